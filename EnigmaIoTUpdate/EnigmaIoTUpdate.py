@@ -1,4 +1,5 @@
 import base64
+import struct
 import paho.mqtt.client as mqtt
 import time
 import hashlib
@@ -7,7 +8,7 @@ import os
 import json
 
 # EnigmaIoTUpdate -f <file.bin> -d <address> -t <basetopic> -u <mqttuser> -P <mqttpass> -s <mqttserver>
-#                       -p <mqttport> <-s> -D <speed>
+#                       -p <mqttport> <-s> -D <speed> -w <window> <-b> <-m>
 
 args = None
 sleepyNode = True
@@ -15,15 +16,28 @@ resultTopic = "/result/#"
 sleepSetTopic = "/set/sleeptime"
 sleepResultTopic = "/result/sleeptime"
 otaSetTopic = "/set/ota"
+otaBinSetTopic = "/set/otabin"
 otaResultTopic = "/result/ota"
 otaOutOfSequenceError = "OTA out of sequence error"
 otaOK = "OTA finished OK"
 # otaLength = 0
 otaFinished = False
+otaStarted = False
+otaWindow = 0
+ackEvent = None
 idx = 0
-
+multicastNodes = {}
+repairs = set()
+nextNew = 1
+
+OTA_STARTED = 0
+OTA_START_ERROR = 1
+OTA_CHECK_OK = 2
+OTA_CHECK_FAIL = 3
 OTA_OUT_OF_SEQUENCE = 4
+OTA_TIMEOUT = 5
 OTA_FINISHED = 6
+OTA_ACK = 7
 
 
 def on_connect(client, userdata, flags, rc):
@@ -36,17 +50,58 @@ def on_connect(client, userdata, flags, rc):
         print("Error connecting. Code =" + str(rc))
         return
 
-    sleep_topic = args.baseTopic + "/" + args.address + resultTopic
-    client.subscribe(sleep_topic)
+    if args.multicast:
+        # Every node answers on its own topic
+        result_topic = args.baseTopic + "/+" + otaResultTopic
+    else:
+        result_topic = args.baseTopic + "/" + args.address + resultTopic
+    client.subscribe(result_topic)
     print("Subscribed")
 
 
+def missing_chunks(next_needed, received, last_sent):
+    # Chunks reported as missing in a selective acknowledge, limited to the ones already sent
+    if received:
+        highest = next_needed + received.bit_length()
+        missing = [i for i in range(next_needed, highest)
+                   if i == next_needed or not received & (1 << (i - next_needed - 1))]
+    else:
+        missing = range(next_needed, next_needed + otaWindow)
+    return [i for i in missing if i <= last_sent]
+
+
+def on_multicast_message(address, payload):
+    status = payload['status']
+    node = multicastNodes.get(address)
+
+    if status == OTA_STARTED:
+        multicastNodes[address] = {'window': int(payload.get('window', 0)), 'done': False, 'ok': False}
+        print("Node %s started OTA" % address)
+    elif node is None:
+        return
+    elif status == OTA_ACK:
+        # Repairs are broadcast, so a chunk lost by many nodes is only sent once
+        repairs.update(missing_chunks(int(payload['next_chunk']), int(payload['received']), nextNew - 1))
+    elif status == OTA_FINISHED:
+        node['done'] = True
+        node['ok'] = True
+        print(" Node %s finished " % address, end='')
+    elif status in (OTA_START_ERROR, OTA_CHECK_FAIL, OTA_TIMEOUT):
+        node['done'] = True
+        print(" Node %s failed: %s " % (address, payload['result']), end='')
+
+
 def on_message(client, userdata, msg):
     global sleepyNode
-    global idx, otaFinished
+    global idx, otaFinished, otaStarted, otaWindow, ackEvent
 
     payload = json.loads(msg.payload)
 
+    if args.multicast:
+        if msg.topic.find(otaResultTopic) >= 0:
+            on_multicast_message(msg.topic.split('/')[1], payload)
+        return
+
     if msg.topic.find(sleepResultTopic) >= 0 and payload['sleeptime'] == 0:
         sleepyNode = False
         print(msg.topic + " " + str(msg.payload))
@@ -55,19 +110,148 @@ def on_message(client, userdata, msg):
 
     if msg.topic.find(otaResultTopic) >= 0:
 
-        if payload['status'] == OTA_OUT_OF_SEQUENCE:
+        if payload['status'] == OTA_STARTED:
+            otaStarted = True
+            otaWindow = int(payload.get('window', 0))
+
+        elif payload['status'] == OTA_OUT_OF_SEQUENCE:
             print(payload['last_chunk'], end='')
             idx = int(payload['last_chunk'])
 
+        elif payload['status'] == OTA_ACK:
+            ackEvent = (int(payload['next_chunk']), int(payload['received']))
+
         elif payload['status'] == OTA_FINISHED:
             print(" OTA Finished ", end='')
             otaFinished = True
 
 
+def publish_chunk(client, ota_topic, i, chunk):
+    # Chunk index is 1 based
+    if args.otaBase64:
+        client.publish(ota_topic, str(i) + "," + base64.b64encode(chunk).decode('ascii'))
+    else:
+        # Binary format is used by gateway as is: little endian chunk index followed by raw chunk data
+        client.publish(args.baseTopic + "/" + args.address + otaBinSetTopic, struct.pack('<H', i) + chunk)
+
+
+def send_sequential(client, ota_topic, chunks, packet_delay):
+    global idx
+
+    # remove to simulate lost message
+    # error = False
+
+    while idx < len(chunks):
+        client.loop()
+        time.sleep(packet_delay)
+        # time.sleep(0.2)
+        # if i not in range(10,13):
+        i = idx + 1
+        publish_chunk(client, ota_topic, i, chunks[idx])
+        idx = idx + 1
+
+        # remove to simulate lost message
+        # if idx == 100 and not error:
+        #    error = True
+        #    idx = idx + 1
+
+        if i % 2 == 0:
+            print(".", end='')
+        if i % 160 == 0:
+            print(" %.f%%" % (i / len(chunks) * 100))
+
+
+def send_windowed(client, ota_topic, chunks, packet_delay):
+    global ackEvent, otaFinished
+
+    num_chunks = len(chunks)
+    next_needed = 1  # First chunk not written by node yet
+    next_new = 1  # First chunk never sent
+    last_progress = time.time()
+    printed = 0
+
+    def send_chunk(i):
+        publish_chunk(client, ota_topic, i, chunks[i - 1])
+        time.sleep(packet_delay)
+
+    while next_needed <= num_chunks and not otaFinished:
+        # Fill window with new chunks
+        while next_new <= num_chunks and next_new < next_needed + otaWindow:
+            send_chunk(next_new)
+            next_new = next_new + 1
+            client.loop(timeout=0)
+            if ackEvent:
+                break
+
+        client.loop(timeout=0.05)
+
+        if ackEvent:
+            prev_needed = next_needed
+            next_needed, received = ackEvent
+            ackEvent = None
+            last_progress = time.time()
+            if received:
+                # Resend only chunks that node reports as missing, below the highest one received
+                highest = next_needed + received.bit_length()
+                for i in range(next_needed, highest):
+                    if i == next_needed or not received & (1 << (i - next_needed - 1)):
+                        send_chunk(i)
+            elif next_needed == prev_needed:
+                # No progress since last acknowledge, all outstanding chunks were lost
+                for i in range(next_needed, next_new):
+                    send_chunk(i)
+            while printed < next_needed - 1:
+                printed = printed + 1
+                if printed % 2 == 0:
+                    print(".", end='')
+                if printed % 160 == 0:
+                    print(" %.f%%" % (printed / num_chunks * 100))
+        elif time.time() - last_progress > 10:
+            print(" No answer from node")
+            return
+
+
+def send_multicast(client, ota_topic, chunks, packet_delay):
+    global nextNew
+
+    num_chunks = len(chunks)
+    last_activity = time.time()
+    printed = 0
+
+    # Nodes only answer when they need a repair, so stream is only slowed down by lost chunks
+    while not all(node['done'] for node in multicastNodes.values()):
+        if repairs:
+            i = min(repairs)
+            repairs.discard(i)
+        elif nextNew <= num_chunks:
+            i = nextNew
+            nextNew = nextNew + 1
+        else:
+            i = 0
+
+        if i:
+            publish_chunk(client, ota_topic, i, chunks[i - 1])
+            last_activity = time.time()
+            time.sleep(packet_delay)
+            while printed < nextNew - 1:
+                printed = printed + 1
+                if printed % 2 == 0:
+                    print(".", end='')
+                if printed % 160 == 0:
+                    print(" %.f%%" % (printed / num_chunks * 100))
+            client.loop(timeout=0)
+        else:
+            client.loop(timeout=0.1)
+            if time.time() - last_activity > 20:
+                print(" No answer from some nodes")
+                return
+
+
 def main():
     global args
     global sleepyNode
     global otaFinished
+    global otaWindow
 
     opt = argparse.ArgumentParser(description='This program allows updating EnigmaIOT node over the air using'
                                               'MQTT messages.')
@@ -120,11 +304,34 @@ def main():
                      default="fast",
                      help="OTA update speed profile: 'fast', 'medium' or 'slow' Throttle this down in case of"
                           "problems with OTA update. Default: %default")
+    opt.add_argument("-w", "--window",
+                     type=int,
+                     dest="otaWindow",
+                     default=16,
+                     help="Number of chunks sent without waiting for node acknowledge. Lost chunks are resent "
+                          "selectively. Node may accept a smaller window. 0 forces sequential update. Default: 16")
+    opt.add_argument("-b", "--base64",
+                     action="store_true",
+                     dest="otaBase64",
+                     default=False,
+                     help="Send chunks as base64 text instead of binary. Needed for gateways that do not support "
+                          "binary OTA topic")
+    opt.add_argument("-m", "--multicast",
+                     action="store_true",
+                     dest="multicast",
+                     default=False,
+                     help="Send firmware once to all nodes with broadcast enabled. Nodes have to be configured "
+                          "as non sleepy before. Device address defaults to broadcast")
 
     # (options, args) = opt.parse_args()
     args = opt.parse_args()
 
-    if not args.address:
+    if args.multicast:
+        if not args.address:
+            args.address = "broadcast"
+        if args.otaWindow <= 0:
+            opt.error('Multicast OTA needs a window')
+    elif not args.address:
         opt.error('Destination address not supplied')
 
     # print(options)
@@ -139,14 +346,10 @@ def main():
 
     with open(args.filename, "rb") as binary_file:
         chunked_file = []
-        encoded_string = []
         n = 212  # Max 215 - 2. Divisible by 4 => 212
 
         for chunk in iter(lambda: binary_file.read(n), b""):
             chunked_file.append(chunk)
-        for chunk in chunked_file:
-            encoded_string.append(base64.b64encode(bytes(chunk)).decode('ascii'))
-        # chunked_string = [encoded_string[i:i+n] for i in range(0, len(encoded_string), n)]
         binary_file.seek(0);
         hash_md5 = hashlib.md5()
         for chunk in iter(lambda: binary_file.read(4096), b""):
@@ -170,53 +373,64 @@ def main():
         time.sleep(1)
 
     # client.loop_start()
-    sleep_topic = args.baseTopic + "/" + args.address + sleepSetTopic
-    client.publish(sleep_topic, "0")
+    if not args.multicast:
+        sleep_topic = args.baseTopic + "/" + args.address + sleepSetTopic
+        client.publish(sleep_topic, "0")
 
-    while sleepyNode:
-        print("Waiting for non sleepy confirmation")
-        client.loop()
-        time.sleep(1)
+        while sleepyNode:
+            print("Waiting for non sleepy confirmation")
+            client.loop()
+            time.sleep(1)
 
     print("Sending hash: " + hash_md5.hexdigest())
     md5_str = hash_md5.hexdigest()
 
-    # msg 0, file size, number of chunks, md5 checksum
-    print("Sending %d bytes in %d chunks" % (ota_length,len(encoded_string)))
-    client.publish(ota_topic, "0," + str(ota_length) + "," + str(len(encoded_string)) + "," + md5_str)
-
-    # for i in range(0, len(chunked_string), 1):
-    print("Sending file: " + args.filename)
-    global idx
-
-    # remove to simulate lost message
-    # error = False
+    # msg 0, file size, number of chunks, md5 checksum, [window]
+    print("Sending %d bytes in %d chunks" % (ota_length,len(chunked_file)))
+    start_msg = "0," + str(ota_length) + "," + str(len(chunked_file)) + "," + md5_str
+    if args.otaWindow > 0:
+        start_msg = start_msg + "," + str(args.otaWindow)
+    client.publish(ota_topic, start_msg)
+
+    if args.multicast:
+        # Collect answers from all nodes
+        for i in range(0, 20):
+            client.loop()
+            time.sleep(0.25)
+        started = [node['window'] for node in multicastNodes.values() if not node['done']]
+        if not started:
+            print("No node started OTA")
+            client.disconnect()
+            return
+        otaWindow = min(started)
+        print("Multicast update to %d nodes. %d chunks window" % (len(started), otaWindow))
+        send_multicast(client, ota_topic, chunked_file, packet_delay)
+        ok_nodes = [address for address, node in multicastNodes.items() if node['ok']]
+        print()
+        print("%d of %d nodes updated OK" % (len(ok_nodes), len(multicastNodes)))
+        client.disconnect()
+        return
 
-    while idx < len(encoded_string):
+    # Nodes that do not support windowed update do not report window and get chunks sequentially
+    for i in range(0, 20):
         client.loop()
-        time.sleep(packet_delay)
-        # time.sleep(0.2)
-        # if i not in range(10,13):
-        i = idx + 1
-        client.publish(ota_topic, str(i) + "," + encoded_string[idx])
-        idx = idx + 1
+        time.sleep(0.25)
+        if otaStarted:
+            break
 
-        # remove to simulate lost message
-        # if idx == 100 and not error:
-        #    error = True
-        #    idx = idx + 1
+    print("Sending file: " + args.filename)
+    if otaWindow > 0:
+        print("Windowed update. %d chunks window" % otaWindow)
+        send_windowed(client, ota_topic, chunked_file, packet_delay)
+    else:
+        send_sequential(client, ota_topic, chunked_file, packet_delay)
 
-        if i % 2 == 0:
-            print(".", end='')
-        if i % 160 == 0:
-            print(" %.f%%" % (i / len(encoded_string) * 100))
-        if i == len(encoded_string):
-            for i in range(0, 40):
-                client.loop()
-                time.sleep(0.5)
-                if otaFinished:
-                    print(" OTA OK ", end='')
-                    break
+    for i in range(0, 40):
+        client.loop()
+        time.sleep(0.5)
+        if otaFinished:
+            print(" OTA OK ", end='')
+            break
 
     print("100%")
     # time.sleep(5)
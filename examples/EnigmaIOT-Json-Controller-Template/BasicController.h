@@ -41,7 +41,7 @@ public:
      * @param command Command type. nodeMessageType_t::DOWNSTREAM_DATA_GET or nodeMessageType_t::DOWNSTREAM_DATA_SET
      * @param payloadEncoding Payload encoding. MSG_PACK is recommended
      */
-	bool processRxCommand (const uint8_t* address, const uint8_t* buffer, uint8_t length, nodeMessageType_t command, nodePayloadEncoding_t payloadEncoding);
+	bool processRxCommand (const uint8_t* address, const uint8_t* buffer, size_t length, nodeMessageType_t command, nodePayloadEncoding_t payloadEncoding);
 
     /**
      * @brief Executes repetitive tasks on controller
@@ -79,7 +79,7 @@ bool sendUplinkData (const uint8_t* data, size_t len, nodePayloadEncoding_t payl
 }
 
 // Called to route incoming messages to your code. Do not modify
-void processRxData (const uint8_t* mac, const uint8_t* buffer, uint8_t length, nodeMessageType_t command, nodePayloadEncoding_t payloadEncoding) {
+void processRxData (const uint8_t* mac, const uint8_t* buffer, size_t length, nodeMessageType_t command, nodePayloadEncoding_t payloadEncoding) {
 	if (controller->processRxCommand (mac, buffer, length, command, payloadEncoding)) {
 		DEBUG_INFO ("Command processed");
 	} else {
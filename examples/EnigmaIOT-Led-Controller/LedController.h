@@ -36,7 +36,7 @@ protected:
 public:
 	void setup (EnigmaIOTNodeClass* node, void* data = NULL);
 
-	bool processRxCommand (const uint8_t* address, const uint8_t* buffer, uint8_t length, nodeMessageType_t command, nodePayloadEncoding_t payloadEncoding);
+	bool processRxCommand (const uint8_t* address, const uint8_t* buffer, size_t length, nodeMessageType_t command, nodePayloadEncoding_t payloadEncoding);
 
 	void loop ();
 
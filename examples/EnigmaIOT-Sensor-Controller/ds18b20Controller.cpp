@@ -18,7 +18,7 @@ constexpr auto CONFIG_FILE = "/customconf.json"; ///< @brief Custom configuratio
 #define ONE_WIRE_BUS 4
 
 
-bool CONTROLLER_CLASS_NAME::processRxCommand (const uint8_t* address, const uint8_t* buffer, uint8_t length, nodeMessageType_t command, nodePayloadEncoding_t payloadEncoding) {
+bool CONTROLLER_CLASS_NAME::processRxCommand (const uint8_t* address, const uint8_t* buffer, size_t length, nodeMessageType_t command, nodePayloadEncoding_t payloadEncoding) {
 	// Process incoming messages here
 	// They are normally encoded as MsgPack so you can confert them to JSON very easily
 	return true;
@@ -31,8 +31,7 @@ bool CONTROLLER_CLASS_NAME::sendCommandResp (const char* command, bool result) {
 }
 
 bool CONTROLLER_CLASS_NAME::sendTemperature (float temp) {
-	const size_t capacity = JSON_OBJECT_SIZE (2);
-	DynamicJsonDocument json (capacity);
+	JsonDocument& json = getJsonDocument ();
 	json["temp"] = temp;
 
 	return sendJson (json);
@@ -37,7 +37,7 @@ protected:
 public:
 	void setup (EnigmaIOTNodeClass* node, void* data = NULL);
 
-	bool processRxCommand (const uint8_t* address, const uint8_t* buffer, uint8_t length, nodeMessageType_t command, nodePayloadEncoding_t payloadEncoding);
+	bool processRxCommand (const uint8_t* address, const uint8_t* buffer, size_t length, nodeMessageType_t command, nodePayloadEncoding_t payloadEncoding);
 
 	void loop ();
 
@@ -76,14 +76,13 @@ protected:
 
     bool sendStartAnouncement () {
         // You can send a 'hello' message when your node starts. Useful to detect unexpected reboot
-        const size_t capacity = JSON_OBJECT_SIZE (10);
-        DynamicJsonDocument json (capacity);
+        JsonDocument& json = getJsonDocument ();
         json["status"] = "start";
         json["device"] = CONTROLLER_NAME;
         char version_buf[10];
         snprintf (version_buf, 10, "%d.%d.%d",
                   ENIGMAIOT_PROT_VERS[0], ENIGMAIOT_PROT_VERS[1], ENIGMAIOT_PROT_VERS[2]);
-        json["version"] = String (version_buf);
+        json["version"] = version_buf;
 
         return sendJson (json);
     }
@@ -20,7 +20,7 @@ const char* buttonKey = "button";
 const char* linkKey = "link";
 const char* bootStateKey = "bstate";
 
-bool CONTROLLER_CLASS_NAME::processRxCommand (const uint8_t* address, const uint8_t* buffer, uint8_t length, nodeMessageType_t command, nodePayloadEncoding_t payloadEncoding) {
+bool CONTROLLER_CLASS_NAME::processRxCommand (const uint8_t* address, const uint8_t* buffer, size_t length, nodeMessageType_t command, nodePayloadEncoding_t payloadEncoding) {
 	// Process incoming messages here
 	// They are normally encoded as MsgPack so you can confert them to JSON very easily
 	if (command != nodeMessageType_t::DOWNSTREAM_DATA_GET && command != nodeMessageType_t::DOWNSTREAM_DATA_SET) {
@@ -136,8 +136,7 @@ bool CONTROLLER_CLASS_NAME::processRxCommand (const uint8_t* address, const uint
 }
 
 bool CONTROLLER_CLASS_NAME::sendRelayStatus () {
-	const size_t capacity = JSON_OBJECT_SIZE (2);
-	DynamicJsonDocument json (capacity);
+	JsonDocument& json = getJsonDocument ();
 
 	json[commandKey] = relayKey;
 	json[relayKey] = config.relayStatus;
@@ -146,8 +145,7 @@ bool CONTROLLER_CLASS_NAME::sendRelayStatus () {
 }
 
 bool CONTROLLER_CLASS_NAME::sendLinkStatus () {
-	const size_t capacity = JSON_OBJECT_SIZE (2);
-	DynamicJsonDocument json (capacity);
+	JsonDocument& json = getJsonDocument ();
 
 	json[commandKey] = linkKey;
 	json[linkKey] = config.linked;
@@ -156,8 +154,7 @@ bool CONTROLLER_CLASS_NAME::sendLinkStatus () {
 }
 
 bool CONTROLLER_CLASS_NAME::sendBootStatus () {
-	const size_t capacity = JSON_OBJECT_SIZE (2);
-	DynamicJsonDocument json (capacity);
+	JsonDocument& json = getJsonDocument ();
 
 	json[commandKey] = bootStateKey;
 	int bootStatus = config.bootStatus;
@@ -264,8 +261,7 @@ void CONTROLLER_CLASS_NAME::loop () {
 
 	if (pushTriggered) { // If button was pushed
 		pushTriggered = false; // Disable push trigger
-		const size_t capacity = JSON_OBJECT_SIZE (2);
-		DynamicJsonDocument json (capacity);
+		JsonDocument& json = getJsonDocument ();
 		json[buttonKey] = config.buttonPin;
 		json["push"] = 1;
 		if (sendJson (json)) {
@@ -0,0 +1,146 @@
+/**
+  * @file EnigmaIOTGatewayBinary.ino
+  * @version 0.9.7
+  * @date 04/02/2021
+  * @author German Martin
+  * @brief Gateway based on EnigmaIoT over ESP-NOW that streams node data to a server as binary frames over UDP or TCP
+  *
+  * Node payloads are not decoded on gateway. Server gets them with their original encoding
+  */
+
+
+#include <Arduino.h>
+
+#include <GwOutput_generic.h>
+#include "GwOutput_binary.h"
+
+#ifdef ESP32
+#include <WiFi.h>
+#include <AsyncTCP.h> // Comment to compile for ESP8266
+#include <Update.h>
+#include <SPIFFS.h>
+#include "esp_system.h"
+#include "esp_event.h"
+#include "soc/soc.h"           // Disable brownout problems
+#include "soc/rtc_cntl_reg.h"  // Disable brownout problems
+#elif defined(ESP8266)
+#include <ESP8266WiFi.h>
+#include <ESPAsyncTCP.h> // Comment to compile for ESP32
+#include <Hash.h>
+#include <SPI.h>
+#endif // ESP32
+
+#include <FS.h>
+
+#include <EnigmaIOTGateway.h>
+#include <helperFunctions.h>
+#include <EnigmaIOTdebug.h>
+#include <espnow_hal.h>
+#include <ArduinoJson.h>
+#include <DNSServer.h>
+#include <ESPAsyncWebServer.h>
+#include <ESPAsyncWiFiManager.h>
+
+#ifndef BUILTIN_LED
+#define BUILTIN_LED 5
+#endif // BUILTIN_LED
+
+#define BLUE_LED BUILTIN_LED
+#define RED_LED BUILTIN_LED
+
+void wifiManagerExit (boolean status) {
+	GwOutput.configManagerExit (status);
+}
+
+void wifiManagerStarted () {
+	GwOutput.configManagerStart (&EnigmaIOTGateway);
+}
+
+void processRxData (uint8_t* mac, uint8_t* buffer, size_t length, uint16_t lostMessages, bool control, gatewayPayloadEncoding_t payload_type, char* nodeName = NULL) {
+	const int PAYLOAD_SIZE = 128;
+	char payload[PAYLOAD_SIZE];
+	int64_t timestamp = EnigmaIOTGateway.getDataTimestamp ();
+
+	if (control) {
+		GwOutput.sendFrame (BINARY_FRAME_CONTROL, mac, timestamp, 0, 0, buffer, length);
+		return;
+	}
+
+	// Payload is sent as it is. Server decodes MsgPack or CayenneLPP
+	if (!GwOutput.outputRawData (mac, timestamp, payload_type, lostMessages, buffer, length)) {
+		DEBUG_WARN ("Error sending data from " MACSTR, MAC2STR (mac));
+	}
+
+	size_t pld_size = snprintf (payload, PAYLOAD_SIZE, "{\"per\":%e,\"lostmessages\":%u,\"totalmessages\":%u,\"packetshour\":%.2f}",
+								EnigmaIOTGateway.getPER (mac),
+								EnigmaIOTGateway.getErrorPackets (mac),
+								EnigmaIOTGateway.getTotalPackets (mac),
+								EnigmaIOTGateway.getPacketsHour (mac));
+	GwOutput.sendFrame (BINARY_FRAME_TEXT, mac, timestamp, GwOutput_data_type::status, 0, (uint8_t*)payload, pld_size);
+}
+
+void newNodeConnected (uint8_t* mac, uint16_t node_id, char* nodeName = NULL) {
+	char macstr[ENIGMAIOT_ADDR_LEN * 3];
+
+	mac2str (mac, macstr);
+	if (!GwOutput.newNodeSend (nodeName ? nodeName : macstr, node_id)) {
+		DEBUG_WARN ("Error sending new node %s", macstr);
+	} else {
+		DEBUG_DBG ("New node %s message sent", macstr);
+	}
+}
+
+void nodeDisconnected (uint8_t* mac, gwInvalidateReason_t reason) {
+	char macstr[ENIGMAIOT_ADDR_LEN * 3];
+
+	mac2str (mac, macstr);
+	if (!GwOutput.nodeDisconnectedSend (macstr, reason)) {
+		DEBUG_WARN ("Error sending node disconnected %s reason %d", macstr, reason);
+	} else {
+		DEBUG_DBG ("Node %s disconnected message sent. Reason %d", macstr, reason);
+	}
+}
+
+void setup () {
+	Serial.begin (115200); Serial.println (); Serial.println ();
+
+#ifdef ESP32
+	// Turn-off the 'brownout detector' to avoid random restarts during wake up,
+	// normally due to bad quality regulator on board
+	WRITE_PERI_REG (RTC_CNTL_BROWN_OUT_REG, 0);
+#endif
+
+	pinMode (BUILTIN_LED, OUTPUT);
+	digitalWrite (BUILTIN_LED, HIGH);
+
+	if (!GwOutput.loadConfig ()) {
+		DEBUG_WARN ("Error reading config file");
+	}
+
+	EnigmaIOTGateway.setRxLed (BLUE_LED);
+	EnigmaIOTGateway.setTxLed (RED_LED);
+	EnigmaIOTGateway.onNewNode (newNodeConnected);
+	EnigmaIOTGateway.onNodeDisconnected (nodeDisconnected);
+	EnigmaIOTGateway.onWiFiManagerStarted (wifiManagerStarted);
+	EnigmaIOTGateway.onWiFiManagerExit (wifiManagerExit);
+	EnigmaIOTGateway.onDataRx (processRxData);
+	EnigmaIOTGateway.begin (&Espnow_hal);
+
+	WiFi.mode (WIFI_AP_STA);
+	WiFi.begin ();
+	EnigmaIOTGateway.configWiFiManager ();
+
+	WiFi.softAP (EnigmaIOTGateway.getNetworkName (), EnigmaIOTGateway.getNetworkKey ());
+
+	DEBUG_INFO ("STA MAC Address: %s", WiFi.macAddress ().c_str ());
+	DEBUG_INFO ("IP address: %s", WiFi.localIP ().toString ().c_str ());
+	DEBUG_INFO ("WiFi Channel: %d", WiFi.channel ());
+	DEBUG_INFO ("Network Name: %s", EnigmaIOTGateway.getNetworkName ());
+
+	GwOutput.begin ();
+}
+
+void loop () {
+	GwOutput.loop ();
+	EnigmaIOTGateway.handle ();
+}
@@ -0,0 +1,389 @@
+/**
+  * @file GwOutput_binary.cpp
+  * @version 0.9.7
+  * @date 04/02/2021
+  * @author German Martin
+  * @brief Binary Gateway output module
+  *
+  * Module to stream EnigmaIOT information to a server as binary frames over UDP or TCP
+  */
+
+#include <Arduino.h>
+#include "GwOutput_binary.h"
+#include <ArduinoJson.h>
+#include <ESPAsyncWebServer.h>
+#include <helperFunctions.h>
+#include <EnigmaIOTdebug.h>
+#include <sys/time.h>
+
+#ifdef ESP32
+#include <SPIFFS.h>
+#endif // ESP32
+
+#include <FS.h>
+
+
+GatewayOutput_binary GwOutput;
+
+/**
+  * @brief Gets current time in ms. If gateway is synchronized to NTP server it is real world time
+  * @return Milliseconds since epoch
+  */
+static int64_t getTimestamp () {
+	struct timeval tv;
+
+	gettimeofday (&tv, NULL);
+	return (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+void GatewayOutput_binary::configManagerStart (EnigmaIOTGatewayClass* enigmaIotGw) {
+	enigmaIotGateway = enigmaIotGw;
+	binServerParam = new AsyncWiFiManagerParameter ("binserver", "Binary output server", binarygw_config.server, 41, "required type=\"text\" maxlength=40");
+	char port[10];
+	itoa (binarygw_config.port, port, 10);
+	binPortParam = new AsyncWiFiManagerParameter ("binport", "Binary output port", port, 6, "required type=\"number\" min=\"0\" max=\"65535\" step=\"1\"");
+	binProtocolParam = new AsyncWiFiManagerParameter ("binproto", "Protocol (udp/tcp)", binarygw_config.tcp ? "tcp" : "udp", 4, "required type=\"text\" pattern=\"^(udp|tcp)$\"");
+
+	enigmaIotGateway->addWiFiManagerParameter (binServerParam);
+	enigmaIotGateway->addWiFiManagerParameter (binPortParam);
+	enigmaIotGateway->addWiFiManagerParameter (binProtocolParam);
+}
+
+bool GatewayOutput_binary::saveConfig () {
+	if (!FILESYSTEM.begin ()) {
+		DEBUG_WARN ("Error opening filesystem");
+	}
+	DEBUG_DBG ("Filesystem opened");
+
+	File configFile = FILESYSTEM.open (BINARY_CONFIG_FILE, "w");
+	if (!configFile) {
+		DEBUG_WARN ("Failed to open config file %s for writing", BINARY_CONFIG_FILE);
+		return false;
+	} else {
+		DEBUG_DBG ("%s opened for writting", BINARY_CONFIG_FILE);
+	}
+
+	const size_t capacity = JSON_OBJECT_SIZE (3) + 80;
+	DynamicJsonDocument doc (capacity);
+
+	doc["server"] = binarygw_config.server;
+	doc["port"] = binarygw_config.port;
+	doc["protocol"] = binarygw_config.tcp ? "tcp" : "udp";
+
+	if (serializeJson (doc, configFile) == 0) {
+		DEBUG_ERROR ("Failed to write to file");
+		configFile.close ();
+		return false;
+	}
+
+	String output;
+	serializeJsonPretty (doc, output);
+
+	DEBUG_DBG ("%s", output.c_str ());
+
+	configFile.flush ();
+	configFile.close ();
+	DEBUG_DBG ("Binary output configuration saved to flash. %u bytes", configFile.size ());
+	return true;
+}
+
+bool GatewayOutput_binary::loadConfig () {
+	bool json_correct = false;
+
+	if (!FILESYSTEM.begin ()) {
+		DEBUG_WARN ("Error starting filesystem. Formatting");
+		FILESYSTEM.format ();
+		WiFi.disconnect ();
+	}
+
+	if (FILESYSTEM.exists (BINARY_CONFIG_FILE)) {
+
+		DEBUG_DBG ("Opening %s file", BINARY_CONFIG_FILE);
+		File configFile = FILESYSTEM.open (BINARY_CONFIG_FILE, "r");
+		if (configFile) {
+			DEBUG_DBG ("%s opened. %u bytes", BINARY_CONFIG_FILE, configFile.size ());
+
+			const size_t capacity = JSON_OBJECT_SIZE (3) + 80;
+			DynamicJsonDocument doc (capacity);
+
+			DeserializationError error = deserializeJson (doc, configFile);
+
+			if (error) {
+				DEBUG_ERROR ("Failed to parse file");
+			} else {
+				DEBUG_DBG ("JSON file parsed");
+			}
+
+			if (doc.containsKey ("server") && doc.containsKey ("port") && doc.containsKey ("protocol")) {
+				json_correct = true;
+			}
+
+			strncpy (binarygw_config.server, doc["server"] | "", sizeof (binarygw_config.server) - 1);
+			binarygw_config.server[sizeof (binarygw_config.server) - 1] = '\0';
+			binarygw_config.port = doc["port"] | BINARY_OUTPUT_DEFAULT_PORT;
+			binarygw_config.tcp = !strcmp (doc["protocol"] | "udp", "tcp");
+
+			configFile.close ();
+			if (json_correct) {
+				DEBUG_INFO ("Binary output module configuration successfuly read");
+			}
+			DEBUG_DBG ("==== Binary output Configuration ====");
+			DEBUG_DBG ("Server: %s", binarygw_config.server);
+			DEBUG_DBG ("Port: %d", binarygw_config.port);
+			DEBUG_DBG ("Protocol: %s", binarygw_config.tcp ? "TCP" : "UDP");
+		} else {
+			DEBUG_WARN ("Error opening %s", BINARY_CONFIG_FILE);
+		}
+	} else {
+		DEBUG_WARN ("%s do not exist", BINARY_CONFIG_FILE);
+	}
+
+	return json_correct;
+}
+
+void GatewayOutput_binary::configManagerExit (bool status) {
+	DEBUG_INFO ("==== Config Portal Binary output result ====");
+	DEBUG_INFO ("Server: %s", binServerParam->getValue ());
+	DEBUG_INFO ("Port: %s", binPortParam->getValue ());
+	DEBUG_INFO ("Protocol: %s", binProtocolParam->getValue ());
+	DEBUG_INFO ("Status: %s", status ? "true" : "false");
+
+	if (status && EnigmaIOTGateway.getShouldSave ()) {
+		strncpy (binarygw_config.server, binServerParam->getValue (), sizeof (binarygw_config.server) - 1);
+		binarygw_config.server[sizeof (binarygw_config.server) - 1] = '\0';
+		binarygw_config.port = atoi (binPortParam->getValue ());
+		binarygw_config.tcp = !strcmp (binProtocolParam->getValue (), "tcp");
+		if (!saveConfig ()) {
+			DEBUG_ERROR ("Error writting binary output config to filesystem.");
+		} else {
+			DEBUG_INFO ("Configuration stored");
+		}
+	} else {
+		DEBUG_DBG ("Configuration does not need to be saved");
+	}
+
+	delete (binServerParam);
+	delete (binPortParam);
+	delete (binProtocolParam);
+}
+
+bool GatewayOutput_binary::begin () {
+	if (!txBuffer) {
+		txBuffer = (uint8_t*)malloc (BINARY_OUTPUT_BUFFER_SIZE);
+		if (!txBuffer) {
+			DEBUG_ERROR ("Cannot allocate binary output buffer");
+			return false;
+		}
+	}
+	txLength = 0;
+	txFrames = 0;
+	serverResolved = false;
+	lastConnectAttempt = 0;
+	started = true;
+	DEBUG_INFO ("Binary output to %s:%d over %s", binarygw_config.server, binarygw_config.port, binarygw_config.tcp ? "TCP" : "UDP");
+	connect ();
+	return true;
+}
+
+bool GatewayOutput_binary::connect () {
+	if (serverResolved && (!binarygw_config.tcp || client.connected ())) {
+		return true;
+	}
+	if (!started || !WiFi.isConnected ()) {
+		return false;
+	}
+	if (lastConnectAttempt && millis () - lastConnectAttempt < BINARY_OUTPUT_RECONNECT_TIME) {
+		return false;
+	}
+	lastConnectAttempt = millis ();
+
+	if (!serverResolved) {
+		if (!WiFi.hostByName (binarygw_config.server, serverIP)) {
+			DEBUG_WARN ("Cannot resolve binary output server %s", binarygw_config.server);
+			return false;
+		}
+		serverResolved = true;
+		DEBUG_DBG ("Binary output server %s is %s", binarygw_config.server, serverIP.toString ().c_str ());
+	}
+
+	if (binarygw_config.tcp) {
+		if (!client.connect (serverIP, binarygw_config.port)) {
+			DEBUG_WARN ("Cannot connect to binary output server %s:%d", binarygw_config.server, binarygw_config.port);
+			return false;
+		}
+		// Frames are already grouped on buffer
+		client.setNoDelay (true);
+		DEBUG_INFO ("Connected to binary output server %s:%d", binarygw_config.server, binarygw_config.port);
+	}
+	return true;
+}
+
+bool GatewayOutput_binary::flush () {
+	bool result = false;
+
+	if (!txLength) {
+		return true;
+	}
+
+	if (connect ()) {
+		if (binarygw_config.tcp) {
+			size_t written = client.write (txBuffer, txLength);
+			if (written == txLength) {
+				result = true;
+			} else {
+				// A partial frame would break stream framing. Start again on a new connection
+				DEBUG_WARN ("Binary output TCP write error. %u of %u bytes written", written, txLength);
+				client.stop ();
+			}
+		} else {
+			result = udp.beginPacket (serverIP, binarygw_config.port)
+				&& udp.write (txBuffer, txLength) == txLength
+				&& udp.endPacket ();
+			if (!result) {
+				DEBUG_WARN ("Binary output UDP send error");
+			}
+		}
+	}
+
+	if (result) {
+		stats.framesSent += txFrames;
+		stats.bytesSent += txLength;
+		stats.flushes++;
+		DEBUG_DBG ("Sent %d binary frames. %u bytes", txFrames, txLength);
+	} else {
+		stats.framesDropped += txFrames;
+	}
+	txLength = 0;
+	txFrames = 0;
+	return result;
+}
+
+bool GatewayOutput_binary::resolveAddress (const char* address, uint8_t* mac) {
+	if (address && str2mac (address, mac)) {
+		return true;
+	}
+	memset (mac, 0, ENIGMAIOT_ADDR_LEN);
+	if (address) {
+		EnigmaIOTGateway.lock (); // Output runs on its own task in pipelined mode
+		Node* node = EnigmaIOTGateway.getNodes ()->getNodeFromName (address);
+		if (node) {
+			memcpy (mac, node->getMacAddress (), ENIGMAIOT_ADDR_LEN);
+		}
+		EnigmaIOTGateway.unlock ();
+	}
+	return false;
+}
+
+bool GatewayOutput_binary::sendFrame (binaryFrameType_t type, const uint8_t* address, int64_t timestamp, uint8_t encoding,
+									  uint16_t lostMessages, const uint8_t* payload, size_t length) {
+	binary_frame_header_t header;
+	size_t frameLength = BINARY_FRAME_HEADER_LENGTH + length;
+
+	if (!started || !txBuffer) {
+		return false;
+	}
+	if (frameLength > BINARY_OUTPUT_BUFFER_SIZE) {
+		DEBUG_WARN ("Binary frame too long: %u bytes", frameLength);
+		stats.framesDropped++;
+		return false;
+	}
+	if (txLength + frameLength > BINARY_OUTPUT_BUFFER_SIZE) {
+		flush ();
+	}
+	if (!txLength) {
+		firstFrameTime = millis ();
+	}
+
+	header.length = frameLength - sizeof (header.length);
+	header.frameType = type;
+	if (address) {
+		memcpy (header.address, address, ENIGMAIOT_ADDR_LEN);
+	} else {
+		memset (header.address, 0, ENIGMAIOT_ADDR_LEN);
+	}
+	header.timestamp = timestamp;
+	header.encoding = encoding;
+	header.lostMessages = lostMessages;
+
+	memcpy (txBuffer + txLength, &header, BINARY_FRAME_HEADER_LENGTH);
+	if (length) {
+		memcpy (txBuffer + txLength + BINARY_FRAME_HEADER_LENGTH, payload, length);
+	}
+	txLength += frameLength;
+	txFrames++;
+	return true;
+}
+
+void GatewayOutput_binary::loop () {
+	if (!started) {
+		return;
+	}
+	if (txLength && millis () - firstFrameTime >= BINARY_OUTPUT_FLUSH_TIME) {
+		flush ();
+	}
+	if (binarygw_config.tcp) {
+		if (client.connected ()) {
+			// Server is not expected to answer. Anything received is discarded so that it does not fill receive window
+			while (client.available ()) {
+				client.read ();
+			}
+		} else {
+			connect ();
+		}
+	}
+}
+
+bool GatewayOutput_binary::outputDataSend (char* address, char* data, size_t length, GwOutput_data_type_t type) {
+	uint8_t mac[ENIGMAIOT_ADDR_LEN];
+
+	resolveAddress (address, mac);
+	return sendFrame (BINARY_FRAME_TEXT, mac, getTimestamp (), type, 0, (uint8_t*)data, length);
+}
+
+int GatewayOutput_binary::outputDataSendBatch (gw_output_data_t* messages, int count) {
+	size_t batchLength = 0;
+	int sent = 0;
+
+	for (int i = 0; i < count; i++) {
+		batchLength += BINARY_FRAME_HEADER_LENGTH + messages[i].length;
+	}
+	if (txLength && txLength + batchLength > BINARY_OUTPUT_BUFFER_SIZE) {
+		flush ();
+	}
+	for (int i = 0; i < count; i++) {
+		if (outputDataSend (messages[i].address, messages[i].data, messages[i].length, messages[i].type)) {
+			sent++;
+		}
+	}
+	return sent;
+}
+
+bool GatewayOutput_binary::outputControlSend (char* address, uint8_t* data, size_t length) {
+	uint8_t mac[ENIGMAIOT_ADDR_LEN];
+
+	resolveAddress (address, mac);
+	return sendFrame (BINARY_FRAME_CONTROL, mac, getTimestamp (), 0, 0, data, length);
+}
+
+bool GatewayOutput_binary::newNodeSend (char* address, uint16_t node_id) {
+	uint8_t mac[ENIGMAIOT_ADDR_LEN];
+	uint8_t payload[sizeof (uint16_t) + NODE_NAME_LENGTH];
+	size_t length = sizeof (uint16_t);
+
+	memcpy (payload, &node_id, sizeof (uint16_t));
+	if (!resolveAddress (address, mac) && address) {
+		// Address is node name
+		size_t nameLength = strnlen (address, NODE_NAME_LENGTH);
+		memcpy (payload + length, address, nameLength);
+		length += nameLength;
+	}
+	return sendFrame (BINARY_FRAME_NEW_NODE, mac, getTimestamp (), 0, 0, payload, length);
+}
+
+bool GatewayOutput_binary::nodeDisconnectedSend (char* address, gwInvalidateReason_t reason) {
+	uint8_t mac[ENIGMAIOT_ADDR_LEN];
+	uint8_t payload = reason;
+
+	resolveAddress (address, mac);
+	return sendFrame (BINARY_FRAME_DISCONNECTED, mac, getTimestamp (), 0, 0, &payload, sizeof (payload));
+}
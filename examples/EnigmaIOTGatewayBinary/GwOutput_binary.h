@@ -0,0 +1,261 @@
+/**
+  * @file GwOutput_binary.h
+  * @version 0.9.7
+  * @date 04/02/2021
+  * @author German Martin
+  * @brief Binary Gateway output module
+  *
+  * Streams gateway events to a server as length prefixed binary frames, over UDP datagrams or a persistent TCP connection.
+  * Node payloads are sent with their original encoding, so that server decodes MsgPack or CayenneLPP itself and gateway
+  * does not spend time transcoding to JSON
+  */
+
+#ifndef _GWOUT_BINARY_h
+#define _GWOUT_BINARY_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include <EnigmaIOTGateway.h>
+#include <GwOutput_generic.h>
+
+#ifdef ESP32
+#include <WiFi.h>
+#include <WiFiUdp.h>
+#elif defined(ESP8266)
+#include <ESP8266WiFi.h>
+#include <WiFiUdp.h>
+#include <WiFiClient.h>
+#endif // ESP32
+
+#include <ESPAsyncWiFiManager.h>
+
+#ifndef BINARY_OUTPUT_BUFFER_SIZE
+const size_t BINARY_OUTPUT_BUFFER_SIZE = 1400; ///< @brief Frames are grouped up to this size before sending. Fits on a single UDP datagram without fragmentation
+#endif // BINARY_OUTPUT_BUFFER_SIZE
+#ifndef BINARY_OUTPUT_FLUSH_TIME
+const uint32_t BINARY_OUTPUT_FLUSH_TIME = 50; ///< @brief Maximum time in ms a frame waits on buffer for more frames
+#endif // BINARY_OUTPUT_FLUSH_TIME
+#ifndef BINARY_OUTPUT_RECONNECT_TIME
+const uint32_t BINARY_OUTPUT_RECONNECT_TIME = 5000; ///< @brief Time in ms between server connection or name resolution attempts
+#endif // BINARY_OUTPUT_RECONNECT_TIME
+#ifndef BINARY_OUTPUT_DEFAULT_PORT
+const int BINARY_OUTPUT_DEFAULT_PORT = 5684; ///< @brief Default server port
+#endif // BINARY_OUTPUT_DEFAULT_PORT
+
+constexpr auto BINARY_CONFIG_FILE = "/binaryout.json"; ///< @brief Binary output configuration file name
+
+/**
+  * @brief Frame types
+  */
+typedef enum {
+	BINARY_FRAME_DATA = 0x01, /**< Node data as it was received. Encoding is `gatewayPayloadEncoding_t`*/
+	BINARY_FRAME_CONTROL = 0x02, /**< Control message from node*/
+	BINARY_FRAME_TEXT = 0x03, /**< Text message given to `outputDataSend()`. Encoding is `GwOutput_data_type_t`*/
+	BINARY_FRAME_NEW_NODE = 0x04, /**< Node registration. Payload is node id (2) followed by node name, if any*/
+	BINARY_FRAME_DISCONNECTED = 0x05 /**< Node disconnection. Payload is `gwInvalidateReason_t` (1)*/
+} binaryFrameType_t;
+
+/**
+  * @brief Frame header. Multibyte fields are little endian
+  *
+  * -----------------------------------------------------------------------------------------------------------
+  *| length (2) | frameType (1) | address (6) | timestamp (8) | encoding (1) | lostMessages (2) | payload (....) |
+  * -----------------------------------------------------------------------------------------------------------
+  *
+  * Length counts every byte after length field, so that a stream may be split without knowing frame types.
+  * Address is all zeros for gateway own messages
+  */
+typedef struct __attribute__ ((packed, aligned (1))) {
+	uint16_t length; /**< Frame length, not including this field*/
+	uint8_t frameType; /**< Frame type, from `binaryFrameType_t`*/
+	uint8_t address[ENIGMAIOT_ADDR_LEN]; /**< Node address*/
+	int64_t timestamp; /**< Gateway time when message was received, in ms since epoch if gateway has time*/
+	uint8_t encoding; /**< Payload encoding. Meaning depends on frame type*/
+	uint16_t lostMessages; /**< Messages lost since previous data message of this node*/
+} binary_frame_header_t;
+
+constexpr auto BINARY_FRAME_HEADER_LENGTH = sizeof (binary_frame_header_t); ///< @brief Header length, before payload
+
+typedef struct {
+	char server[41]; /**< Server name or IP address*/
+	int port = BINARY_OUTPUT_DEFAULT_PORT; /**< Server port*/
+	bool tcp = false; /**< Use a TCP connection instead of UDP datagrams*/
+} binarygw_config_t;
+
+typedef struct {
+	uint32_t framesSent; /**< Frames sent to server*/
+	uint32_t framesDropped; /**< Frames lost because server was not reachable or frame did not fit*/
+	uint32_t bytesSent; /**< Bytes sent to server*/
+	uint32_t flushes; /**< Number of datagrams or TCP writes*/
+} binary_output_stats_t;
+
+class GatewayOutput_binary : public GatewayOutput_generic {
+protected:
+	AsyncWiFiManagerParameter* binServerParam; ///< @brief Configuration field for server name
+	AsyncWiFiManagerParameter* binPortParam; ///< @brief Configuration field for server port
+	AsyncWiFiManagerParameter* binProtocolParam; ///< @brief Configuration field for transport protocol
+
+	binarygw_config_t binarygw_config; ///< @brief Server configuration data
+	WiFiUDP udp; ///< @brief UDP socket
+	WiFiClient client; ///< @brief Persistent TCP connection
+	IPAddress serverIP; ///< @brief Resolved server address
+	bool serverResolved = false; ///< @brief `true` if `serverIP` is valid
+	uint32_t lastConnectAttempt = 0; ///< @brief Value of `millis()` on last connection or resolution attempt
+	bool started = false; ///< @brief `true` after `begin()`
+
+	uint8_t* txBuffer = NULL; ///< @brief Frames waiting to be sent
+	size_t txLength = 0; ///< @brief Bytes used on `txBuffer`
+	int txFrames = 0; ///< @brief Number of frames on `txBuffer`
+	uint32_t firstFrameTime = 0; ///< @brief Value of `millis()` when oldest frame on `txBuffer` was added
+	binary_output_stats_t stats; ///< @brief Output counters
+
+	/**
+	  * @brief Saves output module configuration
+	  * @return Returns `true` if save was successful. `false` otherwise
+	  */
+	bool saveConfig ();
+
+	/**
+	  * @brief Resolves server name and, for TCP, connects to it. Attempts are limited to one every `BINARY_OUTPUT_RECONNECT_TIME`
+	  * @return Returns `true` if server is reachable
+	  */
+	bool connect ();
+
+	/**
+	  * @brief Sends all buffered frames as a single UDP datagram or TCP write
+	  * @return Returns `true` if frames were sent. If not they are dropped
+	  */
+	bool flush ();
+
+	/**
+	  * @brief Gets node address from an address string, that may be a MAC address or a node name
+	  * @param address Address string
+	  * @param mac Buffer to write node address to. It is set to zeros if node is not found
+	  * @return Returns `true` if address string is a MAC address, `false` if it is a node name or it is not valid
+	  */
+	bool resolveAddress (const char* address, uint8_t* mac);
+
+public:
+	GatewayOutput_binary () {
+		binarygw_config.server[0] = '\0';
+		memset (&stats, 0, sizeof (stats));
+	}
+
+	/**
+	  * @brief Called when wifi manager starts config portal
+	  * @param enigmaIotGw Pointer to EnigmaIOT gateway instance
+	  */
+	void configManagerStart (EnigmaIOTGatewayClass* enigmaIotGw);
+
+	/**
+	  * @brief Called when wifi manager exits config portal
+	  * @param status `true` if configuration was successful
+	  */
+	void configManagerExit (bool status);
+
+	/**
+	  * @brief Starts output module
+	  * @return Returns `true` if successful. `false` otherwise
+	  */
+	bool begin ();
+
+	/**
+	  * @brief Loads output module configuration
+	  * @return Returns `true` if load was successful. `false` otherwise
+	  */
+	bool loadConfig ();
+
+	/**
+	  * @brief Adds a frame to output buffer. Buffer is sent when next frame does not fit or after `BINARY_OUTPUT_FLUSH_TIME`
+	  * @param type Frame type
+	  * @param address Node address. `NULL` for gateway own messages
+	  * @param timestamp Time when message was received
+	  * @param encoding Payload encoding
+	  * @param lostMessages Lost messages counter
+	  * @param payload Frame payload
+	  * @param length Payload length
+	  * @return Returns `true` if frame was buffered. `false` if it does not fit on a buffer or output is not started
+	  */
+	bool sendFrame (binaryFrameType_t type, const uint8_t* address, int64_t timestamp, uint8_t encoding,
+					uint16_t lostMessages, const uint8_t* payload, size_t length);
+
+	/**
+	  * @brief Sends node data without decoding it. To be called from data callback
+	  * @param address Node address
+	  * @param timestamp Time when message was received, usually `EnigmaIOTGateway.getDataTimestamp()`
+	  * @param encoding Payload encoding as node sent it
+	  * @param lostMessages Lost messages counter
+	  * @param data Payload
+	  * @param length Payload length
+	  * @return Returns `true` if frame was buffered. `false` otherwise
+	  */
+	bool outputRawData (const uint8_t* address, int64_t timestamp, gatewayPayloadEncoding_t encoding,
+						uint16_t lostMessages, const uint8_t* data, size_t length) {
+		return sendFrame (BINARY_FRAME_DATA, address, timestamp, encoding, lostMessages, data, length);
+	}
+
+	 /**
+	  * @brief Send control data from nodes
+	  * @param address Node Address
+	  * @param data Message data buffer
+	  * @param length Data buffer length
+	  * @return Returns `true` if sending was successful. `false` otherwise
+	  */
+	bool outputControlSend (char* address, uint8_t* data, size_t length);
+
+	 /**
+	  * @brief Send new node notification
+	  * @param address Node Address
+	  * @param node_id Node Id
+	  * @return Returns `true` if sending was successful. `false` otherwise
+	  */
+	bool newNodeSend (char* address, uint16_t node_id);
+
+	 /**
+	  * @brief Send node disconnection notification
+	  * @param address Node Address
+	  * @param reason Disconnection reason code
+	  * @return Returns `true` if sending was successful. `false` otherwise
+	  */
+	bool nodeDisconnectedSend (char* address, gwInvalidateReason_t reason);
+
+	 /**
+	  * @brief Send data from nodes
+	  * @param address Node Address
+	  * @param data Message data buffer
+	  * @param length Data buffer length
+	  * @param type Type of message
+	  * @return Returns `true` if sending was successful. `false` otherwise
+	  */
+	bool outputDataSend (char* address, char* data, size_t length, GwOutput_data_type_t type = data);
+
+	 /**
+	  * @brief Send several data messages at once. Buffer is flushed first if they do not fit on it together,
+	  * so that a batch is sent on a single datagram whenever possible
+	  * @param messages Array of messages
+	  * @param count Number of messages
+	  * @return Number of messages that were buffered
+	  */
+	int outputDataSendBatch (gw_output_data_t* messages, int count);
+
+	 /**
+	  * @brief Should be called regularly for module management
+	  */
+	void loop ();
+
+	/**
+	  * @brief Gets output counters
+	  * @return Sent and dropped frames, bytes and number of writes
+	  */
+	const binary_output_stats_t* getStats () {
+		return &stats;
+	}
+};
+
+extern GatewayOutput_binary GwOutput;
+
+#endif // _GWOUT_BINARY_h
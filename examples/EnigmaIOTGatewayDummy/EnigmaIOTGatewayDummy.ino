@@ -113,7 +113,7 @@ void processRxControlData (char* macStr, uint8_t* data, uint8_t length) {
 	}
 }
 
-void processRxData (uint8_t* mac, uint8_t* buffer, uint8_t length, uint16_t lostMessages, bool control, gatewayPayloadEncoding_t payload_type, char* nodeName = NULL) {
+void processRxData (uint8_t* mac, uint8_t* buffer, size_t length, uint16_t lostMessages, bool control, gatewayPayloadEncoding_t payload_type, char* nodeName = NULL) {
 	//uint8_t *addr = mac;
 	size_t pld_size;
 	const int PAYLOAD_SIZE = 512;
@@ -30,9 +30,9 @@
 
 #include <ArduinoOTA.h>
 
-#include <CayenneLPP.h>
 
 #include <EnigmaIOTGateway.h>
+#include <payloadTranscoder.h>
 #include <helperFunctions.h>
 #include <EnigmaIOTdebug.h>
 #include <espnow_hal.h>
@@ -68,6 +68,7 @@ ETSTimer connectionLedTimer;
 
 const int connectionLed = LED_BUILTIN;
 bool connectionLedFlashing = false;
+bool pipelined = false; // `true` if gateway runs on its own task
 
 bool restartRequested = false;
 time_t restartRequestTime;
@@ -172,12 +173,17 @@ void processRxControlData (char* macStr, uint8_t* data, uint8_t length) {
 	if (data) {
 		if (data[0] == VERSION_ANS && length >= 4) {
 			DEBUG_INFO ("Version message: %d.%d.%d", data[1], data[2], data[3]);
+			EnigmaIOTGateway.lock (); // Callbacks run on output task in pipelined mode
 			Node* node = EnigmaIOTGateway.getNodes ()->getNodeFromName (macStr);
 			if (node) {
 				node->setVersion (data[1], data[2], data[3]);
 			}
+			EnigmaIOTGateway.unlock ();
 		}
+		// Output updates node RSSI
+		EnigmaIOTGateway.lock ();
 		GwOutput.outputControlSend (macStr, data, length);
+		EnigmaIOTGateway.unlock ();
 	}
 }
 
@@ -203,7 +209,7 @@ void doRestart () {
 
 }
 
-void processRxData (uint8_t* mac, uint8_t* buffer, uint8_t length, uint16_t lostMessages, bool control, gatewayPayloadEncoding_t payload_type, char* nodeName = NULL) {
+void processRxData (uint8_t* mac, uint8_t* buffer, size_t length, uint16_t lostMessages, bool control, gatewayPayloadEncoding_t payload_type, char* nodeName = NULL) {
 	uint8_t* addr = mac;
 	size_t pld_size = 0;
 	const int PAYLOAD_SIZE = 1024; // Max MQTT payload in PubSubClient library normal operation.
@@ -220,28 +226,18 @@ void processRxData (uint8_t* mac, uint8_t* buffer, uint8_t length, uint16_t lost
 	//char* netName = EnigmaIOTGateway.getNetworkName ();
 	if (payload_type == CAYENNELPP) {
 		DEBUG_INFO ("CayenneLPP message");
-		const int capacity = JSON_ARRAY_SIZE (25) + 25 * JSON_OBJECT_SIZE (4);
-		DynamicJsonDocument jsonBuffer (capacity);
-		JsonArray root = jsonBuffer.createNestedArray ();
-		CayenneLPP cayennelpp (MAX_DATA_PAYLOAD_SIZE);
-
-		cayennelpp.decode ((uint8_t*)buffer, length, root);
-		uint8_t error = cayennelpp.getError ();
-		if (error != LPP_ERROR_OK) {
-			DEBUG_ERROR ("Error decoding CayenneLPP data: %d", error);
+		pld_size = cayenneLppToJson (buffer, length, payload, PAYLOAD_SIZE);
+		if (!pld_size) {
+			DEBUG_ERROR ("Error decoding CayenneLPP data");
 			return;
 		}
-		pld_size = serializeJson (root, payload, PAYLOAD_SIZE);
 	} else if (payload_type == MSG_PACK) {
 		DEBUG_INFO ("MsgPack message");
-		const int capacity = JSON_ARRAY_SIZE (25) + 25 * JSON_OBJECT_SIZE (4);
-		DynamicJsonDocument jsonBuffer (capacity);
-		DeserializationError error = deserializeMsgPack (jsonBuffer, buffer, length);
-		if (error != DeserializationError::Ok) {
-			DEBUG_ERROR ("Error decoding MSG Pack data: %s", error.c_str ());
+		pld_size = msgPackToJson (buffer, length, payload, PAYLOAD_SIZE);
+		if (!pld_size) {
+			DEBUG_ERROR ("Error decoding MSG Pack data");
 			return;
 		}
-		pld_size = serializeJson (jsonBuffer, payload, PAYLOAD_SIZE);
 	} else if (payload_type == RAW) {
 		DEBUG_INFO ("RAW message");
 		if (length <= PAYLOAD_SIZE) {
@@ -253,27 +249,97 @@ void processRxData (uint8_t* mac, uint8_t* buffer, uint8_t length, uint16_t lost
 		}
 	}
 
-	GwOutput.outputDataSend (nodeName ? nodeName : mac_str, payload, pld_size);
-	DEBUG_INFO ("Published data message from %s, length %d: %s, Encoding 0x%02X", nodeName ? nodeName : mac_str, pld_size, payload, payload_type);
+	// Data, lost messages and status are sent together
+	char lostPayload[32];
+#if ENABLE_STATUS_MESSAGES
+	const int STATUS_SIZE = 128;
+	char statusPayload[STATUS_SIZE];
+#endif
+	gw_output_data_t messages[3];
+	int count = 0;
+	char* address = nodeName ? nodeName : mac_str;
+
+	messages[count++] = { address, payload, pld_size, GwOutput_data_type::data };
 	if (lostMessages > 0) {
-		pld_size = snprintf (payload, PAYLOAD_SIZE, "{\"lostMessages\":%u}", lostMessages);
-		GwOutput.outputDataSend (nodeName ? nodeName : mac_str, payload, pld_size, GwOutput_data_type::lostmessages);
-		DEBUG_INFO ("Published MQTT from %s: %s", nodeName ? nodeName : mac_str, payload);
+		size_t lostSize = snprintf (lostPayload, sizeof (lostPayload), "{\"lostMessages\":%u}", lostMessages);
+		messages[count++] = { address, lostPayload, lostSize, GwOutput_data_type::lostmessages };
 	}
 #if ENABLE_STATUS_MESSAGES
-	pld_size = snprintf (payload, PAYLOAD_SIZE, "{\"per\":%e,\"lostmessages\":%u,\"totalmessages\":%u,\"packetshour\":%.2f}",
-						 EnigmaIOTGateway.getPER ((uint8_t*)mac),
-						 EnigmaIOTGateway.getErrorPackets ((uint8_t*)mac),
-						 EnigmaIOTGateway.getTotalPackets ((uint8_t*)mac),
-						 EnigmaIOTGateway.getPacketsHour ((uint8_t*)mac));
-	GwOutput.outputDataSend (nodeName ? nodeName : mac_str, payload, pld_size, GwOutput_data_type::status);
-	DEBUG_INFO ("Published MQTT from %s: %s", nodeName ? nodeName : mac_str, payload);
+	EnigmaIOTGateway.lock ();
+	Node* node = EnigmaIOTGateway.getNodes ()->getNodeFromMAC (mac);
+	if (node) {
+		if (node->packetNumber > 0) {
+			node->per = (double)node->packetErrors / (double)node->packetNumber;
+		}
+		size_t statusSize = snprintf (statusPayload, STATUS_SIZE, "{\"per\":%e,\"lostmessages\":%u,\"totalmessages\":%u,\"packetshour\":%.2f}",
+									  node->per,
+									  node->packetErrors,
+									  node->packetNumber + node->packetErrors,
+									  node->packetsHour);
+		messages[count++] = { address, statusPayload, statusSize, GwOutput_data_type::status };
+	}
+	EnigmaIOTGateway.unlock ();
 #endif
+	int sent = GwOutput.outputDataSendBatch (messages, count);
+	DEBUG_INFO ("Published %d of %d messages from %s. Data length %d: %s, Encoding 0x%02X", sent, count, address, pld_size, payload, payload_type);
 }
 
+#if ENABLE_AGGREGATED_STATUS
+void sendNodesStatus () {
+	const int PAYLOAD_SIZE = 1024; // Max MQTT payload in PubSubClient library normal operation.
+	const int ENTRY_SIZE = 128;
+	const char* PAYLOAD_END = "]}";
+	char payload[PAYLOAD_SIZE];
+	char entry[ENTRY_SIZE];
+	char mac_str[ENIGMAIOT_ADDR_LEN * 3];
+	char addr[] = "gateway";
+	size_t pld_size;
+	unsigned int page = 0;
+	int nodesInPage = 0;
+
+	// Status of all nodes is sent in as few messages as possible. A new page is started when payload is full
+	pld_size = snprintf (payload, PAYLOAD_SIZE, "{\"page\":%u,\"nodes\":[", page);
+
+	// Output only queues messages, so node list is locked just for a short time
+	EnigmaIOTGateway.lock ();
+	Node* node = EnigmaIOTGateway.getNodes ()->getNextActiveNode (NULL);
+	while (node) {
+		if (node->packetNumber > 0) {
+			node->per = (double)node->packetErrors / (double)node->packetNumber;
+		}
+		char* nodeName = node->getNodeName ();
+		size_t entrySize = snprintf (entry, ENTRY_SIZE, "%s{\"node\":\"%s\",\"per\":%e,\"lost\":%u,\"total\":%u,\"ph\":%.2f}",
+									 nodesInPage ? "," : "",
+									 nodeName ? nodeName : mac2str (node->getMacAddress (), mac_str),
+									 node->per,
+									 node->packetErrors,
+									 node->packetNumber + node->packetErrors,
+									 node->packetsHour);
+		if (nodesInPage && pld_size + entrySize + strlen (PAYLOAD_END) >= PAYLOAD_SIZE) {
+			pld_size += snprintf (payload + pld_size, PAYLOAD_SIZE - pld_size, "%s", PAYLOAD_END);
+			GwOutput.outputDataSend (addr, payload, pld_size, GwOutput_data_type::nodesstatus);
+			page++;
+			nodesInPage = 0;
+			pld_size = snprintf (payload, PAYLOAD_SIZE, "{\"page\":%u,\"nodes\":[", page);
+			continue; // Format entry again without separator
+		}
+		memcpy (payload + pld_size, entry, entrySize);
+		pld_size += entrySize;
+		nodesInPage++;
+		node = EnigmaIOTGateway.getNodes ()->getNextActiveNode (node);
+	}
+	EnigmaIOTGateway.unlock ();
+	pld_size += snprintf (payload + pld_size, PAYLOAD_SIZE - pld_size, "%s", PAYLOAD_END);
+	GwOutput.outputDataSend (addr, payload, pld_size, GwOutput_data_type::nodesstatus);
+	DEBUG_INFO ("Published status of %d nodes in %u messages", EnigmaIOTGateway.getActiveNodesNumber (), page + 1);
+}
+#endif // ENABLE_AGGREGATED_STATUS
+
 void onDownlinkData (uint8_t* address, char* nodeName, control_message_type_t msgType, char* data, unsigned int len) {
-	uint8_t* buffer;
+	uint8_t userData[MAX_FRAGMENTED_PAYLOAD_SIZE];
+	uint8_t* buffer = NULL;
 	unsigned int bufferLen = len;
+	bool allocated = false;
 	gatewayPayloadEncoding_t encoding = ENIGMAIOT;
 
 	if (nodeName) {
@@ -281,33 +347,50 @@ void onDownlinkData (uint8_t* address, char* nodeName, control_message_type_t ms
 	} else {
 		DEBUG_INFO ("DL Message for " MACSTR ". Type 0x%02X", MAC2STR (address), msgType);
 	}
+	if (msgType == OTA_BIN) {
+		// Binary OTA chunks are already in node format. Pass them without copy
+		DEBUG_DBG ("Binary OTA data length: %d", len);
+		EnigmaIOTGateway.lock ();
+		if (!EnigmaIOTGateway.sendDownstream (address, (uint8_t*)data, len, msgType, encoding, nodeName)) {
+			DEBUG_WARN ("Error sending OTA chunk");
+		}
+		EnigmaIOTGateway.unlock ();
+		return;
+	}
+
 	DEBUG_DBG ("Data: %.*s Length: %d", len, data, len);
 
 	if (msgType == USERDATA_GET || msgType == USERDATA_SET) {
-		const int capacity = JSON_ARRAY_SIZE (25) + 25 * JSON_OBJECT_SIZE (4);
-		DynamicJsonDocument json (capacity);
-		DeserializationError error = deserializeJson (json, data, len, DeserializationOption::NestingLimit (3));
-		if (error == DeserializationError::Ok) {
-			DEBUG_INFO ("JSON Message. Result %s", error.c_str ());
-			bufferLen = measureMsgPack (json) + 1; // Add place for \0
-			buffer = (uint8_t*)malloc (bufferLen);
-			bufferLen = serializeMsgPack (json, (char*)buffer, bufferLen);
+		// User data is encoded directly on a stack buffer. Longer data cannot be sent to node anyway
+		buffer = userData;
+		bufferLen = jsonToMsgPack (data, len, buffer, sizeof (userData));
+		if (bufferLen) {
+			DEBUG_INFO ("JSON Message");
 			encoding = MSG_PACK;
 		} else {
-			DEBUG_INFO ("Not JSON Message. Error %s", error.c_str ());
-			bufferLen++; // Add place for \0
-			buffer = (uint8_t*)malloc (bufferLen);
-			sprintf ((char*)buffer, "%.*s", len, data);
+			DEBUG_INFO ("Not JSON Message");
+			if (len >= sizeof (userData)) {
+				DEBUG_WARN ("Downlink data too long: %d bytes", len);
+				return;
+			}
+			bufferLen = sprintf ((char*)buffer, "%.*s", len, data) + 1; // Add place for \0
 			encoding = RAW;
 		}
 	} else {
 		bufferLen = len + 1;
 		buffer = (uint8_t*)calloc (sizeof (uint8_t), bufferLen);
+		if (!buffer) {
+			DEBUG_ERROR ("Cannot allocate %d bytes for downlink message", bufferLen);
+			return;
+		}
+		allocated = true;
 		memcpy (buffer, data, len);
 	}
 
-
-	if (!EnigmaIOTGateway.sendDownstream (address, buffer, bufferLen, msgType, encoding, nodeName)) {
+	EnigmaIOTGateway.lock ();
+	bool sent = EnigmaIOTGateway.sendDownstream (address, buffer, bufferLen, msgType, encoding, nodeName);
+	EnigmaIOTGateway.unlock ();
+	if (!sent) {
 		if (nodeName) {
 			DEBUG_WARN ("Error sending esp_now message to %s", nodeName);
 		} else {
@@ -317,13 +400,18 @@ void onDownlinkData (uint8_t* address, char* nodeName, control_message_type_t ms
 		DEBUG_DBG ("Esp-now message sent or queued correctly");
 	}
 
-	free (buffer);
+	if (allocated) {
+		free (buffer);
+	}
 }
 
 void newNodeConnected (uint8_t* mac, uint16_t node_id, char* nodeName = nullptr) {
 
 	//Serial.printf ("New node connected: %s\n", macstr);
 
+	// Output reads node address from node list
+	EnigmaIOTGateway.lock ();
+
 	if (nodeName) {
 		if (!GwOutput.newNodeSend (nodeName, node_id)) {
 			DEBUG_WARN ("Error sending new node %s", nodeName);
@@ -339,7 +427,7 @@ void newNodeConnected (uint8_t* mac, uint16_t node_id, char* nodeName = nullptr)
 			DEBUG_DBG ("New node %s message sent", macstr);
 		}
 	}
-
+	EnigmaIOTGateway.unlock ();
 }
 
 void nodeDisconnected (uint8_t* mac, gwInvalidateReason_t reason) {
@@ -353,25 +441,6 @@ void nodeDisconnected (uint8_t* mac, gwInvalidateReason_t reason) {
 	}
 }
 
-//#ifdef ESP32
-//void EnigmaIOTGateway_handle (void * param) {
-//	for (;;) {
-//		EnigmaIOTGateway.handle ();
-//		vTaskDelay (0);
-//	}
-//}
-//
-//void GwOutput_handle (void* param) {
-//	for (;;) {
-//		GwOutput.loop ();
-//		vTaskDelay (0);
-//	}
-//}
-//
-//TaskHandle_t xEnigmaIOTGateway_handle = NULL;
-//TaskHandle_t gwoutput_handle = NULL;
-//#endif // ESP32
-
 void setup () {
 	Serial.begin (115200); Serial.println (); Serial.println ();
 
@@ -441,11 +510,13 @@ void setup () {
 
 	arduinoOTAConfigure ();
 
-#ifdef ESP32
-	//xTaskCreate (EnigmaIOTGateway_handle, "handle", 10000, NULL, 1, &xEnigmaIOTGateway_handle);
-	//xTaskCreatePinnedToCore (EnigmaIOTGateway_handle, "handle", 4096, NULL, 0, &xEnigmaIOTGateway_handle, 1);
-	//xTaskCreatePinnedToCore (GwOutput_handle, "gwoutput", 10000, NULL, 2, &gwoutput_handle, 1);
-#endif
+#if ENABLE_GATEWAY_PIPELINE
+	// Messages are processed on gateway task. This loop only runs notifications and MQTT output
+	pipelined = EnigmaIOTGateway.startPipeline ();
+	if (!pipelined) {
+		DEBUG_ERROR ("Gateway pipeline could not be started");
+	}
+#endif // ENABLE_GATEWAY_PIPELINE
 }
 
 #ifdef MEAS_TEMP
@@ -472,7 +543,11 @@ void sendStatus (float temperature) {
 
 void loop () {
 	GwOutput.loop ();
-	EnigmaIOTGateway.handle ();
+	if (pipelined) {
+		EnigmaIOTGateway.handleOutput ();
+	} else {
+		EnigmaIOTGateway.handle ();
+	}
 	ArduinoOTA.handle ();
 
 #ifdef MEAS_TEMP
@@ -497,6 +572,15 @@ void loop () {
 	}
 #endif // MEAS_TEMP
 
+#if ENABLE_AGGREGATED_STATUS
+	static time_t lastNodesStatusTime = 0;
+
+	if (millis () - lastNodesStatusTime > AGGREGATED_STATUS_PERIOD) {
+		lastNodesStatusTime = millis ();
+		sendNodesStatus ();
+	}
+#endif // ENABLE_AGGREGATED_STATUS
+
 	if (restartRequested) {
 		if (millis () - restartRequestTime > 100) {
 			ESP.restart ();
@@ -14,6 +14,7 @@
 #include <ESPAsyncWebServer.h>
 #include <helperFunctions.h>
 #include <EnigmaIOTdebug.h>
+#include <gatewayMetrics.h>
 #include <PubSubClient.h>
 
 #ifdef ESP32
@@ -202,6 +203,17 @@ void GwOutput_MQTT::configManagerExit (bool status) {
 
 bool GwOutput_MQTT::begin () {
     //this->mqtt_queue = new EnigmaIOTRingBuffer<mqtt_queue_item_t> (MAX_MQTT_QUEUE_SIZE);
+	size_t queueBudget = ESP.getFreeHeap () / MQTT_QUEUE_HEAP_DIVISOR;
+	if (queueBudget < MQTT_QUEUE_MIN_BYTES) {
+		queueBudget = MQTT_QUEUE_MIN_BYTES;
+	} else if (queueBudget > MQTT_QUEUE_MAX_BYTES) {
+		queueBudget = MQTT_QUEUE_MAX_BYTES;
+	}
+	if (!mqtt_queue.begin (queueBudget)) {
+		DEBUG_ERROR ("Cannot allocate MQTT queue");
+		return false;
+	}
+	DEBUG_INFO ("MQTT queue: %d messages, %u bytes", MAX_MQTT_QUEUE_SIZE, queueBudget);
 #ifdef SECURE_MQTT
 	randomSeed (micros ());
 #ifdef ESP32
@@ -215,6 +227,7 @@ bool GwOutput_MQTT::begin () {
 	DEBUG_INFO ("Set MQTT server %s - port %d", mqttgw_config.mqtt_server, mqttgw_config.mqtt_port);
 	mqtt_client.setBufferSize (MQTT_BUFFER_SIZE);
 	netName = String (EnigmaIOTGateway.getNetworkName ());
+	topicCache.clear (); // Cached topics include network name
 
 #ifdef ESP32
 	uint64_t chipid = ESP.getEfuseMac ();
@@ -227,7 +240,14 @@ bool GwOutput_MQTT::begin () {
     setenv ("TZ", TZINFO, 1);
     tzset ();
 
-	gwTopic = netName + GW_STATUS;
+#if ENABLE_MULTI_GATEWAY
+	// Gateways share node topics, but every one has its own gateway topics
+	gwAddress = WiFi.softAPmacAddress ();
+	gwPrefix = netName + GW_TOPIC + "/" + gwAddress;
+#else
+	gwPrefix = netName + GW_TOPIC;
+#endif // ENABLE_MULTI_GATEWAY
+	gwTopic = gwPrefix + GW_STATUS;
 	reconnect ();
 	return true;
 }
@@ -265,6 +285,10 @@ void GwOutput_MQTT::reconnect () {
 			mqtt_client.subscribe (dlTopic.c_str ());
 			dlTopic = netName + String ("/+/get/#");
 			mqtt_client.subscribe (dlTopic.c_str ());
+#if ENABLE_MULTI_GATEWAY
+			dlTopic = netName + String ("/+/") + NODE_HELLO;
+			mqtt_client.subscribe (dlTopic.c_str ());
+#endif // ENABLE_MULTI_GATEWAY
 			mqtt_client.setCallback (onDlData);
 			// TODO: stopConnectionFlash ();
 		} else {
@@ -323,6 +347,8 @@ control_message_type_t checkMsgType (String data) {
 		return control_message_type::SLEEP_SET;
 	} else if (data == SET_OTA) {
 		return control_message_type::OTA;
+	} else if (data == SET_OTA_BIN) {
+		return control_message_type::OTA_BIN;
 	} else if (data == SET_IDENTIFY) {
 		DEBUG_WARN ("IDENTIFY MESSAGE %s", data.c_str ());
 		return control_message_type::IDENTIFY;
@@ -347,6 +373,12 @@ control_message_type_t checkMsgType (String data) {
 	} else if (data == SET_RESTART_MCU) {
 		DEBUG_INFO ("RESET MCU");
 		return control_message_type::RESTART_NODE;
+	} else if (data == SET_GROUP_JOIN) {
+		DEBUG_INFO ("JOIN GROUP");
+		return control_message_type::GROUP_JOIN;
+	} else if (data == SET_GROUP_LEAVE) {
+		DEBUG_INFO ("LEAVE GROUP");
+		return control_message_type::GROUP_LEAVE;
 	} else
 		return control_message_type::INVALID;
 }
@@ -391,6 +423,14 @@ void GwOutput_MQTT::onDlData (char* topic, uint8_t* data, unsigned int len) {
 
 	unsigned int addressLen;
 
+#if ENABLE_MULTI_GATEWAY
+	size_t topicLen = strlen (topic);
+	if (topicLen > strlen (NODE_HELLO) && !strcmp (topic + topicLen - strlen (NODE_HELLO), NODE_HELLO)) {
+		onNodeHello (topic, data, len);
+		return;
+	}
+#endif // ENABLE_MULTI_GATEWAY
+
 	addressStr = getTopicAddress (topic, addressLen);
 
 	if (addressStr) {
@@ -438,20 +478,96 @@ void GwOutput_MQTT::loop () {
 	} else {
         mqtt_queue_item_t* message;
         static time_t statusLastUpdated;
+		uint32_t drainStart = millis ();
+		int published = 0;
 
-		if (!mqtt_queue.empty ()) {
+		// Drain several messages, but limit time so that gateway keeps processing incoming messages
+		while (!mqtt_queue.empty ()) {
+			if (MQTT_LOOP_DRAIN_MESSAGES > 0 && published >= MQTT_LOOP_DRAIN_MESSAGES) {
+				break;
+			}
+			if (MQTT_LOOP_DRAIN_TIME > 0 && millis () - drainStart >= MQTT_LOOP_DRAIN_TIME) {
+				break;
+			}
 			message = getMQTTqueue ();
 			if (publishMQTT (message->topic, message->payload, message->payload_len, message->retain)) {
 				DEBUG_DBG ("MQTT published. %s %.*s", message->topic, message->payload_len, message->payload);
+				mqtt_queue.countPublished ();
 				popMQTTqueue ();
+				published++;
+			} else {
+				break;
 			}
 		}
 		if (millis () - statusLastUpdated > STATUS_SEND_PERIOD) {
 			statusLastUpdated = millis ();
 			publishMQTT (gwTopic.c_str (), "1", 1, true);
+#if ENABLE_MULTI_GATEWAY
+			publishLoad ();
+#endif // ENABLE_MULTI_GATEWAY
 		}
+#if ENABLE_GATEWAY_METRICS
+		static time_t metricsLastUpdated;
+		METRICS_SET (METRIC_MQTT_QUEUE, mqtt_queue.size ());
+		if (millis () - metricsLastUpdated > METRICS_PUBLISH_PERIOD) {
+			metricsLastUpdated = millis ();
+			publishMetrics ();
+		}
+#endif // ENABLE_GATEWAY_METRICS
+	}
+}
+
+#if ENABLE_GATEWAY_METRICS
+void GwOutput_MQTT::publishMetrics () {
+	String topic = gwPrefix + GW_METRICS;
+	char* payload = (char*)malloc (MAX_MQTT_PLD_LEN);
+
+	if (!payload) {
+		DEBUG_WARN ("Not enough memory to publish metrics");
+		return;
+	}
+	size_t len = GatewayMetrics.toJson (payload, MAX_MQTT_PLD_LEN);
+	if (len) {
+		// Metrics are published directly so that they do not change MQTT queue depth they report
+		publishMQTT (topic.c_str (), payload, len, false);
+	} else {
+		DEBUG_WARN ("Metrics do not fit on MQTT message");
 	}
+	free (payload);
 }
+#endif // ENABLE_GATEWAY_METRICS
+
+#if ENABLE_MULTI_GATEWAY
+void GwOutput_MQTT::publishLoad () {
+	String topic = gwPrefix + GW_LOAD;
+	const int PAYLOAD_SIZE = 48;
+	char payload[PAYLOAD_SIZE];
+	size_t pld_size;
+
+	pld_size = snprintf (payload, PAYLOAD_SIZE, "{\"nodes\":%d,\"capacity\":%d}", enigmaIotGateway->getActiveNodesNumber (), NUM_NODES);
+	publishMQTT (topic.c_str (), payload, pld_size, true);
+}
+
+void GwOutput_MQTT::onNodeHello (char* topic, uint8_t* data, unsigned int len) {
+	uint8_t addr[ENIGMAIOT_ADDR_LEN];
+	const size_t capacity = JSON_OBJECT_SIZE (2) + 60;
+	DynamicJsonDocument doc (capacity);
+
+	// Topic may use node name. Address is taken from payload
+	if (deserializeJson (doc, data, len) != DeserializationError::Ok) {
+		DEBUG_WARN ("Wrong node registration message on %s: %.*s", topic, len, data);
+		return;
+	}
+	const char* address = doc["address"];
+	const char* gateway = doc["gateway"];
+	if (!address || !gateway || !str2mac (address, addr)) {
+		return;
+	}
+	if (GwOutput.gwAddress != gateway) {
+		EnigmaIOTGateway.releaseNode (addr);
+	}
+}
+#endif // ENABLE_MULTI_GATEWAY
 
 bool GwOutput_MQTT::publishMQTT (const char* topic, const char* payload, size_t len, bool retain) {
 	DEBUG_INFO ("Publish MQTT. %s : %.*s", topic, len, payload);
@@ -481,25 +597,20 @@ void GwOutput_MQTT::setClock () {
 }
 //#endif
 
-bool GwOutput_MQTT::addMQTTqueue (const char* topic, char* payload, size_t len, bool retain) {
-    mqtt_queue_item_t message;
-
-	if (mqtt_queue.size () >= MAX_MQTT_QUEUE_SIZE) {
-		mqtt_queue.pop ();
+bool GwOutput_MQTT::addMQTTqueue (const char* topic, char* payload, size_t len, bool retain, mqtt_msg_class_t msgClass) {
+	if (len > MAX_MQTT_PLD_LEN) {
+		len = MAX_MQTT_PLD_LEN;
 	}
 
-	//message.topic = (char*)malloc (strlen (topic) + 1);
-	strncpy (message.topic, topic, MAX_MQTT_TOPIC_LEN);
-    message.payload_len = len < MAX_MQTT_PLD_LEN ? len : MAX_MQTT_PLD_LEN;
-	//message->payload = (char*)malloc (len);
-    memcpy (message.payload, payload, message.payload_len);
-	message.retain = retain;
+	if (!mqtt_queue.push (topic, payload, len, retain, msgClass)) {
+		DEBUG_WARN ("MQTT message rejected. Queue full. %s", topic);
+		return false;
+	}
 
-	mqtt_queue.push (&message);
-	DEBUG_DBG ("%d MQTT messages queued Len:%d %s %.*s", mqtt_queue.size (),
+	DEBUG_DBG ("%d MQTT messages queued (%u bytes) Len:%d %s %.*s", mqtt_queue.size (), mqtt_queue.bytes (),
 			   len,
-			   message.topic,
-			   message.payload_len, message.payload);
+			   topic,
+			   len, payload);
 
 	return true;
 }
@@ -514,42 +625,126 @@ mqtt_queue_item_t* GwOutput_MQTT::getMQTTqueue () {
 
 void GwOutput_MQTT::popMQTTqueue () {
 	if (mqtt_queue.size ()) {
-        mqtt_queue_item_t* message;
+		mqtt_queue.pop ();
+		DEBUG_DBG ("MQTT message pop. Size %d", mqtt_queue.size ());
+	}
+}
 
-		message = mqtt_queue.front ();
-		if (message) {
-			if (message->topic) {
-				//delete(message->topic);
-                message->topic[0] = 0;
-			}
-			if (message->payload) {
-				//delete(message->payload);
-                message->payload[0] = 0;
+bool MQTTOutputQueue::begin (size_t budget) {
+	if (!items) {
+		items = new mqtt_queue_item_t[maxItems];
+		if (!items) {
+			return false;
+		}
+	}
+	maxBytes = budget;
+	return true;
+}
+
+void MQTTOutputQueue::remove (int pos) {
+	mqtt_queue_item_t* item = at (pos);
+
+	numBytes -= strlen (item->topic) + 1 + item->payload_len;
+	free (item->topic);
+
+	// Close the gap. Dropped messages are normally near the head so few descriptors are moved
+	for (int i = pos; i > 0; i--) {
+		*at (i) = *at (i - 1);
+	}
+	readIndex = (readIndex + 1) % maxItems;
+	numItems--;
+}
+
+int MQTTOutputQueue::selectVictim (mqtt_msg_class_t msgClass) {
+	if (!numItems) {
+		return -1;
+	}
+	if (dropPolicy == MQTT_DROP_OLDEST) {
+		return 0;
+	}
+	// Oldest message of least important class, but never more important than the new one
+	for (int cls = MQTT_MSG_STATUS; cls >= msgClass; cls--) {
+		if (dropPolicy == MQTT_NEVER_DROP_DATA && cls == MQTT_MSG_DATA) {
+			break;
+		}
+		for (int i = 0; i < numItems; i++) {
+			if (at (i)->msgClass == cls) {
+				return i;
 			}
-            message->payload_len = 0;
-			//delete message;
 		}
-		mqtt_queue.pop ();
-		DEBUG_DBG ("MQTT message pop. Size %d", mqtt_queue.size ());
 	}
+	return -1;
+}
+
+bool MQTTOutputQueue::push (const char* topic, const char* payload, size_t len, bool retain, mqtt_msg_class_t msgClass) {
+	size_t topicLen = strnlen (topic, MAX_MQTT_TOPIC_LEN - 1);
+	size_t msgBytes = topicLen + 1 + len;
+
+	if (!items || msgBytes > maxBytes) {
+		stats.rejected++;
+		return false;
+	}
+
+	while (numItems >= maxItems || numBytes + msgBytes > maxBytes) {
+		int victim = selectVictim (msgClass);
+		if (victim < 0) {
+			stats.rejected++;
+			return false;
+		}
+		DEBUG_DBG ("MQTT queue full. Dropping %s", at (victim)->topic);
+		remove (victim);
+		stats.dropped++;
+	}
+
+	char* buffer = (char*)malloc (msgBytes);
+	if (!buffer) {
+		stats.rejected++;
+		return false;
+	}
+	memcpy (buffer, topic, topicLen);
+	buffer[topicLen] = '\0';
+	memcpy (buffer + topicLen + 1, payload, len);
+
+	mqtt_queue_item_t* item = at (numItems);
+	item->topic = buffer;
+	item->payload = buffer + topicLen + 1;
+	item->payload_len = len;
+	item->retain = retain;
+	item->msgClass = msgClass;
+	numItems++;
+	numBytes += msgBytes;
+
+	stats.queued++;
+	if (numItems > stats.itemsHighWater) {
+		stats.itemsHighWater = numItems;
+	}
+	if (numBytes > stats.bytesHighWater) {
+		stats.bytesHighWater = numBytes;
+	}
+	return true;
 }
 
 bool GwOutput_MQTT::outputDataSend (char* address, char* data, size_t length, GwOutput_data_type_t type) {
 	const int TOPIC_SIZE = 64;
 	char topic[TOPIC_SIZE];
 	bool result;
+	mqtt_msg_class_t msgClass = MQTT_MSG_STATUS;
 	switch (type) {
 	case GwOutput_data_type::data:
-		snprintf (topic, TOPIC_SIZE, "%s/%s/%s", netName.c_str (), address, NODE_DATA);
+		topicCache.build (topic, TOPIC_SIZE, netName.c_str (), address, NODE_DATA);
+		msgClass = MQTT_MSG_DATA;
 		break;
 	case GwOutput_data_type::lostmessages:
-		snprintf (topic, TOPIC_SIZE, "%s/%s/%s", netName.c_str (), address, LOST_MESSAGES);
+		topicCache.build (topic, TOPIC_SIZE, netName.c_str (), address, LOST_MESSAGES);
 		break;
 	case GwOutput_data_type::status:
-		snprintf (topic, TOPIC_SIZE, "%s/%s/%s", netName.c_str (), address, NODE_STATUS);
+		topicCache.build (topic, TOPIC_SIZE, netName.c_str (), address, NODE_STATUS);
+		break;
+	case GwOutput_data_type::nodesstatus:
+		topicCache.build (topic, TOPIC_SIZE, netName.c_str (), address, NODES_STATUS);
 		break;
 	}
-	if ((result = addMQTTqueue (topic, data, length))) {
+	if ((result = addMQTTqueue (topic, data, length, false, msgClass))) {
 		DEBUG_INFO ("MQTT queued %s. Length %d", topic, length);
 	} else {
 		DEBUG_WARN ("Error queuing MQTT %s", topic);
@@ -567,7 +762,7 @@ bool GwOutput_MQTT::outputControlSend (char* address, uint8_t* data, size_t leng
 
 	switch (data[0]) {
 	case control_message_type::VERSION_ANS:
-		snprintf (topic, TOPIC_SIZE, "%s/%s/%s", netName.c_str (), address, GET_VERSION_ANS);
+		topicCache.build (topic, TOPIC_SIZE, netName.c_str (), address, GET_VERSION_ANS);
 		if (length >= 4) {
 			pld_size = snprintf (payload, PAYLOAD_SIZE, "{\"version\":\"%d.%d.%d\"}", data[1], data[2], data[3]);
 		}
@@ -579,7 +774,7 @@ bool GwOutput_MQTT::outputControlSend (char* address, uint8_t* data, size_t leng
 	case control_message_type::SLEEP_ANS:
 		uint32_t sleepTime;
 		memcpy (&sleepTime, data + 1, sizeof (sleepTime));
-		snprintf (topic, TOPIC_SIZE, "%s/%s/%s", netName.c_str (), address, GET_SLEEP_ANS);
+		topicCache.build (topic, TOPIC_SIZE, netName.c_str (), address, GET_SLEEP_ANS);
 		pld_size = snprintf (payload, PAYLOAD_SIZE, "{\"sleeptime\":%u}", sleepTime);
 		if (addMQTTqueue (topic, payload, pld_size)) {
 			DEBUG_INFO ("Published MQTT %s %s", topic, payload);
@@ -587,7 +782,7 @@ bool GwOutput_MQTT::outputControlSend (char* address, uint8_t* data, size_t leng
 		}
 		break;
 	case control_message_type::RESET_ANS:
-		snprintf (topic, TOPIC_SIZE, "%s/%s/%s", netName.c_str (), address, SET_RESET_ANS);
+		topicCache.build (topic, TOPIC_SIZE, netName.c_str (), address, SET_RESET_ANS);
 		pld_size = snprintf (payload, PAYLOAD_SIZE, "{}");
 		if (addMQTTqueue (topic, payload, pld_size)) {
 			DEBUG_INFO ("Published MQTT %s %s", topic, payload);
@@ -595,16 +790,21 @@ bool GwOutput_MQTT::outputControlSend (char* address, uint8_t* data, size_t leng
 		}
 		break;
 	case control_message_type::RSSI_ANS:
-		snprintf (topic, TOPIC_SIZE, "%s/%s/%s", netName.c_str (), address, GET_RSSI_ANS);
+		topicCache.build (topic, TOPIC_SIZE, netName.c_str (), address, GET_RSSI_ANS);
 		pld_size = snprintf (payload, PAYLOAD_SIZE, "{\"rssi\":%d,\"channel\":%u}", (int8_t)data[1], data[2]);
-		EnigmaIOTGateway.getNodes ()->getNodeFromName (address)->setRSSI (data[1]);
+		{
+			Node* node = EnigmaIOTGateway.getNodes ()->getNodeFromName (address);
+			if (node) {
+				node->setRSSI (data[1]);
+			}
+		}
 		if (addMQTTqueue (topic, payload, pld_size)) {
 			DEBUG_INFO ("Published MQTT %s %s", topic, payload);
 			result = true;
 		}
 		break;
 	case control_message_type::NAME_ANS:
-		snprintf (topic, TOPIC_SIZE, "%s/%s/%s", netName.c_str (), address, GET_NAME_ANS);
+		topicCache.build (topic, TOPIC_SIZE, netName.c_str (), address, GET_NAME_ANS);
 		char addrStr[ENIGMAIOT_ADDR_LEN * 3];
 		pld_size = snprintf (payload, PAYLOAD_SIZE, "{\"name\":\"%.*s\",\"address\":\"%s\"}", length - ENIGMAIOT_ADDR_LEN - 1, (char*)(data + 1 + ENIGMAIOT_ADDR_LEN), mac2str (data + 1, addrStr));
 		if (addMQTTqueue (topic, payload, pld_size)) {
@@ -613,7 +813,7 @@ bool GwOutput_MQTT::outputControlSend (char* address, uint8_t* data, size_t leng
 		}
 		break;
 	case control_message_type::RESTART_CONFIRM:
-		snprintf (topic, TOPIC_SIZE, "%s/%s/%s", netName.c_str (), address, RESTART_NOTIF);
+		topicCache.build (topic, TOPIC_SIZE, netName.c_str (), address, RESTART_NOTIF);
 		if (length > 1) {
 			pld_size = snprintf (payload, PAYLOAD_SIZE, "{\"reason\":%d}", (int8_t)data[1]);
 		}
@@ -623,10 +823,14 @@ bool GwOutput_MQTT::outputControlSend (char* address, uint8_t* data, size_t leng
 		}
 		break;
 	case control_message_type::OTA_ANS:
-		snprintf (topic, TOPIC_SIZE, "%s/%s/%s", netName.c_str (), address, SET_OTA_ANS);
+		topicCache.build (topic, TOPIC_SIZE, netName.c_str (), address, SET_OTA_ANS);
 		switch (data[1]) {
 		case ota_status::OTA_STARTED:
-			pld_size = snprintf (payload, PAYLOAD_SIZE, "{\"result\":\"OTA Started\",\"status\":%u}", data[1]);
+			if (length > 2) {
+				pld_size = snprintf (payload, PAYLOAD_SIZE, "{\"result\":\"OTA Started\",\"status\":%u,\"window\":%u}", data[1], data[2]);
+			} else {
+				pld_size = snprintf (payload, PAYLOAD_SIZE, "{\"result\":\"OTA Started\",\"status\":%u}", data[1]);
+			}
 			break;
 		case ota_status::OTA_START_ERROR:
 			pld_size = snprintf (payload, PAYLOAD_SIZE, "{\"result\":\"OTA Start error\",\"status\":%u}", data[1]);
@@ -648,6 +852,13 @@ bool GwOutput_MQTT::outputControlSend (char* address, uint8_t* data, size_t leng
 		case ota_status::OTA_FINISHED:
 			pld_size = snprintf (payload, PAYLOAD_SIZE, "{\"result\":\"OTA finished OK\",\"status\":%u}", data[1]);
 			break;
+		case ota_status::OTA_ACK:
+			uint16_t nextChunk;
+			uint32_t received;
+			memcpy ((uint8_t*)&nextChunk, data + 2, sizeof (uint16_t));
+			memcpy ((uint8_t*)&received, data + 4, sizeof (uint32_t));
+			pld_size = snprintf (payload, PAYLOAD_SIZE, "{\"next_chunk\":%u,\"received\":%u,\"result\":\"OTA ack\",\"status\":%u}", nextChunk, received, data[1]);
+			break;
 		}
 		if (addMQTTqueue (topic, payload, pld_size)) {
 			DEBUG_INFO ("Published MQTT %s %s", topic, payload);
@@ -669,12 +880,21 @@ bool GwOutput_MQTT::newNodeSend (char* address, uint16_t node_id) {
 	uint8_t* nodeAddress = enigmaIotGateway->getNodes ()->getNodeFromID (node_id)->getMacAddress ();
 	char addrStr[ENIGMAIOT_ADDR_LEN * 3];
 
+#if ENABLE_MULTI_GATEWAY
+	// Other gateways release node session when they get this message
+	char payload[ENIGMAIOT_ADDR_LEN * 6 + 28];
+	size_t pld_size = snprintf (payload, sizeof (payload), "{\"address\":\"%s\",\"gateway\":\"%s\"}", mac2str (nodeAddress, addrStr), gwAddress.c_str ());
+
+	topicCache.build (topic, TOPIC_SIZE, netName.c_str (), address, NODE_HELLO);
+	bool result = addMQTTqueue (topic, payload, pld_size);
+#else
 	char payload[ENIGMAIOT_ADDR_LEN * 3 + 14];
 
 	snprintf (payload, ENIGMAIOT_ADDR_LEN * 3 + 14, "{\"address\":\"%s\"}", mac2str (nodeAddress, addrStr));
 
-	snprintf (topic, TOPIC_SIZE, "%s/%s/hello", netName.c_str (), address);
+	topicCache.build (topic, TOPIC_SIZE, netName.c_str (), address, NODE_HELLO);
 	bool result = addMQTTqueue (topic, payload, ENIGMAIOT_ADDR_LEN * 3 + 14);
+#endif // ENABLE_MULTI_GATEWAY
 	DEBUG_INFO ("Published MQTT %s", topic);
 	return result;
 }
@@ -687,7 +907,7 @@ bool GwOutput_MQTT::nodeDisconnectedSend (char* address, gwInvalidateReason_t re
 	char payload[PAYLOAD_SIZE];
 	size_t pld_size;
 
-	snprintf (topic, TOPIC_SIZE, "%s/%s/bye", netName.c_str (), address);
+	topicCache.build (topic, TOPIC_SIZE, netName.c_str (), address, "bye");
 	pld_size = snprintf (payload, PAYLOAD_SIZE, "{\"reason\":%d}", reason);
 	bool result = addMQTTqueue (topic, payload, pld_size);
 	DEBUG_INFO ("Published MQTT %s result = %s", topic, result ? "OK" : "Fail");
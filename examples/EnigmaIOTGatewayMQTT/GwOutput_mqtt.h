@@ -38,6 +38,7 @@
 #define GET_SLEEP_ANS    "result/sleeptime"
 #define SET_SLEEP        "set/sleeptime"
 #define SET_OTA          "set/ota"
+#define SET_OTA_BIN      "set/otabin"
 #define SET_OTA_ANS      "result/ota"
 #define SET_IDENTIFY     "set/identify"
 #define SET_RESET_CONFIG "set/reset"
@@ -53,10 +54,32 @@
 #define NODE_DATA        "data"
 #define LOST_MESSAGES    "debug/lostmessages"
 #define NODE_STATUS      "status"
-#define GW_STATUS        "/gateway/status"
+#define NODES_STATUS     "nodes"
+#define GW_TOPIC         "/gateway"
+#define GW_STATUS        "/status"
+#define GW_METRICS       "/metrics"
+#define GW_LOAD          "/load"
+#define NODE_HELLO       "hello"
 #define SET_RESTART_MCU	 "set/restart"
+#define SET_GROUP_JOIN   "set/joingroup"
+#define SET_GROUP_LEAVE  "set/leavegroup"
 
 const time_t STATUS_SEND_PERIOD = 300000;
+#ifndef MQTT_QUEUE_HEAP_DIVISOR
+const uint32_t MQTT_QUEUE_HEAP_DIVISOR = 4; ///< @brief MQTT queue byte budget is free heap at start divided by this value
+#endif // MQTT_QUEUE_HEAP_DIVISOR
+#ifndef MQTT_QUEUE_MIN_BYTES
+const size_t MQTT_QUEUE_MIN_BYTES = 2048; ///< @brief Minimum MQTT queue byte budget, regardless of free heap
+#endif // MQTT_QUEUE_MIN_BYTES
+#ifndef MQTT_QUEUE_MAX_BYTES
+const size_t MQTT_QUEUE_MAX_BYTES = 16384; ///< @brief Maximum MQTT queue byte budget, regardless of free heap
+#endif // MQTT_QUEUE_MAX_BYTES
+#ifndef MQTT_LOOP_DRAIN_MESSAGES
+const int MQTT_LOOP_DRAIN_MESSAGES = 8; ///< @brief Maximum number of queued messages published on every `loop()` call
+#endif // MQTT_LOOP_DRAIN_MESSAGES
+#ifndef MQTT_LOOP_DRAIN_TIME
+const uint32_t MQTT_LOOP_DRAIN_TIME = 20; ///< @brief Maximum time in ms spent publishing queued messages on every `loop()` call
+#endif // MQTT_LOOP_DRAIN_TIME
 
 constexpr auto CONFIG_FILE = "/mqtt.json"; ///< @brief MQTT outout configuration file name
 
@@ -74,13 +97,160 @@ typedef struct {
 constexpr auto MAX_MQTT_TOPIC_LEN = 50;
 constexpr auto MAX_MQTT_PLD_LEN = 2048;
 
+/**
+  * @brief MQTT message classes, used to select which messages are dropped first if queue is full
+  */
+typedef enum {
+	MQTT_MSG_DATA = 0, /**< Data from nodes. Most important class*/
+	MQTT_MSG_CONTROL = 1, /**< Control answers and node events*/
+	MQTT_MSG_STATUS = 2 /**< Node status and lost messages notifications. Least important class*/
+} mqtt_msg_class_t;
+
+/**
+  * @brief Policy used when a new message does not fit on MQTT queue
+  */
+typedef enum {
+	MQTT_DROP_OLDEST = 0, /**< Oldest messages are dropped, whatever their class is*/
+	MQTT_DROP_STATUS_FIRST = 1, /**< Oldest message of the least important class is dropped. A message never causes drop of a more important one*/
+	MQTT_NEVER_DROP_DATA = 2 /**< Like `MQTT_DROP_STATUS_FIRST` but data messages are never dropped. New messages are rejected instead*/
+} mqtt_drop_policy_t;
+
+#ifndef MQTT_QUEUE_DROP_POLICY
+#define MQTT_QUEUE_DROP_POLICY MQTT_DROP_STATUS_FIRST ///< @brief Default MQTT queue drop policy
+#endif // MQTT_QUEUE_DROP_POLICY
+
 typedef struct {
-	char topic[MAX_MQTT_TOPIC_LEN]; /**< Message topic*/
-	char payload[MAX_MQTT_PLD_LEN]; /**< Message payload*/
+	char* topic; /**< Message topic. Topic and payload are allocated on the same block*/
+	char* payload; /**< Message payload*/
 	size_t payload_len; /**< Payload length*/
 	bool retain; /**< MQTT retain flag*/
+	mqtt_msg_class_t msgClass; /**< Message class*/
 } mqtt_queue_item_t;
 
+typedef struct {
+	uint32_t queued; /**< Number of messages added to queue*/
+	uint32_t dropped; /**< Number of messages dropped to make room for newer ones*/
+	uint32_t rejected; /**< Number of messages that could not be queued*/
+	uint32_t published; /**< Number of queued messages published*/
+	size_t bytesHighWater; /**< Maximum number of bytes that queue has held*/
+	int itemsHighWater; /**< Maximum number of messages that queue has held*/
+} mqtt_queue_stats_t;
+
+/**
+  * @brief FIFO queue for outgoing MQTT messages, limited both in number of messages and in bytes.
+  *
+  * Every message takes only the memory it needs. When a new message does not fit other messages are
+  * dropped according to drop policy
+  */
+class MQTTOutputQueue {
+protected:
+	mqtt_queue_item_t* items = NULL; ///< @brief Message descriptors, used as a ring buffer
+	int maxItems; ///< @brief Maximum number of messages
+	int numItems = 0; ///< @brief Number of messages currently queued
+	int readIndex = 0; ///< @brief Position of oldest message
+	size_t maxBytes = MQTT_QUEUE_MIN_BYTES; ///< @brief Byte budget
+	size_t numBytes = 0; ///< @brief Bytes currently used by queued messages
+	mqtt_drop_policy_t dropPolicy = MQTT_QUEUE_DROP_POLICY; ///< @brief Drop policy
+	mqtt_queue_stats_t stats; ///< @brief Queue counters
+
+	/**
+	  * @brief Gets message on a position of the queue
+	  * @param pos Position, starting from oldest message
+	  * @return Message descriptor
+	  */
+	mqtt_queue_item_t* at (int pos) {
+		return &(items[(readIndex + pos) % maxItems]);
+	}
+
+	/**
+	  * @brief Frees a message and removes it from queue
+	  * @param pos Position, starting from oldest message
+	  */
+	void remove (int pos);
+
+	/**
+	  * @brief Selects a message to drop so that a new one may be queued
+	  * @param msgClass Class of the new message
+	  * @return Position of message to drop. -1 if no message may be dropped
+	  */
+	int selectVictim (mqtt_msg_class_t msgClass);
+
+public:
+	/**
+	  * @brief Creates a queue
+	  * @param range Maximum number of messages
+	  */
+	MQTTOutputQueue (int range) : maxItems (range) {
+		memset (&stats, 0, sizeof (stats));
+	}
+
+	/**
+	  * @brief Frees up all queued messages
+	  */
+	~MQTTOutputQueue () {
+		clear ();
+		delete[] (items);
+	}
+
+	/**
+	  * @brief Allocates message descriptors and sets byte budget
+	  * @param budget Maximum number of bytes used by messages
+	  * @return Returns `true` if memory could be allocated
+	  */
+	bool begin (size_t budget);
+
+	/**
+	  * @brief Copies a message to queue, dropping other messages if needed
+	  * @param topic MQTT topic
+	  * @param payload MQTT payload
+	  * @param len Payload length
+	  * @param retain MQTT retain flag
+	  * @param msgClass Message class
+	  * @return Returns `true` if message was queued
+	  */
+	bool push (const char* topic, const char* payload, size_t len, bool retain, mqtt_msg_class_t msgClass);
+
+	/**
+	  * @brief Gets oldest message
+	  * @return Oldest message. `NULL` if queue is empty
+	  */
+	mqtt_queue_item_t* front () {
+		return numItems ? at (0) : NULL;
+	}
+
+	/**
+	  * @brief Deletes oldest message
+	  */
+	void pop () {
+		if (numItems) {
+			remove (0);
+		}
+	}
+
+	/**
+	  * @brief Deletes all messages
+	  */
+	void clear () {
+		while (numItems) {
+			remove (0);
+		}
+	}
+
+	/**
+	  * @brief Counts a message as published
+	  */
+	void countPublished () {
+		stats.published++;
+	}
+
+	int size () { return numItems; } ///< @brief Number of queued messages
+	bool empty () { return numItems == 0; } ///< @brief `true` if no message is queued
+	size_t bytes () { return numBytes; } ///< @brief Bytes used by queued messages
+	size_t budget () { return maxBytes; } ///< @brief Byte budget
+	const mqtt_queue_stats_t* getStats () { return &stats; } ///< @brief Queue counters
+	void setDropPolicy (mqtt_drop_policy_t policy) { dropPolicy = policy; } ///< @brief Sets drop policy
+};
+
 
 class GwOutput_MQTT : public GatewayOutput_generic {
 protected:
@@ -90,10 +260,14 @@ protected:
     AsyncWiFiManagerParameter* mqttPassParam = NULL; ///< @brief Configuration field for MQTT server password
 
 	//std::queue<mqtt_queue_item_t*> mqtt_queue; ///< @brief Output MQTT messages queue. It acts as a FIFO queue
-    EnigmaIOTRingBuffer<mqtt_queue_item_t> mqtt_queue;
+    MQTTOutputQueue mqtt_queue; ///< @brief Output MQTT messages queue
 
 	mqttgw_config_t mqttgw_config; ///< @brief MQTT server configuration data
 	bool shouldSaveConfig = false; ///< @brief Flag to indicate if configuration should be saved
+	String gwPrefix; ///< @brief Prefix of gateway topics. It includes gateway address if several gateways share the same network
+#if ENABLE_MULTI_GATEWAY
+	String gwAddress; ///< @brief Gateway address, used to identify node registrations that were done by this gateway
+#endif // ENABLE_MULTI_GATEWAY
 
 #ifdef SECURE_MQTT
 	WiFiClientSecure espClient; ///< @brief TLS client
@@ -131,8 +305,9 @@ protected:
 	 * @param payload MQTT message payload
 	 * @param len MQTT payload length
 	 * @param retain Message retain flag
+	 * @param msgClass Message class, used to decide which messages are dropped if queue is full
 	 */
-	bool addMQTTqueue (const char* topic, char* payload, size_t len, bool retain = false);
+	bool addMQTTqueue (const char* topic, char* payload, size_t len, bool retain = false, mqtt_msg_class_t msgClass = MQTT_MSG_CONTROL);
 
    /**
 	 * @brief Gets next item in the queue
@@ -154,6 +329,29 @@ protected:
 	 */
 	bool publishMQTT (const char* topic, const char* payload, size_t len, bool retain = false);
 
+#if ENABLE_GATEWAY_METRICS
+	/**
+	 * @brief Publishes gateway metrics summary on gateway metrics topic
+	 */
+	void publishMetrics ();
+#endif // ENABLE_GATEWAY_METRICS
+
+#if ENABLE_MULTI_GATEWAY
+	/**
+	 * @brief Publishes number of registered nodes and gateway capacity on gateway load topic
+	 */
+	void publishLoad ();
+
+	/**
+	 * @brief Processes a node registration published by any gateway of the network. If other gateway registered a node
+	 * that was registered on this one, its session is released here
+	 * @param topic Node registration topic
+	 * @param data Message payload
+	 * @param len Payload length
+	 */
+	static void onNodeHello (char* topic, uint8_t* data, unsigned int len);
+#endif // ENABLE_MULTI_GATEWAY
+
    /**
 	 * @brief Function that processes downlink data from network to node
 	 * @param topic Topic that indicates message type
@@ -236,6 +434,22 @@ public:
 	  * @brief Should be called regularly for module management
 	  */
 	void loop ();
+
+	/**
+	  * @brief Gets output queue counters
+	  * @return Queued, dropped, rejected and published messages and queue high water marks
+	  */
+	const mqtt_queue_stats_t* getQueueStats () {
+		return mqtt_queue.getStats ();
+	}
+
+	/**
+	  * @brief Selects which messages are dropped if output queue is full
+	  * @param policy Drop policy
+	  */
+	void setQueueDropPolicy (mqtt_drop_policy_t policy) {
+		mqtt_queue.setDropPolicy (policy);
+	}
 };
 
 extern GwOutput_MQTT GwOutput;
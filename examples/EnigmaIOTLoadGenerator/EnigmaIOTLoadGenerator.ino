@@ -0,0 +1,298 @@
+/**
+  * @file EnigmaIOTLoadGenerator.ino
+  * @version 0.9.7
+  * @date 04/02/2021
+  * @author German Martin
+  * @brief Emulates many nodes from a single ESP32 to stress test a real gateway
+  *
+  * Every emulated node has its own spoofed address, key and counters. ESP-NOW frames are built and sent as raw 802.11
+  * action frames, as ESP-NOW always uses board address. Gateway answers are captured in promiscuous mode.
+  * Nodes signal themselves as sleepy, so that gateway answers every accepted data message with a Downlink Empty message.
+  * That is used to count messages that gateway has actually accepted.
+  */
+
+#ifndef ESP32
+#error This example needs ESP32. Raw frame sending is not available on ESP8266
+#endif
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <esp_wifi.h>
+#include <CayenneLPP.h>
+#include <ArduinoJson.h>
+
+#include <EnigmaIOTNode.h>
+#include <virtualNode.h>
+#include <helperFunctions.h>
+
+const char NETWORK_KEY[] = "EnigmaIOTLoadGeneratorNetworkKey"; // Same 32 character key as gateway
+const uint8_t GATEWAY_ADDRESS[ENIGMAIOT_ADDR_LEN] = { 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF }; // Gateway soft AP address
+constexpr auto CHANNEL = 3; // Gateway WiFi channel
+
+constexpr auto NUM_SESSIONS = 50; // Number of emulated nodes
+constexpr auto HELLO_RATE = 10; // Maximum Client Hello messages per second, for all nodes together
+constexpr auto HELLO_RETRY_TIME = 5000; // ms to wait for Server Hello before retrying
+constexpr auto DATA_PERIOD = 2000; // ms between data messages of every node
+constexpr auto PAYLOAD_ENCODING = CAYENNELPP; // RAW, CAYENNELPP or MSG_PACK
+constexpr auto RAW_PAYLOAD_SIZE = 32; // Payload length for RAW encoding
+constexpr auto REPORT_PERIOD = 10000; // ms between statistics reports
+constexpr auto RX_QUEUE_SIZE = 16; // Gateway frames waiting to be processed
+
+// ESP-NOW frame: MAC header (24) | Category (1) | OUI (3) | Random (4) | Element ID (1) | Length (1) | OUI (3) | Type (1) | Version (1) | Body
+constexpr auto ESPNOW_HEADER_LENGTH = 39;
+constexpr auto FCS_LENGTH = 4;
+const uint8_t ESPNOW_OUI[] = { 0x18, 0xFE, 0x34 };
+const uint8_t ACTION_FRAME = 0xD0;
+const uint8_t VENDOR_SPECIFIC_CATEGORY = 127;
+const uint8_t VENDOR_SPECIFIC_ELEMENT = 0xDD;
+const uint8_t ESPNOW_TYPE = 4;
+const uint8_t ESPNOW_VERSION = 1;
+
+/**
+  * @brief Emulated node and its schedule
+  */
+typedef struct {
+	VirtualNode node; /**< Node session */
+	uint32_t nextHello; /**< Value of `millis()` when Client Hello may be sent */
+	uint32_t nextData; /**< Value of `millis()` when next data message is due */
+	uint16_t lastAccepted; /**< Counter of last data message accepted by gateway */
+} session_t;
+
+/**
+  * @brief Gateway frame captured on WiFi task
+  */
+typedef struct {
+	uint8_t addr[ENIGMAIOT_ADDR_LEN]; /**< Destination address */
+	uint8_t data[MAX_MESSAGE_LENGTH]; /**< Message */
+	uint8_t len; /**< Message length */
+} rx_frame_t;
+
+/**
+  * @brief Statistics since start
+  */
+struct {
+	uint32_t helloSent; /**< Client Hello messages sent */
+	uint32_t registrations; /**< Valid Server Hello messages */
+	uint32_t busy; /**< Client Hello messages deferred by gateway */
+	uint32_t invalidations; /**< Keys invalidated by gateway */
+	uint32_t dataSent; /**< Data messages sent */
+	uint32_t dataAccepted; /**< Data messages accepted by gateway */
+	uint32_t txErrors; /**< Frames that could not be sent */
+	volatile uint32_t rxDrops; /**< Gateway frames lost because receive queue was full */
+} stats;
+
+session_t sessions[NUM_SESSIONS];
+uint8_t networkKey[KEY_LENGTH]; // Network key hashed as gateway uses it
+QueueHandle_t rxQueue;
+uint32_t lastHello = 0;
+int helloIndex = 0;
+uint32_t lastReport = 0;
+
+session_t* findSession (const uint8_t* mac) {
+	for (int i = 0; i < NUM_SESSIONS; i++) {
+		if (!memcmp (sessions[i].node.getMacAddress (), mac, ENIGMAIOT_ADDR_LEN)) {
+			return &(sessions[i]);
+		}
+	}
+	return NULL;
+}
+
+bool sendFrame (const uint8_t* src, const uint8_t* data, size_t len) {
+	uint8_t frame[ESPNOW_HEADER_LENGTH + MAX_MESSAGE_LENGTH];
+	uint32_t random = esp_random ();
+
+	memset (frame, 0, ESPNOW_HEADER_LENGTH);
+	frame[0] = ACTION_FRAME;
+	memcpy (frame + 4, GATEWAY_ADDRESS, ENIGMAIOT_ADDR_LEN); // Destination
+	memcpy (frame + 10, src, ENIGMAIOT_ADDR_LEN); // Spoofed source
+	memset (frame + 16, 0xFF, ENIGMAIOT_ADDR_LEN); // BSSID
+	frame[24] = VENDOR_SPECIFIC_CATEGORY;
+	memcpy (frame + 25, ESPNOW_OUI, sizeof (ESPNOW_OUI));
+	memcpy (frame + 28, &random, sizeof (uint32_t));
+	frame[32] = VENDOR_SPECIFIC_ELEMENT;
+	frame[33] = len + 5;
+	memcpy (frame + 34, ESPNOW_OUI, sizeof (ESPNOW_OUI));
+	frame[37] = ESPNOW_TYPE;
+	frame[38] = ESPNOW_VERSION;
+	memcpy (frame + ESPNOW_HEADER_LENGTH, data, len);
+
+	if (esp_wifi_80211_tx (WIFI_IF_STA, frame, ESPNOW_HEADER_LENGTH + len, true) != ESP_OK) {
+		stats.txErrors++;
+		return false;
+	}
+	return true;
+}
+
+void promiscuousRx (void* buf, wifi_promiscuous_pkt_type_t type) {
+	// This runs on WiFi task. Frames are only filtered and queued
+	const wifi_promiscuous_pkt_t* pkt = (wifi_promiscuous_pkt_t*)buf;
+	const uint8_t* frame = pkt->payload;
+	int len = pkt->rx_ctrl.sig_len - FCS_LENGTH;
+	rx_frame_t item;
+
+	if (type != WIFI_PKT_MGMT || len <= ESPNOW_HEADER_LENGTH
+		|| frame[0] != ACTION_FRAME || frame[24] != VENDOR_SPECIFIC_CATEGORY
+		|| frame[32] != VENDOR_SPECIFIC_ELEMENT || frame[37] != ESPNOW_TYPE
+		|| memcmp (frame + 34, ESPNOW_OUI, sizeof (ESPNOW_OUI))
+		|| memcmp (frame + 10, GATEWAY_ADDRESS, ENIGMAIOT_ADDR_LEN)) {
+		return;
+	}
+	int bodyLen = frame[33] - 5;
+	if (bodyLen <= 0 || bodyLen > MAX_MESSAGE_LENGTH || bodyLen > len - ESPNOW_HEADER_LENGTH) {
+		return;
+	}
+	memcpy (item.addr, frame + 4, ENIGMAIOT_ADDR_LEN);
+	memcpy (item.data, frame + ESPNOW_HEADER_LENGTH, bodyLen);
+	item.len = bodyLen;
+	if (xQueueSend (rxQueue, &item, 0) != pdTRUE) {
+		stats.rxDrops++;
+	}
+}
+
+size_t buildPayload (uint8_t* buffer) {
+	if (PAYLOAD_ENCODING == CAYENNELPP) {
+		CayenneLPP lpp (MAX_DATA_PAYLOAD_SIZE);
+		lpp.addTemperature (0, 20 + random (100) / 10.0);
+		lpp.addRelativeHumidity (1, 40 + random (200) / 10.0);
+		lpp.addAnalogInput (2, random (330) / 100.0);
+		memcpy (buffer, lpp.getBuffer (), lpp.getSize ());
+		return lpp.getSize ();
+	} else if (PAYLOAD_ENCODING == MSG_PACK) {
+		const size_t capacity = JSON_OBJECT_SIZE (3);
+		DynamicJsonDocument json (capacity);
+		json["temp"] = 20 + random (100) / 10.0;
+		json["hum"] = 40 + random (200) / 10.0;
+		json["bat"] = random (330) / 100.0;
+		return serializeMsgPack (json, (char*)buffer, MAX_DATA_PAYLOAD_SIZE);
+	}
+	CryptModule::random (buffer, RAW_PAYLOAD_SIZE);
+	return RAW_PAYLOAD_SIZE;
+}
+
+void processGatewayFrame (rx_frame_t* frame) {
+	session_t* session = findSession (frame->addr);
+	uint16_t value;
+
+	if (!session) {
+		return;
+	}
+	switch (frame->data[0]) {
+	case SERVER_HELLO:
+		if (session->node.processServerHello (frame->data, frame->len)) {
+			stats.registrations++;
+			session->lastAccepted = 0;
+			session->nextData = millis () + random (DATA_PERIOD); // Spread data messages over period
+		}
+		break;
+	case INVALIDATE_KEY:
+		if (frame->len >= 4 && frame->data[1] == REGISTRATION_BUSY) {
+			// | msgType (1) | reason (1) | Retry after (2) |
+			stats.busy++;
+			memcpy (&value, frame->data + 2, sizeof (uint16_t));
+			session->nextHello = millis () + value;
+		} else if (frame->len >= 2 && session->node.isRegistered ()) {
+			stats.invalidations++;
+			session->node.invalidate ();
+			session->nextHello = millis ();
+		}
+		break;
+	case DOWNLINK_EMPTY:
+		// | msgType (1) | Counter (2) |. Radio retries of the same answer are ignored, as emulated nodes do not send ACK
+		if (frame->len >= 3 && session->node.isRegistered ()) {
+			memcpy (&value, frame->data + 1, sizeof (uint16_t));
+			if (value != session->lastAccepted) {
+				session->lastAccepted = value;
+				stats.dataAccepted++;
+			}
+		}
+		break;
+	}
+}
+
+void report () {
+	int registered = 0;
+
+	for (int i = 0; i < NUM_SESSIONS; i++) {
+		if (sessions[i].node.isRegistered ()) {
+			registered++;
+		}
+	}
+	Serial.printf ("%lu s. Nodes registered %d/%d. Client Hello sent %u, accepted %u, deferred %u. Keys invalidated %u\n",
+				   millis () / 1000, registered, NUM_SESSIONS, stats.helloSent, stats.registrations, stats.busy, stats.invalidations);
+	Serial.printf ("       Data sent %u, accepted %u (%.1f%%), lost %d. TX errors %u, RX drops %u\n",
+				   stats.dataSent, stats.dataAccepted, stats.dataSent ? stats.dataAccepted * 100.0 / stats.dataSent : 0,
+				   (int)(stats.dataSent - stats.dataAccepted), stats.txErrors, stats.rxDrops);
+}
+
+void setup () {
+	uint8_t chipId[ENIGMAIOT_ADDR_LEN];
+
+	Serial.begin (115200);
+	Serial.println ();
+
+	memcpy (networkKey, NETWORK_KEY, KEY_LENGTH);
+	CryptModule::getSHA256 (networkKey, KEY_LENGTH);
+
+	// Locally administered addresses. Part of board address is used so that several generators may run together
+	esp_efuse_mac_get_default (chipId);
+	for (int i = 0; i < NUM_SESSIONS; i++) {
+		uint8_t mac[ENIGMAIOT_ADDR_LEN] = { 0x02, 0xE1, chipId[4], chipId[5], (uint8_t)(i >> 8), (uint8_t)i };
+		sessions[i].node.begin (mac, networkKey, true);
+		sessions[i].nextHello = 0;
+	}
+
+	rxQueue = xQueueCreate (RX_QUEUE_SIZE, sizeof (rx_frame_t));
+
+	WiFi.mode (WIFI_STA);
+	WiFi.disconnect ();
+	wifi_promiscuous_filter_t filter = { .filter_mask = WIFI_PROMIS_FILTER_MASK_MGMT };
+	esp_wifi_set_promiscuous_filter (&filter);
+	esp_wifi_set_promiscuous_rx_cb (promiscuousRx);
+	esp_wifi_set_promiscuous (true);
+	esp_wifi_set_channel (CHANNEL, WIFI_SECOND_CHAN_NONE);
+
+	Serial.printf ("Emulating %d nodes on channel %d. Gateway " MACSTR "\n", NUM_SESSIONS, CHANNEL, MAC2STR (GATEWAY_ADDRESS));
+}
+
+void loop () {
+	uint8_t buffer[MAX_MESSAGE_LENGTH];
+	uint8_t payload[MAX_DATA_PAYLOAD_SIZE];
+	rx_frame_t frame;
+	size_t len;
+
+	while (xQueueReceive (rxQueue, &frame, 0) == pdTRUE) {
+		processGatewayFrame (&frame);
+	}
+
+	// Client Hello rate is limited for all nodes together. Nodes are checked in turn
+	if (millis () - lastHello >= 1000 / HELLO_RATE) {
+		for (int i = 0; i < NUM_SESSIONS; i++) {
+			session_t* session = &(sessions[helloIndex]);
+			helloIndex = (helloIndex + 1) % NUM_SESSIONS;
+			if (!session->node.isRegistered () && (int32_t)(millis () - session->nextHello) >= 0) {
+				if ((len = session->node.clientHello (buffer)) && sendFrame (session->node.getMacAddress (), buffer, len)) {
+					stats.helloSent++;
+				}
+				session->nextHello = millis () + HELLO_RETRY_TIME;
+				lastHello = millis ();
+				break;
+			}
+		}
+	}
+
+	for (int i = 0; i < NUM_SESSIONS; i++) {
+		session_t* session = &(sessions[i]);
+		if (session->node.isRegistered () && (int32_t)(millis () - session->nextData) >= 0) {
+			size_t payloadLen = buildPayload (payload);
+			if ((len = session->node.dataMessage (buffer, payload, payloadLen, PAYLOAD_ENCODING)) && sendFrame (session->node.getMacAddress (), buffer, len)) {
+				stats.dataSent++;
+			}
+			session->nextData += DATA_PERIOD;
+		}
+	}
+
+	if (millis () - lastReport >= REPORT_PERIOD) {
+		lastReport = millis ();
+		report ();
+	}
+}
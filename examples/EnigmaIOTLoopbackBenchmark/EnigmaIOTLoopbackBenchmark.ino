@@ -0,0 +1,214 @@
+/**
+  * @file EnigmaIOTLoopbackBenchmark.ino
+  * @version 0.9.7
+  * @date 04/02/2021
+  * @author German Martin
+  * @brief Measures gateway throughput and latency with emulated nodes, without radio
+  *
+  * Gateway runs over loopback communication layer. Emulated nodes do a real key agreement and send encrypted data messages,
+  * so that every gateway stage runs as it does with real nodes. Results are printed on serial port.
+  */
+
+#include <Arduino.h>
+
+#include <EnigmaIOTGateway.h>
+#include <loopback_hal.h>
+#include <cryptModule.h>
+#include <helperFunctions.h>
+#include <gatewayMetrics.h>
+#include <virtualNode.h>
+
+const char NETWORK_KEY[] = "EnigmaIOTLoopbackBenchmarkKey000"; // Any 32 characters
+
+const int NODE_COUNTS[] = { 1, 5, 10, NUM_NODES }; // Number of emulated nodes on every test
+const int PAYLOAD_SIZES[] = { 8, 64, MAX_DATA_PAYLOAD_SIZE }; // Data payload length on every test
+constexpr auto MESSAGES_PER_NODE = 50; // Data messages sent by every node on every test
+constexpr auto MAX_SAMPLES = NUM_NODES * MESSAGES_PER_NODE;
+constexpr auto HELLO_RETRY_TIME = 300; // ms between Client Hello messages of a node that is not registered yet
+constexpr auto TEST_TIMEOUT = 30000; // ms
+constexpr auto DRAIN_LOOPS = 10; // Idle gateway loops that end a test after all messages have been sent
+
+VirtualNode nodes[NUM_NODES];
+uint32_t lastHello[NUM_NODES]; // Value of `millis()` when last Client Hello was sent by every node
+int activeNodes = 0;
+int payloadSize = 0;
+uint8_t networkKey[KEY_LENGTH]; // Network key hashed as gateway uses it
+
+uint32_t sendTimes[MAX_SAMPLES]; // Value of `micros()` when every message was injected
+uint32_t latencies[MAX_SAMPLES]; // Time from injection to data notification of every received message
+int sent = 0;
+int received = 0;
+uint32_t reportedLost = 0;
+
+VirtualNode* findNode (const uint8_t* mac) {
+	for (int i = 0; i < activeNodes; i++) {
+		if (!memcmp (nodes[i].getMacAddress (), mac, ENIGMAIOT_ADDR_LEN)) {
+			return &(nodes[i]);
+		}
+	}
+	return NULL;
+}
+
+bool sendClientHello (int index) {
+	uint8_t buf[MAX_MESSAGE_LENGTH];
+	size_t len = nodes[index].clientHello (buf);
+
+	lastHello[index] = millis ();
+	return len && Loopback_hal.inject (nodes[index].getMacAddress (), buf, len);
+}
+
+bool sendData (VirtualNode* node, uint16_t index) {
+	uint8_t payload[MAX_DATA_PAYLOAD_SIZE];
+	uint8_t buf[MAX_MESSAGE_LENGTH];
+
+	// Payload starts with message index, so that its injection time can be found when it is notified
+	memset (payload, 0xA5, payloadSize);
+	memcpy (payload, &index, sizeof (uint16_t));
+	size_t len = node->dataMessage (buf, payload, payloadSize, RAW);
+
+	sendTimes[index] = micros ();
+	return len && Loopback_hal.inject (node->getMacAddress (), buf, len);
+}
+
+bool gatewayFrame (uint8_t* address, uint8_t* data, uint8_t len) {
+	VirtualNode* node = findNode (address);
+
+	if (!node) {
+		return false; // Nobody acknowledges it
+	}
+	if (data[0] == SERVER_HELLO && !node->isRegistered ()) {
+		if (!node->processServerHello (data, len)) {
+			Serial.printf ("Wrong Server Hello for " MACSTR "\n", MAC2STR (address));
+		}
+	}
+	return true;
+}
+
+void processRxData (uint8_t* mac, uint8_t* buffer, size_t length, uint16_t lostMessages, bool control, gatewayPayloadEncoding_t payload_type, char* nodeName) {
+	uint32_t now = micros ();
+	uint16_t index;
+
+	if (control || length < sizeof (uint16_t) || !findNode (mac)) {
+		return;
+	}
+	memcpy (&index, buffer, sizeof (uint16_t));
+	if (index < sent && received < MAX_SAMPLES) {
+		latencies[received++] = now - sendTimes[index];
+	}
+	reportedLost += lostMessages;
+}
+
+uint32_t runGateway (int* delivered) {
+	uint32_t start = micros ();
+
+	*delivered = Loopback_hal.process ();
+	EnigmaIOTGateway.handle ();
+	uint32_t elapsed = micros () - start;
+	yield ();
+	return elapsed;
+}
+
+int compareLatency (const void* a, const void* b) {
+	uint32_t x = *(const uint32_t*)a;
+	uint32_t y = *(const uint32_t*)b;
+
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+void runTest (int numNodes, int size) {
+	int delivered;
+	int registered = 0;
+	int total = numNodes * MESSAGES_PER_NODE;
+	uint32_t gatewayTime = 0;
+	uint32_t start;
+
+	activeNodes = numNodes;
+	payloadSize = size;
+	sent = 0;
+	received = 0;
+	reportedLost = 0;
+	for (int i = 0; i < numNodes; i++) {
+		// Locally administered addresses
+		uint8_t mac[ENIGMAIOT_ADDR_LEN] = { 0x02, 0xE1, 0x00, 0x00, (uint8_t)(i >> 8), (uint8_t)i };
+		nodes[i].begin (mac, networkKey);
+		lastHello[i] = 0;
+	}
+
+	// Registration. Gateway limits key agreement rate, so nodes have to retry
+	start = millis ();
+	while (registered < numNodes && millis () - start < TEST_TIMEOUT) {
+		registered = 0;
+		for (int i = 0; i < numNodes; i++) {
+			if (nodes[i].isRegistered ()) {
+				registered++;
+			} else if (!lastHello[i] || millis () - lastHello[i] > HELLO_RETRY_TIME) {
+				sendClientHello (i);
+			}
+		}
+		runGateway (&delivered);
+	}
+	uint32_t registrationTime = millis () - start;
+	if (registered < numNodes) {
+		Serial.printf ("%3d nodes: only %d registered\n", numNodes, registered);
+		return;
+	}
+
+#if ENABLE_GATEWAY_METRICS
+	GatewayMetrics.reset ();
+#endif // ENABLE_GATEWAY_METRICS
+	uint32_t lostFrames = Loopback_hal.getLostFrames ();
+
+	// Data messages are injected on bursts up to input queue size, every node in turn
+	int idleLoops = 0;
+	start = millis ();
+	while (idleLoops < DRAIN_LOOPS && millis () - start < TEST_TIMEOUT) {
+		for (int burst = 0; burst < MAX_INPUT_QUEUE_SIZE && sent < total; burst++) {
+			if (!sendData (&(nodes[sent % numNodes]), sent)) {
+				break;
+			}
+			sent++;
+		}
+		gatewayTime += runGateway (&delivered);
+		if (sent >= total && !delivered) {
+			idleLoops++;
+		}
+	}
+	uint32_t elapsed = millis () - start;
+
+	qsort (latencies, received, sizeof (uint32_t), compareLatency);
+	Serial.printf ("%3d nodes %3d bytes: %7.0f frames/s, %7.0f frames/s on gateway. Latency p50 %6u us, p99 %6u us. "
+				   "Sent %d, received %d, lost %d (%u reported by counter, %u on loopback). Registration %u ms\n",
+				   numNodes, size,
+				   elapsed ? received * 1000.0 / elapsed : 0, gatewayTime ? received * 1000000.0 / gatewayTime : 0,
+				   received ? latencies[(received - 1) * 50 / 100] : 0, received ? latencies[(received - 1) * 99 / 100] : 0,
+				   sent, received, sent - received, reportedLost, Loopback_hal.getLostFrames () - lostFrames, registrationTime);
+#if ENABLE_GATEWAY_METRICS
+	// Cost of every gateway stage during data test
+	GatewayMetrics.printJson (&Serial, false);
+	Serial.println ();
+#endif // ENABLE_GATEWAY_METRICS
+}
+
+void setup () {
+	Serial.begin (115200);
+	Serial.println ();
+	delay (1000);
+
+	memcpy (networkKey, NETWORK_KEY, KEY_LENGTH);
+	CryptModule::getSHA256 (networkKey, KEY_LENGTH);
+
+	Loopback_hal.onPeerData (gatewayFrame);
+	EnigmaIOTGateway.onDataRx (processRxData);
+	EnigmaIOTGateway.begin (&Loopback_hal, (uint8_t*)NETWORK_KEY, true);
+
+	Serial.printf ("%d messages per node. Input queue size %d\n", MESSAGES_PER_NODE, MAX_INPUT_QUEUE_SIZE);
+	for (unsigned int i = 0; i < sizeof (NODE_COUNTS) / sizeof (int); i++) {
+		for (unsigned int j = 0; j < sizeof (PAYLOAD_SIZES) / sizeof (int); j++) {
+			runTest (NODE_COUNTS[i], PAYLOAD_SIZES[j]);
+		}
+	}
+	Serial.println ("Benchmark finished");
+}
+
+void loop () {
+}
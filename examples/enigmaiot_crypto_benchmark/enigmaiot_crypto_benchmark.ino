@@ -0,0 +1,82 @@
+/**
+  * @file enigmaiot_crypto_benchmark.ino
+  * @version 0.9.7
+  * @date 04/02/2021
+  * @author German Martin
+  * @brief Measures throughput of every crypto backend available on this build
+  *
+  * Build with `-DUSE_HW_CRYPTO=1` on ESP32 to include hardware accelerated AES-GCM
+  */
+
+#include <Arduino.h>
+#include <cryptModule.h>
+#include <cryptoBackend.h>
+
+constexpr auto FRAME_LENGTH = MAX_MESSAGE_LENGTH - 1 - IV_LENGTH - TAG_LENGTH; // Largest encrypted payload on a frame
+constexpr auto ITERATIONS = 1000;
+
+uint8_t frame[FRAME_LENGTH];
+uint8_t iv[IV_LENGTH];
+uint8_t key[KEY_LENGTH];
+uint8_t aad[AAD_LENGTH + 1 + IV_LENGTH];
+uint8_t tag[TAG_LENGTH];
+
+void printResult (const char* name, const char* operation, unsigned long elapsed) {
+	float usPerFrame = (float)elapsed / ITERATIONS;
+
+	Serial.printf ("%-18s %-8s %8.1f us/frame %10.0f bytes/s\n", name, operation,
+				   usPerFrame, FRAME_LENGTH * 1000000.0 / usPerFrame);
+}
+
+void benchmark (cipherAlgorithm_t algorithm) {
+	CryptoBackend* backend = CryptModule::getBackend (algorithm);
+	unsigned long start;
+	unsigned long encryptTime = 0;
+	unsigned long decryptTime = 0;
+	uint8_t hash[SHA256_LENGTH];
+	bool ok = true;
+
+	// Every frame is decrypted just after encryption so that tag check succeeds and frame is restored
+	for (int i = 0; i < ITERATIONS; i++) {
+		start = micros ();
+		ok &= CryptModule::encryptBuffer (frame, FRAME_LENGTH, iv, IV_LENGTH, key, KEY_LENGTH - AAD_LENGTH,
+										  aad, sizeof (aad), tag, TAG_LENGTH, algorithm);
+		encryptTime += micros () - start;
+		start = micros ();
+		ok &= CryptModule::decryptBuffer (frame, FRAME_LENGTH, iv, IV_LENGTH, key, KEY_LENGTH - AAD_LENGTH,
+										  aad, sizeof (aad), tag, TAG_LENGTH, algorithm);
+		decryptTime += micros () - start;
+	}
+	printResult (backend->getName (), "encrypt", encryptTime);
+	printResult (backend->getName (), "decrypt", decryptTime);
+
+	start = micros ();
+	for (int i = 0; i < ITERATIONS; i++) {
+		backend->sha256 (frame, FRAME_LENGTH, hash);
+	}
+	printResult (backend->getName (), "sha256", micros () - start);
+
+	if (!ok) {
+		Serial.printf ("%s reported errors\n", backend->getName ());
+	}
+}
+
+void setup () {
+	Serial.begin (115200);
+	Serial.println ();
+	delay (1000);
+
+	CryptModule::random (frame, FRAME_LENGTH);
+	CryptModule::random (iv, IV_LENGTH);
+	CryptModule::random (key, KEY_LENGTH);
+	CryptModule::random (aad, sizeof (aad));
+
+	Serial.printf ("%d iterations over %d byte frames\n", ITERATIONS, FRAME_LENGTH);
+	benchmark (CHACHAPOLY_CIPHER);
+#if USE_HW_CRYPTO
+	benchmark (AES_GCM_CIPHER);
+#endif // USE_HW_CRYPTO
+}
+
+void loop () {
+}
@@ -26,6 +26,7 @@ enum peerType_t {
 
 typedef void (*comms_hal_rcvd_data)(uint8_t* address, uint8_t* data, uint8_t len);
 typedef void (*comms_hal_sent_data)(uint8_t* address, uint8_t status);
+typedef void (*comms_hal_send_complete)(uint32_t tag, uint8_t* address, uint8_t status, uint32_t latency);
 
 /**
   * @brief Interface for communication subsystem abstraction layer definition
@@ -41,6 +42,7 @@ protected:
 
 	comms_hal_rcvd_data dataRcvd = 0; ///< @brief Pointer to a function to be called on every received message
 	comms_hal_sent_data sentResult = 0; ///< @brief Pointer to a function to be called to notify last sending status
+	comms_hal_send_complete sendComplete = 0; ///< @brief Pointer to a function to be called when a tagged message sending finishes
 	peerType_t _ownPeerType; ///< @brief Stores peer type, node or gateway
 
 	/**
@@ -73,6 +75,27 @@ public:
 	  */
 	virtual int32_t send (uint8_t* da, uint8_t* data, int len) = 0;
 
+	/**
+	  * @brief Sends data to the other peer and tags message, so that its sending status can be correlated on send complete callback
+	  * @param da Destination address to send the message to
+	  * @param data Data buffer that contain the message to be sent
+	  * @param len Data length in number of bytes
+	  * @return Returns message tag. 0 if message could not be sent
+	  */
+	virtual uint32_t sendTracked (uint8_t* da, uint8_t* data, int len) = 0;
+
+	/**
+	  * @brief Checks if a peer is listening on a channel. A short message is sent to it on that channel and link layer acknowledge is awaited.
+	  * Channel is kept after probe. Sending status of probe message is not notified to upper layer
+	  * @param da Address of peer to probe
+	  * @param channel Channel to probe peer on
+	  * @param data Probe message
+	  * @param len Probe message length in number of bytes
+	  * @param timeout Maximum time to wait for acknowledge in milliseconds
+	  * @return Returns `true` if peer acknowledged probe message
+	  */
+	virtual bool probe (uint8_t* da, uint8_t channel, uint8_t* data, int len, uint32_t timeout) = 0;
+
 	/**
 	  * @brief Attach a callback function to be run on every received message
 	  * @param dataRcvd Pointer to the callback function
@@ -85,6 +108,13 @@ public:
 	  */
 	virtual void onDataSent (comms_hal_sent_data dataRcvd) = 0;
 
+	/**
+	  * @brief Attach a callback function to be run when sending of a tagged message finishes.
+	  * It gets message tag, destination address, sending status and time since message was sent in microseconds
+	  * @param sendComplete Pointer to the callback function
+	  */
+	virtual void onSendComplete (comms_hal_send_complete sendComplete) = 0;
+
 	/**
 	  * @brief Get address length that a specific communication subsystem uses
 	  * @return Returns number of bytes that is used to represent an address
@@ -18,7 +18,10 @@
 #endif
 
 #include "cryptModule.h"
+#include "cryptoBackend.h"
 #include "helperFunctions.h"
+#include "gatewayMetrics.h"
+#include "gatewayLoad.h"
 #include <cstddef>
 #include <cstdint>
 #include <regex>
@@ -40,6 +43,9 @@ void EnigmaIOTGatewayClass::doResetConfig (void) {
     if (FILESYSTEM.remove (CONFIG_FILE)){
         DEBUG_WARN ("Configuration file removed");
     }
+#if ENABLE_NODE_SNAPSHOT
+    EnigmaIOTGateway.snapshot.clear (); // Static member, so it needs gateway instance
+#endif // ENABLE_NODE_SNAPSHOT
     ESP.restart ();
 }
 
@@ -74,7 +80,7 @@ const void* memstr (const void* str, size_t str_size,
 }
 
 bool buildGetVersion (uint8_t* data, size_t& dataLen, const uint8_t* inputData, size_t inputLen) {
-	DEBUG_DBG ("Build 'Get Version' message from: %s", printHexBuffer (inputData, inputLen));
+	DEBUG_DBG ("Build 'Get Version' message from: %s", DEBUG_HEX (inputData, inputLen));
 	if (dataLen < 1) {
 		return false;
 	}
@@ -84,7 +90,7 @@ bool buildGetVersion (uint8_t* data, size_t& dataLen, const uint8_t* inputData,
 }
 
 bool buildGetSleep (uint8_t* data, size_t& dataLen, const uint8_t* inputData, size_t inputLen) {
-	DEBUG_VERBOSE ("Build 'Get Sleep' message from: %s", printHexBuffer (inputData, inputLen));
+	DEBUG_VERBOSE ("Build 'Get Sleep' message from: %s", DEBUG_HEX (inputData, inputLen));
 	if (dataLen < 1) {
 		return false;
 	}
@@ -94,7 +100,7 @@ bool buildGetSleep (uint8_t* data, size_t& dataLen, const uint8_t* inputData, si
 }
 
 bool buildSetIdentify (uint8_t* data, size_t& dataLen, const uint8_t* inputData, size_t inputLen) {
-	DEBUG_VERBOSE ("Build 'Set Identify' message from: %s", printHexBuffer (inputData, inputLen));
+	DEBUG_VERBOSE ("Build 'Set Identify' message from: %s", DEBUG_HEX (inputData, inputLen));
 	if (dataLen < 1) {
 		return false;
 	}
@@ -104,7 +110,7 @@ bool buildSetIdentify (uint8_t* data, size_t& dataLen, const uint8_t* inputData,
 }
 
 bool buildGetRSSI (uint8_t* data, size_t& dataLen, const uint8_t* inputData, size_t inputLen) {
-	DEBUG_VERBOSE ("Build 'Get RSSI' message from: %s", printHexBuffer (inputData, inputLen));
+	DEBUG_VERBOSE ("Build 'Get RSSI' message from: %s", DEBUG_HEX (inputData, inputLen));
 	if (dataLen < 1) {
 		return false;
 	}
@@ -114,7 +120,7 @@ bool buildGetRSSI (uint8_t* data, size_t& dataLen, const uint8_t* inputData, siz
 }
 
 bool buildGetName (uint8_t* data, size_t& dataLen, const uint8_t* inputData, size_t inputLen) {
-	DEBUG_VERBOSE ("Build 'Get Node Name and Address' message from: %s", printHexBuffer (inputData, inputLen));
+	DEBUG_VERBOSE ("Build 'Get Node Name and Address' message from: %s", DEBUG_HEX (inputData, inputLen));
 	if (dataLen < 1) {
 		return false;
 	}
@@ -124,7 +130,7 @@ bool buildGetName (uint8_t* data, size_t& dataLen, const uint8_t* inputData, siz
 }
 
 bool buildSetName (uint8_t* data, size_t& dataLen, const uint8_t* inputData, size_t inputLen) {
-	DEBUG_VERBOSE ("Build 'Set Node Name' message from: %s", printHexBuffer (inputData, inputLen));
+	DEBUG_VERBOSE ("Build 'Set Node Name' message from: %s", DEBUG_HEX (inputData, inputLen));
 	if (dataLen < NODE_NAME_LENGTH + 1) {
 		DEBUG_ERROR ("Not enough space to build message");
 		return false;
@@ -140,7 +146,7 @@ bool buildSetName (uint8_t* data, size_t& dataLen, const uint8_t* inputData, siz
 }
 
 bool buildSetResetConfig (uint8_t* data, size_t& dataLen, const uint8_t* inputData, size_t inputLen) {
-	DEBUG_VERBOSE ("Build 'Reset Config' message from: %s", printHexBuffer (inputData, inputLen));
+	DEBUG_VERBOSE ("Build 'Reset Config' message from: %s", DEBUG_HEX (inputData, inputLen));
 	if (dataLen < 1) {
 		return false;
 	}
@@ -150,7 +156,7 @@ bool buildSetResetConfig (uint8_t* data, size_t& dataLen, const uint8_t* inputDa
 }
 
 bool buildRestartNode (uint8_t* data, size_t& dataLen, const uint8_t* inputData, size_t inputLen) {
-	DEBUG_VERBOSE ("Build 'Restart Node' message from: %s", printHexBuffer (inputData, inputLen));
+	DEBUG_VERBOSE ("Build 'Restart Node' message from: %s", DEBUG_HEX (inputData, inputLen));
 	if (dataLen < 1) {
 		return false;
 	}
@@ -160,7 +166,7 @@ bool buildRestartNode (uint8_t* data, size_t& dataLen, const uint8_t* inputData,
 }
 
 bool buildSendBrcastKey (uint8_t* data, size_t& dataLen, const uint8_t* key, size_t keyLen) {
-	DEBUG_VERBOSE ("Build 'Send Broadcast Key' message from: %s", printHexBuffer (key, keyLen));
+	DEBUG_VERBOSE ("Build 'Send Broadcast Key' message from: %s", DEBUG_HEX (key, keyLen));
 	if (key && keyLen == KEY_LENGTH) {
 		data[0] = (uint8_t)control_message_type::BRCAST_KEY;
 		memcpy (data + 1, key, keyLen);
@@ -172,6 +178,38 @@ bool buildSendBrcastKey (uint8_t* data, size_t& dataLen, const uint8_t* key, siz
 
 }
 
+bool buildSendGroupKey (uint8_t* data, size_t& dataLen, int8_t group, const uint8_t* key, uint16_t counter) {
+	/*
+	* ------------------------------------------------------
+	*| msgType (1) | group (1) | [key (32) | counter (2)] |
+	* ------------------------------------------------------
+	*/
+	size_t msgLen = key ? 2 + KEY_LENGTH + sizeof (uint16_t) : 2;
+
+	if (dataLen < msgLen) {
+		return false;
+	}
+	data[0] = (uint8_t)control_message_type::GROUP_KEY;
+	data[1] = (uint8_t)group;
+	if (key) {
+		memcpy (data + 2, key, KEY_LENGTH); // No key means that node has to delete it
+		memcpy (data + 2 + KEY_LENGTH, &counter, sizeof (uint16_t)); // Node does not accept older group messages after a restart
+	}
+	dataLen = msgLen;
+	return true;
+}
+
+bool buildSendSessionTicket (uint8_t* data, size_t& dataLen, const uint8_t* inputData, size_t inputLen) {
+	if (inputData && inputLen == SESSION_TICKET_LENGTH + KEY_LENGTH && dataLen > inputLen) {
+		data[0] = (uint8_t)control_message_type::SESSION_TICKET;
+		memcpy (data + 1, inputData, inputLen);
+		dataLen = inputLen + 1;
+		return true;
+	} else {
+		return false;
+	}
+}
+
 int getNextNumber (char*& data, size_t& len/*, char* &position*/) {
 	char strNum[10];
 	int number;
@@ -309,7 +347,18 @@ bool buildOtaMsg (uint8_t* data, size_t& dataLen, const uint8_t* inputData, size
 			decodedLen++;
 		}
 
-		DEBUG_VERBOSE ("Payload data: %s", printHexBuffer (data, decodedLen));
+		// Optional window size requests windowed OTA
+		if (payloadLen > 33 && payload[32] == ',') {
+			int window = atoi (payload + 33);
+			if (window > 0 && window <= 255) {
+				*tempData = (uint8_t)window;
+				tempData++;
+				decodedLen++;
+				DEBUG_WARN ("OTA window = %d chunks", window);
+			}
+		}
+
+		DEBUG_VERBOSE ("Payload data: %s", DEBUG_HEX (data, decodedLen));
 	}
 
 	if ((decodedLen) > MAX_MESSAGE_LENGTH) {
@@ -317,12 +366,44 @@ bool buildOtaMsg (uint8_t* data, size_t& dataLen, const uint8_t* inputData, size
 		return false;
 	}
 	dataLen = decodedLen;
-	DEBUG_VERBOSE ("Payload has %u bytes of data: %s", dataLen, printHexBuffer (data, dataLen));
+	DEBUG_VERBOSE ("Payload has %u bytes of data: %s", dataLen, DEBUG_HEX (data, dataLen));
+	return true;
+}
+
+bool buildOtaBinMsg (uint8_t* data, size_t& dataLen, const uint8_t* inputData, size_t inputLen) {
+	/*
+	* Input is already in node format so it is only prepended with message type
+	* ---------------------------------
+	*| msgIdx (2) | chunk data (....) |
+	* ---------------------------------
+	*/
+	uint16_t msgIdx;
+
+	if (inputLen <= sizeof (uint16_t)) {
+		DEBUG_ERROR ("Binary OTA message is too short: %u bytes", inputLen);
+		return false;
+	}
+	if (inputLen + 1 > MAX_MESSAGE_LENGTH || inputLen + 1 > dataLen) {
+		DEBUG_ERROR ("Binary OTA message too long. %u bytes.", inputLen);
+		return false;
+	}
+
+	memcpy (&msgIdx, inputData, sizeof (uint16_t));
+	if (msgIdx == 0) {
+		DEBUG_ERROR ("OTA message #0 cannot be sent as binary");
+		return false;
+	}
+	DEBUG_INFO ("Binary OTA message number %u", msgIdx);
+	lastOTAmsg = millis ();
+
+	data[0] = (uint8_t)control_message_type::OTA;
+	memcpy (data + 1, inputData, inputLen);
+	dataLen = inputLen + 1;
 	return true;
 }
 
 bool buildSetSleep (uint8_t* data, size_t& dataLen, const uint8_t* inputData, size_t inputLen) {
-	DEBUG_VERBOSE ("Build 'Set Sleep' message from: %s", printHexBuffer (inputData, inputLen));
+	DEBUG_VERBOSE ("Build 'Set Sleep' message from: %s", DEBUG_HEX (inputData, inputLen));
 	if (dataLen < 5) {
 		DEBUG_ERROR ("Not enough space to build message");
 		return false;
@@ -354,10 +435,18 @@ bool buildSetSleep (uint8_t* data, size_t& dataLen, const uint8_t* inputData, si
 
 bool EnigmaIOTGatewayClass::sendDownstream (uint8_t* mac, const uint8_t* data, size_t len, control_message_type_t controlData, gatewayPayloadEncoding_t encoding, char* nodeName) {
 	Node* node;
-	if (nodeName) {
+	int8_t group = -1;
+	if (nodeName && nodeName[0] == GROUP_ADDRESS_PREFIX) {
+		group = nodelist.getGroupIndex (nodeName + 1);
+		if (group < 0) {
+			DEBUG_ERROR ("Group %s not found", nodeName + 1);
+			return false;
+		}
+		node = NULL;
+	} else if (nodeName) {
 		node = nodelist.getNodeFromName (nodeName);
 		if (node) {
-            DEBUG_DBG ("Message to node %s with address %s", nodeName, mac2str (node->getMacAddress ()));
+            DEBUG_DBG ("Message to node %s with address %s", nodeName, DEBUG_MAC (node->getMacAddress ()));
 		}
 	} else {
 		node = nodelist.getNodeFromMAC (mac);
@@ -368,7 +457,7 @@ bool EnigmaIOTGatewayClass::sendDownstream (uint8_t* mac, const uint8_t* data, s
 	if (len == 0 && (controlData == USERDATA_GET || controlData == USERDATA_SET))
 		return false;
 
-	DEBUG_VERBOSE ("Downstream: %s", printHexBuffer (data, len));
+	DEBUG_VERBOSE ("Downstream: %s", DEBUG_HEX (data, len));
 	DEBUG_DBG ("Downstream message type 0x%02X", controlData);
 
 	size_t dataLen = MAX_MESSAGE_LENGTH;
@@ -379,78 +468,111 @@ bool EnigmaIOTGatewayClass::sendDownstream (uint8_t* mac, const uint8_t* data, s
 			DEBUG_ERROR ("Error building get Version message");
 			return false;
 		}
-		DEBUG_VERBOSE ("Get Version. Len: %d Data %s", dataLen, printHexBuffer (downstreamData, dataLen));
+		DEBUG_VERBOSE ("Get Version. Len: %d Data %s", dataLen, DEBUG_HEX (downstreamData, dataLen));
 		break;
 	case control_message_type::SLEEP_GET:
 		if (!buildGetSleep (downstreamData, dataLen, data, len)) {
 			DEBUG_ERROR ("Error building get Sleep message");
 			return false;
 		}
-		DEBUG_VERBOSE ("Get Sleep. Len: %d Data %s", dataLen, printHexBuffer (downstreamData, dataLen));
+		DEBUG_VERBOSE ("Get Sleep. Len: %d Data %s", dataLen, DEBUG_HEX (downstreamData, dataLen));
 		break;
 	case control_message_type::SLEEP_SET:
 		if (!buildSetSleep (downstreamData, dataLen, data, len)) {
 			DEBUG_ERROR ("Error building set Sleep message");
 			return false;
 		}
-		DEBUG_VERBOSE ("Set Sleep. Len: %d Data %s", dataLen, printHexBuffer (downstreamData, dataLen));
+		DEBUG_VERBOSE ("Set Sleep. Len: %d Data %s", dataLen, DEBUG_HEX (downstreamData, dataLen));
 		break;
 	case control_message_type::OTA:
 		if (!buildOtaMsg (downstreamData, dataLen, data, len)) {
 			DEBUG_ERROR ("Error building OTA message");
 			return false;
 		}
-		DEBUG_VERBOSE ("OTA message. Len: %d Data %s", dataLen, printHexBuffer (downstreamData, dataLen));
+		DEBUG_VERBOSE ("OTA message. Len: %d Data %s", dataLen, DEBUG_HEX (downstreamData, dataLen));
+		break;
+	case control_message_type::OTA_BIN:
+		if (!buildOtaBinMsg (downstreamData, dataLen, data, len)) {
+			DEBUG_ERROR ("Error building binary OTA message");
+			return false;
+		}
+		DEBUG_VERBOSE ("Binary OTA message. Len: %d Data %s", dataLen, DEBUG_HEX (downstreamData, dataLen));
+		controlData = control_message_type::OTA;
 		break;
 	case control_message_type::IDENTIFY:
 		if (!buildSetIdentify (downstreamData, dataLen, data, len)) {
 			DEBUG_ERROR ("Error building Identify message");
 			return false;
 		}
-		DEBUG_VERBOSE ("Identify message. Len: %d Data %s", dataLen, printHexBuffer (downstreamData, dataLen));
+		DEBUG_VERBOSE ("Identify message. Len: %d Data %s", dataLen, DEBUG_HEX (downstreamData, dataLen));
 		break;
 	case control_message_type::RESET:
 		if (!buildSetResetConfig (downstreamData, dataLen, data, len)) {
 			DEBUG_ERROR ("Error building Reset message");
 			return false;
 		}
-		DEBUG_VERBOSE ("Reset Config message. Len: %d Data %s", dataLen, printHexBuffer (downstreamData, dataLen));
+		DEBUG_VERBOSE ("Reset Config message. Len: %d Data %s", dataLen, DEBUG_HEX (downstreamData, dataLen));
 		break;
 	case control_message_type::RSSI_GET:
 		if (!buildGetRSSI (downstreamData, dataLen, data, len)) {
 			DEBUG_ERROR ("Error building get RSSI message");
 			return false;
 		}
-		DEBUG_VERBOSE ("Get RSSI message. Len: %d Data %s", dataLen, printHexBuffer (downstreamData, dataLen));
+		DEBUG_VERBOSE ("Get RSSI message. Len: %d Data %s", dataLen, DEBUG_HEX (downstreamData, dataLen));
 		break;
 	case control_message_type::NAME_GET:
 		if (!buildGetName (downstreamData, dataLen, data, len)) {
 			DEBUG_ERROR ("Error building get name message");
 			return false;
 		}
-		DEBUG_VERBOSE ("Get name message. Len: %d Data %s", dataLen, printHexBuffer (downstreamData, dataLen));
+		DEBUG_VERBOSE ("Get name message. Len: %d Data %s", dataLen, DEBUG_HEX (downstreamData, dataLen));
 		break;
 	case control_message_type::NAME_SET:
 		if (!buildSetName (downstreamData, dataLen, data, len)) {
 			DEBUG_ERROR ("Error building set name message");
 			return false;
 		}
-		DEBUG_VERBOSE ("Set name message. Len: %d Data %s", dataLen, printHexBuffer (downstreamData, dataLen));
+		DEBUG_VERBOSE ("Set name message. Len: %d Data %s", dataLen, DEBUG_HEX (downstreamData, dataLen));
 		break;
 	case control_message_type::RESTART_NODE:
 		if (!buildRestartNode (downstreamData, dataLen, data, len)) {
 			DEBUG_ERROR ("Error building restart node message");
 			return false;
 		}
-		DEBUG_VERBOSE ("Restart node message. Len: %d Data %s", dataLen, printHexBuffer (downstreamData, dataLen));
+		DEBUG_VERBOSE ("Restart node message. Len: %d Data %s", dataLen, DEBUG_HEX (downstreamData, dataLen));
 		break;
 	case control_message_type::BRCAST_KEY:
 		if (!buildSendBrcastKey (downstreamData, dataLen, nodelist.getBroadcastNode ()->getEncriptionKey (), KEY_LENGTH)) {
 			DEBUG_ERROR ("Error building broadcast key message");
 			return false;
 		}
-		DEBUG_VERBOSE ("Broadcast key message. Len: %d Data %s", dataLen, printHexBuffer (downstreamData, dataLen));
+		DEBUG_VERBOSE ("Broadcast key message. Len: %d Data %s", dataLen, DEBUG_HEX (downstreamData, dataLen));
+		break;
+	case control_message_type::SESSION_TICKET:
+		if (!buildSendSessionTicket (downstreamData, dataLen, data, len)) {
+			DEBUG_ERROR ("Error building session ticket message");
+			return false;
+		}
+		DEBUG_VERBOSE ("Session ticket message. Len: %d", dataLen);
 		break;
+	case control_message_type::GROUP_JOIN:
+	case control_message_type::GROUP_LEAVE:
+		{
+			char groupName[NODE_NAME_LENGTH];
+			size_t nameLen = data ? strnlen ((char*)data, len) : 0; // Name may come with its null terminator
+
+			if (!node || nameLen == 0 || nameLen >= NODE_NAME_LENGTH) {
+				DEBUG_ERROR ("Wrong group membership message");
+				return false;
+			}
+			memcpy (groupName, data, nameLen);
+			groupName[nameLen] = '\0';
+			if (controlData == control_message_type::GROUP_JOIN) {
+				return joinGroup (node->getMacAddress (), groupName);
+			} else {
+				return leaveGroup (node->getMacAddress (), groupName);
+			}
+		}
 	case control_message_type::USERDATA_GET:
 		DEBUG_INFO ("Data message GET");
 		break;
@@ -464,6 +586,22 @@ bool EnigmaIOTGatewayClass::sendDownstream (uint8_t* mac, const uint8_t* data, s
 
 	DEBUG_INFO ("Send downstream");
 
+	if (group >= 0) {
+		switch (controlData) {
+		case control_message_type::USERDATA_GET:
+		case control_message_type::USERDATA_SET:
+			return downstreamGroupMessage (group, data, len, controlData, encoding);
+		case control_message_type::OTA:
+		case control_message_type::NAME_SET:
+		case control_message_type::BRCAST_KEY:
+		case control_message_type::SESSION_TICKET:
+			DEBUG_ERROR ("Command 0x%02X cannot be sent to a group", controlData);
+			return false;
+		default:
+			return downstreamGroupMessage (group, downstreamData, dataLen, controlData);
+		}
+	}
+
 	if (node) {
 		if (controlData != control_message_type::USERDATA_GET && controlData != control_message_type::USERDATA_SET)
 			return downstreamDataMessage (node, downstreamData, dataLen, controlData);
@@ -473,11 +611,13 @@ bool EnigmaIOTGatewayClass::sendDownstream (uint8_t* mac, const uint8_t* data, s
 				return false;
 			} else
 				return downstreamDataMessage (node, data, len, controlData);
-		} else
+		} else if (len > MAX_DATA_PAYLOAD_SIZE)
+			return downstreamFragmentedData (node, data, len, controlData, encoding);
+		else
 			return downstreamDataMessage (node, data, len, controlData, encoding);
 	} else {
 		//char addr[ENIGMAIOT_ADDR_LEN * 3];
-		DEBUG_ERROR ("Downlink destination %s not found", nodeName ? nodeName : mac2str (mac));
+		DEBUG_ERROR ("Downlink destination %s not found", nodeName ? nodeName : DEBUG_MAC (mac));
 		return false;
 	}
 }
@@ -488,6 +628,9 @@ bool EnigmaIOTGatewayClass::configWiFiManager () {
 	wifiManager = new AsyncWiFiManager (server, dns);
 
 	char networkKey[33] = "";
+#if ENABLE_MULTI_GATEWAY
+	char ticketKey[33] = "";
+#endif // ENABLE_MULTI_GATEWAY
 	//char networkName[NETWORK_NAME_LENGTH] = "";
 	char channel[4];
 	//String (gwConfig.channel).toCharArray (channel, 4);
@@ -497,11 +640,17 @@ bool EnigmaIOTGatewayClass::configWiFiManager () {
 	AsyncWiFiManagerParameter netNameParam ("netname", "Network Name", gwConfig.networkName, (int)NETWORK_NAME_LENGTH - 1, "required type=\"text\" pattern=\"^[^/\\\\]+$\" maxlength=20");
 	AsyncWiFiManagerParameter netKeyParam ("netkey", "NetworkKey", networkKey, 33, "required type=\"password\" minlength=\"8\" maxlength=\"32\"");
 	AsyncWiFiManagerParameter channelParam ("channel", "WiFi Channel", channel, 4, "required type=\"number\" min=\"0\" max=\"13\" step=\"1\"");
+#if ENABLE_MULTI_GATEWAY
+	AsyncWiFiManagerParameter ticketKeyParam ("ticketkey", "Gateway Ticket Key", ticketKey, 33, "type=\"password\" minlength=\"8\" maxlength=\"32\"");
+#endif // ENABLE_MULTI_GATEWAY
 
 	wifiManager->setCustomHeadElement ("<style>input:invalid {border: 2px dashed red;input:valid{border: 2px solid black;}</style>");
 	wifiManager->addParameter (&netKeyParam);
 	wifiManager->addParameter (&channelParam);
 	wifiManager->addParameter (&netNameParam);
+#if ENABLE_MULTI_GATEWAY
+	wifiManager->addParameter (&ticketKeyParam);
+#endif // ENABLE_MULTI_GATEWAY
 	wifiManager->addParameter (new AsyncWiFiManagerParameter ("<br>"));
 
 	if (notifyWiFiManagerStarted) {
@@ -560,7 +709,7 @@ bool EnigmaIOTGatewayClass::configWiFiManager () {
 					memcpy (this->gwConfig.networkKey, netKey, keySize);
 					memcpy (this->plainNetKey, netKey, keySize);
 					CryptModule::getSHA256 (this->gwConfig.networkKey, KEY_LENGTH);
-					DEBUG_DBG ("Raw network Key: %s", printHexBuffer (this->gwConfig.networkKey, KEY_LENGTH));
+					DEBUG_DBG ("Raw network Key: %s", DEBUG_HEX (this->gwConfig.networkKey, KEY_LENGTH));
 				} else {
 					DEBUG_INFO ("Network key password field empty. Keeping the old one");
 				}
@@ -580,6 +729,18 @@ bool EnigmaIOTGatewayClass::configWiFiManager () {
 				DEBUG_WARN ("Network name parameter error");
 				result = false;
 			}
+
+#if ENABLE_MULTI_GATEWAY
+			const char* tckKey = ticketKeyParam.getValue ();
+			if (tckKey && (tckKey[0] != '\0')) { // If password is empty, keep the old one
+				if (!setTicketKey (tckKey)) {
+					DEBUG_WARN ("Ticket key parameter error");
+					result = false;
+				}
+			} else {
+				DEBUG_INFO ("Ticket key password field empty. Keeping the old one");
+			}
+#endif // ENABLE_MULTI_GATEWAY
 		} else {
 			DEBUG_DBG ("Configuration does not need to be saved");
 		}
@@ -611,7 +772,7 @@ bool EnigmaIOTGatewayClass::loadFlashData () {
 			//size_t size = configFile.size ();
             DEBUG_DBG ("%s opened. %u bytes", CONFIG_FILE, configFile.size ());
 
-			const size_t capacity = JSON_OBJECT_SIZE (4) + 160;
+			const size_t capacity = JSON_OBJECT_SIZE (5) + 200;
 			bool json_error = false;
 #if ARDUINOJSON_VERSION_MAJOR == 6
 			DynamicJsonDocument doc (capacity);
@@ -649,6 +810,11 @@ bool EnigmaIOTGatewayClass::loadFlashData () {
 			gwConfig.channel = doc["channel"].as<int> ();
 			strncpy ((char*)gwConfig.networkKey, doc["networkKey"] | "", sizeof (gwConfig.networkKey));
 			strncpy (gwConfig.networkName, doc["networkName"] | "", sizeof (gwConfig.networkName));
+#if ENABLE_MULTI_GATEWAY
+			if (doc.containsKey ("ticketKey")) { // Optional. Tickets are only valid on this gateway without it
+				setTicketKey (doc["ticketKey"].as<const char*> ());
+			}
+#endif // ENABLE_MULTI_GATEWAY
 
 			if (json_correct) {
 				DEBUG_VERBOSE ("Gateway configuration successfuly read");
@@ -659,7 +825,7 @@ bool EnigmaIOTGatewayClass::loadFlashData () {
 			DEBUG_VERBOSE ("Network key: %s", gwConfig.networkKey);
 			strncpy (plainNetKey, (char*)gwConfig.networkKey, KEY_LENGTH);
 			CryptModule::getSHA256 (gwConfig.networkKey, KEY_LENGTH);
-			DEBUG_VERBOSE ("Raw Network key: %s", printHexBuffer (gwConfig.networkKey, KEY_LENGTH));
+			DEBUG_VERBOSE ("Raw Network key: %s", DEBUG_HEX (gwConfig.networkKey, KEY_LENGTH));
 
 #if DEBUG_LEVEL >= DBG
 			char* output;
@@ -696,13 +862,18 @@ bool EnigmaIOTGatewayClass::saveFlashData () {
 		return false;
 	}
 
-	const size_t capacity = JSON_OBJECT_SIZE (4) + 160;
+	const size_t capacity = JSON_OBJECT_SIZE (5) + 200;
 	DynamicJsonDocument doc (capacity);
 
     doc["type"] = "gw";
 	doc["channel"] = gwConfig.channel;
 	doc["networkKey"] = plainNetKey;
 	doc["networkName"] = gwConfig.networkName;
+#if ENABLE_MULTI_GATEWAY
+	if (plainTicketKey[0] != '\0') {
+		doc["ticketKey"] = plainTicketKey;
+	}
+#endif // ENABLE_MULTI_GATEWAY
 
 	if (serializeJson (doc, configFile) == 0) {
 		DEBUG_ERROR ("Failed to write to file");
@@ -734,20 +905,28 @@ bool EnigmaIOTGatewayClass::saveFlashData () {
 }
 
 void EnigmaIOTGatewayClass::begin (Comms_halClass* comm, uint8_t* networkKey, bool useDataCounter) {
-	this->input_queue = new EnigmaIOTRingBuffer<msg_queue_item_t> (MAX_INPUT_QUEUE_SIZE);
+	this->input_queue = new EnigmaIOTLockFreeRingBuffer<msg_queue_item_t> (MAX_INPUT_QUEUE_SIZE);
+#if ENABLE_GATEWAY_METRICS
+	GatewayMetrics.begin ();
+#endif // ENABLE_GATEWAY_METRICS
+	this->sendCompleteQueue = new EnigmaIOTLockFreeRingBuffer<send_complete_item_t> (2 * MAX_DOWNLINK_INFLIGHT); // Untracked messages are reported too
 	this->comm = comm;
 	this->useCounter = useDataCounter;
 
 	uint8_t broadcastKey[KEY_LENGTH];
 	nodelist.initBroadcastNode ();
 	CryptModule::random (broadcastKey, KEY_LENGTH); // Generate random broadcast key
-	DEBUG_DBG ("Broadcast key: %s", printHexBuffer (broadcastKey, KEY_LENGTH));
+	DEBUG_DBG ("Broadcast key: %s", DEBUG_HEX (broadcastKey, KEY_LENGTH));
 	nodelist.getBroadcastNode ()->setEncryptionKey (broadcastKey);
+	CryptModule::random (ticketKey, KEY_LENGTH); // Tickets issued before a restart are not valid anymore
 
 	if (networkKey) {
 		memcpy (this->gwConfig.networkKey, networkKey, KEY_LENGTH);
 		strncpy (plainNetKey, (char*)networkKey, KEY_LENGTH);
 		CryptModule::getSHA256 (this->gwConfig.networkKey, KEY_LENGTH);
+#if ENABLE_MULTI_GATEWAY
+		setSharedTicketKey ();
+#endif // ENABLE_MULTI_GATEWAY
 	} else {
         if (!FILESYSTEM.begin ()) {
 			DEBUG_ERROR ("Error mounting flash");
@@ -776,50 +955,111 @@ void EnigmaIOTGatewayClass::begin (Comms_halClass* comm, uint8_t* networkKey, bo
 		} else {
 			DEBUG_INFO ("Configuration loaded from flash");
 		}
+#if ENABLE_NODE_SNAPSHOT
+		restoreSnapshot ();
+#endif // ENABLE_NODE_SNAPSHOT
+#if ENABLE_MULTI_GATEWAY
+		setSharedTicketKey (); // Snapshot may have been saved with other key
+#endif // ENABLE_MULTI_GATEWAY
 
 		initWiFi (gwConfig.channel, gwConfig.networkName, plainNetKey, COMM_GATEWAY);
-		comm->begin (NULL, gwConfig.channel, COMM_GATEWAY);
-		comm->onDataRcvd (rx_cb);
-		comm->onDataSent (tx_cb);
+	}
+
+	// Communication layer is started on both cases, so that gateway may run with a given key on layers that do not need WiFi
+	comm->begin (NULL, gwConfig.channel, COMM_GATEWAY);
+	comm->onDataRcvd (rx_cb);
+	comm->onDataSent (tx_cb);
+	comm->onSendComplete (send_complete_cb);
+#if ENABLE_MULTI_GATEWAY
+	updateLoad ();
+#endif // ENABLE_MULTI_GATEWAY
 
 #if ENABLE_REST_API
-        DEBUG_INFO ("GW API started");
+	if (!networkKey) {
+		DEBUG_INFO ("GW API started");
 		GwAPI.begin ();
+	}
 #endif
+}
+
+#if ENABLE_NODE_SNAPSHOT
+void EnigmaIOTGatewayClass::getSnapshotState (gateway_snapshot_t* gwState) {
+	memcpy (gwState->ticketKey, ticketKey, KEY_LENGTH);
+	memcpy (gwState->broadcastKey, nodelist.getBroadcastNode ()->getEncriptionKey (), KEY_LENGTH);
+	gwState->lastBroadcastMsgCounter = nodelist.getLastBroadcastMsgCounter ();
+}
+
+void EnigmaIOTGatewayClass::restoreSnapshot () {
+	gateway_snapshot_t gwState;
+
+	snapshot.begin (gwConfig.networkKey);
+	if (snapshot.restore (&nodelist, &gwState)) {
+		memcpy (ticketKey, gwState.ticketKey, KEY_LENGTH);
+		nodelist.getBroadcastNode ()->setEncryptionKey (gwState.broadcastKey);
+		// Counter may have advanced since last save. Skip a whole step so that nodes do not drop next broadcast
+		nodelist.setLastBroadcastMsgCounter (gwState.lastBroadcastMsgCounter + 2 * NODE_SNAPSHOT_COUNTER_STEP);
+		DEBUG_INFO ("Gateway keys restored from snapshot");
 	}
+	snapshotBroadcastCounter = nodelist.getLastBroadcastMsgCounter ();
+
+	// Rewrite snapshot so that it starts with current gateway state and has no broken records
+	getSnapshotState (&gwState);
+	snapshotEnabled = snapshot.compact (&nodelist, &gwState);
+	memset (&gwState, 0, sizeof (gwState));
+}
+
+void EnigmaIOTGatewayClass::updateSnapshot () {
+	bool gwChanged = (uint16_t)(nodelist.getLastBroadcastMsgCounter () - snapshotBroadcastCounter) >= NODE_SNAPSHOT_COUNTER_STEP;
+
+	if (!snapshotEnabled || (!gwChanged && !nodelist.getDirtyNode () && !nodelist.getDirtyGroups ())) {
+		return;
+	}
+
+	gateway_snapshot_t gwState;
+	getSnapshotState (&gwState);
+	if (snapshot.save (&nodelist, &gwState, gwChanged) && gwChanged) {
+		snapshotBroadcastCounter = gwState.lastBroadcastMsgCounter;
+	}
+	memset (&gwState, 0, sizeof (gwState));
 }
+#endif // ENABLE_NODE_SNAPSHOT
 
 bool EnigmaIOTGatewayClass::addInputMsgQueue (const uint8_t* addr, const uint8_t* msg, size_t len) {
-	msg_queue_item_t message;
+	// This runs on WiFi task. Message is written directly on queue slot, without locks nor debug output
+	if (len > MAX_MESSAGE_LENGTH) {
+		inputQueueDrops++;
+		METRICS_COUNT (METRIC_INPUT_DROPS);
+		return false;
+	}
 
-	message.len = len;
-	memcpy (message.data, msg, len);
-	memcpy (message.addr, addr, ENIGMAIOT_ADDR_LEN);
+	msg_queue_item_t* message = input_queue->reserve ();
+
+	if (!message) {
+		inputQueueDrops++;
+		METRICS_COUNT (METRIC_INPUT_DROPS);
+		return false;
+	}
+
+	message->len = len;
+	memcpy (message->data, msg, len);
+	memcpy (message->addr, addr, ENIGMAIOT_ADDR_LEN);
+#if ENABLE_GATEWAY_METRICS
+	message->queuedTime = micros ();
+#endif // ENABLE_GATEWAY_METRICS
+	input_queue->commit ();
+	METRICS_SET (METRIC_INPUT_QUEUE, input_queue->size ());
+#if ENABLE_GATEWAY_PIPELINE
+	if (gatewayTask) {
+		xTaskNotifyGive (gatewayTask);
+	}
+#endif // ENABLE_GATEWAY_PIPELINE
 
-#ifdef ESP32
-	portENTER_CRITICAL (&myMutex);
-#else
-	noInterrupts ();
-#endif
-	input_queue->push (&message);
-	//char macstr[ENIGMAIOT_ADDR_LEN * 3];
-	DEBUG_DBG ("Message 0x%02X added from %s. Size: %d", message.data[0], mac2str (message.addr), input_queue->size ());
-#ifdef ESP32
-	portEXIT_CRITICAL (&myMutex);
-#else
-	interrupts ();
-#endif
 	return true;
 }
 
 msg_queue_item_t* EnigmaIOTGatewayClass::getInputMsgQueue (msg_queue_item_t* buffer) {
-
 	msg_queue_item_t* message;
-#ifdef esp32
-	portENTER_CRITICAL (&myMutex);
-#else
-	noInterrupts ();
-#endif
+
 	message = input_queue->front ();
 	if (message) {
 		DEBUG_DBG ("EnigmaIOT message got from queue. Size: %d", input_queue->size ());
@@ -827,13 +1067,6 @@ msg_queue_item_t* EnigmaIOTGatewayClass::getInputMsgQueue (msg_queue_item_t* buf
 		memcpy (buffer->addr, message->addr, ENIGMAIOT_ADDR_LEN);
 		buffer->len = message->len;
 		popInputMsgQueue ();
-	}
-#ifdef esp32
-	portEXIT_CRITICAL (&myMutex);
-#else
-	interrupts ();
-#endif
-	if (message) {
 		return buffer;
 	} else {
 		return NULL;
@@ -851,6 +1084,257 @@ void EnigmaIOTGatewayClass::rx_cb (uint8_t* mac_addr, uint8_t* data, uint8_t len
 	EnigmaIOTGateway.addInputMsgQueue (mac_addr, data, len);
 }
 
+bool EnigmaIOTGatewayClass::processSchemaData (const uint8_t* mac, uint8_t* data, size_t len, uint16_t lostMessages, gatewayPayloadEncoding_t encoding, char* nodeName, int64_t timestamp) {
+	Node* node = nodelist.getNodeFromMAC (mac);
+	SchemaDecoder* schema = node ? node->getSchema () : NULL;
+
+	if (!schema) {
+		return false;
+	}
+
+	if (encoding == SCHEMA_DEF) {
+		if (!schema->setDefinition (data, len)) {
+			DEBUG_WARN ("Wrong schema definition from " MACSTR, MAC2STR (mac));
+			return false;
+		}
+		return true;
+	}
+
+	uint8_t expanded[SCHEMA_MAX_EXPANDED_LENGTH];
+	size_t expandedLen = sizeof (expanded);
+	schema_result_t result = schema->expand (data, len, expanded, expandedLen);
+
+	if (result == SCHEMA_UNKNOWN) {
+		if (schema->shouldRequest ()) {
+			uint8_t request = control_message_type::SCHEMA_GET;
+			DEBUG_INFO ("Request schema to " MACSTR, MAC2STR (mac));
+			if (!downstreamDataMessage (node, &request, sizeof (request), control_message_type::SCHEMA_GET)) {
+				DEBUG_WARN ("Error sending schema request");
+			}
+		}
+		return false;
+	} else if (result == SCHEMA_WRONG) {
+		DEBUG_WARN ("Wrong schema data from " MACSTR, MAC2STR (mac));
+		return false;
+	}
+	outputData (mac, expanded, expandedLen, lostMessages, false, MSG_PACK, nodeName, timestamp);
+	return true;
+}
+
+void EnigmaIOTGatewayClass::outputData (const uint8_t* mac, uint8_t* data, size_t len, uint16_t lostMessages, bool control, gatewayPayloadEncoding_t encoding, char* nodeName, int64_t timestamp) {
+	// Every data message gets here, also batched and reassembled ones, so schema payloads are expanded in a single place
+	if (!control && (encoding == SCHEMA_DEF || encoding == SCHEMA_DATA)) {
+		processSchemaData (mac, data, len, lostMessages, encoding, nodeName, timestamp);
+		return;
+	}
+#if ENABLE_GATEWAY_PIPELINE
+	if (pipelined) {
+		if (len > OUTPUT_EVENT_DATA_LENGTH) {
+			DEBUG_WARN ("Data too long for output queue: %u bytes", len);
+			return;
+		}
+		output_queue_item_t* item = reserveOutputEvent (OUTPUT_DATA, mac);
+		if (item) {
+			memcpy (item->data, data, len);
+			item->len = len;
+			item->value = lostMessages;
+			item->flag = control;
+			item->encoding = encoding;
+			item->timestamp = timestamp;
+			if (nodeName) {
+				strncpy (item->nodeName, nodeName, NODE_NAME_LENGTH - 1);
+				item->nodeName[NODE_NAME_LENGTH - 1] = '\0';
+			}
+			outputQueue->commit ();
+			METRICS_SET (METRIC_OUTPUT_QUEUE, outputQueue->size ());
+		}
+		return;
+	}
+#endif // ENABLE_GATEWAY_PIPELINE
+	dataTimestamp = timestamp;
+	notifyData (const_cast<uint8_t*>(mac), data, len, lostMessages, control, encoding, nodeName);
+}
+
+void EnigmaIOTGatewayClass::outputNewNode (uint8_t* mac, uint16_t nodeId, char* nodeName) {
+#if ENABLE_GATEWAY_PIPELINE
+	if (pipelined) {
+		output_queue_item_t* item = reserveOutputEvent (OUTPUT_NEW_NODE, mac);
+		if (item) {
+			item->value = nodeId;
+			if (nodeName) {
+				strncpy (item->nodeName, nodeName, NODE_NAME_LENGTH - 1);
+				item->nodeName[NODE_NAME_LENGTH - 1] = '\0';
+			}
+			outputQueue->commit ();
+			METRICS_SET (METRIC_OUTPUT_QUEUE, outputQueue->size ());
+		}
+		return;
+	}
+#endif // ENABLE_GATEWAY_PIPELINE
+	notifyNewNode (mac, nodeId, nodeName);
+}
+
+void EnigmaIOTGatewayClass::outputNodeDisconnection (uint8_t* mac, gwInvalidateReason_t reason) {
+#if ENABLE_GATEWAY_PIPELINE
+	if (pipelined) {
+		output_queue_item_t* item = reserveOutputEvent (OUTPUT_NODE_DISCONNECTED, mac);
+		if (item) {
+			item->value = reason;
+			outputQueue->commit ();
+			METRICS_SET (METRIC_OUTPUT_QUEUE, outputQueue->size ());
+		}
+		return;
+	}
+#endif // ENABLE_GATEWAY_PIPELINE
+	notifyNodeDisconnection (mac, reason);
+}
+
+void EnigmaIOTGatewayClass::outputDownlinkComplete (uint8_t* mac, bool delivered, uint32_t latency) {
+#if ENABLE_GATEWAY_PIPELINE
+	if (pipelined) {
+		output_queue_item_t* item = reserveOutputEvent (OUTPUT_DOWNLINK_COMPLETE, mac);
+		if (item) {
+			item->flag = delivered;
+			item->latency = latency;
+			outputQueue->commit ();
+			METRICS_SET (METRIC_OUTPUT_QUEUE, outputQueue->size ());
+		}
+		return;
+	}
+#endif // ENABLE_GATEWAY_PIPELINE
+	notifyDownlinkComplete (mac, delivered, latency);
+}
+
+#if ENABLE_GATEWAY_PIPELINE
+output_queue_item_t* EnigmaIOTGatewayClass::reserveOutputEvent (outputEvent_t event, const uint8_t* mac) {
+	// Producers are serialized by gateway lock, so this is still single producer
+	output_queue_item_t* item = outputQueue->reserve ();
+
+	if (!item) {
+		outputDrops++;
+		METRICS_COUNT (METRIC_OUTPUT_DROPS);
+		DEBUG_WARN ("Output queue full. Notification from " MACSTR " lost", MAC2STR (mac));
+		return NULL;
+	}
+	item->event = event;
+	memcpy (item->addr, mac, ENIGMAIOT_ADDR_LEN);
+	item->nodeName[0] = '\0';
+#if ENABLE_GATEWAY_METRICS
+	item->queuedTime = micros ();
+#endif // ENABLE_GATEWAY_METRICS
+	return item;
+}
+
+void EnigmaIOTGatewayClass::gatewayTaskLoop (void* param) {
+	EnigmaIOTGatewayClass* gateway = (EnigmaIOTGatewayClass*)param;
+
+	for (;;) {
+		gateway->lock ();
+		gateway->handle ();
+		bool pending = !gateway->input_queue->empty ();
+		gateway->unlock ();
+		if (pending) {
+			// Budget exhausted or output queue full. Sleep one tick anyway so that lower priority tasks on this core can run
+			vTaskDelay (1);
+		} else {
+			// Woken up by receive callback. Timeout keeps maintenance tasks running without traffic
+			ulTaskNotifyTake (pdTRUE, pdMS_TO_TICKS (GATEWAY_TASK_IDLE_WAIT));
+		}
+	}
+}
+#endif // ENABLE_GATEWAY_PIPELINE
+
+bool EnigmaIOTGatewayClass::startPipeline () {
+#if ENABLE_GATEWAY_PIPELINE
+	if (pipelined) {
+		return true;
+	}
+	if (!input_queue) {
+		DEBUG_ERROR ("Gateway pipeline has to be started after begin()");
+		return false;
+	}
+	gatewayMutex = xSemaphoreCreateRecursiveMutex ();
+	if (!gatewayMutex) {
+		DEBUG_ERROR ("Error creating gateway lock");
+		return false;
+	}
+	outputQueue = new EnigmaIOTLockFreeRingBuffer<output_queue_item_t> (OUTPUT_QUEUE_SIZE);
+	pipelined = true;
+	if (xTaskCreatePinnedToCore (gatewayTaskLoop, "EnigmaIOTGw", GATEWAY_TASK_STACK_SIZE, this, GATEWAY_TASK_PRIORITY, &gatewayTask, GATEWAY_TASK_CORE) != pdPASS) {
+		DEBUG_ERROR ("Error creating gateway task");
+		pipelined = false;
+		gatewayTask = NULL;
+		return false;
+	}
+	DEBUG_INFO ("Gateway task started on core %d. Output queue size %d", GATEWAY_TASK_CORE, OUTPUT_QUEUE_SIZE);
+	return true;
+#else
+	DEBUG_WARN ("Gateway pipeline not available. Set ENABLE_GATEWAY_PIPELINE to 1 on ESP32");
+	return false;
+#endif // ENABLE_GATEWAY_PIPELINE
+}
+
+int EnigmaIOTGatewayClass::handleOutput (int maxEvents) {
+	int processed = 0;
+
+#if ENABLE_GATEWAY_PIPELINE
+	output_queue_item_t* item;
+
+	if (!pipelined) {
+		return 0;
+	}
+	// Callbacks run without gateway lock, so that they do not delay gateway task
+	while ((maxEvents <= 0 || processed < maxEvents) && (item = outputQueue->front ())) {
+		METRICS_RECORD (METRIC_OUTPUT_WAIT, item->queuedTime);
+		char* nodeName = item->nodeName[0] ? item->nodeName : NULL;
+		switch (item->event) {
+		case OUTPUT_DATA:
+			if (notifyData) {
+				dataTimestamp = item->timestamp;
+				notifyData (item->addr, item->data, item->len, item->value, item->flag, (gatewayPayloadEncoding_t)(item->encoding), nodeName);
+			}
+			break;
+		case OUTPUT_NEW_NODE:
+			if (notifyNewNode) {
+				notifyNewNode (item->addr, item->value, nodeName);
+			}
+			break;
+		case OUTPUT_NODE_DISCONNECTED:
+			if (notifyNodeDisconnection) {
+				notifyNodeDisconnection (item->addr, (gwInvalidateReason_t)(item->value));
+			}
+			break;
+		case OUTPUT_DOWNLINK_COMPLETE:
+			if (notifyDownlinkComplete) {
+				notifyDownlinkComplete (item->addr, item->flag, item->latency);
+			}
+			break;
+		}
+		outputQueue->pop ();
+		processed++;
+	}
+	METRICS_SET (METRIC_OUTPUT_QUEUE, outputQueue->size ());
+#endif // ENABLE_GATEWAY_PIPELINE
+
+	return processed;
+}
+
+void EnigmaIOTGatewayClass::lock () {
+#if ENABLE_GATEWAY_PIPELINE
+	if (gatewayMutex) {
+		xSemaphoreTakeRecursive (gatewayMutex, portMAX_DELAY);
+	}
+#endif // ENABLE_GATEWAY_PIPELINE
+}
+
+void EnigmaIOTGatewayClass::unlock () {
+#if ENABLE_GATEWAY_PIPELINE
+	if (gatewayMutex) {
+		xSemaphoreGiveRecursive (gatewayMutex);
+	}
+#endif // ENABLE_GATEWAY_PIPELINE
+}
+
 void EnigmaIOTGatewayClass::tx_cb (uint8_t* mac_addr, uint8_t status) {
 	EnigmaIOTGateway.getStatus (mac_addr, status);
 }
@@ -858,13 +1342,133 @@ void EnigmaIOTGatewayClass::tx_cb (uint8_t* mac_addr, uint8_t status) {
 void EnigmaIOTGatewayClass::getStatus (uint8_t* mac_addr, uint8_t status) {
 	//char buffer[ENIGMAIOT_ADDR_LEN * 3];
 #ifdef ESP8266
-	DEBUG_VERBOSE ("SENDStatus %s. Peer %s", status == 0 ? "OK" : "ERROR", mac2str (mac_addr));
+	DEBUG_VERBOSE ("SENDStatus %s. Peer %s", status == 0 ? "OK" : "ERROR", DEBUG_MAC (mac_addr));
 #elif defined ESP32
-	DEBUG_VERBOSE ("SENDStatus %d. Peer %s", status, mac2str (mac_addr));
+	DEBUG_VERBOSE ("SENDStatus %d. Peer %s", status, DEBUG_MAC (mac_addr));
 #endif
 }
 
+void EnigmaIOTGatewayClass::send_complete_cb (uint32_t tag, uint8_t* mac_addr, uint8_t status, uint32_t latency) {
+	// This runs on WiFi task. If queue is full report is lost and message will expire by timeout
+	send_complete_item_t* item = EnigmaIOTGateway.sendCompleteQueue->reserve ();
+
+	if (item) {
+		item->tag = tag;
+		item->status = status;
+		item->latency = latency;
+		EnigmaIOTGateway.sendCompleteQueue->commit ();
+	}
+}
+
+bool EnigmaIOTGatewayClass::sendDownlink (Node* node, const uint8_t* data, size_t len) {
+	downlink_inflight_t* entry = NULL;
+	time_t waitStart = millis ();
+
+	if (len > MAX_MESSAGE_LENGTH) {
+		return false;
+	}
+
+	// Wait for a free slot, so that ESP-NOW layer does not get flooded
+	while (!entry) {
+		for (int i = 0; i < MAX_DOWNLINK_INFLIGHT; i++) {
+			if (!downlinkInflight[i].tag) {
+				entry = &(downlinkInflight[i]);
+				break;
+			}
+		}
+		if (!entry) {
+			if (millis () - waitStart >= DOWNLINK_INFLIGHT_WAIT) {
+				break;
+			}
+			delay (0);
+			processSendCompletions ();
+		}
+	}
+
+	// Give up oldest message if no slot got free
+	if (!entry) {
+		entry = &(downlinkInflight[0]);
+		for (int i = 1; i < MAX_DOWNLINK_INFLIGHT; i++) {
+			if ((int32_t)(downlinkInflight[i].firstSent - entry->firstSent) < 0) {
+				entry = &(downlinkInflight[i]);
+			}
+		}
+		DEBUG_WARN ("Too many downlink messages waiting for confirmation");
+		completeDownlink (entry, false, 0);
+	}
+
+	memcpy (entry->addr, node->getMacAddress (), ENIGMAIOT_ADDR_LEN);
+	memcpy (entry->data, data, len);
+	entry->len = len;
+	entry->retries = 0;
+	entry->firstSent = micros ();
+	entry->lastSent = entry->firstSent;
+	entry->tag = comm->sendTracked (entry->addr, entry->data, entry->len);
+
+	return entry->tag != 0;
+}
+
+void EnigmaIOTGatewayClass::completeDownlink (downlink_inflight_t* entry, bool delivered, uint32_t latency) {
+	Node* node = nodelist.getNodeFromMAC (entry->addr);
+
+	entry->tag = 0;
+	if (delivered) {
+		DEBUG_DBG ("Downlink to " MACSTR " delivered in %u us after %u retries", MAC2STR (entry->addr), latency, entry->retries);
+		if (node) {
+			node->downlinkLatency = latency;
+		}
+	} else {
+		DEBUG_WARN ("Downlink to " MACSTR " not delivered", MAC2STR (entry->addr));
+		downlinkFailures++;
+		if (node) {
+			node->downlinkFailures++;
+		}
+	}
+	if (notifyDownlinkComplete) {
+		outputDownlinkComplete (entry->addr, delivered, latency);
+	}
+}
+
+void EnigmaIOTGatewayClass::processSendCompletions () {
+	send_complete_item_t* report;
+
+	while ((report = sendCompleteQueue->front ()) != NULL) {
+		for (int i = 0; i < MAX_DOWNLINK_INFLIGHT; i++) {
+			downlink_inflight_t* entry = &(downlinkInflight[i]);
+
+			if (!entry->tag || entry->tag != report->tag) {
+				continue;
+			}
+			if (!report->status) {
+				completeDownlink (entry, true, entry->lastSent - entry->firstSent + report->latency);
+			} else if (entry->retries < DOWNLINK_MAX_RETRIES) {
+				entry->retries++;
+				downlinkRetries++;
+				DEBUG_DBG ("Resending downlink to " MACSTR ". Retry %u", MAC2STR (entry->addr), entry->retries);
+				entry->lastSent = micros ();
+				entry->tag = comm->sendTracked (entry->addr, entry->data, entry->len);
+				if (!entry->tag) {
+					completeDownlink (entry, false, 0);
+				}
+			} else {
+				completeDownlink (entry, false, 0);
+			}
+			break;
+		}
+		sendCompleteQueue->pop ();
+	}
+
+	// Forget messages whose status was never reported
+	uint32_t now = micros ();
+	for (int i = 0; i < MAX_DOWNLINK_INFLIGHT; i++) {
+		if (downlinkInflight[i].tag && now - downlinkInflight[i].lastSent > DOWNLINK_CONFIRM_TIMEOUT * 1000) {
+			completeDownlink (&(downlinkInflight[i]), false, 0);
+		}
+	}
+}
+
 void EnigmaIOTGatewayClass::handle () {
+	METRICS_START (loopStart);
 	//#ifdef ESP8266
 	static unsigned long rxOntime;
 	static unsigned long txOntime;
@@ -898,15 +1502,28 @@ void EnigmaIOTGatewayClass::handle () {
 	}
 	//#endif
 
-		// Clean up dead nodes
-	for (int i = 0; i < NUM_NODES; i++) {
-		Node* node = nodelist.getNodeFromID (i);
-		if (MAX_NODE_INACTIVITY > 0) {
-			if (node->isRegistered () && millis () - node->getLastMessageTime () > MAX_NODE_INACTIVITY) {
-				// TODO. Trigger node expired event
-				node->reset ();
+	// Clean up dead nodes. Only nodes whose deadline has passed are checked
+	Node* expiredNode;
+	int expiredCount = 0;
+	while (expiredCount++ < NUM_NODES && (expiredNode = nodelist.getExpiredNode (millis ()))) {
+		if (expiredNode->getRxFragments ()) {
+			expiredNode->getRxFragments ()->expire ();
+		}
+		if (expiredNode->isRegistered ()) {
+			if (MAX_NODE_INACTIVITY > 0 && millis () - expiredNode->getLastMessageTime () > MAX_NODE_INACTIVITY) {
+				DEBUG_INFO ("Node %u inactive for too long", expiredNode->getNodeId ());
+				if (notifyNodeDisconnection) {
+					outputNodeDisconnection (expiredNode->getMacAddress (), NODE_INACTIVE);
+				}
+				expiredNode->reset ();
+				continue;
+			}
+			if (MAX_KEY_VALIDITY > 0 && millis () - expiredNode->getKeyValidFrom () > MAX_KEY_VALIDITY) {
+				DEBUG_DBG ("Node %u key expired", expiredNode->getNodeId ());
+				expiredNode->setKeyExpired (); // Key is invalidated on next message
 			}
 		}
+		nodelist.scheduleNode (expiredNode);
 	}
 
 	if (OTAongoing) {
@@ -918,65 +1535,113 @@ void EnigmaIOTGatewayClass::handle () {
 		}
 	}
 
+	// Resend failed downlink messages and update delivery statistics
+	processSendCompletions ();
+
+#if ENABLE_NODE_SNAPSHOT
+	updateSnapshot ();
+#endif // ENABLE_NODE_SNAPSHOT
+
 	// Check input EnigmaIOT message queue
+	// Process as many messages as allowed by message and time budget, so that bursts do not overflow input queue
+	int processedMessages = 0;
+	time_t drainStart = millis ();
 
-	if (!input_queue->empty ()) {
+	while (!input_queue->empty ()) {
 		msg_queue_item_t* message;
 
-		message = getInputMsgQueue (&tempBuffer);
+#if ENABLE_GATEWAY_PIPELINE
+		// Output task is not keeping up. Messages wait on input queue instead of losing their notifications
+		if (pipelined && outputQueue->isFull ()) {
+			outputStalls++;
+			METRICS_COUNT (METRIC_OUTPUT_STALLS);
+			break;
+		}
+#endif // ENABLE_GATEWAY_PIPELINE
+
+		// Message is processed in place. Producer does not use this slot until it is popped
+		message = input_queue->front ();
+
+		if (!message) {
+			break;
+		}
+		DEBUG_DBG ("EnigmaIOT input message from queue. MsgType: 0x%02X from %s", message->data[0], DEBUG_MAC (message->addr));
+		METRICS_RECORD (METRIC_QUEUE_WAIT, message->queuedTime);
+		METRICS_START (messageStart);
+		manageMessage (message->addr, message->data, message->len);
+		METRICS_RECORD_MESSAGE (message->data[0], messageStart);
+		popInputMsgQueue ();
+		processedMessages++;
 
-		if (message) {
-			DEBUG_DBG ("EnigmaIOT input message from queue. MsgType: 0x%02X", message->data[0]);
-			manageMessage (message->addr, message->data, message->len);
+		if (drainMaxMessages > 0 && processedMessages >= drainMaxMessages) {
+			break;
 		}
+		if (drainMaxTime > 0 && millis () - drainStart >= drainMaxTime) {
+			break;
+		}
+	}
+	if (processedMessages > 1) {
+		DEBUG_DBG ("%d input messages processed in %u ms. %d pending", processedMessages, millis () - drainStart, input_queue->size ());
+	}
+	METRICS_SET (METRIC_INPUT_QUEUE, input_queue->size ());
+	METRICS_RECORD (METRIC_HANDLE_LOOP, loopStart);
+
+#if ENABLE_MULTI_GATEWAY
+	if (millis () - lastLoadUpdate > GATEWAY_LOAD_UPDATE_PERIOD) {
+		updateLoad ();
+	}
+#endif // ENABLE_MULTI_GATEWAY
+
+#if DEBUG_DEFERRED
+	// Print deferred debug output only if there are no messages waiting
+	if (input_queue->empty ()) {
+		DEBUG_PROCESS (DEBUG_DEFERRED_PROCESS_TIME);
 	}
+#endif // DEBUG_DEFERRED
 }
 
 void EnigmaIOTGatewayClass::manageMessage (const uint8_t* mac, uint8_t* buf, uint8_t count) {
 	Node* node;
 
 	DEBUG_INFO ("Reveived message. Origin MAC: %02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-	DEBUG_VERBOSE ("Received data: %s", printHexBuffer (buf, count));
+	DEBUG_VERBOSE ("Received data: %s", DEBUG_HEX (buf, count));
 
+	if (count == 1 && buf[0] == GATEWAY_PROBE) {
+		DEBUG_DBG ("Gateway probe from %s", DEBUG_MAC (mac)); // Link layer acknowledge was all that node wanted
+		return;
+	}
 	if (count <= 1) {
 		DEBUG_WARN ("Empty message");
 		return;
 	}
 
+	METRICS_START (lookupStart);
 	node = nodelist.getNewNode (mac);
+	METRICS_RECORD (METRIC_NODE_LOOKUP, lookupStart);
 
 	flashRx = true;
 
 	int espNowError = 0; // May I remove this??
+	uint16_t retryAfter;
 
 	switch (buf[0]) {
 	case CLIENT_HELLO:
-		// TODO: Do no accept new Client Hello if registration is on process on any node?? Possible DoS Attack??
-		// May cause undesired behaviour in case a node registration message is lost
+		// Key agreement rate is limited so that a registration storm does not block data from registered nodes
 		DEBUG_INFO (" <------- CLIENT HELLO");
+		if (!admitRegistration (retryAfter)) {
+			DEBUG_INFO ("Too many registrations. Node %s has to retry in %u ms", DEBUG_MAC (mac), retryAfter);
+			registrationBusy (mac, retryAfter);
+			break;
+		}
 		//if (!OTAongoing) {
 		if (espNowError == 0) {
 			if (processClientHello (mac, buf, count, node)) {
 				if (serverHello (myPublicKey, node)) {
 					DEBUG_INFO ("Server Hello sent");
-					node->setStatus (REGISTERED);
-					node->setKeyValidFrom (millis ());
-					node->setLastMessageCounter (0);
-					node->setLastControlCounter (0);
-					node->setLastDownlinkMsgCounter (0);
-					node->setLastMessageTime ();
-					if (notifyNewNode) {
-						notifyNewNode (node->getMacAddress (), node->getNodeId (), NULL);
-					}
-#if DEBUG_LEVEL >= INFO
-					nodelist.printToSerial (&DEBUG_ESP_PORT);
-#endif
-					if (node->broadcastIsEnabled ()) {
-						if (!sendBroadcastKey (node)) {
-							DEBUG_WARN ("Error sending broadcast key to node");
-						} else {
-							node->setBroadcastKeyRequested (false);
-							DEBUG_INFO ("Broadcast key sent to node");
+					completeRegistration (node);
+					if (SESSION_TICKET_VALIDITY > 0) {
+						if (!sendSessionTicket (node)) {
+							DEBUG_WARN ("Error sending session ticket to node");
 						}
 					}
 				} else {
@@ -997,15 +1662,31 @@ void EnigmaIOTGatewayClass::manageMessage (const uint8_t* mac, uint8_t* buf, uin
 		//	DEBUG_WARN ("OTA ongoing. Registration ignored");
 		//}
 		break;
-	case CONTROL_DATA:
-		DEBUG_INFO (" <------- CONTROL MESSAGE");
+	case RESUME_REQUEST:
+		DEBUG_INFO (" <------- RESUME REQUEST");
+		if (processResumeRequest (mac, buf, count, node)) {
+			if (resumeResponse (node)) {
+				DEBUG_INFO ("Resume Response sent");
+				completeRegistration (node);
+			} else {
+				node->reset ();
+				DEBUG_INFO ("Error sending Resume Response");
+			}
+		} else {
+			// Node has to fall back to full key agreement
+			invalidateKey (node, INVALID_SESSION_TICKET);
+			node->reset ();
+			DEBUG_WARN ("Session resumption rejected");
+		}
+		memset (resumptionSecret, 0, KEY_LENGTH);
+		break;
+	case CONTROL_DATA:
+		DEBUG_INFO (" <------- CONTROL MESSAGE");
 		if (node->getStatus () == REGISTERED) {
 			if (processControlMessage (mac, buf, count, node)) {
 				DEBUG_INFO ("Control message OK");
-				if (MAX_KEY_VALIDITY > 0) {
-					if (millis () - node->getKeyValidFrom () > MAX_KEY_VALIDITY) {
-						invalidateKey (node, KEY_EXPIRED);
-					}
+				if (node->isKeyExpired ()) {
+					invalidateKey (node, KEY_EXPIRED);
 				}
 			} else {
 				if (DISCONNECT_ON_DATA_ERROR) {
@@ -1035,10 +1716,8 @@ void EnigmaIOTGatewayClass::manageMessage (const uint8_t* mac, uint8_t* buf, uin
 				node->setLastMessageTime ();
 				DEBUG_INFO ("Data OK");
 				DEBUG_VERBOSE ("Key valid from %lu ms", millis () - node->getKeyValidFrom ());
-				if (MAX_KEY_VALIDITY > 0) {
-					if (millis () - node->getKeyValidFrom () > MAX_KEY_VALIDITY) {
-						invalidateKey (node, KEY_EXPIRED);
-					}
+				if (node->isKeyExpired ()) {
+					invalidateKey (node, KEY_EXPIRED);
 				}
 			} else {
 				if (DISCONNECT_ON_DATA_ERROR) {
@@ -1059,10 +1738,8 @@ void EnigmaIOTGatewayClass::manageMessage (const uint8_t* mac, uint8_t* buf, uin
 		if (node->getStatus () == REGISTERED) {
 			if (processClockRequest (mac, buf, count, node)) {
 				DEBUG_INFO ("Clock request OK");
-				if (MAX_KEY_VALIDITY > 0) {
-					if (millis () - node->getKeyValidFrom () > MAX_KEY_VALIDITY) {
-						invalidateKey (node, KEY_EXPIRED);
-					}
+				if (node->isKeyExpired ()) {
+					invalidateKey (node, KEY_EXPIRED);
 				}
 			} else {
 				invalidateKey (node, WRONG_DATA);
@@ -1079,7 +1756,7 @@ void EnigmaIOTGatewayClass::manageMessage (const uint8_t* mac, uint8_t* buf, uin
 			if (processNodeNameSet (mac, buf, count, node)) {
 				DEBUG_INFO ("Node name for node %d set to %s", node->getNodeId (), node->getNodeName ());
 				if (notifyNewNode) {
-					notifyNewNode (node->getMacAddress (), node->getNodeId (), node->getNodeName ());
+					outputNewNode (node->getMacAddress (), node->getNodeId (), node->getNodeName ());
 				}
 			} else {
 				DEBUG_WARN ("Error setting node name for node %d", node->getNodeId ());
@@ -1125,7 +1802,7 @@ bool EnigmaIOTGatewayClass::nodeNameSetRespose (Node* node, int8_t error) {
 
 	CryptModule::random (nodeNameSetResponse_msg.iv, IV_LENGTH);
 
-	DEBUG_VERBOSE ("IV: %s", printHexBuffer (nodeNameSetResponse_msg.iv, IV_LENGTH));
+	DEBUG_VERBOSE ("IV: %s", DEBUG_HEX (nodeNameSetResponse_msg.iv, IV_LENGTH));
 
 	nodeNameSetResponse_msg.errorCode = error;
 
@@ -1140,22 +1817,22 @@ bool EnigmaIOTGatewayClass::nodeNameSetRespose (Node* node, int8_t error) {
 	if (!CryptModule::encryptBuffer ((uint8_t*)&(nodeNameSetResponse_msg.errorCode), sizeof (int8_t), // Encrypt error code only, 1 byte
 									 nodeNameSetResponse_msg.iv, IV_LENGTH,
 									 node->getEncriptionKey (), KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of network key
-									 aad, sizeof (aad), nodeNameSetResponse_msg.tag, TAG_LENGTH)) {
+									 aad, sizeof (aad), nodeNameSetResponse_msg.tag, TAG_LENGTH, node->getCipherAlgorithm ())) {
 		DEBUG_ERROR ("Error during encryption");
 		return false;
 	}
 
-	DEBUG_VERBOSE ("Encrypted set node name response message: %s", printHexBuffer ((uint8_t*)&nodeNameSetResponse_msg, NNSRMSG_LEN));
+	DEBUG_VERBOSE ("Encrypted set node name response message: %s", DEBUG_HEX ((uint8_t*)&nodeNameSetResponse_msg, NNSRMSG_LEN));
 
 	DEBUG_INFO (" -------> SEND SET NODE NAME RESPONSE");
 	uint8_t* addr = node->getMacAddress ();
 	//char addrStr[ENIGMAIOT_ADDR_LEN * 3];
 	if (comm->send (addr, (uint8_t*)&nodeNameSetResponse_msg, NNSRMSG_LEN) == 0) {
-		DEBUG_INFO ("Set Node Name Response message sent to %s", mac2str (addr));
+		DEBUG_INFO ("Set Node Name Response message sent to %s", DEBUG_MAC (addr));
 		return true;
 	} else {
 		nodelist.unregisterNode (node);
-		DEBUG_ERROR ("Error sending Set Node Name Response message to %s", mac2str (addr));
+		DEBUG_ERROR ("Error sending Set Node Name Response message to %s", DEBUG_MAC (addr));
 		return false;
 	}
 }
@@ -1187,29 +1864,25 @@ bool EnigmaIOTGatewayClass::processNodeNameSet (const uint8_t mac[ENIGMAIOT_ADDR
 	memcpy (aad + addDataLen, node->getEncriptionKey () + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH);
 
 	uint8_t packetLen = count - TAG_LENGTH;
+	uint16_t epoch;
 
-	if (!CryptModule::decryptBuffer (buf + nodeId_idx, packetLen - 1 - IV_LENGTH, // Decrypt from nodeId
-									 buf + iv_idx, IV_LENGTH,
-									 node->getEncriptionKey (), KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of network key
-									 aad, sizeof (aad), buf + tag_idx, TAG_LENGTH)) {
+	if (!decryptNodeMessage (node, node->getControlWindow (), buf + nodeId_idx, packetLen - 1 - IV_LENGTH, // Decrypt from nodeId
+							 buf + iv_idx, aad, sizeof (aad), buf + tag_idx, &epoch)) {
 		DEBUG_ERROR ("Error during decryption");
 		error = -4; // Message error
 	}
 
 	memcpy (&counter, &(buf[counter_idx]), sizeof (uint16_t));
 	DEBUG_INFO ("Node Id %d. Control message #%d", node->getNodeId (), counter);
-	if (useCounter) {
-		if (counter > node->getLastControlCounter ()) {
-			DEBUG_INFO ("Accepted");
-			node->setLastControlCounter (counter);
-		} else {
-			DEBUG_WARN ("Control message rejected");
-			return false;
+	if (useCounter && !error) {
+		replay_result_t replay = checkNodeCounter (node, true, ((uint32_t)epoch << 16) | counter);
+		if (replay == REPLAY_DUPLICATE || replay == REPLAY_TOO_OLD) {
+			return true;
 		}
 	}
 
 	if (!error) {
-		DEBUG_VERBOSE ("Decripted node name set message: %s", printHexBuffer (buf, count - TAG_LENGTH));
+		DEBUG_VERBOSE ("Decripted node name set message: %s", DEBUG_HEX (buf, count - TAG_LENGTH));
 
 		size_t nodeNameLen = tag_idx - nodeName_idx;
 
@@ -1235,6 +1908,17 @@ bool EnigmaIOTGatewayClass::processNodeNameSet (const uint8_t mac[ENIGMAIOT_ADDR
 	}
 }
 
+/**
+  * @brief Gets current time in ms. If gateway is synchronized to NTP server it is real world time
+  * @return Milliseconds since epoch
+  */
+static int64_t getTimestamp () {
+	struct timeval tv;
+
+	gettimeofday (&tv, NULL);
+	return (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
 bool EnigmaIOTGatewayClass::processControlMessage (const uint8_t mac[ENIGMAIOT_ADDR_LEN], uint8_t* buf, size_t count, Node* node) {
 	/*
 	* ----------------------------------------------------------------------------------------
@@ -1260,26 +1944,22 @@ bool EnigmaIOTGatewayClass::processControlMessage (const uint8_t mac[ENIGMAIOT_A
 	memcpy (aad + addDataLen, node->getEncriptionKey () + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH);
 
 	uint8_t packetLen = count - TAG_LENGTH;
+	uint16_t epoch;
 
-	if (!CryptModule::decryptBuffer (buf + length_idx, packetLen - 1 - IV_LENGTH, // Decrypt from nodeId
-									 buf + iv_idx, IV_LENGTH,
-									 node->getEncriptionKey (), KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of network key
-									 aad, sizeof (aad), buf + tag_idx, TAG_LENGTH)) {
+	if (!decryptNodeMessage (node, node->getControlWindow (), buf + length_idx, packetLen - 1 - IV_LENGTH, // Decrypt from nodeId
+							 buf + iv_idx, aad, sizeof (aad), buf + tag_idx, &epoch)) {
 		DEBUG_ERROR ("Error during decryption");
 		return false;
 	}
 
-	DEBUG_VERBOSE ("Decripted control message: %s", printHexBuffer (buf, count - TAG_LENGTH));
+	DEBUG_VERBOSE ("Decripted control message: %s", DEBUG_HEX (buf, count - TAG_LENGTH));
 
 	memcpy (&counter, &(buf[counter_idx]), sizeof (uint16_t));
 	DEBUG_INFO ("Node Id %d. Control message #%d", node->getNodeId (), counter);
 	if (useCounter) {
-		if (counter > node->getLastControlCounter ()) {
-			DEBUG_INFO ("Accepted");
-			node->setLastControlCounter (counter);
-		} else {
-            DEBUG_WARN ("Control message rejected. Last counter: %u. Current counter", node->getLastControlCounter (), counter);
-			return false;
+		replay_result_t replay = checkNodeCounter (node, true, ((uint32_t)epoch << 16) | counter);
+		if (replay == REPLAY_DUPLICATE || replay == REPLAY_TOO_OLD) {
+			return true;
 		}
 	}
 
@@ -1298,17 +1978,133 @@ bool EnigmaIOTGatewayClass::processControlMessage (const uint8_t mac[ENIGMAIOT_A
 		}
 	}
 
+	// Keep gateway signal strength reported by node
+	if (payload[0] == control_message_type::RSSI_ANS && (tag_idx - data_idx) >= 2) {
+		node->setRSSI ((int8_t)payload[1]);
+	}
+
 	DEBUG_DBG ("Payload length: %d bytes", tag_idx - data_idx);
 
 	char* nodeName = node->getNodeName ();
 
 	if (notifyData) {
-		notifyData (const_cast<uint8_t*>(mac), buf + data_idx, tag_idx - data_idx, 0, true, ENIGMAIOT, nodeName ? nodeName : NULL);
+		outputData (mac, buf + data_idx, tag_idx - data_idx, 0, true, ENIGMAIOT, nodeName ? nodeName : NULL, getTimestamp ());
 	}
 
 	return true;
 }
 
+/**
+  * @brief Gets time used to check session ticket validity. When several gateways serve the same network a ticket may be checked
+  * by a gateway that did not issue it, so real world time is used
+  * @return Time in ms. It wraps every 49 days
+  */
+static uint32_t getTicketTime () {
+#if ENABLE_MULTI_GATEWAY
+	return (uint32_t)getTimestamp ();
+#else
+	return millis ();
+#endif // ENABLE_MULTI_GATEWAY
+}
+
+bool EnigmaIOTGatewayClass::decryptNodeMessage (Node* node, ReplayWindow* window, uint8_t* data, size_t length, const uint8_t* iv,
+												const uint8_t* aad, uint8_t aadLen, const uint8_t* tag, uint16_t* epoch) {
+	uint16_t epochs[2] = { 0, 0 };
+	uint8_t epochAad[AAD_LENGTH + 1 + IV_LENGTH];
+	uint8_t encrypted[MAX_MESSAGE_LENGTH];
+	int candidates = 1;
+
+	if (length > MAX_MESSAGE_LENGTH || aadLen > sizeof (epochAad)) {
+		return false;
+	}
+	if (useCounter) {
+		candidates = window->getEpochCandidates (epochs);
+	}
+	if (candidates > 1) {
+		memcpy (encrypted, data, length); // Data is decrypted in place. A second attempt needs it as it was received
+	}
+
+	for (int i = 0; i < candidates; i++) {
+		if (i) {
+			DEBUG_DBG ("Trying counter epoch %u", epochs[i]);
+			memcpy (data, encrypted, length);
+		}
+		memcpy (epochAad, aad, aadLen);
+		bindCounterEpoch (epochAad, aadLen, epochs[i]);
+		if (CryptModule::decryptBuffer (data, length, iv, IV_LENGTH,
+										node->getEncriptionKey (), KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of node key
+										epochAad, aadLen, tag, TAG_LENGTH, node->getCipherAlgorithm ())) {
+			*epoch = epochs[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+replay_result_t EnigmaIOTGatewayClass::checkNodeCounter (Node* node, bool control, uint32_t counter, size_t* lostMessages) {
+	replay_result_t result;
+	uint32_t lost = 0;
+
+	if (control) {
+		result = node->acceptControlCounter (counter);
+	} else {
+		result = node->acceptMessageCounter (counter, &lost);
+	}
+
+	switch (result) {
+	case REPLAY_NEW:
+		DEBUG_INFO ("Accepted");
+		if (!control) {
+			node->packetErrors += lost;
+#if ENABLE_LINK_ADAPTATION
+			updateLinkAdaptation (node, lost);
+#endif // ENABLE_LINK_ADAPTATION
+		}
+		break;
+	case REPLAY_LATE:
+		DEBUG_INFO ("Accepted out of order");
+		// It was counted as lost when a higher counter arrived
+		if (!control && node->packetErrors) {
+			node->packetErrors--;
+		}
+#if ENABLE_LINK_ADAPTATION
+		if (!control && node->getLinkAdaptation ()) {
+			node->getLinkAdaptation ()->recoverMessage ();
+		}
+#endif // ENABLE_LINK_ADAPTATION
+		METRICS_COUNT (METRIC_LATE_MESSAGES);
+		break;
+	default:
+		DEBUG_WARN ("%s message #%u discarded. %s", control ? "Control" : "Data", counter,
+					result == REPLAY_DUPLICATE ? "Already received" : "Out of window");
+		METRICS_COUNT (METRIC_REPLAYS);
+	}
+
+	if (lostMessages) {
+		*lostMessages = lost;
+	}
+	return result;
+}
+
+#if ENABLE_LINK_ADAPTATION
+void EnigmaIOTGatewayClass::updateLinkAdaptation (Node* node, uint32_t lostMessages) {
+	LinkAdaptation* link = node->getLinkAdaptation ();
+
+	if (!link || !link->addMessage (lostMessages, node->getRSSI ())) {
+		return;
+	}
+	DEBUG_INFO ("Node %u TX power reduction: %u dB", node->getNodeId (), link->getReduction ());
+
+	// Encrypted so that it cannot be forged. It is queued for sleepy nodes and a newer one replaces it
+	uint8_t buffer[2];
+	buffer[0] = control_message_type::TX_POWER_SET;
+	buffer[1] = link->getReduction ();
+	if (!downstreamDataMessage (node, buffer, sizeof (buffer), control_message_type::TX_POWER_SET)) {
+		DEBUG_WARN ("Error sending TX power to node %u", node->getNodeId ());
+	}
+}
+#endif // ENABLE_LINK_ADAPTATION
+
 bool EnigmaIOTGatewayClass::processUnencryptedDataMessage (const uint8_t mac[ENIGMAIOT_ADDR_LEN], uint8_t* buf, size_t count, Node* node) {
 	/*
 	* ------------------------------------------------------------------------
@@ -1326,35 +2122,27 @@ bool EnigmaIOTGatewayClass::processUnencryptedDataMessage (const uint8_t mac[ENI
 
 	//uint8_t packetLen = count; // Not used
 
-	DEBUG_VERBOSE ("Unencrypted data message: %s", printHexBuffer (buf, count));
+	DEBUG_VERBOSE ("Unencrypted data message: %s", DEBUG_HEX (buf, count));
 
 	node->packetNumber++;
 
 	memcpy (&counter, &buf[counter_idx], sizeof (uint16_t));
 	if (useCounter) {
-		if (counter > node->getLastMessageCounter ()) {
-			lostMessages = counter - node->getLastMessageCounter () - 1;
-			node->packetErrors += lostMessages;
-			node->setLastMessageCounter (counter);
-		} else {
-			DEBUG_WARN ("Data counter error %d : %d", counter, node->getLastMessageCounter ());
-			return false;
+		// Epoch is not authenticated on unencrypted messages. It is guessed from closest counter
+		replay_result_t replay = checkNodeCounter (node, false, node->getMessageWindow ()->extend (counter), &lostMessages);
+		if (replay == REPLAY_DUPLICATE || replay == REPLAY_TOO_OLD) {
+			return true;
 		}
 	}
 
 	char* nodeName = node->getNodeName ();
 
 	if (notifyData) {
-		notifyData (const_cast<uint8_t*>(mac), &(buf[data_idx]), count - data_idx, lostMessages, false, RAW, nodeName ? nodeName : NULL);
+		outputData (mac, &(buf[data_idx]), count - data_idx, lostMessages, false, RAW, nodeName ? nodeName : NULL, getTimestamp ());
 	}
 
 	if (node->getSleepy ()) {
-		if (node->qMessagePending) {
-			DEBUG_INFO (" -------> DOWNLINK QUEUED DATA");
-			flashTx = true;
-			node->qMessagePending = false;
-			return comm->send (node->getMacAddress (), node->queuedMessage, node->qMessageLength) == 0;
-		}
+		return sendQueuedDownlink (node, counter);
 	}
 
 	return true;
@@ -1362,6 +2150,46 @@ bool EnigmaIOTGatewayClass::processUnencryptedDataMessage (const uint8_t mac[ENI
 }
 
 
+bool EnigmaIOTGatewayClass::sendQueuedDownlink (Node* node, uint16_t counter) {
+	const uint8_t* message;
+	size_t len;
+	bool result = true;
+
+	while ((message = nodelist.getQueuedDownlink (node, len))) {
+		DEBUG_INFO (" -------> DOWNLINK QUEUED DATA");
+		flashTx = true;
+		if (!sendDownlink (node, message, len)) {
+			result = false;
+		}
+		nodelist.dropQueuedDownlink (node);
+	}
+
+	if (!node->isKeyExpired ()) { // Otherwise Invalidate Key follows
+		downlinkEmpty (node, counter);
+	}
+
+	return result;
+}
+
+bool EnigmaIOTGatewayClass::downlinkEmpty (Node* node, uint16_t counter) {
+	/*
+	* ---------------------------
+	*| msgType (1) | Counter (2) |
+	* ---------------------------
+	*/
+
+	struct __attribute__ ((packed, aligned (1))) {
+		uint8_t msgType;
+		uint16_t counter;
+	} downlinkEmpty_msg;
+
+	downlinkEmpty_msg.msgType = DOWNLINK_EMPTY;
+	memcpy (&(downlinkEmpty_msg.counter), &counter, sizeof (uint16_t));
+
+	DEBUG_INFO (" -------> DOWNLINK EMPTY");
+	return comm->send (node->getMacAddress (), (uint8_t*)&downlinkEmpty_msg, sizeof (downlinkEmpty_msg)) == 0;
+}
+
 bool EnigmaIOTGatewayClass::processDataMessage (const uint8_t mac[ENIGMAIOT_ADDR_LEN], uint8_t* buf, size_t count, Node* node, bool encrypted) {
 	/*
 	* ----------------------------------------------------------------------------------------
@@ -1393,52 +2221,86 @@ bool EnigmaIOTGatewayClass::processDataMessage (const uint8_t mac[ENIGMAIOT_ADDR
 	memcpy (aad + addDataLen, node->getEncriptionKey () + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH);
 
 	uint8_t packetLen = count - TAG_LENGTH;
+	uint16_t epoch;
 
-	if (!CryptModule::decryptBuffer (buf + length_idx, packetLen - 1 - IV_LENGTH, // Decrypt from nodeId
-									 buf + iv_idx, IV_LENGTH,
-									 node->getEncriptionKey (), KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of network key
-									 aad, sizeof (aad), buf + tag_idx, TAG_LENGTH)) {
+	if (!decryptNodeMessage (node, node->getMessageWindow (), buf + length_idx, packetLen - 1 - IV_LENGTH, // Decrypt from nodeId
+							 buf + iv_idx, aad, sizeof (aad), buf + tag_idx, &epoch)) {
 		DEBUG_ERROR ("Error during decryption");
 		return false;
 	}
-	DEBUG_VERBOSE ("Decrypted data message: %s", printHexBuffer (buf, count - TAG_LENGTH));
+	DEBUG_VERBOSE ("Decrypted data message: %s", DEBUG_HEX (buf, count - TAG_LENGTH));
 	DEBUG_DBG ("Data payload encoding: 0x%02X", buf[encoding_idx]);
 	node->packetNumber++;
 
 	memcpy (&counter, &(buf[counter_idx]), sizeof (uint16_t));
 	DEBUG_INFO ("Node Id %d. Data message #%d", node->getNodeId (), counter);
 	if (useCounter) {
-		if (counter > node->getLastMessageCounter ()) {
-			DEBUG_INFO ("Accepted");
-			lostMessages = counter - node->getLastMessageCounter () - 1;
-			node->packetErrors += lostMessages;
-			node->setLastMessageCounter (counter);
-		} else {
-			DEBUG_WARN ("Data message rejected");
-			return false;
+		replay_result_t replay = checkNodeCounter (node, false, ((uint32_t)epoch << 16) | counter, &lostMessages);
+		if (replay == REPLAY_DUPLICATE || replay == REPLAY_TOO_OLD) {
+			return true; // Already received or too old to know. It is not a node error, so it is only ignored
 		}
 	}
 
 	char* nodeName = node->getNodeName ();
 
-	if (notifyData) {
+	if (buf[encoding_idx] == BATCH) {
+		if (!notifyBatchData (mac, &(buf[data_idx]), tag_idx - data_idx, lostMessages, nodeName)) {
+			DEBUG_WARN ("Wrong batch format");
+		}
+	} else if (buf[encoding_idx] == FRAGMENT) {
+		FragmentBuffer* rxFragments = node->getRxFragments ();
+		fragment_result_t result = rxFragments ? rxFragments->add (&(buf[data_idx]), tag_idx - data_idx) : FRAGMENT_ERROR;
+		if (result == FRAGMENT_ERROR) {
+			DEBUG_WARN ("Wrong fragment");
+		} else if (result == FRAGMENT_COMPLETE) {
+			if (notifyData) {
+				outputData (mac, rxFragments->getData (), rxFragments->getLength (), lostMessages, false, (gatewayPayloadEncoding_t)(rxFragments->getEncoding ()), nodeName ? nodeName : NULL, getTimestamp ());
+			}
+			rxFragments->clear ();
+		}
+	} else if (notifyData) {
 		//DEBUG_WARN ("Notify data %d", input_queue->size());
-		notifyData (const_cast<uint8_t*>(mac), &(buf[data_idx]), tag_idx - data_idx, lostMessages, false, (gatewayPayloadEncoding_t)(buf[encoding_idx]), nodeName ? nodeName : NULL);
+		outputData (mac, &(buf[data_idx]), tag_idx - data_idx, lostMessages, false, (gatewayPayloadEncoding_t)(buf[encoding_idx]), nodeName ? nodeName : NULL, getTimestamp ());
 	}
 
 	if (node->getSleepy ()) {
-		if (node->qMessagePending) {
-			DEBUG_INFO (" -------> DOWNLINK QUEUED DATA");
-			flashTx = true;
-			node->qMessagePending = false;
-			return comm->send (node->getMacAddress (), node->queuedMessage, node->qMessageLength) == 0;
-		}
+		return sendQueuedDownlink (node, counter);
 	}
 
 	return true;
 
 }
 
+bool EnigmaIOTGatewayClass::notifyBatchData (const uint8_t mac[ENIGMAIOT_ADDR_LEN], uint8_t* data, size_t len, uint16_t lostMessages, char* nodeName) {
+	/*
+	* ------------------------------------------------------
+	*| age (2) | encoding (1) | length (1) | Data (....) | ...
+	* ------------------------------------------------------
+	*/
+	int64_t now = getTimestamp ();
+	size_t idx = 0;
+
+	// Check format before notifying anything
+	while (idx < len) {
+		if (idx + BATCH_RECORD_HEADER_LENGTH > len || idx + BATCH_RECORD_HEADER_LENGTH + data[idx + 3] > len) {
+			return false;
+		}
+		idx += BATCH_RECORD_HEADER_LENGTH + data[idx + 3];
+	}
+
+	DEBUG_DBG ("Batched data message. Length: %u", len);
+	for (idx = 0; idx < len; idx += BATCH_RECORD_HEADER_LENGTH + data[idx + 3]) {
+		uint16_t age;
+		memcpy (&age, data + idx, sizeof (uint16_t));
+		if (notifyData) {
+			outputData (mac, data + idx + BATCH_RECORD_HEADER_LENGTH, data[idx + 3], lostMessages, false, (gatewayPayloadEncoding_t)(data[idx + 2]), nodeName ? nodeName : NULL,
+						now - (int64_t)age * BATCH_AGE_RESOLUTION);
+		}
+		lostMessages = 0; // Report lost messages only once
+	}
+	return true;
+}
+
 double EnigmaIOTGatewayClass::getPER (uint8_t* address) {
 	Node* node = nodelist.getNewNode (address);
 
@@ -1468,7 +2330,32 @@ double EnigmaIOTGatewayClass::getPacketsHour (uint8_t* address) {
 }
 
 
-bool EnigmaIOTGatewayClass::downstreamDataMessage (Node* node, const uint8_t* data, size_t len, control_message_type_t controlData, gatewayPayloadEncoding_t encoding) {
+bool EnigmaIOTGatewayClass::downstreamFragmentedData (Node* node, const uint8_t* data, size_t len, control_message_type_t controlData, gatewayPayloadEncoding_t encoding) {
+	uint8_t fragment[MAX_DATA_PAYLOAD_SIZE];
+	uint8_t fragmentCount = FragmentBuffer::getFragmentCount (len);
+
+	if (!fragmentCount) {
+		DEBUG_ERROR ("Downlink message too long: %d bytes. Maximum is %d", len, MAX_FRAGMENTED_PAYLOAD_SIZE);
+		return false;
+	}
+	if (node->getSleepy ()) { // Only one message may be queued for a sleepy node
+		DEBUG_ERROR ("Node must be in non sleepy mode to receive messages longer than %d bytes", MAX_DATA_PAYLOAD_SIZE);
+		return false;
+	}
+
+	fragmentTransferId++;
+	DEBUG_INFO ("Sending %d bytes in %d fragments. Transfer %d", len, fragmentCount, fragmentTransferId);
+	for (uint8_t i = 0; i < fragmentCount; i++) {
+		size_t fragmentLen = FragmentBuffer::buildFragment (fragment, data, len, fragmentTransferId, i, encoding);
+		if (!downstreamDataMessage (node, fragment, fragmentLen, controlData, FRAGMENT)) {
+			DEBUG_WARN ("Error sending fragment %d", i);
+			return false;
+		}
+	}
+	return true;
+}
+
+bool EnigmaIOTGatewayClass::downstreamDataMessage (Node* node, const uint8_t* data, size_t len, control_message_type_t controlData, gatewayPayloadEncoding_t encoding, bool groupCopy) {
 	/*
 	* ----------------------------------------------------------------------------------------
 	*| msgType (1) | IV (12) | length (2) | NodeId (2) | Counter (2) | Data (....) | Tag (16) |
@@ -1533,7 +2420,7 @@ bool EnigmaIOTGatewayClass::downstreamDataMessage (Node* node, const uint8_t* da
 
 	CryptModule::random (buffer + iv_idx, IV_LENGTH);
 
-	DEBUG_VERBOSE ("IV: %s", printHexBuffer (buffer + iv_idx, IV_LENGTH));
+	DEBUG_VERBOSE ("IV: %s", DEBUG_HEX (buffer + iv_idx, IV_LENGTH));
 
 	memcpy (buffer + nodeId_idx, &nodeId, sizeof (uint16_t));
 
@@ -1554,11 +2441,11 @@ bool EnigmaIOTGatewayClass::downstreamDataMessage (Node* node, const uint8_t* da
 
 	memcpy (buffer + data_idx, data, len);
 
-	DEBUG_VERBOSE ("Data: %s", printHexBuffer (buffer + data_idx, len));
+	DEBUG_VERBOSE ("Data: %s", DEBUG_HEX (buffer + data_idx, len));
 
 	memcpy (buffer + length_idx, &packet_length, sizeof (uint16_t));
 
-	DEBUG_VERBOSE ("Downlink message: %s", printHexBuffer (buffer, packet_length));
+	DEBUG_VERBOSE ("Downlink message: %s", DEBUG_HEX (buffer, packet_length));
 	DEBUG_VERBOSE ("Message length: %d bytes", packet_length);
 
 	//uint8_t* crypt_buf = buffer + length_idx;
@@ -1576,22 +2463,18 @@ bool EnigmaIOTGatewayClass::downstreamDataMessage (Node* node, const uint8_t* da
 	if (!CryptModule::encryptBuffer (buffer + length_idx, packet_length - addDataLen, // Encrypt from length
 									 buffer + iv_idx, IV_LENGTH,
 									 node->getEncriptionKey (), KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of node key
-									 aad, sizeof (aad), buffer + tag_idx, TAG_LENGTH)) {
+									 aad, sizeof (aad), buffer + tag_idx, TAG_LENGTH, node->getCipherAlgorithm ())) {
 		DEBUG_ERROR ("Error during encryption");
 		return false;
 	}
 
-	//DEBUG_WARN ("Encryption key: %s", printHexBuffer (node->getEncriptionKey (), KEY_LENGTH));
-	DEBUG_VERBOSE ("Encrypted downlink message: %s", printHexBuffer (buffer, packet_length + TAG_LENGTH));
+	//DEBUG_WARN ("Encryption key: %s", DEBUG_HEX (node->getEncriptionKey (), KEY_LENGTH));
+	DEBUG_VERBOSE ("Encrypted downlink message: %s", DEBUG_HEX (buffer, packet_length + TAG_LENGTH));
 
 	if (node->getSleepy ()) { // Queue message if node may be sleeping
 		if (controlData != control_message_type::OTA) {
 			DEBUG_VERBOSE ("Node is sleepy. Queing message");
-			memcpy (node->queuedMessage, buffer, packet_length + TAG_LENGTH);
-			//node->queuedMessage = buffer;
-			node->qMessageLength = packet_length + TAG_LENGTH;
-			node->qMessagePending = true;
-			return true;
+			return nodelist.queueDownlink (node, buffer, packet_length + TAG_LENGTH, controlData, groupCopy);
 		} else {
 			DEBUG_ERROR ("OTA is only possible with non sleepy nodes. Configure it accordingly first");
 			return false;
@@ -1599,10 +2482,179 @@ bool EnigmaIOTGatewayClass::downstreamDataMessage (Node* node, const uint8_t* da
 	} else {
 		DEBUG_INFO (" -------> DOWNLINK DATA");
 		flashTx = true;
-		return comm->send (node->getMacAddress (), buffer, packet_length + TAG_LENGTH) == 0;
+		return sendDownlink (node, buffer, packet_length + TAG_LENGTH);
 	}
 }
 
+bool EnigmaIOTGatewayClass::downstreamGroupMessage (int8_t group, const uint8_t* data, size_t len, control_message_type_t controlData, gatewayPayloadEncoding_t encoding) {
+	/*
+	* ----------------------------------------------------------------------------------------------------------------------
+	*| msgType (1) | Group (1) | IV (12) | length (2) | NodeId (2) | Counter (2) | [Encoding (1)] | Data (....) | Tag (16) |
+	* ----------------------------------------------------------------------------------------------------------------------
+	*/
+
+	uint8_t buffer[MAX_MESSAGE_LENGTH];
+	node_group_t* entry = nodelist.getGroup (group);
+	uint16_t nodeId = nodelist.getBroadcastNode ()->getNodeId ();
+	uint16_t counter;
+
+	const uint8_t iv_idx = 2;
+	const uint8_t length_idx = iv_idx + IV_LENGTH;
+	const uint8_t nodeId_idx = length_idx + sizeof (int16_t);
+	const uint8_t counter_idx = nodeId_idx + sizeof (int16_t);
+	uint8_t data_idx;
+
+	if (!entry || !data) {
+		DEBUG_ERROR ("Wrong group message");
+		return false;
+	}
+
+	if (controlData == USERDATA_GET || controlData == USERDATA_SET) {
+		buffer[0] = controlData == USERDATA_GET ? (uint8_t)DOWNSTREAM_GROUP_DATA_GET : (uint8_t)DOWNSTREAM_GROUP_DATA_SET;
+		buffer[counter_idx + sizeof (int16_t)] = encoding;
+		data_idx = counter_idx + sizeof (int16_t) + sizeof (int8_t);
+	} else {
+		buffer[0] = (uint8_t)DOWNSTREAM_GROUP_CTRL_DATA;
+		data_idx = counter_idx + sizeof (int16_t);
+	}
+	uint16_t packet_length = data_idx + len;
+
+	if (packet_length + TAG_LENGTH > MAX_MESSAGE_LENGTH) {
+		DEBUG_ERROR ("Group message too long: %d bytes", len);
+		return false;
+	}
+
+	// Sleepy members would miss broadcast. They get a copy encrypted with their own key and downlink counter after their next
+	// message, so that a group frame cannot be replayed to them
+	bool awakeMembers = false;
+	Node* member = NULL;
+	while ((member = nodelist.getNextGroupMember (group, member))) {
+		if (!member->getSleepy ()) {
+			awakeMembers = true;
+		} else if (!downstreamDataMessage (member, data, len, controlData, encoding, true)) {
+			DEBUG_WARN ("Group message could not be queued for node %u", member->getNodeId ());
+		}
+	}
+
+	if (!awakeMembers) {
+		return true;
+	}
+
+	buffer[1] = (uint8_t)group;
+	CryptModule::random (buffer + iv_idx, IV_LENGTH);
+	memcpy (buffer + length_idx, &packet_length, sizeof (uint16_t));
+	memcpy (buffer + nodeId_idx, &nodeId, sizeof (uint16_t));
+	if (useCounter) {
+		counter = nodelist.nextGroupMsgCounter (group);
+	} else {
+		counter = (uint16_t)(Crypto.random ());
+	}
+	DEBUG_INFO ("Group %s message #%d", entry->name, counter);
+	memcpy (buffer + counter_idx, &counter, sizeof (uint16_t));
+	memcpy (buffer + data_idx, data, len);
+
+	// Group id is authenticated together with message type and IV
+	const uint8_t addDataLen = iv_idx + IV_LENGTH;
+	uint8_t aad[AAD_LENGTH + addDataLen];
+
+	memcpy (aad, buffer, addDataLen);
+	memcpy (aad + addDataLen, entry->key + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH);
+
+	if (!CryptModule::encryptBuffer (buffer + length_idx, packet_length - addDataLen, // Encrypt from length
+									 buffer + iv_idx, IV_LENGTH,
+									 entry->key, KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of group key
+									 aad, sizeof (aad), buffer + packet_length, TAG_LENGTH)) {
+		DEBUG_ERROR ("Error during encryption");
+		return false;
+	}
+
+	DEBUG_INFO (" -------> GROUP DOWNLINK DATA");
+	flashTx = true;
+	return sendDownlink (nodelist.getBroadcastNode (), buffer, packet_length + TAG_LENGTH);
+}
+
+bool EnigmaIOTGatewayClass::sendGroupKey (Node* node, int8_t group, bool member) {
+	uint8_t buffer[2 + KEY_LENGTH + sizeof (uint16_t)];
+	size_t len = sizeof (buffer);
+	node_group_t* entry = nodelist.getGroup (group);
+	bool result;
+
+	if (!buildSendGroupKey (buffer, len, group, member && entry ? entry->key : NULL, entry ? entry->lastDownlinkMsgCounter : 0)) {
+		return false;
+	}
+	DEBUG_DBG ("Send group %d key to " MACSTR, group, MAC2STR (node->getMacAddress ()));
+	result = downstreamDataMessage (node, buffer, len, control_message_type::GROUP_KEY);
+	memset (buffer, 0, sizeof (buffer));
+	return result;
+}
+
+bool EnigmaIOTGatewayClass::joinGroup (const uint8_t* mac, const char* group) {
+	Node* node = nodelist.getNodeFromMAC (mac);
+	int8_t index;
+
+	if (!node || node == nodelist.getBroadcastNode () || !group) {
+		return false;
+	}
+	if (group[0] == GROUP_ADDRESS_PREFIX) {
+		group++;
+	}
+
+	index = nodelist.getGroupIndex (group);
+	if (index < 0) {
+		uint8_t key[KEY_LENGTH];
+
+		CryptModule::random (key, KEY_LENGTH);
+		index = nodelist.addGroup (group, key);
+		memset (key, 0, KEY_LENGTH);
+		if (index < 0) {
+			DEBUG_ERROR ("Cannot create group %s", group);
+			return false;
+		}
+		DEBUG_INFO ("Group %s created", group);
+	}
+
+	// Key is sent again even if node was already member, so that it may recover it
+	nodelist.joinGroup (node, index);
+	DEBUG_INFO ("Node %u joins group %s", node->getNodeId (), group);
+	return sendGroupKey (node, index, true);
+}
+
+bool EnigmaIOTGatewayClass::leaveGroup (const uint8_t* mac, const char* group) {
+	Node* node = nodelist.getNodeFromMAC (mac);
+	int8_t index;
+
+	if (!node || !group) {
+		return false;
+	}
+	if (group[0] == GROUP_ADDRESS_PREFIX) {
+		group++;
+	}
+
+	index = nodelist.getGroupIndex (group);
+	if (!nodelist.leaveGroup (node, index)) {
+		DEBUG_WARN ("Node %u is not member of group %s", node->getNodeId (), group);
+		return false;
+	}
+	DEBUG_INFO ("Node %u leaves group %s", node->getNodeId (), group);
+	sendGroupKey (node, index, false);
+
+	if (nodelist.getGroup (index)) {
+		uint8_t key[KEY_LENGTH];
+		Node* member = NULL;
+
+		// Former member still knows current key. Remaining ones get a new one
+		CryptModule::random (key, KEY_LENGTH);
+		nodelist.setGroupKey (index, key);
+		memset (key, 0, KEY_LENGTH);
+		while ((member = nodelist.getNextGroupMember (index, member))) {
+			if (!sendGroupKey (member, index, true)) {
+				DEBUG_WARN ("Error sending new group key to node %u", member->getNodeId ());
+			}
+		}
+	}
+	return true;
+}
+
 bool  EnigmaIOTGatewayClass::invalidateKey (Node* node, gwInvalidateReason_t reason) {
 	/*
 	* --------------------------
@@ -1628,22 +2680,75 @@ bool  EnigmaIOTGatewayClass::invalidateKey (Node* node, gwInvalidateReason_t rea
 
 	invalidateKey_msg.reason = reason;
 
-	DEBUG_VERBOSE ("Invalidate Key message: %s", printHexBuffer ((uint8_t*)&invalidateKey_msg, IKMSG_LEN));
+	DEBUG_VERBOSE ("Invalidate Key message: %s", DEBUG_HEX ((uint8_t*)&invalidateKey_msg, IKMSG_LEN));
 	DEBUG_INFO (" -------> INVALIDATE_KEY");
 	if (notifyNodeDisconnection) {
 		uint8_t* mac = node->getMacAddress ();
-		notifyNodeDisconnection (mac, reason);
+		outputNodeDisconnection (mac, reason);
 	}
 	int32_t error = comm->send (node->getMacAddress (), (uint8_t*)&invalidateKey_msg, IKMSG_LEN) == 0;
 	node->reset ();
 	return error;
 }
 
+bool EnigmaIOTGatewayClass::admitRegistration (uint16_t& retryAfter) {
+	if (MAX_REGISTRATION_RATE == 0) {
+		return true;
+	}
+
+	const uint32_t interval = 1000 / MAX_REGISTRATION_RATE;
+	const uint32_t tolerance = (REGISTRATION_BURST > 0 ? REGISTRATION_BURST - 1 : 0) * interval;
+	uint32_t now = millis ();
+
+	if ((int32_t)(registrationTat - now) < 0) {
+		registrationTat = now;
+	}
+	if (registrationTat - now <= tolerance) {
+		registrationTat += interval;
+		return true;
+	}
+
+	// Give every deferred node a different slot, starting when next key agreement would be admitted
+	uint32_t slot = registrationTat - tolerance;
+	if ((int32_t)(registrationRetrySlot - slot) > 0) {
+		slot = registrationRetrySlot;
+	}
+	if (slot - now > MAX_REGISTRATION_RETRY) {
+		retryAfter = MAX_REGISTRATION_RETRY;
+	} else {
+		retryAfter = slot - now;
+		registrationRetrySlot = slot + interval;
+	}
+	deferredRegistrations++;
+	return false;
+}
+
+bool EnigmaIOTGatewayClass::registrationBusy (const uint8_t* mac, uint16_t retryAfter) {
+	/*
+	* --------------------------------------------
+	*| msgType (1) | reason (1) | Retry after (2) |
+	* --------------------------------------------
+	*/
+
+	struct __attribute__ ((packed, aligned (1))) {
+		uint8_t msgType;
+		uint8_t reason;
+		uint16_t retryAfter;
+	} registrationBusy_msg;
+
+	registrationBusy_msg.msgType = INVALIDATE_KEY;
+	registrationBusy_msg.reason = REGISTRATION_BUSY;
+	registrationBusy_msg.retryAfter = retryAfter;
+
+	DEBUG_INFO (" -------> INVALIDATE_KEY (REGISTRATION_BUSY)");
+	return comm->send (const_cast<uint8_t*>(mac), (uint8_t*)&registrationBusy_msg, sizeof (registrationBusy_msg)) == 0;
+}
+
 bool EnigmaIOTGatewayClass::processClientHello (const uint8_t mac[ENIGMAIOT_ADDR_LEN], const uint8_t* buf, size_t count, Node* node) {
 	/*
-	* ------------------------------------------------------------------------------------------------------------
-	*| msgType (1) | IV (12) | DH Kmaster (32) | Random (30 bits) | Broadcast (1 bit) | Sleepy (1 bit) | Tag (16) |
-	* ------------------------------------------------------------------------------------------------------------
+	* -----------------------------------------------------------------------------------------------------------------------------
+	*| msgType (1) | IV (12) | DH Kmaster (32) | Random (30 bits) | Broadcast (1 bit) | Sleepy (1 bit) | [Ciphers (1)] | Tag (16) |
+	* -----------------------------------------------------------------------------------------------------------------------------
 	*/
 
 	bool sleepyNode;
@@ -1654,19 +2759,29 @@ bool EnigmaIOTGatewayClass::processClientHello (const uint8_t mac[ENIGMAIOT_ADDR
 		uint8_t iv[IV_LENGTH];
 		uint8_t publicKey[KEY_LENGTH];
 		uint32_t random;
+		uint8_t ciphers;
 		uint8_t tag[TAG_LENGTH];
 	} clientHello_msg;
 
 #define CHMSG_LEN sizeof(clientHello_msg)
+#define CHMSG_LEGACY_LEN (CHMSG_LEN - sizeof(uint8_t)) // Nodes that do not send supported ciphers
 
-	if (count < CHMSG_LEN) {
-		DEBUG_WARN ("Message too short");
+	size_t encryptedLen;
+	const uint8_t* tag;
+
+	if (count == CHMSG_LEN) {
+		encryptedLen = KEY_LENGTH + sizeof (uint32_t) + sizeof (uint8_t);
+	} else if (count == CHMSG_LEGACY_LEN) {
+		encryptedLen = KEY_LENGTH + sizeof (uint32_t);
+	} else {
+		DEBUG_WARN ("Wrong message length");
 		return false;
 	}
 
 	memcpy (&clientHello_msg, buf, count);
+	tag = buf + count - TAG_LENGTH;
 
-	const uint8_t addDataLen = CHMSG_LEN - TAG_LENGTH - sizeof (uint32_t) - KEY_LENGTH;
+	const uint8_t addDataLen = CHMSG_LEN - TAG_LENGTH - sizeof (uint8_t) - sizeof (uint32_t) - KEY_LENGTH;
 	uint8_t aad[AAD_LENGTH + addDataLen];
 
 	memcpy (aad, (uint8_t*)&clientHello_msg, addDataLen); // Copy message upto iv
@@ -1674,19 +2789,25 @@ bool EnigmaIOTGatewayClass::processClientHello (const uint8_t mac[ENIGMAIOT_ADDR
 	// Copy 8 last bytes from NetworkKey
 	memcpy (aad + addDataLen, gwConfig.networkKey + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH);
 
-	if (!CryptModule::decryptBuffer (clientHello_msg.publicKey, KEY_LENGTH + sizeof (uint32_t),
+	if (!CryptModule::decryptBuffer (clientHello_msg.publicKey, encryptedLen,
 									 clientHello_msg.iv, IV_LENGTH,
 									 gwConfig.networkKey, KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of network key
-									 aad, sizeof (aad), clientHello_msg.tag, TAG_LENGTH)) {
+									 aad, sizeof (aad), tag, TAG_LENGTH)) {
 		DEBUG_ERROR ("Error during decryption");
 		return false;
 	}
 
-	DEBUG_VERBOSE ("Decrypted Client Hello message: %s", printHexBuffer ((uint8_t*)&clientHello_msg, CHMSG_LEN - TAG_LENGTH));
+	if (count == CHMSG_LEGACY_LEN) {
+		clientHello_msg.ciphers = CHACHAPOLY_CIPHER;
+	}
+
+	DEBUG_VERBOSE ("Decrypted Client Hello message: %s", DEBUG_HEX ((uint8_t*)&clientHello_msg, CHMSG_LEN - TAG_LENGTH));
 
 	node->reset ();
 
 	node->setEncryptionKey (clientHello_msg.publicKey);
+	node->setCipherAlgorithm (CryptModule::selectCipher (clientHello_msg.ciphers));
+	DEBUG_DBG ("Node cipher: %s", CryptModule::getBackend (node->getCipherAlgorithm ())->getName ());
 
 	Crypto.getDH1 ();
 	memcpy (myPublicKey, Crypto.getPubDHKey (), KEY_LENGTH);
@@ -1696,7 +2817,7 @@ bool EnigmaIOTGatewayClass::processClientHello (const uint8_t mac[ENIGMAIOT_ADDR
 
 		node->setKeyValid (true);
 		node->setStatus (INIT);
-		DEBUG_DBG ("Node key: %s", printHexBuffer (node->getEncriptionKey (), KEY_LENGTH));
+		DEBUG_DBG ("Node key: %s", DEBUG_HEX (node->getEncriptionKey (), KEY_LENGTH));
 	} else {
 		nodelist.unregisterNode (node);
 		char macstr[ENIGMAIOT_ADDR_LEN * 3];
@@ -1756,7 +2877,7 @@ bool EnigmaIOTGatewayClass::processClockRequest (const uint8_t mac[ENIGMAIOT_ADD
 
 	memcpy (&clockRequest_msg, buf, count);
 
-	DEBUG_VERBOSE ("IV: %s", printHexBuffer (clockRequest_msg.iv, IV_LENGTH));
+	DEBUG_VERBOSE ("IV: %s", DEBUG_HEX (clockRequest_msg.iv, IV_LENGTH));
 
 	const uint8_t addDataLen = 1 + IV_LENGTH;
 	uint8_t aad[AAD_LENGTH + addDataLen];
@@ -1768,25 +2889,22 @@ bool EnigmaIOTGatewayClass::processClockRequest (const uint8_t mac[ENIGMAIOT_ADD
 
 	//uint8_t packetLen = count - TAG_LENGTH;
 
-	if (!CryptModule::decryptBuffer ((uint8_t*)&(clockRequest_msg.counter), CRMSG_LEN - IV_LENGTH - TAG_LENGTH - 1, // Decrypt from counter, 10 bytes
-									 clockRequest_msg.iv, IV_LENGTH,
-									 node->getEncriptionKey (), KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of network key
-									 aad, sizeof (aad), clockRequest_msg.tag, TAG_LENGTH)) {
+	uint16_t epoch;
+
+	if (!decryptNodeMessage (node, node->getControlWindow (), (uint8_t*)&(clockRequest_msg.counter), CRMSG_LEN - IV_LENGTH - TAG_LENGTH - 1, // Decrypt from counter, 10 bytes
+							 clockRequest_msg.iv, aad, sizeof (aad), clockRequest_msg.tag, &epoch)) {
 		DEBUG_ERROR ("Error during decryption");
 		return false;
 	}
 
-    DEBUG_VERBOSE ("Decripted Clock Request message: %s", printHexBuffer ((uint8_t*)&clockRequest_msg, count - TAG_LENGTH));
+    DEBUG_VERBOSE ("Decripted Clock Request message: %s", DEBUG_HEX ((uint8_t*)&clockRequest_msg, count - TAG_LENGTH));
 
 	memcpy (&counter, &(clockRequest_msg.counter), sizeof (uint16_t));
 	DEBUG_INFO ("Node Id %d. Control message #%d", node->getNodeId (), counter);
 	if (useCounter) {
-		if (counter > node->getLastControlCounter ()) {
-			DEBUG_INFO ("Accepted");
-			node->setLastControlCounter (counter);
-		} else {
-			DEBUG_WARN ("Control message rejected");
-			return false;
+		replay_result_t replay = checkNodeCounter (node, true, ((uint32_t)epoch << 16) | counter);
+		if (replay == REPLAY_DUPLICATE || replay == REPLAY_TOO_OLD) {
+			return true;
 		}
 	}
 
@@ -1796,7 +2914,7 @@ bool EnigmaIOTGatewayClass::processClockRequest (const uint8_t mac[ENIGMAIOT_ADD
 
     DEBUG_DBG ("T1: %llu", clockRequest_msg.t1);
 	DEBUG_DBG ("T2: %llu", t2);
-	DEBUG_VERBOSE ("Clock Request message: %s", printHexBuffer ((uint8_t*)&clockRequest_msg, CRMSG_LEN - TAG_LENGTH));
+	DEBUG_VERBOSE ("Clock Request message: %s", DEBUG_HEX ((uint8_t*)&clockRequest_msg, CRMSG_LEN - TAG_LENGTH));
 
     return clockResponse (node, clockRequest_msg.t1, t2);
 }
@@ -1843,7 +2961,7 @@ bool EnigmaIOTGatewayClass::clockResponse (Node* node, uint64_t t1, uint64_t t2)
 
 	memcpy (&(clockResponse_msg.t3), &t3, sizeof (int64_t));
 
-	DEBUG_VERBOSE ("Clock Response message: %s", printHexBuffer ((uint8_t*)&clockResponse_msg, CRSMSG_LEN - TAG_LENGTH));
+	DEBUG_VERBOSE ("Clock Response message: %s", DEBUG_HEX ((uint8_t*)&clockResponse_msg, CRSMSG_LEN - TAG_LENGTH));
 
 #ifdef DEBUG_ESP_PORT
 	char mac[ENIGMAIOT_ADDR_LEN * 3];
@@ -1864,12 +2982,12 @@ bool EnigmaIOTGatewayClass::clockResponse (Node* node, uint64_t t1, uint64_t t2)
 	if (!CryptModule::encryptBuffer ((uint8_t*)&(clockResponse_msg.counter), CRSMSG_LEN - IV_LENGTH - TAG_LENGTH - 1, // Encrypt only from counter, 18 bytes
 									 clockResponse_msg.iv, IV_LENGTH,
 									 node->getEncriptionKey (), KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of network key
-									 aad, sizeof (aad), clockResponse_msg.tag, TAG_LENGTH)) {
+									 aad, sizeof (aad), clockResponse_msg.tag, TAG_LENGTH, node->getCipherAlgorithm ())) {
 		DEBUG_ERROR ("Error during encryption");
 		return false;
 	}
 
-	DEBUG_VERBOSE ("Encrypted Clock Response message: %s", printHexBuffer ((uint8_t*)&clockResponse_msg, CRSMSG_LEN));
+	DEBUG_VERBOSE ("Encrypted Clock Response message: %s", DEBUG_HEX ((uint8_t*)&clockResponse_msg, CRSMSG_LEN));
 
 	DEBUG_INFO (" -------> CLOCK RESPONSE");
 	if (comm->send (node->getMacAddress (), (uint8_t*)&clockResponse_msg, CRSMSG_LEN) == 0) {
@@ -1891,9 +3009,9 @@ bool EnigmaIOTGatewayClass::sendBroadcastKey (Node* node) {
 
 bool EnigmaIOTGatewayClass::serverHello (const uint8_t* key, Node* node) {
 	/*
-	* -----------------------------------------------------------------------------
-	*| msgType (1) | IV (12) | DH Kslave (32) | NodeID (2) | Random (4) | Tag (16) |
-	* -----------------------------------------------------------------------------
+	* -----------------------------------------------------------------------------------------------
+	*| msgType (1) | IV (12) | DH Kslave (32) | NodeID (2) | Random (4) | [Cipher (1)] | Tag (16) |
+	* -----------------------------------------------------------------------------------------------
 	*/
 
 	struct __attribute__ ((packed, aligned (1))) {
@@ -1902,23 +3020,34 @@ bool EnigmaIOTGatewayClass::serverHello (const uint8_t* key, Node* node) {
 		uint8_t publicKey[KEY_LENGTH];
 		uint16_t nodeId;
 		uint32_t random;
+		uint8_t cipher;
 		uint8_t tag[TAG_LENGTH];
 	} serverHello_msg;
 
 #define SHMSG_LEN sizeof(serverHello_msg)
 
 	uint32_t random;
+	size_t msgLen = SHMSG_LEN;
+	size_t encryptedLen = KEY_LENGTH + sizeof (uint16_t) + sizeof (uint32_t) + sizeof (uint8_t);
+	uint8_t* tag = serverHello_msg.tag;
 
 	if (!key) {
 		DEBUG_ERROR ("NULL key");
 		return false;
 	}
 
+	// Cipher field is only sent if it is not the default one, so that older nodes can still register
+	if (node->getCipherAlgorithm () == CHACHAPOLY_CIPHER) {
+		msgLen -= sizeof (uint8_t);
+		encryptedLen -= sizeof (uint8_t);
+		tag = &(serverHello_msg.cipher);
+	}
+
 	serverHello_msg.msgType = SERVER_HELLO; // Server hello message
 
 	CryptModule::random (serverHello_msg.iv, IV_LENGTH);
 
-	DEBUG_VERBOSE ("IV: %s", printHexBuffer (serverHello_msg.iv, IV_LENGTH));
+	DEBUG_VERBOSE ("IV: %s", DEBUG_HEX (serverHello_msg.iv, IV_LENGTH));
 
 	for (int i = 0; i < KEY_LENGTH; i++) {
 		serverHello_msg.publicKey[i] = key[i];
@@ -1930,9 +3059,11 @@ bool EnigmaIOTGatewayClass::serverHello (const uint8_t* key, Node* node) {
 	random = Crypto.random ();
 	memcpy (&(serverHello_msg.random), &random, RANDOM_LENGTH);
 
-	DEBUG_VERBOSE ("Server Hello message: %s", printHexBuffer ((uint8_t*)&serverHello_msg, SHMSG_LEN - TAG_LENGTH));
+	serverHello_msg.cipher = node->getCipherAlgorithm ();
+
+	DEBUG_VERBOSE ("Server Hello message: %s", DEBUG_HEX ((uint8_t*)&serverHello_msg, msgLen - TAG_LENGTH));
 
-	const uint8_t addDataLen = SHMSG_LEN - TAG_LENGTH - sizeof (uint32_t) - sizeof (uint16_t) - KEY_LENGTH;
+	const uint8_t addDataLen = SHMSG_LEN - TAG_LENGTH - sizeof (uint8_t) - sizeof (uint32_t) - sizeof (uint16_t) - KEY_LENGTH;
 	uint8_t aad[AAD_LENGTH + addDataLen];
 
 	memcpy (aad, (uint8_t*)&serverHello_msg, addDataLen); // Copy message upto iv
@@ -1940,15 +3071,15 @@ bool EnigmaIOTGatewayClass::serverHello (const uint8_t* key, Node* node) {
 	// Copy 8 last bytes from NetworkKey
 	memcpy (aad + addDataLen, gwConfig.networkKey + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH);
 
-	if (!CryptModule::encryptBuffer (serverHello_msg.publicKey, KEY_LENGTH + sizeof (uint16_t) + sizeof (uint32_t), // Encrypt from public key
+	if (!CryptModule::encryptBuffer (serverHello_msg.publicKey, encryptedLen, // Encrypt from public key
 									 serverHello_msg.iv, IV_LENGTH,
 									 gwConfig.networkKey, KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of network key
-									 aad, sizeof (aad), serverHello_msg.tag, TAG_LENGTH)) {
+									 aad, sizeof (aad), tag, TAG_LENGTH)) {
 		DEBUG_ERROR ("Error during encryption");
 		return false;
 	}
 
-	DEBUG_VERBOSE ("Encrypted Server Hello message: %s", printHexBuffer ((uint8_t*)&serverHello_msg, SHMSG_LEN));
+	DEBUG_VERBOSE ("Encrypted Server Hello message: %s", DEBUG_HEX ((uint8_t*)&serverHello_msg, msgLen));
 
 	flashTx = true;
 
@@ -1957,7 +3088,7 @@ bool EnigmaIOTGatewayClass::serverHello (const uint8_t* key, Node* node) {
 	mac2str (node->getMacAddress (), mac);
 #endif
 	DEBUG_INFO (" -------> SERVER_HELLO");
-	if (comm->send (node->getMacAddress (), (uint8_t*)&serverHello_msg, SHMSG_LEN) == 0) {
+	if (comm->send (node->getMacAddress (), (uint8_t*)&serverHello_msg, msgLen) == 0) {
 		DEBUG_INFO ("Server Hello message sent to %s", mac);
 		return true;
 	} else {
@@ -1967,5 +3098,269 @@ bool EnigmaIOTGatewayClass::serverHello (const uint8_t* key, Node* node) {
 	}
 }
 
+void EnigmaIOTGatewayClass::completeRegistration (Node* node) {
+	node->setStatus (REGISTERED);
+#if ENABLE_LINK_ADAPTATION
+	if (node->getLinkAdaptation ()) {
+		node->getLinkAdaptation ()->reset (); // Node starts again at full power
+	}
+#endif // ENABLE_LINK_ADAPTATION
+	node->setKeyValidFrom (millis ());
+	node->setLastMessageCounter (0);
+	node->setLastControlCounter (0);
+	node->setLastDownlinkMsgCounter (0);
+	node->setLastMessageTime ();
+	if (notifyNewNode) {
+		outputNewNode (node->getMacAddress (), node->getNodeId (), NULL);
+	}
+#if DEBUG_LEVEL >= INFO
+	nodelist.printToSerial (&DEBUG_ESP_PORT);
+#endif
+	if (node->broadcastIsEnabled ()) {
+		if (!sendBroadcastKey (node)) {
+			DEBUG_WARN ("Error sending broadcast key to node");
+		} else {
+			node->setBroadcastKeyRequested (false);
+			DEBUG_INFO ("Broadcast key sent to node");
+		}
+	}
+	// Group keys may have changed while node was not registered
+	for (int8_t i = 0; i < MAX_NODE_GROUPS; i++) {
+		if (node->isGroupMember (i) && !sendGroupKey (node, i, true)) {
+			DEBUG_WARN ("Error sending group %d key to node", i);
+		}
+	}
+}
+
+#if ENABLE_MULTI_GATEWAY
+bool EnigmaIOTGatewayClass::setTicketKey (const char* key) {
+	size_t keySize = key ? strlen (key) : 0;
+
+	if (keySize < 8 || keySize > KEY_LENGTH) {
+		DEBUG_WARN ("Ticket key must have from 8 to %d characters", KEY_LENGTH);
+		return false;
+	}
+	memset (plainTicketKey, 0, sizeof (plainTicketKey));
+	memcpy (plainTicketKey, key, keySize);
+	memset (gwConfig.ticketKey, 0, KEY_LENGTH);
+	memcpy (gwConfig.ticketKey, key, keySize);
+	CryptModule::getSHA256 (gwConfig.ticketKey, KEY_LENGTH);
+	return true;
+}
+
+void EnigmaIOTGatewayClass::setSharedTicketKey () {
+	if (plainTicketKey[0] == '\0') {
+		DEBUG_WARN ("Ticket key not set. Session tickets are only valid on this gateway");
+		return;
+	}
+	// Nodes know network key so it cannot protect tickets
+	if (!strncmp (plainTicketKey, plainNetKey, KEY_LENGTH)) {
+		DEBUG_WARN ("Ticket key must be different from network key. Session tickets are only valid on this gateway");
+		return;
+	}
+	memcpy (ticketKey, gwConfig.ticketKey, KEY_LENGTH);
+}
+
+void EnigmaIOTGatewayClass::updateLoad () {
+	uint16_t activeNodes = nodelist.countActiveNodes ();
+	uint16_t nodeLoad = activeNodes * 100 / NUM_NODES;
+	uint16_t queueLoad = input_queue->size () * 100 / MAX_INPUT_QUEUE_SIZE;
+
+	lastLoadUpdate = millis ();
+	GatewayLoad.advertise (nodeLoad > queueLoad ? nodeLoad : queueLoad, NUM_NODES - activeNodes);
+}
+
+bool EnigmaIOTGatewayClass::releaseNode (const uint8_t* mac) {
+	Node* node = nodelist.getNodeFromMAC (mac);
+
+	if (!node || !node->isRegistered ()) {
+		return false;
+	}
+	DEBUG_INFO ("Node %s registered on other gateway. Releasing it", DEBUG_MAC (mac));
+	// Node is not notified as it is using other gateway now. Pending downlink messages are discarded
+	nodelist.unregisterNode (node);
+	return true;
+}
+#endif // ENABLE_MULTI_GATEWAY
+
+void EnigmaIOTGatewayClass::getResumptionSecret (const uint8_t mac[ENIGMAIOT_ADDR_LEN], const uint8_t* ticket, uint8_t* secret) {
+	uint8_t buffer[KEY_LENGTH + ENIGMAIOT_ADDR_LEN + SESSION_TICKET_LENGTH];
+
+	// Secret is bound to node address, so a ticket cannot be used by other node
+	memcpy (buffer, ticketKey, KEY_LENGTH);
+	memcpy (buffer + KEY_LENGTH, mac, ENIGMAIOT_ADDR_LEN);
+	memcpy (buffer + KEY_LENGTH + ENIGMAIOT_ADDR_LEN, ticket, SESSION_TICKET_LENGTH);
+	memcpy (secret, CryptModule::getSHA256 (buffer, sizeof (buffer)), KEY_LENGTH);
+	memset (buffer, 0, sizeof (buffer));
+}
+
+bool EnigmaIOTGatewayClass::sendSessionTicket (Node* node) {
+	/*
+	* --------------------------------------------------------------
+	*| Issue time (4) | Cipher (1) | Random (11) | Secret (32) |
+	* --------------------------------------------------------------
+	*/
+	uint8_t ticketData[SESSION_TICKET_LENGTH + KEY_LENGTH];
+	uint32_t issueTime = getTicketTime ();
+
+	memcpy (ticketData, &issueTime, sizeof (uint32_t));
+	ticketData[sizeof (uint32_t)] = node->getCipherAlgorithm ();
+	CryptModule::random (ticketData + sizeof (uint32_t) + sizeof (uint8_t), SESSION_TICKET_LENGTH - sizeof (uint32_t) - sizeof (uint8_t));
+	getResumptionSecret (node->getMacAddress (), ticketData, ticketData + SESSION_TICKET_LENGTH);
+
+	DEBUG_DBG ("Send session ticket to " MACSTR, MAC2STR (node->getMacAddress ()));
+	bool result = sendDownstream (node->getMacAddress (), ticketData, sizeof (ticketData), control_message_type_t::SESSION_TICKET);
+	memset (ticketData, 0, sizeof (ticketData));
+	return result;
+}
+
+bool EnigmaIOTGatewayClass::processResumeRequest (const uint8_t mac[ENIGMAIOT_ADDR_LEN], const uint8_t* buf, size_t count, Node* node) {
+	/*
+	* ------------------------------------------------------------------------------------------------------------
+	*| msgType (1) | IV (12) | Ticket (16) | Random (8) | Random (6 bits) | Broadcast (1 bit) | Sleepy (1 bit) | Tag (16) |
+	* ------------------------------------------------------------------------------------------------------------
+	*/
+
+	struct __attribute__ ((packed, aligned (1))) {
+		uint8_t msgType;
+		uint8_t iv[IV_LENGTH];
+		uint8_t ticket[SESSION_TICKET_LENGTH];
+		uint8_t nonce[RESUME_NONCE_LENGTH];
+		uint8_t flags;
+		uint8_t tag[TAG_LENGTH];
+	} resumeRequest_msg;
+
+#define RRMSG_LEN sizeof(resumeRequest_msg)
+
+	if (SESSION_TICKET_VALIDITY == 0) {
+		DEBUG_WARN ("Session resumption is disabled");
+		return false;
+	}
+
+	if (count != RRMSG_LEN) {
+		DEBUG_WARN ("Wrong message length");
+		return false;
+	}
+
+	memcpy (&resumeRequest_msg, buf, count);
+
+	uint32_t issueTime;
+	memcpy (&issueTime, resumeRequest_msg.ticket, sizeof (uint32_t));
+	if (getTicketTime () - issueTime > SESSION_TICKET_VALIDITY) {
+		DEBUG_WARN ("Session ticket expired");
+		return false;
+	}
+
+	getResumptionSecret (mac, resumeRequest_msg.ticket, resumptionSecret);
+
+	const uint8_t addDataLen = RRMSG_LEN - TAG_LENGTH - sizeof (uint8_t) - RESUME_NONCE_LENGTH;
+	uint8_t aad[AAD_LENGTH + addDataLen];
+
+	memcpy (aad, (uint8_t*)&resumeRequest_msg, addDataLen); // Copy message upto ticket
+
+	// Copy 8 last bytes from resumption secret
+	memcpy (aad + addDataLen, resumptionSecret + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH);
+
+	if (!CryptModule::decryptBuffer (resumeRequest_msg.nonce, RESUME_NONCE_LENGTH + sizeof (uint8_t),
+									 resumeRequest_msg.iv, IV_LENGTH,
+									 resumptionSecret, KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of resumption secret
+									 aad, sizeof (aad), resumeRequest_msg.tag, TAG_LENGTH)) {
+		DEBUG_ERROR ("Error during decryption. Ticket was not issued to this node");
+		return false;
+	}
+
+	DEBUG_VERBOSE ("Decrypted Resume Request message: %s", DEBUG_HEX ((uint8_t*)&resumeRequest_msg, RRMSG_LEN - TAG_LENGTH));
+
+	node->reset ();
+
+	node->setCipherAlgorithm (CryptModule::selectCipher (resumeRequest_msg.ticket[sizeof (uint32_t)]));
+	DEBUG_DBG ("Node cipher: %s", CryptModule::getBackend (node->getCipherAlgorithm ())->getName ());
+
+	// New node key = SHA256 (secret | node random | gateway random)
+	uint8_t keyMaterial[KEY_LENGTH + 2 * RESUME_NONCE_LENGTH];
+	CryptModule::random (resumeNonce, RESUME_NONCE_LENGTH);
+	memcpy (keyMaterial, resumptionSecret, KEY_LENGTH);
+	memcpy (keyMaterial + KEY_LENGTH, resumeRequest_msg.nonce, RESUME_NONCE_LENGTH);
+	memcpy (keyMaterial + KEY_LENGTH + RESUME_NONCE_LENGTH, resumeNonce, RESUME_NONCE_LENGTH);
+	node->setEncryptionKey (CryptModule::getSHA256 (keyMaterial, sizeof (keyMaterial)));
+	memset (keyMaterial, 0, sizeof (keyMaterial));
+
+	node->setKeyValid (true);
+	node->setStatus (INIT);
+	DEBUG_DBG ("Node key: %s", DEBUG_HEX (node->getEncriptionKey (), KEY_LENGTH));
+
+	bool sleepyNode = (resumeRequest_msg.flags & 0x01U) == 1;
+	node->setInitAsSleepy (sleepyNode);
+	node->setSleepy (sleepyNode);
+	DEBUG_VERBOSE ("This is a %s node", sleepyNode ? "sleepy" : "always awaken");
+
+	bool broadcast = (resumeRequest_msg.flags & 0x02U) == 2;
+	node->enableBroadcast (broadcast);
+	node->setBroadcastKeyRequested (broadcast);
+	DEBUG_INFO ("This node has broadcast mode %s", broadcast ? "enabled" : "disabled");
+
+	return true;
+}
+
+bool EnigmaIOTGatewayClass::resumeResponse (Node* node) {
+	/*
+	* ------------------------------------------------------------------------
+	*| msgType (1) | IV (12) | NodeID (2) | Random (8) | Cipher (1) | Tag (16) |
+	* ------------------------------------------------------------------------
+	*/
+
+	struct __attribute__ ((packed, aligned (1))) {
+		uint8_t msgType;
+		uint8_t iv[IV_LENGTH];
+		uint16_t nodeId;
+		uint8_t nonce[RESUME_NONCE_LENGTH];
+		uint8_t cipher;
+		uint8_t tag[TAG_LENGTH];
+	} resumeResponse_msg;
+
+#define RSMSG_LEN sizeof(resumeResponse_msg)
+
+	resumeResponse_msg.msgType = RESUME_RESPONSE;
+
+	CryptModule::random (resumeResponse_msg.iv, IV_LENGTH);
+
+	uint16_t nodeId = node->getNodeId ();
+	memcpy (&(resumeResponse_msg.nodeId), &nodeId, sizeof (uint16_t));
+	memcpy (resumeResponse_msg.nonce, resumeNonce, RESUME_NONCE_LENGTH);
+	resumeResponse_msg.cipher = node->getCipherAlgorithm ();
+
+	DEBUG_VERBOSE ("Resume Response message: %s", DEBUG_HEX ((uint8_t*)&resumeResponse_msg, RSMSG_LEN - TAG_LENGTH));
+
+	const uint8_t addDataLen = 1 + IV_LENGTH;
+	uint8_t aad[AAD_LENGTH + addDataLen];
+
+	memcpy (aad, (uint8_t*)&resumeResponse_msg, addDataLen); // Copy message upto iv
+
+	// Copy 8 last bytes from resumption secret
+	memcpy (aad + addDataLen, resumptionSecret + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH);
+
+	if (!CryptModule::encryptBuffer ((uint8_t*)&(resumeResponse_msg.nodeId), sizeof (uint16_t) + RESUME_NONCE_LENGTH + sizeof (uint8_t),
+									 resumeResponse_msg.iv, IV_LENGTH,
+									 resumptionSecret, KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of resumption secret
+									 aad, sizeof (aad), resumeResponse_msg.tag, TAG_LENGTH)) {
+		DEBUG_ERROR ("Error during encryption");
+		return false;
+	}
+
+	DEBUG_VERBOSE ("Encrypted Resume Response message: %s", DEBUG_HEX ((uint8_t*)&resumeResponse_msg, RSMSG_LEN));
+
+	flashTx = true;
+
+	DEBUG_INFO (" -------> RESUME_RESPONSE");
+	if (comm->send (node->getMacAddress (), (uint8_t*)&resumeResponse_msg, RSMSG_LEN) == 0) {
+		DEBUG_INFO ("Resume Response message sent to " MACSTR, MAC2STR (node->getMacAddress ()));
+		return true;
+	} else {
+		nodelist.unregisterNode (node);
+		DEBUG_ERROR ("Error sending Resume Response message to " MACSTR, MAC2STR (node->getMacAddress ()));
+		return false;
+	}
+}
+
 EnigmaIOTGatewayClass EnigmaIOTGateway;
 
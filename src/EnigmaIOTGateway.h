@@ -18,10 +18,12 @@
 #include "NodeList.h"
 #include "Filter.h"
 #include "Comms_hal.h"
+#include "nodeSnapshot.h"
 #include <ESPAsyncWebServer.h>
 #include <ESPAsyncWiFiManager.h>
 #include <DNSServer.h>
 #include <queue>
+#include <atomic>
 #if ENABLE_REST_API
 #include "GatewayAPI.h"
 #endif // ENABLE_REST_API
@@ -45,15 +47,22 @@ enum gatewayMessageType_t {
 	CONTROL_DATA = 0x03, /**< Internal control message from sensor to gateway. Used for OTA, settings configuration, etc */
 	DOWNSTREAM_CTRL_DATA = 0x04, /**< Internal control message from gateway to sensor. Used for OTA, settings configuration, etc */
 	DOWNSTREAM_BRCAST_CTRL_DATA = 0x84, /**< Internal control broadcast message from gateway to sensor. Used for OTA, settings configuration, etc */
+	DOWNSTREAM_GROUP_DATA_SET = 0xA2, /**< Data message from gateway to a multicast group. Downstream data for user commands */
+	DOWNSTREAM_GROUP_DATA_GET = 0xB2, /**< Data message from gateway to a multicast group. Downstream data for user commands */
+	DOWNSTREAM_GROUP_CTRL_DATA = 0xA4, /**< Internal control message from gateway to a multicast group */
 	CLOCK_REQUEST = 0x05, /**< Clock request message from node */
 	CLOCK_RESPONSE = 0x06, /**< Clock response message from gateway */
 	NODE_NAME_SET = 0x07, /**< Message from node to signal its own custom node name */
 	NODE_NAME_RESULT = 0x17, /**< Message from gateway to get result after set node name */
 	BROADCAST_KEY_REQUEST = 0x08, /**< Message from node to request broadcast key */
 	BROADCAST_KEY_RESPONSE = 0x18, /**< Message from gateway with broadcast key */
+	DOWNLINK_EMPTY = 0x19, /**< Message from gateway to sleepy node after a data message. Signals that nothing is queued for it, so it may sleep without waiting */
+	GATEWAY_PROBE = 0x1A, /**< Message from node to check if gateway is on a channel. It is ignored */
 	CLIENT_HELLO = 0xFF, /**< ClientHello message from sensor node */
 	SERVER_HELLO = 0xFE, /**< ServerHello message from gateway */
-	INVALIDATE_KEY = 0xFB /**< InvalidateKey message from gateway */
+	INVALIDATE_KEY = 0xFB, /**< InvalidateKey message from gateway */
+	RESUME_REQUEST = 0xFA, /**< Message from node to resume a session using a ticket, without key agreement */
+	RESUME_RESPONSE = 0xF9 /**< Message from gateway with data to derive resumed session key */
 };
 
 enum gatewayPayloadEncoding_t {
@@ -64,6 +73,10 @@ enum gatewayPayloadEncoding_t {
 	BSON = 0x84, /**< Data packed using BSON. NOT IMPLEMENTED */
 	CBOR = 0x85, /**< Data packed using CBOR. NOT IMPLEMENTED */
 	SMILE = 0x86, /**< Data packed using SMILE. NOT IMPLEMENTED */
+	SCHEMA_DEF = 0x87, /**< Schema definition for SCHEMA_DATA payloads. Gateway keeps it and does not notify it */
+	SCHEMA_DATA = 0x88, /**< Values packed using last schema sent by node. Gateway notifies them as MSG_PACK */
+	FRAGMENT = 0x8E, /**< Fragment of a payload too long for a single message. Gateway notifies reassembled payload */
+	BATCH = 0x8F, /**< Several readings, each one with its own encoding and age. Gateway notifies them separately */
 	ENIGMAIOT = 0xFF
 };
 
@@ -77,37 +90,98 @@ enum gwInvalidateReason_t {
 	WRONG_DATA = 0x03, /**< Data message received could not be decrypted successfuly */
 	UNREGISTERED_NODE = 0x04, /**< Data received from an unregistered node*/
 	KEY_EXPIRED = 0x05, /**< Node key has reached maximum validity time */
-	KICKED = 0x06 /**< Node key has been forcibly unregistered */
+	KICKED = 0x06, /**< Node key has been forcibly unregistered */
+	INVALID_SESSION_TICKET = 0x07, /**< Session resumption ticket is not valid or has expired. Node has to do a full key agreement */
+	NODE_INACTIVE = 0x08, /**< Node has not sent any message for `MAX_NODE_INACTIVITY` ms and gateway has deleted it. Only used on node disconnection notification, it is never sent to node */
+	REGISTRATION_BUSY = 0x09 /**< Gateway is processing too many key agreements. Node has to retry after the time given in message. Node key is not affected and it is never notified as a disconnection */
 };
 
 #if defined ARDUINO_ARCH_ESP8266 || defined ARDUINO_ARCH_ESP32
 #include <functional>
-typedef std::function<void (uint8_t* mac, uint8_t* buf, uint8_t len, uint16_t lostMessages, bool control, gatewayPayloadEncoding_t payload_type, char* nodeName)> onGwDataRx_t;
+typedef std::function<void (uint8_t* mac, uint8_t* buf, size_t len, uint16_t lostMessages, bool control, gatewayPayloadEncoding_t payload_type, char* nodeName)> onGwDataRx_t;
 typedef std::function<void (uint8_t* mac, uint16_t node_id, char* nodeName)> onNewNode_t;
 typedef std::function<void (uint8_t* mac, gwInvalidateReason_t reason)> onNodeDisconnected_t;
 typedef std::function<void (boolean status)> onWiFiManagerExit_t;
 typedef std::function<void (void)> simpleEventHandler_t;
+typedef std::function<void (uint8_t* mac, bool delivered, uint32_t latency)> onDownlinkComplete_t;
 
 #else
-typedef void (*onGwDataRx_t)(uint8_t* mac, uint8_t* data, uint8_t len, uint16_t lostMessages, bool control, gatewayPayloadEncoding_t payload_type, char* nodeName);
+typedef void (*onGwDataRx_t)(uint8_t* mac, uint8_t* data, size_t len, uint16_t lostMessages, bool control, gatewayPayloadEncoding_t payload_type, char* nodeName);
 typedef void (*onNewNode_t)(uint8_t* mac, uint16_t node_id, char* nodeName);
 typedef void (*onNodeDisconnected_t)(uint8_t* mac, gwInvalidateReason_t reason);
 typedef void (*onWiFiManagerExit_t)(boolean status);
 typedef void (*simpleEventHandler_t)(void);
+typedef void (*onDownlinkComplete_t)(uint8_t* mac, bool delivered, uint32_t latency);
 #endif
 
 typedef struct {
 	uint8_t channel = DEFAULT_CHANNEL; /**< Channel used for communications*/
 	uint8_t networkKey[KEY_LENGTH];   /**< Network key to protect key agreement*/
 	char networkName[NETWORK_NAME_LENGTH];   /**< Network name, used to help nodes to find gateway*/
+#if ENABLE_MULTI_GATEWAY
+	uint8_t ticketKey[KEY_LENGTH];   /**< Key shared only among gateways to accept each other's session tickets. Nodes never get it*/
+#endif // ENABLE_MULTI_GATEWAY
 } gateway_config_t;
 
 typedef struct {
 	uint8_t addr[ENIGMAIOT_ADDR_LEN]; /**< Message address*/
 	uint8_t data[MAX_MESSAGE_LENGTH]; /**< Message buffer*/
 	size_t len; /**< Message length*/
+#if ENABLE_GATEWAY_METRICS
+	uint32_t queuedTime; /**< Value of `micros()` when message was queued*/
+#endif // ENABLE_GATEWAY_METRICS
 } msg_queue_item_t;
 
+typedef struct {
+	uint32_t tag; /**< Message tag given by communications layer*/
+	uint8_t status; /**< Sending status. 0 means success*/
+	uint32_t latency; /**< Time from message sending to status report in microseconds*/
+} send_complete_item_t;
+
+#if ENABLE_GATEWAY_PIPELINE
+#ifndef ESP32
+#error Gateway pipeline needs ESP32. Set ENABLE_GATEWAY_PIPELINE to 0
+#endif
+
+/**
+  * @brief Notifications passed from gateway task to output task
+  */
+enum outputEvent_t {
+	OUTPUT_DATA = 0x00, /**< Data received from node. Invokes `onDataRx` callback */
+	OUTPUT_NEW_NODE = 0x01, /**< Node registered or changed its name. Invokes `onNewNode` callback */
+	OUTPUT_NODE_DISCONNECTED = 0x02, /**< Node key invalidated. Invokes `onNodeDisconnected` callback */
+	OUTPUT_DOWNLINK_COMPLETE = 0x03 /**< Downlink message delivered or given up. Invokes `onDownlinkComplete` callback */
+};
+
+static const size_t OUTPUT_EVENT_DATA_LENGTH = MAX_FRAGMENTED_PAYLOAD_SIZE > MAX_MESSAGE_LENGTH ? MAX_FRAGMENTED_PAYLOAD_SIZE : MAX_MESSAGE_LENGTH; ///< @brief Longest payload that a notification can carry
+
+typedef struct {
+	uint8_t event; /**< Notification type, as `outputEvent_t`*/
+	uint8_t addr[ENIGMAIOT_ADDR_LEN]; /**< Node address*/
+	char nodeName[NODE_NAME_LENGTH]; /**< Node name. Empty if node has no name*/
+	uint16_t value; /**< Lost messages on data, node id on new node, reason on node disconnection*/
+	bool flag; /**< Control data flag on data, delivery result on downlink completion*/
+	uint8_t encoding; /**< Payload encoding on data*/
+	uint32_t latency; /**< Delivery time on downlink completion*/
+	int64_t timestamp; /**< Data timestamp, as given by `getDataTimestamp()`*/
+#if ENABLE_GATEWAY_METRICS
+	uint32_t queuedTime; /**< Value of `micros()` when notification was queued*/
+#endif // ENABLE_GATEWAY_METRICS
+	size_t len; /**< Payload length on data*/
+	uint8_t data[OUTPUT_EVENT_DATA_LENGTH]; /**< Payload on data*/
+} output_queue_item_t;
+#endif // ENABLE_GATEWAY_PIPELINE
+
+typedef struct {
+	uint32_t tag = 0; /**< Tag of last sending attempt. 0 means slot is free*/
+	uint8_t addr[ENIGMAIOT_ADDR_LEN]; /**< Destination address*/
+	uint8_t data[MAX_MESSAGE_LENGTH]; /**< Message buffer, kept to be able to resend it*/
+	size_t len; /**< Message length*/
+	uint8_t retries; /**< Number of resent attempts*/
+	uint32_t firstSent; /**< Value of `micros()` on first sending attempt*/
+	uint32_t lastSent; /**< Value of `micros()` on last sending attempt*/
+} downlink_inflight_t;
+
 /**
   * @brief Ring buffer class. Used to implement message buffer
   *
@@ -217,6 +291,134 @@ public:
 	}
 };
 
+/**
+  * @brief Lock free ring buffer class for a single producer and a single consumer.
+  *
+  * Producer reserves a slot, fills it in place and commits it. Consumer reads the oldest slot in place
+  * and releases it with `pop()`. Indexes are atomic so no critical section is needed, even if producer and
+  * consumer run on different cores. If buffer is full new elements are rejected, as producer cannot discard
+  * elements owned by consumer.
+  */
+template <typename Telement>
+class EnigmaIOTLockFreeRingBuffer {
+protected:
+	int maxSize; ///< @brief Number of slots. One of them is always kept empty to distinguish full from empty buffer
+	std::atomic<int> readIndex; ///< @brief Pointer to next item to be read. Only written by consumer
+	std::atomic<int> writeIndex; ///< @brief Pointer to next position to write onto. Only written by producer
+	Telement* buffer; ///< @brief Actual buffer
+
+	/**
+	  * @brief Calculates next index position
+	  * @param index Current index
+	  * @return Next index, wrapped to buffer size
+	  */
+	int next (int index) {
+		index++;
+		return index >= maxSize ? 0 : index;
+	}
+
+public:
+	/**
+	  * @brief Creates a ring buffer to hold `Telement` objects
+	  * @param range Buffer depth
+	  */
+	EnigmaIOTLockFreeRingBuffer <Telement> (int range) : maxSize (range + 1), readIndex (0), writeIndex (0) {
+		buffer = new Telement[maxSize];
+	}
+
+	/**
+	  * @brief EnigmaIOTLockFreeRingBuffer destructor. Frees up buffer memory
+	  */
+	~EnigmaIOTLockFreeRingBuffer () {
+		maxSize = 0;
+		delete[] (buffer);
+	}
+
+	/**
+	  * @brief Returns actual number of elements that buffer holds
+	  * @return Returns Actual number of elements that buffer holds
+	  */
+	int size () {
+		int elements = writeIndex.load (std::memory_order_acquire) - readIndex.load (std::memory_order_acquire);
+		return elements < 0 ? elements + maxSize : elements;
+	}
+
+	/**
+	  * @brief Checks if buffer is full
+	  * @return Returns `true`if buffer is full, `false` otherwise
+	  */
+	bool isFull () {
+		return next (writeIndex.load (std::memory_order_relaxed)) == readIndex.load (std::memory_order_acquire);
+	}
+
+	/**
+	  * @brief Checks if buffer is empty
+	  * @return Returns `true`if buffer has no elements stored, `false` otherwise
+	  */
+	bool empty () {
+		return readIndex.load (std::memory_order_relaxed) == writeIndex.load (std::memory_order_acquire);
+	}
+
+	/**
+	  * @brief Gets a free slot to write a new element on. It is not visible to consumer until `commit()` is called.
+	  * Only producer may call this
+	  * @return Returns pointer to free slot. If buffer is full it returns `NULL`
+	  */
+	Telement* reserve () {
+		if (isFull ()) {
+			return NULL;
+		}
+		return &(buffer[writeIndex.load (std::memory_order_relaxed)]);
+	}
+
+	/**
+	  * @brief Publishes element written on slot got from `reserve()`. Only producer may call this
+	  */
+	void commit () {
+		writeIndex.store (next (writeIndex.load (std::memory_order_relaxed)), std::memory_order_release);
+	}
+
+	/**
+	  * @brief Adds a new item to buffer copying it. Only producer may call this
+	  * @param item Element to add to buffer
+	  * @return Returns `false` if buffer was full and element could not be added, `true` otherwise
+	  */
+	bool push (Telement* item) {
+		Telement* slot = reserve ();
+		if (!slot) {
+			return false;
+		}
+		memcpy (slot, item, sizeof (Telement));
+		commit ();
+		return true;
+	}
+
+	/**
+	  * @brief Deletes older item from buffer, if buffer is not empty. Only consumer may call this
+	  * @return Returns `false` if buffer was empty before trying to delete element, `true` otherwise
+	  */
+	bool pop () {
+		if (empty ()) {
+			return false;
+		}
+		readIndex.store (next (readIndex.load (std::memory_order_relaxed)), std::memory_order_release);
+		return true;
+	}
+
+	/**
+	  * @brief Gets a pointer to older item in buffer, if buffer is not empty. Element stays valid until `pop()` is called.
+	  * Only consumer may call this
+	  * @return Returns pointer to element. If buffer was empty before calling this method it returns `NULL`
+	  */
+	Telement* front () {
+		if (!empty ()) {
+			return &(buffer[readIndex.load (std::memory_order_relaxed)]);
+		} else {
+			return NULL;
+		}
+	}
+};
+
 /**
   * @brief Main gateway class. Manages communication with nodes and sends data to upper layer
   *
@@ -224,6 +426,12 @@ public:
 class EnigmaIOTGatewayClass {
 protected:
 	uint8_t myPublicKey[KEY_LENGTH]; ///< @brief Temporary public key store used during key agreement
+	uint8_t ticketKey[KEY_LENGTH]; ///< @brief Random key used to derive session resumption secrets. It is generated on every boot so tickets do not survive a gateway restart, unless node snapshot is enabled. With `ENABLE_MULTI_GATEWAY` it is taken from gateway configuration, if set
+#if ENABLE_MULTI_GATEWAY
+	time_t lastLoadUpdate = 0; ///< @brief Last time that load advertised on beacons was updated
+#endif // ENABLE_MULTI_GATEWAY
+	uint8_t resumptionSecret[KEY_LENGTH]; ///< @brief Temporary store of resumption secret used during session resumption
+	uint8_t resumeNonce[RESUME_NONCE_LENGTH]; ///< @brief Temporary store of gateway random number used during session resumption
 	bool flashTx = false; ///< @brief `true` if Tx LED should flash
 	volatile bool flashRx = false; ///< @brief `true` if Rx LED should flash
 	node_t node; ///< @brief temporary store to keep node data while processing a message
@@ -240,12 +448,39 @@ protected:
 	bool useCounter = true; ///< @brief `true` if counter is used to check data messages order
 	gateway_config_t gwConfig; ///< @brief Gateway specific configuration to be stored on flash memory
 	char plainNetKey[KEY_LENGTH];
-#ifdef ESP32
-	portMUX_TYPE myMutex = portMUX_INITIALIZER_UNLOCKED; ///< @brief Handle to control critical sections
-#endif
+#if ENABLE_MULTI_GATEWAY
+	char plainTicketKey[KEY_LENGTH + 1] = ""; ///< @brief Ticket key as configured, stored on flash. Empty if it has not been set
+#endif // ENABLE_MULTI_GATEWAY
 	msg_queue_item_t tempBuffer; ///< @brief Temporary storage for input message got from buffer
 
-	EnigmaIOTRingBuffer<msg_queue_item_t>* input_queue; ///< @brief Input messages buffer. It acts as a FIFO queue
+	EnigmaIOTLockFreeRingBuffer<msg_queue_item_t>* input_queue; ///< @brief Input messages buffer. It acts as a FIFO queue. Written from ESP-NOW receive callback, read from `handle()`
+	volatile uint32_t inputQueueDrops = 0; ///< @brief Number of input messages lost because input queue was full
+	int drainMaxMessages = INPUT_QUEUE_DRAIN_MESSAGES; ///< @brief Maximum number of input messages processed on every `handle()` call
+	uint32_t drainMaxTime = INPUT_QUEUE_DRAIN_TIME; ///< @brief Maximum time in ms used to process input messages on every `handle()` call
+	uint32_t registrationTat = 0; ///< @brief Theoretical time when registration rate limit would be reached without burst. Key agreements are admitted while it is less than `REGISTRATION_BURST` intervals ahead
+	uint32_t registrationRetrySlot = 0; ///< @brief Next free time slot to be given to a deferred node
+	uint32_t deferredRegistrations = 0; ///< @brief Number of Client Hello messages that were answered with `REGISTRATION_BUSY`
+
+	EnigmaIOTLockFreeRingBuffer<send_complete_item_t>* sendCompleteQueue; ///< @brief Sending status reports. Written from ESP-NOW send callback, read from `handle()`
+	downlink_inflight_t downlinkInflight[MAX_DOWNLINK_INFLIGHT]; ///< @brief Downlink messages waiting for delivery confirmation
+	uint32_t downlinkRetries = 0; ///< @brief Number of downlink messages resent because they were not delivered
+	uint32_t downlinkFailures = 0; ///< @brief Number of downlink messages that could not be delivered after all retries
+	int64_t dataTimestamp = 0; ///< @brief Time in ms when data being notified was taken by node
+	uint8_t fragmentTransferId = 0; ///< @brief Identifier of last fragmented downlink payload
+	onDownlinkComplete_t notifyDownlinkComplete; ///< @brief Callback function that will be invoked when a downlink message delivery is confirmed or given up
+#if ENABLE_GATEWAY_PIPELINE
+	bool pipelined = false; ///< @brief `true` after `startPipeline()`. Notifications are queued instead of invoking callbacks
+	EnigmaIOTLockFreeRingBuffer<output_queue_item_t>* outputQueue = NULL; ///< @brief Notifications buffer. Written from gateway task, read from `handleOutput()`
+	TaskHandle_t gatewayTask = NULL; ///< @brief Task that runs `handle()` in pipelined mode
+	SemaphoreHandle_t gatewayMutex = NULL; ///< @brief Serializes access to gateway between its own task and other ones
+	uint32_t outputStalls = 0; ///< @brief Number of times that input processing was stopped because output queue was full
+	uint32_t outputDrops = 0; ///< @brief Number of notifications lost because output queue was full
+#endif // ENABLE_GATEWAY_PIPELINE
+#if ENABLE_NODE_SNAPSHOT
+	NodeSnapshot snapshot; ///< @brief Encrypted store of node sessions on flash
+	bool snapshotEnabled = false; ///< @brief `true` if snapshot is in use. Only if configuration is stored on flash
+	uint16_t snapshotBroadcastCounter = 0; ///< @brief Broadcast message counter saved on snapshot last time
+#endif // ENABLE_NODE_SNAPSHOT
 
 	AsyncWebServer* server; ///< @brief WebServer that holds configuration portal
 	DNSServer* dns; ///< @brief DNS server used by configuration portal
@@ -281,6 +516,66 @@ protected:
 	 */
 	bool sendBroadcastKey (Node* node);
 
+	/**
+	 * @brief Sends a multicast group key to a member node, or tells node to forget it
+	 * @param node Destination node
+	 * @param group Group index
+	 * @param member `true` to send group key. `false` to make node delete it
+	 * @return Returns `true` if message was successfully sent or queued. `false` otherwise
+	 */
+	bool sendGroupKey (Node* node, int8_t group, bool member);
+
+	/**
+	 * @brief Sets node as registered after a successful key agreement or session resumption, and notifies it to user code
+	 * @param node Entry in node list database of registered node
+	 */
+	void completeRegistration (Node* node);
+
+	/**
+	 * @brief Calculates the secret bound to a session resumption ticket. It is never stored on gateway
+	 * @param mac Address of node that ticket was issued to
+	 * @param ticket Session resumption ticket
+	 * @param secret Buffer to write `KEY_LENGTH` bytes of secret to
+	 */
+	void getResumptionSecret (const uint8_t mac[ENIGMAIOT_ADDR_LEN], const uint8_t* ticket, uint8_t* secret);
+
+#if ENABLE_MULTI_GATEWAY
+	/**
+	 * @brief Uses configured ticket key, so that tickets issued by any gateway of the network are accepted by the others.
+	 * If it has not been set, random key is kept and tickets are only valid on this gateway
+	 */
+	void setSharedTicketKey ();
+
+	/**
+	 * @brief Calculates gateway load from registered nodes and input queue usage and advertises it on WiFi beacons
+	 */
+	void updateLoad ();
+#endif // ENABLE_MULTI_GATEWAY
+
+	/**
+	 * @brief Issues a new session resumption ticket to node, together with its secret. It is sent encrypted with node key
+	 * @param node Entry in node list database to get destination address and cipher
+	 * @return Returns `true` if message was successfully sent. `false` otherwise
+	 */
+	bool sendSessionTicket (Node* node);
+
+	/**
+	 * @brief Gets a buffer containing a **ResumeRequest** message and process it. If ticket is valid a new node key is derived from resumption secret
+	 * @param mac Address where this message was received from
+	 * @param buf Pointer to the buffer that contains the message
+	 * @param count Message length in number of bytes of ResumeRequest message
+	 * @param node Node entry that ResumeRequest message comes from
+	 * @return Returns `true` if message could be correcly processed
+	 */
+	bool processResumeRequest (const uint8_t mac[ENIGMAIOT_ADDR_LEN], const uint8_t* buf, size_t count, Node* node);
+
+	/**
+	 * @brief Build a **ResumeResponse** message and send it to node
+	 * @param node Entry in node list database of node that is resuming its session
+	 * @return Returns `true` if ResumeResponse message was successfully sent. `false` otherwise
+	 */
+	bool resumeResponse (Node* node);
+
 	/**
 	 * @brief Gets a buffer containing a **ClientHello** message and process it. This carries node public key to be used on Diffie Hellman algorithm
 	 * @param mac Address where this message was received from
@@ -318,6 +613,76 @@ protected:
 	 */
 	bool invalidateKey (Node* node, gwInvalidateReason_t reason);
 
+	/**
+	 * @brief Checks if a new key agreement may be processed now, so that their rate keeps under `MAX_REGISTRATION_RATE`.
+	 * If it cannot, it reserves a later time slot for this node, so that deferred nodes retry one after another
+	 * @param retryAfter Time in ms that node has to wait before retrying. Only set if registration is not admitted
+	 * @return Returns `true` if key agreement may be processed
+	 */
+	bool admitRegistration (uint16_t& retryAfter);
+
+	/**
+	 * @brief Sends an **InvalidateKey** message with `REGISTRATION_BUSY` reason and time to retry. Node status is not changed
+	 * @param mac Address of node whose Client Hello was not processed
+	 * @param retryAfter Time in ms that node has to wait before next Client Hello
+	 * @return Returns `true` if message could be correcly sent
+	 */
+	bool registrationBusy (const uint8_t* mac, uint16_t retryAfter);
+
+	/**
+	 * @brief Sends all messages queued for a sleepy node, oldest first, after it sends a data message.
+	 * A **DownlinkEmpty** message follows them, unless node key has expired
+	 * @param node Node that has just sent a data message
+	 * @param counter Counter of data message that is being answered
+	 * @return Returns `true` if all messages could be sent
+	 */
+	bool sendQueuedDownlink (Node* node, uint16_t counter);
+
+	/**
+	 * @brief Sends a **DownlinkEmpty** message to a sleepy node, so that it does not need to wait for downlink data.
+	 * @param node Node to send message to
+	 * @param counter Counter of data message that is being answered
+	 * @return Returns `true` if message could be correcly sent
+	 */
+	bool downlinkEmpty (Node* node, uint16_t counter);
+
+	/**
+	 * @brief Decrypts and authenticates a message from a node. If message counters are used, counter epoch is bound to
+	 * authentication. Epoch expected by replay window is tried first and neighbour one after it, if it is possible
+	 * @param node Node that sent message
+	 * @param window Node replay window that message counter belongs to
+	 * @param data Encrypted data. It is decrypted in place
+	 * @param length Data length
+	 * @param iv Initialization vector
+	 * @param aad Additional authenticated data, without epoch
+	 * @param aadLen Additional authenticated data length
+	 * @param tag Authentication tag
+	 * @param epoch Filled with epoch that message was authenticated with
+	 * @return Returns `true` if message is authentic
+	 */
+	bool decryptNodeMessage (Node* node, ReplayWindow* window, uint8_t* data, size_t length, const uint8_t* iv,
+							 const uint8_t* aad, uint8_t aadLen, const uint8_t* tag, uint16_t* epoch);
+
+	/**
+	 * @brief Checks counter of a message from node against its replay window and records it
+	 * @param node Node that sent message
+	 * @param control `true` for control messages, `false` for data messages
+	 * @param counter Extended message counter
+	 * @param lostMessages Filled with number of data messages lost before this one. May be `NULL`
+	 * @return Check result. Message should only be processed if it is `REPLAY_NEW` or `REPLAY_LATE`
+	 */
+	replay_result_t checkNodeCounter (Node* node, bool control, uint32_t counter, size_t* lostMessages = NULL);
+
+#if ENABLE_LINK_ADAPTATION
+	/**
+	 * @brief Updates TX power recommended to a node with a new data message. Node gets an encrypted **TxPowerSet** command
+	 * when recommendation changes. It is queued for sleepy nodes
+	 * @param node Node that sent message
+	 * @param lostMessages Number of data messages lost before this one
+	 */
+	void updateLinkAdaptation (Node* node, uint32_t lostMessages);
+#endif // ENABLE_LINK_ADAPTATION
+
 	/**
 	 * @brief Processes data message from node
 	 * @param mac Node address
@@ -339,6 +704,94 @@ protected:
 	 */
 	bool processUnencryptedDataMessage (const uint8_t mac[ENIGMAIOT_ADDR_LEN], uint8_t* buf, size_t count, Node* node);
 
+	/**
+	 * @brief Unpacks a batched data payload and notifies every reading separately, with its own encoding and timestamp
+	 * @param mac Node address
+	 * @param data Batched payload
+	 * @param len Batched payload length
+	 * @param lostMessages Number of lost messages detected by counter. It is notified with first reading only
+	 * @param nodeName Node name. `NULL` if node has no name
+	 * @return Returns `true` if batch format was correct
+	 */
+	bool notifyBatchData (const uint8_t mac[ENIGMAIOT_ADDR_LEN], uint8_t* data, size_t len, uint16_t lostMessages, char* nodeName);
+
+	/**
+	 * @brief Processes compact schema payloads. Definitions are stored on node data. Data is expanded to a MsgPack map and notified.
+	 * If schema or key frame is not known node is asked to send them again
+	 * @param mac Node address
+	 * @param data Payload
+	 * @param len Payload length
+	 * @param lostMessages Number of lost messages detected by counter
+	 * @param encoding `SCHEMA_DEF` or `SCHEMA_DATA`
+	 * @param nodeName Node name. `NULL` if node has no name
+	 * @param timestamp Time when data was taken by node
+	 * @return `true` if payload was processed correctly
+	 */
+	bool processSchemaData (const uint8_t* mac, uint8_t* data, size_t len, uint16_t lostMessages, gatewayPayloadEncoding_t encoding, char* nodeName, int64_t timestamp);
+
+	/**
+	 * @brief Notifies data received from a node. In pipelined mode it is queued to output task, otherwise data callback is invoked directly
+	 * @param mac Node address
+	 * @param data Payload
+	 * @param len Payload length
+	 * @param lostMessages Number of lost messages detected by counter
+	 * @param control `true` if it is control data
+	 * @param encoding Payload encoding
+	 * @param nodeName Node name. `NULL` if node has no name
+	 * @param timestamp Time when data was taken by node, as given by `getDataTimestamp()`
+	 */
+	void outputData (const uint8_t* mac, uint8_t* data, size_t len, uint16_t lostMessages, bool control, gatewayPayloadEncoding_t encoding, char* nodeName, int64_t timestamp);
+
+	/**
+	 * @brief Notifies a new node registration or name change. In pipelined mode it is queued to output task
+	 * @param mac Node address
+	 * @param nodeId Node identifier
+	 * @param nodeName Node name. `NULL` if node has no name
+	 */
+	void outputNewNode (uint8_t* mac, uint16_t nodeId, char* nodeName);
+
+	/**
+	 * @brief Notifies a node disconnection. In pipelined mode it is queued to output task
+	 * @param mac Node address
+	 * @param reason Key invalidation reason
+	 */
+	void outputNodeDisconnection (uint8_t* mac, gwInvalidateReason_t reason);
+
+	/**
+	 * @brief Notifies a downlink message delivery result. In pipelined mode it is queued to output task
+	 * @param mac Node address
+	 * @param delivered `true` if message was delivered
+	 * @param latency Time until delivery in microseconds
+	 */
+	void outputDownlinkComplete (uint8_t* mac, bool delivered, uint32_t latency);
+
+#if ENABLE_GATEWAY_PIPELINE
+	/**
+	 * @brief Gets a free slot on output queue for a new notification. It has to be published with `outputQueue->commit()`
+	 * @param event Notification type
+	 * @param mac Node address
+	 * @return Slot with type and address already filled. `NULL` if output queue is full
+	 */
+	output_queue_item_t* reserveOutputEvent (outputEvent_t event, const uint8_t* mac);
+
+	/**
+	 * @brief Body of gateway task. Runs `handle()` and sleeps until a new message arrives
+	 * @param param Pointer to gateway instance
+	 */
+	static void gatewayTaskLoop (void* param);
+#endif // ENABLE_GATEWAY_PIPELINE
+
+	/**
+	 * @brief Sends user data longer than `MAX_DATA_PAYLOAD_SIZE` splitted in several downlink messages
+	 * @param node Destination node. It has to be non sleepy
+	 * @param data Payload
+	 * @param len Payload length. Maximum is `MAX_FRAGMENTED_PAYLOAD_SIZE`
+	 * @param controlData User data message type, `USERDATA_GET` or `USERDATA_SET`
+	 * @param encoding Payload encoding
+	 * @return Returns `true` if all fragments could be sent or queued
+	 */
+	bool downstreamFragmentedData (Node* node, const uint8_t* data, size_t len, control_message_type_t controlData, gatewayPayloadEncoding_t encoding);
+
 	/**
 	 * @brief Builds, encrypts and sends a **DownstreamData** message.
 	 * @param node Node that downstream data message is going to
@@ -346,9 +799,22 @@ protected:
 	 * @param len Length of payload data
 	 * @param controlData Content data type if control data
 	 * @param encoding Identifies data encoding of payload. It can be RAW, CAYENNELPP, MSGPACK
+	 * @param groupCopy `true` if it is the copy of a group message for a sleepy member
 	 * @return Returns `true` if message could be correcly sent or scheduled
 	 */
-	bool downstreamDataMessage (Node* node, const uint8_t* data, size_t len, control_message_type_t controlData, gatewayPayloadEncoding_t encoding = ENIGMAIOT);
+	bool downstreamDataMessage (Node* node, const uint8_t* data, size_t len, control_message_type_t controlData, gatewayPayloadEncoding_t encoding = ENIGMAIOT, bool groupCopy = false);
+
+	/**
+	 * @brief Builds, encrypts and sends a **DownstreamData** message to a multicast group. Message is encrypted once with group key
+	 * and sent as a single broadcast frame. It is also queued for every sleepy member, that would not get broadcast otherwise
+	 * @param group Group index
+	 * @param data Buffer to store payload to be sent
+	 * @param len Length of payload data
+	 * @param controlData Content data type if control data
+	 * @param encoding Identifies data encoding of payload. It can be RAW, CAYENNELPP, MSGPACK
+	 * @return Returns `true` if message could be correcly sent or scheduled
+	 */
+	bool downstreamGroupMessage (int8_t group, const uint8_t* data, size_t len, control_message_type_t controlData, gatewayPayloadEncoding_t encoding = ENIGMAIOT);
 
 	/**
 	* @brief Processes control message from node
@@ -404,6 +870,56 @@ protected:
 	 */
 	static void tx_cb (uint8_t* mac_addr, uint8_t status);
 
+	/**
+	  * @brief Function that will be called anytime a tagged message sending finishes. It queues result to be processed on `handle()`
+	  * @param tag Message tag
+	  * @param mac_addr Address of message destination
+	  * @param status Result of sending process
+	  * @param latency Time since message was sent in microseconds
+	  */
+	static void send_complete_cb (uint32_t tag, uint8_t* mac_addr, uint8_t status, uint32_t latency);
+
+	/**
+	  * @brief Sends a downlink message and keeps it to be resent if it is not delivered.
+	  * If too many messages are waiting for confirmation it waits up to `DOWNLINK_INFLIGHT_WAIT` ms for a free slot
+	  * @param node Destination node
+	  * @param data Encrypted message
+	  * @param len Message length
+	  * @return Returns `true` if message was sent
+	  */
+	bool sendDownlink (Node* node, const uint8_t* data, size_t len);
+
+	/**
+	  * @brief Processes sending status reports. Resends failed downlink messages and updates delivery statistics
+	  */
+	void processSendCompletions ();
+
+#if ENABLE_NODE_SNAPSHOT
+	/**
+	  * @brief Fills gateway data to be stored on node snapshot
+	  * @param gwState Buffer to store gateway data
+	  */
+	void getSnapshotState (gateway_snapshot_t* gwState);
+
+	/**
+	  * @brief Loads node sessions from snapshot and restores broadcast and session ticket keys it they were stored
+	  */
+	void restoreSnapshot ();
+
+	/**
+	  * @brief Saves nodes that changed since last call to node snapshot. Broadcast counter is saved every `NODE_SNAPSHOT_COUNTER_STEP` messages
+	  */
+	void updateSnapshot ();
+#endif // ENABLE_NODE_SNAPSHOT
+
+	/**
+	  * @brief Finishes a downlink message tracking, notifying result
+	  * @param entry Downlink message slot
+	  * @param delivered `true` if delivery was confirmed
+	  * @param latency Time since first sending attempt until confirmation, in microseconds
+	  */
+	void completeDownlink (downlink_inflight_t* entry, bool delivered, uint32_t latency);
+
 	/**
 	 * @brief Functrion to debug send status.
 	 * @param mac_addr Address of message sender
@@ -481,6 +997,16 @@ public:
 	*/
 	bool configWiFiManager ();
 
+#if ENABLE_MULTI_GATEWAY
+	/**
+	 * @brief Sets key shared by all gateways of the network to accept each other's session tickets. It has to be different
+	 * from network key, as every node knows that one. When network key is given to `begin()` it has to be called before it
+	 * @param key Ticket key password. Up to `KEY_LENGTH` characters
+	 * @return Returns `true` if key is valid
+	 */
+	bool setTicketKey (const char* key);
+#endif // ENABLE_MULTI_GATEWAY
+
 	/**
 	 * @brief Initalizes communication basic data and starts accepting node registration
 	 * @param comm Physical layer to be used on this network
@@ -495,6 +1021,60 @@ public:
 	 */
 	void handle ();
 
+	/**
+	 * @brief Starts pipelined mode. Only on ESP32 with `ENABLE_GATEWAY_PIPELINE` set. It has to be called after `begin()`.
+	 *
+	 * A task pinned to `GATEWAY_TASK_CORE` receives, decrypts and processes messages calling `handle()`, so it must not be called anymore.
+	 * Callbacks are not invoked from that task. Notifications are queued and calling task has to run them with `handleOutput()`,
+	 * usually from `loop()`, that runs on the other core. Publishing to a slow output does not delay message processing anymore.
+	 * If output queue gets full gateway keeps new messages on input queue until there is room again
+	 * @return Returns `true` if gateway task was started
+	 */
+	bool startPipeline ();
+
+	/**
+	 * @brief Invokes callbacks for notifications queued by gateway task. Call it periodically in pipelined mode, instead of `handle()`
+	 * @param maxEvents Maximum number of notifications processed. 0 means no limit
+	 * @return Number of notifications processed. Always 0 if pipelined mode is not started
+	 */
+	int handleOutput (int maxEvents = OUTPUT_QUEUE_SIZE);
+
+	/**
+	 * @brief Gets exclusive access to gateway. In pipelined mode, any gateway method called from a task other than gateway task,
+	 * for instance `sendDownstream()` inside an output callback, has to be called between `lock()` and `unlock()`.
+	 * It may be nested. It does nothing if pipelined mode is not started
+	 */
+	void lock ();
+
+	/**
+	 * @brief Releases access to gateway got with `lock()`
+	 */
+	void unlock ();
+
+	/**
+	 * @brief Gets number of times that gateway stopped processing input messages because output task was not keeping up
+	 * @return Number of stalls since pipelined mode start. Always 0 if it is not used
+	 */
+	uint32_t getOutputStalls () {
+#if ENABLE_GATEWAY_PIPELINE
+		return outputStalls;
+#else
+		return 0;
+#endif // ENABLE_GATEWAY_PIPELINE
+	}
+
+	/**
+	 * @brief Gets number of notifications lost because output queue was full
+	 * @return Number of lost notifications since pipelined mode start. Always 0 if it is not used
+	 */
+	uint32_t getOutputDrops () {
+#if ENABLE_GATEWAY_PIPELINE
+		return outputDrops;
+#else
+		return 0;
+#endif // ENABLE_GATEWAY_PIPELINE
+	}
+
 	/**
 	 * @brief Sets a LED to be flashed every time a message is transmitted
 	 * @param led LED I/O pin
@@ -515,7 +1095,7 @@ public:
 	 * Use example:
 	 * ``` C++
 	 * // First define the callback function
-	 * void processRxData (const uint8_t* mac, const uint8_t* buffer, uint8_t length, uint16_t lostMessages) {
+	 * void processRxData (const uint8_t* mac, const uint8_t* buffer, size_t length, uint16_t lostMessages) {
 	 *   // Do whatever you need with received data
 	 * }
 	 *
@@ -573,11 +1153,29 @@ public:
 	 * @param len Payload length
 	 * @param controlData Indicates if data is control data and its class
 	 * @param payload_type Identifies data encoding of payload. It can be RAW, CAYENNELPP, MSGPACK
-	 * @param nodeName Causes data to be sent to a node with this name instead of numeric address
+	 * @param nodeName Causes data to be sent to a node with this name instead of numeric address. If it starts with
+	 * `GROUP_ADDRESS_PREFIX` data is sent to the multicast group with that name
 	 * @return Returns true if everything went ok
 	 */
 	bool sendDownstream (uint8_t* mac, const uint8_t* data, size_t len, control_message_type_t controlData, gatewayPayloadEncoding_t payload_type = RAW, char* nodeName = NULL);
 
+	/**
+	 * @brief Adds a node to a multicast group and sends it group key. Group is created if it does not exist
+	 * @param mac Node address
+	 * @param group Group name
+	 * @return Returns `true` if node is member of group after this
+	 */
+	bool joinGroup (const uint8_t* mac, const char* group);
+
+	/**
+	 * @brief Removes a node from a multicast group. Group key is changed and sent again to remaining members,
+	 * so that node cannot decrypt group messages anymore. Group is deleted when it has no members left
+	 * @param mac Node address
+	 * @param group Group name
+	 * @return Returns `true` if node was member of group
+	 */
+	bool leaveGroup (const uint8_t* mac, const char* group);
+
 	/**
 	 * @brief Defines a function callback that will be called every time a node gets connected or reconnected
 	 *
@@ -643,6 +1241,15 @@ public:
 	void onGatewayRestartRequested (simpleEventHandler_t handler) {
 		notifyRestartRequested = handler;
 	}
+
+	/**
+	 * @brief Defines a function callback that will be called when a downlink message delivery finishes.
+	 * It gets node address, if message was delivered, and time until delivery in microseconds, including retries
+	 * @param handler Pointer to the function
+	 */
+	void onDownlinkComplete (onDownlinkComplete_t handler) {
+		notifyDownlinkComplete = handler;
+	}
     
    /**
 	 * @brief Add message to input queue
@@ -653,7 +1260,8 @@ public:
 	bool addInputMsgQueue (const uint8_t* addr, const uint8_t* msg, size_t len);
 
 	 /**
-	 * @brief Gets next item in the queue
+	 * @brief Gets next item in the queue, copies it to buffer and deletes it from queue
+	 * @param buffer Storage to copy message to
 	 * @return Next message to be processed
 	 */
 	msg_queue_item_t* getInputMsgQueue (msg_queue_item_t* buffer);
@@ -663,6 +1271,59 @@ public:
 	 */
 	void popInputMsgQueue ();
 
+	/**
+	 * @brief Gets number of input messages that have been discarded because input queue was full
+	 * @return Number of dropped messages since gateway start
+	 */
+	uint32_t getInputQueueDrops () {
+		return inputQueueDrops;
+	}
+
+	/**
+	 * @brief Gets number of registrations that have been deferred because of `MAX_REGISTRATION_RATE` limit
+	 * @return Number of Client Hello messages answered with a retry time since gateway start
+	 */
+	uint32_t getDeferredRegistrations () {
+		return deferredRegistrations;
+	}
+
+	/**
+	 * @brief Sets limits for input queue processing on every `handle()` call
+	 * @param maxMessages Maximum number of messages to process. 0 means no limit
+	 * @param maxTime Maximum processing time in milliseconds. 0 means no limit
+	 */
+	void setInputQueueDrainBudget (int maxMessages, uint32_t maxTime) {
+		drainMaxMessages = maxMessages;
+		drainMaxTime = maxTime;
+	}
+
+	/**
+	 * @brief Gets number of downlink messages that have been resent because ESP-NOW layer reported them as not delivered
+	 * @return Number of retries since gateway start
+	 */
+	uint32_t getDownlinkRetries () {
+		return downlinkRetries;
+	}
+
+	/**
+	 * @brief Gets time when data being notified was taken by node. It is only valid during data callback.
+	 *
+	 * Readings that node sent in a batch get the time they were stored on node, not the reception time.
+	 * If gateway is synchronized to NTP server it is real world time
+	 * @return Milliseconds since epoch
+	 */
+	int64_t getDataTimestamp () {
+		return dataTimestamp;
+	}
+
+	/**
+	 * @brief Gets number of downlink messages that could not be delivered after all retries
+	 * @return Number of failed downlink messages since gateway start
+	 */
+	uint32_t getDownlinkFailures () {
+		return downlinkFailures;
+	}
+
 	/**
 	 * @brief Gets number of active nodes
 	 * @return Number of registered nodes
@@ -671,6 +1332,16 @@ public:
 		return nodelist.countActiveNodes ();
 	}
 
+#if ENABLE_MULTI_GATEWAY
+	/**
+	 * @brief Removes session of a node that has registered on other gateway of the same network. Node is not notified and
+	 * disconnection callback is not called, as node is still connected to network
+	 * @param mac Node address
+	 * @return Returns `true` if node was registered on this gateway
+	 */
+	bool releaseNode (const uint8_t* mac);
+#endif // ENABLE_MULTI_GATEWAY
+
 	/**
 	 * @brief Gets nodes data structure
 	 * @return All nodes data structure
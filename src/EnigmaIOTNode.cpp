@@ -12,6 +12,9 @@
 #include <Arduino.h>
 #include "EnigmaIOTNode.h"
 #include "timeManager.h"
+#include "cryptoBackend.h"
+#include "gatewayLoad.h"
+#include "linkAdaptation.h"
 #include <FS.h>
 #include <MD5Builder.h>
 #ifdef ESP8266
@@ -25,6 +28,7 @@
 #include <regex>
 
 const char CONFIG_FILE[] = "/config.json";
+const char GROUP_KEYS_FILE[] = "/groupkeys.bin";
 
 int localLed = -1;
 
@@ -46,6 +50,7 @@ void EnigmaIOTNodeClass::resetConfig () {
 	sendRestart ();
     FILESYSTEM.begin ();
     FILESYSTEM.remove (CONFIG_FILE);
+    FILESYSTEM.remove (GROUP_KEYS_FILE);
     FILESYSTEM.end ();
 	DEBUG_WARN ("Config file %s deleted. Restarting");
 
@@ -61,7 +66,7 @@ void EnigmaIOTNodeClass::sendRestart () {
 	buffer[1] = restartReason;
 
 	DEBUG_WARN ("Message Len %d\n", len);
-	DEBUG_WARN ("Trying to send: %s\n", printHexBuffer (buffer, len));
+	DEBUG_WARN ("Trying to send: %s\n", DEBUG_HEX (buffer, len));
 	if (!EnigmaIOTNode.sendData (buffer, len, true)) {
 		DEBUG_WARN ("Error sending restart");
 	} else {
@@ -98,6 +103,8 @@ void EnigmaIOTNodeClass::setResetPin (int pin) {
 void clearRtcData (rtcmem_data_t* data) {
 	memset (data->nodeKey, 0, KEY_LENGTH);
 	data->lastMessageCounter = 0;
+	data->messageCounterEpoch = 0;
+	data->controlCounterEpoch = 0;
 	data->nodeId = 0;
 	data->channel = 3;
 	memset (data->gateway, 0, 6);
@@ -105,8 +112,13 @@ void clearRtcData (rtcmem_data_t* data) {
 	data->nodeRegisterStatus = UNREGISTERED;
 	data->sleepy = false;
 	data->nodeKeyValid = false;
+	data->cipherAlgorithm = CHACHAPOLY_CIPHER;
 	data->broadcastKeyRequested = false;
 	data->broadcastKeyValid = false;
+	data->sessionTicketValid = false;
+	data->clockDrift = 0;
+	data->txPowerReduction = 0;
+	data->gatewayChannels = 0;
 	DEBUG_DBG ("RTC Cleared");
 }
 
@@ -121,6 +133,8 @@ void dumpRtcData (rtcmem_data_t* data, uint8_t* gateway = NULL) {
 		Serial.printf (" -- Last message counter: %d\n", data->lastMessageCounter);
 		Serial.printf (" -- Last control counter: %d\n", data->lastControlCounter);
 		Serial.printf (" -- Last downlink counter: %d\n", data->lastDownlinkMsgCounter);
+		Serial.printf (" -- Batched data length: %u\n", data->batchLength);
+		Serial.printf (" -- Session ticket is %svalid\n", data->sessionTicketValid ? "" : "NOT ");
 		Serial.printf (" -- NodeID: %d\n", data->nodeId);
 		Serial.printf (" -- Channel: %d\n", data->channel);
 		Serial.printf (" -- RSSI: %d\n", data->rssi);
@@ -143,6 +157,94 @@ void dumpRtcData (rtcmem_data_t* data, uint8_t* gateway = NULL) {
 
 #if USE_FLASH_INSTEAD_RTC
 const char* RTC_DATA_FILE = "/context.bin";
+const char* RTC_JOURNAL_FILE = "/context.log";
+const char* RTC_TMP_FILE = "/context.tmp";
+const size_t RTC_JOURNAL_RECORD_OVERHEAD = sizeof (uint16_t) + sizeof (uint8_t) + sizeof (uint32_t); ///< @brief Offset, length and CRC of every journal record
+
+bool EnigmaIOTNodeClass::readRTCDataFile (const char* fileName, rtcmem_data_t* context) {
+	DEBUG_DBG ("Opening %s file", fileName);
+	File contextFile = FILESYSTEM.open (fileName, "r");
+	if (!contextFile) {
+		DEBUG_WARN ("Error opening file %s", fileName);
+		FILESYSTEM.remove (fileName);
+		return false;
+	}
+	DEBUG_DBG ("%s opened", fileName);
+	size_t size = contextFile.size ();
+	if (size != sizeof (rtcmem_data_t)) {
+		DEBUG_WARN ("File size error. Expected %d bytes. Got %d", sizeof (rtcmem_data_t), size);
+		contextFile.close ();
+		FILESYSTEM.remove (fileName);
+		return false;
+	}
+	size = contextFile.readBytes ((char*)context, sizeof (rtcmem_data_t));
+	contextFile.close ();
+	if (size != sizeof (rtcmem_data_t)) {
+		DEBUG_WARN ("File read error. Expected %d bytes. Got %d", sizeof (rtcmem_data_t), size);
+		FILESYSTEM.remove (fileName);
+		return false;
+	}
+	if (!checkCRC ((uint8_t*)context->nodeKey, sizeof (rtcmem_data_t) - sizeof (uint32_t), &context->crc32)) {
+		DEBUG_WARN ("RTC Data is not valid. Wrong CRC");
+		FILESYSTEM.remove (fileName);
+		return false;
+	}
+	return true;
+}
+
+bool EnigmaIOTNodeClass::applyRTCDataJournal (rtcmem_data_t* context) {
+	uint8_t record[RTC_JOURNAL_RECORD_OVERHEAD + CONTEXT_JOURNAL_MAX_DELTA];
+	uint16_t offset;
+	uint8_t len;
+	uint32_t crc;
+	int applied = 0;
+	bool complete = true;
+
+	contextJournalSize = 0;
+	if (!FILESYSTEM.exists (RTC_JOURNAL_FILE)) {
+		return true;
+	}
+	File journal = FILESYSTEM.open (RTC_JOURNAL_FILE, "r");
+	if (!journal) {
+		DEBUG_WARN ("Error opening file %s", RTC_JOURNAL_FILE);
+		return false;
+	}
+
+	// Records are applied in order until end of file or first damaged record, that may be left by a power loss while appending
+	while (journal.available ()) {
+		if (journal.readBytes ((char*)record, sizeof (uint16_t) + sizeof (uint8_t)) != sizeof (uint16_t) + sizeof (uint8_t)) {
+			complete = false;
+			break;
+		}
+		memcpy (&offset, record, sizeof (uint16_t));
+		len = record[sizeof (uint16_t)];
+		if (!len || len > CONTEXT_JOURNAL_MAX_DELTA || offset < sizeof (uint32_t) || offset + len > sizeof (rtcmem_data_t)) {
+			complete = false;
+			break;
+		}
+		size_t recordLen = RTC_JOURNAL_RECORD_OVERHEAD + len;
+		if (journal.readBytes ((char*)record + sizeof (uint16_t) + sizeof (uint8_t), len + sizeof (uint32_t)) != len + sizeof (uint32_t)) {
+			complete = false;
+			break;
+		}
+		memcpy (&crc, record + recordLen - sizeof (uint32_t), sizeof (uint32_t));
+		if (!checkCRC (record, recordLen - sizeof (uint32_t), &crc)) {
+			complete = false;
+			break;
+		}
+		memcpy ((uint8_t*)context + offset, record + sizeof (uint16_t) + sizeof (uint8_t), len);
+		contextJournalSize += recordLen;
+		applied++;
+	}
+	journal.close ();
+
+	DEBUG_DBG ("%d context changes applied from %s", applied, RTC_JOURNAL_FILE);
+	if (!complete) {
+		DEBUG_WARN ("Context journal is damaged after %u bytes", contextJournalSize);
+	}
+	return complete;
+}
+
 bool EnigmaIOTNodeClass::loadRTCData () {
     //FILESYSTEM.remove (RTC_DATA_FILE); // Only for testing
 	//bool file_correct = false;
@@ -151,67 +253,65 @@ bool EnigmaIOTNodeClass::loadRTCData () {
 
 	rtcmem_data_t context;
 
-    if (FILESYSTEM.exists (RTC_DATA_FILE)) {
-		DEBUG_DBG ("Opening %s file", RTC_DATA_FILE);
-        File contextFile = FILESYSTEM.open (RTC_DATA_FILE, "r");
-		if (contextFile) {
-			DEBUG_DBG ("%s opened", RTC_DATA_FILE);
-			size_t size = contextFile.size ();
-			if (size != sizeof (rtcmem_data_t)) {
-				DEBUG_WARN ("File size error. Expected %d bytes. Got %d", sizeof (rtcmem_data_t), size);
-				contextFile.close ();
-                FILESYSTEM.remove (RTC_DATA_FILE);
-				return false;
-			}
-			size = contextFile.readBytes ((char*)&context, sizeof (rtcmem_data_t));
-			contextFile.close ();
-			if (size != sizeof (rtcmem_data_t)) {
-				DEBUG_WARN ("File read error. Expected %d bytes. Got %d", sizeof (rtcmem_data_t), size);
-				//contextFile.close ();
-                FILESYSTEM.remove (RTC_DATA_FILE);
-				return false;
-			}
-			if (!checkCRC ((uint8_t*)context.nodeKey, sizeof (rtcmem_data_t) - sizeof (uint32_t), &context.crc32)) {
-				DEBUG_WARN ("RTC Data is not valid. Wrong CRC");
-				//contextFile.close ();
-                FILESYSTEM.remove (RTC_DATA_FILE);
-				return false;
-			} else {
-				memcpy (&rtcmem_data, &context, sizeof (rtcmem_data_t));
-				node.setEncryptionKey (rtcmem_data.nodeKey);
-				node.setKeyValid (rtcmem_data.nodeKeyValid);
-				if (rtcmem_data.nodeKeyValid)
-					node.setKeyValidFrom (millis ());
-				node.setLastMessageCounter (rtcmem_data.lastMessageCounter);
-				node.setLastControlCounter (rtcmem_data.lastControlCounter);
-				node.setLastDownlinkMsgCounter (rtcmem_data.lastDownlinkMsgCounter);
-				node.setLastMessageTime ();
-				node.setNodeId (rtcmem_data.nodeId);
-				// setChannel (rtcmem_data.channel);
-				//channel = rtcmem_data.channel;
-				//memcpy (gateway, rtcmem_data.gateway, comm->getAddressLength ()); // setGateway
-				//memcpy (networkKey, rtcmem_data.networkKey, KEY_LENGTH);
-				node.setSleepy (rtcmem_data.sleepy);
-				node.setNodeName (rtcmem_data.nodeName);
-				// set default sleep time if it was not set
-				if (rtcmem_data.sleepy && rtcmem_data.sleepTime == 0) {
-					rtcmem_data.sleepTime = DEFAULT_SLEEP_TIME;
-				}
-				node.setStatus (rtcmem_data.nodeRegisterStatus);
-				DEBUG_DBG ("Set %s mode", node.getSleepy () ? "sleepy" : "non sleepy");
-#if DEBUG_LEVEL >= VERBOSE
-				dumpRtcData (&rtcmem_data);
-#endif
-			}
-		} else {
-			DEBUG_WARN ("Error opening file %s", RTC_DATA_FILE);
-            FILESYSTEM.remove (RTC_DATA_FILE);
-			return false;
+	savedRtcDataValid = false;
+	contextJournalSize = 0;
+
+	// A valid temporary file means that power was lost during a compaction, before it replaced context file. It has latest data
+	if (FILESYSTEM.exists (RTC_TMP_FILE)) {
+		if (readRTCDataFile (RTC_TMP_FILE, &context)) {
+			DEBUG_WARN ("Recovering context from %s", RTC_TMP_FILE);
+			FILESYSTEM.remove (RTC_JOURNAL_FILE);
+			FILESYSTEM.remove (RTC_DATA_FILE);
+			FILESYSTEM.rename (RTC_TMP_FILE, RTC_DATA_FILE);
 		}
-	} else {
+	}
+
+	if (!FILESYSTEM.exists (RTC_DATA_FILE)) {
 		DEBUG_WARN ("%s do not exist", RTC_DATA_FILE);
+		FILESYSTEM.remove (RTC_JOURNAL_FILE);
+		return false;
+	}
+	if (!readRTCDataFile (RTC_DATA_FILE, &context)) {
+		FILESYSTEM.remove (RTC_JOURNAL_FILE);
 		return false;
 	}
+	bool journalComplete = applyRTCDataJournal (&context);
+	context.crc32 = calculateCRC32 ((uint8_t*)context.nodeKey, sizeof (rtcmem_data_t) - sizeof (uint32_t));
+
+	memcpy (&rtcmem_data, &context, sizeof (rtcmem_data_t));
+	memcpy (&savedRtcData, &context, sizeof (rtcmem_data_t));
+	savedRtcDataValid = true;
+	if (!journalComplete) {
+		// Rewrite context so that new records are not appended after damaged one
+		writeRTCDataFile ();
+	}
+
+	node.setEncryptionKey (rtcmem_data.nodeKey);
+	node.setCipherAlgorithm (rtcmem_data.cipherAlgorithm);
+	node.setKeyValid (rtcmem_data.nodeKeyValid);
+	if (rtcmem_data.nodeKeyValid)
+		node.setKeyValidFrom (millis ());
+	node.setLastMessageCounter (rtcmem_data.lastMessageCounter);
+	node.setLastControlCounter (rtcmem_data.lastControlCounter);
+	node.setLastDownlinkMsgCounter (rtcmem_data.lastDownlinkMsgCounter);
+	node.setLastMessageTime ();
+	node.setNodeId (rtcmem_data.nodeId);
+	// setChannel (rtcmem_data.channel);
+	//channel = rtcmem_data.channel;
+	//memcpy (gateway, rtcmem_data.gateway, comm->getAddressLength ()); // setGateway
+	//memcpy (networkKey, rtcmem_data.networkKey, KEY_LENGTH);
+	node.setSleepy (rtcmem_data.sleepy);
+	node.setNodeName (rtcmem_data.nodeName);
+	// set default sleep time if it was not set
+	if (rtcmem_data.sleepy && rtcmem_data.sleepTime == 0) {
+		rtcmem_data.sleepTime = DEFAULT_SLEEP_TIME;
+	}
+	node.setStatus (rtcmem_data.nodeRegisterStatus);
+	TimeManager.setDrift (rtcmem_data.clockDrift);
+	DEBUG_DBG ("Set %s mode", node.getSleepy () ? "sleepy" : "non sleepy");
+#if DEBUG_LEVEL >= VERBOSE
+	dumpRtcData (&rtcmem_data);
+#endif
 
 	DEBUG_DBG ("Load process finished in %d ms", millis () - start_load);
 
@@ -221,7 +321,7 @@ bool EnigmaIOTNodeClass::loadRTCData () {
 bool EnigmaIOTNodeClass::loadRTCData () {
 #ifdef ESP8266
 	if (ESP.rtcUserMemoryRead (RTC_ADDRESS, (uint32_t*)&rtcmem_data, sizeof (rtcmem_data))) {
-		DEBUG_VERBOSE ("Read RTCData: %s", printHexBuffer ((uint8_t*)&rtcmem_data, sizeof (rtcmem_data)));
+		DEBUG_VERBOSE ("Read RTCData: %s", DEBUG_HEX ((uint8_t*)&rtcmem_data, sizeof (rtcmem_data)));
 	} else {
 		DEBUG_ERROR ("Error reading RTC memory");
 		clearRtcData (&rtcmem_data);
@@ -229,7 +329,7 @@ bool EnigmaIOTNodeClass::loadRTCData () {
 	}
 #elif defined ESP32
 	memcpy ((uint8_t*)&rtcmem_data, (uint8_t*)&rtcmem_data_storage, sizeof (rtcmem_data));
-	DEBUG_VERBOSE ("----- Read RTCData: %s", printHexBuffer ((uint8_t*)&rtcmem_data, sizeof (rtcmem_data)));
+	DEBUG_VERBOSE ("----- Read RTCData: %s", DEBUG_HEX ((uint8_t*)&rtcmem_data, sizeof (rtcmem_data)));
 #endif
 	if (!checkCRC ((uint8_t*)rtcmem_data.nodeKey, sizeof (rtcmem_data) - sizeof (uint32_t), &rtcmem_data.crc32)) {
 		DEBUG_DBG ("RTC Data is not valid");
@@ -237,6 +337,7 @@ bool EnigmaIOTNodeClass::loadRTCData () {
 		return false;
 	} else {
 		node.setEncryptionKey (rtcmem_data.nodeKey);
+		node.setCipherAlgorithm (rtcmem_data.cipherAlgorithm);
 		node.setKeyValid (rtcmem_data.nodeKeyValid);
 		if (rtcmem_data.nodeKeyValid)
 			node.setKeyValidFrom (millis ());
@@ -256,6 +357,7 @@ bool EnigmaIOTNodeClass::loadRTCData () {
 			rtcmem_data.sleepTime = DEFAULT_SLEEP_TIME;
 		}
 		node.setStatus (rtcmem_data.nodeRegisterStatus);
+		TimeManager.setDrift (rtcmem_data.clockDrift);
 		DEBUG_DBG ("Set %s mode", node.getSleepy () ? "sleepy" : "non sleepy");
 #if DEBUG_LEVEL >= VERBOSE
 		dumpRtcData (&rtcmem_data);
@@ -278,7 +380,7 @@ bool EnigmaIOTNodeClass::loadFlashData () {
 			DEBUG_DBG ("%s opened", CONFIG_FILE);
 			//size_t size = configFile.size ();
 
-			const size_t capacity = JSON_ARRAY_SIZE (32) + JSON_OBJECT_SIZE (7) + 110;
+			const size_t capacity = JSON_ARRAY_SIZE (32) + JSON_ARRAY_SIZE (SESSION_TICKET_LENGTH) + JSON_ARRAY_SIZE (KEY_LENGTH) + JSON_OBJECT_SIZE (9) + 110;
 			bool json_error = false;
 #if ARDUINOJSON_VERSION_MAJOR == 6
 			DynamicJsonDocument doc (capacity);
@@ -324,7 +426,7 @@ bool EnigmaIOTNodeClass::loadFlashData () {
 			for (int i = 0; i < KEY_LENGTH; i++) {
 				rtcmem_data.networkKey[i] = netKeyJson[i].as<int> ();
 			}
-			DEBUG_DBG ("Network Key dump: %s", printHexBuffer (rtcmem_data.networkKey, KEY_LENGTH));
+			DEBUG_DBG ("Network Key dump: %s", DEBUG_HEX (rtcmem_data.networkKey, KEY_LENGTH));
 			strncpy ((char*)rtcmem_data.nodeName, doc["nodeName"] | "", NODE_NAME_LENGTH);
 			node.setNodeName (rtcmem_data.nodeName);
 
@@ -336,6 +438,19 @@ bool EnigmaIOTNodeClass::loadFlashData () {
 				memcpy (rtcmem_data.gateway, gwAddr, 6);
 			}
 
+			JsonArray ticketJson = doc["sessionTicket"];
+			JsonArray secretJson = doc["resumptionSecret"];
+			if (ticketJson.size () == SESSION_TICKET_LENGTH && secretJson.size () == KEY_LENGTH) {
+				for (int i = 0; i < SESSION_TICKET_LENGTH; i++) {
+					rtcmem_data.sessionTicket[i] = ticketJson[i].as<int> ();
+				}
+				for (int i = 0; i < KEY_LENGTH; i++) {
+					rtcmem_data.resumptionSecret[i] = secretJson[i].as<int> ();
+				}
+				rtcmem_data.sessionTicketValid = true;
+				DEBUG_DBG ("Session ticket loaded");
+			}
+
 			if (json_correct) {
 				DEBUG_VERBOSE ("Configuration successfuly read");
 			}
@@ -345,7 +460,7 @@ bool EnigmaIOTNodeClass::loadFlashData () {
 			DEBUG_DBG ("Sleep time: %u", rtcmem_data.sleepTime);
 			DEBUG_DBG ("Node name: %s", rtcmem_data.nodeName);
 			DEBUG_DBG ("Gateway: %s", gwAddrStr);
-			DEBUG_VERBOSE ("Network key: %s", printHexBuffer (rtcmem_data.networkKey, KEY_LENGTH));
+			DEBUG_VERBOSE ("Network key: %s", DEBUG_HEX (rtcmem_data.networkKey, KEY_LENGTH));
 
 			String output;
 			serializeJsonPretty (doc, output);
@@ -372,7 +487,7 @@ bool EnigmaIOTNodeClass::saveFlashData (bool fsOpen) {
 		return false;
 	}
 
-	const size_t capacity = JSON_ARRAY_SIZE (32) + JSON_OBJECT_SIZE (7) + 110;
+	const size_t capacity = JSON_ARRAY_SIZE (32) + JSON_ARRAY_SIZE (SESSION_TICKET_LENGTH) + JSON_ARRAY_SIZE (KEY_LENGTH) + JSON_OBJECT_SIZE (9) + 110;
 	DynamicJsonDocument doc (capacity);
 
 	char gwAddrStr[ENIGMAIOT_ADDR_LEN * 3];
@@ -387,6 +502,16 @@ bool EnigmaIOTNodeClass::saveFlashData (bool fsOpen) {
 	doc["sleepTime"] = rtcmem_data.sleepTime;
 	doc["gateway"] = gwAddrStr;
 	doc["nodeName"] = rtcmem_data.nodeName;
+	if (rtcmem_data.sessionTicketValid) {
+		JsonArray ticketJson = doc.createNestedArray ("sessionTicket");
+		for (int i = 0; i < SESSION_TICKET_LENGTH; i++) {
+			ticketJson.add (rtcmem_data.sessionTicket[i]);
+		}
+		JsonArray secretJson = doc.createNestedArray ("resumptionSecret");
+		for (int i = 0; i < KEY_LENGTH; i++) {
+			secretJson.add (rtcmem_data.resumptionSecret[i]);
+		}
+	}
 
 	if (serializeJson (doc, configFile) == 0) {
 		DEBUG_ERROR ("Failed to write to file");
@@ -414,28 +539,105 @@ bool EnigmaIOTNodeClass::saveFlashData (bool fsOpen) {
 }
 
 #if USE_FLASH_INSTEAD_RTC
-bool EnigmaIOTNodeClass::saveRTCData () {
-	time_t start_save = millis ();
-	if (configCleared)
-		return false;
+bool EnigmaIOTNodeClass::writeRTCDataFile () {
 	rtcmem_data.crc32 = calculateCRC32 ((uint8_t*)rtcmem_data.nodeKey, sizeof (rtcmem_data) - sizeof (uint32_t));
-    File contextFile = FILESYSTEM.open (RTC_DATA_FILE, "w");
+	// Context is written to a temporary file first, so a power loss never leaves node without a valid context
+	File contextFile = FILESYSTEM.open (RTC_TMP_FILE, "w");
 	if (!contextFile) {
-		DEBUG_WARN ("failed to open config file %s for writing", RTC_DATA_FILE);
+		DEBUG_WARN ("failed to open config file %s for writing", RTC_TMP_FILE);
 		return false;
 	}
-	contextFile.write ((uint8_t*)&rtcmem_data, sizeof (rtcmem_data));
+	size_t size = contextFile.write ((uint8_t*)&rtcmem_data, sizeof (rtcmem_data));
 	contextFile.flush ();
-	size_t size = contextFile.size ();
 	contextFile.close ();
+	if (size != sizeof (rtcmem_data)) {
+		DEBUG_WARN ("Error writing %s. %u bytes written", RTC_TMP_FILE, size);
+		FILESYSTEM.remove (RTC_TMP_FILE);
+		return false;
+	}
+	savedRtcDataValid = false;
+	FILESYSTEM.remove (RTC_JOURNAL_FILE);
+	FILESYSTEM.remove (RTC_DATA_FILE);
+	if (!FILESYSTEM.rename (RTC_TMP_FILE, RTC_DATA_FILE)) {
+		DEBUG_WARN ("Error renaming %s to %s", RTC_TMP_FILE, RTC_DATA_FILE);
+		return false;
+	}
+	memcpy (&savedRtcData, &rtcmem_data, sizeof (rtcmem_data));
+	savedRtcDataValid = true;
+	contextJournalSize = 0;
 	DEBUG_DBG ("Write configuration data to file %s in flash. %u bytes", RTC_DATA_FILE, size);
-	DEBUG_VERBOSE ("Write RTCData: %s", printHexBuffer ((uint8_t*)&rtcmem_data, sizeof (rtcmem_data)));
+	return true;
+}
+
+bool EnigmaIOTNodeClass::appendRTCDataJournal (uint16_t offset, uint8_t len) {
+	uint8_t record[RTC_JOURNAL_RECORD_OVERHEAD + CONTEXT_JOURNAL_MAX_DELTA];
+	size_t recordLen = RTC_JOURNAL_RECORD_OVERHEAD + len;
+
+	memcpy (record, &offset, sizeof (uint16_t));
+	record[sizeof (uint16_t)] = len;
+	memcpy (record + sizeof (uint16_t) + sizeof (uint8_t), (uint8_t*)&rtcmem_data + offset, len);
+	uint32_t crc = calculateCRC32 (record, recordLen - sizeof (uint32_t));
+	memcpy (record + recordLen - sizeof (uint32_t), &crc, sizeof (uint32_t));
+
+	File journal = FILESYSTEM.open (RTC_JOURNAL_FILE, "a");
+	if (!journal) {
+		DEBUG_WARN ("failed to open %s for writing", RTC_JOURNAL_FILE);
+		return false;
+	}
+	size_t size = journal.write (record, recordLen);
+	journal.flush ();
+	journal.close ();
+	if (size != recordLen) {
+		DEBUG_WARN ("Error writing %s. %u bytes written", RTC_JOURNAL_FILE, size);
+		return false;
+	}
+	memcpy ((uint8_t*)&savedRtcData + offset, (uint8_t*)&rtcmem_data + offset, len);
+	contextJournalSize += recordLen;
+	DEBUG_DBG ("Context change of %u bytes at %u appended to %s. Journal is %u bytes", len, offset, RTC_JOURNAL_FILE, contextJournalSize);
+	return true;
+}
+
+bool EnigmaIOTNodeClass::saveRTCData () {
+	time_t start_save = millis ();
+	bool result = true;
+
+	if (configCleared)
+		return false;
+	rtcmem_data.crc32 = calculateCRC32 ((uint8_t*)rtcmem_data.nodeKey, sizeof (rtcmem_data) - sizeof (uint32_t));
+
+	if (!savedRtcDataValid) {
+		result = writeRTCDataFile ();
+	} else {
+		// Look for changed bytes. CRC is not compared as it is calculated again when context is loaded
+		const uint8_t* current = (uint8_t*)&rtcmem_data;
+		const uint8_t* saved = (uint8_t*)&savedRtcData;
+		size_t first = sizeof (uint32_t);
+		size_t last = sizeof (rtcmem_data_t);
+		while (first < last && current[first] == saved[first]) {
+			first++;
+		}
+		if (first == last) {
+			DEBUG_DBG ("Context did not change. Nothing written");
+			return true;
+		}
+		while (current[last - 1] == saved[last - 1]) {
+			last--;
+		}
+		size_t len = last - first;
+		// Small changes are appended to journal. Otherwise, or when journal is full, context file is written again
+		if (len > CONTEXT_JOURNAL_MAX_DELTA
+			|| contextJournalSize + RTC_JOURNAL_RECORD_OVERHEAD + len > CONTEXT_JOURNAL_MAX_SIZE
+			|| !appendRTCDataJournal (first, len)) {
+			result = writeRTCDataFile ();
+		}
+	}
+	DEBUG_VERBOSE ("Write RTCData: %s", DEBUG_HEX ((uint8_t*)&rtcmem_data, sizeof (rtcmem_data)));
 #if DEBUG_LEVEL >= VERBOSE
 	dumpRtcData (&rtcmem_data);
 #endif
 	DEBUG_DBG ("Save process finished in %d ms", millis () - start_save);
 
-	return true;
+	return result;
 }
 
 #else
@@ -452,7 +654,7 @@ bool EnigmaIOTNodeClass::saveRTCData () {
 	if (ESP.rtcUserMemoryWrite (RTC_ADDRESS, (uint32_t*)&rtcmem_data, sizeof (rtcmem_data))) {
 		DEBUG_DBG ("Write configuration data to RTC memory");
 #if DEBUG_LEVEL >= VERBOSE
-		DEBUG_VERBOSE ("Write RTCData: %s", printHexBuffer ((uint8_t*)&rtcmem_data, sizeof (rtcmem_data)));
+		DEBUG_VERBOSE ("Write RTCData: %s", DEBUG_HEX ((uint8_t*)&rtcmem_data, sizeof (rtcmem_data)));
 		dumpRtcData (&rtcmem_data);
 #endif
 		return true;
@@ -461,7 +663,7 @@ bool EnigmaIOTNodeClass::saveRTCData () {
 	rtcmem_data.crc32 = calculateCRC32 ((uint8_t*)rtcmem_data.nodeKey, sizeof (rtcmem_data) - sizeof (uint32_t));
 	memcpy ((uint8_t*)&rtcmem_data_storage, (uint8_t*)&rtcmem_data, sizeof (rtcmem_data));
 	rtcmem_data_storage.crc32 = calculateCRC32 ((uint8_t*)rtcmem_data_storage.nodeKey, sizeof (rtcmem_data) - sizeof (uint32_t));
-	DEBUG_VERBOSE ("Write RTCData: %s", printHexBuffer ((uint8_t*)&rtcmem_data, sizeof (rtcmem_data)));
+	DEBUG_VERBOSE ("Write RTCData: %s", DEBUG_HEX ((uint8_t*)&rtcmem_data, sizeof (rtcmem_data)));
 #if DEBUG_LEVEL >= VERBOSE
 	dumpRtcData (&rtcmem_data);
 #endif
@@ -555,12 +757,14 @@ bool EnigmaIOTNodeClass::configWiFiManager (rtcmem_data_t* data) {
 		DEBUG_DBG ("Node Name: %s", nodeNameParam.getValue ());
 
 		data->lastMessageCounter = 0;
+		data->messageCounterEpoch = 0;
+		data->controlCounterEpoch = 0;
 
 		strncpy ((char*)(data->networkKey), netkey, KEY_LENGTH);
 		DEBUG_DBG ("Stored network key before hash: %.*s", KEY_LENGTH, (char*)(data->networkKey));
 
 		CryptModule::getSHA256 (data->networkKey, KEY_LENGTH);
-		DEBUG_DBG ("Calculated network key: %s", printHexBuffer (data->networkKey, KEY_LENGTH));
+		DEBUG_DBG ("Calculated network key: %s", DEBUG_HEX (data->networkKey, KEY_LENGTH));
 		data->nodeRegisterStatus = UNREGISTERED;
 
 		//const char* netName = WiFi.SSID ().c_str ();
@@ -723,12 +927,38 @@ void EnigmaIOTNodeClass::begin (Comms_halClass* comm, uint8_t* gateway, uint8_t*
 	node.setSleepy (sleepy);
 	DEBUG_DBG ("Set %s mode: %s", node.getSleepy () ? "sleepy" : "non sleepy", sleepy ? "sleepy" : "non sleepy");
 
-	if (loadRTCData () && rtcmem_data.commErrors < COMM_ERRORS_BEFORE_SCAN) { // If data present on RTC node has waked up or it is just configured, continue
+	bool rtcDataLoaded = loadRTCData ();
+
+#if ENABLE_FAST_GATEWAY_DISCOVERY
+	if (rtcDataLoaded && rtcmem_data.commErrors >= COMM_ERRORS_BEFORE_SCAN) {
+		// Gateway may be back on a known channel. If it answers session goes on without a full scan and registration
+		startComms ();
+		if (probeGateway (&rtcmem_data)) {
+			rtcmem_data.commErrors = 0;
+		} else {
+			stop ();
+		}
+	}
+#endif // ENABLE_FAST_GATEWAY_DISCOVERY
+
+	if (rtcDataLoaded && rtcmem_data.commErrors < COMM_ERRORS_BEFORE_SCAN) { // If data present on RTC node has waked up or it is just configured, continue
 #if DEBUG_LEVEL >= DBG
 		char gwAddress[ENIGMAIOT_ADDR_LEN * 3];
 		DEBUG_DBG ("RTC data loaded. Gateway: %s", mac2str (rtcmem_data.gateway, gwAddress));
 		DEBUG_DBG ("Own address: %s", mac2str (node.getMacAddress (), gwAddress));
 #endif
+		// Non sleepy node does not wake from deep sleep so it has been restarted and group counters are lost.
+		// Registering again makes gateway send them with group keys
+		if (!node.getSleepy () && node.getStatus () == REGISTERED) {
+			loadGroupKeys ();
+			for (int i = 0; i < MAX_NODE_GROUP_KEYS; i++) {
+				if (groupKeys[i].group != NO_GROUP) {
+					DEBUG_INFO ("Restarted as group member. Registering again");
+					node.setStatus (UNREGISTERED);
+					break;
+				}
+			}
+		}
 	} else { // No RTC data, first boot or not configured
 		if (gateway && networkKey) { // If connection data has been passed to library
 			DEBUG_DBG ("EnigmaIot started with config data con begin() call");
@@ -787,10 +1017,17 @@ void EnigmaIOTNodeClass::begin (Comms_halClass* comm, uint8_t* gateway, uint8_t*
 		}
 	}
 
+	if (!commStarted) {
+		startComms ();
+	}
+}
+
+void EnigmaIOTNodeClass::startComms () {
 	initWiFi (rtcmem_data.channel, rtcmem_data.networkName);
 	comm->begin (rtcmem_data.gateway, rtcmem_data.channel);
 	comm->onDataRcvd (rx_cb);
 	comm->onDataSent (tx_cb);
+	commStarted = true;
 
 #ifdef ESP8266
 	wifi_set_channel (rtcmem_data.channel);
@@ -807,9 +1044,57 @@ void EnigmaIOTNodeClass::begin (Comms_halClass* comm, uint8_t* gateway, uint8_t*
 	}
 #endif
 
+#if ENABLE_LINK_ADAPTATION
+	if (rtcmem_data.txPowerReduction) {
+		setTxPowerReduction (rtcmem_data.txPowerReduction);
+	}
+#endif // ENABLE_LINK_ADAPTATION
+
 	DEBUG_DBG ("Comms started. Channel %u", rtcmem_data.channel);
 }
 
+#if ENABLE_MULTI_GATEWAY
+/**
+  * @brief Selects least loaded gateway among scan results whose signal is not much worse than the best one.
+  * Gateways that do not advertise their load are selected only if no other one is available
+  * @param indexes Scan result indexes of gateways with network name
+  * @param numFound Number of gateways
+  * @return Scan result index of selected gateway
+  */
+int selectGateway (const int* indexes, int numFound) {
+	int32_t maxRssi;
+	int selected = -1;
+	uint8_t selectedLoad = GATEWAY_LOAD_UNKNOWN;
+	int32_t selectedRssi = 0;
+
+	if (numFound <= 0) {
+		return 0;
+	}
+	maxRssi = WiFi.RSSI (indexes[0]);
+	for (int i = 1; i < numFound; i++) {
+		if (WiFi.RSSI (indexes[i]) > maxRssi) {
+			maxRssi = WiFi.RSSI (indexes[i]);
+		}
+	}
+
+	for (int i = 0; i < numFound; i++) {
+		int32_t rssi = WiFi.RSSI (indexes[i]);
+		uint8_t load = GatewayLoad.getLoad (WiFi.BSSID (indexes[i]));
+		DEBUG_DBG ("Gateway %s on channel %d. RSSI %d dBm. Load %u", DEBUG_MAC (WiFi.BSSID (indexes[i])), WiFi.channel (indexes[i]), rssi, load);
+		if (rssi < maxRssi - GATEWAY_RSSI_MARGIN) {
+			continue;
+		}
+		if (selected < 0 || load < selectedLoad || (load == selectedLoad && rssi > selectedRssi)) {
+			selected = i;
+			selectedLoad = load;
+			selectedRssi = rssi;
+		}
+	}
+	DEBUG_INFO ("Selected gateway %s. Load %u", DEBUG_MAC (WiFi.BSSID (indexes[selected])), selectedLoad);
+	return indexes[selected];
+}
+#endif // ENABLE_MULTI_GATEWAY
+
 #ifdef ESP32
 int scanGatewaySSID (char* name, int& wifiIndex) {
 	uint32_t scanStarted;
@@ -853,19 +1138,95 @@ int scanGatewaySSID (char* name, int& wifiIndex) {
 		}
 	}
 
+#if ENABLE_MULTI_GATEWAY
+	wifiIndex = selectGateway (indexes, numFound);
+#else
 	wifiIndex = indexes[0];
+#endif // ENABLE_MULTI_GATEWAY
 
 	return numFound;
 }
 #endif
 
+#if ENABLE_FAST_GATEWAY_DISCOVERY
+/**
+  * @brief Adds a channel to probe list if it is valid and it is not on list yet
+  * @param channels Probe list
+  * @param numChannels Number of channels on list
+  * @param channel Channel to add
+  * @return New number of channels on list
+  */
+static int addProbeChannel (uint8_t* channels, int numChannels, int channel) {
+	if (channel < 1 || channel > MAX_WIFI_CHANNEL) {
+		return numChannels;
+	}
+	for (int i = 0; i < numChannels; i++) {
+		if (channels[i] == channel) {
+			return numChannels;
+		}
+	}
+	channels[numChannels] = channel;
+	return numChannels + 1;
+}
+
+bool EnigmaIOTNodeClass::probeGateway (rtcmem_data_t* data) {
+	static const uint8_t NO_ADDRESS[ENIGMAIOT_ADDR_LEN] = { 0 };
+	uint8_t channels[MAX_WIFI_CHANNEL];
+	int numChannels = 0;
+	uint8_t probe = GATEWAY_PROBE;
+
+	if (!commStarted || !memcmp (data->gateway, NO_ADDRESS, ENIGMAIOT_ADDR_LEN)) {
+		return false;
+	}
+
+	// Last channel first, then channels where gateway has been found before and then neighbour ones
+	numChannels = addProbeChannel (channels, numChannels, data->channel);
+	for (int channel = 1; channel <= MAX_WIFI_CHANNEL; channel++) {
+		if (data->gatewayChannels & (1 << (channel - 1))) {
+			numChannels = addProbeChannel (channels, numChannels, channel);
+		}
+	}
+	numChannels = addProbeChannel (channels, numChannels, data->channel - 1);
+	numChannels = addProbeChannel (channels, numChannels, data->channel + 1);
+
+	uint32_t probeStarted = millis ();
+	for (int i = 0; i < numChannels; i++) {
+		if (comm->probe (data->gateway, channels[i], &probe, sizeof (probe), GATEWAY_PROBE_TIMEOUT)) {
+			DEBUG_INFO ("Gateway found on channel %u in %lu ms", channels[i], millis () - probeStarted);
+			data->channel = channels[i];
+			data->gatewayChannels |= 1 << (channels[i] - 1);
+			return true;
+		}
+	}
+	DEBUG_INFO ("Gateway not found on %d known channels", numChannels);
+	return false;
+}
+#endif // ENABLE_FAST_GATEWAY_DISCOVERY
+
 bool EnigmaIOTNodeClass::searchForGateway (rtcmem_data_t* data, bool shouldStoreData) {
+#if ENABLE_FAST_GATEWAY_DISCOVERY
+	bool fullScan = fullScanRequested;
+
+	fullScanRequested = false;
+	if (!fullScan && probeGateway (data)) {
+		if (shouldStoreData && !saveRTCData ()) {
+			DEBUG_ERROR ("Error saving data on RTC");
+		}
+		requestReportRSSI = true;
+		return true;
+	}
+#endif // ENABLE_FAST_GATEWAY_DISCOVERY
+
 	DEBUG_DBG ("Searching for AP %s", data->networkName);
 
 	//WiFi.mode (WIFI_STA);
 	int numWifi = 0;
 	int wifiIndex = 0;
 
+#if ENABLE_MULTI_GATEWAY
+	GatewayLoad.beginScan (); // Gateways advertise their load on beacons and probe responses
+#endif // ENABLE_MULTI_GATEWAY
+
 #ifdef ESP8266
     time_t scanStarted = millis ();
 	numWifi = WiFi.scanNetworks (false, false, 0, (uint8_t*)(data->networkName));
@@ -877,12 +1238,27 @@ bool EnigmaIOTNodeClass::searchForGateway (rtcmem_data_t* data, bool shouldStore
 		delay (50);
 #endif
 	}
+#if ENABLE_MULTI_GATEWAY
+	GatewayLoad.endScan ();
+	if (numWifi > 1) {
+		// Scan was filtered by network name, so every result is a gateway
+		int indexes[MAX_SCANNED_GATEWAYS];
+		int numFound = numWifi < MAX_SCANNED_GATEWAYS ? numWifi : MAX_SCANNED_GATEWAYS;
+		for (int i = 0; i < numFound; i++) {
+			indexes[i] = i;
+		}
+		wifiIndex = selectGateway (indexes, numFound);
+	}
+#endif // ENABLE_MULTI_GATEWAY
 	WiFiMode_t mode = WiFi.getMode ();
 	DEBUG_DBG ("WiFi mode is %d. Restarting network interface after scan", mode);
 	WiFi.mode (WIFI_OFF);
 	WiFi.mode (mode);
 #elif defined ESP32
 	numWifi = scanGatewaySSID (data->networkName, wifiIndex);
+#if ENABLE_MULTI_GATEWAY
+	GatewayLoad.endScan ();
+#endif // ENABLE_MULTI_GATEWAY
 #endif // ESP8266
 
 	uint8_t prevGwAddr[ENIGMAIOT_ADDR_LEN];
@@ -896,6 +1272,21 @@ bool EnigmaIOTNodeClass::searchForGateway (rtcmem_data_t* data, bool shouldStore
 		data->channel = WiFi.channel (wifiIndex);
 		data->rssi = WiFi.RSSI (wifiIndex);
 		memcpy (data->gateway, WiFi.BSSID (wifiIndex), 6);
+		if (memcmp (prevGwAddr, data->gateway, ENIGMAIOT_ADDR_LEN)) {
+			data->gatewayChannels = 0; // Channels of previous gateway
+		}
+		if (data->channel >= 1 && data->channel <= MAX_WIFI_CHANNEL) {
+			data->gatewayChannels |= 1 << (data->channel - 1);
+		}
+
+#if ENABLE_MULTI_GATEWAY
+		if (memcmp (prevGwAddr, data->gateway, ENIGMAIOT_ADDR_LEN) && node.isRegistered ()) {
+			// Session key belongs to previous gateway. Session ticket is valid on any gateway of the network, so a single message exchange is needed
+			DEBUG_INFO ("Roaming to gateway %s", DEBUG_MAC (data->gateway));
+			node.reset ();
+			data->nodeRegisterStatus = UNREGISTERED;
+		}
+#endif // ENABLE_MULTI_GATEWAY
 
 		if (shouldStoreData) {
 			DEBUG_DBG ("Found gateway. Storing");
@@ -935,6 +1326,7 @@ bool EnigmaIOTNodeClass::searchForGateway (rtcmem_data_t* data, bool shouldStore
 
 void EnigmaIOTNodeClass::stop () {
 	comm->stop ();
+	commStarted = false;
 	DEBUG_DBG ("Communication layer uninitalized");
 }
 
@@ -990,7 +1382,7 @@ bool EnigmaIOTNodeClass::reportRSSI () {
 
 	if (sendData (buffer, bufLength, true)) {
 		DEBUG_DBG ("Sleep time is %d seconds", sleepTime / 1000000);
-		DEBUG_VERBOSE ("Data: %s", printHexBuffer (buffer, bufLength));
+		DEBUG_VERBOSE ("Data: %s", DEBUG_HEX (buffer, bufLength));
 		return true;
 	} else {
 		DEBUG_WARN ("Error sending version response");
@@ -1029,9 +1421,17 @@ void EnigmaIOTNodeClass::handle () {
 		}
 	}
 
+	// Discard incomplete downlink payload
+	downlinkFragments.expire ();
+
+	// Send batched readings if oldest one has waited too long
+	if (rtcmem_data.batchLength && batchMaxDelay && batchClock () - rtcmem_data.batchStart >= batchMaxDelay) {
+		flushBatch ();
+	}
+
 	// Check if this should go to sleep
 	if (node.getSleepy () && !shouldRestart) {
-		if (sleepRequested && millis () - node.getLastMessageTime () > DOWNLINK_WAIT_TIME && node.isRegistered () && !indentifying) {
+		if (sleepRequested && (downlinkWindowClosed || millis () - node.getLastMessageTime () > DOWNLINK_WAIT_TIME) && node.isRegistered () && !indentifying) {
 			// Substract running time
             int64_t sleep_t = 0;
             if (sleepTime) {
@@ -1041,6 +1441,13 @@ void EnigmaIOTNodeClass::handle () {
 				// Avoid negative values
 				sleep_t = 1000;
 			}
+			if (rtcmem_data.batchLength) {
+				// Keep batch clock running during sleep
+				rtcmem_data.batchClockBase += millis () + (uint32_t)(sleep_t / 1000);
+				if (!saveRTCData ()) {
+					DEBUG_ERROR ("Error saving data on RTC");
+				}
+			}
 			//int64_t msSleep = sleep_t / 1000;
             if (sleep_t) {
                 DEBUG_WARN ("Go to sleep for %ld ms", (int32_t)(sleep_t / 1000L));
@@ -1048,6 +1455,7 @@ void EnigmaIOTNodeClass::handle () {
                 DEBUG_WARN ("Go to sleep indefinitely");
             }
 			DEBUG_WARN ("%d", millis ());
+			DEBUG_FLUSH ();
 #ifdef ESP8266
 			ESP.deepSleep (sleep_t);
 #elif defined ESP32
@@ -1057,12 +1465,14 @@ void EnigmaIOTNodeClass::handle () {
 	}
 
 	// Check registration timeout
-	static time_t lastRegistration = millis ();
 	status_t status = node.getStatus ();
 	if (status == WAIT_FOR_SERVER_HELLO /*|| status == WAIT_FOR_CIPHER_FINISHED*/) {
 		if (node.getSleepy ()) { // Sleep after registration timeout
 			if (millis () - node.getLastMessageTime () > RECONNECTION_PERIOD) {
 				DEBUG_INFO ("Current node status: %d", node.getStatus ());
+				if (sessionResuming) { // Gateway may not support session resumption
+					clearSessionTicket ();
+				}
 				node.reset ();
 				rtcmem_data.nodeRegisterStatus = UNREGISTERED;
 
@@ -1073,6 +1483,7 @@ void EnigmaIOTNodeClass::handle () {
 				uint32_t rnd = Crypto.random (PRE_REG_DELAY * 1000); // nanoseconds
 
 				DEBUG_INFO ("Registration timeout. Go to sleep for %lu ms", (uint32_t)(RECONNECTION_PERIOD * 4 + rnd / 1000));
+				DEBUG_FLUSH ();
 #ifdef ESP8266
 				ESP.deepSleep (RECONNECTION_PERIOD * 4000 + rnd, RF_NO_CAL);
 #elif defined ESP32
@@ -1082,28 +1493,44 @@ void EnigmaIOTNodeClass::handle () {
 		} else { // Retry registration
 			if (millis () - node.getLastMessageTime () > RECONNECTION_PERIOD * 5) {
 				DEBUG_INFO ("Current node status: %d", node.getStatus ());
+				if (sessionResuming) { // Gateway may not support session resumption
+					clearSessionTicket ();
+				}
 				node.reset ();
 				node.setLastMessageTime (); // Set wait time start
 			}
 		}
 	}
 
-	// Retry registration
+	// Retry registration. Waiting is not blocking, so gateway answer is processed as soon as it arrives
 	if (node.getStatus () == UNREGISTERED) {
-		if (millis () - lastRegistration > RECONNECTION_PERIOD) {
-			DEBUG_DBG ("Current node status: %d", node.getStatus ());
+		if (!registrationScheduled) {
+			registrationScheduled = true;
 			lastRegistration = millis (); // Set wait time start
+			if (rtcmem_data.sessionTicketValid) {
+				registrationDelay = 0; // Resumption needs a single message exchange. Do it as soon as possible
+			} else {
+				registrationDelay = RECONNECTION_PERIOD + Crypto.random (PRE_REG_DELAY);
+			}
+			DEBUG_INFO ("Registration delay (%u)", registrationDelay);
+		}
+		if (millis () - lastRegistration >= registrationDelay) {
+			DEBUG_DBG ("Current node status: %d", node.getStatus ());
+			registrationScheduled = false;
 			node.reset ();
-			uint32_t rnd = Crypto.random (PRE_REG_DELAY);
-			DEBUG_INFO ("Random delay (%u)", rnd);
-			delay (1500 + rnd);
-			clientHello ();
-			delay (1500 + Crypto.random (POST_REG_DELAY)); // Wait for Server Hello
+			if (rtcmem_data.sessionTicketValid) {
+				resumeSession ();
+			} else {
+				clientHello ();
+			}
 		}
 	}
 
 	// Check OTA update timeout
 	if (otaRunning) {
+		if (otaWindow && millis () - lastOTAmsg > OTA_ACK_TIMEOUT + otaAckJitter && millis () - lastOTAack > OTA_ACK_TIMEOUT + otaAckJitter) {
+			sendOTAack (); // Last chunks or last ack may have been lost
+		}
 		if (millis () - lastOTAmsg > OTA_TIMEOUT_TIME) {
 			uint8_t responseBuffer[2];
 			responseBuffer[0] = control_message_type::OTA_ANS;
@@ -1112,6 +1539,7 @@ void EnigmaIOTNodeClass::handle () {
 				DEBUG_INFO ("OTA TIMEOUT");
 			}
 			otaRunning = false;
+			freeOTAwindow ();
 			DEBUG_WARN ("Restart due to OTA timeout");
 			restart (IRRELEVANT);
 		}
@@ -1151,6 +1579,7 @@ void EnigmaIOTNodeClass::handle () {
 		static unsigned long retartRequest = millis ();
 		if (millis () - retartRequest > 2500) {
 			DEBUG_WARN ("Restart");
+			DEBUG_FLUSH ();
 			ESP.restart ();
 		}
 	}
@@ -1166,6 +1595,8 @@ void EnigmaIOTNodeClass::handle () {
 		}
 	}
 
+	// Print deferred debug output
+	DEBUG_PROCESS (DEBUG_DEFERRED_PROCESS_TIME);
 }
 
 void EnigmaIOTNodeClass::rx_cb (uint8_t* mac_addr, uint8_t* data, uint8_t len) {
@@ -1188,9 +1619,9 @@ bool EnigmaIOTNodeClass::checkCRC (const uint8_t* buf, size_t count, uint32_t* c
 
 bool EnigmaIOTNodeClass::clientHello () {
 	/*
-	* ------------------------------------------------------------------------------------------------------------
-	*| msgType (1) | IV (12) | DH Kmaster (32) | Random (30 bits) | Broadcast (1 bit) | Sleepy (1 bit) | Tag (16) |
-	* ------------------------------------------------------------------------------------------------------------
+	* -----------------------------------------------------------------------------------------------------------------------------
+	*| msgType (1) | IV (12) | DH Kmaster (32) | Random (30 bits) | Broadcast (1 bit) | Sleepy (1 bit) | [Ciphers (1)] | Tag (16) |
+	* -----------------------------------------------------------------------------------------------------------------------------
 	*/
 
 	struct __attribute__ ((packed, aligned (1))) {
@@ -1198,12 +1629,25 @@ bool EnigmaIOTNodeClass::clientHello () {
 		uint8_t iv[IV_LENGTH];
 		uint8_t publicKey[KEY_LENGTH];
 		uint32_t random;
+		uint8_t ciphers;
 		uint8_t tag[TAG_LENGTH];
 	} clientHello_msg;
 
 #define CHMSG_LEN sizeof(clientHello_msg)
 
+	size_t msgLen = CHMSG_LEN;
+	size_t encryptedLen = KEY_LENGTH + sizeof (uint32_t) + sizeof (uint8_t);
+	uint8_t* tag = clientHello_msg.tag;
+
+	// Supported ciphers are only sent if there is an alternative to default one, so that older gateways can still register this node
+	if (PREFERRED_CIPHER == CHACHAPOLY_CIPHER) {
+		msgLen -= sizeof (uint8_t);
+		encryptedLen -= sizeof (uint8_t);
+		tag = &(clientHello_msg.ciphers);
+	}
+
 	invalidateReason = UNKNOWN_ERROR; // reset any previous force disconnect
+	sessionResuming = false;
 
 	Crypto.getDH1 ();
 	node.setStatus (INIT);
@@ -1228,7 +1672,7 @@ bool EnigmaIOTNodeClass::clientHello () {
 
 	CryptModule::random (clientHello_msg.iv, IV_LENGTH);
 
-	DEBUG_VERBOSE ("IV: %s", printHexBuffer (clientHello_msg.iv, IV_LENGTH));
+	DEBUG_VERBOSE ("IV: %s", DEBUG_HEX (clientHello_msg.iv, IV_LENGTH));
 
 	for (int i = 0; i < KEY_LENGTH; i++) {
 		clientHello_msg.publicKey[i] = key[i];
@@ -1257,9 +1701,11 @@ bool EnigmaIOTNodeClass::clientHello () {
 
 	memcpy (&(clientHello_msg.random), &random, RANDOM_LENGTH);
 
-	DEBUG_VERBOSE ("Client Hello message: %s", printHexBuffer ((uint8_t*)&clientHello_msg, CHMSG_LEN - TAG_LENGTH));
+	clientHello_msg.ciphers = SUPPORTED_CIPHERS;
+
+	DEBUG_VERBOSE ("Client Hello message: %s", DEBUG_HEX ((uint8_t*)&clientHello_msg, msgLen - TAG_LENGTH));
 
-	uint8_t addDataLen = CHMSG_LEN - TAG_LENGTH - sizeof (uint32_t) - KEY_LENGTH;
+	uint8_t addDataLen = CHMSG_LEN - TAG_LENGTH - sizeof (uint8_t) - sizeof (uint32_t) - KEY_LENGTH;
 	uint8_t aad[AAD_LENGTH + addDataLen];
 
 	memcpy (aad, (uint8_t*)&clientHello_msg, addDataLen); // Copy message upto iv
@@ -1267,22 +1713,104 @@ bool EnigmaIOTNodeClass::clientHello () {
 	// Copy 8 last bytes from NetworkKey
 	memcpy (aad + addDataLen, rtcmem_data.networkKey + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH);
 
-	if (!CryptModule::encryptBuffer (clientHello_msg.publicKey, KEY_LENGTH + sizeof (uint32_t), // Encrypt only from public key
+	if (!CryptModule::encryptBuffer (clientHello_msg.publicKey, encryptedLen, // Encrypt only from public key
 									 clientHello_msg.iv, IV_LENGTH,
 									 rtcmem_data.networkKey, KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of network key
-									 aad, sizeof (aad), clientHello_msg.tag, TAG_LENGTH)) {
+									 aad, sizeof (aad), tag, TAG_LENGTH)) {
 		DEBUG_ERROR ("Error during encryption");
 		return false;
 	}
 
-	DEBUG_VERBOSE ("Encrypted Client Hello message: %s", printHexBuffer ((uint8_t*)&clientHello_msg, CHMSG_LEN));
+	DEBUG_VERBOSE ("Encrypted Client Hello message: %s", DEBUG_HEX ((uint8_t*)&clientHello_msg, msgLen));
 
 	node.setStatus (WAIT_FOR_SERVER_HELLO);
 	rtcmem_data.nodeRegisterStatus = WAIT_FOR_SERVER_HELLO;
+	node.setLastMessageTime (); // Registration timeout starts now
 
 	DEBUG_INFO (" -------> CLIENT HELLO");
 
-	return comm->send (rtcmem_data.gateway, (uint8_t*)&clientHello_msg, CHMSG_LEN) == 0;
+	return comm->send (rtcmem_data.gateway, (uint8_t*)&clientHello_msg, msgLen) == 0;
+}
+
+bool EnigmaIOTNodeClass::resumeSession () {
+	/*
+	* ------------------------------------------------------------------------------------------------------------
+	*| msgType (1) | IV (12) | Ticket (16) | Random (8) | Random (6 bits) | Broadcast (1 bit) | Sleepy (1 bit) | Tag (16) |
+	* ------------------------------------------------------------------------------------------------------------
+	*/
+
+	struct __attribute__ ((packed, aligned (1))) {
+		uint8_t msgType;
+		uint8_t iv[IV_LENGTH];
+		uint8_t ticket[SESSION_TICKET_LENGTH];
+		uint8_t nonce[RESUME_NONCE_LENGTH];
+		uint8_t flags;
+		uint8_t tag[TAG_LENGTH];
+	} resumeRequest_msg;
+
+#define RRMSG_LEN sizeof(resumeRequest_msg)
+
+	invalidateReason = UNKNOWN_ERROR; // reset any previous force disconnect
+
+	resumeRequest_msg.msgType = RESUME_REQUEST;
+
+	CryptModule::random (resumeRequest_msg.iv, IV_LENGTH);
+
+	DEBUG_VERBOSE ("IV: %s", DEBUG_HEX (resumeRequest_msg.iv, IV_LENGTH));
+
+	memcpy (resumeRequest_msg.ticket, rtcmem_data.sessionTicket, SESSION_TICKET_LENGTH);
+
+	CryptModule::random (resumeNonce, RESUME_NONCE_LENGTH);
+	memcpy (resumeRequest_msg.nonce, resumeNonce, RESUME_NONCE_LENGTH);
+
+	resumeRequest_msg.flags = (uint8_t)Crypto.random () & 0xFC;
+	if (node.getSleepy ()) {
+		resumeRequest_msg.flags |= 0x01U; // Signal sleepy node
+		DEBUG_DBG ("Signal sleepy node");
+	}
+	if (node.broadcastIsEnabled ()) {
+		resumeRequest_msg.flags |= 0x02U; // Signal broadcast mode enabled to request broadcast key
+		rtcmem_data.broadcastKeyRequested = true;
+		DEBUG_DBG ("Signal broadcast enabled");
+	} else {
+		rtcmem_data.broadcastKeyRequested = false;
+	}
+
+	DEBUG_VERBOSE ("Resume Request message: %s", DEBUG_HEX ((uint8_t*)&resumeRequest_msg, RRMSG_LEN - TAG_LENGTH));
+
+	uint8_t addDataLen = RRMSG_LEN - TAG_LENGTH - sizeof (uint8_t) - RESUME_NONCE_LENGTH;
+	uint8_t aad[AAD_LENGTH + addDataLen];
+
+	memcpy (aad, (uint8_t*)&resumeRequest_msg, addDataLen); // Copy message upto ticket
+
+	// Copy 8 last bytes from resumption secret
+	memcpy (aad + addDataLen, rtcmem_data.resumptionSecret + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH);
+
+	if (!CryptModule::encryptBuffer (resumeRequest_msg.nonce, RESUME_NONCE_LENGTH + sizeof (uint8_t), // Encrypt only random and flags
+									 resumeRequest_msg.iv, IV_LENGTH,
+									 rtcmem_data.resumptionSecret, KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of resumption secret
+									 aad, sizeof (aad), resumeRequest_msg.tag, TAG_LENGTH)) {
+		DEBUG_ERROR ("Error during encryption");
+		return false;
+	}
+
+	DEBUG_VERBOSE ("Encrypted Resume Request message: %s", DEBUG_HEX ((uint8_t*)&resumeRequest_msg, RRMSG_LEN));
+
+	sessionResuming = true;
+	node.setStatus (WAIT_FOR_SERVER_HELLO);
+	rtcmem_data.nodeRegisterStatus = WAIT_FOR_SERVER_HELLO;
+	node.setLastMessageTime (); // Registration timeout starts now
+
+	DEBUG_INFO (" -------> RESUME REQUEST");
+
+	return comm->send (rtcmem_data.gateway, (uint8_t*)&resumeRequest_msg, RRMSG_LEN) == 0;
+}
+
+void EnigmaIOTNodeClass::clearSessionTicket () {
+	DEBUG_INFO ("Session ticket discarded");
+	sessionResuming = false;
+	rtcmem_data.sessionTicketValid = false;
+	memset (rtcmem_data.resumptionSecret, 0, KEY_LENGTH);
 }
 
 bool EnigmaIOTNodeClass::clockRequest () {
@@ -1306,15 +1834,9 @@ bool EnigmaIOTNodeClass::clockRequest () {
 
 	CryptModule::random (clockRequest_msg.iv, IV_LENGTH);
 
-	DEBUG_VERBOSE ("IV: %s", printHexBuffer (clockRequest_msg.iv, IV_LENGTH));
+	DEBUG_VERBOSE ("IV: %s", DEBUG_HEX (clockRequest_msg.iv, IV_LENGTH));
 
-	if (useCounter) {
-		counter = node.getLastControlCounter () + 1;
-		node.setLastControlCounter (counter);
-		rtcmem_data.lastControlCounter = counter;
-	} else {
-		counter = (uint16_t)(Crypto.random ());
-	}
+	counter = nextUplinkCounter (true);
 
 	DEBUG_INFO ("Control message #%d", counter);
 
@@ -1324,7 +1846,7 @@ bool EnigmaIOTNodeClass::clockRequest () {
 
 	memcpy (&(clockRequest_msg.t1), &t1, sizeof (int64_t));
 
-	DEBUG_VERBOSE ("Clock Request message: %s", printHexBuffer ((uint8_t*)&clockRequest_msg, CRMSG_LEN - TAG_LENGTH));
+	DEBUG_VERBOSE ("Clock Request message: %s", DEBUG_HEX ((uint8_t*)&clockRequest_msg, CRMSG_LEN - TAG_LENGTH));
 	DEBUG_DBG ("T1: %llu", t1);
 
 	uint8_t addDataLen = 1 + IV_LENGTH;
@@ -1334,20 +1856,23 @@ bool EnigmaIOTNodeClass::clockRequest () {
 
 	// Copy 8 last bytes from Node Key
 	memcpy (aad + addDataLen, node.getEncriptionKey () + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH);
+	bindCounterEpoch (aad, sizeof (aad), rtcmem_data.controlCounterEpoch);
 
 	if (!CryptModule::encryptBuffer ((uint8_t*)&(clockRequest_msg.counter), CRMSG_LEN - IV_LENGTH - TAG_LENGTH - 1, // Encrypt only from counter
 									 clockRequest_msg.iv, IV_LENGTH,
 									 node.getEncriptionKey (), KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of network key
-									 aad, sizeof (aad), clockRequest_msg.tag, TAG_LENGTH)) {
+									 aad, sizeof (aad), clockRequest_msg.tag, TAG_LENGTH, node.getCipherAlgorithm ())) {
 		DEBUG_ERROR ("Error during encryption");
 		return false;
 	}
 
-	DEBUG_VERBOSE ("Encrypted Clock Request message: %s", printHexBuffer ((uint8_t*)&clockRequest_msg, CRMSG_LEN));
+	DEBUG_VERBOSE ("Encrypted Clock Request message: %s", DEBUG_HEX ((uint8_t*)&clockRequest_msg, CRMSG_LEN));
 
 	DEBUG_INFO (" -------> CLOCK REQUEST");
 
 	node.setLastMessageTime ();
+	downlinkWindowCounter = -1; // Wait for clock response
+	downlinkWindowClosed = false;
 
 	flashBlue = true;
 
@@ -1393,12 +1918,12 @@ bool EnigmaIOTNodeClass::processClockResponse (const uint8_t* mac, const uint8_t
 	if (!CryptModule::decryptBuffer ((uint8_t*)&(clockResponse_msg.counter), CRSMSG_LEN - IV_LENGTH - TAG_LENGTH - 1, // Decrypt from counter, 18 bytes
 									 clockResponse_msg.iv, IV_LENGTH,
 									 node.getEncriptionKey (), KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of network key
-									 aad, sizeof (aad), clockResponse_msg.tag, TAG_LENGTH)) {
+									 aad, sizeof (aad), clockResponse_msg.tag, TAG_LENGTH, node.getCipherAlgorithm ())) {
 		DEBUG_ERROR ("Error during decryption");
 		return false;
 	}
 
-    DEBUG_VERBOSE ("Decripted Clock Response message: %s", printHexBuffer ((uint8_t*)&clockResponse_msg, count - TAG_LENGTH));
+    DEBUG_VERBOSE ("Decripted Clock Response message: %s", DEBUG_HEX ((uint8_t*)&clockResponse_msg, count - TAG_LENGTH));
 
 	memcpy (&counter, &(clockResponse_msg.counter), sizeof (uint16_t));
 	DEBUG_INFO ("Downlink msg #%d", counter);
@@ -1426,19 +1951,25 @@ bool EnigmaIOTNodeClass::processClockResponse (const uint8_t* mac, const uint8_t
 	memcpy (&clockResponse_msg, buf, count);
 
 	int64_t offset = TimeManager.adjustTime (t1, t2, t3, t4);
+	rtcmem_data.clockDrift = TimeManager.getDrift ();
 
+	// Sync period grows while clock keeps accurate, as drift is compensated
 	if (offset < MIN_SYNC_ACCURACY && offset > (MIN_SYNC_ACCURACY * -1)) {
-		timeSyncPeriod = TIME_SYNC_PERIOD;
+		timeSyncPeriod = timeSyncPeriod * 2 < TIME_SYNC_PERIOD ? TIME_SYNC_PERIOD : timeSyncPeriod * 2;
+		if (timeSyncPeriod > MAX_TIME_SYNC_PERIOD) {
+			timeSyncPeriod = MAX_TIME_SYNC_PERIOD;
+		}
 	} else {
 		timeSyncPeriod = QUICK_SYNC_TIME;
 	}
-	DEBUG_VERBOSE ("Clock Response message: %s", printHexBuffer ((uint8_t*)&clockResponse_msg, CRSMSG_LEN - TAG_LENGTH));
+	DEBUG_VERBOSE ("Clock Response message: %s", DEBUG_HEX ((uint8_t*)&clockResponse_msg, CRSMSG_LEN - TAG_LENGTH));
 
 	DEBUG_DBG ("T1: %llu", t1);
     DEBUG_DBG ("T2: %llu", t2);
     DEBUG_DBG ("T3: %llu", t3);
     DEBUG_DBG ("T4: %llu", t4);
     DEBUG_INFO ("Offest adjusted to %lld us, Roundtrip delay is %lld", offset, TimeManager.getDelay ());
+	DEBUG_INFO ("Clock drift %d ppb. Next sync in %u ms", TimeManager.getDrift (), timeSyncPeriod);
 
 	if (useCounter && !otaRunning) { // RTC must not be written if OTA is running. OTA uses RTC memmory to signal 2nd firmware boot
 		if (!saveRTCData ()) {
@@ -1467,9 +1998,9 @@ bool EnigmaIOTNodeClass::hasClockSync () {
 
 bool EnigmaIOTNodeClass::processServerHello (const uint8_t* mac, const uint8_t* buf, size_t count) {
 	/*
-	* ------------------------------------------------------
-	*| msgType (1) | random (12) | DH Kslave (32) | Tag (16) |
-	* ------------------------------------------------------
+	* -----------------------------------------------------------------------------------------------
+	*| msgType (1) | IV (12) | DH Kslave (32) | NodeID (2) | Random (4) | [Cipher (1)] | Tag (16) |
+	* -----------------------------------------------------------------------------------------------
 	*/
 
 	struct __attribute__ ((packed, aligned (1))) {
@@ -1478,21 +2009,29 @@ bool EnigmaIOTNodeClass::processServerHello (const uint8_t* mac, const uint8_t*
 		uint8_t publicKey[KEY_LENGTH];
 		uint16_t nodeId;
 		uint32_t random;
+		uint8_t cipher;
 		uint8_t tag[TAG_LENGTH];
 	} serverHello_msg;
 
 #define SHMSG_LEN sizeof(serverHello_msg)
+#define SHMSG_LEGACY_LEN (SHMSG_LEN - sizeof(uint8_t)) // Gateways that do not send selected cipher
 
 	uint16_t nodeId;
+	size_t encryptedLen;
+	cipherAlgorithm_t cipher = CHACHAPOLY_CIPHER;
 
-	if (count < SHMSG_LEN) {
-		DEBUG_WARN ("Message too short");
+	if (count == SHMSG_LEN) {
+		encryptedLen = KEY_LENGTH + sizeof (uint16_t) + sizeof (uint32_t) + sizeof (uint8_t);
+	} else if (count == SHMSG_LEGACY_LEN) {
+		encryptedLen = KEY_LENGTH + sizeof (uint16_t) + sizeof (uint32_t);
+	} else {
+		DEBUG_WARN ("Wrong message length");
 		return false;
 	}
 
 	memcpy (&serverHello_msg, buf, count);
 
-	uint8_t addDataLen = SHMSG_LEN - TAG_LENGTH - sizeof (uint32_t) - sizeof (uint16_t) - KEY_LENGTH;
+	uint8_t addDataLen = SHMSG_LEN - TAG_LENGTH - sizeof (uint8_t) - sizeof (uint32_t) - sizeof (uint16_t) - KEY_LENGTH;
 	uint8_t aad[AAD_LENGTH + addDataLen];
 
 	memcpy (aad, (uint8_t*)&serverHello_msg, addDataLen); // Copy message upto iv
@@ -1500,15 +2039,24 @@ bool EnigmaIOTNodeClass::processServerHello (const uint8_t* mac, const uint8_t*
 	// Copy 8 last bytes from NetworkKey
 	memcpy (aad + addDataLen, rtcmem_data.networkKey + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH);
 
-	if (!CryptModule::decryptBuffer (serverHello_msg.publicKey, KEY_LENGTH + sizeof (uint16_t) + sizeof (uint32_t),
+	if (!CryptModule::decryptBuffer (serverHello_msg.publicKey, encryptedLen,
 									 serverHello_msg.iv, IV_LENGTH,
 									 rtcmem_data.networkKey, KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of network key
-									 aad, sizeof (aad), serverHello_msg.tag, TAG_LENGTH)) {
+									 aad, sizeof (aad), buf + count - TAG_LENGTH, TAG_LENGTH)) {
 		DEBUG_ERROR ("Error during decryption");
 		return false;
 	}
 
-	DEBUG_VERBOSE ("Decrypted Server Hello message: %s", printHexBuffer ((uint8_t*)&serverHello_msg, SHMSG_LEN - TAG_LENGTH));
+	DEBUG_VERBOSE ("Decrypted Server Hello message: %s", DEBUG_HEX ((uint8_t*)&serverHello_msg, count - TAG_LENGTH));
+
+	if (count == SHMSG_LEN) {
+		if ((serverHello_msg.cipher != CHACHAPOLY_CIPHER && serverHello_msg.cipher != AES_GCM_CIPHER)
+			|| !(serverHello_msg.cipher & SUPPORTED_CIPHERS)) {
+			DEBUG_ERROR ("Unsupported cipher selected by gateway: 0x%02X", serverHello_msg.cipher);
+			return false;
+		}
+		cipher = (cipherAlgorithm_t)serverHello_msg.cipher;
+	}
 
 	bool cError = Crypto.getDH2 (serverHello_msg.publicKey);
 
@@ -1524,26 +2072,108 @@ bool EnigmaIOTNodeClass::processServerHello (const uint8_t* mac, const uint8_t*
 
 	node.setEncryptionKey (CryptModule::getSHA256 (serverHello_msg.publicKey, KEY_LENGTH));
 	memcpy (rtcmem_data.nodeKey, node.getEncriptionKey (), KEY_LENGTH);
-	DEBUG_INFO ("Node key: %s", printHexBuffer (node.getEncriptionKey (), KEY_LENGTH));
+	node.setCipherAlgorithm (cipher);
+	rtcmem_data.cipherAlgorithm = cipher;
+	DEBUG_INFO ("Node key: %s", DEBUG_HEX (node.getEncriptionKey (), KEY_LENGTH));
+	DEBUG_DBG ("Node cipher: %s", CryptModule::getBackend (cipher)->getName ());
 
 	return true;
 }
 
-bool EnigmaIOTNodeClass::sendData (const uint8_t* data, size_t len, bool controlMessage, bool encrypt, nodePayloadEncoding_t payloadType) {
-	if (!controlMessage) {
-		memcpy (dataMessageSent, data, len);
-		dataMessageSentLength = len;
-		dataMessageEncrypt = encrypt;
-		dataMessageSendPending = true;
-		dataMessageSendEncoding = payloadType;
-	}
-	node.setLastMessageTime (); // Mark message time to start RX window start
-
-	if (node.getStatus () == REGISTERED && node.isKeyValid ()) {
+bool EnigmaIOTNodeClass::processResumeResponse (const uint8_t* mac, const uint8_t* buf, size_t count) {
+	/*
+	* ------------------------------------------------------------------------
+	*| msgType (1) | IV (12) | NodeID (2) | Random (8) | Cipher (1) | Tag (16) |
+	* ------------------------------------------------------------------------
+	*/
+
+	struct __attribute__ ((packed, aligned (1))) {
+		uint8_t msgType;
+		uint8_t iv[IV_LENGTH];
+		uint16_t nodeId;
+		uint8_t nonce[RESUME_NONCE_LENGTH];
+		uint8_t cipher;
+		uint8_t tag[TAG_LENGTH];
+	} resumeResponse_msg;
+
+#define RSMSG_LEN sizeof(resumeResponse_msg)
+
+	if (count != RSMSG_LEN) {
+		DEBUG_WARN ("Wrong message length");
+		return false;
+	}
+
+	memcpy (&resumeResponse_msg, buf, count);
+
+	const uint8_t addDataLen = 1 + IV_LENGTH;
+	uint8_t aad[AAD_LENGTH + addDataLen];
+
+	memcpy (aad, (uint8_t*)&resumeResponse_msg, addDataLen); // Copy message upto iv
+
+	// Copy 8 last bytes from resumption secret
+	memcpy (aad + addDataLen, rtcmem_data.resumptionSecret + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH);
+
+	if (!CryptModule::decryptBuffer ((uint8_t*)&(resumeResponse_msg.nodeId), sizeof (uint16_t) + RESUME_NONCE_LENGTH + sizeof (uint8_t),
+									 resumeResponse_msg.iv, IV_LENGTH,
+									 rtcmem_data.resumptionSecret, KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of resumption secret
+									 aad, sizeof (aad), resumeResponse_msg.tag, TAG_LENGTH)) {
+		DEBUG_ERROR ("Error during decryption");
+		return false;
+	}
+
+	DEBUG_VERBOSE ("Decrypted Resume Response message: %s", DEBUG_HEX ((uint8_t*)&resumeResponse_msg, RSMSG_LEN - TAG_LENGTH));
+
+	if ((resumeResponse_msg.cipher != CHACHAPOLY_CIPHER && resumeResponse_msg.cipher != AES_GCM_CIPHER)
+		|| !(resumeResponse_msg.cipher & SUPPORTED_CIPHERS)) {
+		DEBUG_ERROR ("Unsupported cipher selected by gateway: 0x%02X", resumeResponse_msg.cipher);
+		return false;
+	}
+
+	uint16_t nodeId;
+	memcpy (&nodeId, &resumeResponse_msg.nodeId, sizeof (uint16_t));
+	node.setNodeId (nodeId);
+	DEBUG_DBG ("Node ID: %u", node.getNodeId ());
+
+	// New node key = SHA256 (secret | node random | gateway random)
+	uint8_t keyMaterial[KEY_LENGTH + 2 * RESUME_NONCE_LENGTH];
+	memcpy (keyMaterial, rtcmem_data.resumptionSecret, KEY_LENGTH);
+	memcpy (keyMaterial + KEY_LENGTH, resumeNonce, RESUME_NONCE_LENGTH);
+	memcpy (keyMaterial + KEY_LENGTH + RESUME_NONCE_LENGTH, resumeResponse_msg.nonce, RESUME_NONCE_LENGTH);
+	node.setEncryptionKey (CryptModule::getSHA256 (keyMaterial, sizeof (keyMaterial)));
+	memset (keyMaterial, 0, sizeof (keyMaterial));
+	memcpy (rtcmem_data.nodeKey, node.getEncriptionKey (), KEY_LENGTH);
+	node.setCipherAlgorithm ((cipherAlgorithm_t)resumeResponse_msg.cipher);
+	rtcmem_data.cipherAlgorithm = (cipherAlgorithm_t)resumeResponse_msg.cipher;
+	DEBUG_INFO ("Node key: %s", DEBUG_HEX (node.getEncriptionKey (), KEY_LENGTH));
+	DEBUG_DBG ("Node cipher: %s", CryptModule::getBackend (node.getCipherAlgorithm ())->getName ());
+
+	return true;
+}
+
+bool EnigmaIOTNodeClass::sendData (const uint8_t* data, size_t len, bool controlMessage, bool encrypt, nodePayloadEncoding_t payloadType) {
+	if (!controlMessage && len > MAX_DATA_PAYLOAD_SIZE) {
+		if (!encrypt) {
+			DEBUG_WARN ("Unencrypted data too long: %u bytes", len);
+			return false;
+		}
+		return sendFragmentedData (data, len, payloadType);
+	}
+	if (!controlMessage) {
+		if (data != dataMessageSent) { // Payload may have been built on retransmission buffer already
+			memcpy (dataMessageSent, data, len);
+		}
+		dataMessageSentLength = len;
+		dataMessageEncrypt = encrypt;
+		dataMessageSendPending = true;
+		dataMessageSendEncoding = payloadType;
+	}
+	node.setLastMessageTime (); // Mark message time to start RX window start
+
+	if (node.getStatus () == REGISTERED && node.isKeyValid ()) {
 		if (controlMessage) {
-			DEBUG_VERBOSE ("Control message sent: %s", printHexBuffer (data, len));
+			DEBUG_VERBOSE ("Control message sent: %s", DEBUG_HEX (data, len));
 		} else {
-			DEBUG_VERBOSE ("%s data sent: %s", encrypt ? "Encrypted" : "Unencrypted", printHexBuffer (data, len));
+			DEBUG_VERBOSE ("%s data sent: %s", encrypt ? "Encrypted" : "Unencrypted", DEBUG_HEX (data, len));
 		}
 		flashBlue = true;
 		if (dataMessage (data, len, controlMessage, encrypt, payloadType)) {
@@ -1556,6 +2186,118 @@ bool EnigmaIOTNodeClass::sendData (const uint8_t* data, size_t len, bool control
 	return false;
 }
 
+bool EnigmaIOTNodeClass::sendFragmentedData (const uint8_t* data, size_t len, nodePayloadEncoding_t payloadEncoding) {
+	uint8_t fragment[MAX_DATA_PAYLOAD_SIZE];
+	uint8_t fragmentCount = FragmentBuffer::getFragmentCount (len);
+
+	if (!data) {
+		return false;
+	}
+	if (!fragmentCount) {
+		DEBUG_WARN ("Data too long: %u bytes. Maximum is %u", len, MAX_FRAGMENTED_PAYLOAD_SIZE);
+		return false;
+	}
+	node.setLastMessageTime (); // Mark message time to start RX window start
+	if (!(node.getStatus () == REGISTERED && node.isKeyValid ())) {
+		return false;
+	}
+
+	// Fragments are not kept for retransmission after a new registration. If one is lost whole payload is discarded by gateway
+	fragmentTransferId++;
+	DEBUG_INFO ("Sending %u bytes in %u fragments. Transfer %u", len, fragmentCount, fragmentTransferId);
+	flashBlue = true;
+	for (uint8_t i = 0; i < fragmentCount; i++) {
+		size_t fragmentLen = FragmentBuffer::buildFragment (fragment, data, len, fragmentTransferId, i, payloadEncoding);
+		if (i) {
+			delay (FRAGMENT_SEND_INTERVAL);
+		}
+		if (!dataMessage (fragment, fragmentLen, false, true, FRAGMENT)) {
+			DEBUG_WARN ("Error sending fragment %u", i);
+			return false;
+		}
+	}
+	return true;
+}
+
+bool EnigmaIOTNodeClass::batchData (const uint8_t* data, size_t len, nodePayloadEncoding_t payloadEncoding) {
+	/*
+	* ------------------------------------------------------
+	*| age (2) | encoding (1) | length (1) | Data (....) | ...
+	* ------------------------------------------------------
+	* While reading is on batch buffer age field stores time since batch start. It is converted to age when batch is sent
+	*/
+
+	if (!batchMaxDelay) {
+		return sendData (data, len, payloadEncoding);
+	}
+	if (!data) {
+		return false;
+	}
+	if (len + BATCH_RECORD_HEADER_LENGTH > MAX_DATA_PAYLOAD_SIZE) {
+		DEBUG_WARN ("Data too long to be batched. Sending it now");
+		return sendData (data, len, payloadEncoding);
+	}
+	if (rtcmem_data.batchLength + BATCH_RECORD_HEADER_LENGTH + len > MAX_DATA_PAYLOAD_SIZE) {
+		if (!flushBatch ()) {
+			return false;
+		}
+	}
+
+	uint32_t now = batchClock ();
+	if (!rtcmem_data.batchLength) {
+		rtcmem_data.batchStart = now;
+	}
+	uint32_t offset = (now - rtcmem_data.batchStart) / BATCH_AGE_RESOLUTION;
+	if (offset > 0xFFFF) {
+		offset = 0xFFFF;
+	}
+
+	uint8_t* record = rtcmem_data.batchBuffer + rtcmem_data.batchLength;
+	uint16_t offset16 = offset;
+	memcpy (record, &offset16, sizeof (uint16_t));
+	record[2] = (uint8_t)payloadEncoding;
+	record[3] = len;
+	memcpy (record + BATCH_RECORD_HEADER_LENGTH, data, len);
+	rtcmem_data.batchLength += BATCH_RECORD_HEADER_LENGTH + len;
+	DEBUG_DBG ("Reading batched. Batch length: %u", rtcmem_data.batchLength);
+
+	if (rtcmem_data.batchLength + BATCH_RECORD_HEADER_LENGTH >= MAX_DATA_PAYLOAD_SIZE) { // No room for more readings
+		return flushBatch ();
+	}
+	return true;
+}
+
+bool EnigmaIOTNodeClass::flushBatch () {
+	uint8_t buffer[MAX_DATA_PAYLOAD_SIZE];
+	uint8_t length = rtcmem_data.batchLength;
+
+	if (!length) {
+		return true;
+	}
+	if (!(node.getStatus () == REGISTERED && node.isKeyValid ())) {
+		return false; // Keep readings until node is registered
+	}
+
+	// Convert time since batch start to age
+	uint32_t elapsed = (batchClock () - rtcmem_data.batchStart) / BATCH_AGE_RESOLUTION;
+	memcpy (buffer, rtcmem_data.batchBuffer, length);
+	for (uint8_t idx = 0; idx + BATCH_RECORD_HEADER_LENGTH <= length; idx += BATCH_RECORD_HEADER_LENGTH + buffer[idx + 3]) {
+		uint16_t offset;
+		memcpy (&offset, buffer + idx, sizeof (uint16_t));
+		uint32_t age = elapsed > offset ? elapsed - offset : 0; // Clock may go back if node was restarted without sleeping
+		uint16_t age16 = age > 0xFFFF ? 0xFFFF : age;
+		memcpy (buffer + idx, &age16, sizeof (uint16_t));
+	}
+
+	DEBUG_INFO ("Sending batch. Length: %u", length);
+	rtcmem_data.batchLength = 0;
+	if (!sendData (buffer, length, false, true, BATCH)) {
+		DEBUG_WARN ("Error sending batch");
+		return false; // Data is kept for retransmission as any other data message
+	}
+	return true;
+}
+
 void EnigmaIOTNodeClass::sleep () {
 	if (node.getSleepy ()) {
 		DEBUG_DBG ("Sleep programmed for %lu ms", rtcmem_data.sleepTime * 1000);
@@ -1566,6 +2308,32 @@ void EnigmaIOTNodeClass::sleep () {
 	}
 }
 
+uint16_t EnigmaIOTNodeClass::nextUplinkCounter (bool control) {
+	uint16_t counter;
+
+	if (!useCounter) {
+		return (uint16_t)(Crypto.random ());
+	}
+	if (control) {
+		counter = node.getLastControlCounter () + 1;
+		if (!counter) {
+			rtcmem_data.controlCounterEpoch++;
+			DEBUG_INFO ("Control counter epoch %u", rtcmem_data.controlCounterEpoch);
+		}
+		node.setLastControlCounter (counter);
+		rtcmem_data.lastControlCounter = counter;
+	} else {
+		counter = node.getLastMessageCounter () + 1;
+		if (!counter) {
+			rtcmem_data.messageCounterEpoch++;
+			DEBUG_INFO ("Data counter epoch %u", rtcmem_data.messageCounterEpoch);
+		}
+		node.setLastMessageCounter (counter);
+		rtcmem_data.lastMessageCounter = counter;
+	}
+	return counter;
+}
+
 bool EnigmaIOTNodeClass::unencryptedDataMessage (const uint8_t* data, size_t len, bool controlMessage, nodePayloadEncoding_t payloadEncoding) {
 	/*
 	* ------------------------------------------------------------------------
@@ -1596,13 +2364,7 @@ bool EnigmaIOTNodeClass::unencryptedDataMessage (const uint8_t* data, size_t len
 
 	memcpy (buf + nodeId_idx, &nodeId, sizeof (uint16_t));
 
-	if (useCounter) {
-		counter = node.getLastMessageCounter () + 1;
-		node.setLastMessageCounter (counter);
-		rtcmem_data.lastMessageCounter = counter;
-	} else {
-		counter = (uint16_t)(Crypto.random ());
-	}
+	counter = nextUplinkCounter (false);
 	memcpy (buf + counter_idx, &counter, sizeof (uint16_t));
 
 	buf[encoding_idx] = (uint8_t)payloadEncoding;
@@ -1610,7 +2372,10 @@ bool EnigmaIOTNodeClass::unencryptedDataMessage (const uint8_t* data, size_t len
 	memcpy (buf + data_idx, data, len);
 
 	DEBUG_INFO (" -------> UNENCRYPTED DATA");
-	DEBUG_VERBOSE ("Unencrypted data message: %s", printHexBuffer (buf, packet_length));
+
+	downlinkWindowCounter = counter;
+	downlinkWindowClosed = false;
+	DEBUG_VERBOSE ("Unencrypted data message: %s", DEBUG_HEX (buf, packet_length));
 
 #if DEBUG_LEVEL >= VERBOSE
 	char macStr[ENIGMAIOT_ADDR_LEN * 3];
@@ -1670,27 +2435,11 @@ bool EnigmaIOTNodeClass::dataMessage (const uint8_t* data, size_t len, bool cont
 
 	CryptModule::random (buf + iv_idx, IV_LENGTH);
 
-	DEBUG_VERBOSE ("IV: %s", printHexBuffer (buf + iv_idx, IV_LENGTH));
+	DEBUG_VERBOSE ("IV: %s", DEBUG_HEX (buf + iv_idx, IV_LENGTH));
 
 	memcpy (buf + nodeId_idx, &nodeId, sizeof (uint16_t));
 
-	if (!controlMessage) { // Control messages and data messages use different counters
-		if (useCounter) {
-			counter = node.getLastMessageCounter () + 1;
-			node.setLastMessageCounter (counter);
-			rtcmem_data.lastMessageCounter = counter;
-		} else {
-			counter = (uint16_t)(Crypto.random ());
-		}
-	} else {
-		if (useCounter) {
-			counter = node.getLastControlCounter () + 1;
-			node.setLastControlCounter (counter);
-			rtcmem_data.lastControlCounter = counter;
-		} else {
-			counter = (uint16_t)(Crypto.random ());
-		}
-	}
+	counter = nextUplinkCounter (controlMessage); // Control messages and data messages use different counters
 
 	if (!controlMessage) {
 		DEBUG_INFO ("Data message #%d", counter);
@@ -1708,7 +2457,7 @@ bool EnigmaIOTNodeClass::dataMessage (const uint8_t* data, size_t len, bool cont
 
 	memcpy (buf + length_idx, &packet_length, sizeof (uint16_t));
 
-	DEBUG_VERBOSE ("Data message: %s", printHexBuffer (buf, packet_length));
+	DEBUG_VERBOSE ("Data message: %s", DEBUG_HEX (buf, packet_length));
 	DEBUG_DBG ("Encoding: 0x%02X", payloadEncoding);
 
 	uint8_t* crypt_buf = buf + length_idx;
@@ -1722,21 +2471,25 @@ bool EnigmaIOTNodeClass::dataMessage (const uint8_t* data, size_t len, bool cont
 
 	// Copy 8 last bytes from Node Key
 	memcpy (aad + addDataLen, node.getEncriptionKey () + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH);
+	bindCounterEpoch (aad, sizeof (aad), controlMessage ? rtcmem_data.controlCounterEpoch : rtcmem_data.messageCounterEpoch);
 
 	if (!CryptModule::encryptBuffer (crypt_buf, cryptLen, // Encrypt from length
 									 buf + iv_idx, IV_LENGTH,
 									 node.getEncriptionKey (), KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of node key
-									 aad, sizeof (aad), buf + tag_idx, TAG_LENGTH)) {
+									 aad, sizeof (aad), buf + tag_idx, TAG_LENGTH, node.getCipherAlgorithm ())) {
 		DEBUG_ERROR ("Error during encryption");
 		return false;
 	}
 
-	DEBUG_VERBOSE ("Encrypted data message: %s", printHexBuffer (buf, packet_length + TAG_LENGTH));
+	DEBUG_VERBOSE ("Encrypted data message: %s", DEBUG_HEX (buf, packet_length + TAG_LENGTH));
 
 	if (controlMessage) {
 		DEBUG_INFO (" -------> CONTROL MESSAGE");
+		// Control messages are answers to queued commands. Downlink Empty for last data message is still expected
 	} else {
 		DEBUG_INFO (" -------> DATA");
+		downlinkWindowCounter = counter;
+		downlinkWindowClosed = false;
 	}
 #if DEBUG_LEVEL >= VERBOSE
 	char macStr[ENIGMAIOT_ADDR_LEN * 3];
@@ -1757,7 +2510,7 @@ bool EnigmaIOTNodeClass::processGetSleepTimeCommand (const uint8_t* mac, const u
 	uint8_t bufLength;
 
 	DEBUG_DBG ("Get Sleep command received");
-	DEBUG_VERBOSE ("%s", printHexBuffer (data, len));
+	DEBUG_VERBOSE ("%s", DEBUG_HEX (data, len));
 
 	buffer[0] = control_message_type::SLEEP_ANS;
 
@@ -1767,7 +2520,7 @@ bool EnigmaIOTNodeClass::processGetSleepTimeCommand (const uint8_t* mac, const u
 
 	if (sendData (buffer, bufLength, true)) {
 		DEBUG_DBG ("Sleep time is %d seconds", sleepTime);
-		DEBUG_VERBOSE ("Data: %s", printHexBuffer (buffer, bufLength));
+		DEBUG_VERBOSE ("Data: %s", DEBUG_HEX (buffer, bufLength));
 		return true;
 	} else {
 		DEBUG_WARN ("Error sending version response");
@@ -1780,7 +2533,7 @@ bool EnigmaIOTNodeClass::processGetNameCommand (const uint8_t* mac, const uint8_
 	uint8_t bufLength;
 
 	DEBUG_DBG ("Get Name command received");
-	DEBUG_VERBOSE ("%s", printHexBuffer (data, len));
+	DEBUG_VERBOSE ("%s", DEBUG_HEX (data, len));
 
 	buffer[0] = control_message_type::NAME_ANS;
 
@@ -1801,7 +2554,7 @@ bool EnigmaIOTNodeClass::processGetNameCommand (const uint8_t* mac, const uint8_
 
 	if (sendData (buffer, bufLength, true)) {
 		DEBUG_DBG ("Node name is %s", name ? name : "NULL name");
-		DEBUG_VERBOSE ("Data: %s", printHexBuffer (buffer, bufLength));
+		DEBUG_VERBOSE ("Data: %s", DEBUG_HEX (buffer, bufLength));
 		return true;
 	} else {
 		DEBUG_WARN ("Error sending name response");
@@ -1844,12 +2597,12 @@ bool EnigmaIOTNodeClass::processSetNameResponse (const uint8_t* mac, const uint8
 	if (!CryptModule::decryptBuffer ((uint8_t*)&(nodeNameSetResponse_msg.errorCode), sizeof (uint8_t),
 									 nodeNameSetResponse_msg.iv, IV_LENGTH,
 									 node.getEncriptionKey (), KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of network key
-									 aad, sizeof (aad), nodeNameSetResponse_msg.tag, TAG_LENGTH)) {
+									 aad, sizeof (aad), nodeNameSetResponse_msg.tag, TAG_LENGTH, node.getCipherAlgorithm ())) {
 		DEBUG_ERROR ("Error during decryption");
 		return false;
 	}
 
-	DEBUG_VERBOSE ("Decrypted Node Name Set response message: %s", printHexBuffer ((uint8_t*)&nodeNameSetResponse_msg, NNSRMSG_LEN - TAG_LENGTH));
+	DEBUG_VERBOSE ("Decrypted Node Name Set response message: %s", DEBUG_HEX ((uint8_t*)&nodeNameSetResponse_msg, NNSRMSG_LEN - TAG_LENGTH));
 
 	memcpy (&counter, &(nodeNameSetResponse_msg.counter), sizeof (uint16_t));
 	DEBUG_INFO ("Downlink msg #%d", counter);
@@ -1884,7 +2637,7 @@ bool EnigmaIOTNodeClass::processSetNameCommand (const uint8_t* mac, const uint8_
 	uint8_t bufLength;
 
 	DEBUG_DBG ("Set Name command received");
-	DEBUG_VERBOSE ("%s", printHexBuffer (data, len));
+	DEBUG_VERBOSE ("%s", DEBUG_HEX (data, len));
 
 	buffer[0] = control_message_type::NAME_ANS;
 
@@ -1908,7 +2661,7 @@ bool EnigmaIOTNodeClass::processSetNameCommand (const uint8_t* mac, const uint8_
 
 	if (sendData (buffer, bufLength, true)) {
 		DEBUG_DBG ("Node name is %s", rtcmem_data.nodeName);
-		DEBUG_VERBOSE ("Data: %s", printHexBuffer (buffer, bufLength));
+		DEBUG_VERBOSE ("Data: %s", DEBUG_HEX (buffer, bufLength));
 		return true;
 	} else {
 		DEBUG_WARN ("Error sending name response");
@@ -1952,15 +2705,9 @@ bool EnigmaIOTNodeClass::sendNodeNameSet (const char* name) {
 
 	CryptModule::random (buf + iv_idx, IV_LENGTH);
 
-	DEBUG_VERBOSE ("IV: %s", printHexBuffer (buf + iv_idx, IV_LENGTH));
+	DEBUG_VERBOSE ("IV: %s", DEBUG_HEX (buf + iv_idx, IV_LENGTH));
 
-	if (useCounter) {
-		counter = node.getLastControlCounter () + 1;
-		node.setLastControlCounter (counter);
-		rtcmem_data.lastControlCounter = counter;
-	} else {
-		counter = (uint16_t)(Crypto.random ());
-	}
+	counter = nextUplinkCounter (true);
 
 	DEBUG_INFO ("Control message #%d", counter);
 
@@ -1970,7 +2717,7 @@ bool EnigmaIOTNodeClass::sendNodeNameSet (const char* name) {
 
 	memcpy (buf + nodeName_idx, name, nameLength);
 
-	DEBUG_VERBOSE ("Set node name message: %s", printHexBuffer (buf, packet_length));
+	DEBUG_VERBOSE ("Set node name message: %s", DEBUG_HEX (buf, packet_length));
 
 	uint8_t* crypt_buf = buf + nodeId_idx;
 
@@ -1983,16 +2730,17 @@ bool EnigmaIOTNodeClass::sendNodeNameSet (const char* name) {
 
 	// Copy 8 last bytes from Node Key
 	memcpy (aad + addDataLen, node.getEncriptionKey () + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH);
+	bindCounterEpoch (aad, sizeof (aad), rtcmem_data.controlCounterEpoch);
 
 	if (!CryptModule::encryptBuffer (crypt_buf, cryptLen, // Encrypt from length
 									 buf + iv_idx, IV_LENGTH,
 									 node.getEncriptionKey (), KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of node key
-									 aad, sizeof (aad), buf + tag_idx, TAG_LENGTH)) {
+									 aad, sizeof (aad), buf + tag_idx, TAG_LENGTH, node.getCipherAlgorithm ())) {
 		DEBUG_ERROR ("Error during encryption");
 		return false;
 	}
 
-	DEBUG_VERBOSE ("Encrypted set node name message: %s", printHexBuffer (buf, packet_length + TAG_LENGTH));
+	DEBUG_VERBOSE ("Encrypted set node name message: %s", DEBUG_HEX (buf, packet_length + TAG_LENGTH));
 
 #if DEBUG_LEVEL >= VERBOSE
 	char macStr[ENIGMAIOT_ADDR_LEN * 3];
@@ -2018,7 +2766,7 @@ bool EnigmaIOTNodeClass::processSetIdentifyCommand (const uint8_t* mac, const ui
 	//uint8_t bufLength;
 
 	DEBUG_DBG ("Set Identify command received");
-	DEBUG_VERBOSE ("%s", printHexBuffer (data, len));
+	DEBUG_VERBOSE ("%s", DEBUG_HEX (data, len));
 
 	DEBUG_WARN ("IDENTIFY");
 	startIdentifying (1000);
@@ -2028,6 +2776,7 @@ bool EnigmaIOTNodeClass::processSetIdentifyCommand (const uint8_t* mac, const ui
 
 bool EnigmaIOTNodeClass::processGetRSSICommand (const uint8_t* mac, const uint8_t* data, uint8_t len) {
 	requestSearchGateway = true;
+	fullScanRequested = true; // Probing does not measure RSSI
 	requestReportRSSI = true;
 
 	return true;
@@ -2044,7 +2793,7 @@ bool EnigmaIOTNodeClass::processSetResetConfigCommand (const uint8_t* mac, const
 	uint8_t bufLength;
 
 	DEBUG_DBG ("Reset Config command received");
-	DEBUG_VERBOSE ("%s", printHexBuffer (data, len));
+	DEBUG_VERBOSE ("%s", DEBUG_HEX (data, len));
 
 	buffer[0] = control_message_type::RESET_ANS;
 	bufLength = 1;
@@ -2055,7 +2804,7 @@ bool EnigmaIOTNodeClass::processSetResetConfigCommand (const uint8_t* mac, const
 
 	if ((result = sendData (buffer, bufLength, true))) {
 		DEBUG_DBG ("Reset Config about to be executed", sleepTime);
-		DEBUG_VERBOSE ("Data: %s", printHexBuffer (buffer, bufLength));
+		DEBUG_VERBOSE ("Data: %s", DEBUG_HEX (buffer, bufLength));
 	} else {
 		DEBUG_WARN ("Error sending Reset Config response");
 	}
@@ -2091,7 +2840,10 @@ void EnigmaIOTNodeClass::clearRTC () {
 #if USE_FLASH_INSTEAD_RTC
     FILESYSTEM.begin ();
     FILESYSTEM.remove (RTC_DATA_FILE);
+    FILESYSTEM.remove (RTC_JOURNAL_FILE);
+    FILESYSTEM.remove (RTC_TMP_FILE);
     FILESYSTEM.end ();
+	savedRtcDataValid = false;
 #endif
 
 	DEBUG_DBG ("RTC Cleared");
@@ -2102,7 +2854,7 @@ bool EnigmaIOTNodeClass::processSetSleepTimeCommand (const uint8_t* mac, const u
 	uint8_t bufLength;
 
 	DEBUG_DBG ("Set Sleep command received");
-	DEBUG_VERBOSE ("%s", printHexBuffer (data, len));
+	DEBUG_VERBOSE ("%s", DEBUG_HEX (data, len));
     if (!FILESYSTEM.begin ()) {
 		DEBUG_ERROR ("Error mounting flash");
 	}
@@ -2133,7 +2885,7 @@ bool EnigmaIOTNodeClass::processSetSleepTimeCommand (const uint8_t* mac, const u
 
 	if (sendData (buffer, bufLength, true)) {
 		DEBUG_DBG ("Sleep time is %d seconds", sleepTime);
-		DEBUG_VERBOSE ("Data: %s", printHexBuffer (buffer, bufLength));
+		DEBUG_VERBOSE ("Data: %s", DEBUG_HEX (buffer, bufLength));
 		return result;
 	} else {
 		DEBUG_WARN ("Error sending version response");
@@ -2152,7 +2904,7 @@ bool EnigmaIOTNodeClass::processVersionCommand (const uint8_t* mac, const uint8_
 	DEBUG_DBG ("Version command received");
 	if (sendData (buffer, bufLength, true)) {
 		DEBUG_DBG ("Version is %s", ENIGMAIOT_PROT_VERS);
-		DEBUG_VERBOSE ("Data: %s", printHexBuffer (buffer, bufLength));
+		DEBUG_VERBOSE ("Data: %s", DEBUG_HEX (buffer, bufLength));
 		return true;
 	} else {
 		DEBUG_WARN ("Error sending version response");
@@ -2160,12 +2912,44 @@ bool EnigmaIOTNodeClass::processVersionCommand (const uint8_t* mac, const uint8_
 	}
 }
 
-bool EnigmaIOTNodeClass::processOTACommand (const uint8_t* mac, const uint8_t* data, uint8_t len) {
+bool EnigmaIOTNodeClass::sendOTAack () {
+	/*
+	* ------------------------------------------------------------------
+	*| msgType (1) | status (1) | next chunk (2) | received bitmap (4) |
+	* ------------------------------------------------------------------
+	*/
+	uint8_t responseBuffer[8];
+
+	responseBuffer[0] = control_message_type::OTA_ANS;
+	responseBuffer[1] = ota_status::OTA_ACK;
+	memcpy (responseBuffer + 2, &otaNextChunk, sizeof (uint16_t));
+	memcpy (responseBuffer + 4, &otaReceived, sizeof (uint32_t));
+	otaChunksSinceAck = 0;
+	lastOTAack = millis ();
+	if (otaMulticast) {
+		otaAckJitter = Crypto.random (OTA_ACK_TIMEOUT);
+	}
+	DEBUG_INFO ("OTA ack. Next chunk %u. Received 0x%08X", otaNextChunk, otaReceived);
+	return sendData (responseBuffer, sizeof (responseBuffer), true);
+}
+
+void EnigmaIOTNodeClass::freeOTAwindow () {
+	if (otaWindowBuffer) {
+		free (otaWindowBuffer);
+		otaWindowBuffer = NULL;
+	}
+	otaWindow = 0;
+	otaMulticast = false;
+	otaAckJitter = 0;
+}
+
+bool EnigmaIOTNodeClass::processOTACommand (const uint8_t* mac, const uint8_t* data, uint8_t len, bool broadcast) {
 	const uint8_t MAX_OTA_RESPONSE_LENGTH = 4;
+	const uint8_t OTA_START_LENGTH = 38; // size (4) + number of chunks (2) + MD5 (32)
 
 	uint8_t responseBuffer[MAX_OTA_RESPONSE_LENGTH];
 
-	//DEBUG_VERBOSE ("Data: %s", printHexBuffer (data, len));
+	//DEBUG_VERBOSE ("Data: %s", DEBUG_HEX (data, len));
 	uint16_t msgIdx;
 	static char md5buffer[33];
 	char md5calc[32];
@@ -2174,8 +2958,21 @@ bool EnigmaIOTNodeClass::processOTACommand (const uint8_t* mac, const uint8_t* d
 	static uint16_t oldIdx;
 	static bool otaRecoverRequested = false;
 	static MD5Builder _md5;
+	static size_t totalBytes = 0;
 	uint8_t* dataPtr = (uint8_t*)(data + 1);
 	uint8_t dataLen = len - 1;
+	bool otaComplete;
+
+	auto writeChunk = [&](const uint8_t* chunk, uint8_t chunkLen) {
+		_md5.add (const_cast<uint8_t*>(chunk), chunkLen);
+		// Process OTA Update
+#if DEBUG_LEVEL >= INFO
+		size_t numBytes =
+#endif
+			Update.write (const_cast<uint8_t*>(chunk), chunkLen);
+		totalBytes += chunkLen;
+		DEBUG_INFO ("%u bytes written. Total %u", numBytes, totalBytes);
+	};
 
 	if (dataLen < 2) {
 		DEBUG_ERROR ("OTA message is too short: %u bytes", dataLen + 1);
@@ -2185,8 +2982,12 @@ bool EnigmaIOTNodeClass::processOTACommand (const uint8_t* mac, const uint8_t* d
 	memcpy (&msgIdx, dataPtr, sizeof (uint16_t));
 	dataPtr += sizeof (uint16_t);
 	dataLen -= sizeof (uint16_t);
-	DEBUG_INFO ("OTA message #%u", msgIdx);
-	if (msgIdx > 0 && otaRunning) {
+	DEBUG_INFO ("%s OTA message #%u", broadcast ? "Broadcast" : "Unicast", msgIdx);
+	if (broadcast && msgIdx > 0 && !otaMulticast) {
+		DEBUG_DBG ("Multicast OTA not started on this node. Ignored");
+		return true;
+	}
+	if (msgIdx > 0 && otaRunning && !otaWindow) {
 		if (msgIdx != (oldIdx + 1)) {
 			if (!otaRecoverRequested) {
 				otaRecoverRequested = true;
@@ -2207,7 +3008,7 @@ bool EnigmaIOTNodeClass::processOTACommand (const uint8_t* mac, const uint8_t* d
 	lastOTAmsg = millis ();
 
 	if (msgIdx == 0) {
-		if (dataLen < 38) {
+		if (dataLen < OTA_START_LENGTH) {
 			DEBUG_ERROR ("OTA message #0 is too short: %u bytes", dataLen + 3);
 			return false;
 		}
@@ -2221,13 +3022,45 @@ bool EnigmaIOTNodeClass::processOTACommand (const uint8_t* mac, const uint8_t* d
 		dataLen -= sizeof (uint16_t);
 		memcpy (md5buffer, dataPtr, 32);
 		md5buffer[32] = '\0';
-		DEBUG_VERBOSE ("MD5: %s", printHexBuffer ((uint8_t*)md5buffer, 32));
+		DEBUG_VERBOSE ("MD5: %s", DEBUG_HEX ((uint8_t*)md5buffer, 32));
+		dataPtr += 32;
+		dataLen -= 32;
+		// Windowed OTA is requested by an additional byte with maximum window size.
+		// Answer carries accepted window, absent or 0 means sequential OTA
+		freeOTAwindow ();
+		if (dataLen >= 1 && dataPtr[0] > 1) {
+			otaWindow = dataPtr[0] < OTA_WINDOW_SIZE ? dataPtr[0] : OTA_WINDOW_SIZE;
+			otaWindowBuffer = (uint8_t*)malloc (otaWindow * MAX_DATA_PAYLOAD_SIZE);
+			if (!otaWindowBuffer) {
+				DEBUG_WARN ("Not enough memory for windowed OTA");
+				otaWindow = 0;
+			}
+		}
+		if (broadcast) {
+			if (!otaWindow) { // Sequential OTA cannot work with many nodes
+				responseBuffer[0] = control_message_type::OTA_ANS;
+				responseBuffer[1] = ota_status::OTA_START_ERROR;
+				sendData (responseBuffer, 2, true);
+				DEBUG_ERROR ("Multicast OTA needs windowed mode");
+				return true;
+			}
+			otaMulticast = true;
+			otaAckJitter = Crypto.random (OTA_ACK_TIMEOUT);
+		}
+		oldIdx = 0;
+		otaNextChunk = 1;
+		otaReceived = 0;
+		otaChunksSinceAck = 0;
+		lastOTAack = millis ();
+		totalBytes = 0;
 		otaRunning = true;
 		otaError = false;
 		_md5.begin ();
 		responseBuffer[0] = control_message_type::OTA_ANS;
 		responseBuffer[1] = ota_status::OTA_STARTED;
-		if (sendData (responseBuffer, 2, true)) {
+		responseBuffer[2] = otaWindow;
+		DEBUG_INFO ("OTA window: %u chunks", otaWindow);
+		if (sendData (responseBuffer, 3, true)) {
 			DEBUG_WARN ("OTA STARTED");
 			restart (IRRELEVANT, false); // Force unregistration after boot so that sleepy status is synchronized
 							 // on Gateway
@@ -2244,18 +3077,54 @@ bool EnigmaIOTNodeClass::processOTACommand (const uint8_t* mac, const uint8_t* d
 			}
 		}
 	} else {
-		if (otaRunning) {
-			static size_t totalBytes = 0;
-
-			_md5.add (dataPtr, dataLen);
-			// Process OTA Update
-#if DEBUG_LEVEL >= INFO
-			size_t numBytes = 
-#endif
-                Update.write (dataPtr, dataLen);
-			totalBytes += dataLen;
-			DEBUG_INFO ("%u bytes written. Total %u", numBytes, totalBytes);
-		} else {
+		if (otaRunning && otaWindow) {
+			if (msgIdx < otaNextChunk) { // Retransmitted chunk was already written
+				DEBUG_DBG ("OTA chunk %u duplicated", msgIdx);
+				return true;
+			}
+			if (msgIdx >= otaNextChunk + otaWindow || msgIdx > numMsgs || dataLen > MAX_DATA_PAYLOAD_SIZE) {
+				DEBUG_WARN ("OTA chunk %u out of window", msgIdx);
+				// On multicast, stream goes on regardless of this node. Do not send a repair request per chunk
+				if (!otaMulticast || millis () - lastOTAack > OTA_NAK_HOLDOFF) {
+					sendOTAack ();
+				}
+				return true;
+			}
+			if (msgIdx == otaNextChunk) {
+				// Write this chunk and all contiguous ones that were waiting on buffer
+				writeChunk (dataPtr, dataLen);
+				otaNextChunk++;
+				while (otaReceived & 1) {
+					uint8_t slot = otaNextChunk % otaWindow;
+					writeChunk (otaWindowBuffer + slot * MAX_DATA_PAYLOAD_SIZE, otaChunkLength[slot]);
+					otaReceived >>= 1;
+					otaNextChunk++;
+				}
+				otaReceived >>= 1;
+			} else {
+				uint32_t bit = 1UL << (msgIdx - otaNextChunk - 1);
+				uint16_t highest = otaReceived ? otaNextChunk + 32 - __builtin_clz (otaReceived) : otaNextChunk - 1;
+				bool gap = msgIdx > highest + 1;
+
+				if (!(otaReceived & bit)) {
+					uint8_t slot = msgIdx % otaWindow;
+					memcpy (otaWindowBuffer + slot * MAX_DATA_PAYLOAD_SIZE, dataPtr, dataLen);
+					otaChunkLength[slot] = dataLen;
+					otaReceived |= bit;
+				}
+				if (gap) { // Some chunks before this one were lost. Report it so that sender retransmits them soon
+					otaChunksSinceAck++;
+					sendOTAack ();
+					return true;
+				}
+			}
+			otaChunksSinceAck++;
+			if (!otaMulticast && otaNextChunk <= numMsgs && otaChunksSinceAck >= otaWindow / 2) {
+				sendOTAack ();
+			}
+		} else if (otaRunning) {
+			writeChunk (dataPtr, dataLen);
+		} else if (!broadcast) {
 			if (!otaError) {
 				otaError = true;
 				responseBuffer[0] = control_message_type::OTA_ANS;
@@ -2266,9 +3135,17 @@ bool EnigmaIOTNodeClass::processOTACommand (const uint8_t* mac, const uint8_t* d
 		}
 	}
 
-	if (msgIdx == numMsgs && otaRunning) {
+	if (otaWindow) {
+		otaComplete = msgIdx > 0 && otaNextChunk > numMsgs;
+	} else {
+		otaComplete = msgIdx == numMsgs;
+	}
+
+	if (otaComplete && otaRunning) {
 		StreamString otaErrorStr;
 
+		freeOTAwindow ();
+
 		DEBUG_INFO ("OTA end");
 		_md5.calculate ();
 		DEBUG_DBG ("OTA MD5 %s", _md5.toString ().c_str ());
@@ -2345,7 +3222,7 @@ void EnigmaIOTNodeClass::restart (restartReason_t reason, bool reboot) {
 
 bool EnigmaIOTNodeClass::processControlCommand (const uint8_t* mac, const uint8_t* data, size_t len, bool broadcast) {
 
-	DEBUG_VERBOSE ("Data: %s", printHexBuffer (data, len));
+	DEBUG_VERBOSE ("Data: %s", DEBUG_HEX (data, len));
 	DEBUG_DBG ("%s control command", broadcast ? "Broadcast" : "Unicast");
 	switch (data[0]) {
 	case control_message_type::VERSION:
@@ -2371,14 +3248,34 @@ bool EnigmaIOTNodeClass::processControlCommand (const uint8_t* mac, const uint8_
 		return processSetRestartCommand (mac, data, len);
 	case control_message_type::BRCAST_KEY:
 		return processBroadcastKeyMessage (mac, data, len);
+	case control_message_type::GROUP_KEY:
+		if (!broadcast) {
+			return processGroupKeyMessage (mac, data, len);
+		}
+		break;
+	case control_message_type::SESSION_TICKET:
+		if (!broadcast) {
+			return processSessionTicketMessage (mac, data, len);
+		}
+		break;
+	case control_message_type::SCHEMA_GET:
+		if (!broadcast) {
+			return processSchemaRequest (mac, data, len);
+		}
+		break;
+#if ENABLE_LINK_ADAPTATION
+	case control_message_type::TX_POWER_SET:
+		if (!broadcast) {
+			return processTxPowerCommand (mac, data, len);
+		}
+		break;
+#endif // ENABLE_LINK_ADAPTATION
 	case control_message_type::OTA:
-		if (!broadcast) { // DO NOT PROCESS BROADCAST OTA MESSAGES
-			if (processOTACommand (mac, data, len)) {
-				return true;
-			} else {
-				DEBUG_ERROR ("Error processing OTA");
-				restart (OTA_ERROR_RESTART);
-			}
+		if (processOTACommand (mac, data, len, broadcast)) {
+			return true;
+		} else {
+			DEBUG_ERROR ("Error processing OTA");
+			restart (OTA_ERROR_RESTART);
 		}
 		break;
 	}
@@ -2393,7 +3290,7 @@ bool EnigmaIOTNodeClass::processBroadcastKeyMessage (const uint8_t* mac, const u
 
 	int broadcastKey_idx = 1;
 
-	DEBUG_VERBOSE ("Broadcast key: %s", printHexBuffer (&buf[broadcastKey_idx], KEY_LENGTH));
+	DEBUG_VERBOSE ("Broadcast key: %s", DEBUG_HEX (&buf[broadcastKey_idx], KEY_LENGTH));
 
 	memcpy (rtcmem_data.broadcastKey, &buf[broadcastKey_idx], KEY_LENGTH);
 	rtcmem_data.broadcastKeyRequested = false;
@@ -2402,19 +3299,236 @@ bool EnigmaIOTNodeClass::processBroadcastKeyMessage (const uint8_t* mac, const u
 	return true;
 }
 
+bool EnigmaIOTNodeClass::setDataSchema (const schema_field_t* fields, uint8_t count) {
+	// Schema is not sent here. A sleepy node sets it on every wake up and gateway still keeps it from previous ones.
+	// It is sent after registration and gateway asks for it if it does not know schema id
+	return dataSchema.setSchema (fields, count);
+}
+
+bool EnigmaIOTNodeClass::sendSchemaDefinition () {
+	uint8_t buffer[SCHEMA_MAX_DEFINITION_LENGTH];
+	size_t len = dataSchema.buildDefinition (buffer, sizeof (buffer));
+
+	if (!len) {
+		return false;
+	}
+	DEBUG_DBG ("Send schema 0x%04X", dataSchema.getSchemaId ());
+	if (!sendData (buffer, len, false, true, SCHEMA_DEF)) {
+		return false;
+	}
+	schemaDefinitionPending = false;
+	return true;
+}
+
+bool EnigmaIOTNodeClass::sendSchemaData (const float* values) {
+	size_t maxLength;
+	uint8_t* buffer;
+	size_t len;
+
+	if (!dataSchema.isSet ()) {
+		DEBUG_WARN ("Schema is not set");
+		return false;
+	}
+	if (schemaDefinitionPending && !sendSchemaDefinition ()) {
+		DEBUG_WARN ("Error sending schema");
+		return false;
+	}
+	buffer = getPayloadBuffer (maxLength);
+	len = dataSchema.encode (values, buffer, maxLength);
+	if (!len) {
+		return false;
+	}
+	return sendData (buffer, len, false, true, SCHEMA_DATA);
+}
+
+bool EnigmaIOTNodeClass::processSchemaRequest (const uint8_t* mac, const uint8_t* buf, size_t count) {
+	DEBUG_DBG ("Schema request received");
+	if (!dataSchema.isSet ()) {
+		DEBUG_WARN ("Schema is not set");
+		return false;
+	}
+	dataSchema.forceKeyFrame ();
+	return sendSchemaDefinition ();
+}
+
+#if ENABLE_LINK_ADAPTATION
+bool EnigmaIOTNodeClass::processTxPowerCommand (const uint8_t* mac, const uint8_t* buf, size_t count) {
+	if (count < 2) {
+		DEBUG_WARN ("Wrong TX power message");
+		return false;
+	}
+	return updateTxPower (buf[1]);
+}
+
+bool EnigmaIOTNodeClass::updateTxPower (uint8_t reduction) {
+	if (reduction > LINK_ADAPTATION_MAX_REDUCTION) {
+		DEBUG_WARN ("Wrong TX power reduction: %u dB", reduction);
+		return false;
+	}
+	if (reduction == rtcmem_data.txPowerReduction) {
+		return true;
+	}
+	DEBUG_DBG ("TX power reduction changed to %u dB", reduction);
+	rtcmem_data.txPowerReduction = reduction;
+	setTxPowerReduction (reduction);
+	if (!saveRTCData ()) {
+		DEBUG_ERROR ("Error saving data on RTC");
+	}
+	return true;
+}
+#endif // ENABLE_LINK_ADAPTATION
+
+void EnigmaIOTNodeClass::loadGroupKeys () {
+	if (groupKeysLoaded) {
+		return;
+	}
+	groupKeysLoaded = true;
+	for (int i = 0; i < MAX_NODE_GROUP_KEYS; i++) {
+		groupKeys[i].group = NO_GROUP;
+		lastGroupMsgCounter[i] = UINT16_MAX; // Group messages are rejected until gateway sends current counter with group key
+	}
+
+    if (!FILESYSTEM.begin ()) {
+		DEBUG_ERROR ("Error mounting flash");
+		return;
+	}
+	if (!FILESYSTEM.exists (GROUP_KEYS_FILE)) {
+		return;
+	}
+	File keysFile = FILESYSTEM.open (GROUP_KEYS_FILE, "r");
+	if (!keysFile) {
+		return;
+	}
+	size_t size = keysFile.read ((uint8_t*)groupKeys, sizeof (groupKeys));
+	keysFile.close ();
+	if (size != sizeof (groupKeys)) {
+		DEBUG_WARN ("Wrong group keys file. %u bytes", size);
+		for (int i = 0; i < MAX_NODE_GROUP_KEYS; i++) {
+			groupKeys[i].group = NO_GROUP;
+		}
+	}
+}
+
+bool EnigmaIOTNodeClass::saveGroupKeys () {
+    if (!FILESYSTEM.begin ()) {
+		DEBUG_ERROR ("Error mounting flash");
+		return false;
+	}
+	File keysFile = FILESYSTEM.open (GROUP_KEYS_FILE, "w");
+	if (!keysFile) {
+		DEBUG_WARN ("failed to open %s for writing", GROUP_KEYS_FILE);
+		return false;
+	}
+	size_t size = keysFile.write ((uint8_t*)groupKeys, sizeof (groupKeys));
+	keysFile.flush ();
+	keysFile.close ();
+	return size == sizeof (groupKeys);
+}
+
+int EnigmaIOTNodeClass::findGroupKey (uint8_t group) {
+	loadGroupKeys ();
+	for (int i = 0; i < MAX_NODE_GROUP_KEYS; i++) {
+		if (groupKeys[i].group == group) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+bool EnigmaIOTNodeClass::processGroupKeyMessage (const uint8_t* mac, const uint8_t* buf, size_t count) {
+	/*
+	* ------------------------------------------------------
+	*| msgType (1) | group (1) | [key (32) | counter (2)] |
+	* ------------------------------------------------------
+	*/
+	if (!buf || (count != 2 && count != 2 + KEY_LENGTH + sizeof (uint16_t)) || buf[1] == NO_GROUP) {
+		DEBUG_WARN ("Invalid group key message. Incorrect length %d", count);
+		return false;
+	}
+
+	uint8_t group = buf[1];
+	int entry = findGroupKey (group);
+
+	if (count == 2) {
+		if (entry < 0) {
+			return true;
+		}
+		DEBUG_INFO ("Left group %u", group);
+		groupKeys[entry].group = NO_GROUP;
+		memset (groupKeys[entry].key, 0, KEY_LENGTH);
+	} else {
+		if (entry < 0) {
+			entry = findGroupKey (NO_GROUP);
+		}
+		if (entry < 0) {
+			DEBUG_WARN ("No room for group %u key", group);
+			return false;
+		}
+		// Key comes with gateway group counter, so that messages sent before a restart cannot be replayed
+		memcpy (&lastGroupMsgCounter[entry], buf + 2 + KEY_LENGTH, sizeof (uint16_t));
+		if (groupKeys[entry].group == group && !memcmp (groupKeys[entry].key, buf + 2, KEY_LENGTH)) {
+			return true; // Same key sent again. Nothing to save
+		}
+		DEBUG_INFO ("Joined group %u", group);
+		groupKeys[entry].group = group;
+		memcpy (groupKeys[entry].key, buf + 2, KEY_LENGTH);
+		DEBUG_VERBOSE ("Group key: %s", DEBUG_HEX (groupKeys[entry].key, KEY_LENGTH));
+	}
+
+	if (!saveGroupKeys ()) {
+		DEBUG_ERROR ("Error saving group keys on flash");
+	}
+	return true;
+}
+
+bool EnigmaIOTNodeClass::processSessionTicketMessage (const uint8_t* mac, const uint8_t* buf, size_t count) {
+	/*
+	* ------------------------------------------------
+	*| msgType (1) | Ticket (16) | Secret (32) |
+	* ------------------------------------------------
+	*/
+	if (!buf || count != SESSION_TICKET_LENGTH + KEY_LENGTH + 1) {
+		DEBUG_WARN ("Invalid session ticket message. Incorrect length %d", count);
+		return false;
+	}
+
+	int ticket_idx = 1;
+	int secret_idx = ticket_idx + SESSION_TICKET_LENGTH;
+
+	DEBUG_VERBOSE ("Session ticket: %s", DEBUG_HEX (&buf[ticket_idx], SESSION_TICKET_LENGTH));
+
+	memcpy (rtcmem_data.sessionTicket, &buf[ticket_idx], SESSION_TICKET_LENGTH);
+	memcpy (rtcmem_data.resumptionSecret, &buf[secret_idx], KEY_LENGTH);
+	rtcmem_data.sessionTicketValid = true;
+
+	// Ticket is stored on flash too so that it survives a power loss. This happens only after a full key agreement
+	if (!saveRTCData ()) {
+		DEBUG_ERROR ("Error saving data on RTC");
+	}
+	if (!saveFlashData ()) {
+		DEBUG_ERROR ("Error saving data on flash");
+	}
+
+	return true;
+}
+
 bool EnigmaIOTNodeClass::processDownstreamData (const uint8_t* mac, const uint8_t* buf, size_t count, bool control) {
 	/*
 	* --------------------------------------------------------------------------
 	*| msgType (1) | IV (12) | length (2) | Counter (2) | NodeId (2) | Data (....) | Tag (16) |
 	* --------------------------------------------------------------------------
+	* Group messages have a Group (1) field between msgType and IV
 	*/
 
-	uint8_t iv_idx = 1;
+	bool broadcast = (buf[0] & 0x80);
+	bool group = (buf[0] & 0xA0) == 0xA0; // Group messages have group id after message type
+	uint8_t iv_idx = group ? 2 : 1;
 	uint8_t length_idx = iv_idx + IV_LENGTH;
 	uint8_t nodeId_idx = length_idx + sizeof (int16_t);
 	uint8_t counter_idx = nodeId_idx + sizeof (int16_t);
 	uint8_t encoding_idx;
 	uint8_t data_idx;
+	int groupEntry = -1;
 	if (!control) {
 		encoding_idx = counter_idx + sizeof (int16_t);
 		data_idx = encoding_idx + sizeof (int8_t);
@@ -2425,25 +3539,42 @@ bool EnigmaIOTNodeClass::processDownstreamData (const uint8_t* mac, const uint8_
 
 	uint16_t counter;
 	uint16_t nodeId;
-	bool broadcast = (buf[0] & 0x80);
 
 	//if (broadcast) {
 	//	DEBUG_WARN ("Broadcast message. Type: 0x%X", buf[0]);
 	//} 
 
-	const uint8_t addDataLen = 1 + IV_LENGTH;
-	uint8_t aad[AAD_LENGTH + addDataLen];
+	const uint8_t addDataLen = iv_idx + IV_LENGTH;
+	uint8_t aad[AAD_LENGTH + 2 + IV_LENGTH];
 
 	memcpy (aad, buf, addDataLen); // Copy message upto iv
 
 	uint8_t packetLen = count - TAG_LENGTH;
 
-	if (broadcast) {
+	if (group) {
+		if (node.getSleepy ()) {
+			DEBUG_DBG ("Sleepy nodes get group messages from their own queue");
+			return false;
+		}
+		groupEntry = findGroupKey (buf[1]);
+		if (groupEntry < 0) {
+			DEBUG_DBG ("Not member of group %u", buf[1]);
+			return false;
+		}
+		memcpy (aad + addDataLen, groupKeys[groupEntry].key + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH); 	// Copy 8 last bytes from group key
+		if (!CryptModule::decryptBuffer (buf + length_idx, packetLen - addDataLen, // Decrypt from length
+										 buf + iv_idx, IV_LENGTH,
+										 groupKeys[groupEntry].key, KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of group key
+										 aad, AAD_LENGTH + addDataLen, buf + tag_idx, TAG_LENGTH)) {
+			DEBUG_ERROR ("Error during decryption of group message");
+			return false;
+		}
+	} else if (broadcast) {
 		memcpy (aad + addDataLen, rtcmem_data.broadcastKey + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH); 	// Copy 8 last bytes from Node Key
 		if (!CryptModule::decryptBuffer (buf + length_idx, packetLen - 1 - IV_LENGTH, // Decrypt from nodeId
 										 buf + iv_idx, IV_LENGTH,
 										 rtcmem_data.broadcastKey, KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of network key
-										 aad, sizeof (aad), buf + tag_idx, TAG_LENGTH)) {
+										 aad, AAD_LENGTH + addDataLen, buf + tag_idx, TAG_LENGTH)) {
 			DEBUG_ERROR ("Error during decryption of broadcast message");
 			return false;
 		}
@@ -2452,20 +3583,28 @@ bool EnigmaIOTNodeClass::processDownstreamData (const uint8_t* mac, const uint8_
 		if (!CryptModule::decryptBuffer (buf + length_idx, packetLen - 1 - IV_LENGTH, // Decrypt from nodeId
 										 buf + iv_idx, IV_LENGTH,
 										 node.getEncriptionKey (), KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of network key
-										 aad, sizeof (aad), buf + tag_idx, TAG_LENGTH)) {
+										 aad, AAD_LENGTH + addDataLen, buf + tag_idx, TAG_LENGTH, node.getCipherAlgorithm ())) {
 			DEBUG_ERROR ("Error during decryption");
 			return false;
 		}
 	}
 
-	DEBUG_VERBOSE ("Decripted downstream message: %s", printHexBuffer (buf, count - TAG_LENGTH));
+	DEBUG_VERBOSE ("Decripted downstream message: %s", DEBUG_HEX (buf, count - TAG_LENGTH));
 
 	memcpy (&nodeId, &(buf[nodeId_idx]), sizeof (uint16_t));
 
 	memcpy (&counter, &(buf[counter_idx]), sizeof (uint16_t));
 	DEBUG_INFO ("Downlink msg #%d", counter);
 	if (useCounter) {
-		if (broadcast) {
+		if (group) {
+			if (counter > lastGroupMsgCounter[groupEntry]) {
+				DEBUG_INFO ("Accepted. Counter was %u", lastGroupMsgCounter[groupEntry]);
+				lastGroupMsgCounter[groupEntry] = counter;
+			} else {
+				DEBUG_WARN ("Group msg rejected");
+				return false;
+			}
+		} else if (broadcast) {
 			if (counter > lastBroadcastMsgCounter) {
 				DEBUG_INFO ("Accepted. Counter was %u", lastBroadcastMsgCounter);
 				lastBroadcastMsgCounter = counter;
@@ -2490,13 +3629,28 @@ bool EnigmaIOTNodeClass::processDownstreamData (const uint8_t* mac, const uint8_
 
 	if (control) {
 		DEBUG_INFO ("Control command");
-		DEBUG_VERBOSE ("Data: %s", printHexBuffer (&buf[data_idx], tag_idx - data_idx));
+		DEBUG_VERBOSE ("Data: %s", DEBUG_HEX (&buf[data_idx], tag_idx - data_idx));
 		return processControlCommand (mac, &buf[data_idx], tag_idx - data_idx, broadcast);
 	}
 
+	// Application gets group messages as any other downlink data
+	nodeMessageType_t msgType = group ? (nodeMessageType_t)(buf[0] & ~0xA0) : (nodeMessageType_t)(buf[0]);
+
+	if (buf[encoding_idx] == FRAGMENT) {
+		fragment_result_t result = downlinkFragments.add (&buf[data_idx], tag_idx - data_idx);
+		if (result == FRAGMENT_COMPLETE) {
+			DEBUG_VERBOSE ("Sending data notification. Payload length: %d", downlinkFragments.getLength ());
+			if (notifyData) {
+				notifyData (mac, downlinkFragments.getData (), downlinkFragments.getLength (), msgType, (nodePayloadEncoding_t)(downlinkFragments.getEncoding ()));
+			}
+			downlinkFragments.clear ();
+		}
+		return result != FRAGMENT_ERROR;
+	}
+
 	DEBUG_VERBOSE ("Sending data notification. Payload length: %d", tag_idx - data_idx);
 	if (notifyData) {
-		notifyData (mac, &buf[data_idx], tag_idx - data_idx, (nodeMessageType_t)(buf[0]), (nodePayloadEncoding_t)(buf[encoding_idx]));
+		notifyData (mac, &buf[data_idx], tag_idx - data_idx, msgType, (nodePayloadEncoding_t)(buf[encoding_idx]));
 	}
 
 	return true;
@@ -2528,9 +3682,77 @@ nodeInvalidateReason_t EnigmaIOTNodeClass::processInvalidateKey (const uint8_t*
 	return (nodeInvalidateReason_t)reason;
 }
 
+void EnigmaIOTNodeClass::completeRegistration () {
+	sessionResuming = false;
+
+	// mark node as registered
+	//stopFlash (); // Do not flash during setup for less battery drain
+	node.setKeyValid (true);
+	rtcmem_data.nodeKeyValid = true;
+	node.setKeyValidFrom (millis ());
+	node.setLastMessageCounter (0);
+	node.setStatus (REGISTERED);
+	rtcmem_data.nodeRegisterStatus = REGISTERED;
+
+	// save context to RTC memory
+	memcpy (rtcmem_data.nodeKey, node.getEncriptionKey (), KEY_LENGTH);
+	rtcmem_data.lastMessageCounter = 0;
+	rtcmem_data.lastDownlinkMsgCounter = 0;
+	rtcmem_data.lastControlCounter = 0;
+	rtcmem_data.messageCounterEpoch = 0;
+	rtcmem_data.controlCounterEpoch = 0;
+	rtcmem_data.nodeId = node.getNodeId ();
+	DEBUG_INFO ("Reset counters");
+#if ENABLE_LINK_ADAPTATION
+	if (rtcmem_data.txPowerReduction) { // Gateway starts again from full power
+		rtcmem_data.txPowerReduction = 0;
+		setTxPowerReduction (0);
+	}
+#endif // ENABLE_LINK_ADAPTATION
+	if (!saveRTCData ()) {
+		DEBUG_ERROR ("Error saving data on RTC");
+	}
+
+	// request clock sync if non sleepy
+	//if (!node.getSleepy () && node.isRegistered ())
+	//	clockRequest ();
+
+#if DEBUG_LEVEL >= INFO
+	node.printToSerial (&DEBUG_ESP_PORT);
+#endif
+	if (!sendNodeNameSet (rtcmem_data.nodeName)) {
+		DEBUG_WARN ("Error sending set node name %s", rtcmem_data.nodeName ? rtcmem_data.nodeName : "NULL name");
+	}
+
+	// Gateway does not keep schema of unregistered nodes
+	schemaDefinitionPending = dataSchema.isSet ();
+	dataSchema.forceKeyFrame ();
+
+	// send notification to user code
+	if (notifyConnection) {
+		notifyConnection ();
+	}
+	// Resend last message in case of it is still pending to be sent.
+	// If key expired it was successfully sent before so retransmission is not needed 
+	if (invalidateReason < KEY_EXPIRED && dataMessageSentLength > 0) {
+		if (node.getStatus () == REGISTERED && node.isKeyValid ()) {
+			if (dataMessageSendPending && dataMessageSentLength > 0) {
+				DEBUG_INFO ("Data pending to be sent. Length: %u", dataMessageSentLength);
+				DEBUG_VERBOSE ("Data sent: %s", DEBUG_HEX (dataMessageSent, dataMessageSentLength));
+				dataMessage ((uint8_t*)dataMessageSent, dataMessageSentLength, false, dataMessageEncrypt, dataMessageSendEncoding);
+				//dataMessageSentLength = 0;
+				dataMessageSendPending = false;
+
+				flashBlue = true;
+			}
+		}
+	}
+	cycleStartedTime = millis ();
+}
+
 void EnigmaIOTNodeClass::manageMessage (const uint8_t* mac, const uint8_t* buf, uint8_t count) {
 	DEBUG_INFO ("Reveived message. Origin MAC: %02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-	DEBUG_VERBOSE ("Received data: %s", printHexBuffer (const_cast<uint8_t*>(buf), count));
+	DEBUG_VERBOSE ("Received data: %s", DEBUG_HEX (const_cast<uint8_t*>(buf), count));
 	flashBlue = true;
 
 	if (count <= 1) {
@@ -2549,59 +3771,7 @@ void EnigmaIOTNodeClass::manageMessage (const uint8_t* mac, const uint8_t* buf,
 		DEBUG_INFO (" <------- SERVER HELLO");
 		if (node.getStatus () == WAIT_FOR_SERVER_HELLO) {
 			if (processServerHello (mac, buf, count)) {
-				// mark node as registered
-				//stopFlash (); // Do not flash during setup for less battery drain
-				node.setKeyValid (true);
-				rtcmem_data.nodeKeyValid = true;
-				node.setKeyValidFrom (millis ());
-				node.setLastMessageCounter (0);
-				node.setStatus (REGISTERED);
-				rtcmem_data.nodeRegisterStatus = REGISTERED;
-
-				// save context to RTC memory
-				memcpy (rtcmem_data.nodeKey, node.getEncriptionKey (), KEY_LENGTH);
-				rtcmem_data.lastMessageCounter = 0;
-				rtcmem_data.lastDownlinkMsgCounter = 0;
-				rtcmem_data.lastControlCounter = 0;
-				rtcmem_data.nodeId = node.getNodeId ();
-				DEBUG_INFO ("Reset counters");
-				if (!saveRTCData ()) {
-					DEBUG_ERROR ("Error saving data on RTC");
-				}
-
-				// request clock sync if non sleepy
-				//if (!node.getSleepy () && node.isRegistered ())
-				//	clockRequest ();
-
-#if DEBUG_LEVEL >= INFO
-				node.printToSerial (&DEBUG_ESP_PORT);
-#endif
-				if (!sendNodeNameSet (rtcmem_data.nodeName)) {
-					DEBUG_WARN ("Error sending set node name %s", rtcmem_data.nodeName ? rtcmem_data.nodeName : "NULL name");
-				}
-
-				// send notification to user code
-				if (notifyConnection) {
-					notifyConnection ();
-				}
-				// Resend last message in case of it is still pending to be sent.
-				// If key expired it was successfully sent before so retransmission is not needed 
-				if (invalidateReason < KEY_EXPIRED && dataMessageSentLength > 0) {
-					if (node.getStatus () == REGISTERED && node.isKeyValid ()) {
-						if (dataMessageSendPending && dataMessageSentLength > 0) {
-							DEBUG_INFO ("Data pending to be sent. Length: %u", dataMessageSentLength);
-							DEBUG_VERBOSE ("Data sent: %s", printHexBuffer (dataMessageSent, dataMessageSentLength));
-							dataMessage ((uint8_t*)dataMessageSent, dataMessageSentLength, false, dataMessageEncrypt, dataMessageSendEncoding);
-							//dataMessageSentLength = 0;
-							dataMessageSendPending = false;
-
-							flashBlue = true;
-						}
-					}
-				}
-				cycleStartedTime = millis ();
-
-
+				completeRegistration ();
 			} else {
 				node.reset ();
 			}
@@ -2609,14 +3779,45 @@ void EnigmaIOTNodeClass::manageMessage (const uint8_t* mac, const uint8_t* buf,
 			node.reset ();
 		}
 		break;
+	case RESUME_RESPONSE:
+		DEBUG_INFO (" <------- RESUME RESPONSE");
+		if (node.getStatus () == WAIT_FOR_SERVER_HELLO && sessionResuming) {
+			if (processResumeResponse (mac, buf, count)) {
+				completeRegistration ();
+			} else {
+				node.reset ();
+			}
+		}
+		break;
 	case INVALIDATE_KEY:
 		DEBUG_INFO (" <------- INVALIDATE KEY");
+		if (count >= 2 && buf[1] == INVALID_SESSION_TICKET) { // Node was not registered. Just fall back to full key agreement
+			if (sessionResuming && node.getStatus () == WAIT_FOR_SERVER_HELLO) {
+				clearSessionTicket ();
+				node.reset ();
+			}
+			break;
+		}
+		if (count >= 4 && buf[1] == REGISTRATION_BUSY) { // Key agreement was not processed. Retry when gateway says
+			if (node.getStatus () == WAIT_FOR_SERVER_HELLO && !sessionResuming) {
+				uint16_t retryAfter;
+				memcpy (&retryAfter, buf + 2, sizeof (uint16_t));
+				DEBUG_INFO ("Gateway busy. Registration retry in %u ms", retryAfter);
+				node.reset ();
+				registrationScheduled = true;
+				lastRegistration = millis ();
+				registrationDelay = retryAfter;
+			}
+			break;
+		}
 		invalidateReason = processInvalidateKey (mac, buf, count);
 		requestSearchGateway = true;
 		node.reset ();
 		rtcmem_data.lastMessageCounter = 0;
 		rtcmem_data.lastControlCounter = 0;
 		rtcmem_data.lastDownlinkMsgCounter = 0;
+		rtcmem_data.messageCounterEpoch = 0;
+		rtcmem_data.controlCounterEpoch = 0;
 		lastBroadcastMsgCounter = 0;
 		TimeManager.reset ();
 		timeSyncPeriod = QUICK_SYNC_TIME;
@@ -2629,6 +3830,7 @@ void EnigmaIOTNodeClass::manageMessage (const uint8_t* mac, const uint8_t* buf,
 		if (!node.broadcastIsEnabled ()) {
 			break;
 		}
+	case DOWNSTREAM_GROUP_DATA_SET:
 	case DOWNSTREAM_DATA_SET:
 		DEBUG_INFO (" <------- DOWNSTREAM DATA SET");
 		if (processDownstreamData (mac, buf, count)) {
@@ -2640,6 +3842,7 @@ void EnigmaIOTNodeClass::manageMessage (const uint8_t* mac, const uint8_t* buf,
 		if (!node.broadcastIsEnabled ()) {
 			break;
 		}
+	case DOWNSTREAM_GROUP_DATA_GET:
 	case DOWNSTREAM_DATA_GET:
 		DEBUG_INFO (" <------- DOWNSTREAM DATA GET");
 		if (processDownstreamData (mac, buf, count)) {
@@ -2651,6 +3854,7 @@ void EnigmaIOTNodeClass::manageMessage (const uint8_t* mac, const uint8_t* buf,
 		if (!node.broadcastIsEnabled ()) {
 			break;
 		}
+	case DOWNSTREAM_GROUP_CTRL_DATA:
 	case DOWNSTREAM_CTRL_DATA:
 		DEBUG_INFO (" <------- DOWNSTREAM CONTROL DATA");
 		if (processDownstreamData (mac, buf, count, true)) {
@@ -2678,6 +3882,17 @@ void EnigmaIOTNodeClass::manageMessage (const uint8_t* mac, const uint8_t* buf,
 			DEBUG_INFO ("Broadcast Key OK");
 		}
 		break;
+	case DOWNLINK_EMPTY:
+		DEBUG_INFO (" <------- DOWNLINK EMPTY");
+		if (count >= 1 + sizeof (uint16_t) && downlinkWindowCounter >= 0) {
+			uint16_t counter;
+			memcpy (&counter, &(buf[1]), sizeof (uint16_t));
+			if (counter == downlinkWindowCounter) {
+				DEBUG_DBG ("Nothing queued for msg #%u", counter);
+				downlinkWindowClosed = true;
+			}
+		}
+		break;
 	}
 }
 
@@ -2688,6 +3903,13 @@ void EnigmaIOTNodeClass::getStatus (uint8_t* mac_addr, uint8_t status) {
 		rtcmem_data.commErrors = 0;
 	} else {
 		rtcmem_data.commErrors++;
+#if ENABLE_LINK_ADAPTATION
+		if (rtcmem_data.txPowerReduction) {
+			DEBUG_INFO ("Back to full TX power");
+			rtcmem_data.txPowerReduction = 0;
+			setTxPowerReduction (0);
+		}
+#endif // ENABLE_LINK_ADAPTATION
 		if (!saveRTCData ()) {
 			DEBUG_ERROR ("Error saving data on RTC");
 		}
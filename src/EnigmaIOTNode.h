@@ -21,6 +21,8 @@
 #include "helperFunctions.h"
 #include "Comms_hal.h"
 #include "NodeList.h"
+#include "fragmentBuffer.h"
+#include "schemaCodec.h"
 #include <cstddef>
 #include <cstdint>
 #include <ESPAsyncWebServer.h>
@@ -43,15 +45,22 @@ enum nodeMessageType {
 	CONTROL_DATA = 0x03, /**< Internal control message from node to gateway. Used for OTA, settings configuration, etc */
 	DOWNSTREAM_CTRL_DATA = 0x04, /**< Internal control message from gateway to node. Used for OTA, settings configuration, etc */
 	DOWNSTREAM_BRCAST_CTRL_DATA = 0x84, /**< Internal control broadcast message from gateway to sensor. Used for OTA, settings configuration, etc */
+	DOWNSTREAM_GROUP_DATA_SET = 0xA2, /**< Data message from gateway to a multicast group. Downstream data for user commands */
+	DOWNSTREAM_GROUP_DATA_GET = 0xB2, /**< Data message from gateway to a multicast group. Downstream data for user commands */
+	DOWNSTREAM_GROUP_CTRL_DATA = 0xA4, /**< Internal control message from gateway to a multicast group */
 	CLOCK_REQUEST = 0x05, /**< Clock request message from node */
 	CLOCK_RESPONSE = 0x06, /**< Clock response message from gateway */
 	NODE_NAME_SET = 0x07, /**< Message from node to signal its own custom node name */
 	NODE_NAME_RESULT = 0x17, /**< Message from gateway to get result after set node name */
 	BROADCAST_KEY_REQUEST = 0x08, /**< Message from node to request broadcast key */
 	BROADCAST_KEY_RESPONSE = 0x18, /**< Message from gateway with broadcast key */
+	DOWNLINK_EMPTY = 0x19, /**< Message from gateway to sleepy node after a data message. Signals that nothing is queued for it, so it may sleep without waiting */
+	GATEWAY_PROBE = 0x1A, /**< Message from node to check if gateway is on a channel. Only its link layer acknowledge is used */
 	CLIENT_HELLO = 0xFF, /**< ClientHello message from node */
 	SERVER_HELLO = 0xFE, /**< ServerHello message from gateway */
-	INVALIDATE_KEY = 0xFB /**< InvalidateKey message from gateway */
+	INVALIDATE_KEY = 0xFB, /**< InvalidateKey message from gateway */
+	RESUME_REQUEST = 0xFA, /**< Message from node to resume a session using a ticket, without key agreement */
+	RESUME_RESPONSE = 0xF9 /**< Message from gateway with data to derive resumed session key */
 };
 
 enum nodePayloadEncoding_t {
@@ -61,7 +70,11 @@ enum nodePayloadEncoding_t {
 	MSG_PACK = 0x83, /**< Data packed using MessagePack */
 	BSON = 0x84, /**< Data packed using BSON. NOT IMPLEMENTED */
 	CBOR = 0x85, /**< Data packed using CBOR. NOT IMPLEMENTED */
-	SMILE = 0x86 /**< Data packed using SMILE. NOT IMPLEMENTED */
+	SMILE = 0x86, /**< Data packed using SMILE. NOT IMPLEMENTED */
+	SCHEMA_DEF = 0x87, /**< Schema definition for SCHEMA_DATA payloads. Sent automatically by node */
+	SCHEMA_DATA = 0x88, /**< Values packed using a schema, as differences to a previous key frame */
+	FRAGMENT = 0x8E, /**< Fragment of a payload too long for a single message */
+	BATCH = 0x8F /**< Several readings, each one with its own encoding and age */
 };
 
 
@@ -73,7 +86,10 @@ enum nodeInvalidateReason_t {
 	WRONG_CLIENT_HELLO = 0x01, /**< ClientHello message received was invalid */
 	WRONG_DATA = 0x03, /**< Data message received could not be decrypted successfuly */
 	UNREGISTERED_NODE = 0x04, /**< Data received from an unregistered node*/
-	KEY_EXPIRED = 0x05 /**< Node key has reached maximum validity time */
+	KEY_EXPIRED = 0x05, /**< Node key has reached maximum validity time */
+	KICKED = 0x06, /**< Node key has been forcibly unregistered */
+	INVALID_SESSION_TICKET = 0x07, /**< Session resumption ticket is not valid or has expired. Node has to do a full key agreement */
+	REGISTRATION_BUSY = 0x09 /**< Gateway is processing too many key agreements. Node has to retry after the time given in message */
 };
 
 /**
@@ -94,6 +110,7 @@ typedef struct {
 	uint8_t commErrors /*= 0*/; /**< number of non acknowledged packets. May mean that gateway is not available or its channel has changed.
 								This is used to retrigger Gateway scan*/
 	bool nodeKeyValid /* = false*/; /**< true if key has been negotiated successfully */
+	cipherAlgorithm_t cipherAlgorithm /* = CHACHAPOLY_CIPHER*/; /**< Algorithm agreed with gateway to use with node key */
 	uint8_t broadcastKey[KEY_LENGTH]; /**< Key to encrypt broadcast messages */
 	bool broadcastKeyValid /* = false*/; /**< true if broadcast key has been received from gateway */
 	bool broadcastKeyRequested /* = false*/; /**< true if broadcast key has been requested to gateway */
@@ -101,19 +118,41 @@ typedef struct {
 	uint16_t lastMessageCounter; /**< Node last message counter */
 	uint16_t lastControlCounter; /**< Control message last counter */
 	uint16_t lastDownlinkMsgCounter; /**< Downlink message last counter */
+	uint16_t messageCounterEpoch; /**< Number of times that data message counter has wrapped. It is bound to message authentication */
+	uint16_t controlCounterEpoch; /**< Number of times that control message counter has wrapped. It is bound to message authentication */
+	bool sessionTicketValid /* = false*/; /**< true if a session resumption ticket has been received from gateway */
+	uint8_t sessionTicket[SESSION_TICKET_LENGTH]; /**< Ticket issued by gateway to resume session without a new key agreement. It is opaque for node */
+	uint8_t resumptionSecret[KEY_LENGTH]; /**< Secret bound to session ticket. Resumed session key is derived from it */
+	int32_t clockDrift; /**< Estimated clock drift in ppb. It is kept across restarts so that clock synchronization does not need to estimate it again */
+	uint32_t batchClockBase; /**< Time in ms spent on previous wake cycles. Added to `millis()` to get a clock that survives deep sleep */
+	uint32_t batchStart; /**< Batch clock value when first reading on batch buffer was stored */
+	uint8_t batchLength; /**< Number of bytes used on batch buffer */
+	uint8_t batchBuffer[MAX_DATA_PAYLOAD_SIZE]; /**< Readings waiting to be sent in a single message */
+	uint8_t txPowerReduction; /**< TX power reduction in dB recommended by gateway. 0 means full power */
+	uint16_t gatewayChannels; /**< Bit n - 1 is set if gateway has been found on channel n. Used to probe gateway before a full scan */
 } rtcmem_data_t;
 
+/**
+  * @brief Multicast group key that node got from gateway. Stored on flash, as it is not renewed with node key
+  */
+typedef struct {
+	uint8_t group; /**< Group index given by gateway. `NO_GROUP` if entry is empty */
+	uint8_t key[KEY_LENGTH]; /**< Group key */
+} node_group_key_t;
+
+static const uint8_t NO_GROUP = 0xFF; ///< @brief Marks an empty group key entry
+
 typedef nodeMessageType nodeMessageType_t;
 
 #if defined ARDUINO_ARCH_ESP8266 || defined ARDUINO_ARCH_ESP32
 #include <functional>
-typedef std::function<void (const uint8_t* mac, const uint8_t* buf, uint8_t len, nodeMessageType_t command, nodePayloadEncoding_t payloadEncoding)> onNodeDataRx_t;
+typedef std::function<void (const uint8_t* mac, const uint8_t* buf, size_t len, nodeMessageType_t command, nodePayloadEncoding_t payloadEncoding)> onNodeDataRx_t;
 typedef std::function<void ()> onConnected_t;
 typedef std::function<void (nodeInvalidateReason_t reason)> onDisconnected_t;
 typedef std::function<void (bool status)> onWiFiManagerExit_t;
 typedef std::function<void (void)> simpleEventHandler_t;
 #else
-typedef void (*onNodeDataRx_t)(const uint8_t* mac, const uint8_t* buf, uint8_t len, nodeMessageType_t command, nodePayloadEncoding_t payloadEncoding);
+typedef void (*onNodeDataRx_t)(const uint8_t* mac, const uint8_t* buf, size_t len, nodeMessageType_t command, nodePayloadEncoding_t payloadEncoding);
 typedef void (*onConnected_t)();
 typedef void (*onDisconnected_t)(nodeInvalidateReason_t reason);
 typedef void (*onWiFiManagerExit_t)(bool status);
@@ -136,6 +175,11 @@ protected:
 	onDisconnected_t notifyDisconnection; ///< @brief Callback that will be called anytime a node is disconnected
 	bool useCounter = true; ///< @brief `true` means that data message counter will be used to mark message order
 	rtcmem_data_t rtcmem_data; ///< @brief Context data to be stored on persistent storage
+#if USE_FLASH_INSTEAD_RTC
+	rtcmem_data_t savedRtcData; ///< @brief Context data as it is stored on flash. Used to find changed bytes
+	bool savedRtcDataValid = false; ///< @brief `true` if `savedRtcData` matches flash contents
+	size_t contextJournalSize = 0; ///< @brief Length of context journal file
+#endif
 	bool sleepRequested = false; ///< @brief `true` means that this node will sleep as soon a message is sent and downlink wait time has passed
 	uint64_t sleepTime; ///< @brief Time in microseconds that this node will be slept between measurements
 	uint8_t dataMessageSent[MAX_MESSAGE_LENGTH]; ///< @brief Buffer where sent message is stored in case of retransmission is needed
@@ -148,6 +192,15 @@ protected:
 	bool otaError = false; ///< @brief True if OTA update has failed. This normally produces a restart
 	bool protectOTA = false; ///< @brief True if OTA update was launched. OTA flag is stored on RTC so this disables writting.
 	time_t lastOTAmsg; ///< @brief Time when last OTA update message has received. This is used to control timeout
+	uint8_t otaWindow = 0; ///< @brief Number of chunks that may be received out of order during OTA. 0 means sequential OTA
+	uint16_t otaNextChunk; ///< @brief On windowed OTA, index of next chunk to be written to flash
+	uint32_t otaReceived; ///< @brief On windowed OTA, bitmap of chunks already received after `otaNextChunk`. Bit 0 corresponds to `otaNextChunk + 1`
+	uint8_t* otaWindowBuffer = NULL; ///< @brief On windowed OTA, storage for chunks received out of order
+	uint8_t otaChunkLength[OTA_WINDOW_SIZE]; ///< @brief Length of every chunk stored on `otaWindowBuffer`
+	uint8_t otaChunksSinceAck; ///< @brief Number of chunks stored since last selective acknowledge
+	time_t lastOTAack; ///< @brief Time when last selective acknowledge was sent
+	bool otaMulticast = false; ///< @brief True if OTA is being received as broadcast. Acknowledges are only sent to request repairs
+	uint16_t otaAckJitter = 0; ///< @brief Random delay added to acknowledge timeout on multicast OTA, so that nodes do not answer at the same time
 	boolean indentifying = false; ///< @brief True if node has its led flashing to be identified
 	time_t identifyStart; ///< @brief Time when identification started flashing. Used to control identification timeout
 	clock_t timeSyncPeriod = QUICK_SYNC_TIME; ///< @brief Clock synchronization period
@@ -156,6 +209,8 @@ protected:
 	restartReason_t restartReason; ///< @brief Reason of restart (OTA, restart requested, configuration reset)
 	bool gatewaySearchStarted = false; ///< @brief Avoids start a new gateway scan if it already started
 	bool requestSearchGateway = false; ///< @brief Flag to control updating gateway address, RSSI and channel
+	bool fullScanRequested = false; ///< @brief Next gateway search has to scan all channels, so that RSSI is measured
+	bool commStarted = false; ///< @brief Communication layer has been started
 	bool requestReportRSSI = false; ///< @brief Flag to control RSSI reporting
 	bool configCleared = false; ///< @brief This flag disables asy configuration save after triggering a factory reset
 	int resetPin = -1; ///< @brief  Pin used to reset configuration if it is connected to ground during startup
@@ -164,6 +219,21 @@ protected:
 	simpleEventHandler_t notifyWiFiManagerStarted; ///< @brief Function called when configuration portal is started
 	time_t cycleStartedTime;
 	int16_t lastBroadcastMsgCounter; ///< @brief Counter for broadcast messages from gateway */
+	node_group_key_t groupKeys[MAX_NODE_GROUP_KEYS]; ///< @brief Keys of multicast groups this node is member of
+	uint16_t lastGroupMsgCounter[MAX_NODE_GROUP_KEYS]; ///< @brief Counter for every multicast group messages from gateway. Kept on RAM and set by gateway together with group key on every registration
+	bool groupKeysLoaded = false; ///< @brief True after group keys have been read from flash. They are only read when first needed
+	uint32_t batchMaxDelay = 0; ///< @brief Maximum time in ms that a reading waits on batch buffer. 0 means batching is disabled
+	uint8_t fragmentTransferId = 0; ///< @brief Identifier of last fragmented payload sent
+	FragmentBuffer downlinkFragments; ///< @brief Reassembly buffer for fragmented downlink payloads
+	SchemaEncoder dataSchema; ///< @brief Schema of readings sent with `sendSchemaData()`
+	bool schemaDefinitionPending = false; ///< @brief True if schema has to be sent to gateway before next schema reading
+	time_t lastRegistration; ///< @brief Time when node entered unregistered state or last registration was attempted
+	uint32_t registrationDelay; ///< @brief Time in ms to wait before next registration attempt
+	bool registrationScheduled = false; ///< @brief True if next registration attempt time has been already calculated
+	bool sessionResuming = false; ///< @brief True if node is waiting for gateway answer to a session resumption request
+	uint8_t resumeNonce[RESUME_NONCE_LENGTH]; ///< @brief Node random number used to derive resumed session key
+	int32_t downlinkWindowCounter = -1; ///< @brief Counter of last data message if it was the last message sent. -1 if any other message was sent after it
+	bool downlinkWindowClosed = false; ///< @brief True if gateway has nothing more to send after last message, so node may sleep without waiting `DOWNLINK_WAIT_TIME`
 
 	/**
 	  * @brief Check that a given CRC matches to calulated value from a buffer
@@ -191,6 +261,23 @@ protected:
    */
 	bool loadRTCData ();
 
+#if USE_FLASH_INSTEAD_RTC
+	/**
+   * @brief Reads context from a file in flash and checks its CRC. File is deleted if it is not valid
+   * @param fileName File to read
+   * @param context Buffer to store context
+   * @return Returns `true` if data is valid. `false` otherwise
+   */
+	bool readRTCDataFile (const char* fileName, rtcmem_data_t* context);
+
+	/**
+   * @brief Applies changes stored on context journal, in order, until the end or the first damaged record
+   * @param context Context read from context file
+   * @return Returns `true` if all journal records were valid. `false` if journal has to be compacted
+   */
+	bool applyRTCDataJournal (rtcmem_data_t* context);
+#endif
+
 	/**
 	* @brief Loads configuration from flash memory
 	* @return Returns `true` if data was read successfuly. `false` otherwise
@@ -223,6 +310,22 @@ protected:
 	  */
 	bool clientHello ();
 
+	/**
+	  * @brief Build a **ResumeRequest** message and send it to gateway. It uses stored session ticket to get a new key without Diffie Hellman key agreement
+	  * @return Returns `true` if ResumeRequest message was successfully sent. `false` otherwise
+	  */
+	bool resumeSession ();
+
+	/**
+	  * @brief Discards stored session ticket, so that next registration uses a full key agreement
+	  */
+	void clearSessionTicket ();
+
+	/**
+	  * @brief Sets node as registered after a successful key agreement or session resumption. Context is saved and pending data is sent
+	  */
+	void completeRegistration ();
+
 	/**
 	  * @brief Build a **ClockRequest** messange and send it to gateway
 	  * @return Returns `true` if ClockRequest message was successfully sent. `false` otherwise
@@ -248,6 +351,15 @@ protected:
 	  */
 	bool processServerHello (const uint8_t* mac, const uint8_t* buf, size_t count);
 
+	/**
+	  * @brief Gets a buffer containing a **ResumeResponse** message and process it. It uses gateway random number to derive a new shared key from resumption secret
+	  * @param mac Address where this message was received from
+	  * @param buf Pointer to the buffer that contains the message
+	  * @param count Message length in number of bytes of ResumeResponse message
+	  * @return Returns `true` if message could be correcly processed
+	  */
+	bool processResumeResponse (const uint8_t* mac, const uint8_t* buf, size_t count);
+
 	/**
 	  * @brief Gets a buffer containing an **InvalidateKey** message and process it. This trigger a new key agreement to start
 	  * @param mac Address where this message was received from
@@ -266,6 +378,83 @@ protected:
 	  */
 	bool processBroadcastKeyMessage (const uint8_t* mac, const uint8_t* buf, size_t count);
 
+	/**
+	  * @brief Gets a buffer containing a **GroupKey** control message and process it. Key is stored, or deleted if message has no key
+	  * @param mac Address where this message was received from
+	  * @param buf Pointer to the buffer that contains the message
+	  * @param count Message length in number of bytes
+	  * @return Returns `true` if message could be correcly processed
+	  */
+	bool processGroupKeyMessage (const uint8_t* mac, const uint8_t* buf, size_t count);
+
+	/**
+	  * @brief Sends schema definition as a data message
+	  * @return Returns `true` if message could be correcly sent
+	  */
+	bool sendSchemaDefinition ();
+
+	/**
+	  * @brief Gets a buffer containing a **SchemaGet** control message and process it. Schema is sent again and next reading is a key frame
+	  * @param mac Address where this message was received from
+	  * @param buf Pointer to the buffer that contains the message
+	  * @param count Message length in number of bytes
+	  * @return Returns `true` if message could be correcly processed
+	  */
+	bool processSchemaRequest (const uint8_t* mac, const uint8_t* buf, size_t count);
+
+#if ENABLE_LINK_ADAPTATION
+	/**
+	  * @brief Gets a buffer containing a **TxPowerSet** control message and process it
+	  * @param mac Address where this message was received from
+	  * @param buf Pointer to the buffer that contains the message
+	  * @param count Message length in number of bytes
+	  * @return Returns `true` if message could be correcly processed
+	  */
+	bool processTxPowerCommand (const uint8_t* mac, const uint8_t* buf, size_t count);
+
+	/**
+	  * @brief Applies TX power reduction recommended by gateway and stores it on RTC memory, so that it is kept during deep sleep
+	  * @param reduction Reduction in dB from maximum power. Up to `LINK_ADAPTATION_MAX_REDUCTION`
+	  * @return Returns `true` if reduction is valid
+	  */
+	bool updateTxPower (uint8_t reduction);
+#endif // ENABLE_LINK_ADAPTATION
+
+	/**
+	  * @brief Reads multicast group keys from flash, if they were not read yet
+	  */
+	void loadGroupKeys ();
+
+	/**
+	  * @brief Stores multicast group keys on flash
+	  * @return Returns `true` if keys were written
+	  */
+	bool saveGroupKeys ();
+
+	/**
+	  * @brief Finds entry of a multicast group key
+	  * @param group Group index given by gateway. `NO_GROUP` to find a free entry
+	  * @return Entry position. -1 if not found
+	  */
+	int findGroupKey (uint8_t group);
+
+	/**
+	  * @brief Gets a buffer containing a **SessionTicket** message and process it. Ticket is stored to allow fast reconnection in the future
+	  * @param mac Address where this message was received from
+	  * @param buf Pointer to the buffer that contains the message
+	  * @param count Message length in number of bytes of SessionTicket message
+	  * @return Returns `true` if message could be correcly processed
+	  */
+	bool processSessionTicketMessage (const uint8_t* mac, const uint8_t* buf, size_t count);
+
+	/**
+	  * @brief Gets counter for next uplink message. Counter epoch is increased every time 16 bit counter wraps,
+	  * so that node does not need to register again
+	  * @param control `true` for control messages, `false` for data messages
+	  * @return Message counter. Random if counters are not used
+	  */
+	uint16_t nextUplinkCounter (bool control);
+
 	/**
 	  * @brief Builds, encrypts and sends a **Data** message.
 	  * @param data Buffer to store payload to be sent
@@ -292,9 +481,21 @@ protected:
 	  * @param mac Gateway address
 	  * @param data Buffer to store received message
 	  * @param len Length of payload data
+	  * @param broadcast `true` if message was received as broadcast. Only windowed OTA is possible this way
 	  * @return Returns `true` if message could be correcly decoded and processed
 	  */
-	bool processOTACommand (const uint8_t* mac, const uint8_t* data, uint8_t len);
+	bool processOTACommand (const uint8_t* mac, const uint8_t* data, uint8_t len, bool broadcast = false);
+
+	/**
+	  * @brief Sends a selective acknowledge during windowed OTA. It carries next chunk needed and a bitmap with chunks already received after it
+	  * @return Returns `true` if message could be sent
+	  */
+	bool sendOTAack ();
+
+	/**
+	  * @brief Frees windowed OTA buffer
+	  */
+	void freeOTAwindow ();
 
 	/**
 	  * @brief Processes a control command. Does not propagate to user code
@@ -414,6 +615,15 @@ protected:
 	  */
 	bool sendData (const uint8_t* data, size_t len, bool controlMessage, bool encrypt = true, nodePayloadEncoding_t payloadEncoding = CAYENNELPP);
 
+	/**
+	  * @brief Sends a payload longer than `MAX_DATA_PAYLOAD_SIZE` splitted in several data messages
+	  * @param data Payload buffer
+	  * @param len Payload length. Maximum is `MAX_FRAGMENTED_PAYLOAD_SIZE`
+	  * @param payloadEncoding Identifies data encoding of payload
+	  * @return Returns `true` if all fragments could be correcly sent
+	  */
+	bool sendFragmentedData (const uint8_t* data, size_t len, nodePayloadEncoding_t payloadEncoding);
+
 	/**
 	 * @brief Starts searching for a gateway that it using configured Network Name as WiFi AP. Stores this info for subsequent use
 	 * @param data Node context structure
@@ -422,6 +632,27 @@ protected:
 	 */
 	bool searchForGateway (rtcmem_data_t* data, bool shouldStoreData = false);
 
+	/**
+	  * @brief Probes last known gateway on its last channel, on channels where it was found before and on neighbour channels.
+	  * It needs communication layer to be started
+	  * @param data Status data. Channel is updated if gateway is found
+	  * @return Returns `true` if gateway acknowledged probe on any channel
+	  */
+	bool probeGateway (rtcmem_data_t* data);
+
+	/**
+	  * @brief Starts WiFi and communication layer on channel stored on RTC data
+	  */
+	void startComms ();
+
+	/**
+	  * @brief Gets a millisecond clock that keeps counting during deep sleep, used to calculate age of batched readings
+	  * @return Clock value in ms
+	  */
+	uint32_t batchClock () {
+		return rtcmem_data.batchClockBase + millis ();
+	}
+
 	/**
 	 * @brief Clears configuration stored in RTC memory to recover factory state
 	 */
@@ -438,6 +669,22 @@ protected:
 	 */
 	bool saveRTCData ();
 
+#if USE_FLASH_INSTEAD_RTC
+	/**
+	 * @brief Writes whole context to flash and clears journal. Temporary file is renamed so that a valid context is always available
+	 * @return Returns `true` if result is successful. `false` otherwise
+	 */
+	bool writeRTCDataFile ();
+
+	/**
+	 * @brief Appends a context change to journal file
+	 * @param offset Offset of changed bytes in context
+	 * @param len Number of changed bytes
+	 * @return Returns `true` if result is successful. `false` otherwise
+	 */
+	bool appendRTCDataJournal (uint16_t offset, uint8_t len);
+#endif
+
 	/**
 	 * @brief Checks reset button status during startup
 	 */
@@ -613,13 +860,78 @@ public:
 		return sendData (data, len, false, false, payloadEncoding);
 	}
 
+	/**
+	  * @brief Gets buffer that data messages are kept on until they are sent. A payload built here and passed to `sendData()`
+	  * is not copied again before encryption, so that no intermediate buffer is needed.
+	  * It is overwritten by the next data message, so it must be filled right before calling `sendData()`
+	  * @param maxLength Filled with buffer size. Payloads that need fragmentation do not fit on it
+	  * @return Payload buffer
+	  */
+	uint8_t* getPayloadBuffer (size_t& maxLength) {
+		maxLength = MAX_DATA_PAYLOAD_SIZE;
+		return dataMessageSent;
+	}
+
+	/**
+	  * @brief Sets schema of readings sent with `sendSchemaData()`. Schema is sent to gateway after registration or when gateway
+	  * asks for it. Field array is not copied, so it has to be kept while it is used
+	  * @param fields Field descriptions
+	  * @param count Number of fields. Up to `SCHEMA_MAX_FIELDS`
+	  * @return Returns `true` if schema is valid
+	  */
+	bool setDataSchema (const schema_field_t* fields, uint8_t count);
+
+	/**
+	  * @brief Sends a reading with compact schema encoding. Only values are sent, as differences to last key frame.
+	  * Gateway notifies it as a MsgPack map that uses field names as keys
+	  * @param values One value for every schema field, in schema order
+	  * @return Returns `true` if message could be correcly sent
+	  */
+	bool sendSchemaData (const float* values);
+
+	/**
+	  * @brief Enables uplink batching. Readings stored with `batchData` are sent together in a single message
+	  * when batch buffer gets full or when oldest reading has waited for `maxDelay` ms.
+	  * Gateway notifies every reading separately with its original timestamp.
+	  *
+	  * Batch buffer is kept on RTC memory so sleepy nodes may accumulate readings during several wake cycles.
+	  * In that case delay is checked only while node is awake
+	  * @param maxDelay Maximum time in ms that a reading may wait before it is sent. 0 disables batching
+	  */
+	void enableBatching (uint32_t maxDelay = BATCH_MAX_DELAY) {
+		batchMaxDelay = maxDelay;
+	}
+
+	/**
+	  * @brief Stores a reading on batch buffer. If batching is not enabled it is sent immediately
+	  * @param data Payload buffer
+	  * @param len Payload length
+	  * @param payloadEncoding Identifies data encoding of payload. It can be RAW, CAYENNELPP, MSGPACK
+	  * @return Returns `true` if data could be stored or sent
+	  */
+	bool batchData (const uint8_t* data, size_t len, nodePayloadEncoding_t payloadEncoding = CAYENNELPP);
+
+	/**
+	  * @brief Sends all readings stored on batch buffer in a single message
+	  * @return Returns `true` if message could be correcly sent or batch buffer was empty
+	  */
+	bool flushBatch ();
+
+	/**
+	  * @brief Gets number of bytes waiting on batch buffer
+	  * @return Used batch buffer length
+	  */
+	uint8_t getBatchLength () {
+		return rtcmem_data.batchLength;
+	}
+
 	/**
 	  * @brief Defines a function callback that will be called on every downlink data message that is received from gateway
 	  *
 	  * Use example:
 	  * ``` C++
 	  * // First define the callback function
-	  * void processRxData (const uint8_t* mac, const uint8_t* buffer, uint8_t length) {
+	  * void processRxData (const uint8_t* mac, const uint8_t* buffer, size_t length) {
 	  *   // Do whatever you need with received data
 	  * }
 	  *
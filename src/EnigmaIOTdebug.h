@@ -28,14 +28,55 @@
 #define DBG	    4 ///< @brief Debug level that will give error, warning,info AND dbg messages
 #define VERBOSE	5 ///< @brief Debug level that will give all defined messages
 
-#ifdef ESP8266
+#if defined ESP8266 || DEBUG_DEFERRED
 const char* extractFileName (const char* path);
+#endif
+#ifdef ESP8266
 #define DEBUG_LINE_PREFIX() DEBUG_ESP_PORT.printf_P (PSTR("[%lu][%s:%d] %s() Heap: %lu | "),millis(),extractFileName(__FILE__),__LINE__,__FUNCTION__,(unsigned long)ESP.getFreeHeap())
 #endif
 
 #ifdef DEBUG_ESP_PORT
 
-#ifdef ESP8266
+#if DEBUG_DEFERRED
+#include "deferredLog.h"
+#define DEBUG_DEFERRED_RECORD(level,text,...) DeferredLog.record (level, PSTR(text), __FILE__, __FUNCTION__, __LINE__, ##__VA_ARGS__)
+
+#if DEBUG_LEVEL >= VERBOSE
+#define DEBUG_VERBOSE(text,...) DEBUG_DEFERRED_RECORD(VERBOSE,text,##__VA_ARGS__)
+#else
+#define DEBUG_VERBOSE(...)
+#endif
+
+#if DEBUG_LEVEL >= DBG
+#define DEBUG_DBG(text,...) DEBUG_DEFERRED_RECORD(DBG,text,##__VA_ARGS__)
+#else
+#define DEBUG_DBG(...)
+#endif
+
+#if DEBUG_LEVEL >= INFO
+#define DEBUG_INFO(text,...) DEBUG_DEFERRED_RECORD(INFO,text,##__VA_ARGS__)
+#else
+#define DEBUG_INFO(...)
+#endif
+
+#if DEBUG_LEVEL >= WARN
+#define DEBUG_WARN(text,...) DEBUG_DEFERRED_RECORD(WARN,text,##__VA_ARGS__)
+#else
+#define DEBUG_WARN(...)
+#endif
+
+#if DEBUG_LEVEL >= ERROR
+#define DEBUG_ERROR(text,...) DEBUG_DEFERRED_RECORD(ERROR,text,##__VA_ARGS__)
+#else
+#define DEBUG_ERROR(...)
+#endif
+
+#define DEBUG_MAC(mac) (debug_mac_t { (const uint8_t*)(mac) }) ///< @brief MAC address argument. It is copied and formatted later as `mac2str()` does
+#define DEBUG_HEX(buffer,len) (debug_hex_t { (const uint8_t*)(buffer), (uint16_t)(len) }) ///< @brief Buffer argument. It is copied and formatted later as `printHexBuffer()` does
+#define DEBUG_PROCESS(maxTime) DeferredLog.process (maxTime) ///< @brief Prints stored debug records during up to `maxTime` ms
+#define DEBUG_FLUSH() DeferredLog.flush () ///< @brief Prints all stored debug records
+
+#elif defined ESP8266
 #if DEBUG_LEVEL >= VERBOSE
 #define DEBUG_VERBOSE(text,...) DEBUG_ESP_PORT.print("V ");DEBUG_LINE_PREFIX();DEBUG_ESP_PORT.printf_P(PSTR(text),##__VA_ARGS__);DEBUG_ESP_PORT.println()
 #else
@@ -81,7 +122,12 @@ const char* extractFileName (const char* path);
 #define DEBUG_ERROR(...)
 #endif
 
-
+#ifndef DEBUG_MAC
+#define DEBUG_MAC(mac) mac2str (mac) ///< @brief MAC address argument for `%s` on debug calls
+#define DEBUG_HEX(buffer,len) printHexBuffer (buffer, len) ///< @brief Buffer argument for `%s` on debug calls
+#define DEBUG_PROCESS(maxTime) ///< @brief Prints stored debug records. Only used if `DEBUG_DEFERRED` is enabled
+#define DEBUG_FLUSH() ///< @brief Prints all stored debug records. Only used if `DEBUG_DEFERRED` is enabled
+#endif
 
 #endif
 
@@ -18,6 +18,10 @@
 #include <EnigmaIOTNode.h>
 #include <ArduinoJson.h>
 
+#ifndef JSON_CONTROLLER_DOC_SIZE
+const size_t JSON_CONTROLLER_DOC_SIZE = 512; ///< @brief Capacity of JSON document shared by controllers to build messages
+#endif // JSON_CONTROLLER_DOC_SIZE
+
 #if defined ESP8266 || defined ESP32
 #include <functional>
 typedef std::function<bool (const uint8_t* data, size_t len, nodePayloadEncoding_t payloadEncoding)> sendData_cb; /**< Data send callback definition */
@@ -53,7 +57,7 @@ public:
 	 * @return `true` on success
 	 */
 	virtual bool processRxCommand (
-		const uint8_t* mac, const uint8_t* buffer, uint8_t length, nodeMessageType_t command, nodePayloadEncoding_t payloadEncoding) = 0;
+		const uint8_t* mac, const uint8_t* buffer, size_t length, nodeMessageType_t command, nodePayloadEncoding_t payloadEncoding) = 0;
 
 	/**
 	 * @brief Register send data callback to run when module needs to send a message
@@ -107,23 +111,50 @@ protected:
 	  */
 	virtual bool saveConfig () = 0;
 
+#if ARDUINOJSON_VERSION_MAJOR == 6
+	/**
+	  * @brief Gets a JSON document to build a message on. It is allocated only once and shared by every controller,
+	  * so that building a message does not use heap. Previous content is cleared
+	  * @return Empty JSON document
+	  */
+	JsonDocument& getJsonDocument () {
+		static StaticJsonDocument<JSON_CONTROLLER_DOC_SIZE> jsonDoc;
+
+		jsonDoc.clear ();
+		return jsonDoc;
+	}
+
 	/**
-	  * @brief Sends a JSON encoded message to lower layer
+	  * @brief Sends a JSON encoded message to lower layer. It is serialized as MsgPack directly on node payload buffer,
+	  * so heap is only used if message needs fragmentation
+	  * @param json JSON document to send
 	  * @return Returns `true` if message sending was successful. `false` otherwise
 	  */
-#if ARDUINOJSON_VERSION_MAJOR == 6
-	bool sendJson (DynamicJsonDocument& json) {
-		int len = measureMsgPack (json) + 1;
-		uint8_t* buffer = (uint8_t*)malloc (len);
-		len = serializeMsgPack (json, (char*)buffer, len);
-
-		size_t strLen = measureJson (json) + 1;
-		char* strBuffer = (char*)calloc (sizeof (uint8_t), strLen);
-
-		/*Serial.printf ("Trying to send: %s\n", printHexBuffer (
-			buffer, len));*/
-		serializeJson (json, strBuffer, strLen);
-		DEBUG_INFO ("Trying to send: %s", strBuffer);
+	bool sendJson (JsonDocument& json) {
+		uint8_t* buffer = NULL;
+		size_t bufferSize = 0;
+		bool allocated = false;
+		size_t len = measureMsgPack (json);
+
+		if (enigmaIotNode) {
+			buffer = enigmaIotNode->getPayloadBuffer (bufferSize);
+		}
+		if (len > bufferSize) {
+			buffer = (uint8_t*)malloc (len);
+			if (!buffer) {
+				DEBUG_WARN ("---- Error allocating %u bytes", len);
+				return false;
+			}
+			bufferSize = len;
+			allocated = true;
+		}
+		len = serializeMsgPack (json, (char*)buffer, bufferSize);
+
+#if DEBUG_LEVEL >= DBG
+		char strBuffer[MAX_DATA_PAYLOAD_SIZE + 1]; // Longer messages are shown truncated
+		serializeJson (json, strBuffer, sizeof (strBuffer));
+		DEBUG_DBG ("Trying to send: %s", strBuffer);
+#endif
 		bool result = false;
 		if (sendData)
 			result = sendData (buffer, len, MSG_PACK);
@@ -132,8 +163,9 @@ protected:
 		} else {
 			DEBUG_INFO ("---- Data sent");
 		}
-		free (buffer);
-		free (strBuffer);
+		if (allocated) {
+			free (buffer);
+		}
 		return result;
 	}
 #elif ARDUINOJSON_VERSION_MAJOR == 5
@@ -15,38 +15,161 @@
 // Global configuration. Physical layer settings
 static const uint8_t ENIGMAIOT_PROT_VERS[3] = { 0,9,7 }; ///< @brief EnitmaIoT Version
 static const uint8_t DEFAULT_CHANNEL = 3; ///< @brief WiFi channel to be used on ESP-NOW
+static const uint8_t MAX_WIFI_CHANNEL = 14; ///< @brief Highest WiFi channel number
 static const uint32_t FLASH_LED_TIME = 30; ///< @brief Time that led keeps on during flash in ms
 static const int RESET_PIN_DURATION = 5000; ///< @brief Number of milliseconds that reset pin has to be grounded to produce a configuration reset
 #define TZINFO "CET-1CEST-2,M3.5.0/02:00:00,M10.5.0/03:00:00" ///< @brief Time zone
 #define NTP_SERVER_1 "pool.ntp.org"
 #define NTP_SERVER_2 "time.nist.gov"
+#ifndef MAX_FRAGMENTED_PAYLOAD_SIZE
+static const size_t MAX_FRAGMENTED_PAYLOAD_SIZE = 1024; ///< @brief Maximum length of user data that is sent splitted in several messages. Maximum is 32 fragments
+#endif //MAX_FRAGMENTED_PAYLOAD_SIZE
+#ifndef FRAGMENT_TIMEOUT
+static const uint32_t FRAGMENT_TIMEOUT = 2000; ///< @brief Time in ms without new fragments after which an incomplete payload is discarded
+#endif //FRAGMENT_TIMEOUT
+#ifndef ENABLE_MULTI_GATEWAY
+#define ENABLE_MULTI_GATEWAY 0 ///< @brief Allow several gateways to serve the same network, on different channels. Gateways advertise their load so that nodes choose the least loaded one, and session tickets are accepted by all of them. Gateways need to keep real world time synchronized, for instance using NTP. Set it equally on gateways and nodes
+#endif // ENABLE_MULTI_GATEWAY
+#ifndef ENABLE_LINK_ADAPTATION
+#define ENABLE_LINK_ADAPTATION 0 ///< @brief Gateway recommends every node a TX power reduction from its lost messages and reported RSSI, so that nodes close to gateway spend less energy per message. Set it equally on gateways and nodes
+#endif // ENABLE_LINK_ADAPTATION
+#ifndef LINK_ADAPTATION_WINDOW
+static const uint8_t LINK_ADAPTATION_WINDOW = 32; ///< @brief Number of data messages without losses after which gateway recommends a lower TX power
+#endif // LINK_ADAPTATION_WINDOW
+static const uint8_t LINK_ADAPTATION_STEP = 2; ///< @brief TX power change in dB on every adaptation step
+#ifndef LINK_ADAPTATION_MAX_REDUCTION
+static const uint8_t LINK_ADAPTATION_MAX_REDUCTION = 16; ///< @brief Maximum TX power reduction in dB. Maximum is 18
+#endif // LINK_ADAPTATION_MAX_REDUCTION
+#ifndef LINK_ADAPTATION_LOST_RAISE
+static const uint8_t LINK_ADAPTATION_LOST_RAISE = 2; ///< @brief Number of lost messages inside a window that make gateway raise node TX power two steps
+#endif // LINK_ADAPTATION_LOST_RAISE
+#ifndef LINK_ADAPTATION_MIN_RSSI
+static const int8_t LINK_ADAPTATION_MIN_RSSI = -75; ///< @brief Gateway does not lower TX power of a node if its signal, estimated from RSSI reported by node, would get under this value in dBm
+#endif // LINK_ADAPTATION_MIN_RSSI
 
 // Gateway configuration
 static const unsigned int MAX_KEY_VALIDITY = 86400000U; ///< @brief After this time (in ms) a node is unregistered. Setting this to 0 means imfinite
 static const unsigned int MAX_NODE_INACTIVITY = 86400000U; ///< @brief After this time (in ms) a node is marked as gone. Setting this to 0 means imfinite
-static const size_t MAX_MQTT_QUEUE_SIZE = 3; ///< @brief Maximum number of MQTT messages to be sent
-#define ENABLE_STATUS_MESSAGES 1 ///< @brief Enable sending status message after every data message
+#ifndef SESSION_TICKET_VALIDITY
+static const uint32_t SESSION_TICKET_VALIDITY = 604800000U; ///< @brief Time (in ms) a session resumption ticket is accepted after it was issued. Setting this to 0 disables session resumption. Maximum is 49 days
+#endif // SESSION_TICKET_VALIDITY
+static const size_t MAX_MQTT_QUEUE_SIZE = 32; ///< @brief Maximum number of MQTT messages waiting to be sent. Queue size is also limited in bytes
+#ifndef ENABLE_STATUS_MESSAGES
+#define ENABLE_STATUS_MESSAGES 0 ///< @brief Enable sending status message after every data message
+#endif // ENABLE_STATUS_MESSAGES
+#ifndef ENABLE_AGGREGATED_STATUS
+#define ENABLE_AGGREGATED_STATUS 1 ///< @brief Enable sending status of all active nodes periodically, in as few messages as possible
+#endif // ENABLE_AGGREGATED_STATUS
+#ifndef AGGREGATED_STATUS_PERIOD
+static const uint32_t AGGREGATED_STATUS_PERIOD = 60000; ///< @brief Period in ms to send aggregated status of all active nodes
+#endif // AGGREGATED_STATUS_PERIOD
 static const int RATE_AVE_ORDER = 5; ///< @brief Message rate filter order
 static const int MAX_INPUT_QUEUE_SIZE = 3; ///< @brief Input queue size for EnigmaIOT messages. Acts as a buffer to be able to handle messages during high load
+#ifndef INPUT_QUEUE_DRAIN_MESSAGES
+static const int INPUT_QUEUE_DRAIN_MESSAGES = MAX_INPUT_QUEUE_SIZE; ///< @brief Maximum number of input messages processed on every `handle()` call. Setting this to 0 means no limit
+#endif //INPUT_QUEUE_DRAIN_MESSAGES
+#ifndef INPUT_QUEUE_DRAIN_TIME
+static const uint32_t INPUT_QUEUE_DRAIN_TIME = 20; ///< @brief Maximum time in ms spent processing input messages on every `handle()` call. Setting this to 0 means no limit
+#endif //INPUT_QUEUE_DRAIN_TIME
+#ifndef ENABLE_GATEWAY_PIPELINE
+#define ENABLE_GATEWAY_PIPELINE 0 ///< @brief Only for ESP32. Gateway processes messages on its own task, pinned to `GATEWAY_TASK_CORE`, and passes notifications to output task through a queue. See `EnigmaIOTGatewayClass::startPipeline()`
+#endif // ENABLE_GATEWAY_PIPELINE
+#ifndef OUTPUT_QUEUE_SIZE
+static const int OUTPUT_QUEUE_SIZE = 8; ///< @brief Number of notifications that may wait for output task when `ENABLE_GATEWAY_PIPELINE` is set. Every one takes about `MAX_FRAGMENTED_PAYLOAD_SIZE` bytes
+#endif // OUTPUT_QUEUE_SIZE
+#ifndef GATEWAY_TASK_CORE
+static const int GATEWAY_TASK_CORE = 0; ///< @brief Core that runs gateway task when `ENABLE_GATEWAY_PIPELINE` is set. Arduino `loop()` runs on the other one
+#endif // GATEWAY_TASK_CORE
+#ifndef MAX_DOWNLINK_INFLIGHT
+static const int MAX_DOWNLINK_INFLIGHT = 4; ///< @brief Maximum number of downlink messages waiting for delivery confirmation from ESP-NOW layer. Minimum is 1
+#endif //MAX_DOWNLINK_INFLIGHT
+#ifndef DOWNLINK_MAX_RETRIES
+static const uint8_t DOWNLINK_MAX_RETRIES = 2; ///< @brief Number of times a downlink message is resent if ESP-NOW layer reports it was not delivered
+#endif //DOWNLINK_MAX_RETRIES
+#ifndef DOWNLINK_INFLIGHT_WAIT
+static const uint32_t DOWNLINK_INFLIGHT_WAIT = 50; ///< @brief Maximum time in ms that a downlink message waits for a free slot when too many messages are waiting for delivery confirmation
+#endif //DOWNLINK_INFLIGHT_WAIT
+#ifndef DOWNLINK_CONFIRM_TIMEOUT
+static const uint32_t DOWNLINK_CONFIRM_TIMEOUT = 500; ///< @brief Time in ms after which a downlink message without delivery confirmation is considered lost
+#endif //DOWNLINK_CONFIRM_TIMEOUT
 #ifndef NUM_NODES
 static const int NUM_NODES = 20; ///< @brief Maximum number of nodes that this gateway can handle
 #endif //NUM_NODES
+#ifndef OUTPUT_TOPIC_CACHE_SIZE
+static const int OUTPUT_TOPIC_CACHE_SIZE = NUM_NODES; ///< @brief Number of per node topic prefixes kept by every output module. Least recently used one is replaced when it is full
+#endif // OUTPUT_TOPIC_CACHE_SIZE
+#ifndef MAX_REGISTRATION_RATE
+static const uint8_t MAX_REGISTRATION_RATE = 4; ///< @brief Maximum number of key agreements per second that gateway processes. Every one needs a Curve25519 calculation. Nodes over this limit are told when to retry. 0 means no limit
+#endif // MAX_REGISTRATION_RATE
+#ifndef REGISTRATION_BURST
+static const uint8_t REGISTRATION_BURST = 4; ///< @brief Number of key agreements that gateway processes in a row before `MAX_REGISTRATION_RATE` applies
+#endif // REGISTRATION_BURST
+static const uint16_t MAX_REGISTRATION_RETRY = 60000; ///< @brief Maximum time in ms that gateway asks a node to wait before retrying registration
+#ifndef ENABLE_NODE_SNAPSHOT
+#define ENABLE_NODE_SNAPSHOT 0 ///< @brief Save registered node sessions to flash, encrypted, so that nodes do not need to register again after a gateway restart. Only used if network configuration is stored on flash
+#endif // ENABLE_NODE_SNAPSHOT
+#ifndef NODE_SNAPSHOT_MAX_SIZE
+static const size_t NODE_SNAPSHOT_MAX_SIZE = 16384; ///< @brief Node snapshot file is rewritten with current node sessions only when it grows over this size in bytes. Every node takes about 120 bytes
+#endif // NODE_SNAPSHOT_MAX_SIZE
+#ifndef NODE_SNAPSHOT_COUNTER_STEP
+static const uint16_t NODE_SNAPSHOT_COUNTER_STEP = 32; ///< @brief Node is saved on snapshot every time one of its message counters reaches a multiple of this value. Restored downlink counters are increased twice this value
+#endif // NODE_SNAPSHOT_COUNTER_STEP
+#ifndef ENABLE_GATEWAY_METRICS
+#define ENABLE_GATEWAY_METRICS 1 ///< @brief Enable counters and latency histograms of gateway message processing, published on REST API and gateway output
+#endif // ENABLE_GATEWAY_METRICS
+#ifndef METRICS_MESSAGE_TYPES
+static const uint8_t METRICS_MESSAGE_TYPES = 16; ///< @brief Number of message types that get their own processing time histogram. Other types are added to a common one
+#endif // METRICS_MESSAGE_TYPES
+#ifndef METRICS_HISTOGRAM_BUCKETS
+static const uint8_t METRICS_HISTOGRAM_BUCKETS = 14; ///< @brief Number of buckets of every latency histogram. First one ends at 16 us and every next one doubles. With 14 buckets last one is over 65 ms
+#endif // METRICS_HISTOGRAM_BUCKETS
+#ifndef METRICS_PUBLISH_PERIOD
+static const uint32_t METRICS_PUBLISH_PERIOD = 60000; ///< @brief Period in ms to publish gateway metrics on gateway output
+#endif // METRICS_PUBLISH_PERIOD
+#ifndef GATEWAY_LOAD_UPDATE_PERIOD
+static const uint32_t GATEWAY_LOAD_UPDATE_PERIOD = 1000; ///< @brief Period in ms to update load advertised on WiFi beacons, when `ENABLE_MULTI_GATEWAY` is set
+#endif // GATEWAY_LOAD_UPDATE_PERIOD
+#ifndef DOWNLINK_POOL_SIZE
+static const int DOWNLINK_POOL_SIZE = NUM_NODES; ///< @brief Number of downlink messages for sleepy nodes that gateway can hold, shared by all nodes. Every one takes `MAX_MESSAGE_LENGTH` bytes
+#endif //DOWNLINK_POOL_SIZE
+#ifndef MAX_NODE_DOWNLINK_QUEUE
+static const uint8_t MAX_NODE_DOWNLINK_QUEUE = 4; ///< @brief Maximum number of downlink messages queued for a single sleepy node
+#endif //MAX_NODE_DOWNLINK_QUEUE
 #ifndef CONNECT_TO_WIFI_AP
 #define CONNECT_TO_WIFI_AP 1 ///< @brief In projects where gateway should not be connected to WiFi (for instance a data logger to SD) it may be useful to disable WiFi setting this to 0. Set it to 1 otherwise
 #endif //CONNECT_TO_WIFI_AP
 
 // Node configuration
 static const int16_t RECONNECTION_PERIOD = 1500; ///< @brief Time to retry Gateway connection
-static const uint16_t DOWNLINK_WAIT_TIME = 350; ///< @brief Time to wait for downlink message before sleep. Setting less than 180 ms causes ESP-NOW errors due to lack of ACK processing
+static const uint16_t DOWNLINK_WAIT_TIME = 350; ///< @brief Maximum time to wait for downlink message before sleep. Node sleeps earlier if gateway signals it has nothing queued. Setting less than 180 ms causes ESP-NOW errors due to lack of ACK processing
 static const uint32_t DEFAULT_SLEEP_TIME = 10; ///< @brief Default sleep time if it was not set
 static const time_t IDENTIFY_TIMEOUT = 10000; ///< @brief How long LED will be flashing during identification
 #ifndef TIME_SYNC_PERIOD
 static const uint32_t TIME_SYNC_PERIOD = 30000; ///< @brief Period of clock synchronization request
 #endif // TIME_SYNC_PERIOD
+#ifndef MAX_TIME_SYNC_PERIOD
+static const uint32_t MAX_TIME_SYNC_PERIOD = 900000; ///< @brief Maximum period of clock synchronization request. Period is doubled from `TIME_SYNC_PERIOD` up to this value while clock keeps accurate
+#endif // MAX_TIME_SYNC_PERIOD
 static const unsigned int QUICK_SYNC_TIME = 5000; ///< @brief Period of clock synchronization request in case of resync is needed 
-static const uint32_t PRE_REG_DELAY = 5000; ///< @brief Time to wait before registration so that other nodes have time to communicate. Real delay is a random lower than this value.
-static const uint32_t POST_REG_DELAY = 1500; ///< @brief Time to wait before sending data after registration so that other nodes have time to finish their registration. Real delay is a random lower than this value.
+static const uint32_t PRE_REG_DELAY = 5000; ///< @brief Time to wait before registration so that other nodes have time to communicate. Real delay is a random lower than this value. It is not applied when node resumes its session
 static const uint8_t COMM_ERRORS_BEFORE_SCAN = 2; ///< @brief Node will search for a gateway if this number of communication errors have happened.
+#ifndef ENABLE_FAST_GATEWAY_DISCOVERY
+#define ENABLE_FAST_GATEWAY_DISCOVERY 1 ///< @brief Before scanning all channels, node probes last known gateway on its last channel, on channels where it was found before and on neighbour ones. A gateway that is back after a short outage is found in a few milliseconds instead of seconds
+#endif // ENABLE_FAST_GATEWAY_DISCOVERY
+#ifndef GATEWAY_PROBE_TIMEOUT
+static const uint32_t GATEWAY_PROBE_TIMEOUT = 50; ///< @brief Maximum time in ms to wait for gateway acknowledge on every probed channel
+#endif // GATEWAY_PROBE_TIMEOUT
+#ifndef GATEWAY_RSSI_MARGIN
+static const int8_t GATEWAY_RSSI_MARGIN = 10; ///< @brief When `ENABLE_MULTI_GATEWAY` is set, node chooses the least loaded gateway among those whose RSSI is up to this number of dB lower than the best one
+#endif // GATEWAY_RSSI_MARGIN
+#ifndef OTA_WINDOW_SIZE
+static const uint8_t OTA_WINDOW_SIZE = 16; ///< @brief Maximum number of OTA chunks that node accepts out of order in windowed OTA mode. Maximum is 32. Each one takes `MAX_DATA_PAYLOAD_SIZE` bytes of RAM during OTA
+#endif // OTA_WINDOW_SIZE
+static const uint32_t OTA_ACK_TIMEOUT = 1000; ///< @brief On windowed OTA, time in ms without new chunks after which node repeats its selective acknowledge
+static const uint32_t OTA_NAK_HOLDOFF = 250; ///< @brief On multicast OTA, minimum time in ms between two repair requests caused by chunks out of window
+#ifndef BATCH_MAX_DELAY
+static const uint32_t BATCH_MAX_DELAY = 10000; ///< @brief Default maximum time in ms that a reading waits on batch buffer before it is sent. Maximum is `BATCH_AGE_RESOLUTION` * 65535
+#endif // BATCH_MAX_DELAY
 
 //Web API
 #define ENABLE_WEB_API 1 ///< @brief Enable Web API support on gateway
@@ -57,5 +180,17 @@ static const uint8_t COMM_ERRORS_BEFORE_SCAN = 2; ///< @brief Node will search f
 // DON'T ENABLE DEBUG IF YOU CAN ONLY DO OTA UPDATE. YOU MAY BE UNABLE TO DO OTA UPDATE ANYMORE UNTIL YOU FLASH THE NODE THROUGH WIRE
 #define DEBUG_LEVEL WARN ///< @brief Possible values VERBOSE, DBG, INFO, WARN, ERROR, NONE
 #endif //DEBUG_LEVEL
+#ifndef DEBUG_DEFERRED
+#define DEBUG_DEFERRED 0 ///< @brief Store debug messages as binary records and format them later, when gateway or node is idle, so that debug output changes timing as little as possible
+#endif //DEBUG_DEFERRED
+#ifndef DEBUG_DEFERRED_BUFFER_SIZE
+static const size_t DEBUG_DEFERRED_BUFFER_SIZE = 4096; ///< @brief RAM buffer size in bytes for deferred debug records. Records are discarded while it is full
+#endif //DEBUG_DEFERRED_BUFFER_SIZE
+#ifndef DEBUG_DEFERRED_PROCESS_TIME
+static const uint32_t DEBUG_DEFERRED_PROCESS_TIME = 5; ///< @brief Maximum time in ms spent printing deferred debug records on every idle `handle()` call
+#endif //DEBUG_DEFERRED_PROCESS_TIME
+static const uint8_t DEBUG_DEFERRED_MAX_RECORD = 128; ///< @brief Maximum length of a deferred debug record. Arguments that do not fit are discarded. Maximum is 255
+static const uint8_t DEBUG_DEFERRED_MAX_STRING = 32; ///< @brief Maximum number of characters of a string argument that are stored on a deferred debug record
+static const uint8_t DEBUG_DEFERRED_MAX_HEX = 32; ///< @brief Maximum number of bytes of a hex buffer argument that are stored on a deferred debug record
 
 #endif
@@ -24,12 +24,43 @@ static const uint8_t NETWORK_NAME_LENGTH = 21; ///< @brief Maximum number of cha
 static const uint8_t NODE_NAME_LENGTH = 33; ///< @brief Maximum number of characters of node name
 static const uint8_t BROADCAST_ADDRESS[] = { 0xff,0xff,0xff,0xff,0xff,0xff }; ///< @brief Broadcast address
 static const char BROADCAST_NONE_NAME[] = "broadcast"; ///< @brief Name to reference broadcast node
+static const char GROUP_ADDRESS_PREFIX = '@'; ///< @brief Downlink addresses that start with this character are multicast group names
+#ifndef ESPNOW_PEER_CACHE_SIZE
+static const uint8_t ESPNOW_PEER_CACHE_SIZE = 16; ///< @brief Number of peers that gateway keeps registered on ESP32 ESP-NOW peer list. Least recently used one is replaced when it is full. ESP-NOW limit is 20
+#endif // ESPNOW_PEER_CACHE_SIZE
+#ifndef ESPNOW_MAX_PENDING_SENDS
+static const uint8_t ESPNOW_MAX_PENDING_SENDS = 8; ///< @brief Number of sent messages that ESP-NOW layer can keep waiting for sending status, to match it with message tag
+#endif // ESPNOW_MAX_PENDING_SENDS
+#ifndef LOOPBACK_QUEUE_SIZE
+static const uint8_t LOOPBACK_QUEUE_SIZE = 32; ///< @brief Number of messages that loopback communication layer can keep queued on every direction
+#endif // LOOPBACK_QUEUE_SIZE
 
 // Gateway configuration
 static const int OTA_GW_TIMEOUT = 11000; ///< @brief OTA mode timeout. In OTA mode all data messages are ignored
 #ifndef DISCONNECT_ON_DATA_ERROR
 static const bool DISCONNECT_ON_DATA_ERROR = true; ///< @brief Activates node invalidation in case of data error
 #endif //DISCONNECT_ON_DATA_ERROR
+#ifndef MAX_NODE_GROUPS
+static const uint8_t MAX_NODE_GROUPS = 16; ///< @brief Maximum number of multicast groups that gateway can handle. Maximum is 16
+#endif // MAX_NODE_GROUPS
+#ifndef ANTI_REPLAY_WINDOW
+static const uint8_t ANTI_REPLAY_WINDOW = 32; ///< @brief Number of latest uplink message counters tracked for every node. Messages that arrive out of order inside this window are accepted once. Maximum is 32
+#endif // ANTI_REPLAY_WINDOW
+#ifndef GATEWAY_TASK_PRIORITY
+static const int GATEWAY_TASK_PRIORITY = 2; ///< @brief FreeRTOS priority of gateway task when `ENABLE_GATEWAY_PIPELINE` is set. Arduino `loop()` task has priority 1
+#endif // GATEWAY_TASK_PRIORITY
+#ifndef GATEWAY_TASK_STACK_SIZE
+static const uint32_t GATEWAY_TASK_STACK_SIZE = 8192; ///< @brief Stack size of gateway task in bytes
+#endif // GATEWAY_TASK_STACK_SIZE
+#ifndef GATEWAY_TASK_IDLE_WAIT
+static const uint32_t GATEWAY_TASK_IDLE_WAIT = 10; ///< @brief Maximum time in ms that gateway task sleeps waiting for new messages. Maintenance tasks run at least with this period
+#endif // GATEWAY_TASK_IDLE_WAIT
+#ifndef MAX_OUTPUT_SINKS
+static const int MAX_OUTPUT_SINKS = 4; ///< @brief Maximum number of output modules that `GatewayOutput_fanout` can send every message to
+#endif // MAX_OUTPUT_SINKS
+#ifndef OUTPUT_TOPIC_PREFIX_LENGTH
+static const uint8_t OUTPUT_TOPIC_PREFIX_LENGTH = 64; ///< @brief Maximum length of a cached topic prefix, `<network name>/<node address | node name>/`. Longer ones are formatted on every message
+#endif // OUTPUT_TOPIC_PREFIX_LENGTH
 #ifndef ENABLE_REST_API
 #define ENABLE_REST_API 1 ///< Set to 1 to enable REST API
 #endif // ENABLE_REST_API
@@ -37,7 +68,29 @@ static const bool DISCONNECT_ON_DATA_ERROR = true; ///< @brief Activates node in
 // Node configuration
 static const uint32_t OTA_TIMEOUT_TIME = 10000; ///< @brief Timeout between OTA messages. In milliseconds
 static const int MIN_SYNC_ACCURACY = 5000; ///< @brief If calculated offset absolute value is higher than this value resync is done more often. us units
+static const uint8_t TIME_SYNC_SAMPLES = 4; ///< @brief Number of clock synchronization samples kept. The one with lowest round trip delay is used to adjust clock
+static const int CLOCK_SLEW_RATE = 500; ///< @brief Maximum rate used to slew clock when correcting an offset. ppm units
+static const int CLOCK_STEP_THRESHOLD = 128000; ///< @brief Offsets higher than this value are corrected with a clock step instead of slewing. us units
+static const int MAX_CLOCK_DRIFT = 500; ///< @brief Maximum clock drift that is compensated. ppm units
+static const uint32_t CLOCK_DRIFT_TIME_CONSTANT = 300000; ///< @brief Weight of every new drift estimation is `interval / (interval + CLOCK_DRIFT_TIME_CONSTANT)`, so that samples that are close in time, and noisier, have less influence. ms units
+static const int TIME_SAMPLE_DISPERSION = 15; ///< @brief Rate at which clock synchronization samples lose accuracy as they get older. Used to select the best sample. ppm units
 static const int MAX_DATA_PAYLOAD_SIZE = 214; ///< @brief Maximun payload size for data packets
+#ifndef MAX_NODE_GROUP_KEYS
+static const uint8_t MAX_NODE_GROUP_KEYS = 4; ///< @brief Maximum number of multicast groups that a node can be member of. Every one takes 33 bytes on flash
+#endif // MAX_NODE_GROUP_KEYS
+static const uint8_t BATCH_AGE_RESOLUTION = 10; ///< @brief Time units in ms used to encode reading age on batched data messages
+static const uint8_t BATCH_RECORD_HEADER_LENGTH = 4; ///< @brief Age (2), encoding (1) and length (1) header that precedes every reading on batched data messages
+static const uint8_t FRAGMENT_HEADER_LENGTH = 4; ///< @brief Transfer id (1), index (1), count (1) and encoding (1) header that precedes every fragment of a long payload
+static const int FRAGMENT_PAYLOAD_SIZE = MAX_DATA_PAYLOAD_SIZE - FRAGMENT_HEADER_LENGTH; ///< @brief Payload bytes carried by every fragment but the last one
+static const uint32_t FRAGMENT_SEND_INTERVAL = 5; ///< @brief Time in ms between consecutive fragments sent by node, to avoid ESP-NOW send errors
+#ifndef SCHEMA_MAX_FIELDS
+static const uint8_t SCHEMA_MAX_FIELDS = 16; ///< @brief Maximum number of fields of a data schema
+#endif // SCHEMA_MAX_FIELDS
+static const uint8_t SCHEMA_FIELD_NAME_LENGTH = 15; ///< @brief Maximum number of characters of a schema field name
+#ifndef SCHEMA_KEY_FRAME_INTERVAL
+static const uint8_t SCHEMA_KEY_FRAME_INTERVAL = 16; ///< @brief Number of schema data messages that carry differences to last key frame before node sends a new key frame
+#endif // SCHEMA_KEY_FRAME_INTERVAL
+static const uint8_t SCHEMA_REQUEST_INTERVAL = 8; ///< @brief Gateway asks node for its schema again after this number of schema data messages that could not be expanded
 #ifndef CHECK_COMM_ERRORS
 static const bool CHECK_COMM_ERRORS = true; ///< @brief Try to reconnect in case of communication errors
 #endif // CHECK_COMM_ERRORS
@@ -45,13 +98,44 @@ static const uint32_t RTC_ADDRESS = 8; ///< @brief RTC memory address where to s
 #ifndef USE_FLASH_INSTEAD_RTC
 #define USE_FLASH_INSTEAD_RTC 0 ///< @brief Use flash instead RTC for temporary context data. ATTENTION: This allows connection to survive power off cycles but may damage flash memory persistently.
 #endif // USE_FLASH_INSTEAD_RTC
+#ifndef CONTEXT_JOURNAL_MAX_DELTA
+static const uint8_t CONTEXT_JOURNAL_MAX_DELTA = 32; ///< @brief Maximum number of changed context bytes that are appended to flash journal. Bigger changes rewrite context file
+#endif // CONTEXT_JOURNAL_MAX_DELTA
+#ifndef CONTEXT_JOURNAL_MAX_SIZE
+static const size_t CONTEXT_JOURNAL_MAX_SIZE = 4096; ///< @brief Maximum flash context journal length. Context is compacted to a single file when it is reached
+#endif // CONTEXT_JOURNAL_MAX_SIZE
 
 //Crypto configuration
 const uint8_t KEY_LENGTH = 32; ///< @brief Key length used by selected crypto algorythm. The only tested value is 32. Change it only if you know what you are doing
 const uint8_t IV_LENGTH = 12; ///< @brief Initalization vector length used by selected crypto algorythm
 const uint8_t TAG_LENGTH = 16; ///< @brief Authentication tag length. For Poly1305 it is always 16
 const uint8_t AAD_LENGTH = 8; ///< @brief Number of bytes from last part of key that will be used for additional authenticated data
+const uint8_t SESSION_TICKET_LENGTH = 16; ///< @brief Length of session resumption ticket issued by gateway
+const uint8_t RESUME_NONCE_LENGTH = 8; ///< @brief Length of random numbers exchanged by node and gateway to derive a resumed session key
 #define CYPHER_TYPE ChaChaPoly
+/**
+  * @brief Authenticated encryption algorithms that may be used on node sessions. Values can be combined as a bit mask
+  */
+enum cipherAlgorithm_t {
+	CHACHAPOLY_CIPHER = 0x01, /**< ChaCha20-Poly1305. Software implementation, available on every platform */
+	AES_GCM_CIPHER = 0x02 /**< AES-GCM through mbedTLS. Hardware accelerated on ESP32 */
+};
+#ifndef USE_HW_CRYPTO
+#define USE_HW_CRYPTO 0 ///< @brief Set to 1 on ESP32 to support hardware accelerated AES-GCM. A node with this enabled requests AES-GCM on registration, so its gateway needs it enabled too. Otherwise ChaCha20-Poly1305 is used
+#endif // USE_HW_CRYPTO
+#if USE_HW_CRYPTO && !defined ESP32
+#error USE_HW_CRYPTO is only supported on ESP32
+#endif
+#if USE_HW_CRYPTO
+static const uint8_t SUPPORTED_CIPHERS = CHACHAPOLY_CIPHER | AES_GCM_CIPHER; ///< @brief Algorithms that this device is able to use for node sessions
+static const cipherAlgorithm_t PREFERRED_CIPHER = AES_GCM_CIPHER; ///< @brief Algorithm selected for node sessions if both peers support it
+#else
+static const uint8_t SUPPORTED_CIPHERS = CHACHAPOLY_CIPHER; ///< @brief Algorithms that this device is able to use for node sessions
+static const cipherAlgorithm_t PREFERRED_CIPHER = CHACHAPOLY_CIPHER; ///< @brief Algorithm selected for node sessions if both peers support it
+#endif // USE_HW_CRYPTO
+#ifndef CIPHER_CONTEXT_CACHE_SIZE
+static const int CIPHER_CONTEXT_CACHE_SIZE = 4; ///< @brief Number of cipher contexts that are kept with its key already loaded. Least recently used one is replaced when a new key is needed
+#endif // CIPHER_CONTEXT_CACHE_SIZE
 
 //Web API
 const int WEB_API_PORT = 80; ///< @brief TCP port where Web API will listen through
@@ -17,6 +17,9 @@ float FilterClass::addValue (float value) {
 	case MEDIAN_FILTER:
 		return medianFilter (value);
 		break;
+	case EWMA_FILTER:
+		return ewmaFilter (value);
+		break;
 	default:
 		return value;
 	}
@@ -30,8 +33,12 @@ float FilterClass::addWeigth (float coeff) {
 	}
 	_weightValues[0] = coeff;
 
+	_uniformWeights = true;
 	for (int i = 0; i < _order; i++) {
 		sumWeight += _weightValues[i];
+		if (_weightValues[i] != _weightValues[0]) {
+			_uniformWeights = false;
+		}
 	}
 
 	//DEBUG_VERBOSE ("SumWeight: %f", sumWeight);
@@ -39,90 +46,81 @@ float FilterClass::addWeigth (float coeff) {
 	return sumWeight;
 }
 
+void FilterClass::setAlpha (float alpha) {
+	if (alpha > 0 && alpha <= 1) {
+		_alpha = alpha;
+	}
+}
 
 float FilterClass::aveFilter (float value) {
 	float sumValue = 0;
 	float sumWeight = 0;
 	float procValue;
-	int left, right;
-
-	for (int i = 0; i < _order - 1; i++) {
-		_rawValues[i] = _rawValues[i + 1];
-	}
-	_rawValues[_order - 1] = value;
+	float oldest = _rawValues[_head];
 
 	DEBUG_VERBOSE ("Value: %f\n", value);
 
-	DEBUG_VERBOSE ("Raw values:");
-	for (int i = 0; i < _order; i++) {
-		DEBUG_VERBOSE (" %f", _rawValues[i]);
-	}
-
-	DEBUG_VERBOSE ("Coeffs:");
-	for (int i = 0; i < _order; i++) {
-		DEBUG_VERBOSE (" %f", _weightValues[i]);
-	}
+	_rawValues[_head] = value;
+	_head = (_head + 1) % _order;
 
 	if (_index < _order) {
 		_index++;
-		left = _order - _index;
-		right = _order - 1;
-	} 	else {
-		left = 0;
-		right = _order - 1;
-	}
-	DEBUG_VERBOSE ("Index: %d , left: %d , right: %d\n", _index, left, right);
-
-	for (int i = left; i <= right; i++) {
-		sumValue += _rawValues[i] * _weightValues[i];
-		sumWeight += _weightValues[i];
-		//DBG_OUTPUT_PORT.printf("Raw value %d: %f\n", (i + 1), _rawValues[_order - (i+1)]);
+		_sum += value;
+	} else if (_head == 0) {
+		// Recalculate sum once on every round so that rounding errors do not accumulate
+		_sum = 0;
+		for (int i = 0; i < _order; i++) {
+			_sum += _rawValues[i];
+		}
+	} else {
+		_sum += value - oldest;
+	}
+	DEBUG_VERBOSE ("Index: %d , head: %d\n", _index, _head);
+
+	if (_uniformWeights) {
+		procValue = _sum / _index;
+	} else {
+		// Newest value uses last weight value
+		for (int i = 0; i < _index; i++) {
+			int idx = (_head + _order - 1 - i) % _order;
+			sumValue += _rawValues[idx] * _weightValues[_order - 1 - i];
+			sumWeight += _weightValues[_order - 1 - i];
+		}
+		DEBUG_VERBOSE ("Sum: %f", sumValue);
+		DEBUG_VERBOSE (" SumWeight: %f\n", sumWeight);
+		procValue = sumValue / sumWeight;
 	}
-	DEBUG_VERBOSE ("Sum: %f", sumValue);
-	DEBUG_VERBOSE (" SumWeight: %f\n", sumWeight);
-
-	procValue = sumValue / sumWeight;
 
 	DEBUG_VERBOSE ("Average: %f\n", procValue);
 
 	return procValue;
 }
 
-int FilterClass::divide (float* array, int start, int end) {
-	int left;
-	int right;
-	float pivot;
-	float temp;
-
-	pivot = array[start];
-	left = start;
-	right = end;
+float FilterClass::ewmaFilter (float value) {
+	if (_index == 0) {
+		_index++;
+		_ewma = value;
+	} else {
+		_ewma += _alpha * (value - _ewma);
+	}
 
-	// While indexes do not cross
-	while (left < right) {
-		while (array[right] > pivot) {
-			right--;
-		}
+	DEBUG_VERBOSE ("EWMA: %f\n", _ewma);
+	return _ewma;
+}
 
-		while ((left < right) && (array[left] <= pivot)) {
-			left++;
-		}
+int FilterClass::findOrdered (float value, int count, bool after) {
+	int left = 0;
+	int right = count;
 
-		// If indexes have not crossed yet we continue doing exchanges
-		if (left < right) {
-			temp = array[left];
-			array[left] = array[right];
-			array[right] = temp;
+	while (left < right) {
+		int middle = (left + right) / 2;
+		if (_orderedValues[middle] < value || (after && _orderedValues[middle] == value)) {
+			left = middle + 1;
+		} else {
+			right = middle;
 		}
 	}
-
-	// Indexes have crossed. We put the pivot on place
-	temp = array[right];
-	array[right] = array[start];
-	array[start] = temp;
-
-	// NEw pivot position
-	return right;
+	return left;
 }
 
 void FilterClass::clear () {
@@ -132,6 +130,9 @@ void FilterClass::clear () {
 		//_weightValues[i] = 1;
 	}
 	_index = 0;
+	_head = 0;
+	_sum = 0;
+	_ewma = 0;
 }
 
 FilterClass::~FilterClass () {
@@ -140,82 +141,36 @@ FilterClass::~FilterClass () {
 	free (_weightValues);
 }
 
-void FilterClass::quicksort (float* array, int start, int end) {
-	float pivot;
-
-	if (start < end) {
-		pivot = divide (array, start, end);
-
-		// Ordeno la lista de los menores
-		quicksort (array, start, pivot - 1);
-
-		// Ordeno la lista de los mayores
-		quicksort (array, pivot + 1, end);
-	}
-}
-
 float FilterClass::medianFilter (float value) {
 	float procValue;
-	int medianIdx;
-	int left, right, tempidx;
-	bool even;
-
-	if (_index < _order) {
+	int count = _index;
+	int pos;
+
+	// Take oldest value out of ordered window
+	if (count == _order) {
+		pos = findOrdered (_rawValues[_head], count, false);
+		memmove (_orderedValues + pos, _orderedValues + pos + 1, (count - pos - 1) * sizeof (float));
+		count--;
+	} else {
 		_index++;
-		left = _order - _index;
-		right = _order - 1;
-		even = ((right - left) % 2) == 1;
-		DEBUG_VERBOSE ("%d: ", (right - left) % 2);
-		if (even) {
-			tempidx = (right - left - 1) / 2;
-			DEBUG_VERBOSE ("even\n");
-		} 		else {
-			tempidx = (right - left) / 2;
-			DEBUG_VERBOSE ("odd\n");
-		}
-		medianIdx = right - _index + 1 + tempidx;
-	} 	else {
-		left = 0;
-		right = _order - 1;
-		even = (_order % 2) == 0;
-		if (even)
-			tempidx = (right - 1) / 2;
-		else
-			tempidx = right / 2;
-		medianIdx = right - _index + 1 + tempidx;
 	}
-	DEBUG_VERBOSE ("Index: %d , left: %d , right: %d , even: %s , tempidx: %d , medianidx: %d\n", _index, left, right, (even ? "even" : "odd"), tempidx, medianIdx);
 
-	// Shift raw values
-	for (int i = 0; i < _order - 1; i++) {
-		_rawValues[i] = _rawValues[i + 1];
-	}
-	// Add new raw value
-	_rawValues[_order - 1] = value;
+	_rawValues[_head] = value;
+	_head = (_head + 1) % _order;
 
-	DEBUG_VERBOSE ("Raw values:");
-	for (int i = 0; i < _order; i++) {
-		DEBUG_VERBOSE (" %f", _rawValues[i]);
-	}
+	// Insert new value on its place
+	pos = findOrdered (value, count, true);
+	memmove (_orderedValues + pos + 1, _orderedValues + pos, (count - pos) * sizeof (float));
+	_orderedValues[pos] = value;
+	count++;
 
-	// copy to array before ordering
-	for (int i = 0; i < _order; i++) {
-		_orderedValues[i] = _rawValues[i];
-	}
-
-	// order values
-	quicksort (_orderedValues, left, right);
-
-	DEBUG_VERBOSE ("Ordered values:");
-	for (int i = 0; i < _order; i++) {
-		DEBUG_VERBOSE (" %f", _orderedValues[i]);
-	}
+	DEBUG_VERBOSE ("Index: %d , head: %d , inserted at: %d\n", _index, _head, pos);
 
 	// select median value
-	if (!even) {
-		procValue = _orderedValues[medianIdx];
+	if (count % 2) {
+		procValue = _orderedValues[count / 2];
 	} 	else { // there is no center value
-		procValue = (_orderedValues[medianIdx] + _orderedValues[medianIdx + 1]) / 2.0F;
+		procValue = (_orderedValues[count / 2 - 1] + _orderedValues[count / 2]) / 2.0F;
 	}
 
 	DEBUG_VERBOSE ("Median: %f\n", procValue);
@@ -248,5 +203,7 @@ FilterClass::FilterClass (FilterType_t type, uint8_t order) {
 		_weightValues[i] = 1;
 	}
 
+	_alpha = 2.0F / (_order + 1);
+
 }
 
@@ -23,17 +23,23 @@
   */
 typedef enum {
 	MEDIAN_FILTER, /**< Median filter */
-	AVERAGE_FILTER /**< Average filter */
+	AVERAGE_FILTER, /**< Average filter */
+	EWMA_FILTER /**< Exponentially weighted moving average. It does not need to store samples */
 } FilterType_t;
 
 class FilterClass {
 protected:
 	FilterType_t _filterType; ///< @brief Filter type from FilterType_t
 	uint8_t _order; ///< @brief Filter order. Numbre of samples to store for calculations
-	float* _rawValues; ///< @brief Raw values store
-	float* _orderedValues; ///< @brief Values ordered for median calculation
+	float* _rawValues; ///< @brief Raw values store. It is used as a ring buffer
+	float* _orderedValues; ///< @brief Values on filter window, kept in ascending order for median calculation
 	float* _weightValues; ///< @brief Weight values for average calculation. By default all them have value of 1 for arithmetic average
 	uint _index = 0;///< @brief Used to point latest entered value while number of values less than order
+	uint8_t _head = 0; ///< @brief Position on `_rawValues` where next value is written. It holds oldest value once buffer is full
+	float _sum = 0; ///< @brief Running sum of values on filter window
+	bool _uniformWeights = true; ///< @brief `true` if all weight values are equal, so average is calculated from running sum
+	float _alpha; ///< @brief Smoothing factor for EWMA filter
+	float _ewma = 0; ///< @brief Current EWMA filter output
 
 	/**
 	 * @brief Average filter calculation of next value
@@ -43,37 +49,43 @@ protected:
 	float aveFilter (float value);
 
 	/**
-	 * @brief Divide function to be used on Quick Sort
-	 * @param array Input array
-	 * @param start Start index
-	 * @param end End index
-	 * @return Returns new pivot position
+	 * @brief Median filter calculation of next value. Oldest value is removed from ordered window and new one is inserted on its place,
+	 * so no sorting is needed
+	 * @param value Next value to do calculation with
+	 * @return Returns calculated median
 	 */
-	int divide (float* array, int start, int end);
+	float medianFilter (float value);
 
 	/**
-	 * @brief Sorting function that uses QuickSort algorythm
-	 * @param array Input array
-	 * @param start Start index
-	 * @param end End index
+	 * @brief Exponentially weighted moving average calculation of next value
+	 * @param value Next value to do calculation with
+	 * @return Returns calculated average
 	 */
-	void quicksort (float* array, int start, int end);
+	float ewmaFilter (float value);
 
 	/**
-	 * @brief Median filter calculation of next value
-	 * @param value Next value to do calculation with
-	 * @return Returns calculated median
+	 * @brief Finds position of a value on ordered window using binary search
+	 * @param value Value to search for
+	 * @param count Number of values on ordered window
+	 * @param after If `true` it returns position after last value that is equal to searched one. First equal position otherwise
+	 * @return Position on `_orderedValues`
 	 */
-	float medianFilter (float value);
+	int findOrdered (float value, int count, bool after);
 
 public:
 	/**
 	 * @brief Creates a new filter class
 	 * @param type Filter type from FilterType_t
-	 * @param order Filter order
+	 * @param order Filter order. For EWMA filter it sets smoothing factor to 2 / (order + 1), equivalent to an average of that order
 	 */
 	FilterClass (FilterType_t type, uint8_t order);
 
+	/**
+	 * @brief Sets smoothing factor of EWMA filter
+	 * @param alpha Weight of every new value, from 0 to 1. Higher values follow changes faster
+	 */
+	void setAlpha (float alpha);
+
 	/**
 	 * @brief Adds a new weighting value. It is pushed on the array so latest value will be used for older data
 	 * @param coeff Next weighting coefficient
@@ -7,7 +7,9 @@
   */
 
 #include "GatewayAPI.h"
+#include "gatewayMetrics.h"
 #include <functional>
+#include <memory>
 
 using namespace std;
 using namespace placeholders;
@@ -20,10 +22,13 @@ const char* getGwInfoUri = "/api/gw/info";
 const char* getGwRestartUri = "/api/gw/restart";
 const char* getGwResettUri = "/api/gw/reset";
 const char* getNodeRestartUri = "/api/node/restart";
+const char* getGwMetricsUri = "/api/gw/metrics";
 const char* nodeIdParam = "nodeid";
 const char* nodeNameParam = "nodename";
 const char* nodeAddrParam = "nodeaddr";
 const char* confirmParam = "confirm";
+const char* offsetParam = "offset";
+const char* limitParam = "limit";
 
 void GatewayAPI::begin () {
 	//if (!gw) {
@@ -39,6 +44,9 @@ void GatewayAPI::begin () {
 	server->on (getGwRestartUri, HTTP_PUT, std::bind (&GatewayAPI::restartGw, this, _1));
     server->on (getGwResettUri, HTTP_PUT, std::bind (&GatewayAPI::resetGw, this, _1));
 	server->on (getNodeRestartUri, HTTP_PUT, std::bind (&GatewayAPI::restartNode, this, _1));
+#if ENABLE_GATEWAY_METRICS
+	server->on (getGwMetricsUri, HTTP_GET | HTTP_DELETE, std::bind (&GatewayAPI::gwMetrics, this, _1));
+#endif // ENABLE_GATEWAY_METRICS
 	server->onNotFound (std::bind (&GatewayAPI::onNotFound, this, _1));
 	server->begin ();
 }
@@ -143,7 +151,9 @@ const char* GatewayAPI::deleteNode (Node* node, int& resultCode) {
 		if (node->isRegistered ()) {
 			DEBUG_INFO ("Node %d is registered", node->getNodeId ());
 			resultCode = 200;
+			EnigmaIOTGateway.lock (); // Web server runs on its own task
 			EnigmaIOTGateway.invalidateKey (node, KICKED);
+			EnigmaIOTGateway.unlock ();
             return "{\"result\":\"ok\"}";
 		} else {
 			DEBUG_INFO ("Node %d is not registered", node->getNodeId ());
@@ -152,7 +162,10 @@ const char* GatewayAPI::deleteNode (Node* node, int& resultCode) {
 	return NULL;
 }
 
-char* GatewayAPI::getNodeInfo (Node* node, int& resultCode, char* nodeInfo, size_t len) {
+bool GatewayAPI::getNodeInfo (Node* node, int& resultCode, Print* nodeInfo) {
+	bool result = false;
+
+	EnigmaIOTGateway.lock ();
 	if (node) {
 		DEBUG_DBG ("Node %d is %p", node->getNodeId (), node);
 		if (node->isRegistered ()) {
@@ -160,13 +173,14 @@ char* GatewayAPI::getNodeInfo (Node* node, int& resultCode, char* nodeInfo, size
 			resultCode = 200;
 			time_t currentMillis = millis ();
 			uint8_t* version = node->getVersion ();
-            snprintf (nodeInfo, len, "{\"version\":\"%d.%d.%d\",\"node_id\":%d,\"address\":\"" MACSTR "\","\
+			char* name = node->getNodeName ();
+            nodeInfo->printf ("{\"version\":\"%d.%d.%d\",\"node_id\":%d,\"address\":\"" MACSTR "\","\
                       "\"Name\":\"%s\",\"keyValidSince\":%ld,\"lastMessageTime\":%ld,\"sleepy\":%s,"\
                       "\"Broadcast\":%s,\"TimeSync\":%s,\"rssi\":%d,\"packetsHour\":%f,\"per\":%f}",
 					  version[0], version[1], version[2],
 					  node->getNodeId (),
 					  MAC2STR (node->getMacAddress ()),
-					  node->getNodeName (),
+					  name ? name : "",
 					  currentMillis - node->getKeyValidFrom (),
 					  currentMillis - node->getLastMessageTime (),
 					  node->getSleepy () ? "True" : "False",
@@ -176,17 +190,20 @@ char* GatewayAPI::getNodeInfo (Node* node, int& resultCode, char* nodeInfo, size
 					  node->packetsHour,
 					  node->per
 			);
-			DEBUG_DBG ("NodeInfo: %s", nodeInfo);
-			return nodeInfo;
+			result = true;
 		} else {
 			DEBUG_INFO ("Node %d is not registered", node->getNodeId ());
 		}
 	}
-	return NULL;
+	EnigmaIOTGateway.unlock ();
+	return result;
 }
 
 bool GatewayAPI::restartNodeRequest (Node* node) {
-	return EnigmaIOTGateway.sendDownstream (node->getMacAddress (), NULL, 0, RESTART_NODE);
+	EnigmaIOTGateway.lock ();
+	bool result = EnigmaIOTGateway.sendDownstream (node->getMacAddress (), NULL, 0, RESTART_NODE);
+	EnigmaIOTGateway.unlock ();
+	return result;
 }
 
 void GatewayAPI::restartNode (AsyncWebServerRequest* request) {
@@ -194,11 +211,13 @@ void GatewayAPI::restartNode (AsyncWebServerRequest* request) {
 	int resultCode = 404;
 	char response[RESPONSE_SIZE];
 
+	EnigmaIOTGateway.lock (); // Node may be released by gateway task while it is used
 	node = getNodeFromParam (request);
 
 	DEBUG_WARN ("Send restart command to node %p", node);
 
 	bool result = restartNodeRequest (node);
+	EnigmaIOTGateway.unlock ();
 	if (result) {
 		snprintf (response, 30, "{\"node_restart\":\"processed\"}");
 		resultCode = 200;
@@ -215,11 +234,12 @@ void GatewayAPI::nodeOp (AsyncWebServerRequest* request) {
 	int resultCode = 404;
 	char response[RESPONSE_SIZE];
 
-	node = getNodeFromParam (request);
-
 	WebRequestMethodComposite method = request->method ();
 	DEBUG_INFO ("Method: %s", methodToString (request->method ()).c_str ());
 
+	EnigmaIOTGateway.lock (); // Node may be released by gateway task while it is used
+	node = getNodeFromParam (request);
+
 	if (method == HTTP_DELETE) {
 		DEBUG_INFO ("Delete node %p", node);
 		const char* strTemp = deleteNode (node, resultCode);
@@ -228,13 +248,18 @@ void GatewayAPI::nodeOp (AsyncWebServerRequest* request) {
 		}
 	} else if (method == HTTP_GET) {
 		DEBUG_INFO ("Info node %p", node);
-		const char* strTemp = getNodeInfo (node, resultCode, response, RESPONSE_SIZE);
-		DEBUG_DBG ("strTemp = %p", strTemp);
-		if (!strTemp) {
-			//strncpy (response, strTemp, 200);
-			resultCode = 404;
+		if (node && node->isRegistered ()) {
+			// Node info length depends on node name, so it is streamed instead of using a fixed buffer
+			AsyncResponseStream* stream = request->beginResponseStream ("application/json");
+			getNodeInfo (node, resultCode, stream);
+			EnigmaIOTGateway.unlock ();
+			stream->setCode (resultCode);
+			request->send (stream);
+			return;
 		}
+		resultCode = 404;
 	}
+	EnigmaIOTGateway.unlock ();
 	if (resultCode == 404) {
 		snprintf (response, 25, "{\"result\":\"not found\"}");
 	}
@@ -242,6 +267,22 @@ void GatewayAPI::nodeOp (AsyncWebServerRequest* request) {
 	request->send (resultCode, "application/json", response);
 }
 
+#if ENABLE_GATEWAY_METRICS
+void GatewayAPI::gwMetrics (AsyncWebServerRequest* request) {
+	if (request->method () == HTTP_DELETE) {
+		GatewayMetrics.reset ();
+		DEBUG_INFO ("Metrics reset");
+		request->send (200, "application/json", "{\"metrics_reset\":\"processed\"}");
+		return;
+	}
+
+	// Metrics length depends on number of message types seen, so it is streamed instead of using a fixed buffer
+	AsyncResponseStream* stream = request->beginResponseStream ("application/json");
+	GatewayMetrics.printJson (stream, true);
+	request->send (stream);
+}
+#endif // ENABLE_GATEWAY_METRICS
+
 void GatewayAPI::getMaxNodes (AsyncWebServerRequest* request) {
 	char response[25];
 
@@ -316,32 +357,105 @@ void GatewayAPI::resetGw (AsyncWebServerRequest* request) {
 }
 
 
-void GatewayAPI::getNodes (AsyncWebServerRequest* request) {
-	Node* node = NULL;
-
-	AsyncResponseStream* response = request->beginResponseStream ("application/json");
-	response->setCode (200);
+/**
+  * @brief Node list response state. It is kept between chunks
+  */
+struct node_list_cursor_t {
+	Node* node = NULL; /**< Last node whose entry was built. NULL before first one */
+	int remaining; /**< Number of nodes still to be listed */
+	int offset; /**< Number of active nodes skipped before first listed one */
+	bool started = false; /**< Response header has been built */
+	bool listed = false; /**< At least one node entry has been built */
+	bool finished = false; /**< Response footer has been built */
+	char piece[NODE_LIST_ENTRY_SIZE]; /**< Response piece being sent */
+	size_t length = 0; /**< Length of response piece */
+	size_t sent = 0; /**< Bytes of response piece already copied to output */
+};
+
+size_t GatewayAPI::fillNodeList (node_list_cursor_t* cursor, uint8_t* buffer, size_t maxLen) {
+	size_t written = 0;
+
+	// Cursor node points to static node array, so it is still valid on next chunk even if it has been released meanwhile
+	EnigmaIOTGateway.lock ();
+	while (written < maxLen) {
+		// Copy pending piece. It may take several chunks if output buffer is small
+		if (cursor->sent < cursor->length) {
+			size_t copyLen = cursor->length - cursor->sent;
+			if (copyLen > maxLen - written) {
+				copyLen = maxLen - written;
+			}
+			memcpy (buffer + written, cursor->piece + cursor->sent, copyLen);
+			cursor->sent += copyLen;
+			written += copyLen;
+			continue;
+		}
 
-	response->print ("{\"nodes\":[");
-	do {
-		bool first = (node == NULL);
-		node = EnigmaIOTGateway.nodelist.getNextActiveNode (node);
-		if (node && !first) {
-			DEBUG_DBG ("First is %s, node is %p", first ? "true" : "false", node);
-			response->print (',');
+		if (cursor->finished) {
+			break;
 		}
-		if (node) {
-			DEBUG_DBG ("LastNode: %u, node: %p", node->getNodeId (), node);
+
+		int pieceLen;
+		cursor->sent = 0;
+		if (!cursor->started) {
+			for (int i = 0; i < cursor->offset; i++) {
+				cursor->node = EnigmaIOTGateway.nodelist.getNextActiveNode (cursor->node);
+				if (!cursor->node) {
+					cursor->remaining = 0;
+					break;
+				}
+			}
+			pieceLen = snprintf (cursor->piece, NODE_LIST_ENTRY_SIZE, "{\"total\":%u,\"offset\":%d,\"nodes\":[",
+								 EnigmaIOTGateway.nodelist.countActiveNodes (), cursor->offset);
+			cursor->started = true;
+		} else {
+			Node* node = cursor->remaining > 0 ? EnigmaIOTGateway.nodelist.getNextActiveNode (cursor->node) : NULL;
+			if (node) {
+				char* name = node->getNodeName ();
+				DEBUG_DBG ("Got node. NodeId -> %u", node->getNodeId ());
+				pieceLen = snprintf (cursor->piece, NODE_LIST_ENTRY_SIZE, "%s{\"nodeId\":%u,\"address\":\"" MACSTR "\",\"name\":\"%s\"}",
+									 cursor->listed ? "," : "",
+									 node->getNodeId (),
+									 MAC2STR (node->getMacAddress ()),
+									 name ? name : "");
+				cursor->node = node;
+				cursor->listed = true;
+				cursor->remaining--;
+			} else {
+				pieceLen = snprintf (cursor->piece, NODE_LIST_ENTRY_SIZE, "]}");
+				cursor->finished = true;
+			}
 		}
-		if (node) {
-			DEBUG_DBG ("Got node. NodeId -> %u", node->getNodeId ());
-			response->printf ("{\"nodeId\":%u,\"address\":\"" MACSTR "\",\"name\":\"%s\"}",
-							  node->getNodeId (),
-							  MAC2STR (node->getMacAddress ()),
-							  node->getNodeName ());
+		if (pieceLen < 0) {
+			pieceLen = 0;
 		}
-	} while (node != NULL);
-	response->print ("]}");
+		cursor->length = (size_t)pieceLen < NODE_LIST_ENTRY_SIZE ? pieceLen : NODE_LIST_ENTRY_SIZE - 1;
+	}
+	EnigmaIOTGateway.unlock ();
+
+	return written;
+}
+
+void GatewayAPI::getNodes (AsyncWebServerRequest* request) {
+	std::shared_ptr<node_list_cursor_t> cursor (new node_list_cursor_t ());
+
+	cursor->offset = 0;
+	cursor->remaining = NUM_NODES;
+	if (request->hasParam (offsetParam)) {
+		cursor->offset = request->getParam (offsetParam)->value ().toInt ();
+	}
+	if (request->hasParam (limitParam)) {
+		cursor->remaining = request->getParam (limitParam)->value ().toInt ();
+	}
+	if (cursor->offset < 0 || cursor->remaining < 0) {
+		request->send (400, "application/json", "{\"result\":\"wrong parameter\"}");
+		return;
+	}
+
+	// Node list is built while it is sent, one entry at a time, so memory use does not depend on number of nodes
+	AsyncWebServerResponse* response = request->beginChunkedResponse ("application/json",
+		[this, cursor](uint8_t* buffer, size_t maxLen, size_t index) -> size_t {
+			return fillNodeList (cursor.get (), buffer, maxLen);
+		});
 	request->send (response);
 }
 
@@ -19,6 +19,9 @@
 #endif
 
 const size_t RESPONSE_SIZE = 250;  ///< @brief Maximum API response size
+const size_t NODE_LIST_ENTRY_SIZE = 100; ///< @brief Maximum size of a single node entry on node list response
+
+struct node_list_cursor_t;
 
 String methodToString (WebRequestMethodComposite method);
 
@@ -40,10 +43,20 @@ protected:
 	void getMaxNodes (AsyncWebServerRequest* request);
     
     /**
-     * @brief Processes node list request
+     * @brief Processes node list request. Response is sent in chunks, built while it is being sent.
+     * `offset` and `limit` parameters select a page of active nodes
      * @param request Node list request
      */
 	void getNodes (AsyncWebServerRequest* request);
+
+    /**
+     * @brief Fills next chunk of node list response
+     * @param cursor Node list response state
+     * @param buffer Output buffer
+     * @param maxLen Output buffer size
+     * @return Number of bytes written. 0 when response is complete
+     */
+	size_t fillNodeList (node_list_cursor_t* cursor, uint8_t* buffer, size_t maxLen);
     
     /**
      * @brief Processes node information request
@@ -75,6 +88,14 @@ protected:
      * @param request Node information request
      */
 	void restartNode (AsyncWebServerRequest* request);
+
+#if ENABLE_GATEWAY_METRICS
+    /**
+     * @brief Processes gateway metrics request. `DELETE` method sets all metrics to zero
+     * @param request Gateway metrics request
+     */
+	void gwMetrics (AsyncWebServerRequest* request);
+#endif // ENABLE_GATEWAY_METRICS
 	// TODO: Reset node
 	// TODO: Reset Gw
 
@@ -85,7 +106,7 @@ protected:
 	void onNotFound (AsyncWebServerRequest* request);
 
     /**
-     * @brief Gets node reference from request parameters
+     * @brief Gets node reference from request parameters. Caller has to hold `EnigmaIOTGateway.lock()` until it does not use node anymore
      * @param request Request with node parameter (NodeID, Name or MAC address)
      */
 	Node* getNodeFromParam (AsyncWebServerRequest* request);
@@ -98,13 +119,13 @@ protected:
 	const char* deleteNode (Node* node, int& resultCode);
     
     /**
-     * @brief Builds node info
+     * @brief Writes node info
      * @param node Node to get info from
      * @param resultCode Result code
-     * @param nodeInfo Node information JSON element
-     * @param len JSON length
+     * @param nodeInfo Output to write node information JSON element to
+     * @return `true` if node is registered and its information was written
      */
-	char* getNodeInfo (Node* node, int& resultCode, char* nodeInfo, size_t len);
+	bool getNodeInfo (Node* node, int& resultCode, Print* nodeInfo);
     
     /**
      * @brief Builds gateway info
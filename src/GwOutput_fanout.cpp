@@ -0,0 +1,118 @@
+/**
+  * @file GwOutput_fanout.cpp
+  * @version 0.9.7
+  * @date 04/02/2021
+  * @author German Martin
+  * @brief Gateway output module that sends every message to several output modules
+  */
+
+#include "GwOutput_fanout.h"
+#include "EnigmaIOTdebug.h"
+
+bool GatewayOutput_fanout::addSink (GatewayOutput_generic* sink) {
+	if (!sink || numSinks >= MAX_OUTPUT_SINKS) {
+		DEBUG_WARN ("Cannot add output module. Maximum is %d", MAX_OUTPUT_SINKS);
+		return false;
+	}
+	sinks[numSinks++] = sink;
+	if (downlinkCb) {
+		sink->setDlCallback (downlinkCb);
+	}
+	DEBUG_INFO ("Output module %d added", numSinks);
+	return true;
+}
+
+void GatewayOutput_fanout::configManagerStart (EnigmaIOTGatewayClass* enigmaIotGw) {
+	enigmaIotGateway = enigmaIotGw;
+	for (int i = 0; i < numSinks; i++) {
+		sinks[i]->configManagerStart (enigmaIotGw);
+	}
+}
+
+void GatewayOutput_fanout::configManagerExit (bool status) {
+	for (int i = 0; i < numSinks; i++) {
+		sinks[i]->configManagerExit (status);
+	}
+}
+
+bool GatewayOutput_fanout::begin () {
+	bool result = true;
+
+	for (int i = 0; i < numSinks; i++) {
+		if (!sinks[i]->begin ()) {
+			DEBUG_WARN ("Output module %d did not start", i);
+			result = false;
+		}
+	}
+	return result;
+}
+
+bool GatewayOutput_fanout::loadConfig () {
+	bool result = true;
+
+	for (int i = 0; i < numSinks; i++) {
+		result = sinks[i]->loadConfig () && result;
+	}
+	return result;
+}
+
+bool GatewayOutput_fanout::outputControlSend (char* address, uint8_t* data, size_t length) {
+	bool result = true;
+
+	for (int i = 0; i < numSinks; i++) {
+		result = sinks[i]->outputControlSend (address, data, length) && result;
+	}
+	return result;
+}
+
+bool GatewayOutput_fanout::newNodeSend (char* address, uint16_t node_id) {
+	bool result = true;
+
+	for (int i = 0; i < numSinks; i++) {
+		result = sinks[i]->newNodeSend (address, node_id) && result;
+	}
+	return result;
+}
+
+bool GatewayOutput_fanout::nodeDisconnectedSend (char* address, gwInvalidateReason_t reason) {
+	bool result = true;
+
+	for (int i = 0; i < numSinks; i++) {
+		result = sinks[i]->nodeDisconnectedSend (address, reason) && result;
+	}
+	return result;
+}
+
+bool GatewayOutput_fanout::outputDataSend (char* address, char* data, size_t length, GwOutput_data_type_t type) {
+	bool result = true;
+
+	for (int i = 0; i < numSinks; i++) {
+		result = sinks[i]->outputDataSend (address, data, length, type) && result;
+	}
+	return result;
+}
+
+int GatewayOutput_fanout::outputDataSendBatch (gw_output_data_t* messages, int count) {
+	int result = count;
+
+	for (int i = 0; i < numSinks; i++) {
+		int sent = sinks[i]->outputDataSendBatch (messages, count);
+		if (sent < result) {
+			result = sent;
+		}
+	}
+	return numSinks ? result : 0;
+}
+
+void GatewayOutput_fanout::loop () {
+	for (int i = 0; i < numSinks; i++) {
+		sinks[i]->loop ();
+	}
+}
+
+void GatewayOutput_fanout::setDlCallback (onDlData_t cb) {
+	downlinkCb = cb;
+	for (int i = 0; i < numSinks; i++) {
+		sinks[i]->setDlCallback (cb);
+	}
+}
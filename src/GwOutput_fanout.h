@@ -0,0 +1,132 @@
+/**
+  * @file GwOutput_fanout.h
+  * @version 0.9.7
+  * @date 04/02/2021
+  * @author German Martin
+  * @brief Gateway output module that sends every message to several output modules
+  *
+  * It is used as any other output module. Sinks are added with `addSink()`, for instance MQTT and a log file, and they get
+  * every call in the same order they were added. Downlink messages from any sink are passed to the same callback
+  */
+
+#ifndef _GWOUT_FANOUT_h
+#define _GWOUT_FANOUT_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include <EnigmaIOTGateway.h>
+#include "GwOutput_generic.h"
+
+class GatewayOutput_fanout : public GatewayOutput_generic {
+protected:
+	GatewayOutput_generic* sinks[MAX_OUTPUT_SINKS]; ///< @brief Output modules that get every message
+	int numSinks = 0; ///< @brief Number of output modules added
+
+	/**
+	  * @brief Every sink saves its own configuration when config portal exits
+	  * @return Always `true`
+	  */
+	bool saveConfig () {
+		return true;
+	}
+
+public:
+	/**
+	  * @brief Adds an output module. It has to be done before `begin()`
+	  * @param sink Output module instance
+	  * @return Returns `false` if there are already `MAX_OUTPUT_SINKS` modules
+	  */
+	bool addSink (GatewayOutput_generic* sink);
+
+	/**
+	  * @brief Gets number of output modules
+	  * @return Number of sinks
+	  */
+	int getSinkCount () {
+		return numSinks;
+	}
+
+	/**
+	  * @brief Called when wifi manager starts config portal. Every sink adds its own parameters
+	  * @param enigmaIotGw Pointer to EnigmaIOT gateway instance
+	  */
+	void configManagerStart (EnigmaIOTGatewayClass* enigmaIotGw);
+
+	/**
+	  * @brief Called when wifi manager exits config portal
+	  * @param status `true` if configuration was successful
+	  */
+	void configManagerExit (bool status);
+
+	/**
+	  * @brief Starts all output modules
+	  * @return Returns `true` if all of them started successfully
+	  */
+	bool begin ();
+
+	/**
+	  * @brief Loads configuration of all output modules
+	  * @return Returns `true` if all of them loaded their configuration
+	  */
+	bool loadConfig ();
+
+	/**
+	  * @brief Send control data from nodes to all output modules
+	  * @param address Node Address
+	  * @param data Message data buffer
+	  * @param length Data buffer length
+	  * @return Returns `true` if sending was successful on all of them. `false` otherwise
+	  */
+	bool outputControlSend (char* address, uint8_t* data, size_t length);
+
+	/**
+	  * @brief Send new node notification to all output modules
+	  * @param address Node Address
+	  * @param node_id Node Id
+	  * @return Returns `true` if sending was successful on all of them. `false` otherwise
+	  */
+	bool newNodeSend (char* address, uint16_t node_id);
+
+	/**
+	  * @brief Send node disconnection notification to all output modules
+	  * @param address Node Address
+	  * @param reason Disconnection reason code
+	  * @return Returns `true` if sending was successful on all of them. `false` otherwise
+	  */
+	bool nodeDisconnectedSend (char* address, gwInvalidateReason_t reason);
+
+	/**
+	  * @brief Send data from nodes to all output modules
+	  * @param address Node Address
+	  * @param data Message data buffer
+	  * @param length Data buffer length
+	  * @param type Type of message
+	  * @return Returns `true` if sending was successful on all of them. `false` otherwise
+	  */
+	bool outputDataSend (char* address, char* data, size_t length, GwOutput_data_type_t type = GwOutput_data_type::data);
+
+	/**
+	  * @brief Send several data messages to all output modules. Every sink gets the whole batch at once
+	  * @param messages Array of messages
+	  * @param count Number of messages
+	  * @return Lowest number of messages sent successfully by a sink
+	  */
+	int outputDataSendBatch (gw_output_data_t* messages, int count);
+
+	/**
+	  * @brief Runs management of all output modules
+	  */
+	void loop ();
+
+	/**
+	  * @brief Set data processing function on all output modules
+	  * @param cb Function handle
+	  */
+	void setDlCallback (onDlData_t cb);
+};
+
+#endif // _GWOUT_FANOUT_h
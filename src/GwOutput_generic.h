@@ -22,16 +22,151 @@
 typedef enum GwOutput_data_type {
 	data,
 	lostmessages,
-	status
+	status,
+	nodesstatus
 } GwOutput_data_type_t;
 
 #include <functional>
 typedef std::function<void (uint8_t* address, char* nodeName, control_message_type_t msgType, char* data, unsigned int len)> onDlData_t;
 
+typedef struct {
+	char* address; /**< Node address or name*/
+	char* data; /**< Message data buffer*/
+	size_t length; /**< Data buffer length*/
+	GwOutput_data_type_t type; /**< Type of message*/
+} gw_output_data_t;
+
+/**
+  * @brief Cache of per node topic prefixes, `<network name>/<node address | node name>/`, so that they are not formatted
+  * again on every message. Least recently used entry is replaced when cache is full. Memory is allocated on first use
+  */
+class GwOutputTopicCache {
+protected:
+	typedef struct {
+		uint32_t hash; /**< Address hash, to skip most entries without comparing strings*/
+		uint32_t lastUsed; /**< Use sequence number. 0 means entry is free*/
+		uint8_t prefixLen; /**< Prefix length*/
+		char address[NODE_NAME_LENGTH]; /**< Node address or name*/
+		char prefix[OUTPUT_TOPIC_PREFIX_LENGTH]; /**< Formatted prefix*/
+	} topic_cache_entry_t;
+
+	topic_cache_entry_t* entries = NULL; ///< @brief Cache entries
+	uint32_t useCounter = 0; ///< @brief Last use sequence number
+	uint32_t misses = 0; ///< @brief Number of prefixes that had to be formatted
+
+	/**
+	  * @brief Calculates FNV-1a hash of a string
+	  * @param str String to hash
+	  * @return Hash value
+	  */
+	static uint32_t hash (const char* str) {
+		uint32_t h = 2166136261U;
+		while (*str) {
+			h = (h ^ (uint8_t)*str++) * 16777619U;
+		}
+		return h;
+	}
+
+	/**
+	  * @brief Finds prefix of a node, formatting it if it is not cached
+	  * @param netName Network name
+	  * @param address Node address or name
+	  * @return Cache entry. `NULL` if prefix is too long to be cached or memory is not available
+	  */
+	topic_cache_entry_t* lookup (const char* netName, const char* address) {
+		if (strlen (address) >= NODE_NAME_LENGTH) {
+			return NULL;
+		}
+		if (!entries) {
+			entries = (topic_cache_entry_t*)calloc (OUTPUT_TOPIC_CACHE_SIZE, sizeof (topic_cache_entry_t));
+			if (!entries) {
+				return NULL;
+			}
+		}
+		uint32_t h = hash (address);
+		topic_cache_entry_t* victim = entries;
+		for (int i = 0; i < OUTPUT_TOPIC_CACHE_SIZE; i++) {
+			topic_cache_entry_t* entry = &(entries[i]);
+			if (entry->lastUsed && entry->hash == h && !strcmp (entry->address, address)) {
+				entry->lastUsed = ++useCounter;
+				return entry;
+			}
+			if (entry->lastUsed < victim->lastUsed) {
+				victim = entry;
+			}
+		}
+		int len = snprintf (victim->prefix, OUTPUT_TOPIC_PREFIX_LENGTH, "%s/%s/", netName, address);
+		misses++;
+		if (len < 0 || len >= OUTPUT_TOPIC_PREFIX_LENGTH) {
+			victim->lastUsed = 0;
+			return NULL;
+		}
+		strcpy (victim->address, address);
+		victim->hash = h;
+		victim->prefixLen = len;
+		victim->lastUsed = ++useCounter;
+		return victim;
+	}
+
+public:
+	~GwOutputTopicCache () {
+		free (entries);
+	}
+
+	/**
+	  * @brief Writes a node topic, `<network name>/<node address | node name>/<suffix>`. It is truncated as `snprintf` would do
+	  * @param topic Buffer to write topic to
+	  * @param size Buffer size
+	  * @param netName Network name
+	  * @param address Node address or name
+	  * @param suffix Topic part after node address
+	  * @return Topic length
+	  */
+	size_t build (char* topic, size_t size, const char* netName, const char* address, const char* suffix) {
+		topic_cache_entry_t* entry = lookup (netName, address);
+
+		if (!entry) {
+			int len = snprintf (topic, size, "%s/%s/%s", netName, address, suffix);
+			return len > 0 ? len : 0;
+		}
+		size_t suffixLen = strlen (suffix);
+		size_t len = entry->prefixLen + suffixLen;
+		if (len >= size) {
+			len = size - 1;
+		}
+		if (entry->prefixLen >= len) {
+			memcpy (topic, entry->prefix, len);
+		} else {
+			memcpy (topic, entry->prefix, entry->prefixLen);
+			memcpy (topic + entry->prefixLen, suffix, len - entry->prefixLen);
+		}
+		topic[len] = '\0';
+		return len;
+	}
+
+	/**
+	  * @brief Deletes all cached prefixes. It has to be called if network name changes
+	  */
+	void clear () {
+		if (entries) {
+			memset (entries, 0, OUTPUT_TOPIC_CACHE_SIZE * sizeof (topic_cache_entry_t));
+		}
+	}
+
+	/**
+	  * @brief Gets number of prefixes that were not found on cache
+	  * @return Number of cache misses
+	  */
+	uint32_t getMisses () {
+		return misses;
+	}
+};
+
 class GatewayOutput_generic {
 protected:
 	EnigmaIOTGatewayClass* enigmaIotGateway; ///< @brief Pointer to EnigmaIOT gateway instance
 	onDlData_t downlinkCb; ///< @brief downlink processing function handle
+	GwOutputTopicCache topicCache; ///< @brief Per node topic prefixes
 
 	/**
 	  * @brief Saves output module configuration
@@ -106,6 +241,23 @@ public:
 	  */
 	virtual bool outputDataSend (char* address, char* data, size_t length, GwOutput_data_type_t type = data) = 0;
 
+	 /**
+	  * @brief Send several data messages at once. Modules that are able to group messages may override this to
+	  * reduce overhead per message. Default implementation calls `outputDataSend()` for every one
+	  * @param messages Array of messages
+	  * @param count Number of messages
+	  * @return Number of messages that were sent successfully
+	  */
+	virtual int outputDataSendBatch (gw_output_data_t* messages, int count) {
+		int sent = 0;
+		for (int i = 0; i < count; i++) {
+			if (outputDataSend (messages[i].address, messages[i].data, messages[i].length, messages[i].type)) {
+				sent++;
+			}
+		}
+		return sent;
+	}
+
 	 /**
 	  * @brief Should be called often for module management
 	  */
@@ -115,7 +267,7 @@ public:
 	  * @brief Set data processing function
 	  * @param cb Function handle
 	  */
-	void setDlCallback (onDlData_t cb) {
+	virtual void setDlCallback (onDlData_t cb) {
 		downlinkCb = cb;
 	}
 };
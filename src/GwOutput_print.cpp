@@ -0,0 +1,95 @@
+/**
+  * @file GwOutput_print.cpp
+  * @version 0.9.7
+  * @date 04/02/2021
+  * @author German Martin
+  * @brief Gateway output module that writes every message as a text line on any `Print` stream
+  */
+
+#include "GwOutput_print.h"
+#include "EnigmaIOTdebug.h"
+
+static const int PRINT_TOPIC_SIZE = 64;
+
+bool GatewayOutput_print::begin () {
+	if (!out) {
+		return false;
+	}
+	netName = String (EnigmaIOTGateway.getNetworkName ());
+	topicCache.clear ();
+	return true;
+}
+
+bool GatewayOutput_print::writeLine (const char* address, const char* suffix, const char* payload, size_t len) {
+	char topic[PRINT_TOPIC_SIZE];
+
+	if (!out) {
+		return false;
+	}
+	size_t topicLen = topicCache.build (topic, PRINT_TOPIC_SIZE, netName.c_str (), address, suffix);
+	if (topicLen >= PRINT_TOPIC_SIZE) {
+		topicLen = PRINT_TOPIC_SIZE - 1;
+	}
+	size_t written = out->write ((const uint8_t*)topic, topicLen);
+	written += out->write (' ');
+	written += out->write ((const uint8_t*)payload, len);
+	written += out->write ('\n');
+	pendingFlush = true;
+	return written == topicLen + len + 2;
+}
+
+bool GatewayOutput_print::outputControlSend (char* address, uint8_t* data, size_t length) {
+	const int PAYLOAD_SIZE = MAX_MESSAGE_LENGTH * 2 + 1;
+	char payload[PAYLOAD_SIZE];
+	size_t pld_size = 0;
+
+	if (!data || !length) {
+		return false;
+	}
+	for (size_t i = 0; i < length && pld_size + 2 < PAYLOAD_SIZE; i++) {
+		pld_size += snprintf (payload + pld_size, PAYLOAD_SIZE - pld_size, "%02X", data[i]);
+	}
+	return writeLine (address, "control", payload, pld_size);
+}
+
+bool GatewayOutput_print::newNodeSend (char* address, uint16_t node_id) {
+	const int PAYLOAD_SIZE = 24;
+	char payload[PAYLOAD_SIZE];
+
+	size_t pld_size = snprintf (payload, PAYLOAD_SIZE, "{\"node_id\":%u}", node_id);
+	return writeLine (address, "hello", payload, pld_size);
+}
+
+bool GatewayOutput_print::nodeDisconnectedSend (char* address, gwInvalidateReason_t reason) {
+	const int PAYLOAD_SIZE = 24;
+	char payload[PAYLOAD_SIZE];
+
+	size_t pld_size = snprintf (payload, PAYLOAD_SIZE, "{\"reason\":%d}", reason);
+	return writeLine (address, "bye", payload, pld_size);
+}
+
+bool GatewayOutput_print::outputDataSend (char* address, char* data, size_t length, GwOutput_data_type_t type) {
+	const char* suffix;
+
+	switch (type) {
+	case GwOutput_data_type::lostmessages:
+		suffix = "debug/lostmessages";
+		break;
+	case GwOutput_data_type::status:
+		suffix = "status";
+		break;
+	case GwOutput_data_type::nodesstatus:
+		suffix = "nodes";
+		break;
+	default:
+		suffix = "data";
+	}
+	return writeLine (address, suffix, data, length);
+}
+
+void GatewayOutput_print::loop () {
+	if (pendingFlush && out) {
+		out->flush ();
+		pendingFlush = false;
+	}
+}
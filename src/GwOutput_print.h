@@ -0,0 +1,124 @@
+/**
+  * @file GwOutput_print.h
+  * @version 0.9.7
+  * @date 04/02/2021
+  * @author German Martin
+  * @brief Gateway output module that writes every message as a text line on any `Print` stream
+  *
+  * It may be used to log gateway output on a serial port or a file on SD card, alone or together with other output
+  * modules using `GatewayOutput_fanout`. Lines use the same topics as MQTT output: `<network name>/<node address | node name>/<topic> <payload>`.
+  * It does not receive downlink messages
+  */
+
+#ifndef _GWOUT_PRINT_h
+#define _GWOUT_PRINT_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include <EnigmaIOTGateway.h>
+#include "GwOutput_generic.h"
+
+class GatewayOutput_print : public GatewayOutput_generic {
+protected:
+	Print* out; ///< @brief Stream where messages are written
+	bool pendingFlush = false; ///< @brief `true` if something was written since last `loop()`
+
+	/**
+	  * @brief This module has no configuration
+	  * @return Always `true`
+	  */
+	bool saveConfig () {
+		return true;
+	}
+
+	/**
+	  * @brief Writes a line with node topic and payload
+	  * @param address Node address or name
+	  * @param suffix Topic part after node address
+	  * @param payload Payload
+	  * @param len Payload length
+	  * @return Returns `true` if the whole line was written
+	  */
+	bool writeLine (const char* address, const char* suffix, const char* payload, size_t len);
+
+public:
+	/**
+	  * @brief Creates a print output module
+	  * @param out Stream where messages are written, for instance `&Serial` or an open `File`
+	  */
+	GatewayOutput_print (Print* out) : out (out) {}
+
+	/**
+	  * @brief Called when wifi manager starts config portal
+	  * @param enigmaIotGw Pointer to EnigmaIOT gateway instance
+	  */
+	void configManagerStart (EnigmaIOTGatewayClass* enigmaIotGw) {
+		enigmaIotGateway = enigmaIotGw;
+	}
+
+	/**
+	  * @brief Called when wifi manager exits config portal
+	  * @param status `true` if configuration was successful
+	  */
+	void configManagerExit (bool status) {}
+
+	/**
+	  * @brief Starts output module. Network name is taken from gateway
+	  * @return Returns `true` if successful. `false` otherwise
+	  */
+	bool begin ();
+
+	/**
+	  * @brief This module has no configuration
+	  * @return Always `true`
+	  */
+	bool loadConfig () {
+		return true;
+	}
+
+	/**
+	  * @brief Send control data from nodes. Data is written in hexadecimal
+	  * @param address Node Address
+	  * @param data Message data buffer
+	  * @param length Data buffer length
+	  * @return Returns `true` if sending was successful. `false` otherwise
+	  */
+	bool outputControlSend (char* address, uint8_t* data, size_t length);
+
+	/**
+	  * @brief Send new node notification
+	  * @param address Node Address
+	  * @param node_id Node Id
+	  * @return Returns `true` if sending was successful. `false` otherwise
+	  */
+	bool newNodeSend (char* address, uint16_t node_id);
+
+	/**
+	  * @brief Send node disconnection notification
+	  * @param address Node Address
+	  * @param reason Disconnection reason code
+	  * @return Returns `true` if sending was successful. `false` otherwise
+	  */
+	bool nodeDisconnectedSend (char* address, gwInvalidateReason_t reason);
+
+	/**
+	  * @brief Send data from nodes
+	  * @param address Node Address
+	  * @param data Message data buffer
+	  * @param length Data buffer length
+	  * @param type Type of message
+	  * @return Returns `true` if sending was successful. `false` otherwise
+	  */
+	bool outputDataSend (char* address, char* data, size_t length, GwOutput_data_type_t type = GwOutput_data_type::data);
+
+	/**
+	  * @brief Flushes stream if something was written since last call, so that a batch of messages is flushed only once
+	  */
+	void loop ();
+};
+
+#endif // _GWOUT_PRINT_h
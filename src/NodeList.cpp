@@ -11,6 +11,9 @@
 void Node::setEncryptionKey (const uint8_t* key) {
 	if (key) {
 		memcpy (this->key, key, KEY_LENGTH);
+		if (nodeList) {
+			nodeList->markDirty (this);
+		}
 	}
 }
 
@@ -23,8 +26,12 @@ node_t Node::getNodeData () {
 	memcpy (thisNode.mac, mac, 6);
 	thisNode.nodeId = nodeId;
 	thisNode.lastMessageCounter = lastMessageCounter;
+	thisNode.lastControlCounter = lastControlCounter;
 	thisNode.status = status;
-	memcpy (thisNode.nodeName, getNodeName (), NODE_NAME_LENGTH);
+	memset (thisNode.nodeName, 0, NODE_NAME_LENGTH);
+	if (getNodeName ()) {
+		memcpy (thisNode.nodeName, getNodeName (), NODE_NAME_LENGTH);
+	}
 
 	return thisNode;
 }
@@ -64,27 +71,45 @@ void Node::printToSerial (Stream* port) {
 	port->println ();
 }
 
-void Node::initRateFilter () {
+node_cold_data::node_cold_data () :
+	rateFilter (AVERAGE_FILTER, RATE_AVE_ORDER) {
 	float weight = 1;
 
-	rateFilter = new FilterClass (AVERAGE_FILTER, RATE_AVE_ORDER);
+	memset (nodeName, 0, NODE_NAME_LENGTH);
 	for (int i = 0; i < RATE_AVE_ORDER; i++) {
-		rateFilter->addWeigth (weight);
+		rateFilter.addWeigth (weight);
 		weight = weight / 2;
 	}
+}
+
+bool Node::allocColdData () {
+	if (!cold) {
+		cold = new node_cold_t ();
+		if (!cold) {
+			DEBUG_ERROR ("Cannot allocate node data");
+			return false;
+		}
+	}
+	return true;
+}
 
+void Node::freeColdData () {
+	if (cold) {
+		delete cold;
+		cold = NULL;
+	}
 }
 
 Node::Node () :
 	keyValid (false),
 	status (UNREGISTERED) {
-	initRateFilter ();
 }
 
 Node::Node (node_t nodeData) :
 	keyValid (nodeData.keyValid),
 	status (nodeData.status),
 	lastMessageCounter (nodeData.lastMessageCounter),
+	lastControlCounter (nodeData.lastControlCounter),
 	nodeId (nodeData.nodeId),
 	keyValidFrom (nodeData.keyValidFrom),
 	sleepyNode (nodeData.sleepyNode)
@@ -94,12 +119,101 @@ Node::Node (node_t nodeData) :
 {
 	memcpy (key, nodeData.key, sizeof (uint16_t));
 	memcpy (mac, nodeData.mac, 6);
+	messageWindow.reset (lastMessageCounter);
+	controlWindow.reset (lastControlCounter);
+}
+
+void Node::setNodeName (const char* name) {
+	if (nodeList) {
+		nodeList->removeNameIndex (this);
+	}
+	if (!allocColdData ()) {
+		return;
+	}
+	memset (cold->nodeName, 0, NODE_NAME_LENGTH);
+	strncpy (cold->nodeName, name, NODE_NAME_LENGTH - 1);
+	if (nodeList) {
+		nodeList->addNameIndex (this);
+	}
+}
+
+void Node::setKeyValidFrom (time_t keyValidFrom) {
+	this->keyValidFrom = keyValidFrom;
+	keyExpired = false;
+	if (nodeList) {
+		nodeList->scheduleNode (this);
+	}
+}
+
+void Node::setLastMessageTime () {
+	lastMessageTime = millis ();
+	if (nodeList) {
+		nodeList->scheduleNode (this);
+	}
+}
+
+void Node::setLastMessageCounter (uint32_t counter) {
+	lastMessageCounter = counter;
+	messageWindow.reset (counter);
+	if (nodeList && !(counter % NODE_SNAPSHOT_COUNTER_STEP)) {
+		nodeList->markDirty (this);
+	}
+}
+
+void Node::setLastControlCounter (uint32_t counter) {
+	lastControlCounter = counter;
+	controlWindow.reset (counter);
+	if (nodeList && !(counter % NODE_SNAPSHOT_COUNTER_STEP)) {
+		nodeList->markDirty (this);
+	}
+}
+
+replay_result_t Node::acceptMessageCounter (uint32_t counter, uint32_t* lost) {
+	replay_result_t result = messageWindow.accept (counter, lost);
+
+	if (result == REPLAY_NEW) {
+		lastMessageCounter = counter;
+		if (nodeList && !(counter % NODE_SNAPSHOT_COUNTER_STEP)) {
+			nodeList->markDirty (this);
+		}
+	}
+	return result;
+}
+
+replay_result_t Node::acceptControlCounter (uint32_t counter) {
+	replay_result_t result = controlWindow.accept (counter);
+
+	if (result == REPLAY_NEW) {
+		lastControlCounter = counter;
+		if (nodeList && !(counter % NODE_SNAPSHOT_COUNTER_STEP)) {
+			nodeList->markDirty (this);
+		}
+	}
+	return result;
+}
+
+void Node::setLastDownlinkMsgCounter (uint16_t counter) {
+	lastDownlinkMsgCounter = counter;
+	if (nodeList && !(counter % NODE_SNAPSHOT_COUNTER_STEP)) {
+		nodeList->markDirty (this);
+	}
+}
 
-	initRateFilter ();
+void Node::setStatus (status_t status) {
+	this->status = status;
+	if (status != UNREGISTERED) {
+		allocColdData ();
+	}
+	if (nodeList) {
+		nodeList->updateFreeSlot (this);
+		nodeList->scheduleNode (this);
+	}
 }
 
 void Node::updatePacketsRate (float value) {
-	packetsHour = rateFilter->addValue (value);
+	if (cold) {
+		packetsHour = cold->rateFilter.addValue (value);
+	}
 }
 
 
@@ -107,29 +221,513 @@ void Node::reset () {
 	DEBUG_DBG ("Reset node");
 	//memset (mac, 0, 6);
 	memset (key, 0, KEY_LENGTH);
-	memset (nodeName, 0, NODE_NAME_LENGTH);
+	cipherAlgorithm = CHACHAPOLY_CIPHER;
+	if (nodeList) {
+		nodeList->removeNameIndex (this);
+	}
+	freeColdData (); // Frees name, rate filter and fragments
 	keyValid = false;
 	lastMessageCounter = 0;
 	lastControlCounter = 0;
+	messageWindow.reset ();
+	controlWindow.reset ();
 	lastDownlinkMsgCounter = 0;
 	keyValidFrom = 0;
+	keyExpired = false;
 	status = UNREGISTERED;
+	rssi = 0;
 	enigmaIOTVersion[0] = 0;
 	enigmaIOTVersion[1] = 0;
 	enigmaIOTVersion[2] = 0;
 	//broadcastEnabled = false;
 	broadcastKeyRequested = false;
-	if (rateFilter) {
-		DEBUG_DBG ("Reset packet rate");
-		rateFilter->clear ();
+	if (nodeList) {
+		nodeList->clearDownlinkQueue (this);
 	}
 	//sleepyNode = true;
+	if (nodeList) {
+		nodeList->updateFreeSlot (this);
+		nodeList->scheduleNode (this);
+	}
 }
 
 NodeList::NodeList () {
 	for (int i = 0; i < NUM_NODES; i++) {
 		nodes[i].nodeId = i;
+		nodes[i].nodeList = this;
+	}
+	for (int i = 0; i < NODE_INDEX_SIZE; i++) {
+		macIndex[i] = EMPTY_INDEX_ENTRY;
+		nameIndex[i] = EMPTY_INDEX_ENTRY;
+	}
+	memset (freeSlots, 0, sizeof (freeSlots));
+	memset (dirtySlots, 0, sizeof (dirtySlots));
+	for (int i = 0; i < NUM_NODES; i++) {
+		freeSlots[i / 32] |= 1UL << (i % 32);
+	}
+	for (int i = 0; i < DOWNLINK_POOL_SIZE; i++) {
+		downlinkPool[i].next = i + 1 < DOWNLINK_POOL_SIZE ? i + 1 : -1;
+	}
+	freeDownlinkEntry = DOWNLINK_POOL_SIZE > 0 ? 0 : -1;
+	freeDownlinkCount = DOWNLINK_POOL_SIZE;
+	memset (nodeGroups, 0, sizeof (nodeGroups));
+}
+
+uint16_t NodeList::macHash (const uint8_t* mac) {
+	// FNV-1a
+	uint32_t hash = 2166136261UL;
+
+	for (int i = 0; i < ENIGMAIOT_ADDR_LEN; i++) {
+		hash ^= mac[i];
+		hash *= 16777619UL;
+	}
+	return hash & (NODE_INDEX_SIZE - 1);
+}
+
+uint16_t NodeList::nameHash (const char* name) {
+	// FNV-1a
+	uint32_t hash = 2166136261UL;
+
+	for (int i = 0; i < NODE_NAME_LENGTH && name[i]; i++) {
+		hash ^= (uint8_t)name[i];
+		hash *= 16777619UL;
+	}
+	return hash & (NODE_INDEX_SIZE - 1);
+}
+
+uint16_t NodeList::slotHash (const uint16_t* index, uint16_t nodeId) {
+	if (index == nameIndex) {
+		return nameHash (nodes[nodeId].getNodeName ());
+	} else {
+		return macHash (nodes[nodeId].mac);
+	}
+}
+
+int NodeList::findMacIndex (const uint8_t* mac) {
+	uint16_t pos = macHash (mac);
+
+	while (macIndex[pos] != EMPTY_INDEX_ENTRY) {
+		if (!memcmp (nodes[macIndex[pos]].mac, mac, ENIGMAIOT_ADDR_LEN)) {
+			return pos;
+		}
+		pos = (pos + 1) & (NODE_INDEX_SIZE - 1);
+	}
+	return -1;
+}
+
+void NodeList::addIndex (uint16_t* index, uint16_t nodeId) {
+	uint16_t pos = slotHash (index, nodeId);
+
+	while (index[pos] != EMPTY_INDEX_ENTRY) {
+		if (index[pos] == nodeId) {
+			return;
+		}
+		pos = (pos + 1) & (NODE_INDEX_SIZE - 1);
+	}
+	index[pos] = nodeId;
+}
+
+void NodeList::removeIndex (uint16_t* index, uint16_t nodeId) {
+	uint16_t pos = slotHash (index, nodeId);
+
+	while (index[pos] != nodeId) {
+		if (index[pos] == EMPTY_INDEX_ENTRY) {
+			return; // Not indexed
+		}
+		pos = (pos + 1) & (NODE_INDEX_SIZE - 1);
+	}
+
+	// Shift back following entries that would not be reachable otherwise
+	uint16_t next = pos;
+	while (true) {
+		next = (next + 1) & (NODE_INDEX_SIZE - 1);
+		if (index[next] == EMPTY_INDEX_ENTRY) {
+			break;
+		}
+		uint16_t home = slotHash (index, index[next]);
+		bool inPlace = (pos <= next) ? (pos < home && home <= next) : (pos < home || home <= next);
+		if (!inPlace) {
+			index[pos] = index[next];
+			pos = next;
+		}
+	}
+	index[pos] = EMPTY_INDEX_ENTRY;
+}
+
+void NodeList::addNameIndex (Node* node) {
+	if (isListNode (node) && node->getNodeName ()) {
+		addIndex (nameIndex, node->nodeId);
+		markDirty (node);
+	}
+}
+
+void NodeList::removeNameIndex (Node* node) {
+	if (isListNode (node) && node->getNodeName ()) {
+		removeIndex (nameIndex, node->nodeId);
+	}
+}
+
+void NodeList::updateFreeSlot (Node* node) {
+	uint16_t nodeId = node->nodeId;
+
+	if (!isListNode (node)) {
+		return;
+	}
+	if (node->status == UNREGISTERED) {
+		freeSlots[nodeId / 32] |= 1UL << (nodeId % 32);
+	} else {
+		freeSlots[nodeId / 32] &= ~(1UL << (nodeId % 32));
+	}
+	markDirty (node);
+}
+
+void NodeList::markDirty (Node* node) {
+	if (isListNode (node)) {
+		dirtySlots[node->nodeId / 32] |= 1UL << (node->nodeId % 32);
+	}
+}
+
+Node* NodeList::getDirtyNode () {
+	for (unsigned int i = 0; i < sizeof (dirtySlots) / sizeof (dirtySlots[0]); i++) {
+		if (dirtySlots[i]) {
+			return &(nodes[i * 32 + __builtin_ctz (dirtySlots[i])]);
+		}
+	}
+	return NULL;
+}
+
+Node* NodeList::restoreNode (uint16_t nodeId, const uint8_t* mac) {
+	if (nodeId >= NUM_NODES) {
+		return NULL;
+	}
+
+	Node* node = &(nodes[nodeId]);
+	int pos = findMacIndex (mac);
+
+	node->reset ();
+	if (pos >= 0 && macIndex[pos] == nodeId) {
+		return node;
+	}
+	if (pos >= 0) {
+		Node* other = &(nodes[macIndex[pos]]);
+		other->reset ();
+		removeIndex (macIndex, other->nodeId);
+		memset (other->mac, 0, ENIGMAIOT_ADDR_LEN);
+		other->groups = 0;
+	}
+	node->groups = 0;
+	removeIndex (macIndex, nodeId);
+	node->setMacAddress (mac);
+	addIndex (macIndex, nodeId);
+	return node;
+}
+
+bool NodeList::getNodeDeadline (Node* node, uint32_t& deadline) {
+	bool pending = false;
+	uint32_t candidate;
+
+	// Deadlines are 1 ms after limit, as expiration checks use strictly greater comparison
+	if (node->status == REGISTERED) {
+		if (MAX_NODE_INACTIVITY > 0) {
+			deadline = (uint32_t)node->lastMessageTime + MAX_NODE_INACTIVITY + 1;
+			pending = true;
+		}
+		if (MAX_KEY_VALIDITY > 0 && !node->keyExpired) {
+			candidate = (uint32_t)node->keyValidFrom + MAX_KEY_VALIDITY + 1;
+			if (!pending || (int32_t)(candidate - deadline) < 0) {
+				deadline = candidate;
+			}
+			pending = true;
+		}
+	}
+	if (node->getRxFragments () && node->getRxFragments ()->inProgress ()) {
+		candidate = node->getRxFragments ()->getLastFragmentTime () + FRAGMENT_TIMEOUT + 1;
+		if (!pending || (int32_t)(candidate - deadline) < 0) {
+			deadline = candidate;
+		}
+		pending = true;
 	}
+
+	return pending;
+}
+
+void NodeList::swapDeadline (int a, int b) {
+	uint16_t nodeId = deadlineHeap[a];
+
+	deadlineHeap[a] = deadlineHeap[b];
+	deadlineHeap[b] = nodeId;
+	nodes[deadlineHeap[a]].deadlinePos = a;
+	nodes[deadlineHeap[b]].deadlinePos = b;
+}
+
+void NodeList::fixDeadline (int pos) {
+	// Times are compared by difference so that millis() overflow does not break ordering
+	while (pos > 0) {
+		int parent = (pos - 1) / 2;
+		if ((int32_t)(nodes[deadlineHeap[pos]].deadline - nodes[deadlineHeap[parent]].deadline) >= 0) {
+			break;
+		}
+		swapDeadline (pos, parent);
+		pos = parent;
+	}
+	for (;;) {
+		int smallest = pos;
+		int left = 2 * pos + 1;
+		int right = left + 1;
+		if (left < deadlineCount && (int32_t)(nodes[deadlineHeap[left]].deadline - nodes[deadlineHeap[smallest]].deadline) < 0) {
+			smallest = left;
+		}
+		if (right < deadlineCount && (int32_t)(nodes[deadlineHeap[right]].deadline - nodes[deadlineHeap[smallest]].deadline) < 0) {
+			smallest = right;
+		}
+		if (smallest == pos) {
+			break;
+		}
+		swapDeadline (pos, smallest);
+		pos = smallest;
+	}
+}
+
+void NodeList::scheduleNode (Node* node) {
+	uint32_t deadline;
+	int pos = node->deadlinePos;
+
+	if (!isListNode (node)) {
+		return;
+	}
+
+	if (!getNodeDeadline (node, deadline)) {
+		if (pos >= 0) { // Take it out of heap, moving last node to its place
+			deadlineCount--;
+			if (pos != deadlineCount) {
+				swapDeadline (pos, deadlineCount);
+				fixDeadline (pos);
+			}
+			node->deadlinePos = -1;
+		}
+		return;
+	}
+
+	node->deadline = deadline;
+	if (pos < 0) {
+		pos = deadlineCount++;
+		deadlineHeap[pos] = node->nodeId;
+		node->deadlinePos = pos;
+	}
+	fixDeadline (pos);
+}
+
+Node* NodeList::getExpiredNode (uint32_t now) {
+	if (!deadlineCount) {
+		return NULL;
+	}
+
+	Node* node = &(nodes[deadlineHeap[0]]);
+	if ((int32_t)(now - node->deadline) < 0) {
+		return NULL;
+	}
+	return node;
+}
+
+bool NodeList::queueDownlink (Node* node, const uint8_t* message, size_t len, control_message_type_t type, bool group) {
+	if (!message || len > MAX_MESSAGE_LENGTH) {
+		return false;
+	}
+
+	// A newer command of the same type makes queued one useless. User data is left to application. Group keys may be for different groups.
+	// A group command does not override one sent to node alone
+	if (type != control_message_type::USERDATA_GET && type != control_message_type::USERDATA_SET && type != control_message_type::GROUP_KEY) {
+		int16_t previous = -1;
+		int16_t entry = node->qHead;
+		while (entry >= 0) {
+			if (downlinkPool[entry].type == type && downlinkPool[entry].group == group) {
+				DEBUG_DBG ("Queued command 0x%02X replaced", type);
+				int16_t next = downlinkPool[entry].next;
+				if (previous >= 0) {
+					downlinkPool[previous].next = next;
+				} else {
+					node->qHead = next;
+				}
+				if (node->qTail == entry) {
+					node->qTail = previous;
+				}
+				node->qCount--;
+				downlinkPool[entry].next = freeDownlinkEntry;
+				freeDownlinkEntry = entry;
+				freeDownlinkCount++;
+				break; // There cannot be more than one
+			}
+			previous = entry;
+			entry = downlinkPool[entry].next;
+		}
+	}
+
+	if (node->qCount >= MAX_NODE_DOWNLINK_QUEUE) {
+		DEBUG_WARN ("Downlink queue full for node %u", node->nodeId);
+		return false;
+	}
+	if (freeDownlinkEntry < 0) {
+		DEBUG_WARN ("Downlink pool exhausted");
+		return false;
+	}
+
+	// Always appended at the end. Counters must be delivered in ascending order
+	int16_t entry = freeDownlinkEntry;
+	freeDownlinkEntry = downlinkPool[entry].next;
+	freeDownlinkCount--;
+	memcpy (downlinkPool[entry].message, message, len);
+	downlinkPool[entry].length = len;
+	downlinkPool[entry].type = type;
+	downlinkPool[entry].group = group;
+	downlinkPool[entry].next = -1;
+	if (node->qTail >= 0) {
+		downlinkPool[node->qTail].next = entry;
+	} else {
+		node->qHead = entry;
+	}
+	node->qTail = entry;
+	node->qCount++;
+	DEBUG_DBG ("%u messages queued for node %u", node->qCount, node->nodeId);
+
+	return true;
+}
+
+const uint8_t* NodeList::getQueuedDownlink (Node* node, size_t& len) {
+	if (node->qHead < 0) {
+		len = 0;
+		return NULL;
+	}
+	len = downlinkPool[node->qHead].length;
+	return downlinkPool[node->qHead].message;
+}
+
+void NodeList::dropQueuedDownlink (Node* node) {
+	int16_t entry = node->qHead;
+
+	if (entry < 0) {
+		return;
+	}
+	node->qHead = downlinkPool[entry].next;
+	if (node->qHead < 0) {
+		node->qTail = -1;
+	}
+	node->qCount--;
+	downlinkPool[entry].next = freeDownlinkEntry;
+	freeDownlinkEntry = entry;
+	freeDownlinkCount++;
+}
+
+void NodeList::clearDownlinkQueue (Node* node) {
+	while (node->qHead >= 0) {
+		dropQueuedDownlink (node);
+	}
+}
+
+int8_t NodeList::getGroupIndex (const char* name) {
+	if (!name || !name[0]) {
+		return -1;
+	}
+	for (int i = 0; i < MAX_NODE_GROUPS; i++) {
+		if (!strncmp (nodeGroups[i].name, name, NODE_NAME_LENGTH)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+node_group_t* NodeList::getGroup (int8_t group) {
+	if (group < 0 || group >= MAX_NODE_GROUPS || !nodeGroups[group].name[0]) {
+		return NULL;
+	}
+	return &(nodeGroups[group]);
+}
+
+int8_t NodeList::addGroup (const char* name, const uint8_t* key) {
+	if (!name || !name[0] || strnlen (name, NODE_NAME_LENGTH) >= NODE_NAME_LENGTH) {
+		return -1;
+	}
+	for (int i = 0; i < MAX_NODE_GROUPS; i++) {
+		if (!nodeGroups[i].name[0]) {
+			strncpy (nodeGroups[i].name, name, NODE_NAME_LENGTH);
+			memcpy (nodeGroups[i].key, key, KEY_LENGTH);
+			nodeGroups[i].lastDownlinkMsgCounter = 0;
+			dirtyGroups |= 1U << i;
+			return i;
+		}
+	}
+	return -1;
+}
+
+void NodeList::setGroupKey (int8_t group, const uint8_t* key) {
+	node_group_t* entry = getGroup (group);
+
+	if (entry) {
+		memcpy (entry->key, key, KEY_LENGTH);
+		dirtyGroups |= 1U << group;
+	}
+}
+
+uint16_t NodeList::nextGroupMsgCounter (int8_t group) {
+	node_group_t* entry = getGroup (group);
+
+	if (!entry) {
+		return 0;
+	}
+	entry->lastDownlinkMsgCounter++;
+	if (!(entry->lastDownlinkMsgCounter % NODE_SNAPSHOT_COUNTER_STEP)) {
+		dirtyGroups |= 1U << group;
+	}
+	return entry->lastDownlinkMsgCounter;
+}
+
+void NodeList::restoreGroup (int8_t group, const char* name, const uint8_t* key, uint16_t counter) {
+	if (group < 0 || group >= MAX_NODE_GROUPS) {
+		return;
+	}
+	memset (nodeGroups[group].name, 0, NODE_NAME_LENGTH);
+	if (name) {
+		strncpy (nodeGroups[group].name, name, NODE_NAME_LENGTH - 1);
+	}
+	memcpy (nodeGroups[group].key, key, KEY_LENGTH);
+	nodeGroups[group].lastDownlinkMsgCounter = counter;
+}
+
+bool NodeList::joinGroup (Node* node, int8_t group) {
+	if (!node || !isListNode (node) || !getGroup (group) || node->isGroupMember (group)) {
+		return false;
+	}
+	node->groups |= 1U << group;
+	markDirty (node);
+	return true;
+}
+
+bool NodeList::leaveGroup (Node* node, int8_t group) {
+	if (!node || !isListNode (node) || !node->isGroupMember (group)) {
+		return false;
+	}
+	node->groups &= ~(1U << group);
+	markDirty (node);
+
+	for (int i = 0; i < NUM_NODES; i++) {
+		if (nodes[i].isGroupMember (group)) {
+			return true;
+		}
+	}
+	DEBUG_DBG ("Group %s has no members. Deleted", nodeGroups[group].name);
+	memset (&(nodeGroups[group]), 0, sizeof (node_group_t));
+	dirtyGroups |= 1U << group;
+	return true;
+}
+
+Node* NodeList::getNextGroupMember (int8_t group, Node* node) {
+	int i = node && isListNode (node) ? node->nodeId + 1 : 0;
+
+	for (; i < NUM_NODES; i++) {
+		if (nodes[i].isGroupMember (group) && nodes[i].isRegistered ()) {
+			return &(nodes[i]);
+		}
+	}
+	return NULL;
 }
 
 Node* NodeList::getNodeFromID (uint16_t nodeId) {
@@ -140,19 +738,17 @@ Node* NodeList::getNodeFromID (uint16_t nodeId) {
 }
 
 Node* NodeList::getNodeFromMAC (const uint8_t* mac) {
-	uint16_t index = 0;
-
-	if (!memcmp (broadcastNode.getEncriptionKey (), mac, ENIGMAIOT_ADDR_LEN)) {
+	if (!memcmp (broadcastNode.getMacAddress (), mac, ENIGMAIOT_ADDR_LEN)) {
 		return &broadcastNode;
 	}
 
-	while (index < NUM_NODES) {
-		if (!memcmp (nodes[index].mac, mac, ENIGMAIOT_ADDR_LEN)) {
-			if (nodes[index].status != UNREGISTERED) {
-				return &(nodes[index]);
-			}
+	int pos = findMacIndex (mac);
+
+	if (pos >= 0) {
+		Node* node = &(nodes[macIndex[pos]]);
+		if (node->status != UNREGISTERED) {
+			return node;
 		}
-		index++;
 	}
 
 	return NULL;
@@ -172,8 +768,6 @@ void NodeList::initBroadcastNode () {
 }
 
 Node* NodeList::getNodeFromName (const char* name) {
-	uint16_t index = 0;
-
 	// Check if address is an address as an string
 	uint8_t netAddr[ENIGMAIOT_ADDR_LEN];
 	if (str2mac (name, netAddr)) {
@@ -186,13 +780,14 @@ Node* NodeList::getNodeFromName (const char* name) {
 		return &broadcastNode;
 	}
 
-	while (index < NUM_NODES) {
-		if (!strncmp (nodes[index].nodeName, name, NODE_NAME_LENGTH)) {
-			if (nodes[index].status != UNREGISTERED) {
-				return &(nodes[index]);
-			}
+	uint16_t pos = nameHash (name);
+
+	while (nameIndex[pos] != EMPTY_INDEX_ENTRY) {
+		Node* node = &(nodes[nameIndex[pos]]);
+		if (node->status != UNREGISTERED && node->getNodeName () && !strncmp (node->getNodeName (), name, NODE_NAME_LENGTH)) {
+			return node;
 		}
-		index++;
+		pos = (pos + 1) & (NODE_INDEX_SIZE - 1);
 	}
 
 	return NULL;
@@ -211,48 +806,42 @@ int8_t NodeList::checkNodeName (const char* name, const uint8_t* address) {
 		return EMPTY_NAME; // Too long name
 	}
 
-	for (int i = 0; i < NUM_NODES; i++) {
-		// if node is not registered and has this node name
-		DEBUG_DBG ("Node %d status is %d", i, nodes[i].status);
-		if (nodes[i].status != UNREGISTERED) {
-			char* currentNodeNamme = nodes[i].getNodeName ();
-			DEBUG_DBG ("Node %d name is %s", i, currentNodeNamme ? currentNodeNamme : "NULL");
-			if (currentNodeNamme && !strncmp (currentNodeNamme, name, NODE_NAME_LENGTH)) {
-				// if addresses addresses are different
-				//char addrStr[ENIGMAIOT_ADDR_LEN * 3];
-				DEBUG_INFO ("Found node name %s in Node List with address %s", name, mac2str (address));
-				if (memcmp (nodes[i].getMacAddress (), address, ENIGMAIOT_ADDR_LEN)) {
-					DEBUG_ERROR ("Duplicated name %s", name);
-					return ALREADY_USED; // Already used
-				}
+	uint16_t pos = nameHash (name);
+
+	while (nameIndex[pos] != EMPTY_INDEX_ENTRY) {
+		Node* node = &(nodes[nameIndex[pos]]);
+		// if node is registered and has this node name
+		DEBUG_DBG ("Node %d status is %d", node->nodeId, node->status);
+		if (node->status != UNREGISTERED && node->getNodeName () && !strncmp (node->getNodeName (), name, NODE_NAME_LENGTH)) {
+			// if addresses addresses are different
+			DEBUG_INFO ("Found node name %s in Node List with address %s", name, DEBUG_MAC (address));
+			if (memcmp (node->getMacAddress (), address, ENIGMAIOT_ADDR_LEN)) {
+				DEBUG_ERROR ("Duplicated name %s", name);
+				return ALREADY_USED; // Already used
 			}
 		}
+		pos = (pos + 1) & (NODE_INDEX_SIZE - 1);
 	}
 	return NAME_OK; // Name was not used
 }
 
 Node* NodeList::findEmptyNode () {
-	uint16_t index = 0;
-
-	while (index < NUM_NODES) {
-		if (nodes[index].status != UNREGISTERED) {
-			return &(nodes[index]);
+	for (unsigned int i = 0; i < sizeof (freeSlots) / sizeof (freeSlots[0]); i++) {
+		if (freeSlots[i]) {
+			return &(nodes[i * 32 + __builtin_ctz (freeSlots[i])]);
 		}
-		index++;
 	}
 
 	return NULL;
 }
 
 uint16_t NodeList::countActiveNodes () {
-	uint16_t counter = 0;
+	uint16_t freeCounter = 0;
 
-	for (int i = 0; i < NUM_NODES; i++) {
-		if (nodes[i].status != UNREGISTERED) {
-			counter++;
-		}
+	for (unsigned int i = 0; i < sizeof (freeSlots) / sizeof (freeSlots[0]); i++) {
+		freeCounter += __builtin_popcount (freeSlots[i]);
 	}
-	return counter;
+	return NUM_NODES - freeCounter;
 }
 
 bool NodeList::unregisterNode (uint16_t nodeId) {
@@ -322,19 +911,30 @@ Node* NodeList::getNextActiveNode (Node* node) {
 }
 
 Node* NodeList::getNewNode (const uint8_t* mac) {
-	Node* node = getNodeFromMAC (mac);
-	if (node) {
-		return node;
-	} else {
-		for (int i = 0; i < NUM_NODES; i++) {
-			if (nodes[i].status == UNREGISTERED) {
-				nodes[i].setMacAddress (const_cast<uint8_t*>(mac));
-				nodes[i].reset ();
-				return &(nodes[i]);
-			}
+	if (!memcmp (broadcastNode.getMacAddress (), mac, ENIGMAIOT_ADDR_LEN)) {
+		return &broadcastNode;
+	}
+
+	int pos = findMacIndex (mac);
+
+	if (pos >= 0) {
+		Node* node = &(nodes[macIndex[pos]]);
+		if (node->status == UNREGISTERED) {
+			// Address still owns its former slot, so reuse it
+			node->reset ();
 		}
+		return node;
 	}
-	return NULL;
+
+	Node* node = findEmptyNode ();
+	if (node) {
+		removeIndex (macIndex, node->nodeId);
+		node->setMacAddress (mac);
+		addIndex (macIndex, node->nodeId);
+		node->groups = 0; // Membership belonged to former address
+		node->reset ();
+	}
+	return node;
 }
 
 void NodeList::printToSerial (Stream* port) {
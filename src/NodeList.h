@@ -16,6 +16,10 @@
 #endif
 #include "EnigmaIoTconfig.h"
 #include "Filter.h"
+#include "fragmentBuffer.h"
+#include "replayWindow.h"
+#include "schemaCodec.h"
+#include "linkAdaptation.h"
 
 /**
   * @brief State definition for nodes
@@ -65,7 +69,14 @@ typedef enum control_message_type {
     RESTART_NODE = 0x09,
     RESTART_CONFIRM = 0x89,
     BRCAST_KEY = 0x10,
+    SESSION_TICKET = 0x11,
+    GROUP_KEY = 0x12,
+    SCHEMA_GET = 0x13,
+    TX_POWER_SET = 0x14,
 	  OTA = 0xEF,
+	  OTA_BIN = 0xEE, // Binary OTA chunk from gateway output. Only used on gateway, it is sent to node as OTA
+	  GROUP_JOIN = 0xED, // Adds node to a multicast group. Only used on gateway, it is sent to node as GROUP_KEY
+	  GROUP_LEAVE = 0xEC, // Removes node from a multicast group. Only used on gateway, it is sent to node as GROUP_KEY
 	  OTA_ANS = 0xFF,
 	  USERDATA_GET = 0x00,
 	  USERDATA_SET = 0x20,
@@ -80,7 +91,8 @@ typedef enum ota_status {
 	  OTA_CHECK_FAIL = 3,
 	  OTA_OUT_OF_SEQUENCE =4 ,
 	  OTA_TIMEOUT = 5,
-	  OTA_FINISHED = 6
+	  OTA_FINISHED = 6,
+	  OTA_ACK = 7
 } ota_status_t;
 
 /**
@@ -90,8 +102,8 @@ struct node_instance {
     uint8_t mac[ENIGMAIOT_ADDR_LEN]; ///< @brief Node address
     uint16_t nodeId; ///< @brief Node identifier asigned by gateway
     uint8_t key[32]; ///< @brief Shared key
-    uint16_t lastMessageCounter; ///< @brief Last message counter state for specific Node
-    uint16_t lastControlCounter; ///< @brief Last control message counter state for specific Node
+    uint32_t lastMessageCounter; ///< @brief Last message counter state for specific Node. Extended 32 bit counter on gateway
+    uint32_t lastControlCounter; ///< @brief Last control message counter state for specific Node. Extended 32 bit counter on gateway
     uint16_t lastDownlinkMsgCounter; ///< @brief Last downlink message counter state for specific Node
     time_t keyValidFrom; ///< @brief Last time that Node and Gateway agreed a key
     time_t lastMessageTime; ///< @brief Last time a message was received by Node
@@ -103,6 +115,27 @@ struct node_instance {
 
 typedef struct node_instance node_t;
 
+/**
+  * @brief Node data that is only needed while node is registered. It is allocated on registration and freed on node reset,
+  * so that free node slots only take the memory of most used fields
+  */
+struct node_cold_data {
+    char nodeName[NODE_NAME_LENGTH]; /**< Node name. Use as a human friendly name to avoid use of numeric address*/
+    FilterClass rateFilter; /**< Filter for message rate smoothing*/
+    FragmentBuffer rxFragments; /**< Reassembly buffer for fragmented payloads received from this node*/
+    SchemaDecoder schema; /**< Schema that this node uses for `SCHEMA_DATA` payloads*/
+    LinkAdaptation linkAdaptation; /**< TX power recommended to this node*/
+
+    /**
+      * @brief Initializes empty node name and message rate filter
+      */
+    node_cold_data ();
+};
+
+typedef struct node_cold_data node_cold_t;
+
+class NodeList;
+
 /**
   * @brief Class definition for a single sensor Node
   */
@@ -150,8 +183,8 @@ public:
       * @return Returns Node name
       */
     char* getNodeName () {
-        if (strlen (nodeName)) {
-            return nodeName;
+        if (cold && cold->nodeName[0]) {
+            return cold->nodeName;
         } else {
             return NULL;
         }
@@ -161,10 +194,7 @@ public:
       * @brief Sets Node name
       * @param name Custom node name. This should be unique in the network
       */
-    void setNodeName (const char* name) {
-        memset (nodeName, 0, NODE_NAME_LENGTH);
-        strncpy (nodeName, name, NODE_NAME_LENGTH);
-    }
+    void setNodeName (const char* name);
 
     /**
       * @brief Gets Node encryption key
@@ -180,6 +210,22 @@ public:
       */
     void setEncryptionKey (const uint8_t* key);
 
+    /**
+      * @brief Gets algorithm agreed to encrypt messages with this node key
+      * @return Cipher algorithm
+      */
+    cipherAlgorithm_t getCipherAlgorithm () {
+        return cipherAlgorithm;
+    }
+
+    /**
+      * @brief Sets algorithm to encrypt messages with this node key
+      * @param algorithm Cipher algorithm agreed during registration
+      */
+    void setCipherAlgorithm (cipherAlgorithm_t algorithm) {
+        cipherAlgorithm = algorithm;
+    }
+
     /**
       * @brief Gets last time that key was agreed with gateway
       * @return Time in milliseconds of last key agreement
@@ -192,8 +238,21 @@ public:
       * @brief Sets time when key was agreed with gateway
       * @param keyValidFrom Time on key agreement
       */
-    void setKeyValidFrom (time_t keyValidFrom) {
-        this->keyValidFrom = keyValidFrom;
+    void setKeyValidFrom (time_t keyValidFrom);
+
+    /**
+      * @brief Checks if node key has been valid for more than `MAX_KEY_VALIDITY` ms. It is updated by gateway when key validity deadline passes
+      * @return `true` if key has expired
+      */
+    bool isKeyExpired () {
+        return keyExpired;
+    }
+
+    /**
+      * @brief Marks node key as expired
+      */
+    void setKeyExpired () {
+        keyExpired = true;
     }
 
     /**
@@ -207,23 +266,21 @@ public:
     /**
       * @brief Sets current moment as last node message time
       */
-    void setLastMessageTime () {
-        lastMessageTime = millis ();
-    }
+    void setLastMessageTime ();
 
     /**
       * @brief Gets counter for last received message from node
-      * @return Message counter
+      * @return Message counter. Extended 32 bit counter on gateway
       */
-    uint16_t getLastMessageCounter () {
+    uint32_t getLastMessageCounter () {
         return lastMessageCounter;
     }
 
     /**
       * @brief Gets counter for last received control message from node
-      * @return Message counter
+      * @return Message counter. Extended 32 bit counter on gateway
       */
-    uint16_t getLastControlCounter () {
+    uint32_t getLastControlCounter () {
         return lastControlCounter;
     }
 
@@ -236,28 +293,53 @@ public:
     }
 
     /**
-      * @brief Sets counter for last received message from node
-      * @param counter Message counter
+      * @brief Sets counter for last received message from node. Replay window starts again from it
+      * @param counter Message counter. Extended 32 bit counter on gateway
       */
-    void setLastMessageCounter (uint16_t counter) {
-        lastMessageCounter = counter;
+    void setLastMessageCounter (uint32_t counter);
+
+    /**
+      * @brief Sets counter for last received control message from node. Replay window starts again from it
+      * @param counter Message counter. Extended 32 bit counter on gateway
+      */
+    void setLastControlCounter (uint32_t counter);
+
+    /**
+      * @brief Gets replay window of data messages from node
+      * @return Replay window
+      */
+    ReplayWindow* getMessageWindow () {
+        return &messageWindow;
     }
 
     /**
-      * @brief Sets counter for last received control message from node
-      * @param counter Message counter
+      * @brief Gets replay window of control messages from node
+      * @return Replay window
       */
-    void setLastControlCounter (uint16_t counter) {
-        lastControlCounter = counter;
+    ReplayWindow* getControlWindow () {
+        return &controlWindow;
     }
 
+    /**
+      * @brief Checks extended counter of a data message from node and records it if it was not received before
+      * @param counter Extended message counter
+      * @param lost Filled with number of messages skipped by a new highest counter
+      * @return Check result. Message should only be processed if it is `REPLAY_NEW` or `REPLAY_LATE`
+      */
+    replay_result_t acceptMessageCounter (uint32_t counter, uint32_t* lost);
+
+    /**
+      * @brief Checks extended counter of a control message from node and records it if it was not received before
+      * @param counter Extended message counter
+      * @return Check result. Message should only be processed if it is `REPLAY_NEW` or `REPLAY_LATE`
+      */
+    replay_result_t acceptControlCounter (uint32_t counter);
+
     /**
       * @brief Sets counter for last downlink message from gateway
       * @param counter Message counter
       */
-    void setLastDownlinkMsgCounter (uint16_t counter) {
-        lastDownlinkMsgCounter = counter;
-    }
+    void setLastDownlinkMsgCounter (uint16_t counter);
 
     /**
       * @brief Sets node address
@@ -305,9 +387,7 @@ public:
       * @brief Sets status for finite state machine that represents node
       * @param status Node status
       */
-    void setStatus (status_t status) {
-        this->status = status;
-    }
+    void setStatus (status_t status);
 
     /**
       * @brief Gets a struct that represents node object. May be used for node serialization
@@ -405,6 +485,31 @@ public:
         return broadcastKeyRequested;
     }
 
+    /**
+      * @brief Checks if node is member of a multicast group
+      * @param group Group index
+      * @return `true` if node is member of group
+      */
+    bool isGroupMember (uint8_t group) {
+        return group < MAX_NODE_GROUPS && (groups & (1U << group));
+    }
+
+    /**
+      * @brief Gets multicast groups this node is member of
+      * @return Bitmap of group indexes
+      */
+    uint16_t getGroups () {
+        return groups;
+    }
+
+    /**
+      * @brief Sets multicast groups this node is member of. Used to restore membership after a restart
+      * @param groups Bitmap of group indexes
+      */
+    void setGroups (uint16_t groups) {
+        this->groups = groups;
+    }
+
     /**
       * @brief Adds a new message rate value for filter calculation
       * @param value Next value for calculation
@@ -462,46 +567,134 @@ public:
         enigmaIOTVersion[2] = incremental;
     }
 
-    uint8_t queuedMessage[MAX_MESSAGE_LENGTH]; ///< @brief Message queued for sending to node in case of sleepy mode
-    size_t qMessageLength;  ///< @brief Queued message length
-    bool qMessagePending = false; ///< @brief `True` if message should be sent just after next data message
+    /**
+      * @brief Gets reassembly buffer for fragmented payloads received from this node
+      * @return Reassembly buffer. NULL if node is not registered
+      */
+    FragmentBuffer* getRxFragments () {
+        return cold ? &(cold->rxFragments) : NULL;
+    }
+
+    /**
+      * @brief Gets schema decoder of compact data sent by this node
+      * @return Schema decoder. NULL if node is not registered
+      */
+    SchemaDecoder* getSchema () {
+        return cold ? &(cold->schema) : NULL;
+    }
+
+    /**
+      * @brief Gets TX power adaptation state of this node
+      * @return Link adaptation. NULL if node is not registered
+      */
+    LinkAdaptation* getLinkAdaptation () {
+        return cold ? &(cold->linkAdaptation) : NULL;
+    }
+
+    /**
+      * @brief Checks if there are downlink messages waiting for this node to wake up
+      * @return `true` if downlink queue is not empty
+      */
+    bool hasQueuedDownlink () {
+        return qHead >= 0;
+    }
+
+    /**
+      * @brief Gets number of downlink messages waiting for this node to wake up
+      * @return Downlink queue length
+      */
+    uint8_t getQueuedDownlinkCount () {
+        return qCount;
+    }
+
 
     uint32_t packetNumber = 0; ///< @brief Number of packets received from node to gateway
     uint32_t packetErrors = 0; ///< @brief Number of errored packets
     double per = 0;  ///< @brief Current packet error rate of a specific node
     double packetsHour = 0; ///< @brief Packet rate for a specific nope
+    uint32_t downlinkLatency = 0; ///< @brief Time until delivery of last confirmed downlink message, in microseconds
+    uint32_t downlinkFailures = 0; ///< @brief Number of downlink messages that were not delivered to this node
     //int64_t t1, t2, t3, t4;  ///< @brief Timestaps to calculate clock offset
 
 protected:
 //#define KEYLENGTH 32
     bool keyValid; ///< @brief Node shared key valid
     status_t status; ///< @brief Current node status. See `enum node_status`
-    uint16_t lastMessageCounter; ///< @brief Last message counter state for specific Node
-    uint16_t lastControlCounter; ///< @brief Last message counter state for specific Node
+    uint32_t lastMessageCounter; ///< @brief Last message counter state for specific Node. Extended 32 bit counter on gateway
+    uint32_t lastControlCounter; ///< @brief Last message counter state for specific Node. Extended 32 bit counter on gateway
     uint16_t lastDownlinkMsgCounter; ///< @brief Last downlink message counter state for specific Node
+    ReplayWindow messageWindow; ///< @brief Data message counters received by gateway
+    ReplayWindow controlWindow; ///< @brief Control message counters received by gateway
     uint16_t nodeId; ///< @brief Node identifier asigned by gateway
     timer_t keyValidFrom; ///< @brief Last time that Node and Gateway agreed a key
     bool sleepyNode = true; ///< @brief Node sleepy definition
     bool broadcastEnabled = false; ///< @brief Node is able to send broadcast messages
     bool broadcastKeyRequested = false; ///< @brief Node is waiting for broadcast key
+    uint16_t groups = 0; ///< @brief Bitmap of multicast groups this node is member of. It is kept while node address owns this slot, so that node gets its group keys again after a new registration
     bool initAsSleepy; ///< @brief Stores initial sleepy node. If this is false, this node does not accept sleep time changes
     bool askedTimeSync = false; ////< @brief Gateway marks this true to track if a node uses timeSync
     uint8_t mac[ENIGMAIOT_ADDR_LEN]; ///< @brief Node address
     uint8_t key[KEY_LENGTH]; ///< @brief Shared key
+    cipherAlgorithm_t cipherAlgorithm = CHACHAPOLY_CIPHER; ///< @brief Algorithm used with shared key
     timer_t lastMessageTime; ///< @brief Node state
-    FilterClass* rateFilter; ///< @brief Filter for message rate smoothing
-    char nodeName[NODE_NAME_LENGTH]; ///< @brief Node name. Use as a human friendly name to avoid use of numeric address
-    int8_t rssi; ///< @brief Stores last RSSI measurement
+    node_cold_t* cold = NULL; ///< @brief Node data that is allocated on registration. NULL while node is unregistered
+    int8_t rssi = 0; ///< @brief Stores last RSSI measurement. 0 if node has not reported it
     uint8_t enigmaIOTVersion[3]; ///< @brief Protocol version, filled when a version message is received
+    NodeList* nodeList = NULL; ///< @brief Node list that holds this node, if any. It is notified about status changes to keep its indexes updated
+    bool keyExpired = false; ///< @brief Node key has reached `MAX_KEY_VALIDITY`
+    uint32_t deadline; ///< @brief Next time when node has to be checked for inactivity, key expiration or fragment timeout
+    int16_t deadlinePos = -1; ///< @brief Node position on deadline heap. -1 if node has no pending deadline
+    int16_t qHead = -1; ///< @brief Oldest message of downlink queue, as an index of shared pool. -1 if queue is empty
+    int16_t qTail = -1; ///< @brief Newest message of downlink queue, as an index of shared pool. -1 if queue is empty
+    uint8_t qCount = 0; ///< @brief Number of messages on downlink queue
 
-     /**
-      * @brief Starts smoothing filter
+    /**
+      * @brief Allocates node cold data, if it was not allocated yet
+      * @return `true` if cold data is available
       */
-    void initRateFilter ();
+    bool allocColdData ();
+
+    /**
+      * @brief Frees node cold data
+      */
+    void freeColdData ();
 
     friend class NodeList;
 };
 
+/**
+  * @brief Calculates hash table size as the lowest power of 2 that is, at least, twice the number of elements
+  * @param elements Number of elements to be indexed
+  * @param size Candidate size, used for recursion
+  * @return Hash table size
+  */
+constexpr int indexTableSize (int elements, int size = 1) {
+    return size >= 2 * elements ? size : indexTableSize (elements, size * 2);
+}
+
+static const int NODE_INDEX_SIZE = indexTableSize (NUM_NODES); ///< @brief Number of entries of node lookup hash tables
+static const uint16_t EMPTY_INDEX_ENTRY = 0xFFFF; ///< @brief Marks a free entry in node lookup hash tables
+
+/**
+  * @brief Multicast group. Messages to a group are encrypted once with group key and sent as a single broadcast frame. Sleepy members get a unicast copy
+  */
+struct node_group_t {
+    char name[NODE_NAME_LENGTH]; /**< Group name. Empty if group is not used*/
+    uint8_t key[KEY_LENGTH]; /**< Group key. It is sent to every member*/
+    uint16_t lastDownlinkMsgCounter; /**< Last message counter of this group*/
+};
+
+/**
+  * @brief Downlink message waiting for a sleepy node to wake up. Entries are taken from a pool shared by all nodes
+  */
+struct downlink_queue_entry_t {
+    uint8_t message[MAX_MESSAGE_LENGTH]; /**< Encrypted message, ready to be sent*/
+    uint8_t length; /**< Message length*/
+    uint8_t type; /**< Control message type. Used to coalesce redundant commands*/
+    bool group; /**< `true` if it is a copy of a group message. It never replaces a command sent to node alone, nor the other way around*/
+    int16_t next; /**< Next entry on node queue or on free list. -1 marks the end*/
+};
+
 
 class NodeList {
 public:
@@ -628,11 +821,293 @@ public:
         lastBroadcastMsgCounter++;
     }
 
+    /**
+     * @brief Sets last broadcast message counter state. Used to restore it after a restart
+     * @param counter Last broadcast message counter
+     */
+    void setLastBroadcastMsgCounter (uint16_t counter) {
+        lastBroadcastMsgCounter = counter;
+    }
+
+    /**
+      * @brief Marks a node as changed, so that it is saved on next node snapshot update
+      * @param node Node that changed
+      */
+    void markDirty (Node* node);
+
+    /**
+      * @brief Gets first node that has changed since it was saved last time
+      * @return Changed node. NULL if there is none
+      */
+    Node* getDirtyNode ();
+
+    /**
+      * @brief Marks a node as saved
+      * @param node Saved node
+      */
+    void clearDirty (Node* node) {
+        if (isListNode (node)) {
+            dirtySlots[node->nodeId / 32] &= ~(1UL << (node->nodeId % 32));
+        }
+    }
+
+    /**
+      * @brief Gets a node slot with a given nodeId and assigns it an address. Used to restore nodes from a snapshot,
+      * as every node has to keep its former nodeId. Any other slot with the same address is reset
+      * @param nodeId Node identifier
+      * @param mac Node address
+      * @return Node slot. NULL if nodeId is out of range
+      */
+    Node* restoreNode (uint16_t nodeId, const uint8_t* mac);
+
+    /**
+      * @brief Recalculates next deadline of a node and updates its position on deadline heap.
+      * Called every time node status, last message time or key validity change
+      * @param node Node to update
+      */
+    void scheduleNode (Node* node);
+
+    /**
+      * @brief Gets node with the earliest deadline, if it has already passed. Caller has to check node and call `scheduleNode()`
+      * or reset it, otherwise the same node is returned again
+      * @param now Current time, as given by `millis()`
+      * @return Node whose inactivity, key validity or fragment timeout deadline has passed. NULL if there is none
+      */
+    Node* getExpiredNode (uint32_t now);
+
+    /**
+      * @brief Adds a message to node downlink queue. It will be sent after next data message from node.
+      * Queued commands of the same type and origin are replaced, except user data and group keys, so that only last one is delivered
+      * @param node Destination node
+      * @param message Encrypted message
+      * @param len Message length
+      * @param type Control message type. See `enum control_message_type`
+      * @param group `true` if message is a copy of a group message
+      * @return `true` if message was queued. `false` if node queue is full or there is no free pool entry
+      */
+    bool queueDownlink (Node* node, const uint8_t* message, size_t len, control_message_type_t type, bool group = false);
+
+    /**
+      * @brief Gets oldest message on node downlink queue
+      * @param node Node to get message from
+      * @param len Message length is written here
+      * @return Message buffer. It is valid until `dropQueuedDownlink()` is called. NULL if queue is empty
+      */
+    const uint8_t* getQueuedDownlink (Node* node, size_t& len);
+
+    /**
+      * @brief Deletes oldest message on node downlink queue and gives its entry back to pool
+      * @param node Node to delete message from
+      */
+    void dropQueuedDownlink (Node* node);
+
+    /**
+      * @brief Deletes all messages on node downlink queue. Used when node key changes, as they cannot be decrypted anymore
+      * @param node Node whose queue is deleted
+      */
+    void clearDownlinkQueue (Node* node);
+
+    /**
+      * @brief Finds a multicast group by its name
+      * @param name Group name, without `GROUP_ADDRESS_PREFIX`
+      * @return Group index. -1 if group does not exist
+      */
+    int8_t getGroupIndex (const char* name);
+
+    /**
+      * @brief Gets a multicast group
+      * @param group Group index
+      * @return Group data. NULL if index is out of range or group is not used
+      */
+    node_group_t* getGroup (int8_t group);
+
+    /**
+      * @brief Creates a multicast group
+      * @param name Group name, without `GROUP_ADDRESS_PREFIX`
+      * @param key Group key
+      * @return Group index. -1 if name is not valid or there is no free group
+      */
+    int8_t addGroup (const char* name, const uint8_t* key);
+
+    /**
+      * @brief Changes key of a multicast group. Used when a node leaves it, so that it cannot decrypt new messages
+      * @param group Group index
+      * @param key New group key
+      */
+    void setGroupKey (int8_t group, const uint8_t* key);
+
+    /**
+      * @brief Gets next counter of a multicast group message
+      * @param group Group index
+      * @return Message counter
+      */
+    uint16_t nextGroupMsgCounter (int8_t group);
+
+    /**
+      * @brief Sets all data of a multicast group. Used to restore it after a restart
+      * @param group Group index
+      * @param name Group name. Empty to delete group
+      * @param key Group key
+      * @param counter Last message counter
+      */
+    void restoreGroup (int8_t group, const char* name, const uint8_t* key, uint16_t counter);
+
+    /**
+      * @brief Adds a node to a multicast group
+      * @param node Node to add
+      * @param group Group index
+      * @return `true` if node was not member of group yet
+      */
+    bool joinGroup (Node* node, int8_t group);
+
+    /**
+      * @brief Removes a node from a multicast group. Group is deleted when it has no members left
+      * @param node Node to remove
+      * @param group Group index
+      * @return `true` if node was member of group
+      */
+    bool leaveGroup (Node* node, int8_t group);
+
+    /**
+      * @brief Gets next registered member of a multicast group
+      * @param group Group index
+      * @param node Previous member. NULL to get first one
+      * @return Group member. NULL if there are no more members
+      */
+    Node* getNextGroupMember (int8_t group, Node* node = NULL);
+
+    /**
+      * @brief Gets multicast groups that changed since they were saved on node snapshot. Deleted groups are included
+      * @return Bitmap of group indexes
+      */
+    uint16_t getDirtyGroups () {
+        return dirtyGroups;
+    }
+
+    /**
+      * @brief Marks all multicast groups as saved
+      */
+    void clearDirtyGroups () {
+        dirtyGroups = 0;
+    }
+
+    /**
+      * @brief Gets number of pool entries that are not used by any node queue
+      * @return Free entries
+      */
+    int getFreeDownlinkEntries () {
+        return freeDownlinkCount;
+    }
+
 protected:
     Node nodes[NUM_NODES]; ///< @brief Static Node array that holds maximum number of supported nodes 
     Node broadcastNode; ///< @brief Node instance that holds data used for broadcast messages. This does not represent any individual node
     uint16_t lastBroadcastMsgCounter; ///< @brief Last broadcast message counter state for all nodes, both for data and control messages
+    uint16_t macIndex[NODE_INDEX_SIZE]; ///< @brief Open addressing hash table that maps node addresses to nodeId. Holds every slot that has an address assigned
+    uint16_t nameIndex[NODE_INDEX_SIZE]; ///< @brief Open addressing hash table that maps node names to nodeId. Holds every slot that has a name assigned
+    uint32_t freeSlots[(NUM_NODES + 31) / 32]; ///< @brief Bitmap of unregistered slots. A bit set to 1 means that slot is free
+    uint32_t dirtySlots[(NUM_NODES + 31) / 32]; ///< @brief Bitmap of slots that changed since they were saved on node snapshot
+    uint16_t deadlineHeap[NUM_NODES]; ///< @brief Min heap of nodeId ordered by node deadline. Only nodes with some pending deadline are in it
+    int deadlineCount = 0; ///< @brief Number of nodes on deadline heap
+    downlink_queue_entry_t downlinkPool[DOWNLINK_POOL_SIZE]; ///< @brief Downlink messages for sleepy nodes, shared by all of them
+    int16_t freeDownlinkEntry; ///< @brief First entry of pool free list. -1 if pool is exhausted
+    int freeDownlinkCount; ///< @brief Number of entries on pool free list
+    node_group_t nodeGroups[MAX_NODE_GROUPS]; ///< @brief Multicast groups. Membership is stored on every node
+    uint16_t dirtyGroups = 0; ///< @brief Bitmap of groups that changed since they were saved on node snapshot
+
+    /**
+      * @brief Calculates hash of a node address
+      * @param mac Node address
+      * @return Hash table start position
+      */
+    uint16_t macHash (const uint8_t* mac);
+
+    /**
+      * @brief Calculates hash of a node name
+      * @param name Node name
+      * @return Hash table start position
+      */
+    uint16_t nameHash (const char* name);
+
+    /**
+      * @brief Calculates hash of the key that a slot has on a given index
+      * @param index Hash table, `macIndex` or `nameIndex`
+      * @param nodeId Slot to get key from
+      * @return Hash table start position
+      */
+    uint16_t slotHash (const uint16_t* index, uint16_t nodeId);
+
+    /**
+      * @brief Finds position of an address in address index
+      * @param mac Node address
+      * @return Position in `macIndex`. -1 if it was not found
+      */
+    int findMacIndex (const uint8_t* mac);
+
+    /**
+      * @brief Adds a slot to an index using its current key
+      * @param index Hash table, `macIndex` or `nameIndex`
+      * @param nodeId Slot that holds the node
+      */
+    void addIndex (uint16_t* index, uint16_t nodeId);
+
+    /**
+      * @brief Deletes a slot from an index. Its key must not have changed since it was added.
+      * Entries are shifted back so that no deleted marks are needed
+      * @param index Hash table, `macIndex` or `nameIndex`
+      * @param nodeId Slot that holds the node
+      */
+    void removeIndex (uint16_t* index, uint16_t nodeId);
+
+    /**
+      * @brief Checks if a node instance belongs to this list
+      * @param node Node instance
+      * @return `true` if node is one of list slots
+      */
+    bool isListNode (Node* node) {
+        return node->nodeId < NUM_NODES && &(nodes[node->nodeId]) == node;
+    }
+
+    /**
+      * @brief Adds node to name index. Called after node name is set
+      * @param node Node that changed its name
+      */
+    void addNameIndex (Node* node);
+
+    /**
+      * @brief Deletes node from name index. Called before node name is changed
+      * @param node Node that is going to change its name
+      */
+    void removeNameIndex (Node* node);
+
+    /**
+      * @brief Updates free slot bitmap after a node status change
+      * @param node Node that changed its status
+      */
+    void updateFreeSlot (Node* node);
+
+    /**
+      * @brief Calculates next deadline of a node
+      * @param node Node to check
+      * @param deadline Earliest deadline is written here
+      * @return `true` if node has some pending deadline
+      */
+    bool getNodeDeadline (Node* node, uint32_t& deadline);
+
+    /**
+      * @brief Swaps two nodes on deadline heap
+      * @param a Position of first node
+      * @param b Position of second node
+      */
+    void swapDeadline (int a, int b);
+
+    /**
+      * @brief Restores heap order moving a node up or down from its position
+      * @param pos Position of node to move
+      */
+    void fixDeadline (int pos);
 
+    friend class Node;
 };
 
 
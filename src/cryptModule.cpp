@@ -10,38 +10,57 @@
 
 #include "cryptModule.h"
 #include <Curve25519.h>
-#include <ChaChaPoly.h>
-#include <Poly1305.h>
-#include <SHA256.h>
+#include "cryptoBackend.h"
 #include "helperFunctions.h"
+#include "gatewayMetrics.h"
+
+CryptoBackend* CryptModule::getBackend (cipherAlgorithm_t algorithm) {
+	switch (algorithm) {
+#if USE_HW_CRYPTO
+	case AES_GCM_CIPHER:
+		return &AesGcmCrypto;
+#endif // USE_HW_CRYPTO
+	case CHACHAPOLY_CIPHER:
+	default:
+		return &ChaChaPolyCrypto;
+	}
+}
 
-CYPHER_TYPE cipher;
+cipherAlgorithm_t CryptModule::selectCipher (uint8_t peerCiphers) {
+	uint8_t common = peerCiphers & SUPPORTED_CIPHERS;
 
-uint8_t* CryptModule::getSHA256 (uint8_t* buffer, uint8_t length) {
-	const uint8_t HASH_LEN = 32;
+	if (common & PREFERRED_CIPHER) {
+		return PREFERRED_CIPHER;
+	}
+	if (common & AES_GCM_CIPHER) {
+		return AES_GCM_CIPHER;
+	}
+	return CHACHAPOLY_CIPHER;
+}
 
-	uint8_t key[HASH_LEN];
+void CryptModule::clearCipherCache () {
+	ChaChaPolyCrypto.clear ();
+#if USE_HW_CRYPTO
+	AesGcmCrypto.clear ();
+#endif // USE_HW_CRYPTO
+}
 
-	if (length < HASH_LEN) {
+uint8_t* CryptModule::getSHA256 (uint8_t* buffer, uint8_t length) {
+	uint8_t key[SHA256_LENGTH];
+
+	if (length < SHA256_LENGTH) {
 		DEBUG_ERROR ("Too small buffer. Should be 32 bytes");
 		return NULL;
 	}
 
-	SHA256 hash;
-
-	// hash.reset (); // Not needed, implicit to constructor
-	hash.update ((void*)buffer, length);
-	hash.finalize (key, HASH_LEN);
-	hash.clear ();
-
-	/*br_sha256_context* shaContext = new br_sha256_context ();
-	br_sha256_init (shaContext);
-	br_sha224_update (shaContext, (void*)buffer, length);
-	br_sha256_out (shaContext, key);
-	delete shaContext;*/
+	// Any backend gives the same result, so use the fastest one
+	if (!getBackend (PREFERRED_CIPHER)->sha256 (buffer, length, key)) {
+		DEBUG_ERROR ("Error calculating hash");
+		return NULL;
+	}
 
-	if (length > HASH_LEN) {
-		length = HASH_LEN;
+	if (length > SHA256_LENGTH) {
+		length = SHA256_LENGTH;
 	}
 
 	memcpy (buffer, key, length);
@@ -51,31 +70,23 @@ uint8_t* CryptModule::getSHA256 (uint8_t* buffer, uint8_t length) {
 
 bool CryptModule::decryptBuffer (const uint8_t* data, size_t length,
 								 const uint8_t* iv, uint8_t ivlen, const uint8_t* key, uint8_t keylen,
-								 const uint8_t* aad, uint8_t aadLen, const uint8_t* tag, uint8_t tagLen) {
+								 const uint8_t* aad, uint8_t aadLen, const uint8_t* tag, uint8_t tagLen,
+								 cipherAlgorithm_t algorithm) {
 	if (key && iv && data) {
 
-		DEBUG_VERBOSE ("IV: %s", printHexBuffer (iv, ivlen));
-		DEBUG_VERBOSE ("Key: %s", printHexBuffer (key, keylen));
-		DEBUG_VERBOSE ("AAD: %s", printHexBuffer (aad, aadLen));
-		cipher.clear ();
-
-		if (cipher.setKey (key, keylen)) {
-			if (cipher.setIV ((uint8_t*)iv, ivlen)) {
-				cipher.addAuthData ((uint8_t*)aad, aadLen);
-				cipher.decrypt ((uint8_t*)data, (uint8_t*)data, length);
-				bool ok = cipher.checkTag ((uint8_t*)tag, tagLen);
-				cipher.clear ();
-				DEBUG_VERBOSE ("Tag: %s", printHexBuffer (tag, tagLen));
-				if (!ok) {
-					DEBUG_ERROR ("Data authentication error");
-				}
-				return ok;
-			} else {
-				DEBUG_ERROR ("Error setting IV");
-			}
-		} else {
-			DEBUG_ERROR ("Error setting key");
+		DEBUG_VERBOSE ("IV: %s", DEBUG_HEX (iv, ivlen));
+		DEBUG_VERBOSE ("Key: %s", DEBUG_HEX (key, keylen));
+		DEBUG_VERBOSE ("AAD: %s", DEBUG_HEX (aad, aadLen));
+
+		METRICS_START (start);
+		bool ok = getBackend (algorithm)->decrypt ((uint8_t*)data, length, iv, ivlen, key, keylen, aad, aadLen, tag, tagLen);
+		METRICS_RECORD (METRIC_DECRYPT, start);
+		DEBUG_VERBOSE ("Tag: %s", DEBUG_HEX (tag, tagLen));
+		if (!ok) {
+			METRICS_COUNT (METRIC_DECRYPT_ERRORS);
+			DEBUG_ERROR ("Data authentication error");
 		}
+		return ok;
 	} else {
 		DEBUG_ERROR ("Error in key or IV");
 	}
@@ -85,29 +96,20 @@ bool CryptModule::decryptBuffer (const uint8_t* data, size_t length,
 
 bool CryptModule::encryptBuffer (const uint8_t* data, size_t length,
 								 const uint8_t* iv, uint8_t ivlen, const uint8_t* key, uint8_t keylen,
-								 const uint8_t* aad, uint8_t aadLen, const uint8_t* tag, uint8_t tagLen) {
+								 const uint8_t* aad, uint8_t aadLen, const uint8_t* tag, uint8_t tagLen,
+								 cipherAlgorithm_t algorithm) {
 
 	if (key && iv && data) {
 
-		DEBUG_VERBOSE ("IV: %s", printHexBuffer (iv, ivlen));
-		DEBUG_VERBOSE ("Key: %s", printHexBuffer (key, keylen));
-		DEBUG_VERBOSE ("AAD: %s", printHexBuffer (aad, aadLen));
-		cipher.clear ();
-
-		if (cipher.setKey ((uint8_t*)key, keylen)) {
-			if (cipher.setIV ((uint8_t*)iv, ivlen)) {
-				cipher.addAuthData ((uint8_t*)aad, aadLen);
-				cipher.encrypt ((uint8_t*)data, (uint8_t*)data, length);
-				cipher.computeTag ((uint8_t*)tag, tagLen);
-				cipher.clear ();
-				DEBUG_VERBOSE ("Tag: %s", printHexBuffer (tag, tagLen));
-				return true;
-			} else {
-				DEBUG_ERROR ("Error setting IV");
-			}
-		} else {
-			DEBUG_ERROR ("Error setting key");
-		}
+		DEBUG_VERBOSE ("IV: %s", DEBUG_HEX (iv, ivlen));
+		DEBUG_VERBOSE ("Key: %s", DEBUG_HEX (key, keylen));
+		DEBUG_VERBOSE ("AAD: %s", DEBUG_HEX (aad, aadLen));
+
+		METRICS_START (start);
+		bool ok = getBackend (algorithm)->encrypt ((uint8_t*)data, length, iv, ivlen, key, keylen, aad, aadLen, (uint8_t*)tag, tagLen);
+		METRICS_RECORD (METRIC_ENCRYPT, start);
+		DEBUG_VERBOSE ("Tag: %s", DEBUG_HEX (tag, tagLen));
+		return ok;
 	} else {
 		DEBUG_ERROR ("Error on input data for encryption");
 	}
@@ -140,14 +142,14 @@ uint8_t* CryptModule::random (const uint8_t* buf, size_t len) {
 
 void CryptModule::getDH1 () {
 	Curve25519::dh1 (publicDHKey, privateDHKey);
-	DEBUG_VERBOSE ("Public key: %s", printHexBuffer (publicDHKey, KEY_LENGTH));
+	DEBUG_VERBOSE ("Public key: %s", DEBUG_HEX (publicDHKey, KEY_LENGTH));
 
-	DEBUG_VERBOSE ("Private key: %s", printHexBuffer (privateDHKey, KEY_LENGTH));
+	DEBUG_VERBOSE ("Private key: %s", DEBUG_HEX (privateDHKey, KEY_LENGTH));
 }
 
 bool CryptModule::getDH2 (const uint8_t* remotePubKey) {
-	DEBUG_VERBOSE ("Remote public key: %s", printHexBuffer (const_cast<uint8_t*>(remotePubKey), KEY_LENGTH));
-	DEBUG_VERBOSE ("Private key: %s", printHexBuffer (privateDHKey, KEY_LENGTH));
+	DEBUG_VERBOSE ("Remote public key: %s", DEBUG_HEX (const_cast<uint8_t*>(remotePubKey), KEY_LENGTH));
+	DEBUG_VERBOSE ("Private key: %s", DEBUG_HEX (privateDHKey, KEY_LENGTH));
 
 	if (!Curve25519::dh2 (const_cast<uint8_t*>(remotePubKey), privateDHKey)) {
 		DEBUG_WARN ("DH2 error");
@@ -18,6 +18,8 @@
 #endif
 #include "EnigmaIoTconfig.h"
 
+class CryptoBackend;
+
 #define CRYPTMODULE_DEBUG_TAG "CryptModule"
 
 #ifdef ESP8266
@@ -77,11 +79,13 @@ public:
 	  * @param aadLen Additional Authentication Data length
 	  * @param tag Buffer to store authentication tag calculated by Poly1305
 	  * @param tagLen Additional Authentication Tag length
+	  * @param algorithm Algorithm agreed for this key. ChaCha20-Poly1305 by default
 	  * @return True if decryption and tag checking was correct
 	  */
 	static bool decryptBuffer (const uint8_t* data, size_t length,
 							   const uint8_t* iv, uint8_t ivlen, const uint8_t* key, uint8_t keylen,
-							   const uint8_t* aad, uint8_t aadLen, const uint8_t* tag, uint8_t tagLen);
+							   const uint8_t* aad, uint8_t aadLen, const uint8_t* tag, uint8_t tagLen,
+							   cipherAlgorithm_t algorithm = CHACHAPOLY_CIPHER);
 
 	/**
 	  * @brief Generates a SHA256 hash from input
@@ -103,11 +107,32 @@ public:
 	  * @param aadLen Additional Authentication Data length
 	  * @param tag Buffer to store authentication tag calculated by Poly1305
 	  * @param tagLen Additional Authentication Tag length
+	  * @param algorithm Algorithm agreed for this key. ChaCha20-Poly1305 by default
 	  * @return True if encryption and tag generation was correct
 	  */
 	static bool encryptBuffer (const uint8_t* data, size_t length,
 							   const uint8_t* iv, uint8_t ivlen, const uint8_t* key, uint8_t keylen,
-							   const uint8_t* aad, uint8_t aadLen, const uint8_t* tag, uint8_t tagLen);
+							   const uint8_t* aad, uint8_t aadLen, const uint8_t* tag, uint8_t tagLen,
+							   cipherAlgorithm_t algorithm = CHACHAPOLY_CIPHER);
+
+	/**
+	  * @brief Deletes all cached cipher contexts, wiping their keys from memory
+	  */
+	static void clearCipherCache ();
+
+	/**
+	  * @brief Gets implementation of an algorithm
+	  * @param algorithm Algorithm identifier
+	  * @return Crypto backend. ChaCha20-Poly1305 backend if algorithm is not supported on this build
+	  */
+	static CryptoBackend* getBackend (cipherAlgorithm_t algorithm);
+
+	/**
+	  * @brief Selects algorithm to use with a peer during registration
+	  * @param peerCiphers Bit mask of algorithms supported by peer
+	  * @return Preferred algorithm if both support it, ChaCha20-Poly1305 otherwise
+	  */
+	static cipherAlgorithm_t selectCipher (uint8_t peerCiphers);
 
 	/**
 	  * @brief Starts first stage of Diffie Hellman key agreement algorithm
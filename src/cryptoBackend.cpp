@@ -0,0 +1,111 @@
+/**
+  * @file cryptoBackend.cpp
+  * @version 0.9.7
+  * @date 04/02/2021
+  * @author German Martin
+  * @brief Authenticated encryption and hash implementations used by CryptModule
+  */
+
+#include "cryptoBackend.h"
+#include "helperFunctions.h"
+
+bool ChaChaPolyBackend::encrypt (uint8_t* data, size_t length, const uint8_t* iv, uint8_t ivlen, const uint8_t* key, uint8_t keylen,
+								 const uint8_t* aad, uint8_t aadLen, uint8_t* tag, uint8_t tagLen) {
+	bool result = false;
+
+	cache.lock ();
+	CYPHER_TYPE* cipher = cache.get (key, keylen);
+	if (!cipher) {
+		DEBUG_ERROR ("Error setting key");
+	} else if (!cipher->setIV (iv, ivlen)) {
+		DEBUG_ERROR ("Error setting IV");
+	} else {
+		cipher->addAuthData (aad, aadLen);
+		cipher->encrypt (data, data, length);
+		cipher->computeTag (tag, tagLen);
+		result = true;
+	}
+	cache.unlock ();
+	return result;
+}
+
+bool ChaChaPolyBackend::decrypt (uint8_t* data, size_t length, const uint8_t* iv, uint8_t ivlen, const uint8_t* key, uint8_t keylen,
+								 const uint8_t* aad, uint8_t aadLen, const uint8_t* tag, uint8_t tagLen) {
+	bool result = false;
+
+	cache.lock ();
+	CYPHER_TYPE* cipher = cache.get (key, keylen);
+	if (!cipher) {
+		DEBUG_ERROR ("Error setting key");
+	} else if (!cipher->setIV (iv, ivlen)) {
+		DEBUG_ERROR ("Error setting IV");
+	} else {
+		cipher->addAuthData (aad, aadLen);
+		cipher->decrypt (data, data, length);
+		result = cipher->checkTag (tag, tagLen);
+	}
+	cache.unlock ();
+	return result;
+}
+
+bool ChaChaPolyBackend::sha256 (const uint8_t* data, size_t length, uint8_t* hash) {
+	SHA256 sha;
+
+	// sha.reset (); // Not needed, implicit to constructor
+	sha.update ((const void*)data, length);
+	sha.finalize (hash, SHA256_LENGTH);
+	sha.clear ();
+	return true;
+}
+
+ChaChaPolyBackend ChaChaPolyCrypto;
+
+#if USE_HW_CRYPTO
+bool AesGcmBackend::encrypt (uint8_t* data, size_t length, const uint8_t* iv, uint8_t ivlen, const uint8_t* key, uint8_t keylen,
+							 const uint8_t* aad, uint8_t aadLen, uint8_t* tag, uint8_t tagLen) {
+	cache.lock ();
+	AesGcmCipher* cipher = cache.get (key, keylen);
+
+	if (!cipher) {
+		cache.unlock ();
+		DEBUG_ERROR ("Error setting key");
+		return false;
+	}
+	int result = mbedtls_gcm_crypt_and_tag (cipher->getContext (), MBEDTLS_GCM_ENCRYPT, length,
+											iv, ivlen, aad, aadLen, data, data, tagLen, tag);
+	cache.unlock ();
+	if (result) {
+		DEBUG_ERROR ("AES-GCM encryption error -0x%04X", -result);
+	}
+	return result == 0;
+}
+
+bool AesGcmBackend::decrypt (uint8_t* data, size_t length, const uint8_t* iv, uint8_t ivlen, const uint8_t* key, uint8_t keylen,
+							 const uint8_t* aad, uint8_t aadLen, const uint8_t* tag, uint8_t tagLen) {
+	cache.lock ();
+	AesGcmCipher* cipher = cache.get (key, keylen);
+
+	if (!cipher) {
+		cache.unlock ();
+		DEBUG_ERROR ("Error setting key");
+		return false;
+	}
+	int result = mbedtls_gcm_auth_decrypt (cipher->getContext (), length, iv, ivlen, aad, aadLen,
+										   tag, tagLen, data, data);
+	cache.unlock ();
+	if (result && result != MBEDTLS_ERR_GCM_AUTH_FAILED) {
+		DEBUG_ERROR ("AES-GCM decryption error -0x%04X", -result);
+	}
+	return result == 0;
+}
+
+bool AesGcmBackend::sha256 (const uint8_t* data, size_t length, uint8_t* hash) {
+#if MBEDTLS_VERSION_NUMBER >= 0x03000000
+	return mbedtls_sha256 (data, length, hash, 0) == 0;
+#else
+	return mbedtls_sha256_ret (data, length, hash, 0) == 0;
+#endif
+}
+
+AesGcmBackend AesGcmCrypto;
+#endif // USE_HW_CRYPTO
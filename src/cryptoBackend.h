@@ -0,0 +1,304 @@
+/**
+  * @file cryptoBackend.h
+  * @version 0.9.7
+  * @date 04/02/2021
+  * @author German Martin
+  * @brief Authenticated encryption and hash implementations used by CryptModule
+  *
+  * ChaCha20-Poly1305 uses [Arduino CryptoLib](https://rweather.github.io/arduinolibs/crypto.html) library and is always available.
+  * AES-GCM uses mbedTLS, that is accelerated by hardware on ESP32. It is only available if `USE_HW_CRYPTO` is enabled
+  */
+
+#ifndef _CRYPTOBACKEND_h
+#define _CRYPTOBACKEND_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include "EnigmaIoTconfig.h"
+#include <ChaChaPoly.h>
+#include <SHA256.h>
+#if USE_HW_CRYPTO
+#include <mbedtls/gcm.h>
+#include <mbedtls/sha256.h>
+#include <mbedtls/version.h>
+#endif // USE_HW_CRYPTO
+
+const uint8_t SHA256_LENGTH = 32; ///< @brief SHA256 hash length
+
+static_assert (CIPHER_CONTEXT_CACHE_SIZE >= 1, "CIPHER_CONTEXT_CACHE_SIZE must be at least 1");
+
+/**
+  * @brief Least recently used cache of cipher instances that have their key already loaded,
+  * so that key setup is skipped if the same key is used again
+  *
+  * There is a single cache per backend, shared by all tasks. `get()` changes LRU state and may load other key on a context,
+  * so it and every use of the returned cipher have to be done between `lock()` and `unlock()`.
+  *
+  * `Tcipher` needs to implement `bool setKey (const uint8_t* key, size_t len)` and `void clear ()`
+  */
+template <typename Tcipher>
+class CipherContextCache {
+protected:
+	/**
+	  * @brief Cipher instance with a key already loaded
+	  */
+	typedef struct {
+		uint8_t key[KEY_LENGTH]; /**< Key loaded on cipher*/
+		uint8_t keyLen = 0; /**< Key length. 0 means context is free*/
+		uint32_t lastUsed = 0; /**< Use sequence number of last use, for LRU replacement*/
+		Tcipher cipher; /**< Cipher instance*/
+	} cipher_context_t;
+
+	cipher_context_t contexts[CIPHER_CONTEXT_CACHE_SIZE]; ///< @brief Cipher contexts keyed by its loaded key
+	uint32_t useCounter = 0; ///< @brief Sequence number used to track least recently used context
+#ifdef ESP32
+	SemaphoreHandle_t mutex = NULL; ///< @brief Serializes cache use between tasks. Created on first use
+	portMUX_TYPE mutexInit = portMUX_INITIALIZER_UNLOCKED; ///< @brief Protects mutex creation
+#endif // ESP32
+
+public:
+	/**
+	  * @brief Gets exclusive access to cache and its cipher instances. Mutex is used instead of a critical section as
+	  * encryption may take long. It does nothing on ESP8266, as there is a single task
+	  */
+	void lock () {
+#ifdef ESP32
+		if (!mutex) {
+			// Semaphore cannot be allocated inside a critical section. If other task won, this one is deleted
+			SemaphoreHandle_t newMutex = xSemaphoreCreateMutex ();
+			portENTER_CRITICAL (&mutexInit);
+			if (!mutex) {
+				mutex = newMutex;
+				newMutex = NULL;
+			}
+			portEXIT_CRITICAL (&mutexInit);
+			if (newMutex) {
+				vSemaphoreDelete (newMutex);
+			}
+		}
+		xSemaphoreTake (mutex, portMAX_DELAY);
+#endif // ESP32
+	}
+
+	/**
+	  * @brief Releases access got with `lock()`
+	  */
+	void unlock () {
+#ifdef ESP32
+		xSemaphoreGive (mutex);
+#endif // ESP32
+	}
+
+	/**
+	  * @brief Gets a cipher instance with given key loaded. If key is not cached least recently used context is replaced.
+	  * Caller has to hold `lock()` until it does not use cipher anymore
+	  * @param key Key to load
+	  * @param keylen Key length
+	  * @return Cipher instance, ready to set IV. `NULL` if key could not be set
+	  */
+	Tcipher* get (const uint8_t* key, uint8_t keylen) {
+		cipher_context_t* context = NULL;
+
+		if (keylen > KEY_LENGTH) {
+			return NULL;
+		}
+
+		for (int i = 0; i < CIPHER_CONTEXT_CACHE_SIZE; i++) {
+			if (contexts[i].keyLen == keylen && !memcmp (contexts[i].key, key, keylen)) {
+				contexts[i].lastUsed = ++useCounter;
+				return &(contexts[i].cipher);
+			}
+			if (!context || contexts[i].lastUsed < context->lastUsed) {
+				context = &(contexts[i]);
+			}
+		}
+
+		context->cipher.clear ();
+		if (!context->cipher.setKey (key, keylen)) {
+			context->keyLen = 0;
+			context->lastUsed = 0;
+			return NULL;
+		}
+		memcpy (context->key, key, keylen);
+		context->keyLen = keylen;
+		context->lastUsed = ++useCounter;
+
+		return &(context->cipher);
+	}
+
+	/**
+	  * @brief Deletes all cached contexts, wiping their keys from memory
+	  */
+	void clear () {
+		lock ();
+		for (int i = 0; i < CIPHER_CONTEXT_CACHE_SIZE; i++) {
+			contexts[i].cipher.clear ();
+			memset (contexts[i].key, 0, KEY_LENGTH);
+			contexts[i].keyLen = 0;
+			contexts[i].lastUsed = 0;
+		}
+		unlock ();
+	}
+};
+
+/**
+  * @brief Interface that every crypto implementation has to follow to be used by CryptModule
+  */
+class CryptoBackend {
+public:
+	/**
+	  * @brief Gets algorithm identifier used on registration negotiation
+	  * @return Algorithm identifier
+	  */
+	virtual cipherAlgorithm_t getAlgorithm () = 0;
+
+	/**
+	  * @brief Gets a human readable algorithm name
+	  * @return Algorithm name
+	  */
+	virtual const char* getName () = 0;
+
+	/**
+	  * @brief Encrypts a buffer in place and calculates authentication tag
+	  * @param data Buffer to encrypt. It will be used as input and output
+	  * @param length Buffer length in number of bytes
+	  * @param iv Initialization Vector
+	  * @param ivlen IV length
+	  * @param key Shared key
+	  * @param keylen Key length
+	  * @param aad Additional Authentication Data
+	  * @param aadLen Additional Authentication Data length
+	  * @param tag Buffer to store authentication tag
+	  * @param tagLen Authentication tag length
+	  * @return `true` if encryption was correct
+	  */
+	virtual bool encrypt (uint8_t* data, size_t length, const uint8_t* iv, uint8_t ivlen, const uint8_t* key, uint8_t keylen,
+						  const uint8_t* aad, uint8_t aadLen, uint8_t* tag, uint8_t tagLen) = 0;
+
+	/**
+	  * @brief Decrypts a buffer in place and checks authentication tag
+	  * @param data Buffer to decrypt. It will be used as input and output
+	  * @param length Buffer length in number of bytes
+	  * @param iv Initialization Vector
+	  * @param ivlen IV length
+	  * @param key Shared key
+	  * @param keylen Key length
+	  * @param aad Additional Authentication Data
+	  * @param aadLen Additional Authentication Data length
+	  * @param tag Authentication tag to check
+	  * @param tagLen Authentication tag length
+	  * @return `true` if decryption and tag checking was correct
+	  */
+	virtual bool decrypt (uint8_t* data, size_t length, const uint8_t* iv, uint8_t ivlen, const uint8_t* key, uint8_t keylen,
+						  const uint8_t* aad, uint8_t aadLen, const uint8_t* tag, uint8_t tagLen) = 0;
+
+	/**
+	  * @brief Calculates SHA256 hash
+	  * @param data Data to hash
+	  * @param length Data length
+	  * @param hash Buffer to store hash. It should be `SHA256_LENGTH` bytes long
+	  * @return `true` if hash was calculated
+	  */
+	virtual bool sha256 (const uint8_t* data, size_t length, uint8_t* hash) = 0;
+
+	/**
+	  * @brief Wipes all cached keys
+	  */
+	virtual void clear () = 0;
+};
+
+/**
+  * @brief ChaCha20-Poly1305 software implementation
+  */
+class ChaChaPolyBackend : public CryptoBackend {
+protected:
+	CipherContextCache<CYPHER_TYPE> cache; ///< @brief Cipher contexts with key already loaded
+
+public:
+	cipherAlgorithm_t getAlgorithm () { return CHACHAPOLY_CIPHER; }
+	const char* getName () { return "ChaCha20-Poly1305"; }
+	bool encrypt (uint8_t* data, size_t length, const uint8_t* iv, uint8_t ivlen, const uint8_t* key, uint8_t keylen,
+				  const uint8_t* aad, uint8_t aadLen, uint8_t* tag, uint8_t tagLen);
+	bool decrypt (uint8_t* data, size_t length, const uint8_t* iv, uint8_t ivlen, const uint8_t* key, uint8_t keylen,
+				  const uint8_t* aad, uint8_t aadLen, const uint8_t* tag, uint8_t tagLen);
+	bool sha256 (const uint8_t* data, size_t length, uint8_t* hash);
+	void clear () { cache.clear (); }
+};
+
+extern ChaChaPolyBackend ChaChaPolyCrypto; ///< @brief ChaCha20-Poly1305 backend instance
+
+#if USE_HW_CRYPTO
+/**
+  * @brief Wrapper to mbedTLS AES-GCM context to be used on CipherContextCache
+  */
+class AesGcmCipher {
+protected:
+	mbedtls_gcm_context context; ///< @brief mbedTLS GCM context
+	bool initialized = false; ///< @brief `true` if context was initialized
+
+public:
+	/**
+	  * @brief Frees up mbedTLS context
+	  */
+	~AesGcmCipher () {
+		clear ();
+	}
+
+	/**
+	  * @brief Calculates AES key schedule
+	  * @param key AES key. Valid lengths are 16, 24 and 32 bytes
+	  * @param len Key length
+	  * @return `true` if key was valid
+	  */
+	bool setKey (const uint8_t* key, size_t len) {
+		clear ();
+		mbedtls_gcm_init (&context);
+		initialized = true;
+		return mbedtls_gcm_setkey (&context, MBEDTLS_CIPHER_ID_AES, key, len * 8) == 0;
+	}
+
+	/**
+	  * @brief Frees up context, wiping key schedule
+	  */
+	void clear () {
+		if (initialized) {
+			mbedtls_gcm_free (&context);
+			initialized = false;
+		}
+	}
+
+	/**
+	  * @brief Gets mbedTLS context
+	  * @return GCM context with key loaded
+	  */
+	mbedtls_gcm_context* getContext () {
+		return &context;
+	}
+};
+
+/**
+  * @brief AES-GCM and SHA256 implementation over mbedTLS, hardware accelerated on ESP32
+  */
+class AesGcmBackend : public CryptoBackend {
+protected:
+	CipherContextCache<AesGcmCipher> cache; ///< @brief AES contexts with key schedule already calculated
+
+public:
+	cipherAlgorithm_t getAlgorithm () { return AES_GCM_CIPHER; }
+	const char* getName () { return "AES-GCM"; }
+	bool encrypt (uint8_t* data, size_t length, const uint8_t* iv, uint8_t ivlen, const uint8_t* key, uint8_t keylen,
+				  const uint8_t* aad, uint8_t aadLen, uint8_t* tag, uint8_t tagLen);
+	bool decrypt (uint8_t* data, size_t length, const uint8_t* iv, uint8_t ivlen, const uint8_t* key, uint8_t keylen,
+				  const uint8_t* aad, uint8_t aadLen, const uint8_t* tag, uint8_t tagLen);
+	bool sha256 (const uint8_t* data, size_t length, uint8_t* hash);
+	void clear () { cache.clear (); }
+};
+
+extern AesGcmBackend AesGcmCrypto; ///< @brief AES-GCM backend instance
+#endif // USE_HW_CRYPTO
+
+#endif // _CRYPTOBACKEND_h
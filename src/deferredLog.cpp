@@ -0,0 +1,289 @@
+/**
+  * @file deferredLog.cpp
+  * @version 0.9.7
+  * @date 04/02/2021
+  * @author German Martin
+  * @brief Deferred debug output. Debug calls store binary records that are formatted later
+  */
+
+#include "deferredLog.h"
+
+#if DEBUG_DEFERRED
+
+#include "EnigmaIOTdebug.h"
+
+#ifdef ESP32
+static portMUX_TYPE deferredLogMux = portMUX_INITIALIZER_UNLOCKED; // Debug calls may run on WiFi task
+#define DEFERRED_LOG_LOCK() portENTER_CRITICAL (&deferredLogMux)
+#define DEFERRED_LOG_UNLOCK() portEXIT_CRITICAL (&deferredLogMux)
+#else
+#define DEFERRED_LOG_LOCK()
+#define DEFERRED_LOG_UNLOCK()
+#endif
+
+const size_t DEFERRED_LOG_MAX_FORMAT = 160; ///< @brief Maximum format string length that is shown
+const size_t DEFERRED_LOG_MAX_LINE = 256; ///< @brief Maximum length of a formatted debug line
+const char DEFERRED_LOG_LEVELS[] = "?EWIDV";
+
+uint8_t* DeferredLogWriter::reserve (deferred_log_arg_t type, size_t len) {
+	if (full || (size_t)(end - pos) < len + 1) {
+		full = true;
+		return NULL;
+	}
+	*pos = type;
+	uint8_t* value = pos + 1;
+	pos += len + 1;
+	return value;
+}
+
+void DeferredLogWriter::putInt32 (int32_t value) {
+	uint8_t* dest = reserve (LOG_ARG_INT32, sizeof (int32_t));
+	if (dest) {
+		memcpy (dest, &value, sizeof (int32_t));
+	}
+}
+
+void DeferredLogWriter::putInt64 (int64_t value) {
+	uint8_t* dest = reserve (LOG_ARG_INT64, sizeof (int64_t));
+	if (dest) {
+		memcpy (dest, &value, sizeof (int64_t));
+	}
+}
+
+void DeferredLogWriter::putDouble (double value) {
+	uint8_t* dest = reserve (LOG_ARG_DOUBLE, sizeof (double));
+	if (dest) {
+		memcpy (dest, &value, sizeof (double));
+	}
+}
+
+void DeferredLogWriter::putString (const char* value) {
+	size_t len = value ? strnlen (value, DEBUG_DEFERRED_MAX_STRING) : 0;
+
+	putBytes (LOG_ARG_STRING, (const uint8_t*)value, len);
+}
+
+void DeferredLogWriter::putBytes (deferred_log_arg_t type, const uint8_t* buffer, size_t len) {
+	if (len > 255) {
+		len = 255;
+	}
+	uint8_t* dest = reserve (type, len + 1);
+	if (dest) {
+		*dest = len;
+		if (len) {
+			memcpy (dest + 1, buffer, len);
+		}
+	}
+}
+
+void DeferredLogWriter::put (debug_mac_t value) {
+	static const uint8_t noAddress[ENIGMAIOT_ADDR_LEN] = { 0 };
+
+	putBytes (LOG_ARG_MAC, value.mac ? value.mac : noAddress, ENIGMAIOT_ADDR_LEN);
+}
+
+void DeferredLogClass::store (const uint8_t* record, uint8_t len) {
+	DEFERRED_LOG_LOCK ();
+	if (used + len + 1 > DEBUG_DEFERRED_BUFFER_SIZE) {
+		lost++;
+		DEFERRED_LOG_UNLOCK ();
+		return;
+	}
+	buffer[head] = len;
+	head = (head + 1) % DEBUG_DEFERRED_BUFFER_SIZE;
+	size_t first = DEBUG_DEFERRED_BUFFER_SIZE - head;
+	if (first > len) {
+		first = len;
+	}
+	memcpy (buffer + head, record, first);
+	memcpy (buffer, record + first, len - first);
+	head = (head + len) % DEBUG_DEFERRED_BUFFER_SIZE;
+	used += len + 1;
+	DEFERRED_LOG_UNLOCK ();
+}
+
+uint8_t DeferredLogClass::fetch (uint8_t* record) {
+	DEFERRED_LOG_LOCK ();
+	if (!used) {
+		DEFERRED_LOG_UNLOCK ();
+		return 0;
+	}
+	uint8_t len = buffer[tail];
+	tail = (tail + 1) % DEBUG_DEFERRED_BUFFER_SIZE;
+	size_t first = DEBUG_DEFERRED_BUFFER_SIZE - tail;
+	if (first > len) {
+		first = len;
+	}
+	memcpy (record, buffer + tail, first);
+	memcpy (record + first, buffer, len - first);
+	tail = (tail + len) % DEBUG_DEFERRED_BUFFER_SIZE;
+	used -= len + 1;
+	DEFERRED_LOG_UNLOCK ();
+	return len;
+}
+
+void DeferredLogClass::print (const uint8_t* record, uint8_t len) {
+	deferred_log_header_t header;
+	char format[DEFERRED_LOG_MAX_FORMAT];
+	char line[DEFERRED_LOG_MAX_LINE];
+	char text[3 * DEBUG_DEFERRED_MAX_HEX + DEBUG_DEFERRED_MAX_STRING + 1];
+	char spec[16];
+	size_t lineLen = 0;
+	const uint8_t* arg = record + sizeof (deferred_log_header_t);
+	const uint8_t* end = record + len;
+
+	memcpy (&header, record, sizeof (deferred_log_header_t));
+	strncpy_P (format, header.format, DEFERRED_LOG_MAX_FORMAT - 1);
+	format[DEFERRED_LOG_MAX_FORMAT - 1] = '\0';
+
+	for (const char* f = format; *f && lineLen < DEFERRED_LOG_MAX_LINE - 1; f++) {
+		if (*f != '%' || f[1] == '%') {
+			line[lineLen++] = *f;
+			if (*f == '%') {
+				f++;
+			}
+			continue;
+		}
+
+		// Take flags, width and precision from format. Length modifiers are ignored, as argument type is stored on record
+		size_t specLen = 0;
+		spec[specLen++] = *f++;
+		while (*f && strchr ("-+ #0123456789.*", *f)) {
+			if (*f == '*') {
+				// Width or precision is taken from next argument
+				int32_t value = 0;
+				if (arg + 1 + sizeof (int32_t) <= end && *arg == LOG_ARG_INT32) {
+					memcpy (&value, arg + 1, sizeof (int32_t));
+					arg += 1 + sizeof (int32_t);
+				}
+				if (specLen < sizeof (spec) - 8) {
+					specLen += snprintf (spec + specLen, sizeof (spec) - specLen, "%d", (int)value);
+				}
+			} else if (specLen < sizeof (spec) - 4) {
+				spec[specLen++] = *f;
+			}
+			f++;
+		}
+		while (*f && strchr ("hlLqjzt", *f)) {
+			f++;
+		}
+		if (!*f) {
+			break;
+		}
+		char conversion = *f;
+		bool isFloat = strchr ("fFeEgGaA", conversion) != NULL;
+		bool isUnsigned = strchr ("ouxX", conversion) != NULL;
+		size_t remaining = DEFERRED_LOG_MAX_LINE - lineLen;
+		int written = 0;
+
+		if (arg >= end) {
+			written = snprintf (line + lineLen, remaining, "?");
+			lineLen += written > 0 ? ((size_t)written < remaining ? written : remaining - 1) : 0;
+			continue;
+		}
+
+		uint8_t type = *arg++;
+		if (type == LOG_ARG_INT32 || type == LOG_ARG_INT64) {
+			int64_t value;
+			if (type == LOG_ARG_INT32) {
+				int32_t value32;
+				memcpy (&value32, arg, sizeof (int32_t));
+				value = isUnsigned ? (int64_t)(uint32_t)value32 : value32;
+				arg += sizeof (int32_t);
+			} else {
+				memcpy (&value, arg, sizeof (int64_t));
+				arg += sizeof (int64_t);
+			}
+			if (isFloat) {
+				spec[specLen++] = conversion;
+				spec[specLen] = '\0';
+				written = snprintf (line + lineLen, remaining, spec, (double)value);
+			} else if (conversion == 'c') {
+				spec[specLen++] = 'c';
+				spec[specLen] = '\0';
+				written = snprintf (line + lineLen, remaining, spec, (int)value);
+			} else {
+				spec[specLen++] = 'l';
+				spec[specLen++] = 'l';
+				spec[specLen++] = isUnsigned ? conversion : 'd';
+				spec[specLen] = '\0';
+				written = snprintf (line + lineLen, remaining, spec, (long long)value);
+			}
+		} else if (type == LOG_ARG_DOUBLE) {
+			double value;
+			memcpy (&value, arg, sizeof (double));
+			arg += sizeof (double);
+			spec[specLen++] = isFloat ? conversion : 'f';
+			spec[specLen] = '\0';
+			written = snprintf (line + lineLen, remaining, spec, value);
+		} else if (type == LOG_ARG_STRING || type == LOG_ARG_MAC || type == LOG_ARG_HEX) {
+			uint8_t dataLen = *arg++;
+			uint8_t shown;
+			if (arg + dataLen > end) {
+				dataLen = end - arg;
+			}
+			text[0] = '\0';
+			if (type == LOG_ARG_STRING) {
+				shown = dataLen < DEBUG_DEFERRED_MAX_STRING ? dataLen : DEBUG_DEFERRED_MAX_STRING;
+				memcpy (text, arg, shown);
+				text[shown] = '\0';
+			} else if (type == LOG_ARG_MAC) {
+				if (dataLen == ENIGMAIOT_ADDR_LEN) {
+					snprintf (text, sizeof (text), "%02X:%02X:%02X:%02X:%02X:%02X", arg[0], arg[1], arg[2], arg[3], arg[4], arg[5]);
+				}
+			} else {
+				shown = dataLen < DEBUG_DEFERRED_MAX_HEX ? dataLen : DEBUG_DEFERRED_MAX_HEX;
+				for (int i = 0; i < shown; i++) {
+					snprintf (text + 3 * i, sizeof (text) - 3 * i, "%02X ", arg[i]);
+				}
+			}
+			arg += dataLen;
+			spec[specLen++] = 's';
+			spec[specLen] = '\0';
+			written = snprintf (line + lineLen, remaining, spec, text);
+		} else {
+			// Unknown argument type. Rest of record cannot be decoded
+			arg = end;
+			written = snprintf (line + lineLen, remaining, "?");
+		}
+		if (written > 0) {
+			lineLen += (size_t)written < remaining ? written : remaining - 1;
+		}
+	}
+	line[lineLen] = '\0';
+
+	DEBUG_ESP_PORT.printf ("%c [%lu][%s:%d] %s() Heap: %lu | %s%s\n",
+						   DEFERRED_LOG_LEVELS[header.level < sizeof (DEFERRED_LOG_LEVELS) - 1 ? header.level : 0],
+						   (unsigned long)header.time, extractFileName (header.file), header.line, header.function,
+						   (unsigned long)header.heap, line, header.truncated ? " ..." : "");
+}
+
+bool DeferredLogClass::process (uint32_t maxTime) {
+	uint8_t record[DEBUG_DEFERRED_MAX_RECORD];
+	uint32_t start = millis ();
+	uint8_t len;
+
+	DEFERRED_LOG_LOCK ();
+	uint32_t lostRecords = lost;
+	lost = 0;
+	DEFERRED_LOG_UNLOCK ();
+	if (lostRecords) {
+		DEBUG_ESP_PORT.printf ("W [%lu] %u debug messages lost\n", (unsigned long)millis (), lostRecords);
+	}
+
+	while ((len = fetch (record))) {
+		print (record, len);
+		if (maxTime && millis () - start >= maxTime) {
+			break;
+		}
+	}
+
+	DEFERRED_LOG_LOCK ();
+	bool empty = !used;
+	DEFERRED_LOG_UNLOCK ();
+	return empty;
+}
+
+DeferredLogClass DeferredLog;
+
+#endif // DEBUG_DEFERRED
@@ -0,0 +1,293 @@
+/**
+  * @file deferredLog.h
+  * @version 0.9.7
+  * @date 04/02/2021
+  * @author German Martin
+  * @brief Deferred debug output. Debug calls store binary records that are formatted later
+  *
+  * When `DEBUG_DEFERRED` is set, `DEBUG_*` macros do not format anything. They copy format string address, call location
+  * and arguments to a RAM ring buffer. Strings, MAC addresses and hex buffers are copied as raw bytes, so that they are still valid
+  * when record is formatted. Records are formatted and printed by `process()`, that gateway and node call when they have
+  * nothing else to do, and before node goes to sleep. If buffer is full new records are discarded and counted.
+  *
+  * Every record has this format:
+  *
+  * | Length (1) | Header (....) | Arguments (....) |
+  *
+  * Every argument starts with its type (`deferred_log_arg_t`), and is followed by its value. Strings and buffers start with their length.
+  */
+
+#ifndef _DEFERREDLOG_h
+#define _DEFERREDLOG_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include "EnigmaIoTconfig.h"
+#include <type_traits>
+
+#if DEBUG_DEFERRED
+
+/**
+  * @brief Argument types on deferred log records
+  */
+enum deferred_log_arg_t {
+	LOG_ARG_INT32 = 0x01, /**< Integer up to 32 bits*/
+	LOG_ARG_INT64 = 0x02, /**< 64 bit integer*/
+	LOG_ARG_DOUBLE = 0x03, /**< Floating point number*/
+	LOG_ARG_STRING = 0x04, /**< String, copied up to `DEBUG_DEFERRED_MAX_STRING` characters*/
+	LOG_ARG_MAC = 0x05, /**< MAC address, shown as `mac2str()` does*/
+	LOG_ARG_HEX = 0x06 /**< Buffer, shown as `printHexBuffer()` does, up to `DEBUG_DEFERRED_MAX_HEX` bytes*/
+};
+
+/**
+  * @brief MAC address argument. It is created by `DEBUG_MAC()` macro
+  */
+struct debug_mac_t {
+	const uint8_t* mac; /**< MAC address*/
+};
+
+/**
+  * @brief Hex buffer argument. It is created by `DEBUG_HEX()` macro
+  */
+struct debug_hex_t {
+	const uint8_t* buffer; /**< Buffer*/
+	uint16_t len; /**< Buffer length*/
+};
+
+/**
+  * @brief Deferred log record header
+  */
+struct __attribute__ ((packed, aligned (1))) deferred_log_header_t {
+	uint32_t time; /**< Value of `millis()` when record was stored*/
+	uint32_t heap; /**< Free heap when record was stored*/
+	const char* format; /**< Format string. It is in flash on ESP8266*/
+	const char* file; /**< Source file*/
+	const char* function; /**< Calling function*/
+	uint16_t line; /**< Source line*/
+	uint8_t level; /**< Debug level*/
+	uint8_t truncated; /**< Set if some arguments did not fit on record*/
+};
+
+/**
+  * @brief Writer of record arguments. It stops writing when record is full
+  */
+class DeferredLogWriter {
+protected:
+	uint8_t* pos; ///< @brief Next byte to write
+	uint8_t* end; ///< @brief End of record buffer
+	bool full = false; ///< @brief Set when an argument did not fit
+
+	/**
+	  * @brief Reserves space for an argument and writes its type
+	  * @param type Argument type
+	  * @param len Argument value length
+	  * @return Position to write value to. `NULL` if it does not fit
+	  */
+	uint8_t* reserve (deferred_log_arg_t type, size_t len);
+
+public:
+	/**
+	  * @brief Starts writing arguments
+	  * @param buffer Buffer to write arguments to
+	  * @param len Buffer length
+	  */
+	DeferredLogWriter (uint8_t* buffer, size_t len) : pos (buffer), end (buffer + len) {}
+
+	/**
+	  * @brief Gets end of last complete argument
+	  * @return Position after last argument
+	  */
+	uint8_t* getPos () {
+		return pos;
+	}
+
+	/**
+	  * @brief Checks if some argument was discarded
+	  * @return `true` if an argument did not fit. Later ones are discarded too
+	  */
+	bool isFull () {
+		return full;
+	}
+
+	/**
+	  * @brief Writes an integer argument
+	  * @param value Argument value
+	  */
+	void putInt32 (int32_t value);
+
+	/**
+	  * @brief Writes a 64 bit integer argument
+	  * @param value Argument value
+	  */
+	void putInt64 (int64_t value);
+
+	/**
+	  * @brief Writes a floating point argument
+	  * @param value Argument value
+	  */
+	void putDouble (double value);
+
+	/**
+	  * @brief Writes a string argument. It is truncated to `DEBUG_DEFERRED_MAX_STRING` characters
+	  * @param value Argument value. `NULL` is written as an empty string
+	  */
+	void putString (const char* value);
+
+	/**
+	  * @brief Writes a buffer argument
+	  * @param type Argument type
+	  * @param buffer Buffer
+	  * @param len Buffer length. It is truncated to 255 bytes
+	  */
+	void putBytes (deferred_log_arg_t type, const uint8_t* buffer, size_t len);
+
+	/**
+	  * @brief Writes an argument, selecting its type from C++ type. Integers and enums up to 32 bits are written as 32 bit integers.
+	  * Pointers are written as integers
+	  * @param value Argument value
+	  */
+	template <typename T>
+	typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type put (T value) {
+		if (sizeof (T) > sizeof (int32_t)) {
+			putInt64 ((int64_t)value);
+		} else {
+			putInt32 ((int32_t)value);
+		}
+	}
+
+	/**
+	  * @brief Writes a floating point argument. `float` values are promoted
+	  * @param value Argument value
+	  */
+	void put (double value) {
+		putDouble (value);
+	}
+
+	/**
+	  * @brief Writes a string argument
+	  * @param value Argument value
+	  */
+	void put (const char* value) {
+		putString (value);
+	}
+
+	/**
+	  * @brief Writes a pointer argument, as an integer
+	  * @param value Argument value
+	  */
+	void put (const void* value) {
+		put ((uintptr_t)value);
+	}
+
+	/**
+	  * @brief Writes a MAC address argument
+	  * @param value Argument value
+	  */
+	void put (debug_mac_t value);
+
+	/**
+	  * @brief Writes a hex buffer argument
+	  * @param value Argument value
+	  */
+	void put (debug_hex_t value) {
+		putBytes (LOG_ARG_HEX, value.buffer, value.buffer ? (value.len < DEBUG_DEFERRED_MAX_HEX ? value.len : DEBUG_DEFERRED_MAX_HEX) : 0);
+	}
+
+	/**
+	  * @brief Writes all arguments of a debug call
+	  */
+	void putAll () {}
+
+	/**
+	  * @brief Writes all arguments of a debug call
+	  * @param value First argument
+	  * @param args Other arguments
+	  */
+	template <typename T, typename... Args>
+	void putAll (T value, Args... args) {
+		put (value);
+		putAll (args...);
+	}
+};
+
+class DeferredLogClass {
+protected:
+	uint8_t buffer[DEBUG_DEFERRED_BUFFER_SIZE]; ///< @brief Ring buffer of records
+	size_t head = 0; ///< @brief Position of next record to write
+	size_t tail = 0; ///< @brief Position of oldest record
+	size_t used = 0; ///< @brief Bytes in use on ring buffer
+	uint32_t lost = 0; ///< @brief Records discarded because buffer was full, since last output
+
+	/**
+	  * @brief Copies a record to ring buffer
+	  * @param record Record, without length
+	  * @param len Record length
+	  */
+	void store (const uint8_t* record, uint8_t len);
+
+	/**
+	  * @brief Takes oldest record from ring buffer
+	  * @param record Buffer to copy record to. It should be `DEBUG_DEFERRED_MAX_RECORD` bytes long
+	  * @return Record length. 0 if there are no records
+	  */
+	uint8_t fetch (uint8_t* record);
+
+	/**
+	  * @brief Formats and prints a record
+	  * @param record Record
+	  * @param len Record length
+	  */
+	void print (const uint8_t* record, uint8_t len);
+
+public:
+	/**
+	  * @brief Stores a debug record. Arguments are copied, not formatted
+	  * @param level Debug level
+	  * @param format Format string, as in `printf()`. It must be a literal, as only its address is stored
+	  * @param file Source file. It must be a literal
+	  * @param function Calling function. It must be a literal
+	  * @param line Source line
+	  * @param args Format arguments
+	  */
+	template <typename... Args>
+	void record (uint8_t level, const char* format, const char* file, const char* function, uint16_t line, Args... args) {
+		uint8_t record[DEBUG_DEFERRED_MAX_RECORD];
+		deferred_log_header_t* header = (deferred_log_header_t*)record;
+		DeferredLogWriter writer (record + sizeof (deferred_log_header_t), sizeof (record) - sizeof (deferred_log_header_t));
+
+		header->time = millis ();
+		header->heap = ESP.getFreeHeap ();
+		header->format = format;
+		header->file = file;
+		header->function = function;
+		header->line = line;
+		header->level = level;
+		writer.putAll (args...);
+		header->truncated = writer.isFull ();
+		store (record, writer.getPos () - record);
+	}
+
+	/**
+	  * @brief Formats and prints stored records
+	  * @param maxTime Maximum time in ms spent printing. 0 prints all records
+	  * @return `true` if there are no records left
+	  */
+	bool process (uint32_t maxTime);
+
+	/**
+	  * @brief Formats and prints all stored records
+	  */
+	void flush () {
+		process (0);
+	}
+};
+
+extern DeferredLogClass DeferredLog;
+
+#endif // DEBUG_DEFERRED
+
+#endif // _DEFERREDLOG_h
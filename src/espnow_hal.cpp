@@ -7,6 +7,7 @@
   */
 
 #include "espnow_hal.h"
+#include "gatewayMetrics.h"
 extern "C" {
 #ifdef ESP8266
 #include <espnow.h>
@@ -19,6 +20,15 @@ extern "C" {
 
 Espnow_halClass Espnow_hal;
 
+#ifdef ESP32
+static portMUX_TYPE pendingSendsMux = portMUX_INITIALIZER_UNLOCKED; // Send status callback runs on WiFi task
+#define PENDING_SENDS_LOCK() portENTER_CRITICAL (&pendingSendsMux)
+#define PENDING_SENDS_UNLOCK() portEXIT_CRITICAL (&pendingSendsMux)
+#else
+#define PENDING_SENDS_LOCK()
+#define PENDING_SENDS_UNLOCK()
+#endif
+
 peerType_t _peerType;
 
 void Espnow_halClass::initComms (peerType_t peerType) {
@@ -59,6 +69,19 @@ void ICACHE_FLASH_ATTR Espnow_halClass::rx_cb (uint8_t* mac_addr, uint8_t* data,
 }
 
 void ICACHE_FLASH_ATTR Espnow_halClass::tx_cb (uint8_t* mac_addr, uint8_t status) {
+	uint32_t tag;
+	uint32_t latency;
+
+	bool pending = Espnow_hal.completePendingSend (mac_addr, &tag, &latency);
+
+	if (Espnow_hal.probing && !memcmp (mac_addr, Espnow_hal.probeAddr, COMMS_HAL_ADDR_LEN)) {
+		Espnow_hal.probeStatus = status;
+		Espnow_hal.probing = false;
+		return; // Probe is not a protocol message
+	}
+	if (pending && Espnow_hal.sendComplete) {
+		Espnow_hal.sendComplete (tag, mac_addr, status, latency);
+	}
 	if (Espnow_hal.sentResult) {
 		Espnow_hal.sentResult (mac_addr, status);
 	}
@@ -90,57 +113,205 @@ bool Espnow_halClass::addPeer (const uint8_t* da) {
 	peer.ifidx = ESP_IF_WIFI_AP;
 	peer.encrypt = false;
 	esp_err_t error = esp_now_add_peer (&peer);
-	//char addrStr[ENIGMAIOT_ADDR_LEN * 3];
-	DEBUG_DBG ("Peer %s added on channel %u. Result 0x%X %s", mac2str (da), ch, error, esp_err_to_name (error));
-	return error == ESP_OK;
+	DEBUG_DBG ("Peer " MACSTR " added on channel %u. Result 0x%X %s", MAC2STR (da), ch, error, esp_err_to_name (error));
+	return error == ESP_OK || error == ESP_ERR_ESPNOW_EXIST;
 #else 
 	return true;
 #endif
 }
 
+#ifdef ESP32
+bool Espnow_halClass::cachePeer (const uint8_t* da) {
+	peer_cache_entry_t* entry = NULL;
+	uint8_t ch;
+	wifi_second_chan_t secondCh;
+
+	// Peers are bound to the channel they were added on
+	esp_wifi_get_channel (&ch, &secondCh);
+	if (ch != peerCacheChannel) {
+		clearPeerCache ();
+		peerCacheChannel = ch;
+	}
+
+	for (int i = 0; i < ESPNOW_PEER_CACHE_SIZE; i++) {
+		if (peerCache[i].lastUsed && !memcmp (peerCache[i].addr, da, COMMS_HAL_ADDR_LEN)) {
+			peerCache[i].lastUsed = ++peerUseCounter;
+			return true;
+		}
+		if (!entry || peerCache[i].lastUsed < entry->lastUsed) {
+			entry = &(peerCache[i]);
+		}
+	}
+
+	if (entry->lastUsed) {
+		esp_err_t error = esp_now_del_peer (entry->addr);
+		DEBUG_DBG ("Peer " MACSTR " evicted. Result %d", MAC2STR (entry->addr), error);
+		entry->lastUsed = 0;
+	}
+
+	if (!addPeer (da)) {
+		return false;
+	}
+	memcpy (entry->addr, da, COMMS_HAL_ADDR_LEN);
+	entry->lastUsed = ++peerUseCounter;
+	return true;
+}
+
+void Espnow_halClass::clearPeerCache () {
+	for (int i = 0; i < ESPNOW_PEER_CACHE_SIZE; i++) {
+		if (peerCache[i].lastUsed) {
+			esp_now_del_peer (peerCache[i].addr);
+			peerCache[i].lastUsed = 0;
+		}
+	}
+}
+#endif // ESP32
+
 void Espnow_halClass::stop () {
 	DEBUG_INFO ("-------------> ESP-NOW STOP");
 	esp_now_unregister_recv_cb ();
 	esp_now_unregister_send_cb ();
+#ifdef ESP32
+	if (_ownPeerType == COMM_GATEWAY) {
+		clearPeerCache ();
+	}
+#endif
 	esp_now_deinit ();
 }
 
-int32_t Espnow_halClass::send (uint8_t* da, uint8_t* data, int len) {
+int32_t Espnow_halClass::sendFrame (uint8_t* da, uint8_t* data, int len, uint32_t* tag) {
 	int32_t error;
-//#ifdef ESP32
-	char buffer[18];
-	mac2str (da, buffer);
-	DEBUG_DBG ("ESP-NOW message to %s", buffer);
+	pending_send_t* entry = NULL;
+
+	DEBUG_DBG ("ESP-NOW message to " MACSTR, MAC2STR (da));
+#ifdef ESP32
 	if (_ownPeerType == COMM_GATEWAY) {
-		addPeer (da);
-		/*esp_now_peer_info_t peer;
-		memcpy (peer.peer_addr, da, COMMS_HAL_ADDR_LEN);
-		uint8_t ch;
-		wifi_second_chan_t secondCh;
-		esp_wifi_get_channel (&ch, &secondCh);
-		peer.channel = ch;
-		peer.ifidx = ESP_IF_WIFI_AP;
-		peer.encrypt = false;
-		esp_err_t error = esp_now_add_peer (&peer);
-		DEBUG_DBG ("Peer added on channel %u. Result %d", ch, error);*/
-
-		//wifi_bandwidth_t bw;
-		//esp_wifi_get_bandwidth (ESP_IF_WIFI_AP, &bw);
-		//ESP_LOGD (TAG, "WiFi bandwidth: %s", bw == WIFI_BW_HT20 ? "20 MHz" : "40 MHz");
-	}
-//#endif
+		if (!cachePeer (da)) {
+			DEBUG_WARN ("Error registering peer " MACSTR, MAC2STR (da));
+		}
+	}
+#endif
+
+	// Register message before sending, as status may be reported before esp_now_send returns.
+	// If too many messages are pending, oldest one is forgotten. Its status will not be reported
+	PENDING_SENDS_LOCK ();
+	if (++lastTag == 0) {
+		lastTag = 1;
+	}
+	for (int i = 0; i < ESPNOW_MAX_PENDING_SENDS; i++) {
+		if (!pendingSends[i].tag) {
+			entry = &(pendingSends[i]);
+			break;
+		}
+		if (!entry || (lastTag - pendingSends[i].tag) > (lastTag - entry->tag)) {
+			entry = &(pendingSends[i]);
+		}
+	}
+	entry->tag = lastTag;
+	memcpy (entry->addr, da, COMMS_HAL_ADDR_LEN);
+	entry->sentTime = micros ();
+	*tag = lastTag;
+	PENDING_SENDS_UNLOCK ();
 
 	// Serial.printf ("Phy Mode ---> %d\n", (int)wifi_get_phy_mode ());
+	METRICS_START (start);
 	error = esp_now_send (da, data, len);
+	METRICS_RECORD (METRIC_COMM_SEND, start);
 #ifdef ESP32
 	DEBUG_DBG ("esp now send result = %d", error);
-	if (_ownPeerType == COMM_GATEWAY) {
-		error = esp_now_del_peer (da); // TODO: test
-		DEBUG_DBG ("Peer deleted. Result %d", error);
+#endif
+	if (error) {
+		METRICS_COUNT (METRIC_SEND_ERRORS);
+		PENDING_SENDS_LOCK ();
+		if (entry->tag == *tag) {
+			entry->tag = 0;
+		}
+		PENDING_SENDS_UNLOCK ();
+		*tag = 0;
+	}
+	return error;
+}
+
+bool Espnow_halClass::completePendingSend (const uint8_t* addr, uint32_t* tag, uint32_t* latency) {
+	pending_send_t* entry = NULL;
+
+	PENDING_SENDS_LOCK ();
+	for (int i = 0; i < ESPNOW_MAX_PENDING_SENDS; i++) {
+		if (pendingSends[i].tag && !memcmp (pendingSends[i].addr, addr, COMMS_HAL_ADDR_LEN)) {
+			if (!entry || (lastTag - pendingSends[i].tag) > (lastTag - entry->tag)) {
+				entry = &(pendingSends[i]);
+			}
+		}
+	}
+	if (entry) {
+		*tag = entry->tag;
+		*latency = micros () - entry->sentTime;
+		entry->tag = 0;
+	}
+	PENDING_SENDS_UNLOCK ();
+
+	return entry != NULL;
+}
+
+int32_t Espnow_halClass::send (uint8_t* da, uint8_t* data, int len) {
+	uint32_t tag;
+
+	return sendFrame (da, data, len, &tag);
+}
+
+uint32_t Espnow_halClass::sendTracked (uint8_t* da, uint8_t* data, int len) {
+	uint32_t tag;
+
+	sendFrame (da, data, len, &tag);
+	return tag;
+}
+
+bool Espnow_halClass::probe (uint8_t* da, uint8_t channel, uint8_t* data, int len, uint32_t timeout) {
+	uint32_t tag;
 
+#ifdef ESP8266
+	wifi_set_channel (channel);
+#elif defined ESP32
+	esp_err_t err_ok;
+	esp_wifi_set_promiscuous (true);
+	err_ok = esp_wifi_set_channel (channel, WIFI_SECOND_CHAN_NONE);
+	esp_wifi_set_promiscuous (false);
+	if (err_ok) {
+		DEBUG_WARN ("Error setting wifi channel %u: %s", channel, esp_err_to_name (err_ok));
+		return false;
+	}
+
+	esp_now_peer_info_t peer;
+	memset (&peer, 0, sizeof (peer));
+	memcpy (peer.peer_addr, da, COMMS_HAL_ADDR_LEN);
+	peer.channel = 0; // Current channel
+	peer.ifidx = ESP_IF_WIFI_STA;
+	peer.encrypt = false;
+	err_ok = esp_now_is_peer_exist (da) ? esp_now_mod_peer (&peer) : esp_now_add_peer (&peer);
+	if (err_ok) {
+		DEBUG_WARN ("Error setting peer " MACSTR ": %s", MAC2STR (da), esp_err_to_name (err_ok));
+		return false;
 	}
 #endif
-	return error;
+
+	memcpy (probeAddr, da, COMMS_HAL_ADDR_LEN);
+	probing = true; // Status may be reported before sendFrame returns
+	if (sendFrame (da, data, len, &tag)) {
+		probing = false;
+		return false;
+	}
+
+	uint32_t probeStarted = millis ();
+	while (probing && millis () - probeStarted < timeout) {
+		delay (1);
+	}
+	if (probing) {
+		probing = false;
+		DEBUG_DBG ("No probe status on channel %u", channel);
+		return false;
+	}
+	DEBUG_DBG ("Probe on channel %u %s in %lu ms", channel, probeStatus == 0 ? "acknowledged" : "failed", millis () - probeStarted);
+	return probeStatus == 0;
 }
 
 void Espnow_halClass::onDataRcvd (comms_hal_rcvd_data dataRcvd) {
@@ -150,3 +321,7 @@ void Espnow_halClass::onDataRcvd (comms_hal_rcvd_data dataRcvd) {
 void Espnow_halClass::onDataSent (comms_hal_sent_data sentResult) {
 	this->sentResult = sentResult;
 }
+
+void Espnow_halClass::onSendComplete (comms_hal_send_complete sendComplete) {
+	this->sendComplete = sendComplete;
+}
@@ -25,6 +25,10 @@
 #include "helperFunctions.h"
 #include "EnigmaIOTdebug.h"
 
+#ifdef ESP32
+static_assert (ESPNOW_PEER_CACHE_SIZE > 0 && ESPNOW_PEER_CACHE_SIZE <= ESP_NOW_MAX_TOTAL_PEER_NUM, "ESPNOW_PEER_CACHE_SIZE exceeds ESP-NOW peer limit");
+#endif // ESP32
+
 /**
   * @brief Definition for ESP-NOW hardware abstraction layer
   */
@@ -53,6 +57,66 @@ protected:
 	  */
     bool addPeer (const uint8_t* da);
 
+#ifdef ESP32
+	/**
+	  * @brief Peer registered on ESP-NOW by gateway
+	  */
+	typedef struct {
+		uint8_t addr[COMMS_HAL_ADDR_LEN]; /**< Peer address */
+		uint32_t lastUsed = 0; /**< Use sequence number of last send to this peer. 0 means entry is free */
+	} peer_cache_entry_t;
+
+	peer_cache_entry_t peerCache[ESPNOW_PEER_CACHE_SIZE]; ///< @brief Peers currently registered on ESP-NOW
+	uint32_t peerUseCounter = 0; ///< @brief Sequence number used to track least recently used peer
+	uint8_t peerCacheChannel = 0; ///< @brief WiFi channel that cached peers were registered on
+
+	/**
+	  * @brief Makes sure that a peer is registered before sending to it. If peer list is full least recently used peer is deleted
+	  * @param da Peer address
+	  * @return `true` if peer is registered
+	  */
+	bool cachePeer (const uint8_t* da);
+
+	/**
+	  * @brief Deletes all cached peers from ESP-NOW peer list
+	  */
+	void clearPeerCache ();
+#endif // ESP32
+
+	/**
+	  * @brief Sent message waiting for its sending status
+	  */
+	typedef struct {
+		uint32_t tag = 0; /**< Message tag. 0 means entry is free */
+		uint8_t addr[COMMS_HAL_ADDR_LEN]; /**< Destination address */
+		uint32_t sentTime; /**< Value of `micros()` when message was sent */
+	} pending_send_t;
+
+	pending_send_t pendingSends[ESPNOW_MAX_PENDING_SENDS]; ///< @brief Sent messages waiting for status. ESP-NOW reports them in the same order they were sent
+	uint32_t lastTag = 0; ///< @brief Last tag assigned to a message
+	volatile bool probing = false; ///< @brief `true` while waiting for probe message status
+	volatile uint8_t probeStatus; ///< @brief Sending status of last probe message
+	uint8_t probeAddr[COMMS_HAL_ADDR_LEN]; ///< @brief Address of peer being probed
+
+	/**
+	  * @brief Sends a message, registering it to wait for its sending status
+	  * @param da Destination address to send the message to
+	  * @param data Data buffer that contain the message to be sent
+	  * @param len Data length in number of bytes
+	  * @param tag Tag assigned to message. It is 0 if message could not be sent
+	  * @return Returns sending status. 0 for success, 1 to indicate an error.
+	  */
+	int32_t sendFrame (uint8_t* da, uint8_t* data, int len, uint32_t* tag);
+
+	/**
+	  * @brief Gets and frees oldest pending message sent to an address
+	  * @param addr Destination address reported by ESP-NOW
+	  * @param tag Tag of matched message
+	  * @param latency Time since message was sent, in microseconds
+	  * @return `true` if a pending message was found
+	  */
+	bool completePendingSend (const uint8_t* addr, uint32_t* tag, uint32_t* latency);
+
 	/**
 	  * @brief Function that processes incoming messages and passes them to upper layer
 	  * @param mac_addr Destination address to send the message to
@@ -90,6 +154,28 @@ public:
 	  * @return Returns sending status. 0 for success, 1 to indicate an error.
 	  */
     int32_t send (uint8_t* da, uint8_t* data, int len) override;
+
+	/**
+	  * @brief Sends data to the other peer and tags message, so that its sending status can be correlated on send complete callback
+	  * @param da Destination address to send the message to
+	  * @param data Data buffer that contain the message to be sent
+	  * @param len Data length in number of bytes
+	  * @return Returns message tag. 0 if message could not be sent
+	  */
+	uint32_t sendTracked (uint8_t* da, uint8_t* data, int len) override;
+
+	/**
+	  * @brief Checks if a peer is listening on a channel. A short message is sent to it on that channel and ESP-NOW acknowledge is awaited.
+	  * Channel is kept after probe. On ESP32 peer is bound to current channel, so that it follows later channel changes
+	  * @param da Address of peer to probe
+	  * @param channel WiFi channel to probe peer on
+	  * @param data Probe message
+	  * @param len Probe message length in number of bytes
+	  * @param timeout Maximum time to wait for acknowledge in milliseconds
+	  * @return Returns `true` if peer acknowledged probe message
+	  */
+	bool probe (uint8_t* da, uint8_t channel, uint8_t* data, int len, uint32_t timeout) override;
+
 	/**
 	  * @brief Attach a callback function to be run on every received message
 	  * @param dataRcvd Pointer to the callback function
@@ -102,6 +188,13 @@ public:
 	  */
     void onDataSent (comms_hal_sent_data dataRcvd) override;
 
+	/**
+	  * @brief Attach a callback function to be run when sending of a tagged message finishes.
+	  * On ESP32 it runs on WiFi task, so it should return quickly
+	  * @param sendComplete Pointer to the callback function
+	  */
+	void onSendComplete (comms_hal_send_complete sendComplete) override;
+
 	/**
 	  * @brief Get address length used on ESP-NOW subsystem
 	  * @return Always returns the sice of 802.11 MAC address, equals to 6
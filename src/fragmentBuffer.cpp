@@ -0,0 +1,104 @@
+/**
+  * @file fragmentBuffer.cpp
+  * @version 0.9.7
+  * @date 04/02/2021
+  * @author German Martin
+  * @brief Fragmentation and reassembly of user data longer than a single message
+  */
+
+#include "fragmentBuffer.h"
+#include "EnigmaIOTdebug.h"
+
+fragment_result_t FragmentBuffer::add (const uint8_t* data, size_t len) {
+	const uint8_t ID_IDX = 0;
+	const uint8_t INDEX_IDX = 1;
+	const uint8_t COUNT_IDX = 2;
+	const uint8_t ENCODING_IDX = 3;
+
+	if (!data || len <= FRAGMENT_HEADER_LENGTH) {
+		return FRAGMENT_ERROR;
+	}
+
+	uint8_t id = data[ID_IDX];
+	uint8_t index = data[INDEX_IDX];
+	uint8_t count = data[COUNT_IDX];
+	size_t fragmentLen = len - FRAGMENT_HEADER_LENGTH;
+
+	if (count < 2 || count > getFragmentCount (MAX_FRAGMENTED_PAYLOAD_SIZE) || index >= count) {
+		DEBUG_WARN ("Wrong fragment %u of %u", index, count);
+		return FRAGMENT_ERROR;
+	}
+	if ((index < count - 1 && fragmentLen != FRAGMENT_PAYLOAD_SIZE) || fragmentLen > FRAGMENT_PAYLOAD_SIZE) {
+		DEBUG_WARN ("Wrong fragment length: %u", fragmentLen);
+		return FRAGMENT_ERROR;
+	}
+
+	if (buffer && (id != transferId || count != fragmentCount)) {
+		DEBUG_INFO ("New transfer %u. Incomplete transfer %u discarded", id, transferId);
+		clear ();
+	}
+	if (!buffer) {
+		buffer = (uint8_t*)malloc (count * FRAGMENT_PAYLOAD_SIZE);
+		if (!buffer) {
+			DEBUG_ERROR ("Cannot allocate reassembly buffer");
+			return FRAGMENT_ERROR;
+		}
+		transferId = id;
+		fragmentCount = count;
+		received = 0;
+		length = 0;
+	}
+
+	memcpy (buffer + index * FRAGMENT_PAYLOAD_SIZE, data + FRAGMENT_HEADER_LENGTH, fragmentLen);
+	received |= 1UL << index;
+	lastFragmentTime = millis ();
+	if (index == count - 1) {
+		length = index * FRAGMENT_PAYLOAD_SIZE + fragmentLen;
+		encoding = data[ENCODING_IDX];
+	}
+	DEBUG_DBG ("Fragment %u of %u received. Transfer %u", index + 1, count, id);
+
+	if (received == (count < 32 ? (1UL << count) - 1 : 0xFFFFFFFFUL)) {
+		return FRAGMENT_COMPLETE;
+	}
+	return FRAGMENT_PENDING;
+}
+
+bool FragmentBuffer::expire () {
+	if (buffer && millis () - lastFragmentTime > FRAGMENT_TIMEOUT) {
+		DEBUG_WARN ("Transfer %u timeout", transferId);
+		clear ();
+		return true;
+	}
+	return false;
+}
+
+void FragmentBuffer::clear () {
+	if (buffer) {
+		free (buffer);
+		buffer = NULL;
+	}
+	length = 0;
+	received = 0;
+	fragmentCount = 0;
+}
+
+uint8_t FragmentBuffer::getFragmentCount (size_t len) {
+	if (len > MAX_FRAGMENTED_PAYLOAD_SIZE) {
+		return 0;
+	}
+	return (len + FRAGMENT_PAYLOAD_SIZE - 1) / FRAGMENT_PAYLOAD_SIZE;
+}
+
+size_t FragmentBuffer::buildFragment (uint8_t* output, const uint8_t* data, size_t len, uint8_t transferId, uint8_t index, uint8_t encoding) {
+	size_t offset = index * FRAGMENT_PAYLOAD_SIZE;
+	size_t fragmentLen = len - offset < FRAGMENT_PAYLOAD_SIZE ? len - offset : FRAGMENT_PAYLOAD_SIZE;
+
+	output[0] = transferId;
+	output[1] = index;
+	output[2] = getFragmentCount (len);
+	output[3] = encoding;
+	memcpy (output + FRAGMENT_HEADER_LENGTH, data + offset, fragmentLen);
+
+	return FRAGMENT_HEADER_LENGTH + fragmentLen;
+}
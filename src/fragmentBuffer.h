@@ -0,0 +1,136 @@
+/**
+  * @file fragmentBuffer.h
+  * @version 0.9.7
+  * @date 04/02/2021
+  * @author German Martin
+  * @brief Fragmentation and reassembly of user data longer than a single message
+  *
+  * Long payloads are split in fragments that are sent as independent data messages, each one with its own counter and authentication tag.
+  * Every fragment starts with this header, and is marked with `FRAGMENT` payload encoding:
+  *
+  * | Transfer Id (1) | Fragment index (1) | Fragment count (1) | Encoding (1) | Data (....) |
+  *
+  * All fragments but the last one carry `FRAGMENT_PAYLOAD_SIZE` bytes of data.
+  */
+
+#ifndef _FRAGMENTBUFFER_h
+#define _FRAGMENTBUFFER_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include "EnigmaIoTconfig.h"
+
+/**
+  * @brief Result of adding a fragment to reassembly buffer
+  */
+enum fragment_result_t {
+	FRAGMENT_ERROR, /**< Fragment is not valid or memory could not be allocated*/
+	FRAGMENT_PENDING, /**< Fragment was stored. More fragments are needed*/
+	FRAGMENT_COMPLETE /**< All fragments have been received. Payload is ready*/
+};
+
+/**
+  * @brief Reassembly buffer for a fragmented payload. Memory is only allocated while a transfer is in progress
+  */
+class FragmentBuffer {
+protected:
+	uint8_t* buffer = NULL; ///< @brief Reassembled payload. `NULL` if there is no transfer in progress
+	size_t length = 0; ///< @brief Payload length. It is known when last fragment is received
+	uint8_t transferId = 0; ///< @brief Identifier of transfer in progress
+	uint8_t fragmentCount = 0; ///< @brief Number of fragments of transfer in progress
+	uint32_t received = 0; ///< @brief Bitmap of fragments already received
+	uint8_t encoding = 0; ///< @brief Encoding of reassembled payload
+	uint32_t lastFragmentTime = 0; ///< @brief Value of `millis()` on last fragment reception
+
+public:
+	/**
+	  * @brief Frees reassembly buffer
+	  */
+	~FragmentBuffer () {
+		clear ();
+	}
+
+	/**
+	  * @brief Adds a received fragment. A fragment of a different transfer discards previous one
+	  * @param data Fragment, starting with fragment header
+	  * @param len Fragment length
+	  * @return Reassembly result
+	  */
+	fragment_result_t add (const uint8_t* data, size_t len);
+
+	/**
+	  * @brief Gets reassembled payload. Only valid after `add()` returns `FRAGMENT_COMPLETE`, until `clear()` is called
+	  * @return Payload buffer
+	  */
+	uint8_t* getData () {
+		return buffer;
+	}
+
+	/**
+	  * @brief Gets reassembled payload length
+	  * @return Payload length
+	  */
+	size_t getLength () {
+		return length;
+	}
+
+	/**
+	  * @brief Gets reassembled payload encoding
+	  * @return Payload encoding as it was signaled on fragment header
+	  */
+	uint8_t getEncoding () {
+		return encoding;
+	}
+
+	/**
+	  * @brief Checks if there is a transfer in progress
+	  * @return `true` if some fragments have been received and payload is not complete yet
+	  */
+	bool inProgress () {
+		return buffer != NULL;
+	}
+
+	/**
+	  * @brief Gets time of last fragment reception
+	  * @return Value of `millis()` when last fragment was received
+	  */
+	uint32_t getLastFragmentTime () {
+		return lastFragmentTime;
+	}
+
+	/**
+	  * @brief Discards transfer in progress if no fragment has been received for `FRAGMENT_TIMEOUT` ms
+	  * @return `true` if a transfer was discarded
+	  */
+	bool expire ();
+
+	/**
+	  * @brief Discards transfer in progress and frees its memory
+	  */
+	void clear ();
+
+	/**
+	  * @brief Calculates number of fragments needed to send a payload
+	  * @param len Payload length
+	  * @return Number of fragments. 0 if payload is longer than `MAX_FRAGMENTED_PAYLOAD_SIZE`
+	  */
+	static uint8_t getFragmentCount (size_t len);
+
+	/**
+	  * @brief Builds a fragment of a payload, header included
+	  * @param output Buffer to write fragment to. It should be `MAX_DATA_PAYLOAD_SIZE` bytes long
+	  * @param data Complete payload
+	  * @param len Complete payload length
+	  * @param transferId Identifier of this transfer. All fragments of a payload have to use the same one
+	  * @param index Fragment index, starting from 0
+	  * @param encoding Payload encoding
+	  * @return Fragment length
+	  */
+	static size_t buildFragment (uint8_t* output, const uint8_t* data, size_t len, uint8_t transferId, uint8_t index, uint8_t encoding);
+};
+
+#endif // _FRAGMENTBUFFER_h
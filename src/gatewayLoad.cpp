@@ -0,0 +1,144 @@
+/**
+  * @file gatewayLoad.cpp
+  * @version 0.9.7
+  * @date 04/02/2021
+  * @author German Martin
+  * @brief Gateway load advertisement, used to select a gateway when several of them serve the same network
+  */
+
+#include "gatewayLoad.h"
+
+#if ENABLE_MULTI_GATEWAY
+
+#include "EnigmaIOTdebug.h"
+
+#ifdef ESP32
+static portMUX_TYPE gatewayLoadMux = portMUX_INITIALIZER_UNLOCKED; // Vendor elements are received on WiFi task
+#define GATEWAY_LOAD_LOCK() portENTER_CRITICAL (&gatewayLoadMux)
+#define GATEWAY_LOAD_UNLOCK() portEXIT_CRITICAL (&gatewayLoadMux)
+#else
+#define GATEWAY_LOAD_LOCK()
+#define GATEWAY_LOAD_UNLOCK()
+#endif
+
+#ifdef ESP32
+// OUI (3) + OUI type (1) + rest of load information
+static uint8_t vendorIE[sizeof (vendor_ie_data_t) + sizeof (gateway_load_ie_t) - 1];
+#else
+static uint8_t vendorIE[sizeof (gateway_load_ie_t)]; // SDK keeps a reference to this buffer
+#endif
+
+bool GatewayLoadClass::advertise (uint8_t load, uint16_t freeSlots) {
+	if (advertising && advertised.load == load && advertised.freeSlots == freeSlots) {
+		return true;
+	}
+	advertised.signature = GATEWAY_LOAD_IE_SIGNATURE;
+	advertised.load = load;
+	advertised.freeSlots = freeSlots;
+	DEBUG_DBG ("Advertise gateway load %u%%. %u free slots", load, freeSlots);
+
+#ifdef ESP8266
+	memcpy (vendorIE, &advertised, sizeof (gateway_load_ie_t));
+	advertising = wifi_set_user_ie (true, (uint8_t*)GATEWAY_LOAD_OUI, USER_IE_BEACON, vendorIE, sizeof (gateway_load_ie_t))
+		&& wifi_set_user_ie (true, (uint8_t*)GATEWAY_LOAD_OUI, USER_IE_PROBE_RESP, vendorIE, sizeof (gateway_load_ie_t));
+#elif defined ESP32
+	vendor_ie_data_t* ie = (vendor_ie_data_t*)vendorIE;
+	ie->element_id = WIFI_VENDOR_IE_ELEMENT_ID;
+	ie->length = sizeof (GATEWAY_LOAD_OUI) + sizeof (gateway_load_ie_t);
+	memcpy (ie->vendor_oui, GATEWAY_LOAD_OUI, sizeof (GATEWAY_LOAD_OUI));
+	memcpy (&(ie->vendor_oui_type), &advertised, sizeof (gateway_load_ie_t)); // Signature is used as OUI type
+	// An element cannot be replaced while it is set
+	if (advertising) {
+		esp_wifi_set_vendor_ie (false, WIFI_VND_IE_TYPE_BEACON, WIFI_VND_IE_ID_0, vendorIE);
+		esp_wifi_set_vendor_ie (false, WIFI_VND_IE_TYPE_PROBE_RESP, WIFI_VND_IE_ID_0, vendorIE);
+	}
+	advertising = esp_wifi_set_vendor_ie (true, WIFI_VND_IE_TYPE_BEACON, WIFI_VND_IE_ID_0, vendorIE) == ESP_OK
+		&& esp_wifi_set_vendor_ie (true, WIFI_VND_IE_TYPE_PROBE_RESP, WIFI_VND_IE_ID_0, vendorIE) == ESP_OK;
+#endif
+	if (!advertising) {
+		DEBUG_WARN ("Error setting gateway load on beacon");
+	}
+	return advertising;
+}
+
+void GatewayLoadClass::store (const uint8_t* bssid, const uint8_t* ie, uint8_t len) {
+	gateway_load_ie_t info;
+
+	if (len < sizeof (gateway_load_ie_t) || ie[0] != GATEWAY_LOAD_IE_SIGNATURE) {
+		return;
+	}
+	memcpy (&info, ie, sizeof (gateway_load_ie_t));
+
+	GATEWAY_LOAD_LOCK ();
+	int index;
+	for (index = 0; index < scannedNum; index++) {
+		if (!memcmp (scanned[index].bssid, bssid, ENIGMAIOT_ADDR_LEN)) {
+			break;
+		}
+	}
+	if (index < MAX_SCANNED_GATEWAYS) {
+		memcpy (scanned[index].bssid, bssid, ENIGMAIOT_ADDR_LEN);
+		scanned[index].load = info.load;
+		scanned[index].freeSlots = info.freeSlots;
+		if (index == scannedNum) {
+			scannedNum++;
+		}
+	}
+	GATEWAY_LOAD_UNLOCK ();
+}
+
+#ifdef ESP8266
+void GatewayLoadClass::onVendorIE (user_ie_type type, const uint8_t sa[6], const uint8_t m_oui[3], uint8_t* ie, uint8_t ie_len, int rssi) {
+	if (!memcmp (m_oui, GATEWAY_LOAD_OUI, sizeof (GATEWAY_LOAD_OUI))) {
+		GatewayLoad.store (sa, ie, ie_len);
+	}
+}
+#elif defined ESP32
+void GatewayLoadClass::onVendorIE (void* ctx, wifi_vendor_ie_type_t type, const uint8_t sa[6], const vendor_ie_data_t* vnd_ie, int rssi) {
+	if (vnd_ie && vnd_ie->length >= sizeof (GATEWAY_LOAD_OUI) + sizeof (gateway_load_ie_t)
+		&& !memcmp (vnd_ie->vendor_oui, GATEWAY_LOAD_OUI, sizeof (GATEWAY_LOAD_OUI))) {
+		GatewayLoad.store (sa, &(vnd_ie->vendor_oui_type), vnd_ie->length - sizeof (GATEWAY_LOAD_OUI));
+	}
+}
+#endif
+
+void GatewayLoadClass::beginScan () {
+	GATEWAY_LOAD_LOCK ();
+	scannedNum = 0;
+	GATEWAY_LOAD_UNLOCK ();
+#ifdef ESP8266
+	wifi_register_user_ie_manufacturer_recv_cb (onVendorIE);
+#elif defined ESP32
+	esp_wifi_set_vendor_ie_cb (onVendorIE, NULL);
+#endif
+}
+
+void GatewayLoadClass::endScan () {
+#ifdef ESP8266
+	wifi_unregister_user_ie_manufacturer_recv_cb ();
+#elif defined ESP32
+	esp_wifi_set_vendor_ie_cb (NULL, NULL);
+#endif
+	DEBUG_DBG ("%u gateways advertised their load", scannedNum);
+}
+
+uint8_t GatewayLoadClass::getLoad (const uint8_t* bssid, uint16_t* freeSlots) {
+	uint8_t load = GATEWAY_LOAD_UNKNOWN;
+
+	GATEWAY_LOAD_LOCK ();
+	for (int i = 0; i < scannedNum; i++) {
+		if (!memcmp (scanned[i].bssid, bssid, ENIGMAIOT_ADDR_LEN)) {
+			load = scanned[i].load;
+			if (freeSlots) {
+				*freeSlots = scanned[i].freeSlots;
+			}
+			break;
+		}
+	}
+	GATEWAY_LOAD_UNLOCK ();
+	return load;
+}
+
+GatewayLoadClass GatewayLoad;
+
+#endif // ENABLE_MULTI_GATEWAY
@@ -0,0 +1,110 @@
+/**
+  * @file gatewayLoad.h
+  * @version 0.9.7
+  * @date 04/02/2021
+  * @author German Martin
+  * @brief Gateway load advertisement, used to select a gateway when several of them serve the same network
+  *
+  * Every gateway adds a vendor specific element to its beacons and probe responses with its current load.
+  * Nodes read these elements while they scan for gateways, and choose the least loaded one among those with good signal.
+  * Element has this format, after OUI:
+  *
+  * | Signature (1) | Load (1) | Free node slots (2) |
+  */
+
+#ifndef _GATEWAYLOAD_h
+#define _GATEWAYLOAD_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#ifdef ESP8266
+#include <ESP8266WiFi.h>
+#elif defined ESP32
+#include <WiFi.h>
+#include <esp_wifi.h>
+#endif
+#include "EnigmaIoTconfig.h"
+
+#if ENABLE_MULTI_GATEWAY
+
+static const uint8_t GATEWAY_LOAD_OUI[3] = { 0x18, 0xFE, 0x34 }; ///< @brief OUI used on vendor specific element
+static const uint8_t GATEWAY_LOAD_IE_SIGNATURE = 0xE1; ///< @brief First byte of vendor specific element, to distinguish it from other uses of the same OUI
+static const uint8_t MAX_SCANNED_GATEWAYS = 10; ///< @brief Maximum number of gateways whose load is kept during a scan
+static const uint8_t GATEWAY_LOAD_UNKNOWN = 0xFF; ///< @brief Load value of gateways that do not advertise it
+
+/**
+  * @brief Load information advertised by a gateway
+  */
+struct __attribute__ ((packed, aligned (1))) gateway_load_ie_t {
+	uint8_t signature; /**< Always `GATEWAY_LOAD_IE_SIGNATURE`*/
+	uint8_t load; /**< Gateway load, from 0 (idle) to 100 (it cannot accept more nodes)*/
+	uint16_t freeSlots; /**< Number of nodes that gateway can still register*/
+};
+
+/**
+  * @brief Load advertised by a gateway found during a scan
+  */
+struct gateway_load_entry_t {
+	uint8_t bssid[ENIGMAIOT_ADDR_LEN]; /**< Gateway address*/
+	uint8_t load; /**< Gateway load*/
+	uint16_t freeSlots; /**< Number of nodes that gateway can still register*/
+};
+
+class GatewayLoadClass {
+protected:
+	gateway_load_ie_t advertised; ///< @brief Load currently advertised by gateway
+	bool advertising = false; ///< @brief `true` if vendor element is set on gateway beacon
+	gateway_load_entry_t scanned[MAX_SCANNED_GATEWAYS]; ///< @brief Load of gateways found during last scan
+	uint8_t scannedNum = 0; ///< @brief Number of valid entries on `scanned`
+
+	/**
+	  * @brief Stores load of a gateway from a received vendor element
+	  * @param bssid Gateway address
+	  * @param ie Vendor element data after OUI
+	  * @param len Data length
+	  */
+	void store (const uint8_t* bssid, const uint8_t* ie, uint8_t len);
+
+#ifdef ESP8266
+	static void onVendorIE (user_ie_type type, const uint8_t sa[6], const uint8_t m_oui[3], uint8_t* ie, uint8_t ie_len, int rssi);
+#elif defined ESP32
+	static void onVendorIE (void* ctx, wifi_vendor_ie_type_t type, const uint8_t sa[6], const vendor_ie_data_t* vnd_ie, int rssi);
+#endif
+
+public:
+	/**
+	  * @brief Sets load advertised on gateway beacons. Radio is only accessed if values have changed
+	  * @param load Gateway load, from 0 to 100
+	  * @param freeSlots Number of nodes that gateway can still register
+	  * @return `true` if vendor element was set
+	  */
+	bool advertise (uint8_t load, uint16_t freeSlots);
+
+	/**
+	  * @brief Starts collecting load of gateways. It has to be called before a WiFi scan is started
+	  */
+	void beginScan ();
+
+	/**
+	  * @brief Stops collecting load of gateways. Collected values are kept until next scan
+	  */
+	void endScan ();
+
+	/**
+	  * @brief Gets load advertised by a gateway during last scan
+	  * @param bssid Gateway address
+	  * @param freeSlots Number of nodes that gateway can still register. It is not modified if load is unknown
+	  * @return Gateway load. `GATEWAY_LOAD_UNKNOWN` if gateway did not advertise it
+	  */
+	uint8_t getLoad (const uint8_t* bssid, uint16_t* freeSlots = NULL);
+};
+
+extern GatewayLoadClass GatewayLoad;
+
+#endif // ENABLE_MULTI_GATEWAY
+
+#endif // _GATEWAYLOAD_h
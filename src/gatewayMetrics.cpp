@@ -0,0 +1,190 @@
+/**
+  * @file gatewayMetrics.cpp
+  * @version 0.9.7
+  * @date 04/02/2021
+  * @author German Martin
+  * @brief Counters and latency histograms of gateway hot paths
+  */
+
+#include "gatewayMetrics.h"
+
+#if ENABLE_GATEWAY_METRICS
+
+#include "EnigmaIOTdebug.h"
+
+const char* const METRICS_HISTOGRAM_NAMES[METRIC_HISTOGRAMS_NUM] = { "handle", "decrypt", "encrypt", "send", "node_lookup", "queue_wait", "output_wait" };
+const char* const METRICS_COUNTER_NAMES[METRIC_COUNTERS_NUM] = { "send_errors", "decrypt_errors", "input_drops", "output_stalls", "output_drops", "late_messages", "replays" };
+const char* const METRICS_GAUGE_NAMES[METRIC_GAUGES_NUM] = { "input_queue", "mqtt_queue", "output_queue" };
+
+/**
+  * @brief Writes to a fixed buffer, keeping it null terminated. Output that does not fit is discarded
+  */
+class MetricsBufferPrint : public Print {
+protected:
+	char* buffer; ///< @brief Output buffer
+	size_t len; ///< @brief Buffer length
+	size_t pos = 0; ///< @brief Number of bytes written
+	bool overflow = false; ///< @brief Set if some output did not fit
+
+public:
+	MetricsBufferPrint (char* buffer, size_t len) : buffer (buffer), len (len) {
+		buffer[0] = '\0';
+	}
+
+	size_t write (uint8_t c) override {
+		if (pos + 1 >= len) {
+			overflow = true;
+			return 0;
+		}
+		buffer[pos++] = c;
+		buffer[pos] = '\0';
+		return 1;
+	}
+
+	size_t length () {
+		return overflow ? 0 : pos;
+	}
+};
+
+bool GatewayMetricsClass::begin () {
+	if (histograms) {
+		return true;
+	}
+	histograms = (metrics_histogram_t*)calloc (METRIC_HISTOGRAMS_NUM, sizeof (metrics_histogram_t));
+	messages = (metrics_histogram_t*)calloc (METRICS_MESSAGE_TYPES + 1, sizeof (metrics_histogram_t));
+	messageTypes = (uint8_t*)calloc (METRICS_MESSAGE_TYPES, sizeof (uint8_t));
+	if (!histograms || !messages || !messageTypes) {
+		DEBUG_ERROR ("Error allocating metrics");
+		free (histograms);
+		free (messages);
+		free (messageTypes);
+		histograms = NULL;
+		messages = NULL;
+		messageTypes = NULL;
+		return false;
+	}
+	reset ();
+	return true;
+}
+
+void GatewayMetricsClass::reset () {
+	if (!histograms) {
+		return;
+	}
+	memset (histograms, 0, METRIC_HISTOGRAMS_NUM * sizeof (metrics_histogram_t));
+	memset (messages, 0, (METRICS_MESSAGE_TYPES + 1) * sizeof (metrics_histogram_t));
+	messageTypesNum = 0;
+	memset (counters, 0, sizeof (counters));
+	memset (gauges, 0, sizeof (gauges));
+	lastReset = millis ();
+}
+
+void GatewayMetricsClass::add (metrics_histogram_t* histogram, uint32_t value) {
+	uint32_t bucket = 0;
+	uint32_t scaled = value >> METRICS_BUCKET_BASE_BITS;
+
+	if (scaled) {
+		bucket = 32 - __builtin_clz (scaled);
+		if (bucket >= METRICS_HISTOGRAM_BUCKETS) {
+			bucket = METRICS_HISTOGRAM_BUCKETS - 1;
+		}
+	}
+	histogram->buckets[bucket]++;
+	histogram->count++;
+	histogram->sum += value;
+	if (value > histogram->max) {
+		histogram->max = value;
+	}
+}
+
+void GatewayMetricsClass::recordMessage (uint8_t msgType, uint32_t value) {
+	if (!histograms) {
+		return;
+	}
+
+	// Only a few message types exist, so linear search is fast enough
+	int index;
+	for (index = 0; index < messageTypesNum; index++) {
+		if (messageTypes[index] == msgType) {
+			break;
+		}
+	}
+	if (index == messageTypesNum && messageTypesNum < METRICS_MESSAGE_TYPES) {
+		messageTypes[messageTypesNum++] = msgType;
+	}
+	add (&(messages[index]), value);
+}
+
+uint32_t GatewayMetricsClass::percentile (metrics_histogram_t* histogram, uint8_t percent) {
+	uint64_t threshold = ((uint64_t)histogram->count * percent + 99) / 100;
+	uint32_t accumulated = 0;
+
+	for (int i = 0; i < METRICS_HISTOGRAM_BUCKETS - 1; i++) {
+		accumulated += histogram->buckets[i];
+		if (accumulated >= threshold) {
+			uint32_t limit = METRICS_BUCKET_BASE << i;
+			return limit < histogram->max ? limit : histogram->max;
+		}
+	}
+	return histogram->max;
+}
+
+void GatewayMetricsClass::printHistogram (Print* out, metrics_histogram_t* histogram, bool withBuckets) {
+	uint32_t average = histogram->count ? histogram->sum / histogram->count : 0;
+
+	out->printf ("{\"n\":%u,\"avg\":%u,\"p50\":%u,\"p90\":%u,\"p99\":%u,\"max\":%u",
+				 histogram->count, average,
+				 percentile (histogram, 50), percentile (histogram, 90), percentile (histogram, 99),
+				 histogram->max);
+	if (withBuckets) {
+		out->print (",\"buckets\":[");
+		for (int i = 0; i < METRICS_HISTOGRAM_BUCKETS; i++) {
+			out->printf (i ? ",%u" : "%u", histogram->buckets[i]);
+		}
+		out->print ("]");
+	}
+	out->print ("}");
+}
+
+void GatewayMetricsClass::printJson (Print* out, bool withBuckets) {
+	if (!histograms) {
+		out->print ("{}");
+		return;
+	}
+
+	out->printf ("{\"period\":%u,\"bucket_base\":%u", millis () - lastReset, METRICS_BUCKET_BASE);
+	out->print (",\"counters\":{");
+	for (int i = 0; i < METRIC_COUNTERS_NUM; i++) {
+		out->printf ("%s\"%s\":%u", i ? "," : "", METRICS_COUNTER_NAMES[i], counters[i]);
+	}
+	out->print ("},\"gauges\":{");
+	for (int i = 0; i < METRIC_GAUGES_NUM; i++) {
+		out->printf ("%s\"%s\":{\"value\":%u,\"max\":%u}", i ? "," : "", METRICS_GAUGE_NAMES[i], gauges[i].value, gauges[i].max);
+	}
+	out->print ("},\"latency\":{");
+	for (int i = 0; i < METRIC_HISTOGRAMS_NUM; i++) {
+		out->printf ("%s\"%s\":", i ? "," : "", METRICS_HISTOGRAM_NAMES[i]);
+		printHistogram (out, &(histograms[i]), withBuckets);
+	}
+	out->print ("},\"messages\":{");
+	for (int i = 0; i < messageTypesNum; i++) {
+		out->printf ("%s\"0x%02X\":", i ? "," : "", messageTypes[i]);
+		printHistogram (out, &(messages[i]), withBuckets);
+	}
+	if (messages[METRICS_MESSAGE_TYPES].count) {
+		out->printf ("%s\"other\":", messageTypesNum ? "," : "");
+		printHistogram (out, &(messages[METRICS_MESSAGE_TYPES]), withBuckets);
+	}
+	out->print ("}}");
+}
+
+size_t GatewayMetricsClass::toJson (char* buffer, size_t len) {
+	MetricsBufferPrint out (buffer, len);
+
+	printJson (&out, false);
+	return out.length ();
+}
+
+GatewayMetricsClass GatewayMetrics;
+
+#endif // ENABLE_GATEWAY_METRICS
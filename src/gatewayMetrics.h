@@ -0,0 +1,207 @@
+/**
+  * @file gatewayMetrics.h
+  * @version 0.9.7
+  * @date 04/02/2021
+  * @author German Martin
+  * @brief Counters and latency histograms of gateway hot paths
+  *
+  * Memory is allocated once when gateway starts and never grows. Recording a value takes a few instructions, so metrics
+  * may be always on. Before `begin()` is called every record is ignored, so that modules shared with node do not use any memory.
+  * Histograms have logarithmic buckets: bucket 0 counts values lower than `METRICS_BUCKET_BASE` us and every next bucket doubles its limit.
+  * Last bucket counts every value over the previous one.
+  */
+
+#ifndef _GATEWAYMETRICS_h
+#define _GATEWAYMETRICS_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include "EnigmaIoTconfig.h"
+
+#if ENABLE_GATEWAY_METRICS
+
+static const uint32_t METRICS_BUCKET_BASE = 16; ///< @brief Upper limit of first histogram bucket in us
+static const uint8_t METRICS_BUCKET_BASE_BITS = 4; ///< @brief log2 of `METRICS_BUCKET_BASE`
+
+/**
+  * @brief Latency histograms with fixed meaning
+  */
+enum gateway_metric_histogram_t {
+	METRIC_HANDLE_LOOP, /**< Duration of `EnigmaIOTGatewayClass::handle()`*/
+	METRIC_DECRYPT, /**< Duration of `CryptModule::decryptBuffer()`*/
+	METRIC_ENCRYPT, /**< Duration of `CryptModule::encryptBuffer()`*/
+	METRIC_COMM_SEND, /**< Duration of a frame send call on communication layer*/
+	METRIC_NODE_LOOKUP, /**< Time to find node that sent a message on node list*/
+	METRIC_QUEUE_WAIT, /**< Time that a message waits on input queue until it is processed*/
+	METRIC_OUTPUT_WAIT, /**< Time that a notification waits on output queue until output task gets it. Only with `ENABLE_GATEWAY_PIPELINE`*/
+	METRIC_HISTOGRAMS_NUM /**< Number of fixed histograms*/
+};
+
+/**
+  * @brief Event counters
+  */
+enum gateway_metric_counter_t {
+	METRIC_SEND_ERRORS, /**< Frames that communication layer could not send*/
+	METRIC_DECRYPT_ERRORS, /**< Messages that could not be decrypted or authenticated*/
+	METRIC_INPUT_DROPS, /**< Input messages lost because input queue was full*/
+	METRIC_OUTPUT_STALLS, /**< Times that gateway task stopped processing input messages because output queue was full*/
+	METRIC_OUTPUT_DROPS, /**< Notifications lost because output queue was full*/
+	METRIC_LATE_MESSAGES, /**< Uplink messages accepted out of order, inside anti-replay window*/
+	METRIC_REPLAYS, /**< Uplink messages discarded because their counter was already received or it was out of window*/
+	METRIC_COUNTERS_NUM /**< Number of counters*/
+};
+
+/**
+  * @brief Gauges. Maximum value is kept too
+  */
+enum gateway_metric_gauge_t {
+	METRIC_INPUT_QUEUE, /**< Messages on input queue*/
+	METRIC_MQTT_QUEUE, /**< Messages on MQTT output queue*/
+	METRIC_OUTPUT_QUEUE, /**< Notifications on output queue, waiting for output task*/
+	METRIC_GAUGES_NUM /**< Number of gauges*/
+};
+
+/**
+  * @brief Latency histogram
+  */
+struct metrics_histogram_t {
+	uint32_t count; /**< Number of recorded values*/
+	uint64_t sum; /**< Sum of recorded values in us*/
+	uint32_t max; /**< Maximum recorded value in us*/
+	uint32_t buckets[METRICS_HISTOGRAM_BUCKETS]; /**< Number of values on every bucket*/
+};
+
+/**
+  * @brief Gauge value
+  */
+struct metrics_gauge_t {
+	uint32_t value; /**< Last value*/
+	uint32_t max; /**< Maximum value*/
+};
+
+class GatewayMetricsClass {
+protected:
+	metrics_histogram_t* histograms = NULL; ///< @brief Fixed histograms. `NULL` until `begin()` is called
+	metrics_histogram_t* messages = NULL; ///< @brief Message processing histograms. Last one is used for message types that do not fit
+	uint8_t* messageTypes = NULL; ///< @brief Message type of every message histogram
+	uint8_t messageTypesNum = 0; ///< @brief Number of message histograms in use
+	uint32_t counters[METRIC_COUNTERS_NUM]; ///< @brief Event counters
+	metrics_gauge_t gauges[METRIC_GAUGES_NUM]; ///< @brief Gauges
+	uint32_t lastReset = 0; ///< @brief Value of `millis()` when metrics were reset
+
+	/**
+	  * @brief Adds a value to a histogram
+	  * @param histogram Histogram
+	  * @param value Value in us
+	  */
+	void add (metrics_histogram_t* histogram, uint32_t value);
+
+	/**
+	  * @brief Estimates a percentile from histogram buckets
+	  * @param histogram Histogram
+	  * @param percent Percentile, 1 to 100
+	  * @return Upper limit of bucket that contains percentile, in us. It is never higher than maximum value
+	  */
+	uint32_t percentile (metrics_histogram_t* histogram, uint8_t percent);
+
+	/**
+	  * @brief Writes a histogram as a JSON object
+	  * @param out Output stream
+	  * @param histogram Histogram
+	  * @param withBuckets If `true` bucket counts are included
+	  */
+	void printHistogram (Print* out, metrics_histogram_t* histogram, bool withBuckets);
+
+public:
+	/**
+	  * @brief Allocates metrics memory. It is called on gateway start
+	  * @return `true` if memory could be allocated
+	  */
+	bool begin ();
+
+	/**
+	  * @brief Sets all metrics to zero
+	  */
+	void reset ();
+
+	/**
+	  * @brief Adds a value to a histogram
+	  * @param metric Histogram
+	  * @param value Value in us
+	  */
+	void record (gateway_metric_histogram_t metric, uint32_t value) {
+		if (histograms) {
+			add (&(histograms[metric]), value);
+		}
+	}
+
+	/**
+	  * @brief Adds message processing time to histogram of its message type
+	  * @param msgType Message type
+	  * @param value Processing time in us
+	  */
+	void recordMessage (uint8_t msgType, uint32_t value);
+
+	/**
+	  * @brief Increments a counter
+	  * @param counter Counter
+	  */
+	void count (gateway_metric_counter_t counter) {
+		if (histograms) {
+			counters[counter]++;
+		}
+	}
+
+	/**
+	  * @brief Sets a gauge value
+	  * @param gauge Gauge
+	  * @param value Current value
+	  */
+	void set (gateway_metric_gauge_t gauge, uint32_t value) {
+		if (histograms) {
+			gauges[gauge].value = value;
+			if (value > gauges[gauge].max) {
+				gauges[gauge].max = value;
+			}
+		}
+	}
+
+	/**
+	  * @brief Writes all metrics as a JSON object
+	  * @param out Output stream
+	  * @param withBuckets If `true` bucket counts of every histogram are included. Otherwise only summary values are written
+	  */
+	void printJson (Print* out, bool withBuckets);
+
+	/**
+	  * @brief Writes metrics summary as a JSON object, without bucket counts
+	  * @param buffer Buffer to write to
+	  * @param len Buffer length
+	  * @return JSON length. 0 if it does not fit on buffer
+	  */
+	size_t toJson (char* buffer, size_t len);
+};
+
+extern GatewayMetricsClass GatewayMetrics;
+
+#define METRICS_START(start) uint32_t start = micros ()
+#define METRICS_RECORD(metric,start) GatewayMetrics.record (metric, micros () - (start))
+#define METRICS_RECORD_MESSAGE(msgType,start) GatewayMetrics.recordMessage (msgType, micros () - (start))
+#define METRICS_COUNT(counter) GatewayMetrics.count (counter)
+#define METRICS_SET(gauge,value) GatewayMetrics.set (gauge, value)
+
+#else // ENABLE_GATEWAY_METRICS
+
+#define METRICS_START(start)
+#define METRICS_RECORD(metric,start)
+#define METRICS_RECORD_MESSAGE(msgType,start)
+#define METRICS_COUNT(counter)
+#define METRICS_SET(gauge,value)
+
+#endif // ENABLE_GATEWAY_METRICS
+
+#endif // _GATEWAYMETRICS_h
@@ -61,20 +61,18 @@ void initWiFi (uint8_t channel, const char* networkName, const char* networkKey,
 
 }
 
+// CRC32 of every 4 bit value, polynomial 0x04C11DB7. Processing a nibble at a time is much faster than bit by bit and table takes only 64 bytes
+static const uint32_t CRC32_NIBBLE_TABLE[16] = {
+	0x00000000, 0x04C11DB7, 0x09823B6E, 0x0D4326D9, 0x130476DC, 0x17C56B6B, 0x1A864DB2, 0x1E475005,
+	0x2608EDB8, 0x22C9F00F, 0x2F8AD6D6, 0x2B4BCB61, 0x350C9B64, 0x31CD86D3, 0x3C8EA00A, 0x384FBDBD
+};
+
 uint32_t calculateCRC32 (const uint8_t* data, size_t length) {
 	uint32_t crc = 0xffffffff;
 	while (length--) {
 		uint8_t c = *data++;
-		for (uint32_t i = 0x80; i > 0; i >>= 1) {
-			bool bit = crc & 0x80000000;
-			if (c & i) {
-				bit = !bit;
-			}
-			crc <<= 1;
-			if (bit) {
-				crc ^= 0x04c11db7;
-			}
-		}
+		crc = (crc << 4) ^ CRC32_NIBBLE_TABLE[(crc >> 28) ^ (c >> 4)];
+		crc = (crc << 4) ^ CRC32_NIBBLE_TABLE[(crc >> 28) ^ (c & 0x0F)];
 	}
 	return crc;
 }
@@ -150,7 +148,7 @@ uint8_t* str2mac (const char* macAddrString, uint8_t* macBytes) {
 	return macBytes;
 }
 
-#ifdef ESP8266
+#if defined ESP8266 || DEBUG_DEFERRED
 const char* IRAM_ATTR extractFileName (const char* path) {
 	size_t i = 0;
 	size_t pos = 0;
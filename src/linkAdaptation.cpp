@@ -0,0 +1,75 @@
+/**
+  * @file linkAdaptation.cpp
+  * @version 0.9.7
+  * @date 04/02/2021
+  * @author German Martin
+  * @brief Node TX power adaptation from link quality measured by gateway
+  */
+
+#include "linkAdaptation.h"
+#include "EnigmaIOTdebug.h"
+
+#ifdef ESP8266
+#include <ESP8266WiFi.h>
+static const float MAX_TX_POWER = 20.5; ///< @brief ESP8266 maximum TX power in dBm
+#elif defined ESP32
+#include <WiFi.h>
+#include <esp_wifi.h>
+static const float MAX_TX_POWER = 20; ///< @brief ESP32 maximum TX power in dBm
+#endif
+
+bool LinkAdaptation::addMessage (uint32_t lostMessages, int8_t rssi) {
+	uint8_t previous = reduction;
+	bool windowEnd = true;
+	// Estimated node signal on gateway has to stay over minimum
+	int allowed = rssi ? rssi - LINK_ADAPTATION_MIN_RSSI : LINK_ADAPTATION_MAX_REDUCTION;
+
+	if (allowed > LINK_ADAPTATION_MAX_REDUCTION) {
+		allowed = LINK_ADAPTATION_MAX_REDUCTION;
+	} else if (allowed < 0) {
+		allowed = 0;
+	}
+
+	lost = lostMessages > (uint32_t)(UINT8_MAX - lost) ? UINT8_MAX : lost + lostMessages;
+	messages++;
+
+	if (lost >= LINK_ADAPTATION_LOST_RAISE) {
+		reduction = reduction > 2 * LINK_ADAPTATION_STEP ? reduction - 2 * LINK_ADAPTATION_STEP : 0;
+		messages = 0;
+		lost = 0;
+	} else if (messages >= LINK_ADAPTATION_WINDOW) {
+		if (lost == 0 && reduction + LINK_ADAPTATION_STEP <= allowed) {
+			reduction += LINK_ADAPTATION_STEP;
+		} else if (reduction > allowed) {
+			reduction = allowed - allowed % LINK_ADAPTATION_STEP;
+		}
+		messages = 0;
+		lost = 0;
+	} else {
+		windowEnd = false;
+	}
+
+	// Node goes back to full power on its own when a message is not acknowledged. Sending current value again on
+	// every window end brings it back to recommended power
+	if (reduction != previous || !announced || (windowEnd && reduction)) {
+		DEBUG_DBG ("TX power reduction %u dB", reduction);
+		announced = true;
+		return true;
+	}
+	return false;
+}
+
+void setTxPowerReduction (uint8_t reduction) {
+	if (reduction > LINK_ADAPTATION_MAX_REDUCTION) {
+		reduction = LINK_ADAPTATION_MAX_REDUCTION;
+	}
+#ifdef ESP8266
+	WiFi.setOutputPower (MAX_TX_POWER - reduction);
+#elif defined ESP32
+	esp_err_t err_ok;
+	if ((err_ok = esp_wifi_set_max_tx_power ((int8_t)((MAX_TX_POWER - reduction) * 4)))) { // Unit is 0.25 dBm
+		DEBUG_ERROR ("Error setting TX power: %s", esp_err_to_name (err_ok));
+	}
+#endif
+	DEBUG_INFO ("TX power set to %.1f dBm", MAX_TX_POWER - reduction);
+}
@@ -0,0 +1,79 @@
+/**
+  * @file linkAdaptation.h
+  * @version 0.9.7
+  * @date 04/02/2021
+  * @author German Martin
+  * @brief Node TX power adaptation from link quality measured by gateway
+  *
+  * Gateway counts lost data messages of every node on windows of `LINK_ADAPTATION_WINDOW` messages. If a window has no losses
+  * it recommends node to lower its TX power by `LINK_ADAPTATION_STEP` dB, as long as node signal that gateway estimates from
+  * the RSSI that node reports stays over `LINK_ADAPTATION_MIN_RSSI`. As soon as `LINK_ADAPTATION_LOST_RAISE` messages are lost
+  * inside a window, power is raised two steps. Recommendation is a reduction in dB from maximum power, so that 0 means full power.
+  *
+  * Nodes get it on an encrypted `TX_POWER_SET` control message when it changes. It is queued for sleepy nodes until they wake up.
+  * Node goes back to full power when a message is not acknowledged, without telling gateway, so any recommendation other than
+  * full power is sent again at the end of every window.
+  */
+
+#ifndef _LINKADAPTATION_h
+#define _LINKADAPTATION_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include "EnigmaIoTconfig.h"
+
+class LinkAdaptation {
+protected:
+	uint8_t reduction = 0; ///< @brief Recommended TX power reduction in dB
+	uint8_t messages = 0; ///< @brief Number of messages on current window
+	uint8_t lost = 0; ///< @brief Number of lost messages on current window
+	bool announced = false; ///< @brief `true` if recommendation has been sent to node since last reset
+
+public:
+	/**
+	  * @brief Starts again from full power. Used when node registers
+	  */
+	void reset () {
+		reduction = 0;
+		messages = 0;
+		lost = 0;
+		announced = false;
+	}
+
+	/**
+	  * @brief Gets recommended TX power reduction
+	  * @return Reduction in dB from maximum power
+	  */
+	uint8_t getReduction () {
+		return reduction;
+	}
+
+	/**
+	  * @brief Adds a received message to current window and updates recommendation
+	  * @param lostMessages Number of messages lost before this one
+	  * @param rssi Gateway signal strength reported by node, in dBm. 0 if it is not known
+	  * @return `true` if recommendation has to be sent to node: it has changed, it has not been sent yet or a window has ended with reduced power
+	  */
+	bool addMessage (uint32_t lostMessages, int8_t rssi);
+
+	/**
+	  * @brief Takes back a lost message that has been received out of order
+	  */
+	void recoverMessage () {
+		if (lost) {
+			lost--;
+		}
+	}
+};
+
+/**
+  * @brief Sets node WiFi TX power
+  * @param reduction Reduction in dB from maximum power. Up to `LINK_ADAPTATION_MAX_REDUCTION`
+  */
+void setTxPowerReduction (uint8_t reduction);
+
+#endif // _LINKADAPTATION_h
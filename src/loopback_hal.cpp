@@ -0,0 +1,160 @@
+/**
+  * @file loopback_hal.cpp
+  * @version 0.9.7
+  * @date 04/02/2021
+  * @author German Martin
+  * @brief In-process communication layer without radio. Used to test and benchmark gateway or node with emulated peers
+  */
+
+#include "loopback_hal.h"
+#include "EnigmaIOTdebug.h"
+
+Loopback_halClass Loopback_hal;
+
+#ifdef ESP32
+static portMUX_TYPE loopbackMux = portMUX_INITIALIZER_UNLOCKED; // Peers may be emulated on a different task
+#define LOOPBACK_LOCK() portENTER_CRITICAL (&loopbackMux)
+#define LOOPBACK_UNLOCK() portEXIT_CRITICAL (&loopbackMux)
+#else
+#define LOOPBACK_LOCK()
+#define LOOPBACK_UNLOCK()
+#endif
+
+void Loopback_halClass::begin (uint8_t* gateway, uint8_t channel, peerType_t peerType) {
+	_ownPeerType = peerType;
+	DEBUG_INFO ("Starting loopback communication as %s", peerType == COMM_GATEWAY ? "gateway" : "node");
+	if (peerType == COMM_NODE && gateway) {
+		memcpy (gatewayAddress, gateway, COMMS_HAL_ADDR_LEN);
+	}
+	this->channel = channel;
+	initComms (peerType);
+	LOOPBACK_LOCK ();
+	rxQueue.count = 0;
+	txQueue.count = 0;
+	started = true;
+	LOOPBACK_UNLOCK ();
+}
+
+void Loopback_halClass::stop () {
+	DEBUG_INFO ("-------------> LOOPBACK STOP");
+	LOOPBACK_LOCK ();
+	started = false;
+	rxQueue.count = 0;
+	txQueue.count = 0;
+	LOOPBACK_UNLOCK ();
+}
+
+bool Loopback_halClass::enqueue (loopback_queue_t* queue, const uint8_t* addr, const uint8_t* data, uint8_t len, uint32_t tag) {
+	LOOPBACK_LOCK ();
+	if (!started || queue->count >= LOOPBACK_QUEUE_SIZE) {
+		lostFrames++;
+		LOOPBACK_UNLOCK ();
+		return false;
+	}
+	loopback_frame_t* frame = &(queue->frames[(queue->head + queue->count) % LOOPBACK_QUEUE_SIZE]);
+	memcpy (frame->addr, addr, COMMS_HAL_ADDR_LEN);
+	memcpy (frame->data, data, len);
+	frame->len = len;
+	frame->tag = tag;
+	frame->sentTime = micros ();
+	queue->count++;
+	LOOPBACK_UNLOCK ();
+	return true;
+}
+
+bool Loopback_halClass::dequeue (loopback_queue_t* queue, loopback_frame_t* frame) {
+	LOOPBACK_LOCK ();
+	if (!queue->count) {
+		LOOPBACK_UNLOCK ();
+		return false;
+	}
+	memcpy (frame, &(queue->frames[queue->head]), sizeof (loopback_frame_t));
+	queue->head = (queue->head + 1) % LOOPBACK_QUEUE_SIZE;
+	queue->count--;
+	LOOPBACK_UNLOCK ();
+	return true;
+}
+
+bool Loopback_halClass::isLost () {
+	return lossRate && (uint8_t)random (100) < lossRate;
+}
+
+int32_t Loopback_halClass::send (uint8_t* da, uint8_t* data, int len) {
+	return sendTracked (da, data, len) ? 0 : 1;
+}
+
+uint32_t Loopback_halClass::sendTracked (uint8_t* da, uint8_t* data, int len) {
+	if (!da || !data || len <= 0 || len > COMMS_HAL_MAX_MESSAGE_LENGTH) {
+		return 0;
+	}
+	if (++lastTag == 0) {
+		lastTag = 1;
+	}
+	DEBUG_DBG ("Loopback message to %s", DEBUG_MAC (da));
+	if (!enqueue (&txQueue, da, data, len, lastTag)) {
+		DEBUG_WARN ("Loopback output queue full");
+		return 0;
+	}
+	return lastTag;
+}
+
+bool Loopback_halClass::inject (const uint8_t* addr, const uint8_t* data, uint8_t len) {
+	if (!addr || !data || !len || len > COMMS_HAL_MAX_MESSAGE_LENGTH) {
+		return false;
+	}
+	return enqueue (&rxQueue, addr, data, len, 0);
+}
+
+int Loopback_halClass::process () {
+	loopback_frame_t frame;
+	int delivered = 0;
+
+	// Only frames that were queued before this call are delivered, so that answers sent from callbacks wait for next call
+	LOOPBACK_LOCK ();
+	int pendingRx = rxQueue.count;
+	int pendingTx = txQueue.count;
+	LOOPBACK_UNLOCK ();
+
+	while (pendingRx-- > 0 && dequeue (&rxQueue, &frame)) {
+		if (isLost ()) {
+			lostFrames++;
+			continue;
+		}
+		if (dataRcvd) {
+			dataRcvd (frame.addr, frame.data, frame.len);
+		}
+		delivered++;
+	}
+
+	while (pendingTx-- > 0 && dequeue (&txQueue, &frame)) {
+		uint8_t status = 1;
+		if (!isLost ()) {
+			if (peerData && peerData (frame.addr, frame.data, frame.len)) {
+				status = 0;
+			}
+			delivered++;
+		} else {
+			lostFrames++;
+		}
+		if (sendComplete) {
+			sendComplete (frame.tag, frame.addr, status, micros () - frame.sentTime);
+		}
+		if (sentResult) {
+			sentResult (frame.addr, status);
+		}
+	}
+
+	return delivered;
+}
+
+void Loopback_halClass::onDataRcvd (comms_hal_rcvd_data dataRcvd) {
+	this->dataRcvd = dataRcvd;
+}
+
+void Loopback_halClass::onDataSent (comms_hal_sent_data sentResult) {
+	this->sentResult = sentResult;
+}
+
+void Loopback_halClass::onSendComplete (comms_hal_send_complete sendComplete) {
+	this->sendComplete = sendComplete;
+}
@@ -0,0 +1,225 @@
+/**
+  * @file loopback_hal.h
+  * @version 0.9.7
+  * @date 04/02/2021
+  * @author German Martin
+  * @brief In-process communication layer without radio. Used to test and benchmark gateway or node with emulated peers
+  *
+  * Messages sent by EnigmaIOT are passed to a peer callback instead of being transmitted, and messages from emulated peers
+  * are injected as if they had been received. Both directions are queued and delivered when `process()` is called,
+  * so that callbacks do not run inside `send()`, like on a real radio.
+  */
+
+#ifndef _LOOPBACK_HAL_h
+#define _LOOPBACK_HAL_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include "Comms_hal.h"
+#include "EnigmaIoTconfig.h"
+
+/**
+  * @brief Function that gets messages sent to emulated peers
+  * @param address Destination address
+  * @param data Message buffer
+  * @param len Message length
+  * @return `true` if peer acknowledges message. Sending status is reported as error otherwise
+  */
+typedef bool (*loopback_hal_peer_data)(uint8_t* address, uint8_t* data, uint8_t len);
+
+/**
+  * @brief Definition for loopback communication layer
+  */
+class Loopback_halClass : public Comms_halClass {
+public:
+	static const size_t COMMS_HAL_MAX_MESSAGE_LENGTH = MAX_MESSAGE_LENGTH; ///< @brief Maximum message length. Same as ESP-NOW
+	static const uint8_t COMMS_HAL_ADDR_LEN = ENIGMAIOT_ADDR_LEN; ///< @brief Address length. Same as ESP-NOW
+
+protected:
+	/**
+	  * @brief Message waiting to be delivered
+	  */
+	typedef struct {
+		uint8_t addr[COMMS_HAL_ADDR_LEN]; /**< Source address for received messages, destination address for sent ones */
+		uint8_t data[COMMS_HAL_MAX_MESSAGE_LENGTH]; /**< Message buffer */
+		uint8_t len; /**< Message length */
+		uint32_t tag; /**< Message tag. 0 if message is not tracked */
+		uint32_t sentTime; /**< Value of `micros()` when message was queued */
+	} loopback_frame_t;
+
+	/**
+	  * @brief Fixed size FIFO of frames
+	  */
+	typedef struct {
+		loopback_frame_t frames[LOOPBACK_QUEUE_SIZE]; /**< Frame storage */
+		uint8_t head = 0; /**< Index of oldest frame */
+		uint8_t count = 0; /**< Number of queued frames */
+	} loopback_queue_t;
+
+	loopback_queue_t rxQueue; ///< @brief Messages from emulated peers waiting to be received
+	loopback_queue_t txQueue; ///< @brief Messages sent to emulated peers waiting to be delivered
+	loopback_hal_peer_data peerData = NULL; ///< @brief Function that gets messages sent to emulated peers
+	uint8_t gatewayAddress[COMMS_HAL_ADDR_LEN]; ///< @brief Gateway address when used on a node
+	uint8_t lossRate = 0; ///< @brief Percentage of messages that are randomly lost on every direction
+	uint32_t lastTag = 0; ///< @brief Last tag assigned to a message
+	uint32_t lostFrames = 0; ///< @brief Number of messages dropped by emulated losses or because a queue was full
+	bool started = false; ///< @brief `true` between `begin()` and `stop()`
+
+	/**
+	  * @brief Communication subsistem initialization. Nothing has to be done without radio
+	  * @param peerType Role that peer plays into the system, sensor node or gateway.
+	  */
+	void initComms (peerType_t peerType) override {}
+
+	/**
+	  * @brief Adds a frame to a queue
+	  * @param queue Queue
+	  * @param addr Frame address
+	  * @param data Message buffer
+	  * @param len Message length
+	  * @param tag Message tag
+	  * @return `true` if there was room for frame
+	  */
+	bool enqueue (loopback_queue_t* queue, const uint8_t* addr, const uint8_t* data, uint8_t len, uint32_t tag);
+
+	/**
+	  * @brief Gets and removes oldest frame from a queue
+	  * @param queue Queue
+	  * @param frame Buffer to copy frame to
+	  * @return `true` if queue was not empty
+	  */
+	bool dequeue (loopback_queue_t* queue, loopback_frame_t* frame);
+
+	/**
+	  * @brief Decides if a frame is lost, according to configured loss rate
+	  * @return `true` if frame has to be dropped
+	  */
+	bool isLost ();
+
+public:
+	/**
+	 * @brief Setup communication environment
+	 * @param gateway Address of gateway. It may be `NULL` in case this is used in the own gateway
+	 * @param channel Not used
+	 * @param peerType Role that peer plays into the system, sensor node or gateway.
+	 */
+	void begin (uint8_t* gateway, uint8_t channel = 0, peerType_t peerType = COMM_NODE) override;
+
+	/**
+	 * @brief Terminates communication. Queued messages are discarded
+	 */
+	void stop () override;
+
+	/**
+	  * @brief Queues a message to an emulated peer
+	  * @param da Destination address to send the message to
+	  * @param data Data buffer that contain the message to be sent
+	  * @param len Data length in number of bytes
+	  * @return Returns sending status. 0 for success, 1 to indicate an error.
+	  */
+	int32_t send (uint8_t* da, uint8_t* data, int len) override;
+
+	/**
+	  * @brief Queues a message to an emulated peer and tags it, so that its sending status can be correlated on send complete callback
+	  * @param da Destination address to send the message to
+	  * @param data Data buffer that contain the message to be sent
+	  * @param len Data length in number of bytes
+	  * @return Returns message tag. 0 if message could not be sent
+	  */
+	uint32_t sendTracked (uint8_t* da, uint8_t* data, int len) override;
+
+	/**
+	  * @brief Probing is not supported as there are no channels on loopback
+	  * @param da Address of peer to probe
+	  * @param channel Channel to probe peer on
+	  * @param data Probe message
+	  * @param len Probe message length in number of bytes
+	  * @param timeout Maximum time to wait for acknowledge in milliseconds
+	  * @return Always `false`
+	  */
+	bool probe (uint8_t* da, uint8_t channel, uint8_t* data, int len, uint32_t timeout) override {
+		return false;
+	}
+
+	/**
+	  * @brief Attach a callback function to be run on every received message
+	  * @param dataRcvd Pointer to the callback function
+	  */
+	void onDataRcvd (comms_hal_rcvd_data dataRcvd) override;
+
+	/**
+	  * @brief Attach a callback function to be run after sending a message to receive its status
+	  * @param dataRcvd Pointer to the callback function
+	  */
+	void onDataSent (comms_hal_sent_data dataRcvd) override;
+
+	/**
+	  * @brief Attach a callback function to be run when sending of a tagged message finishes
+	  * @param sendComplete Pointer to the callback function
+	  */
+	void onSendComplete (comms_hal_send_complete sendComplete) override;
+
+	/**
+	  * @brief Attach a callback function that gets every message sent to emulated peers
+	  * @param peerData Pointer to the callback function
+	  */
+	void onPeerData (loopback_hal_peer_data peerData) {
+		this->peerData = peerData;
+	}
+
+	/**
+	  * @brief Queues a message from an emulated peer. It is received on next `process()` call
+	  * @param addr Address of emulated peer
+	  * @param data Message buffer
+	  * @param len Message length
+	  * @return `true` if message could be queued
+	  */
+	bool inject (const uint8_t* addr, const uint8_t* data, uint8_t len);
+
+	/**
+	  * @brief Delivers queued messages in both directions and reports sending status. It should be called often, usually from `loop()`
+	  * @return Number of delivered messages
+	  */
+	int process ();
+
+	/**
+	  * @brief Sets percentage of messages randomly lost on every direction, to emulate a noisy radio
+	  * @param percent Loss rate, from 0 to 100
+	  */
+	void setLossRate (uint8_t percent) {
+		lossRate = percent > 100 ? 100 : percent;
+	}
+
+	/**
+	  * @brief Gets number of messages dropped by emulated losses or because a queue was full
+	  * @return Number of lost messages
+	  */
+	uint32_t getLostFrames () {
+		return lostFrames;
+	}
+
+	/**
+	  * @brief Get address length
+	  * @return Always returns 6, like ESP-NOW
+	  */
+	uint8_t getAddressLength () override {
+		return COMMS_HAL_ADDR_LEN;
+	}
+
+	/**
+	  * @brief Get maximum message length
+	  * @return Always returns a value equal to 250, like ESP-NOW
+	  */
+	size_t getMaxMessageLength () {
+		return COMMS_HAL_MAX_MESSAGE_LENGTH;
+	}
+
+};
+
+extern Loopback_halClass Loopback_hal; ///< @brief Singleton instance of loopback class
+
+#endif // _LOOPBACK_HAL_h
@@ -0,0 +1,332 @@
+/**
+  * @file nodeSnapshot.cpp
+  * @version 0.9.7
+  * @date 04/02/2021
+  * @author German Martin
+  * @brief Encrypted log of node sessions, used to restore them after a gateway restart
+  */
+
+#include "nodeSnapshot.h"
+#include "cryptModule.h"
+#include "helperFunctions.h"
+#include "EnigmaIOTdebug.h"
+
+const char SNAPSHOT_FILE[] = "/nodes.bin";
+const char SNAPSHOT_TMP_FILE[] = "/nodes.tmp";
+const char SNAPSHOT_KEY_LABEL[] = "snapshot";
+const uint16_t SNAPSHOT_GATEWAY_ID = 0xFFFF;
+const uint8_t SNAPSHOT_HEADER_LENGTH = 1 + sizeof (uint16_t) + IV_LENGTH;
+
+void NodeSnapshot::begin (const uint8_t* networkKey) {
+	const uint8_t labelLen = sizeof (SNAPSHOT_KEY_LABEL) - 1;
+	uint8_t buffer[KEY_LENGTH + labelLen];
+
+	memcpy (buffer, networkKey, KEY_LENGTH);
+	memcpy (buffer + KEY_LENGTH, SNAPSHOT_KEY_LABEL, labelLen);
+	CryptModule::getSHA256 (buffer, sizeof (buffer));
+	memcpy (key, buffer, KEY_LENGTH);
+	memset (buffer, 0, sizeof (buffer));
+}
+
+bool NodeSnapshot::writeRecord (File& file, snapshot_record_type_t type, uint16_t nodeId, uint8_t* data, size_t len) {
+	uint8_t header[SNAPSHOT_HEADER_LENGTH];
+	uint8_t aad[SNAPSHOT_HEADER_LENGTH + AAD_LENGTH];
+	uint8_t tag[TAG_LENGTH];
+
+	header[0] = type;
+	memcpy (header + 1, &nodeId, sizeof (uint16_t));
+	CryptModule::random (header + 1 + sizeof (uint16_t), IV_LENGTH);
+
+	memcpy (aad, header, SNAPSHOT_HEADER_LENGTH);
+	memcpy (aad + SNAPSHOT_HEADER_LENGTH, key + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH);
+
+	if (!CryptModule::encryptBuffer (data, len, header + 1 + sizeof (uint16_t), IV_LENGTH,
+									 key, KEY_LENGTH - AAD_LENGTH, aad, sizeof (aad), tag, TAG_LENGTH)) {
+		DEBUG_ERROR ("Error encrypting snapshot record");
+		return false;
+	}
+
+	size_t written = file.write (header, SNAPSHOT_HEADER_LENGTH);
+	written += file.write (data, len);
+	written += file.write (tag, TAG_LENGTH);
+
+	return written == SNAPSHOT_HEADER_LENGTH + len + TAG_LENGTH;
+}
+
+bool NodeSnapshot::writeNode (File& file, Node* node) {
+	node_snapshot_t data;
+	bool result;
+
+	memcpy (data.mac, node->getMacAddress (), ENIGMAIOT_ADDR_LEN);
+	memcpy (data.key, node->getEncriptionKey (), KEY_LENGTH);
+	data.cipher = node->getCipherAlgorithm ();
+	data.lastMessageCounter = node->getMessageWindow ()->getHighest ();
+	data.lastControlCounter = node->getControlWindow ()->getHighest ();
+	data.lastDownlinkMsgCounter = node->getLastDownlinkMsgCounter ();
+	data.keyAge = millis () - node->getKeyValidFrom ();
+	data.flags = 0;
+	if (node->getSleepy ()) {
+		data.flags |= SNAPSHOT_SLEEPY;
+	}
+	if (node->getInitAsSleepy ()) {
+		data.flags |= SNAPSHOT_INIT_SLEEPY;
+	}
+	if (node->broadcastIsEnabled ()) {
+		data.flags |= SNAPSHOT_BROADCAST;
+	}
+	if (node->useTimeSync ()) {
+		data.flags |= SNAPSHOT_TIME_SYNC;
+	}
+	memcpy (data.version, node->getVersion (), sizeof (data.version));
+	memset (data.name, 0, NODE_NAME_LENGTH);
+	if (node->getNodeName ()) {
+		strncpy (data.name, node->getNodeName (), NODE_NAME_LENGTH - 1);
+	}
+	data.groups = node->getGroups ();
+
+	result = writeRecord (file, SNAPSHOT_NODE, node->getNodeId (), (uint8_t*)&data, sizeof (data));
+	memset (&data, 0, sizeof (data));
+	return result;
+}
+
+bool NodeSnapshot::writeGroup (File& file, NodeList* nodelist, int8_t group) {
+	group_snapshot_t data;
+	node_group_t* entry = nodelist->getGroup (group);
+	bool result;
+
+	memset (&data, 0, sizeof (data));
+	if (entry) {
+		memcpy (data.name, entry->name, NODE_NAME_LENGTH);
+		memcpy (data.key, entry->key, KEY_LENGTH);
+		data.lastDownlinkMsgCounter = entry->lastDownlinkMsgCounter;
+	}
+
+	result = writeRecord (file, SNAPSHOT_GROUP, group, (uint8_t*)&data, sizeof (data));
+	memset (&data, 0, sizeof (data));
+	return result;
+}
+
+void NodeSnapshot::restoreNode (NodeList* nodelist, uint16_t nodeId, node_snapshot_t* data) {
+	Node* node = nodelist->restoreNode (nodeId, data->mac);
+
+	if (!node) {
+		DEBUG_WARN ("Wrong node %u on snapshot", nodeId);
+		return;
+	}
+
+	node->setEncryptionKey (data->key);
+	node->setCipherAlgorithm ((cipherAlgorithm_t)data->cipher);
+	node->setLastMessageCounter (data->lastMessageCounter);
+	node->setLastControlCounter (data->lastControlCounter);
+	// Downlink counter may have advanced since last save. Skip a whole step so that node does not drop next downlink
+	node->setLastDownlinkMsgCounter (data->lastDownlinkMsgCounter + 2 * NODE_SNAPSHOT_COUNTER_STEP);
+	node->setInitAsSleepy (data->flags & SNAPSHOT_INIT_SLEEPY);
+	node->setSleepy (data->flags & SNAPSHOT_SLEEPY);
+	node->enableBroadcast (data->flags & SNAPSHOT_BROADCAST);
+	if (data->flags & SNAPSHOT_TIME_SYNC) {
+		node->setTimeSyncEnabled ();
+	}
+	node->setVersion (data->version[0], data->version[1], data->version[2]);
+	node->setKeyValid (true);
+	node->setStatus (REGISTERED);
+	node->setKeyValidFrom (millis () - data->keyAge);
+	node->setLastMessageTime ();
+	data->name[NODE_NAME_LENGTH - 1] = '\0';
+	if (data->name[0]) {
+		node->setNodeName (data->name);
+	}
+	node->setGroups (data->groups);
+	DEBUG_DBG ("Node %u restored: %s", nodeId, DEBUG_MAC (data->mac));
+}
+
+bool NodeSnapshot::restore (NodeList* nodelist, gateway_snapshot_t* gwState) {
+	bool gwRestored = false;
+	int restored = 0;
+	uint8_t header[SNAPSHOT_HEADER_LENGTH];
+	uint8_t aad[SNAPSHOT_HEADER_LENGTH + AAD_LENGTH];
+	uint8_t tag[TAG_LENGTH];
+	const size_t maxRecord = sizeof (node_snapshot_t) > sizeof (gateway_snapshot_t) ? sizeof (node_snapshot_t) : sizeof (gateway_snapshot_t);
+	uint8_t data[maxRecord > sizeof (group_snapshot_t) ? maxRecord : sizeof (group_snapshot_t)];
+
+	if (!FILESYSTEM.exists (SNAPSHOT_FILE)) {
+		DEBUG_INFO ("No node snapshot found");
+		return false;
+	}
+
+	File file = FILESYSTEM.open (SNAPSHOT_FILE, "r");
+	if (!file) {
+		DEBUG_ERROR ("Error opening node snapshot");
+		return false;
+	}
+
+	while (file.read (header, SNAPSHOT_HEADER_LENGTH) == SNAPSHOT_HEADER_LENGTH) {
+		uint16_t nodeId;
+		size_t len;
+
+		memcpy (&nodeId, header + 1, sizeof (uint16_t));
+		switch (header[0]) {
+		case SNAPSHOT_NODE:
+			len = sizeof (node_snapshot_t);
+			break;
+		case SNAPSHOT_REMOVE:
+			len = 0;
+			break;
+		case SNAPSHOT_GATEWAY:
+			len = sizeof (gateway_snapshot_t);
+			break;
+		case SNAPSHOT_GROUP:
+			len = sizeof (group_snapshot_t);
+			break;
+		default:
+			len = SIZE_MAX;
+		}
+		if (len == SIZE_MAX) {
+			DEBUG_WARN ("Wrong record type %u on node snapshot", header[0]);
+			break;
+		}
+		if (file.read (data, len) != len || file.read (tag, TAG_LENGTH) != TAG_LENGTH) {
+			DEBUG_WARN ("Incomplete record on node snapshot");
+			break;
+		}
+
+		memcpy (aad, header, SNAPSHOT_HEADER_LENGTH);
+		memcpy (aad + SNAPSHOT_HEADER_LENGTH, key + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH);
+		if (!CryptModule::decryptBuffer (data, len, header + 1 + sizeof (uint16_t), IV_LENGTH,
+										 key, KEY_LENGTH - AAD_LENGTH, aad, sizeof (aad), tag, TAG_LENGTH)) {
+			DEBUG_WARN ("Wrong record on node snapshot");
+			break;
+		}
+
+		if (header[0] == SNAPSHOT_NODE) {
+			restoreNode (nodelist, nodeId, (node_snapshot_t*)data);
+			restored++;
+		} else if (header[0] == SNAPSHOT_REMOVE) {
+			Node* node = nodelist->getNodeFromID (nodeId);
+			if (node) {
+				node->reset ();
+			}
+		} else if (header[0] == SNAPSHOT_GROUP) {
+			group_snapshot_t* group = (group_snapshot_t*)data;
+			group->name[NODE_NAME_LENGTH - 1] = '\0';
+			// Counter may have advanced since last save. Skip a whole step so that members do not drop next message
+			nodelist->restoreGroup (nodeId, group->name, group->key, group->lastDownlinkMsgCounter + 2 * NODE_SNAPSHOT_COUNTER_STEP);
+		} else if (nodeId == SNAPSHOT_GATEWAY_ID) {
+			memcpy (gwState, data, sizeof (gateway_snapshot_t));
+			gwRestored = true;
+		}
+	}
+	file.close ();
+	memset (data, 0, sizeof (data));
+
+	DEBUG_INFO ("Node snapshot loaded. %d records, %u nodes registered", restored, nodelist->countActiveNodes ());
+
+	// Restored nodes are already on snapshot
+	Node* node;
+	while ((node = nodelist->getDirtyNode ())) {
+		nodelist->clearDirty (node);
+	}
+	nodelist->clearDirtyGroups ();
+
+	return gwRestored;
+}
+
+bool NodeSnapshot::save (NodeList* nodelist, gateway_snapshot_t* gwState, bool gwChanged) {
+	Node* node;
+	bool result = true;
+
+	File file = FILESYSTEM.open (SNAPSHOT_FILE, "a");
+	if (!file) {
+		DEBUG_ERROR ("Error opening node snapshot");
+		return false;
+	}
+
+	if (gwChanged) {
+		gateway_snapshot_t data = *gwState;
+		result = writeRecord (file, SNAPSHOT_GATEWAY, SNAPSHOT_GATEWAY_ID, (uint8_t*)&data, sizeof (data));
+		memset (&data, 0, sizeof (data));
+	}
+
+	uint16_t dirtyGroups = nodelist->getDirtyGroups ();
+	for (int8_t i = 0; result && i < MAX_NODE_GROUPS; i++) {
+		if (dirtyGroups & (1U << i)) {
+			result = writeGroup (file, nodelist, i);
+		}
+	}
+	nodelist->clearDirtyGroups ();
+
+	while (result && (node = nodelist->getDirtyNode ())) {
+		if (node->isRegistered ()) {
+			result = writeNode (file, node);
+		} else {
+			uint8_t empty;
+			result = writeRecord (file, SNAPSHOT_REMOVE, node->getNodeId (), &empty, 0);
+		}
+		nodelist->clearDirty (node);
+	}
+
+	size_t size = file.size ();
+	file.close ();
+
+	if (!result) {
+		DEBUG_ERROR ("Error writing node snapshot");
+		return false;
+	}
+
+	const size_t recordOverhead = SNAPSHOT_HEADER_LENGTH + TAG_LENGTH;
+	size_t fullSize = recordOverhead + sizeof (gateway_snapshot_t) + nodelist->countActiveNodes () * (recordOverhead + sizeof (node_snapshot_t))
+		+ MAX_NODE_GROUPS * (recordOverhead + sizeof (group_snapshot_t));
+	if (size > NODE_SNAPSHOT_MAX_SIZE && size > 2 * fullSize) {
+		return compact (nodelist, gwState);
+	}
+
+	return true;
+}
+
+bool NodeSnapshot::compact (NodeList* nodelist, gateway_snapshot_t* gwState) {
+	bool result;
+
+	File file = FILESYSTEM.open (SNAPSHOT_TMP_FILE, "w");
+	if (!file) {
+		DEBUG_ERROR ("Error creating node snapshot");
+		return false;
+	}
+
+	gateway_snapshot_t data = *gwState;
+	result = writeRecord (file, SNAPSHOT_GATEWAY, SNAPSHOT_GATEWAY_ID, (uint8_t*)&data, sizeof (data));
+	memset (&data, 0, sizeof (data));
+
+	for (int8_t i = 0; result && i < MAX_NODE_GROUPS; i++) {
+		if (nodelist->getGroup (i)) {
+			result = writeGroup (file, nodelist, i);
+		}
+	}
+	nodelist->clearDirtyGroups ();
+
+	for (int i = 0; result && i < NUM_NODES; i++) {
+		Node* node = nodelist->getNodeFromID (i);
+		if (node && node->isRegistered ()) {
+			result = writeNode (file, node);
+			nodelist->clearDirty (node);
+		}
+	}
+	file.close ();
+
+	if (!result) {
+		DEBUG_ERROR ("Error writing node snapshot");
+		FILESYSTEM.remove (SNAPSHOT_TMP_FILE);
+		return false;
+	}
+
+	FILESYSTEM.remove (SNAPSHOT_FILE);
+	if (!FILESYSTEM.rename (SNAPSHOT_TMP_FILE, SNAPSHOT_FILE)) {
+		DEBUG_ERROR ("Error renaming node snapshot");
+		return false;
+	}
+	DEBUG_INFO ("Node snapshot compacted");
+	return true;
+}
+
+void NodeSnapshot::clear () {
+	FILESYSTEM.remove (SNAPSHOT_FILE);
+	FILESYSTEM.remove (SNAPSHOT_TMP_FILE);
+}
@@ -0,0 +1,165 @@
+/**
+  * @file nodeSnapshot.h
+  * @version 0.9.7
+  * @date 04/02/2021
+  * @author German Martin
+  * @brief Encrypted log of node sessions, used to restore them after a gateway restart
+  *
+  * Snapshot is a file of records that are only appended. Every record has this format:
+  *
+  * | Type (1) | NodeId (2) | IV (12) | Data (....) | Tag (16) |
+  *
+  * Data is encrypted with a key derived from network key. Header is authenticated too.
+  * A later record of a node replaces previous ones. When file grows over `NODE_SNAPSHOT_MAX_SIZE` it is rewritten
+  * with current state of gateway and every registered node.
+  */
+
+#ifndef _NODESNAPSHOT_h
+#define _NODESNAPSHOT_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include "EnigmaIoTconfig.h"
+#include "NodeList.h"
+
+/**
+  * @brief Kind of snapshot record
+  */
+enum snapshot_record_type_t {
+	SNAPSHOT_NODE = 0x01, /**< Complete node session*/
+	SNAPSHOT_REMOVE = 0x02, /**< Node is not registered anymore. Record has no data*/
+	SNAPSHOT_GATEWAY = 0x03, /**< Gateway keys and broadcast counter*/
+	SNAPSHOT_GROUP = 0x04 /**< Multicast group. NodeId field is group index. An empty name means that group was deleted*/
+};
+
+/**
+  * @brief Node flags stored on snapshot
+  */
+enum snapshot_node_flags_t {
+	SNAPSHOT_SLEEPY = 0x01, /**< Node is sleepy*/
+	SNAPSHOT_INIT_SLEEPY = 0x02, /**< Node started as sleepy*/
+	SNAPSHOT_BROADCAST = 0x04, /**< Node has broadcast enabled*/
+	SNAPSHOT_TIME_SYNC = 0x08 /**< Node uses time synchronization*/
+};
+
+/**
+  * @brief Node session data stored on snapshot
+  */
+struct __attribute__ ((packed, aligned (1))) node_snapshot_t {
+	uint8_t mac[ENIGMAIOT_ADDR_LEN]; /**< Node address*/
+	uint8_t key[KEY_LENGTH]; /**< Node shared key*/
+	uint8_t cipher; /**< Cipher algorithm agreed with node*/
+	uint32_t lastMessageCounter; /**< Last uplink data message counter, extended with its epoch*/
+	uint32_t lastControlCounter; /**< Last uplink control message counter, extended with its epoch*/
+	uint16_t lastDownlinkMsgCounter; /**< Last downlink message counter*/
+	uint32_t keyAge; /**< Time in ms since key agreement when record was written*/
+	uint8_t flags; /**< Node flags. See `snapshot_node_flags_t`*/
+	uint8_t version[3]; /**< Node protocol version*/
+	char name[NODE_NAME_LENGTH]; /**< Node name. Empty if node has no name*/
+	uint16_t groups; /**< Bitmap of multicast groups node is member of*/
+};
+
+/**
+  * @brief Gateway data stored on snapshot. It is needed so that broadcast messages and session tickets keep working after restart
+  */
+struct __attribute__ ((packed, aligned (1))) gateway_snapshot_t {
+	uint8_t ticketKey[KEY_LENGTH]; /**< Key used to derive session ticket secrets*/
+	uint8_t broadcastKey[KEY_LENGTH]; /**< Broadcast key*/
+	uint16_t lastBroadcastMsgCounter; /**< Last broadcast message counter*/
+};
+
+/**
+  * @brief Multicast group data stored on snapshot
+  */
+struct __attribute__ ((packed, aligned (1))) group_snapshot_t {
+	char name[NODE_NAME_LENGTH]; /**< Group name*/
+	uint8_t key[KEY_LENGTH]; /**< Group key*/
+	uint16_t lastDownlinkMsgCounter; /**< Last group message counter*/
+};
+
+class NodeSnapshot {
+protected:
+	uint8_t key[KEY_LENGTH]; ///< @brief Snapshot encryption key
+
+	/**
+	  * @brief Encrypts and appends a record to snapshot file
+	  * @param file Snapshot file, open for writing
+	  * @param type Record type
+	  * @param nodeId Node identifier. 0xFFFF for gateway record
+	  * @param data Record data. It is encrypted in place
+	  * @param len Data length
+	  * @return `true` if record was written completely
+	  */
+	bool writeRecord (File& file, snapshot_record_type_t type, uint16_t nodeId, uint8_t* data, size_t len);
+
+	/**
+	  * @brief Appends session of a registered node to snapshot file
+	  * @param file Snapshot file, open for writing
+	  * @param node Node to save
+	  * @return `true` if record was written completely
+	  */
+	bool writeNode (File& file, Node* node);
+
+	/**
+	  * @brief Restores a node from its record data
+	  * @param nodelist Node list to restore node to
+	  * @param nodeId Node identifier
+	  * @param data Decrypted node record
+	  */
+	void restoreNode (NodeList* nodelist, uint16_t nodeId, node_snapshot_t* data);
+
+	/**
+	  * @brief Appends a multicast group to snapshot file
+	  * @param file Snapshot file, open for writing
+	  * @param nodelist Node list that holds groups
+	  * @param group Group index
+	  * @return `true` if record was written completely
+	  */
+	bool writeGroup (File& file, NodeList* nodelist, int8_t group);
+
+public:
+	/**
+	  * @brief Derives snapshot key from network key
+	  * @param networkKey Network key hash, as stored on gateway configuration
+	  */
+	void begin (const uint8_t* networkKey);
+
+	/**
+	  * @brief Restores gateway and node sessions from snapshot file. Reading stops on first incomplete or wrong record,
+	  * as it may come from a write that was interrupted. `compact()` should be called after this, so that
+	  * new records are not appended after a broken one
+	  * @param nodelist Node list to restore nodes to
+	  * @param gwState Gateway data is written here if snapshot has it
+	  * @return `true` if gateway data was restored
+	  */
+	bool restore (NodeList* nodelist, gateway_snapshot_t* gwState);
+
+	/**
+	  * @brief Appends records of every node that changed since last save, and gateway data if requested.
+	  * Snapshot is compacted if it grows too much
+	  * @param nodelist Node list that tracks changed nodes
+	  * @param gwState Current gateway data
+	  * @param gwChanged `true` if gateway data has to be saved
+	  * @return `true` if all records were written
+	  */
+	bool save (NodeList* nodelist, gateway_snapshot_t* gwState, bool gwChanged);
+
+	/**
+	  * @brief Rewrites snapshot with gateway data and sessions of all registered nodes only
+	  * @param nodelist Node list to save
+	  * @param gwState Current gateway data
+	  * @return `true` if snapshot was rewritten
+	  */
+	bool compact (NodeList* nodelist, gateway_snapshot_t* gwState);
+
+	/**
+	  * @brief Deletes snapshot file
+	  */
+	void clear ();
+};
+
+#endif // _NODESNAPSHOT_h
@@ -0,0 +1,896 @@
+/**
+  * @file payloadTranscoder.cpp
+  * @version 0.9.7
+  * @date 04/02/2021
+  * @author German Martin
+  * @brief Conversion between node payload encodings and JSON
+  */
+
+#include "payloadTranscoder.h"
+#include "EnigmaIOTdebug.h"
+
+/**
+  * @brief Output buffer that is filled sequentially. Once it overflows nothing else is written
+  */
+typedef struct {
+	char* buffer; /**< Output buffer*/
+	size_t size; /**< Output buffer size*/
+	size_t pos; /**< Number of bytes written*/
+	bool overflow; /**< Set if some data did not fit on buffer*/
+} transcoder_output_t;
+
+static void putChar (transcoder_output_t* out, char c) {
+	if (out->pos < out->size) {
+		out->buffer[out->pos++] = c;
+	} else {
+		out->overflow = true;
+	}
+}
+
+static void putString (transcoder_output_t* out, const char* str) {
+	while (*str) {
+		putChar (out, *str++);
+	}
+}
+
+static void putUInt (transcoder_output_t* out, uint64_t value) {
+	char digits[20];
+	int numDigits = 0;
+
+	do {
+		digits[numDigits++] = '0' + value % 10;
+		value /= 10;
+	} while (value);
+	while (numDigits) {
+		putChar (out, digits[--numDigits]);
+	}
+}
+
+static void putInt (transcoder_output_t* out, int64_t value) {
+	if (value < 0) {
+		putChar (out, '-');
+		putUInt (out, (uint64_t)(-(value + 1)) + 1); // Avoid overflow with INT64_MIN
+	} else {
+		putUInt (out, value);
+	}
+}
+
+static void putDouble (transcoder_output_t* out, double value, uint8_t precision) {
+	char number[32];
+
+	if (isnan (value) || isinf (value)) {
+		putString (out, "null"); // Not valid on JSON
+		return;
+	}
+	snprintf (number, sizeof (number), "%.*g", precision, value);
+	putString (out, number);
+}
+
+/**
+  * @brief Writes `raw / divider` with only the needed number of decimals. Divider has to be 2 or a power of 10
+  */
+static void putFixed (transcoder_output_t* out, int32_t raw, uint16_t divider) {
+	uint32_t absValue = raw < 0 ? -(int64_t)raw : raw;
+	uint32_t fraction = absValue % divider;
+
+	if (raw < 0) {
+		putChar (out, '-');
+	}
+	putUInt (out, absValue / divider);
+	if (!fraction) {
+		return;
+	}
+	if (divider == 2) {
+		putString (out, ".5");
+		return;
+	}
+	putChar (out, '.');
+	for (uint16_t weight = divider / 10; weight && fraction; weight /= 10) {
+		putChar (out, '0' + fraction / weight);
+		fraction %= weight;
+	}
+}
+
+static void putJsonString (transcoder_output_t* out, const char* str, size_t len) {
+	static const char HEX_DIGITS[] = "0123456789abcdef";
+
+	putChar (out, '"');
+	for (size_t i = 0; i < len; i++) {
+		char c = str[i];
+		switch (c) {
+		case '"':
+			putString (out, "\\\"");
+			break;
+		case '\\':
+			putString (out, "\\\\");
+			break;
+		case '\b':
+			putString (out, "\\b");
+			break;
+		case '\f':
+			putString (out, "\\f");
+			break;
+		case '\n':
+			putString (out, "\\n");
+			break;
+		case '\r':
+			putString (out, "\\r");
+			break;
+		case '\t':
+			putString (out, "\\t");
+			break;
+		default:
+			if ((uint8_t)c < 0x20) {
+				putString (out, "\\u00");
+				putChar (out, HEX_DIGITS[c >> 4]);
+				putChar (out, HEX_DIGITS[c & 0x0F]);
+			} else {
+				putChar (out, c);
+			}
+		}
+	}
+	putChar (out, '"');
+}
+
+static size_t finishOutput (transcoder_output_t* out) {
+	if (out->overflow) {
+		DEBUG_WARN ("Transcoder output buffer too small: %u bytes", out->size);
+		return 0;
+	}
+	if (out->pos < out->size) {
+		out->buffer[out->pos] = '\0';
+	}
+	return out->pos;
+}
+
+static uint64_t readBigEndian (const uint8_t* data, uint8_t len) {
+	uint64_t value = 0;
+
+	for (uint8_t i = 0; i < len; i++) {
+		value = (value << 8) | data[i];
+	}
+	return value;
+}
+
+// ---------------------------------------------------------------- MessagePack to JSON
+
+static bool msgPackValueToJson (const uint8_t* input, size_t inputLen, size_t& idx, transcoder_output_t* out, uint8_t depth);
+
+/**
+  * @brief Checks that input has at least `length` bytes left from `idx`. It is written so that it cannot overflow with a length read from input
+  * @return `false` if input is truncated
+  */
+static bool inputAvailable (size_t inputLen, size_t idx, uint32_t length) {
+	return idx <= inputLen && length <= inputLen - idx;
+}
+
+/**
+  * @brief Gets length of a MessagePack element, reading its length field
+  * @return `false` if input is truncated
+  */
+static bool msgPackReadLength (const uint8_t* input, size_t inputLen, size_t& idx, uint8_t lenBytes, uint32_t& length) {
+	if (!inputAvailable (inputLen, idx, lenBytes)) {
+		return false;
+	}
+	length = readBigEndian (input + idx, lenBytes);
+	idx += lenBytes;
+	return true;
+}
+
+static bool msgPackStringToJson (const uint8_t* input, size_t inputLen, size_t& idx, transcoder_output_t* out, uint32_t length) {
+	if (!inputAvailable (inputLen, idx, length)) {
+		return false;
+	}
+	putJsonString (out, (const char*)(input + idx), length);
+	idx += length;
+	return true;
+}
+
+static bool msgPackArrayToJson (const uint8_t* input, size_t inputLen, size_t& idx, transcoder_output_t* out, uint32_t count, uint8_t depth) {
+	if (depth >= TRANSCODER_MAX_NESTING) {
+		DEBUG_WARN ("MessagePack nesting too deep");
+		return false;
+	}
+	putChar (out, '[');
+	for (uint32_t i = 0; i < count; i++) {
+		if (i) {
+			putChar (out, ',');
+		}
+		if (!msgPackValueToJson (input, inputLen, idx, out, depth + 1)) {
+			return false;
+		}
+	}
+	putChar (out, ']');
+	return true;
+}
+
+static bool msgPackMapToJson (const uint8_t* input, size_t inputLen, size_t& idx, transcoder_output_t* out, uint32_t count, uint8_t depth) {
+	if (depth >= TRANSCODER_MAX_NESTING) {
+		DEBUG_WARN ("MessagePack nesting too deep");
+		return false;
+	}
+	putChar (out, '{');
+	for (uint32_t i = 0; i < count; i++) {
+		if (i) {
+			putChar (out, ',');
+		}
+		// JSON only allows string keys
+		if (idx >= inputLen) {
+			return false;
+		}
+		uint8_t type = input[idx++];
+		uint32_t length;
+		if ((type & 0xE0) == 0xA0) {
+			length = type & 0x1F;
+		} else if (type >= 0xD9 && type <= 0xDB) {
+			if (!msgPackReadLength (input, inputLen, idx, 1 << (type - 0xD9), length)) {
+				return false;
+			}
+		} else {
+			DEBUG_WARN ("MessagePack map key is not a string");
+			return false;
+		}
+		if (!msgPackStringToJson (input, inputLen, idx, out, length)) {
+			return false;
+		}
+		putChar (out, ':');
+		if (!msgPackValueToJson (input, inputLen, idx, out, depth + 1)) {
+			return false;
+		}
+	}
+	putChar (out, '}');
+	return true;
+}
+
+static bool msgPackValueToJson (const uint8_t* input, size_t inputLen, size_t& idx, transcoder_output_t* out, uint8_t depth) {
+	uint32_t length;
+
+	if (idx >= inputLen) {
+		return false;
+	}
+	uint8_t type = input[idx++];
+
+	if (type <= 0x7F) { // positive fixint
+		putUInt (out, type);
+		return true;
+	}
+	if (type >= 0xE0) { // negative fixint
+		putInt (out, (int8_t)type);
+		return true;
+	}
+	if ((type & 0xE0) == 0xA0) { // fixstr
+		return msgPackStringToJson (input, inputLen, idx, out, type & 0x1F);
+	}
+	if ((type & 0xF0) == 0x90) { // fixarray
+		return msgPackArrayToJson (input, inputLen, idx, out, type & 0x0F, depth);
+	}
+	if ((type & 0xF0) == 0x80) { // fixmap
+		return msgPackMapToJson (input, inputLen, idx, out, type & 0x0F, depth);
+	}
+
+	switch (type) {
+	case 0xC0:
+		putString (out, "null");
+		return true;
+	case 0xC2:
+		putString (out, "false");
+		return true;
+	case 0xC3:
+		putString (out, "true");
+		return true;
+	case 0xCA: // float 32
+		if (!inputAvailable (inputLen, idx, 4)) {
+			return false;
+		} else {
+			uint32_t bits = readBigEndian (input + idx, 4);
+			float value;
+			memcpy (&value, &bits, sizeof (float));
+			idx += 4;
+			putDouble (out, value, 7);
+			return true;
+		}
+	case 0xCB: // float 64
+		if (!inputAvailable (inputLen, idx, 8)) {
+			return false;
+		} else {
+			uint64_t bits = readBigEndian (input + idx, 8);
+			double value;
+			memcpy (&value, &bits, sizeof (double));
+			idx += 8;
+			putDouble (out, value, 15);
+			return true;
+		}
+	case 0xCC: // uint 8, 16, 32, 64
+	case 0xCD:
+	case 0xCE:
+	case 0xCF:
+		{
+			uint8_t size = 1 << (type - 0xCC);
+			if (!inputAvailable (inputLen, idx, size)) {
+				return false;
+			}
+			putUInt (out, readBigEndian (input + idx, size));
+			idx += size;
+			return true;
+		}
+	case 0xD0: // int 8, 16, 32, 64
+	case 0xD1:
+	case 0xD2:
+	case 0xD3:
+		{
+			uint8_t size = 1 << (type - 0xD0);
+			if (!inputAvailable (inputLen, idx, size)) {
+				return false;
+			}
+			uint64_t value = readBigEndian (input + idx, size);
+			if (size < 8 && (value & (1ULL << (size * 8 - 1)))) { // Sign extension
+				value |= ~0ULL << (size * 8);
+			}
+			putInt (out, (int64_t)value);
+			idx += size;
+			return true;
+		}
+	case 0xD9: // str 8, 16, 32
+	case 0xDA:
+	case 0xDB:
+		return msgPackReadLength (input, inputLen, idx, 1 << (type - 0xD9), length)
+			&& msgPackStringToJson (input, inputLen, idx, out, length);
+	case 0xDC: // array 16, 32
+	case 0xDD:
+		return msgPackReadLength (input, inputLen, idx, type == 0xDC ? 2 : 4, length)
+			&& msgPackArrayToJson (input, inputLen, idx, out, length, depth);
+	case 0xDE: // map 16, 32
+	case 0xDF:
+		return msgPackReadLength (input, inputLen, idx, type == 0xDE ? 2 : 4, length)
+			&& msgPackMapToJson (input, inputLen, idx, out, length, depth);
+	default: // bin and ext types have no JSON representation
+		DEBUG_WARN ("MessagePack type 0x%02X not supported", type);
+		return false;
+	}
+}
+
+size_t msgPackToJson (const uint8_t* input, size_t inputLen, char* output, size_t outputLen) {
+	transcoder_output_t out = { output, outputLen, 0, false };
+	size_t idx = 0;
+
+	if (!input || !output || !inputLen) {
+		return 0;
+	}
+	if (!msgPackValueToJson (input, inputLen, idx, &out, 0)) {
+		DEBUG_WARN ("Invalid MessagePack data");
+		return 0;
+	}
+	return finishOutput (&out);
+}
+
+// ---------------------------------------------------------------- CayenneLPP to JSON
+
+/**
+  * @brief CayenneLPP data type definition
+  */
+typedef struct {
+	uint8_t type; /**< Type code*/
+	uint8_t size; /**< Value size in bytes*/
+	uint16_t divider; /**< Value resolution divider*/
+	bool isSigned; /**< `true` if value is signed*/
+	const char* name; /**< Type name*/
+} lpp_type_t;
+
+static const lpp_type_t LPP_TYPES[] = {
+	{ 0, 1, 1, false, "digital_in" },
+	{ 1, 1, 1, false, "digital_out" },
+	{ 2, 2, 100, true, "analog_in" },
+	{ 3, 2, 100, true, "analog_out" },
+	{ 100, 4, 1, false, "generic" },
+	{ 101, 2, 1, false, "luminosity" },
+	{ 102, 1, 1, false, "presence" },
+	{ 103, 2, 10, true, "temperature" },
+	{ 104, 1, 2, false, "humidity" },
+	{ 113, 6, 1000, true, "accelerometer" },
+	{ 115, 2, 10, false, "pressure" },
+	{ 116, 2, 100, false, "voltage" },
+	{ 117, 2, 1000, false, "current" },
+	{ 118, 4, 1, false, "frequency" },
+	{ 120, 1, 1, false, "percentage" },
+	{ 121, 2, 1, true, "altitude" },
+	{ 125, 2, 1, false, "concentration" },
+	{ 128, 2, 1, false, "power" },
+	{ 130, 4, 1000, false, "distance" },
+	{ 131, 4, 1000, false, "energy" },
+	{ 132, 2, 1, false, "direction" },
+	{ 133, 4, 1, false, "time" },
+	{ 134, 6, 100, true, "gyrometer" },
+	{ 135, 3, 1, false, "colour" },
+	{ 136, 9, 10000, true, "gps" },
+	{ 142, 1, 1, false, "switch" }
+};
+
+static const uint8_t LPP_ACCELEROMETER_TYPE = 113;
+static const uint8_t LPP_GYROMETER_TYPE = 134;
+static const uint8_t LPP_COLOUR_TYPE = 135;
+static const uint8_t LPP_GPS_TYPE = 136;
+
+static const lpp_type_t* getLppType (uint8_t type) {
+	for (size_t i = 0; i < sizeof (LPP_TYPES) / sizeof (lpp_type_t); i++) {
+		if (LPP_TYPES[i].type == type) {
+			return &LPP_TYPES[i];
+		}
+	}
+	return NULL;
+}
+
+static int32_t readLppValue (const uint8_t* data, uint8_t size, bool isSigned) {
+	uint32_t value = readBigEndian (data, size);
+
+	if (isSigned && size < 4 && (value & (1UL << (size * 8 - 1)))) { // Sign extension
+		value |= ~0UL << (size * 8);
+	}
+	return (int32_t)value;
+}
+
+static void putLppField (transcoder_output_t* out, const char* name, const uint8_t* data, uint8_t size, uint16_t divider, bool isSigned) {
+	putChar (out, '"');
+	putString (out, name);
+	putString (out, "\":");
+	if (!isSigned && size == 4) {
+		uint32_t value = readBigEndian (data, size);
+		if (divider == 1) {
+			putUInt (out, value);
+		} else {
+			putDouble (out, (double)value / divider, 10);
+		}
+	} else {
+		putFixed (out, readLppValue (data, size, isSigned), divider);
+	}
+}
+
+size_t cayenneLppToJson (const uint8_t* input, size_t inputLen, char* output, size_t outputLen) {
+	transcoder_output_t out = { output, outputLen, 0, false };
+	size_t idx = 0;
+	bool first = true;
+
+	if (!output) {
+		return 0;
+	}
+
+	putChar (&out, '[');
+	while (idx + 2 < inputLen) {
+		uint8_t channel = input[idx++];
+		uint8_t type = input[idx++];
+		const lpp_type_t* lppType = getLppType (type);
+
+		if (!lppType) {
+			DEBUG_WARN ("Unknown CayenneLPP type %u", type);
+			return 0;
+		}
+		if (!inputAvailable (inputLen, idx, lppType->size)) {
+			DEBUG_WARN ("CayenneLPP data truncated");
+			return 0;
+		}
+
+		if (!first) {
+			putChar (&out, ',');
+		}
+		first = false;
+		putString (&out, "{\"channel\":");
+		putUInt (&out, channel);
+		putString (&out, ",\"type\":");
+		putUInt (&out, type);
+		putString (&out, ",\"name\":\"");
+		putString (&out, lppType->name);
+		putString (&out, "\",");
+
+		const uint8_t* value = input + idx;
+		if (type == LPP_ACCELEROMETER_TYPE || type == LPP_GYROMETER_TYPE) {
+			putString (&out, "\"value\":{");
+			putLppField (&out, "x", value, 2, lppType->divider, true);
+			putChar (&out, ',');
+			putLppField (&out, "y", value + 2, 2, lppType->divider, true);
+			putChar (&out, ',');
+			putLppField (&out, "z", value + 4, 2, lppType->divider, true);
+			putChar (&out, '}');
+		} else if (type == LPP_COLOUR_TYPE) {
+			putString (&out, "\"value\":{");
+			putLppField (&out, "r", value, 1, 1, false);
+			putChar (&out, ',');
+			putLppField (&out, "g", value + 1, 1, 1, false);
+			putChar (&out, ',');
+			putLppField (&out, "b", value + 2, 1, 1, false);
+			putChar (&out, '}');
+		} else if (type == LPP_GPS_TYPE) {
+			putString (&out, "\"value\":{");
+			putLppField (&out, "latitude", value, 3, 10000, true);
+			putChar (&out, ',');
+			putLppField (&out, "longitude", value + 3, 3, 10000, true);
+			putChar (&out, ',');
+			putLppField (&out, "altitude", value + 6, 3, 100, true);
+			putChar (&out, '}');
+		} else {
+			putLppField (&out, "value", value, lppType->size, lppType->divider, lppType->isSigned);
+		}
+		putChar (&out, '}');
+		idx += lppType->size;
+	}
+	putChar (&out, ']');
+
+	return finishOutput (&out);
+}
+
+// ---------------------------------------------------------------- JSON to MessagePack
+
+/**
+  * @brief JSON parser state. MessagePack output uses the same sequential buffer than JSON output
+  */
+typedef struct {
+	const char* input; /**< Next character to parse*/
+	const char* end; /**< End of input text*/
+	transcoder_output_t out; /**< MessagePack output*/
+} json_parser_t;
+
+static void skipSpaces (json_parser_t* parser) {
+	while (parser->input < parser->end &&
+		   (*parser->input == ' ' || *parser->input == '\t' || *parser->input == '\n' || *parser->input == '\r')) {
+		parser->input++;
+	}
+}
+
+static void putByte (json_parser_t* parser, uint8_t data) {
+	putChar (&parser->out, (char)data);
+}
+
+static void putBigEndian (json_parser_t* parser, uint64_t value, uint8_t size) {
+	for (int i = size - 1; i >= 0; i--) {
+		putByte (parser, (uint8_t)(value >> (i * 8)));
+	}
+}
+
+/**
+  * @brief Writes a container or string header on space reserved for the largest one, moving data back if a shorter one is used
+  * @param start Position of reserved space. 3 bytes were reserved
+  * @param shortType First byte for short header, that holds length on its lower bits. 0 if there is not a short header
+  * @param shortMax Maximum length for short header
+  * @param longType First byte for header followed by 8 bit length. 0 if there is not one
+  * @param wordType First byte for header followed by 16 bit length
+  */
+static bool writeHeader (json_parser_t* parser, size_t start, uint32_t length, uint8_t shortType, uint8_t shortMax, uint8_t byteType, uint8_t wordType) {
+	const uint8_t RESERVED = 3;
+	uint8_t header[RESERVED];
+	uint8_t headerLen;
+
+	if (parser->out.overflow) {
+		return false;
+	}
+	if (shortType && length <= shortMax) {
+		header[0] = shortType | length;
+		headerLen = 1;
+	} else if (byteType && length <= 0xFF) {
+		header[0] = byteType;
+		header[1] = length;
+		headerLen = 2;
+	} else if (length <= 0xFFFF) {
+		header[0] = wordType;
+		header[1] = length >> 8;
+		header[2] = length & 0xFF;
+		headerLen = 3;
+	} else {
+		return false;
+	}
+	uint8_t* buffer = (uint8_t*)parser->out.buffer;
+	if (headerLen < RESERVED) {
+		memmove (buffer + start + headerLen, buffer + start + RESERVED, parser->out.pos - start - RESERVED);
+		parser->out.pos -= RESERVED - headerLen;
+	}
+	memcpy (buffer + start, header, headerLen);
+	return true;
+}
+
+static bool parseHex4 (json_parser_t* parser, uint32_t& code) {
+	code = 0;
+	if (parser->end - parser->input < 4) {
+		return false;
+	}
+	for (int i = 0; i < 4; i++) {
+		char c = *parser->input++;
+		code <<= 4;
+		if (c >= '0' && c <= '9') {
+			code |= c - '0';
+		} else if (c >= 'a' && c <= 'f') {
+			code |= c - 'a' + 10;
+		} else if (c >= 'A' && c <= 'F') {
+			code |= c - 'A' + 10;
+		} else {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void putUtf8 (json_parser_t* parser, uint32_t code) {
+	if (code < 0x80) {
+		putByte (parser, code);
+	} else if (code < 0x800) {
+		putByte (parser, 0xC0 | (code >> 6));
+		putByte (parser, 0x80 | (code & 0x3F));
+	} else if (code < 0x10000) {
+		putByte (parser, 0xE0 | (code >> 12));
+		putByte (parser, 0x80 | ((code >> 6) & 0x3F));
+		putByte (parser, 0x80 | (code & 0x3F));
+	} else {
+		putByte (parser, 0xF0 | (code >> 18));
+		putByte (parser, 0x80 | ((code >> 12) & 0x3F));
+		putByte (parser, 0x80 | ((code >> 6) & 0x3F));
+		putByte (parser, 0x80 | (code & 0x3F));
+	}
+}
+
+static bool parseString (json_parser_t* parser) {
+	char quote = *parser->input++; // Both double and single quotes are accepted
+	size_t start = parser->out.pos;
+
+	putBigEndian (parser, 0, 3); // Reserve space for header
+
+	while (parser->input < parser->end) {
+		char c = *parser->input++;
+		if (c == quote) {
+			return writeHeader (parser, start, parser->out.pos - start - 3, 0xA0, 31, 0xD9, 0xDA);
+		}
+		if (c != '\\') {
+			putByte (parser, c);
+			continue;
+		}
+		if (parser->input >= parser->end) {
+			return false;
+		}
+		c = *parser->input++;
+		switch (c) {
+		case 'b':
+			putByte (parser, '\b');
+			break;
+		case 'f':
+			putByte (parser, '\f');
+			break;
+		case 'n':
+			putByte (parser, '\n');
+			break;
+		case 'r':
+			putByte (parser, '\r');
+			break;
+		case 't':
+			putByte (parser, '\t');
+			break;
+		case 'u':
+			{
+				uint32_t code;
+				if (!parseHex4 (parser, code)) {
+					return false;
+				}
+				if (code >= 0xD800 && code < 0xDC00) { // Surrogate pair
+					uint32_t low;
+					if (parser->end - parser->input < 6 || parser->input[0] != '\\' || parser->input[1] != 'u') {
+						return false;
+					}
+					parser->input += 2;
+					if (!parseHex4 (parser, low) || low < 0xDC00 || low > 0xDFFF) {
+						return false;
+					}
+					code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+				}
+				putUtf8 (parser, code);
+			}
+			break;
+		default: // Quotes, slash and backslash
+			putByte (parser, c);
+		}
+	}
+	return false; // Unterminated string
+}
+
+static bool matchLiteral (json_parser_t* parser, const char* literal) {
+	size_t len = strlen (literal);
+
+	if ((size_t)(parser->end - parser->input) < len || memcmp (parser->input, literal, len)) {
+		return false;
+	}
+	parser->input += len;
+	return true;
+}
+
+static void putInteger (json_parser_t* parser, int64_t value) {
+	if (value >= 0) {
+		if (value <= 0x7F) {
+			putByte (parser, value);
+		} else if (value <= 0xFF) {
+			putByte (parser, 0xCC);
+			putBigEndian (parser, value, 1);
+		} else if (value <= 0xFFFF) {
+			putByte (parser, 0xCD);
+			putBigEndian (parser, value, 2);
+		} else if (value <= 0xFFFFFFFFLL) {
+			putByte (parser, 0xCE);
+			putBigEndian (parser, value, 4);
+		} else {
+			putByte (parser, 0xCF);
+			putBigEndian (parser, value, 8);
+		}
+	} else {
+		if (value >= -32) {
+			putByte (parser, (uint8_t)value);
+		} else if (value >= INT8_MIN) {
+			putByte (parser, 0xD0);
+			putBigEndian (parser, value, 1);
+		} else if (value >= INT16_MIN) {
+			putByte (parser, 0xD1);
+			putBigEndian (parser, value, 2);
+		} else if (value >= INT32_MIN) {
+			putByte (parser, 0xD2);
+			putBigEndian (parser, value, 4);
+		} else {
+			putByte (parser, 0xD3);
+			putBigEndian (parser, value, 8);
+		}
+	}
+}
+
+static bool parseNumber (json_parser_t* parser) {
+	const uint8_t MAX_NUMBER_LENGTH = 32;
+	char number[MAX_NUMBER_LENGTH + 1];
+	uint8_t len = 0;
+	bool isFloat = false;
+
+	while (parser->input < parser->end && len < MAX_NUMBER_LENGTH) {
+		char c = *parser->input;
+		if (c == '.' || c == 'e' || c == 'E') {
+			isFloat = true;
+		} else if (!(c >= '0' && c <= '9') && c != '-' && c != '+') {
+			break;
+		}
+		number[len++] = c;
+		parser->input++;
+	}
+	number[len] = '\0';
+
+	if (!isFloat) {
+		bool negative = number[0] == '-';
+		const char* digit = number + (negative ? 1 : 0);
+		uint64_t value = 0;
+		if (!*digit) {
+			return false;
+		}
+		for (; *digit; digit++) {
+			if (*digit < '0' || *digit > '9') {
+				return false;
+			}
+			if (value > (INT64_MAX - (*digit - '0')) / 10) {
+				isFloat = true; // Too big for an integer
+				break;
+			}
+			value = value * 10 + (*digit - '0');
+		}
+		if (!isFloat) {
+			putInteger (parser, negative ? -(int64_t)value : (int64_t)value);
+			return true;
+		}
+	}
+
+	char* numberEnd;
+	double value = strtod (number, &numberEnd);
+	if (numberEnd != number + len) {
+		return false;
+	}
+	float shortValue = (float)value;
+	if ((double)shortValue == value) { // float 32 is enough
+		uint32_t bits;
+		memcpy (&bits, &shortValue, sizeof (float));
+		putByte (parser, 0xCA);
+		putBigEndian (parser, bits, 4);
+	} else {
+		uint64_t bits;
+		memcpy (&bits, &value, sizeof (double));
+		putByte (parser, 0xCB);
+		putBigEndian (parser, bits, 8);
+	}
+	return true;
+}
+
+static bool parseValue (json_parser_t* parser, uint8_t depth) {
+	skipSpaces (parser);
+	if (parser->input >= parser->end) {
+		return false;
+	}
+
+	char c = *parser->input;
+	if (c == '{' || c == '[') {
+		bool isObject = c == '{';
+		char closing = isObject ? '}' : ']';
+		size_t start = parser->out.pos;
+		uint32_t count = 0;
+
+		if (depth >= TRANSCODER_JSON_MAX_NESTING) {
+			return false;
+		}
+		parser->input++;
+		putBigEndian (parser, 0, 3); // Reserve space for header
+		skipSpaces (parser);
+		if (parser->input < parser->end && *parser->input == closing) {
+			parser->input++;
+		} else {
+			while (true) {
+				if (isObject) {
+					skipSpaces (parser);
+					if (parser->input >= parser->end || (*parser->input != '"' && *parser->input != '\'')) {
+						return false;
+					}
+					if (!parseString (parser)) {
+						return false;
+					}
+					skipSpaces (parser);
+					if (parser->input >= parser->end || *parser->input++ != ':') {
+						return false;
+					}
+				}
+				if (!parseValue (parser, depth + 1)) {
+					return false;
+				}
+				count++;
+				skipSpaces (parser);
+				if (parser->input >= parser->end) {
+					return false;
+				}
+				c = *parser->input++;
+				if (c == closing) {
+					break;
+				}
+				if (c != ',') {
+					return false;
+				}
+			}
+		}
+		if (isObject) {
+			return writeHeader (parser, start, count, 0x80, 15, 0, 0xDE);
+		} else {
+			return writeHeader (parser, start, count, 0x90, 15, 0, 0xDC);
+		}
+	}
+	if (c == '"' || c == '\'') {
+		return parseString (parser);
+	}
+	if (c == '-' || (c >= '0' && c <= '9')) {
+		return parseNumber (parser);
+	}
+	if (matchLiteral (parser, "true")) {
+		putByte (parser, 0xC3);
+		return true;
+	}
+	if (matchLiteral (parser, "false")) {
+		putByte (parser, 0xC2);
+		return true;
+	}
+	if (matchLiteral (parser, "null")) {
+		putByte (parser, 0xC0);
+		return true;
+	}
+	return false;
+}
+
+size_t jsonToMsgPack (const char* input, size_t inputLen, uint8_t* output, size_t outputLen) {
+	json_parser_t parser = { input, input + inputLen, { (char*)output, outputLen, 0, false } };
+
+	if (!input || !output) {
+		return 0;
+	}
+	if (!parseValue (&parser, 0)) {
+		DEBUG_DBG ("Not a JSON text");
+		return 0;
+	}
+	// Only spaces are allowed after JSON value. A null terminator is accepted too
+	skipSpaces (&parser);
+	if (parser.input < parser.end && *parser.input != '\0') {
+		DEBUG_DBG ("Not a JSON text. Extra data after value");
+		return 0;
+	}
+	if (parser.out.overflow) {
+		DEBUG_WARN ("MessagePack data too long for output buffer: %u bytes", outputLen);
+		return 0;
+	}
+	return parser.out.pos;
+}
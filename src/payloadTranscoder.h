@@ -0,0 +1,61 @@
+/**
+  * @file payloadTranscoder.h
+  * @version 0.9.7
+  * @date 04/02/2021
+  * @author German Martin
+  * @brief Conversion between node payload encodings and JSON
+  *
+  * Data is converted in a single pass, writing directly to output buffer.
+  * No intermediate document is built and no heap memory is used.
+  */
+
+#ifndef _PAYLOADTRANSCODER_h
+#define _PAYLOADTRANSCODER_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#ifndef TRANSCODER_MAX_NESTING
+static const uint8_t TRANSCODER_MAX_NESTING = 10; ///< @brief Maximum nesting level of arrays and maps when decoding MessagePack
+#endif // TRANSCODER_MAX_NESTING
+#ifndef TRANSCODER_JSON_MAX_NESTING
+static const uint8_t TRANSCODER_JSON_MAX_NESTING = 3; ///< @brief Maximum nesting level of arrays and objects when encoding JSON downlink data
+#endif // TRANSCODER_JSON_MAX_NESTING
+
+/**
+  * @brief Converts MessagePack data to JSON text
+  * @param input MessagePack data
+  * @param inputLen MessagePack data length
+  * @param output Buffer to write JSON text to. It is null terminated if there is room
+  * @param outputLen Output buffer size
+  * @return Number of characters of JSON text. 0 if data is not valid MessagePack or it does not fit on output buffer
+  */
+size_t msgPackToJson (const uint8_t* input, size_t inputLen, char* output, size_t outputLen);
+
+/**
+  * @brief Converts CayenneLPP data to JSON text.
+  *
+  * Format is the same that CayenneLPP library generates:
+  * `[{"channel":1,"type":103,"name":"temperature","value":21.5},...]`
+  * @param input CayenneLPP data
+  * @param inputLen CayenneLPP data length
+  * @param output Buffer to write JSON text to. It is null terminated if there is room
+  * @param outputLen Output buffer size
+  * @return Number of characters of JSON text. 0 if data has unknown types, is truncated or it does not fit on output buffer
+  */
+size_t cayenneLppToJson (const uint8_t* input, size_t inputLen, char* output, size_t outputLen);
+
+/**
+  * @brief Converts a JSON text to MessagePack data
+  * @param input JSON text. It does not need to be null terminated
+  * @param inputLen JSON text length
+  * @param output Buffer to write MessagePack data to
+  * @param outputLen Output buffer size
+  * @return Number of bytes of MessagePack data. 0 if text is not valid JSON, it is nested more than `TRANSCODER_JSON_MAX_NESTING` levels or it does not fit on output buffer
+  */
+size_t jsonToMsgPack (const char* input, size_t inputLen, uint8_t* output, size_t outputLen);
+
+#endif // _PAYLOADTRANSCODER_h
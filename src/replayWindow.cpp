@@ -0,0 +1,64 @@
+/**
+  * @file replayWindow.cpp
+  * @version 0.9.7
+  * @date 04/02/2021
+  * @author German Martin
+  * @brief Sliding window anti-replay check of uplink message counters
+  */
+
+#include "replayWindow.h"
+
+static const uint32_t EPOCH_LENGTH = 0x10000U; ///< @brief Number of counters on every epoch
+static const uint32_t HALF_EPOCH = 0x8000U; ///< @brief Half of epoch length. Used to find closest counter
+
+int ReplayWindow::getEpochCandidates (uint16_t* epochs) {
+	uint16_t low = highest & 0xFFFF;
+
+	epochs[0] = getEpoch ();
+	if (low >= HALF_EPOCH && epochs[0] < 0xFFFF) {
+		epochs[1] = epochs[0] + 1;
+		return 2;
+	}
+	if (low < ANTI_REPLAY_WINDOW && epochs[0] > 0) {
+		epochs[1] = epochs[0] - 1;
+		return 2;
+	}
+	return 1;
+}
+
+uint32_t ReplayWindow::extend (uint16_t counter) {
+	uint32_t candidate = (highest & 0xFFFF0000U) | counter;
+
+	if (candidate < highest && highest - candidate > HALF_EPOCH && candidate < 0xFFFF0000U) {
+		candidate += EPOCH_LENGTH;
+	} else if (candidate > highest && candidate - highest > HALF_EPOCH && candidate >= EPOCH_LENGTH) {
+		candidate -= EPOCH_LENGTH;
+	}
+	return candidate;
+}
+
+replay_result_t ReplayWindow::accept (uint32_t counter, uint32_t* lost) {
+	if (lost) {
+		*lost = 0;
+	}
+
+	if (counter > highest) {
+		uint32_t shift = counter - highest;
+		bitmap = shift < ANTI_REPLAY_WINDOW ? (bitmap << shift) | 1 : 1;
+		highest = counter;
+		if (lost) {
+			*lost = shift - 1;
+		}
+		return REPLAY_NEW;
+	}
+
+	uint32_t offset = highest - counter;
+	if (offset >= ANTI_REPLAY_WINDOW) {
+		return REPLAY_TOO_OLD;
+	}
+	if (bitmap & (1U << offset)) {
+		return REPLAY_DUPLICATE;
+	}
+	bitmap |= 1U << offset;
+	return REPLAY_LATE;
+}
@@ -0,0 +1,105 @@
+/**
+  * @file replayWindow.h
+  * @version 0.9.7
+  * @date 04/02/2021
+  * @author German Martin
+  * @brief Sliding window anti-replay check of uplink message counters
+  *
+  * Messages carry a 16 bit counter. Gateway extends it to 32 bits: upper 16 bits are the counter epoch, that node increments
+  * every time its 16 bit counter wraps. Epoch is not sent but it is bound to message authentication, so that a message from
+  * an older epoch does not pass as a new one. A bitmap keeps track of the last `ANTI_REPLAY_WINDOW` counters, so that
+  * messages that arrive out of order are accepted once.
+  */
+
+#ifndef _REPLAYWINDOW_h
+#define _REPLAYWINDOW_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include "EnigmaIoTconfig.h"
+
+static_assert (ANTI_REPLAY_WINDOW > 0 && ANTI_REPLAY_WINDOW <= 32, "ANTI_REPLAY_WINDOW must be from 1 to 32, as window bitmap has 32 bits");
+
+/**
+  * @brief Result of a counter check
+  */
+enum replay_result_t {
+	REPLAY_NEW = 0, /**< Counter is higher than any other received before*/
+	REPLAY_LATE = 1, /**< Counter is lower than highest one but it is inside window and it was not received yet*/
+	REPLAY_DUPLICATE = 2, /**< Counter was already received*/
+	REPLAY_TOO_OLD = 3 /**< Counter is out of window*/
+};
+
+/**
+  * @brief Binds counter epoch to message authentication by mixing it into additional authenticated data.
+  * Epoch 0 leaves data unchanged, so that messages are the same as without extended counters
+  * @param aad Additional authenticated data. At least 2 bytes long
+  * @param len Data length
+  * @param epoch Counter epoch
+  */
+inline void bindCounterEpoch (uint8_t* aad, size_t len, uint16_t epoch) {
+	aad[len - 2] ^= (uint8_t)epoch;
+	aad[len - 1] ^= (uint8_t)(epoch >> 8);
+}
+
+class ReplayWindow {
+protected:
+	uint32_t highest = 0; ///< @brief Highest extended counter accepted
+	uint32_t bitmap = 1; ///< @brief Bit n is set if counter `highest - n` has been accepted
+
+public:
+	/**
+	  * @brief Starts window again. Given counter is taken as already received
+	  * @param counter Extended counter
+	  */
+	void reset (uint32_t counter = 0) {
+		highest = counter;
+		bitmap = 1;
+	}
+
+	/**
+	  * @brief Gets highest extended counter accepted
+	  * @return Extended counter
+	  */
+	uint32_t getHighest () {
+		return highest;
+	}
+
+	/**
+	  * @brief Gets epoch that messages are expected to use
+	  * @return Counter epoch
+	  */
+	uint16_t getEpoch () {
+		return highest >> 16;
+	}
+
+	/**
+	  * @brief Gets epochs that a new message may have been authenticated with, most likely first.
+	  * Next epoch is only expected on second half of current one and previous epoch only while window still reaches it
+	  * @param epochs Array of 2 elements to write epochs to
+	  * @return Number of epochs, 1 or 2
+	  */
+	int getEpochCandidates (uint16_t* epochs);
+
+	/**
+	  * @brief Extends a 16 bit counter to the closest value to highest counter. Used when epoch is not authenticated,
+	  * as in unencrypted messages
+	  * @param counter 16 bit counter
+	  * @return Extended counter
+	  */
+	uint32_t extend (uint16_t counter);
+
+	/**
+	  * @brief Checks a counter and records it if it was not received before
+	  * @param counter Extended counter
+	  * @param lost Filled with number of counters skipped by a new highest counter. May be `NULL`
+	  * @return Check result. Message should only be processed if it is `REPLAY_NEW` or `REPLAY_LATE`
+	  */
+	replay_result_t accept (uint32_t counter, uint32_t* lost = NULL);
+};
+
+#endif // _REPLAYWINDOW_h
@@ -0,0 +1,316 @@
+/**
+  * @file schemaCodec.cpp
+  * @version 0.9.7
+  * @date 04/02/2021
+  * @author German Martin
+  * @brief Compact encoding of periodic readings based on a schema that node registers on gateway
+  */
+
+#include "schemaCodec.h"
+#include "cryptModule.h"
+#include "EnigmaIOTdebug.h"
+
+static const uint8_t KEY_FRAME_FLAG = 0x80; ///< @brief Sequence bit that marks a key frame
+static const uint8_t SEQUENCE_MASK = 0x7F; ///< @brief Sequence bits that identify a key frame
+static const int32_t POWERS_OF_TEN[SCHEMA_MAX_DECIMALS + 1] = { 1, 10, 100, 1000, 10000, 100000, 1000000 };
+
+static size_t putVarint (uint8_t* output, size_t outputLen, size_t idx, int64_t value) {
+	uint64_t zigzag = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+
+	do {
+		if (idx >= outputLen) {
+			return 0;
+		}
+		uint8_t data = zigzag & 0x7F;
+		zigzag >>= 7;
+		output[idx++] = zigzag ? data | 0x80 : data;
+	} while (zigzag);
+	return idx;
+}
+
+static bool getVarint (const uint8_t* input, size_t inputLen, size_t& idx, int64_t& value) {
+	uint64_t zigzag = 0;
+
+	for (uint8_t shift = 0; shift < 64; shift += 7) {
+		if (idx >= inputLen) {
+			return false;
+		}
+		uint8_t data = input[idx++];
+		zigzag |= (uint64_t)(data & 0x7F) << shift;
+		if (!(data & 0x80)) {
+			value = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+			return true;
+		}
+	}
+	return false;
+}
+
+static size_t putBigEndian (uint8_t* output, size_t idx, uint64_t value, uint8_t size) {
+	for (int i = size - 1; i >= 0; i--) {
+		output[idx++] = (uint8_t)(value >> (8 * i));
+	}
+	return idx;
+}
+
+static int32_t scaleValue (float value, const schema_field_t* field) {
+	if (field->type == SCHEMA_BOOL) {
+		return value != 0;
+	}
+	if (isnan (value)) {
+		return 0;
+	}
+
+	double scaled = (double)value * POWERS_OF_TEN[field->decimals];
+
+	if (scaled >= INT32_MAX) {
+		return INT32_MAX;
+	}
+	if (scaled <= INT32_MIN) {
+		return INT32_MIN;
+	}
+	return (int32_t)(scaled < 0 ? scaled - 0.5 : scaled + 0.5);
+}
+
+bool SchemaEncoder::setSchema (const schema_field_t* fields, uint8_t count) {
+	uint8_t definition[SCHEMA_MAX_DEFINITION_LENGTH];
+
+	if (!fields || count == 0 || count > SCHEMA_MAX_FIELDS) {
+		DEBUG_WARN ("Wrong schema field count: %u", count);
+		return false;
+	}
+	for (int i = 0; i < count; i++) {
+		size_t nameLen = fields[i].name ? strlen (fields[i].name) : 0;
+		if (nameLen == 0 || nameLen > SCHEMA_FIELD_NAME_LENGTH || fields[i].type > SCHEMA_BOOL || fields[i].decimals > SCHEMA_MAX_DECIMALS) {
+			DEBUG_WARN ("Wrong schema field %d", i);
+			return false;
+		}
+	}
+
+	this->fields = fields;
+	fieldCount = count;
+	size_t len = buildDefinition (definition, sizeof (definition));
+	schemaId = SchemaDecoder::calculateId (definition + sizeof (uint16_t), len - sizeof (uint16_t));
+	memcpy (definition, &schemaId, sizeof (uint16_t));
+	keySequence = CryptModule::random () & SEQUENCE_MASK; // Gateway may keep a key frame from a previous boot
+	keyValid = false;
+	DEBUG_DBG ("Schema 0x%04X set. %u fields", schemaId, count);
+	return true;
+}
+
+size_t SchemaEncoder::buildDefinition (uint8_t* output, size_t outputLen) {
+	size_t idx = SCHEMA_HEADER_LENGTH;
+
+	if (!fields || !output || outputLen < SCHEMA_HEADER_LENGTH) {
+		return 0;
+	}
+
+	memcpy (output, &schemaId, sizeof (uint16_t));
+	output[2] = fieldCount;
+	for (int i = 0; i < fieldCount; i++) {
+		uint8_t nameLen = strlen (fields[i].name);
+		if (idx + 3 + nameLen > outputLen) {
+			return 0;
+		}
+		output[idx++] = fields[i].type;
+		output[idx++] = fields[i].type == SCHEMA_BOOL ? 0 : fields[i].decimals;
+		output[idx++] = nameLen;
+		memcpy (output + idx, fields[i].name, nameLen);
+		idx += nameLen;
+	}
+	return idx;
+}
+
+size_t SchemaEncoder::encode (const float* values, uint8_t* output, size_t outputLen) {
+	int32_t raw[SCHEMA_MAX_FIELDS];
+	bool keyFrame = !keyValid || framesSinceKey >= SCHEMA_KEY_FRAME_INTERVAL;
+	uint8_t sequence = keyFrame ? (keySequence + 1) & SEQUENCE_MASK : keySequence;
+	size_t idx = SCHEMA_HEADER_LENGTH;
+
+	if (!fields || !values || !output || outputLen < SCHEMA_HEADER_LENGTH) {
+		return 0;
+	}
+
+	memcpy (output, &schemaId, sizeof (uint16_t));
+	output[2] = keyFrame ? sequence | KEY_FRAME_FLAG : sequence;
+	for (int i = 0; i < fieldCount; i++) {
+		raw[i] = scaleValue (values[i], &(fields[i]));
+		idx = putVarint (output, outputLen, idx, keyFrame ? (int64_t)raw[i] : (int64_t)raw[i] - keyValues[i]);
+		if (!idx) {
+			return 0;
+		}
+	}
+
+	// State only changes when message has been built
+	if (keyFrame) {
+		memcpy (keyValues, raw, fieldCount * sizeof (int32_t));
+		keySequence = sequence;
+		keyValid = true;
+		framesSinceKey = 0;
+	} else {
+		framesSinceKey++;
+	}
+	DEBUG_DBG ("Schema data %s. Sequence %u. Length %u", keyFrame ? "key frame" : "delta", sequence, idx);
+	return idx;
+}
+
+bool SchemaDecoder::setDefinition (const uint8_t* data, size_t len) {
+	uint16_t id;
+	uint8_t count;
+	size_t idx = SCHEMA_HEADER_LENGTH;
+
+	if (!data || len < SCHEMA_HEADER_LENGTH) {
+		return false;
+	}
+	memcpy (&id, data, sizeof (uint16_t));
+	count = data[2];
+	if (count == 0 || count > SCHEMA_MAX_FIELDS) {
+		DEBUG_WARN ("Wrong schema field count: %u", count);
+		return false;
+	}
+	for (int i = 0; i < count; i++) {
+		if (idx + 3 > len || data[idx] > SCHEMA_BOOL || data[idx + 1] > SCHEMA_MAX_DECIMALS
+			|| data[idx + 2] == 0 || data[idx + 2] > SCHEMA_FIELD_NAME_LENGTH || idx + 3 + data[idx + 2] > len) {
+			DEBUG_WARN ("Wrong schema field %d", i);
+			return false;
+		}
+		idx += 3 + data[idx + 2];
+	}
+	if (idx != len || calculateId (data + sizeof (uint16_t), len - sizeof (uint16_t)) != id) {
+		DEBUG_WARN ("Wrong schema definition");
+		return false;
+	}
+
+	failedMessages = 0;
+	if (definition && id == schemaId) {
+		return true; // Same schema. Key frame is still valid
+	}
+
+	clear ();
+	definition = (uint8_t*)malloc (len - SCHEMA_HEADER_LENGTH);
+	keyValues = (int32_t*)malloc (count * sizeof (int32_t));
+	if (!definition || !keyValues) {
+		DEBUG_ERROR ("Cannot allocate schema");
+		clear ();
+		return false;
+	}
+	memcpy (definition, data + SCHEMA_HEADER_LENGTH, len - SCHEMA_HEADER_LENGTH);
+	fieldCount = count;
+	schemaId = id;
+	DEBUG_DBG ("Schema 0x%04X stored. %u fields", id, count);
+	return true;
+}
+
+schema_result_t SchemaDecoder::expand (const uint8_t* data, size_t len, uint8_t* output, size_t& outputLen) {
+	int32_t raw[SCHEMA_MAX_FIELDS];
+	uint16_t id;
+	size_t idx = SCHEMA_HEADER_LENGTH;
+	size_t outIdx = 0;
+
+	if (!data || len < SCHEMA_HEADER_LENGTH || !output || outputLen < SCHEMA_MAX_EXPANDED_LENGTH) {
+		return SCHEMA_WRONG;
+	}
+
+	memcpy (&id, data, sizeof (uint16_t));
+	bool keyFrame = data[2] & KEY_FRAME_FLAG;
+	uint8_t sequence = data[2] & SEQUENCE_MASK;
+
+	if (!definition || id != schemaId) {
+		DEBUG_INFO ("Unknown schema 0x%04X", id);
+		failedMessages++;
+		return SCHEMA_UNKNOWN;
+	}
+	if (!keyFrame && (!keyValid || sequence != keySequence)) {
+		DEBUG_INFO ("Key frame %u not received", sequence);
+		failedMessages++;
+		return SCHEMA_UNKNOWN;
+	}
+
+	for (int i = 0; i < fieldCount; i++) {
+		int64_t value;
+		if (!getVarint (data, len, idx, value)) {
+			return SCHEMA_WRONG;
+		}
+		if (!keyFrame) {
+			value += keyValues[i];
+		}
+		if (value > INT32_MAX || value < INT32_MIN) {
+			return SCHEMA_WRONG;
+		}
+		raw[i] = value;
+	}
+	if (idx != len) {
+		return SCHEMA_WRONG;
+	}
+
+	if (keyFrame) {
+		memcpy (keyValues, raw, fieldCount * sizeof (int32_t));
+		keySequence = sequence;
+		keyValid = true;
+	}
+	failedMessages = 0;
+
+	// Map header
+	if (fieldCount < 16) {
+		output[outIdx++] = 0x80 | fieldCount;
+	} else {
+		output[outIdx++] = 0xde;
+		outIdx = putBigEndian (output, outIdx, fieldCount, 2);
+	}
+
+	const uint8_t* field = definition;
+	for (int i = 0; i < fieldCount; i++) {
+		uint8_t type = field[0];
+		uint8_t decimals = field[1];
+		uint8_t nameLen = field[2];
+
+		output[outIdx++] = 0xa0 | nameLen;
+		memcpy (output + outIdx, field + 3, nameLen);
+		outIdx += nameLen;
+		field += 3 + nameLen;
+
+		if (type == SCHEMA_BOOL) {
+			output[outIdx++] = raw[i] ? 0xc3 : 0xc2;
+		} else if (decimals > 0) {
+			double value = (double)raw[i] / POWERS_OF_TEN[decimals];
+			uint64_t bits;
+			memcpy (&bits, &value, sizeof (double));
+			output[outIdx++] = 0xcb;
+			outIdx = putBigEndian (output, outIdx, bits, 8);
+		} else if (raw[i] >= 0 && raw[i] < 128) {
+			output[outIdx++] = raw[i];
+		} else if (raw[i] < 0 && raw[i] >= -32) {
+			output[outIdx++] = (uint8_t)(int8_t)raw[i];
+		} else {
+			output[outIdx++] = 0xd2;
+			outIdx = putBigEndian (output, outIdx, (uint32_t)raw[i], 4);
+		}
+	}
+	outputLen = outIdx;
+	return SCHEMA_EXPANDED;
+}
+
+bool SchemaDecoder::shouldRequest () {
+	return failedMessages == 1 || (failedMessages > 0 && failedMessages % SCHEMA_REQUEST_INTERVAL == 0);
+}
+
+void SchemaDecoder::clear () {
+	if (definition) {
+		free (definition);
+		definition = NULL;
+	}
+	if (keyValues) {
+		free (keyValues);
+		keyValues = NULL;
+	}
+	fieldCount = 0;
+	keyValid = false;
+}
+
+uint16_t SchemaDecoder::calculateId (const uint8_t* data, size_t len) {
+	uint32_t hash = 2166136261UL; // FNV-1a
+
+	for (size_t i = 0; i < len; i++) {
+		hash = (hash ^ data[i]) * 16777619UL;
+	}
+	return (uint16_t)(hash >> 16) ^ (uint16_t)hash;
+}
@@ -0,0 +1,188 @@
+/**
+  * @file schemaCodec.h
+  * @version 0.9.7
+  * @date 04/02/2021
+  * @author German Martin
+  * @brief Compact encoding of periodic readings based on a schema that node registers on gateway
+  *
+  * Node describes its readings once with a schema definition, sent with `SCHEMA_DEF` payload encoding:
+  *
+  * | Schema id (2) | Field count (1) | Type (1) | Decimals (1) | Name length (1) | Name (....) | ... |
+  *
+  * After that, readings are sent with `SCHEMA_DATA` encoding and they only carry field values, in schema order:
+  *
+  * | Schema id (2) | Sequence (1) | Value (....) | ... |
+  *
+  * Every value is sent as the integer `value * 10^decimals`, encoded as a zigzag varint. If sequence bit 7 is set message is a key frame
+  * and values are absolute. Otherwise values are differences to the key frame whose sequence is on bits 0-6, so that a lost message
+  * does not affect the next ones. Schema id is a hash of definition, so that gateway detects schema changes.
+  *
+  * Gateway expands readings to a MsgPack map that uses field names as keys, so that application gets them as any other MsgPack payload.
+  */
+
+#ifndef _SCHEMACODEC_h
+#define _SCHEMACODEC_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include "EnigmaIoTconfig.h"
+
+static const uint8_t SCHEMA_MAX_DECIMALS = 6; ///< @brief Maximum number of decimals of a schema field
+static const size_t SCHEMA_HEADER_LENGTH = 3; ///< @brief Schema id (2) and field count (1) or sequence (1) that start every schema message
+static const size_t SCHEMA_MAX_DEFINITION_LENGTH = SCHEMA_HEADER_LENGTH + SCHEMA_MAX_FIELDS * (3 + SCHEMA_FIELD_NAME_LENGTH); ///< @brief Longest schema definition message
+static const size_t SCHEMA_MAX_EXPANDED_LENGTH = 3 + SCHEMA_MAX_FIELDS * (1 + SCHEMA_FIELD_NAME_LENGTH + 9); ///< @brief Longest MsgPack map that a schema data message is expanded to
+
+/**
+  * @brief Schema field types
+  */
+enum schemaFieldType_t {
+	SCHEMA_NUMBER = 0x00, /**< Number. It is sent with `decimals` decimal digits*/
+	SCHEMA_BOOL = 0x01 /**< Boolean. Any value different from 0 is true*/
+};
+
+/**
+  * @brief Description of a schema field. Field id is its position on schema
+  */
+typedef struct {
+	const char* name; /**< Field name. It is used as key when gateway expands data. Up to `SCHEMA_FIELD_NAME_LENGTH` characters*/
+	schemaFieldType_t type; /**< Field type*/
+	uint8_t decimals; /**< Number of decimals that are kept. Up to `SCHEMA_MAX_DECIMALS`*/
+} schema_field_t;
+
+/**
+  * @brief Result of expanding a schema data message
+  */
+enum schema_result_t {
+	SCHEMA_EXPANDED, /**< Data was expanded*/
+	SCHEMA_UNKNOWN, /**< Schema or key frame that message refers to is not known. Node has to send them again*/
+	SCHEMA_WRONG /**< Message format is not valid*/
+};
+
+/**
+  * @brief Builds schema messages on node. It keeps last key frame so that next readings are sent as differences to it
+  */
+class SchemaEncoder {
+protected:
+	const schema_field_t* fields = NULL; ///< @brief Field descriptions. `NULL` if no schema is set
+	uint8_t fieldCount = 0; ///< @brief Number of fields
+	uint16_t schemaId = 0; ///< @brief Hash of schema definition
+	int32_t keyValues[SCHEMA_MAX_FIELDS]; ///< @brief Values sent on last key frame
+	uint8_t keySequence = 0; ///< @brief Sequence of last key frame
+	uint8_t framesSinceKey = 0; ///< @brief Number of messages sent after last key frame
+	bool keyValid = false; ///< @brief `true` if a key frame has been sent since schema was set or key frame was requested
+
+public:
+	/**
+	  * @brief Sets schema. Field array is not copied, so it has to be kept while it is used
+	  * @param fields Field descriptions
+	  * @param count Number of fields. Up to `SCHEMA_MAX_FIELDS`
+	  * @return `true` if schema is valid
+	  */
+	bool setSchema (const schema_field_t* fields, uint8_t count);
+
+	/**
+	  * @brief Checks if a schema has been set
+	  * @return `true` if schema is set
+	  */
+	bool isSet () {
+		return fields != NULL;
+	}
+
+	/**
+	  * @brief Gets schema id
+	  * @return Hash of schema definition
+	  */
+	uint16_t getSchemaId () {
+		return schemaId;
+	}
+
+	/**
+	  * @brief Makes next message a key frame
+	  */
+	void forceKeyFrame () {
+		keyValid = false;
+	}
+
+	/**
+	  * @brief Builds schema definition message
+	  * @param output Buffer to write definition to. It should be `SCHEMA_MAX_DEFINITION_LENGTH` bytes long
+	  * @param outputLen Output buffer size
+	  * @return Definition length. 0 if there is no schema or it does not fit on buffer
+	  */
+	size_t buildDefinition (uint8_t* output, size_t outputLen);
+
+	/**
+	  * @brief Builds a data message. A key frame is built every `SCHEMA_KEY_FRAME_INTERVAL` messages
+	  * @param values One value for every field, in schema order
+	  * @param output Buffer to write message to
+	  * @param outputLen Output buffer size
+	  * @return Message length. 0 if there is no schema or it does not fit on buffer
+	  */
+	size_t encode (const float* values, uint8_t* output, size_t outputLen);
+};
+
+/**
+  * @brief Expands schema messages on gateway. Memory for schema is only allocated when node sends its definition
+  */
+class SchemaDecoder {
+protected:
+	uint8_t* definition = NULL; ///< @brief Field descriptions, as they are on definition message after its header. `NULL` if schema is not known
+	int32_t* keyValues = NULL; ///< @brief Values of last key frame. One for every field
+	uint8_t fieldCount = 0; ///< @brief Number of fields
+	uint16_t schemaId = 0; ///< @brief Hash of schema definition
+	uint8_t keySequence = 0; ///< @brief Sequence of last key frame
+	bool keyValid = false; ///< @brief `true` if a key frame has been received for current schema
+	uint8_t failedMessages = 0; ///< @brief Number of messages that could not be expanded since last schema request
+
+public:
+	/**
+	  * @brief Frees schema memory
+	  */
+	~SchemaDecoder () {
+		clear ();
+	}
+
+	/**
+	  * @brief Stores a schema definition. It replaces previous one
+	  * @param data Definition message
+	  * @param len Definition message length
+	  * @return `true` if definition is valid
+	  */
+	bool setDefinition (const uint8_t* data, size_t len);
+
+	/**
+	  * @brief Expands a data message to a MsgPack map
+	  * @param data Data message
+	  * @param len Data message length
+	  * @param output Buffer to write MsgPack map to. It should be `SCHEMA_MAX_EXPANDED_LENGTH` bytes long
+	  * @param outputLen Output buffer size. It is updated with MsgPack data length
+	  * @return Expansion result
+	  */
+	schema_result_t expand (const uint8_t* data, size_t len, uint8_t* output, size_t& outputLen);
+
+	/**
+	  * @brief Tells if node should be asked to send its schema again. It is true for first message that cannot be expanded
+	  * and then once every `SCHEMA_REQUEST_INTERVAL` messages, so that a lost request is repeated
+	  * @return `true` if schema has to be requested
+	  */
+	bool shouldRequest ();
+
+	/**
+	  * @brief Discards schema and frees its memory
+	  */
+	void clear ();
+
+	/**
+	  * @brief Calculates schema id from field descriptions
+	  * @param data Field descriptions, starting at field count
+	  * @param len Field descriptions length
+	  * @return Schema id
+	  */
+	static uint16_t calculateId (const uint8_t* data, size_t len);
+};
+
+#endif // _SCHEMACODEC_h
@@ -9,26 +9,70 @@
 #include "timeManager.h"
 #include "EnigmaIOTdebug.h"
 
-int64_t TimeManagerClass::clock () {
+int64_t TimeManagerClass::systemClock () {
     timeval currentime;
-    
+
     gettimeofday (&currentime, NULL);
     int64_t clk = currentime.tv_sec;
     clk *= 1000000L;
     clk += currentime.tv_usec;
+    return clk;
+}
+
+int64_t TimeManagerClass::correction (int64_t sysTime, int64_t* slew) {
+    int64_t elapsed = sysTime - refTime;
+    int64_t slewed = elapsed * CLOCK_SLEW_RATE / 1000000LL;
+
+    if (slewRemaining >= 0) {
+        slewed = slewed < slewRemaining ? slewed : slewRemaining;
+    } else {
+        slewed = slewed < -slewRemaining ? -slewed : slewRemaining;
+    }
+    if (slew) {
+        *slew = slewed;
+    }
+    return refCorrection + elapsed * drift / 1000000000LL + slewed;
+}
+
+void TimeManagerClass::rebase (int64_t sysTime) {
+    int64_t slewed;
+
+    refCorrection = correction (sysTime, &slewed);
+    slewRemaining -= slewed;
+    refTime = sysTime;
+}
+
+void TimeManagerClass::stepClock (int64_t step) {
+    timeval newtime;
+    int64_t sysTime = systemClock ();
+    int64_t newtime_us;
+
+    rebase (sysTime);
+    newtime_us = sysTime + step;
+    newtime.tv_sec = newtime_us / 1000000LL;
+    newtime.tv_usec = newtime_us - ((int64_t)(newtime.tv_sec) * 1000000LL);
+
+    settimeofday (&newtime, NULL); // hard adjustment
+
+    // Keep correction reference on the same point of time
+    refTime += step;
+    slewRemaining = 0;
+    sampleCount = 0;
+    nextSample = 0;
+    lastUsedSample = newtime_us + refCorrection;
+    driftRefTime = lastUsedSample;
+    DEBUG_DBG ("Clock stepped %lld us", step);
+}
+
+int64_t TimeManagerClass::clock () {
     // DEBUG_DBG ("Clock: %lld", clk/1000L);
-    return clk/1000L;
+    return clock_us () / 1000L;
 }
 
 int64_t TimeManagerClass::clock_us () {
-    timeval currentime;
-
-    gettimeofday (&currentime, NULL);
-    int64_t clk = currentime.tv_sec;
-    clk *= 1000000L;
-    clk += currentime.tv_usec;
+    int64_t clk = systemClock ();
     // DEBUG_DBG ("Clock: %lld", clk);
-    return clk;
+    return clk + correction (clk);
 }
 
 int64_t TimeManagerClass::adjustTime (int64_t t1r, int64_t t2r, int64_t t3r, int64_t t4r) {
@@ -36,31 +80,93 @@ int64_t TimeManagerClass::adjustTime (int64_t t1r, int64_t t2r, int64_t t3r, int
 	int64_t t2 = t2r;
 	int64_t t3 = t3r;
 	int64_t t4 = t4r;
-    timeval currenttime;
-    int64_t currenttime_us;
-    timeval newtime;
-    int64_t newtime_us;
 
 	DEBUG_DBG ("T1: %lld, T2: %lld, T3: %lld, T4: %lld", t1, t2, t3, t4);
 	offset = ((t2 - t1) + (t3 - t4)) / 2L;
     DEBUG_DBG ("New offset: %lld", offset);
 	roundTripDelay = (t4 - t1) - (t3 - t2);
     DEBUG_DBG ("Round trip delay: %lld", roundTripDelay);
-    
-    gettimeofday (&currenttime, NULL);
-    currenttime_us = (int64_t)currenttime.tv_sec * 1000000LL + (int64_t)currenttime.tv_usec;
-    newtime_us = currenttime_us + offset;
-    newtime.tv_sec = newtime_us / 1000000LL;
-    newtime.tv_usec = newtime_us - ((int64_t)(newtime.tv_sec) * 1000000LL);
-    
-    settimeofday (&newtime, NULL); // hard adjustment
 
-	timeIsAdjusted = true;
+    if (!timeIsAdjusted) {
+        stepClock (offset);
+        timeIsAdjusted = true;
+        return offset;
+    }
+
+    int64_t sysTime = systemClock ();
+    time_sample_t* sample = &(samples[nextSample]);
+
+    sample->offset = offset;
+    sample->delay = roundTripDelay;
+    sample->correction = correction (sysTime);
+    sample->time = sysTime + sample->correction;
+    nextSample = (nextSample + 1) % TIME_SYNC_SAMPLES;
+    if (sampleCount < TIME_SYNC_SAMPLES) {
+        sampleCount++;
+    }
+
+    // Use sample with lowest delay, as it is the one that has less asymmetry error. Older samples are penalized
+    time_sample_t* best = NULL;
+    int64_t bestScore = 0;
+    for (int i = 0; i < sampleCount; i++) {
+        int64_t score = samples[i].delay + (sample->time - samples[i].time) * 2 * TIME_SAMPLE_DISPERSION / 1000000LL;
+        if (!best || score < bestScore) {
+            best = &(samples[i]);
+            bestScore = score;
+        }
+    }
+
+    rebase (sysTime);
+    // Sample offset has already been reduced by correction applied since it was taken
+    int64_t currentOffset = best->offset - (refCorrection - best->correction);
+
+    if (currentOffset > CLOCK_STEP_THRESHOLD || currentOffset < -CLOCK_STEP_THRESHOLD) {
+        stepClock (currentOffset);
+        return offset;
+    }
+
+    // Error still not corrected after slewing is caused by drift estimation error. A sample is used only once for this
+    if (best->time > lastUsedSample) {
+        int64_t driftInterval = best->time - driftRefTime;
+        int64_t driftError = (currentOffset - slewRemaining) * 1000000000LL / driftInterval;
+        int64_t weight = driftInterval / 1000L;
+        weight = weight * 1024 / (weight + CLOCK_DRIFT_TIME_CONSTANT);
+        setDrift (drift + driftError * weight / 1024);
+        lastUsedSample = best->time;
+        DEBUG_DBG ("Drift error %lld ppb. New drift %d ppb", driftError, drift);
+    } else {
+        DEBUG_DBG ("Sample discarded. Delay %lld is higher than a previous one", roundTripDelay);
+    }
+
+    slewRemaining = currentOffset;
+    driftRefTime = best->time;
+    DEBUG_DBG ("Slewing %lld us", currentOffset);
 
     return offset;
 }
 
+void TimeManagerClass::setDrift (int32_t drift) {
+    const int32_t MAX_DRIFT_PPB = MAX_CLOCK_DRIFT * 1000L;
 
+    rebase (systemClock ());
+    if (drift > MAX_DRIFT_PPB) {
+        drift = MAX_DRIFT_PPB;
+    } else if (drift < -MAX_DRIFT_PPB) {
+        drift = -MAX_DRIFT_PPB;
+    }
+    this->drift = drift;
+}
 
-TimeManagerClass TimeManager;
+void TimeManagerClass::reset () {
+    offset = 0;
+    timeIsAdjusted = false;
+    sampleCount = 0;
+    nextSample = 0;
+    lastUsedSample = 0;
+    refTime = systemClock ();
+    refCorrection = 0;
+    slewRemaining = 0;
+}
 
+
+TimeManagerClass TimeManager;
@@ -11,12 +11,65 @@
 
 #include <Arduino.h>
 #include "sys/time.h"
+#include "EnigmaIoTconfig.h"
 
+/**
+  * @brief Result of a clock synchronization exchange
+  */
+struct time_sample_t {
+    int64_t offset; /**< Offset between gateway time and local clock when sample was taken. us units */
+    int64_t delay; /**< Round trip delay of exchange. us units */
+    int64_t correction; /**< Software correction applied to local clock when sample was taken. us units */
+    int64_t time; /**< Local clock value when sample was taken. us units */
+};
+
+/**
+  * @brief Local clock synchronized to gateway time.
+  *
+  * System clock is stepped only on first synchronization or if offset is higher than `CLOCK_STEP_THRESHOLD`.
+  * After that, offset is corrected slewing clock at `CLOCK_SLEW_RATE`, and crystal drift is estimated from consecutive samples
+  * and compensated continuously. Both corrections are applied by software on top of system clock.
+  */
 class TimeManagerClass {
 protected:
     bool timeIsAdjusted = false; ///< @brief Indicates if time has been synchronized
-    int64_t offset = 0; ///< @brief Offet between node `millis()` and gateway time
-    int64_t roundTripDelay; ///< @brief Propagation delay between Node and Gateway
+    int64_t offset = 0; ///< @brief Offet between node clock and gateway time on last sample
+    int64_t roundTripDelay; ///< @brief Propagation delay between Node and Gateway on last sample
+    time_sample_t samples[TIME_SYNC_SAMPLES]; ///< @brief Last synchronization samples
+    uint8_t sampleCount = 0; ///< @brief Number of valid samples
+    uint8_t nextSample = 0; ///< @brief Position of next sample
+    int64_t lastUsedSample = 0; ///< @brief Local clock value of last sample used to adjust clock. Older samples are not used again
+    int64_t refTime = 0; ///< @brief System clock when correction was last updated. us units
+    int64_t refCorrection = 0; ///< @brief Software correction at `refTime`. us units
+    int64_t slewRemaining = 0; ///< @brief Offset still to be slewed since `refTime`. us units
+    int32_t drift = 0; ///< @brief Estimated local clock drift. Positive if local clock is slow. ppb units
+    int64_t driftRefTime = 0; ///< @brief Local clock value of sample used for current slewing. Drift is estimated from error accumulated since then. us units
+
+    /**
+      * @brief Gets system clock, without software correction
+      * @return System clock in microseconds
+      */
+    int64_t systemClock ();
+
+    /**
+      * @brief Calculates software correction for a given system clock value
+      * @param sysTime System clock in microseconds
+      * @param slew Offset that has been slewed since `refTime` is written here, if it is not NULL
+      * @return Correction in microseconds
+      */
+    int64_t correction (int64_t sysTime, int64_t* slew = NULL);
+
+    /**
+      * @brief Moves correction reference to current time. Correction value does not change
+      * @param sysTime Current system clock in microseconds
+      */
+    void rebase (int64_t sysTime);
+
+    /**
+      * @brief Adds a step to system clock. Stored samples are discarded as they are not valid anymore
+      * @param step Step in microseconds
+      */
+    void stepClock (int64_t step);
 
 public:
     /**
@@ -24,7 +77,7 @@ public:
       * @return Clock value in milliseconds
       */
     int64_t clock ();
-    
+
     /**
       * @brief Gets local clock.
       * @return Clock value in microseconds
@@ -43,12 +96,13 @@ public:
     }
 
      /**
-      * @brief Gets delay between Gateway time and local clock and adjust local clock accordingly. It uses same procedure as SNTP protocol.
+      * @brief Adds a synchronization sample, calculated as in SNTP protocol, and adjusts local clock using sample with lowest
+      *        round trip delay. Drift is estimated every time a new sample is used
       * @param t1r T1
       * @param t2r T2
       * @param t3r T3
       * @param t4r T4
-      * @return Clock value in seconds. It uses UnixTime format
+      * @return Offset of this sample in microseconds
       */
     int64_t adjustTime (int64_t t1r, int64_t t2r, int64_t t3r, int64_t t4r);
 
@@ -77,15 +131,25 @@ public:
     }
 
     /**
-      * @brief Resets clock synchronization and sets values to initial status
+      * @brief Gets estimated local clock drift
+      * @return Drift in ppb. Positive if local clock is slow
+      */
+    int32_t getDrift () {
+        return drift;
+    }
+
+    /**
+      * @brief Sets local clock drift, usually restored from a previous estimation
+      * @param drift Drift in ppb. Positive if local clock is slow
       */
-	void reset () {
-		offset = 0;
-		timeIsAdjusted = false;
-	}
+    void setDrift (int32_t drift);
+
+    /**
+      * @brief Resets clock synchronization and sets values to initial status. Drift estimation is kept as it depends on node hardware
+      */
+    void reset ();
 };
 
 extern TimeManagerClass TimeManager;
 
 #endif
-
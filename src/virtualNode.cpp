@@ -0,0 +1,181 @@
+/**
+  * @file virtualNode.cpp
+  * @version 0.9.7
+  * @date 04/02/2021
+  * @author German Martin
+  * @brief Emulated node session, used to test and benchmark gateways without a board per node
+  */
+
+#include "virtualNode.h"
+#include "EnigmaIOTNode.h"
+#include <Curve25519.h>
+
+void VirtualNode::begin (const uint8_t* mac, const uint8_t* networkKey, bool sleepy) {
+	memcpy (this->mac, mac, ENIGMAIOT_ADDR_LEN);
+	this->networkKey = networkKey;
+	this->sleepy = sleepy;
+	registered = false;
+	counter = 0;
+	epoch = 0;
+}
+
+size_t VirtualNode::clientHello (uint8_t* buf) {
+	/*
+	* -----------------------------------------------------------------------------------------------------------------------------
+	*| msgType (1) | IV (12) | DH Kmaster (32) | Random (30 bits) | Broadcast (1 bit) | Sleepy (1 bit) | [Ciphers (1)] | Tag (16) |
+	* -----------------------------------------------------------------------------------------------------------------------------
+	*/
+
+	struct __attribute__ ((packed, aligned (1))) {
+		uint8_t msgType;
+		uint8_t iv[IV_LENGTH];
+		uint8_t publicKey[KEY_LENGTH];
+		uint32_t random;
+		uint8_t ciphers;
+		uint8_t tag[TAG_LENGTH];
+	} clientHello_msg;
+
+	const uint8_t addDataLen = 1 + IV_LENGTH;
+	uint8_t aad[AAD_LENGTH + addDataLen];
+
+	if (!networkKey) {
+		return 0;
+	}
+	registered = false;
+
+	clientHello_msg.msgType = CLIENT_HELLO;
+	CryptModule::random (clientHello_msg.iv, IV_LENGTH);
+	// Every node has its own key pair. CryptModule keeps a single one
+	Curve25519::dh1 (clientHello_msg.publicKey, privateKey);
+	uint32_t random = Crypto.random () & 0xFFFFFFFCU; // Broadcast is never requested
+	if (sleepy) {
+		random |= 0x00000001U;
+	}
+	memcpy (&(clientHello_msg.random), &random, RANDOM_LENGTH);
+	clientHello_msg.ciphers = SUPPORTED_CIPHERS;
+
+	memcpy (aad, (uint8_t*)&clientHello_msg, addDataLen); // Copy message upto iv
+	memcpy (aad + addDataLen, networkKey + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH);
+
+	if (!CryptModule::encryptBuffer (clientHello_msg.publicKey, KEY_LENGTH + sizeof (uint32_t) + sizeof (uint8_t),
+									 clientHello_msg.iv, IV_LENGTH,
+									 networkKey, KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of network key
+									 aad, sizeof (aad), clientHello_msg.tag, TAG_LENGTH)) {
+		return 0;
+	}
+
+	memcpy (buf, &clientHello_msg, sizeof (clientHello_msg));
+	return sizeof (clientHello_msg);
+}
+
+bool VirtualNode::processServerHello (const uint8_t* buf, size_t count) {
+	/*
+	* -----------------------------------------------------------------------------------------------
+	*| msgType (1) | IV (12) | DH Kslave (32) | NodeID (2) | Random (4) | [Cipher (1)] | Tag (16) |
+	* -----------------------------------------------------------------------------------------------
+	*/
+
+	struct __attribute__ ((packed, aligned (1))) {
+		uint8_t msgType;
+		uint8_t iv[IV_LENGTH];
+		uint8_t publicKey[KEY_LENGTH];
+		uint16_t nodeId;
+		uint32_t random;
+		uint8_t cipher;
+		uint8_t tag[TAG_LENGTH];
+	} serverHello_msg;
+
+	size_t encryptedLen = KEY_LENGTH + sizeof (uint16_t) + sizeof (uint32_t);
+	cipherAlgorithm_t selectedCipher = CHACHAPOLY_CIPHER;
+
+	// Cipher is only sent if it is not the default one
+	if (count == sizeof (serverHello_msg)) {
+		encryptedLen += sizeof (uint8_t);
+	} else if (count != sizeof (serverHello_msg) - sizeof (uint8_t)) {
+		return false;
+	}
+	if (!networkKey || registered) {
+		return false;
+	}
+	memcpy (&serverHello_msg, buf, count);
+
+	const uint8_t addDataLen = 1 + IV_LENGTH;
+	uint8_t aad[AAD_LENGTH + addDataLen];
+
+	memcpy (aad, (uint8_t*)&serverHello_msg, addDataLen); // Copy message upto iv
+	memcpy (aad + addDataLen, networkKey + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH);
+
+	if (!CryptModule::decryptBuffer (serverHello_msg.publicKey, encryptedLen,
+									 serverHello_msg.iv, IV_LENGTH,
+									 networkKey, KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of network key
+									 aad, sizeof (aad), buf + count - TAG_LENGTH, TAG_LENGTH)) {
+		return false;
+	}
+	if (count == sizeof (serverHello_msg)) {
+		if ((serverHello_msg.cipher != CHACHAPOLY_CIPHER && serverHello_msg.cipher != AES_GCM_CIPHER)
+			|| !(serverHello_msg.cipher & SUPPORTED_CIPHERS)) {
+			return false;
+		}
+		selectedCipher = (cipherAlgorithm_t)serverHello_msg.cipher;
+	}
+
+	if (!Curve25519::dh2 (serverHello_msg.publicKey, privateKey)) {
+		return false;
+	}
+	memcpy (key, CryptModule::getSHA256 (serverHello_msg.publicKey, KEY_LENGTH), KEY_LENGTH);
+	memcpy (&nodeId, &(serverHello_msg.nodeId), sizeof (uint16_t));
+	cipher = selectedCipher;
+	counter = 0;
+	epoch = 0;
+	registered = true;
+	return true;
+}
+
+size_t VirtualNode::dataMessage (uint8_t* buf, const uint8_t* data, size_t len, uint8_t encoding) {
+	/*
+	* ---------------------------------------------------------------------------------------------------------
+	*| msgType (1) | IV (12) | length (2) | NodeId (2) | Counter (2) | Encoding (1) | Data (....) | tag (16) |
+	* ---------------------------------------------------------------------------------------------------------
+	*/
+
+	const uint8_t iv_idx = 1;
+	const uint8_t length_idx = iv_idx + IV_LENGTH;
+	const uint8_t nodeId_idx = length_idx + sizeof (int16_t);
+	const uint8_t counter_idx = nodeId_idx + sizeof (int16_t);
+	const uint8_t encoding_idx = counter_idx + sizeof (int16_t);
+	const uint8_t data_idx = encoding_idx + sizeof (int8_t);
+
+	if (!registered || !data || len > MAX_DATA_PAYLOAD_SIZE) {
+		return 0;
+	}
+
+	uint16_t packet_length = data_idx + len;
+
+	buf[0] = SENSOR_DATA;
+	CryptModule::random (buf + iv_idx, IV_LENGTH);
+	memcpy (buf + length_idx, &packet_length, sizeof (uint16_t));
+	memcpy (buf + nodeId_idx, &nodeId, sizeof (uint16_t));
+	counter++;
+	if (counter == 0) {
+		epoch++;
+	}
+	memcpy (buf + counter_idx, &counter, sizeof (uint16_t));
+	buf[encoding_idx] = encoding;
+	memcpy (buf + data_idx, data, len);
+
+	const uint8_t addDataLen = 1 + IV_LENGTH;
+	uint8_t aad[AAD_LENGTH + addDataLen];
+
+	memcpy (aad, buf, addDataLen); // Copy message upto iv
+	memcpy (aad + addDataLen, key + KEY_LENGTH - AAD_LENGTH, AAD_LENGTH);
+	bindCounterEpoch (aad, sizeof (aad), epoch);
+
+	if (!CryptModule::encryptBuffer (buf + length_idx, packet_length - 1 - IV_LENGTH, // Encrypt from length
+									 buf + iv_idx, IV_LENGTH,
+									 key, KEY_LENGTH - AAD_LENGTH, // Use first 24 bytes of node key
+									 aad, sizeof (aad), buf + packet_length, TAG_LENGTH, cipher)) {
+		return 0;
+	}
+
+	return packet_length + TAG_LENGTH;
+}
@@ -0,0 +1,113 @@
+/**
+  * @file virtualNode.h
+  * @version 0.9.7
+  * @date 04/02/2021
+  * @author German Martin
+  * @brief Emulated node session, used to test and benchmark gateways without a board per node
+  *
+  * It builds and processes the same messages as a real node: key agreement with network key and encrypted data messages.
+  * It does not send anything by itself. Messages are written to a buffer so that caller may send them with any address
+  * on any communication layer. Many instances may be used at the same time, each one with its own address, key and counters.
+  */
+
+#ifndef _VIRTUALNODE_h
+#define _VIRTUALNODE_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include "EnigmaIoTconfig.h"
+#include "cryptModule.h"
+#include "replayWindow.h"
+
+class VirtualNode {
+protected:
+	uint8_t mac[ENIGMAIOT_ADDR_LEN]; ///< @brief Node address
+	const uint8_t* networkKey = NULL; ///< @brief Network key, hashed as gateway uses it. It is not copied
+	uint8_t privateKey[KEY_LENGTH]; ///< @brief Private key of current key agreement
+	uint8_t key[KEY_LENGTH]; ///< @brief Node key
+	cipherAlgorithm_t cipher = CHACHAPOLY_CIPHER; ///< @brief Cipher selected by gateway
+	uint16_t nodeId = 0; ///< @brief Node id given by gateway
+	uint16_t counter = 0; ///< @brief Last data message counter
+	uint16_t epoch = 0; ///< @brief Data counter epoch. Incremented every time counter wraps
+	bool sleepy = false; ///< @brief Signals gateway that node is sleepy, so that it answers every data message
+	bool registered = false; ///< @brief `true` after a valid Server Hello
+
+public:
+	/**
+	  * @brief Initializes node session
+	  * @param mac Node address
+	  * @param networkKey Network key, hashed with SHA256. It must be kept valid while node is used
+	  * @param sleepy Node signals itself as sleepy during key agreement
+	  */
+	void begin (const uint8_t* mac, const uint8_t* networkKey, bool sleepy = false);
+
+	/**
+	  * @brief Builds a Client Hello message to start a new key agreement. Node is unregistered until a Server Hello is processed
+	  * @param buf Buffer to write message to. It has to be at least `MAX_MESSAGE_LENGTH` bytes long
+	  * @return Message length. 0 in case of error
+	  */
+	size_t clientHello (uint8_t* buf);
+
+	/**
+	  * @brief Processes a Server Hello message and calculates node key
+	  * @param buf Message buffer
+	  * @param count Message length
+	  * @return `true` if message is valid and node is registered
+	  */
+	bool processServerHello (const uint8_t* buf, size_t count);
+
+	/**
+	  * @brief Builds an encrypted data message with next counter value
+	  * @param buf Buffer to write message to. It has to be at least `MAX_MESSAGE_LENGTH` bytes long
+	  * @param data Payload
+	  * @param len Payload length. Up to `MAX_DATA_PAYLOAD_SIZE`
+	  * @param encoding Payload encoding
+	  * @return Message length. 0 in case of error
+	  */
+	size_t dataMessage (uint8_t* buf, const uint8_t* data, size_t len, uint8_t encoding);
+
+	/**
+	  * @brief Marks node as unregistered, after gateway has invalidated its key
+	  */
+	void invalidate () {
+		registered = false;
+	}
+
+	/**
+	  * @brief Gets node address
+	  * @return Node address
+	  */
+	const uint8_t* getMacAddress () {
+		return mac;
+	}
+
+	/**
+	  * @brief Checks if node has a valid key
+	  * @return `true` if node is registered
+	  */
+	bool isRegistered () {
+		return registered;
+	}
+
+	/**
+	  * @brief Gets node id given by gateway
+	  * @return Node id
+	  */
+	uint16_t getNodeId () {
+		return nodeId;
+	}
+
+	/**
+	  * @brief Gets counter of last data message
+	  * @return Message counter
+	  */
+	uint16_t getCounter () {
+		return counter;
+	}
+};
+
+#endif // _VIRTUALNODE_h